@@ -0,0 +1,166 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "BackingFolderWatcher.h"
+
+#include <vector>
+
+#if defined(_WIN32)
+#include <cstring>
+
+#include "UTFConvert.h"
+
+// Size of the buffer receiving the change notifications. Changes are lost
+// (and everything is reported as changed) if more accumulate between two reads.
+static const DWORD notificationBufferSize = 64 * 1024;
+#endif
+
+BackingFolderWatcher::BackingFolderWatcher() :
+	isRunning_(false)
+#if defined(_WIN32)
+	, dirHandle_(INVALID_HANDLE_VALUE), stopEvent_(NULL)
+#endif
+{
+}
+
+BackingFolderWatcher::~BackingFolderWatcher()
+{
+	stop();
+}
+
+/**
+ * Starts the watcher thread for the folder rootDir (UTF-8).
+ * Returns false if the folder can't be watched.
+ */
+bool BackingFolderWatcher::start(const std::string &rootDir, const ChangeHandler &handler)
+{
+	if(isRunning_)
+		return true;
+
+#if defined(_WIN32)
+	std::wstring rootDirW = UTFConvert::toWide(rootDir);
+	dirHandle_ = CreateFileW(rootDirW.c_str(), FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if(dirHandle_ == INVALID_HANDLE_VALUE)
+		return false;
+
+	stopEvent_ = CreateEventW(NULL, TRUE, FALSE, NULL);
+	if(stopEvent_ == NULL)
+	{
+		CloseHandle(dirHandle_);
+		dirHandle_ = INVALID_HANDLE_VALUE;
+		return false;
+	}
+
+	rootDir_ = rootDir;
+	handler_ = handler;
+	isRunning_ = true;
+	worker_ = boost::thread([this]() { watchLoop(); });
+	return true;
+#else
+	(void)rootDir;
+	(void)handler;
+	return false;
+#endif
+}
+
+void BackingFolderWatcher::stop()
+{
+	if(!isRunning_)
+		return;
+
+#if defined(_WIN32)
+	SetEvent(stopEvent_);
+	worker_.join();
+
+	CloseHandle(stopEvent_);
+	stopEvent_ = NULL;
+	CloseHandle(dirHandle_);
+	dirHandle_ = INVALID_HANDLE_VALUE;
+#endif
+	handler_ = ChangeHandler();
+	isRunning_ = false;
+}
+
+void BackingFolderWatcher::watchLoop()
+{
+#if defined(_WIN32)
+	// DWORD elements, the notifications must be DWORD aligned
+	std::vector<DWORD> buffer(notificationBufferSize / sizeof(DWORD));
+	OVERLAPPED overlapped;
+	memset(&overlapped, 0, sizeof(overlapped));
+	overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	if(overlapped.hEvent == NULL)
+		return;
+
+	const DWORD notifyFilter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+		FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE;
+	HANDLE waitHandles[2] = { overlapped.hEvent, stopEvent_ };
+
+	while(true)
+	{
+		ResetEvent(overlapped.hEvent);
+		if(!ReadDirectoryChangesW(dirHandle_, &buffer[0], notificationBufferSize, TRUE,
+				notifyFilter, NULL, &overlapped, NULL))
+		{
+			handler_(std::string(), true);		// Can't watch anymore, drop everything once
+			break;
+		}
+
+		DWORD waitResult = WaitForMultipleObjects(2, waitHandles, FALSE, INFINITE);
+		DWORD bytesReturned = 0;
+		if(waitResult != WAIT_OBJECT_0 ||
+			!GetOverlappedResult(dirHandle_, &overlapped, &bytesReturned, FALSE))
+		{
+			CancelIo(dirHandle_);
+			GetOverlappedResult(dirHandle_, &overlapped, &bytesReturned, TRUE);
+			break;
+		}
+
+		if(bytesReturned == 0)
+		{
+			handler_(std::string(), true);		// The buffer overflowed
+			continue;
+		}
+
+		const unsigned char *pos = reinterpret_cast<const unsigned char *>(&buffer[0]);
+		while(true)
+		{
+			const FILE_NOTIFY_INFORMATION *info = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(pos);
+			std::string name;
+			UTFConvert::toUTF8(info->FileName, info->FileNameLength / sizeof(WCHAR), name);
+			for(std::string::iterator it = name.begin(); it != name.end(); ++it)
+			{
+				if(*it == '\\')
+					*it = '/';
+			}
+
+			bool namesChanged = (info->Action != FILE_ACTION_MODIFIED);
+			handler_(rootDir_ + "/" + name, namesChanged);
+
+			if(info->NextEntryOffset == 0)
+				break;
+			pos += info->NextEntryOffset;
+		}
+	}
+
+	CloseHandle(overlapped.hEvent);
+#endif
+}
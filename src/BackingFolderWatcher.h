@@ -0,0 +1,75 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef BACKINGFOLDERWATCHER_H
+#define BACKINGFOLDERWATCHER_H
+
+#include "config.h"
+
+#include <string>
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+/**
+ * Watches the backing folder of a mount for changes made by others,
+ * e.g. a sync client like Dropbox or OneDrive writing to it.
+ *
+ * The handler is called from the watcher thread with the cipher path of
+ * every changed file or folder, and with an empty path if changes were lost,
+ * in which case everything must be considered changed.
+ * Our own changes are reported as well.
+ *
+ * Only implemented on Windows (ReadDirectoryChangesW), start() returns false
+ * on other platforms.
+ */
+class BackingFolderWatcher
+{
+public:
+	/**
+	 * Called with the cipher path, and true if files were added, removed or
+	 * renamed, false if only their contents or attributes changed.
+	 */
+	typedef boost::function<void (const std::string &cipherPath, bool namesChanged)> ChangeHandler;
+
+	BackingFolderWatcher();
+	virtual ~BackingFolderWatcher();
+
+	bool start(const std::string &rootDir, const ChangeHandler &handler);
+	void stop();
+
+private:
+	void watchLoop();
+
+	std::string rootDir_;
+	ChangeHandler handler_;
+	boost::thread worker_;
+	bool isRunning_;
+#if defined(_WIN32)
+	HANDLE dirHandle_;
+	HANDLE stopEvent_;
+#endif
+};
+
+#endif
@@ -0,0 +1,277 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "CacheAutoTuner.h"
+
+#include <algorithm>
+
+#include <boost/thread.hpp>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Fewer lookups per cycle don't tell anything about a cache
+static const uint64_t minLookupCount = 200;
+// Caches below this hit rate shrink, above the other one they may grow
+static const uint64_t lowHitPercent = 25;
+static const uint64_t highHitPercent = 75;
+// Reads served from the read-ahead per cycle which grow its window
+static const uint64_t minSequentialHits = 64;
+static const long maxReadAheadKB = 16 * 1024;
+static const long minReadAheadKB = 128;
+static const long minBlockCacheMB = 8;
+static const long minStatCacheSize = 1000;
+// The caches grow up to this multiple of the configured size
+static const long maxGrowthFactor = 4;
+// Files assumed to be read or written at the same time, each with its own buffers
+static const long bufferedFileCount = 4;
+// See CacheTuning::statCacheSize_
+static const long statEntryBytes = 256;
+// Below this, requests are not dispatched to several threads
+static const int minThreadCount = 2;
+static const int maxThreadsPerCore = 4;
+
+static uint64_t difference(uint64_t newValue, uint64_t oldValue)
+{
+	return newValue >= oldValue ? newValue - oldValue : 0;
+}
+
+static bool fitsBudget(const CacheTuning &base, const CacheTuning &tuning)
+{
+	return base.memoryBudgetMB_ <= 0
+		|| CacheAutoTuner::memoryKB(tuning) <= static_cast<uint64_t>(base.memoryBudgetMB_) * 1024;
+}
+
+CacheAutoTuner::Sample::Sample()
+	: blockCacheHits_(0), blockCacheMisses_(0), blockCacheBytes_(0),
+	statCacheHits_(0), statCacheMisses_(0), readAheadHits_(0), readAheadMisses_(0),
+	busyMicros_(0), cpuMicros_(0)
+{
+}
+
+CacheAutoTuner::CacheAutoTuner() :
+	hasSample_(false),
+	coreCount_(std::max(1, static_cast<int>(boost::thread::hardware_concurrency())))
+{
+}
+
+CacheAutoTuner::~CacheAutoTuner()
+{
+}
+
+void CacheAutoTuner::reset()
+{
+	hasSample_ = false;
+}
+
+bool CacheAutoTuner::update(const Sample &sample, const CacheTuning &base, CacheTuning &tuning)
+{
+	CacheTuning oldTuning(tuning);
+	if(hasSample_ && sample.time_ > lastSample_.time_)
+	{
+		Sample delta;
+		delta.time_ = sample.time_;
+		delta.blockCacheHits_ = difference(sample.blockCacheHits_, lastSample_.blockCacheHits_);
+		delta.blockCacheMisses_ = difference(sample.blockCacheMisses_, lastSample_.blockCacheMisses_);
+		delta.blockCacheBytes_ = sample.blockCacheBytes_;
+		delta.statCacheHits_ = difference(sample.statCacheHits_, lastSample_.statCacheHits_);
+		delta.statCacheMisses_ = difference(sample.statCacheMisses_, lastSample_.statCacheMisses_);
+		delta.readAheadHits_ = difference(sample.readAheadHits_, lastSample_.readAheadHits_);
+		delta.readAheadMisses_ = difference(sample.readAheadMisses_, lastSample_.readAheadMisses_);
+		delta.busyMicros_ = difference(sample.busyMicros_, lastSample_.busyMicros_);
+		delta.cpuMicros_ = difference(sample.cpuMicros_, lastSample_.cpuMicros_);
+		uint64_t elapsedMicros = static_cast<uint64_t>(
+			std::chrono::duration_cast<std::chrono::microseconds>(sample.time_ - lastSample_.time_).count());
+
+		tuneReadAhead(delta, base, tuning);
+		tuneBlockCache(delta, base, tuning);
+		tuneStatCache(delta, base, tuning);
+		tuneThreads(delta, elapsedMicros, base, tuning);
+	}
+	// Also if the configured sizes exceed the budget
+	fitBudget(base, tuning);
+
+	lastSample_ = sample;
+	hasSample_ = true;
+	return tuning != oldTuning;
+}
+
+/**
+ * Reads served from the buffer mean the files are read sequentially, and a
+ * bigger window keeps the background thread further ahead. Only files opened
+ * afterwards get the new window.
+ */
+void CacheAutoTuner::tuneReadAhead(const Sample &delta, const CacheTuning &base, CacheTuning &tuning) const
+{
+	if(base.readAheadKB_ <= 0 || tuning.readAheadKB_ <= 0)
+		return;
+
+	if(delta.readAheadHits_ >= minSequentialHits)
+	{
+		CacheTuning grown(tuning);
+		grown.readAheadKB_ = std::min(tuning.readAheadKB_ * 2, std::max(base.readAheadKB_, maxReadAheadKB));
+		if(fitsBudget(base, grown))
+			tuning = grown;
+	}
+	else if(delta.readAheadHits_ == 0 && delta.readAheadMisses_ >= minLookupCount)
+		tuning.readAheadKB_ = std::max(base.readAheadKB_, tuning.readAheadKB_ / 2);
+}
+
+/**
+ * Only grows while the cache is full, a cache with room left would not hit
+ * more often if it were bigger.
+ */
+void CacheAutoTuner::tuneBlockCache(const Sample &delta, const CacheTuning &base, CacheTuning &tuning) const
+{
+	if(base.blockCacheMB_ <= 0 || tuning.blockCacheMB_ <= 0)
+		return;
+	uint64_t lookups = delta.blockCacheHits_ + delta.blockCacheMisses_;
+	if(lookups < minLookupCount)
+		return;
+
+	uint64_t hitPercent = delta.blockCacheHits_ * 100 / lookups;
+	uint64_t budgetBytes = static_cast<uint64_t>(tuning.blockCacheMB_) * 1024 * 1024;
+	if(hitPercent < lowHitPercent)
+		tuning.blockCacheMB_ = std::max(std::min(base.blockCacheMB_, minBlockCacheMB), tuning.blockCacheMB_ / 2);
+	else if(hitPercent >= highHitPercent && delta.blockCacheBytes_ * 10 >= budgetBytes * 9)
+	{
+		CacheTuning grown(tuning);
+		grown.blockCacheMB_ = std::min(tuning.blockCacheMB_ + tuning.blockCacheMB_ / 2 + 1,
+			base.blockCacheMB_ * maxGrowthFactor);
+		if(fitsBudget(base, grown))
+			tuning = grown;
+	}
+}
+
+/**
+ * The stat cache doesn't tell how full it is, it grows while it hits and
+ * still misses often.
+ */
+void CacheAutoTuner::tuneStatCache(const Sample &delta, const CacheTuning &base, CacheTuning &tuning) const
+{
+	if(base.statCacheSize_ <= 0 || tuning.statCacheSize_ <= 0)
+		return;
+	uint64_t lookups = delta.statCacheHits_ + delta.statCacheMisses_;
+	if(lookups < minLookupCount)
+		return;
+
+	uint64_t hitPercent = delta.statCacheHits_ * 100 / lookups;
+	if(hitPercent < lowHitPercent)
+		tuning.statCacheSize_ = std::max(std::min(base.statCacheSize_, minStatCacheSize), tuning.statCacheSize_ / 2);
+	else if(hitPercent >= highHitPercent && delta.statCacheMisses_ >= minLookupCount)
+	{
+		CacheTuning grown(tuning);
+		grown.statCacheSize_ = std::min(tuning.statCacheSize_ * 2, base.statCacheSize_ * maxGrowthFactor);
+		if(fitsBudget(base, grown))
+			tuning = grown;
+	}
+}
+
+/**
+ * The requests in flight follow from their total duration, the CPU
+ * saturation from the CPU time of the process. More requests at the same
+ * time help while they wait for the disk or the network, not while they
+ * wait for the CPU.
+ */
+void CacheAutoTuner::tuneThreads(const Sample &delta, uint64_t elapsedMicros,
+	const CacheTuning &base, CacheTuning &tuning) const
+{
+	int baseThreads = base.threadCount_ > 0 ? static_cast<int>(base.threadCount_) : coreCount_;
+	int threads = tuning.threadCount_ > 0 ? static_cast<int>(tuning.threadCount_) : coreCount_;
+	if(elapsedMicros == 0 || baseThreads < minThreadCount)
+		return;
+
+	uint64_t inFlightPercent = delta.busyMicros_ * 100 / elapsedMicros;
+	uint64_t cpuPercent = delta.cpuMicros_ * 100 / (elapsedMicros * coreCount_);
+	int minThreads = std::max(minThreadCount, std::min(baseThreads, coreCount_));
+	int maxThreads = std::max(baseThreads, maxThreadsPerCore * coreCount_);
+
+	int newThreads = threads;
+	if(cpuPercent >= 90 && threads > minThreads)
+		newThreads = threads - 1;
+	else if(inFlightPercent >= static_cast<uint64_t>(threads) * 75 && cpuPercent < 75 && threads < maxThreads)
+		newThreads = std::min(maxThreads, threads + std::max(1, threads / 4));
+	else if(inFlightPercent < static_cast<uint64_t>(threads) * 25 && threads > baseThreads)
+		newThreads = threads - 1;
+
+	if(newThreads != threads)
+		tuning.threadCount_ = newThreads;
+}
+
+bool CacheAutoTuner::fitBudget(const CacheTuning &base, CacheTuning &tuning)
+{
+	if(base.memoryBudgetMB_ <= 0)
+		return false;
+	uint64_t budgetKB = static_cast<uint64_t>(base.memoryBudgetMB_) * 1024;
+	CacheTuning oldTuning(tuning);
+
+	// The block cache gives way first, then the read-ahead, then the stat cache
+	uint64_t usedKB = memoryKB(tuning);
+	if(usedKB > budgetKB && tuning.blockCacheMB_ > 0)
+	{
+		long excessMB = static_cast<long>((usedKB - budgetKB + 1023) / 1024);
+		tuning.blockCacheMB_ = std::max(std::min(tuning.blockCacheMB_, minBlockCacheMB),
+			tuning.blockCacheMB_ - excessMB);
+	}
+	while(memoryKB(tuning) > budgetKB && tuning.readAheadKB_ > minReadAheadKB)
+		tuning.readAheadKB_ = std::max(minReadAheadKB, tuning.readAheadKB_ / 2);
+	usedKB = memoryKB(tuning);
+	if(usedKB > budgetKB && tuning.statCacheSize_ > minStatCacheSize)
+	{
+		long excessEntries = static_cast<long>((usedKB - budgetKB) * 1024 / statEntryBytes) + 1;
+		tuning.statCacheSize_ = std::max(minStatCacheSize, tuning.statCacheSize_ - excessEntries);
+	}
+	return tuning != oldTuning;
+}
+
+uint64_t CacheAutoTuner::memoryKB(const CacheTuning &tuning)
+{
+	uint64_t kb = static_cast<uint64_t>(std::max(tuning.blockCacheMB_, 0L)) * 1024;
+	kb += static_cast<uint64_t>(std::max(tuning.readAheadKB_, 0L) + std::max(tuning.writeBufferKB_, 0L))
+		* bufferedFileCount;
+	kb += static_cast<uint64_t>(std::max(tuning.statCacheSize_, 0L)) * statEntryBytes / 1024;
+	return kb;
+}
+
+uint64_t CacheAutoTuner::processCPUMicros()
+{
+#if defined(_WIN32)
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+	if(!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+		return 0;
+	ULARGE_INTEGER kernel, user;
+	kernel.LowPart = kernelTime.dwLowDateTime;
+	kernel.HighPart = kernelTime.dwHighDateTime;
+	user.LowPart = userTime.dwLowDateTime;
+	user.HighPart = userTime.dwHighDateTime;
+	// In units of 100 ns
+	return (kernel.QuadPart + user.QuadPart) / 10;
+#else
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	return static_cast<uint64_t>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+		+ static_cast<uint64_t>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+#endif
+}
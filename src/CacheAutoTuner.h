@@ -0,0 +1,107 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef CACHEAUTOTUNER_H
+#define CACHEAUTOTUNER_H
+
+#include <chrono>
+#include <stdint.h>
+
+#include "CacheTuning.h"
+
+/**
+ * Adapts the CacheTuning of a mount to the way it is used, if
+ * CacheTuning::autoTune_ is set.
+ *
+ * Fed with the counters of the drive once per CacheTrimmer cycle, it
+ * - grows the read-ahead window while files are read sequentially from it,
+ *   and takes it back to the configured size when they are read randomly,
+ * - shrinks the block cache and the stat cache while few lookups hit them,
+ *   and grows them while they hit and are full,
+ * - serves more requests at the same time while they queue up and the CPU
+ *   has time left, and fewer while the CPU is saturated or they are idle.
+ * Everything stays within CacheTuning::memoryBudgetMB_. The lower limits
+ * and the step sizes keep it from swinging between the extremes.
+ *
+ * Only computes the tuning, PFMLayer applies it. Not thread safe.
+ */
+class CacheAutoTuner
+{
+public:
+	/**
+	 * The counters of a drive at one time, see PFMLayer::autoTune(). All counts are
+	 * totals since the mount, the tuner works with their differences.
+	 */
+	struct Sample
+	{
+		Sample();
+
+		std::chrono::steady_clock::time_point time_;
+		uint64_t blockCacheHits_, blockCacheMisses_;
+		uint64_t blockCacheBytes_;		// In use at this time
+		uint64_t statCacheHits_, statCacheMisses_;
+		uint64_t readAheadHits_;		// Reads served from a read-ahead buffer
+		uint64_t readAheadMisses_;		// Reads of files with a read-ahead buffer which were not
+		uint64_t busyMicros_;			// Duration of all requests served
+		uint64_t cpuMicros_;			// CPU time of the process, see processCPUMicros()
+	};
+
+	CacheAutoTuner();
+	virtual ~CacheAutoTuner();
+
+	/**
+	 * Forgets the last sample, e.g. when the configured tuning changed.
+	 */
+	void reset();
+
+	/**
+	 * Adapts tuning, the one in effect, to the counters since the last
+	 * sample. base is the configured tuning, with the caches disabled if
+	 * caching is disabled for the mount. Returns true if tuning was changed.
+	 */
+	bool update(const Sample &sample, const CacheTuning &base, CacheTuning &tuning);
+
+	/**
+	 * Shrinks the caches and buffers of tuning until they fit into the
+	 * memory budget of base. Returns true if tuning was changed.
+	 */
+	static bool fitBudget(const CacheTuning &base, CacheTuning &tuning);
+
+	// Estimated memory used by the caches and buffers of tuning
+	static uint64_t memoryKB(const CacheTuning &tuning);
+
+	// User and kernel time of this process
+	static uint64_t processCPUMicros();
+
+private:
+	CacheAutoTuner(const CacheAutoTuner &) = delete;
+	CacheAutoTuner &operator=(const CacheAutoTuner &) = delete;
+
+	void tuneReadAhead(const Sample &delta, const CacheTuning &base, CacheTuning &tuning) const;
+	void tuneBlockCache(const Sample &delta, const CacheTuning &base, CacheTuning &tuning) const;
+	void tuneStatCache(const Sample &delta, const CacheTuning &base, CacheTuning &tuning) const;
+	void tuneThreads(const Sample &delta, uint64_t elapsedMicros, const CacheTuning &base, CacheTuning &tuning) const;
+
+	Sample lastSample_;
+	bool hasSample_;
+	int coreCount_;
+};
+
+#endif
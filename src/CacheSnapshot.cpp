@@ -0,0 +1,141 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "CacheSnapshot.h"
+
+#include "EncryptedFile.h"
+
+static const char snapshotMagic[EncryptedFile::magicSize] = { 'E', 'F', 'S', 'C', 'A', 'C', 'H', 'E' };
+
+CacheSnapshot::CacheSnapshot()
+{
+}
+
+CacheSnapshot::~CacheSnapshot()
+{
+}
+
+bool CacheSnapshot::load(const std::string &fileName, const std::shared_ptr<encfs::Cipher> &cipher,
+	const std::shared_ptr<encfs::AbstractCipherKey> &key)
+{
+	clear();
+	std::string data;
+	if(!EncryptedFile::load(fileName, snapshotMagic, formatVersion, cipher, key, data))
+		return false;
+
+	size_t pos = 0;
+	std::vector<encfs::NameCodingCache::Entry> nameCodings;
+	uint32_t count = 0;
+	if(!EncryptedFile::getLE(data, pos, count))
+		return false;
+	for(uint32_t i = 0; i < count; i++)
+	{
+		encfs::NameCodingCache::Entry entry;
+		if(!(EncryptedFile::getString(data, pos, entry.key) && EncryptedFile::getString(data, pos, entry.coded)
+			&& EncryptedFile::getLE(data, pos, entry.childIV)))
+			return false;
+		nameCodings.push_back(entry);
+	}
+
+	FolderMap folders;
+	FolderMap::iterator hint = folders.end();
+	if(!EncryptedFile::getLE(data, pos, count))
+		return false;
+	for(uint32_t i = 0; i < count; i++)
+	{
+		std::string path;
+		Folder folder;
+		uint32_t nameCount = 0;
+		if(!(EncryptedFile::getString(data, pos, path) && EncryptedFile::getLE(data, pos, folder.mtime)
+			&& EncryptedFile::getLE(data, pos, nameCount)))
+			return false;
+		// Each name takes at least its length
+		if((data.size() - pos) / 4 < nameCount)
+			return false;
+		folder.names.resize(nameCount);
+		for(uint32_t n = 0; n < nameCount; n++)
+		{
+			if(!EncryptedFile::getString(data, pos, folder.names[n]))
+				return false;
+		}
+		// Stored in order, each folder goes to the end
+		hint = folders.insert(hint, FolderMap::value_type(path, Folder()));
+		hint->second.mtime = folder.mtime;
+		hint->second.names.swap(folder.names);
+	}
+
+	nameCodings_.swap(nameCodings);
+	folders_.swap(folders);
+	return true;
+}
+
+bool CacheSnapshot::save(const std::string &fileName, const std::shared_ptr<encfs::Cipher> &cipher,
+	const std::shared_ptr<encfs::AbstractCipherKey> &key) const
+{
+	std::string data;
+	EncryptedFile::putLE(data, static_cast<uint32_t>(nameCodings_.size()));
+	for(size_t i = 0; i < nameCodings_.size(); i++)
+	{
+		EncryptedFile::putString(data, nameCodings_[i].key);
+		EncryptedFile::putString(data, nameCodings_[i].coded);
+		EncryptedFile::putLE(data, nameCodings_[i].childIV);
+	}
+	EncryptedFile::putLE(data, static_cast<uint32_t>(folders_.size()));
+	for(FolderMap::const_iterator iter = folders_.begin(); iter != folders_.end(); ++iter)
+	{
+		EncryptedFile::putString(data, iter->first);
+		EncryptedFile::putLE(data, iter->second.mtime);
+		EncryptedFile::putLE(data, static_cast<uint32_t>(iter->second.names.size()));
+		for(size_t n = 0; n < iter->second.names.size(); n++)
+			EncryptedFile::putString(data, iter->second.names[n]);
+	}
+
+	return EncryptedFile::save(fileName, snapshotMagic, formatVersion, cipher, key, data);
+}
+
+void CacheSnapshot::clear()
+{
+	nameCodings_.clear();
+	folders_.clear();
+}
+
+bool CacheSnapshot::takeFolder(const std::string &dirPath, std::vector<std::string> &names, int64_t &mtime)
+{
+	FolderMap::iterator iter = folders_.find(dirPath);
+	if(iter == folders_.end())
+		return false;
+
+	names.swap(iter->second.names);
+	mtime = iter->second.mtime;
+	folders_.erase(iter);
+	return true;
+}
+
+void CacheSnapshot::forgetTree(const std::string &dirPath)
+{
+	folders_.erase(dirPath);
+	std::string prefix(dirPath);
+	if(prefix.empty() || prefix[prefix.length() - 1] != '/')
+		prefix += '/';
+	FolderMap::iterator iter = folders_.lower_bound(prefix);
+	while(iter != folders_.end() && iter->first.compare(0, prefix.length(), prefix) == 0)
+		folders_.erase(iter++);
+}
@@ -0,0 +1,100 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CACHESNAPSHOT_H
+#define CACHESNAPSHOT_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// libencfs
+#include "NameCodingCache.h"
+
+namespace encfs
+{
+	class Cipher;
+	class AbstractCipherKey;
+}
+
+/**
+ * Snapshot of the name coding cache and of the folder listings of a mount,
+ * written when it is unmounted and read when it is mounted the next time, so
+ * that the folders browsed before need no names decoded again.
+ *
+ * The coded names only depend on the volume key and are always valid. A
+ * folder keeps the names it had and the modification time of its backing
+ * folder; its listing is only used as long as the backing folder still has
+ * this time (see takeFolder()). The attributes of the files may change without
+ * a change of the folder, so they are not kept, every file is queried once
+ * when the listing is used.
+ *
+ * The file is stored next to the configuration of the volume like the name
+ * index, see EncryptedFile, with the magic "EFSCACHE".
+ */
+class CacheSnapshot
+{
+public:
+	struct Folder
+	{
+		Folder() : mtime(0) { }
+
+		int64_t mtime;		// Of the backing folder, seconds since 1970
+		std::vector<std::string> names;
+	};
+
+	typedef std::map<std::string, Folder> FolderMap;	// By plaintext path
+
+	CacheSnapshot();
+	virtual ~CacheSnapshot();
+
+	/**
+	 * Replaces the snapshot by the one stored in fileName. Returns false if
+	 * there is none, or if it was written with another key or is damaged.
+	 */
+	bool load(const std::string &fileName, const std::shared_ptr<encfs::Cipher> &cipher,
+		const std::shared_ptr<encfs::AbstractCipherKey> &key);
+	bool save(const std::string &fileName, const std::shared_ptr<encfs::Cipher> &cipher,
+		const std::shared_ptr<encfs::AbstractCipherKey> &key) const;
+
+	void clear();
+
+	/**
+	 * Removes the folder dirPath from the snapshot and returns its names and
+	 * the modification time of its backing folder. Returns false if the
+	 * snapshot has no such folder.
+	 */
+	bool takeFolder(const std::string &dirPath, std::vector<std::string> &names, int64_t &mtime);
+	// Removes dirPath and the folders below it. A folder keeps its time when
+	// it is renamed, another folder might get its name and time
+	void forgetTree(const std::string &dirPath);
+
+	std::vector<encfs::NameCodingCache::Entry> nameCodings_;
+	FolderMap folders_;
+
+private:
+	CacheSnapshot(const CacheSnapshot &o) = delete;
+	CacheSnapshot & operator=(const CacheSnapshot & o) = delete;
+
+	static const uint32_t formatVersion = 2;	// 2: the IVs of the pieces don't overlap
+};
+
+#endif
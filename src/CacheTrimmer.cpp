@@ -0,0 +1,163 @@
+/**
+ * Copyright (C) 2026 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "CacheTrimmer.h"
+
+#include <algorithm>
+
+#include "MemoryPool.h"
+
+// Period of the idle check, a drive is trimmed after one cycle without requests
+static const int idleCycleSeconds = 30;
+
+CacheTrimmer::Client::Client() :
+	lastActivity_(0),
+	isRegistered_(false)
+{
+}
+
+CacheTrimmer::Client::~Client()
+{
+	stop();
+}
+
+void CacheTrimmer::Client::start(const ActivityFunction &activity, const TrimFunction &trim,
+	const TuneFunction &tune)
+{
+	CacheTrimmer &trimmer = CacheTrimmer::instance();
+	boost::mutex::scoped_lock lock(trimmer.mutex_);
+	activity_ = activity;
+	trim_ = trim;
+	tune_ = tune;
+	lastActivity_ = activity_();
+	if(isRegistered_)
+		return;
+	isRegistered_ = true;
+	trimmer.clients_.push_back(this);
+}
+
+void CacheTrimmer::Client::stop()
+{
+	if(!isRegistered_)
+		return;
+
+	CacheTrimmer &trimmer = CacheTrimmer::instance();
+	boost::mutex::scoped_lock lock(trimmer.mutex_);
+	std::vector<Client *>::iterator iter = std::find(trimmer.clients_.begin(), trimmer.clients_.end(), this);
+	if(iter != trimmer.clients_.end())
+		trimmer.clients_.erase(iter);
+	isRegistered_ = false;
+}
+
+CacheTrimmer &CacheTrimmer::instance()
+{
+	static CacheTrimmer trimmer;
+	return trimmer;
+}
+
+CacheTrimmer::CacheTrimmer()
+#if defined(_WIN32)
+	: stopEvent_(CreateEvent(NULL, TRUE, FALSE, NULL)),
+	lowMemory_(CreateMemoryResourceNotification(LowMemoryResourceNotification))
+#else
+	: isStopping_(false)
+#endif
+{
+	thread_ = boost::thread([this]() { trimmerLoop(); });
+}
+
+CacheTrimmer::~CacheTrimmer()
+{
+#if defined(_WIN32)
+	SetEvent(stopEvent_);
+#else
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		isStopping_ = true;
+	}
+	stopCond_.notify_all();
+#endif
+	thread_.join();
+#if defined(_WIN32)
+	if(lowMemory_ != NULL)
+		CloseHandle(lowMemory_);
+	CloseHandle(stopEvent_);
+#endif
+}
+
+/**
+ * Waits until the current cycle is over, or until the system runs low on
+ * memory. Returns false when the trimmer is stopped.
+ */
+bool CacheTrimmer::waitForCycle(bool &isLowMemory)
+{
+#if defined(_WIN32)
+	if(!isLowMemory && lowMemory_ != NULL)
+	{
+		HANDLE handles[2] = { stopEvent_, lowMemory_ };
+		DWORD result = WaitForMultipleObjects(2, handles, FALSE, idleCycleSeconds * 1000);
+		if(result == WAIT_OBJECT_0)
+			return false;
+		isLowMemory = (result == WAIT_OBJECT_0 + 1);
+		return true;
+	}
+
+	// The notification stays signaled while memory is low, check it again after the cycle
+	if(WaitForSingleObject(stopEvent_, idleCycleSeconds * 1000) == WAIT_OBJECT_0)
+		return false;
+	BOOL state = FALSE;
+	isLowMemory = (lowMemory_ != NULL && QueryMemoryResourceNotification(lowMemory_, &state) && state);
+	return true;
+#else
+	boost::mutex::scoped_lock lock(mutex_);
+	stopCond_.wait_for(lock, boost::chrono::seconds(idleCycleSeconds), [this]() { return isStopping_; });
+	return !isStopping_;
+#endif
+}
+
+/**
+ * Trims the drives which were idle since the last call, or all of them
+ * completely with shedAll. The others are tuned.
+ */
+void CacheTrimmer::trimClients(bool shedAll)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	if(clients_.empty())
+		return;
+
+	for(size_t i = 0; i < clients_.size(); i++)
+	{
+		Client *client = clients_[i];
+		uint64_t activity = client->activity_();
+		bool isIdle = (activity == client->lastActivity_);
+		client->lastActivity_ = activity;
+		if(isIdle || shedAll)
+			client->trim_(shedAll);
+		else if(client->tune_)
+			client->tune_();
+	}
+	encfs::MemoryPool::destroyAll();
+}
+
+void CacheTrimmer::trimmerLoop()
+{
+	bool isLowMemory = false;
+	while(waitForCycle(isLowMemory))
+		trimClients(isLowMemory);
+}
@@ -0,0 +1,120 @@
+/**
+ * Copyright (C) 2026 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CACHETRIMMER_H
+#define CACHETRIMMER_H
+
+#include "config.h"
+
+#include <vector>
+#include <stdint.h>
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+/**
+ * Shrinks the caches of the mounted drives while they are idle, with one
+ * thread for all mounts.
+ *
+ * Every idleCycleSeconds, the caches of a drive whose activity counter did
+ * not change during the cycle are trimmed. Each further idle cycle trims
+ * them again, so they shrink step by step until the drive is used.
+ * On Windows, all caches are dropped as soon as the system signals low
+ * memory (CreateMemoryResourceNotification).
+ * The free blocks of encfs::MemoryPool are returned to the heap after every
+ * trim.
+ * Drives which want to adapt their caches to their use (see CacheAutoTuner)
+ * are also called once per cycle while they are busy.
+ */
+class CacheTrimmer
+{
+public:
+	/**
+	 * Returns a value which changes with every request served by the drive.
+	 */
+	typedef boost::function<uint64_t ()> ActivityFunction;
+
+	/**
+	 * Shrinks the caches of the drive, drops them completely with shedAll.
+	 */
+	typedef boost::function<void (bool shedAll)> TrimFunction;
+
+	/**
+	 * Adapts the caches of the drive to the requests of the last cycle.
+	 */
+	typedef boost::function<void ()> TuneFunction;
+
+	/**
+	 * The caches of one drive, registered while it is mounted.
+	 */
+	class Client
+	{
+	public:
+		Client();
+		virtual ~Client();
+
+		void start(const ActivityFunction &activity, const TrimFunction &trim,
+			const TuneFunction &tune = TuneFunction());
+
+		/**
+		 * Unregisters the drive, and waits if it is being trimmed.
+		 */
+		void stop();
+
+	private:
+		friend class CacheTrimmer;
+
+		ActivityFunction activity_;
+		TrimFunction trim_;
+		TuneFunction tune_;
+		uint64_t lastActivity_;
+		bool isRegistered_;
+	};
+
+	static CacheTrimmer &instance();
+
+private:
+	CacheTrimmer();
+	~CacheTrimmer();
+
+	CacheTrimmer(const CacheTrimmer &);
+	CacheTrimmer &operator=(const CacheTrimmer &);
+
+	bool waitForCycle(bool &isLowMemory);
+	void trimClients(bool shedAll);
+	void trimmerLoop();
+
+	boost::mutex mutex_;		// Protects clients_, held while trimming
+	std::vector<Client *> clients_;
+#if defined(_WIN32)
+	HANDLE stopEvent_;
+	HANDLE lowMemory_;			// Signaled while the system is low on memory
+#else
+	bool isStopping_;
+	boost::condition_variable stopCond_;
+#endif
+	boost::thread thread_;
+};
+
+#endif
@@ -0,0 +1,79 @@
+/**
+ * Copyright (C) 2026 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CACHETUNING_H
+#define CACHETUNING_H
+
+/**
+ * Cache and buffer sizes of one mount, stored with its MountEntry.
+ *
+ * The defaults are the sizes used before they could be set per mount.
+ * A size of 0 disables the cache or buffer. Only the read-ahead, the
+ * write-back limit and the threads are used if caching is disabled for the
+ * mount, see withCaching().
+ * With autoTune_, the sizes are where CacheAutoTuner starts, and it keeps the
+ * caches and buffers within memoryBudgetMB_.
+ */
+struct CacheTuning
+{
+	CacheTuning()
+		: statCacheSize_(20000), statCacheTimeToLive_(0), blockCacheMB_(64),
+		listingCache_(true), readAheadKB_(1024), writeBufferKB_(1024), threadCount_(0),
+		firstBlockPrefetchKB_(0), autoTune_(false), memoryBudgetMB_(256)
+	{ }
+
+	/**
+	 * The tuning in effect, with the caches disabled unless enableCaching.
+	 */
+	CacheTuning withCaching(bool enableCaching) const
+	{
+		CacheTuning tuning(*this);
+		if(!enableCaching)
+		{
+			tuning.statCacheSize_ = 0;
+			tuning.blockCacheMB_ = 0;
+			tuning.listingCache_ = false;
+			tuning.firstBlockPrefetchKB_ = 0;
+		}
+		return tuning;
+	}
+
+	bool operator==(const CacheTuning &o) const
+	{
+		return statCacheSize_ == o.statCacheSize_ && statCacheTimeToLive_ == o.statCacheTimeToLive_
+			&& blockCacheMB_ == o.blockCacheMB_ && listingCache_ == o.listingCache_
+			&& readAheadKB_ == o.readAheadKB_ && writeBufferKB_ == o.writeBufferKB_
+			&& threadCount_ == o.threadCount_ && firstBlockPrefetchKB_ == o.firstBlockPrefetchKB_
+			&& autoTune_ == o.autoTune_ && memoryBudgetMB_ == o.memoryBudgetMB_;
+	}
+	bool operator!=(const CacheTuning &o) const { return !(*this == o); }
+
+	long statCacheSize_;		// Stat results of files and folders, an entry takes less than 256 bytes
+	long statCacheTimeToLive_;	// Milliseconds, 0: cached stat results never expire
+	long blockCacheMB_;			// Decoded blocks shared by all files
+	bool listingCache_;			// Folder listings
+	long readAheadKB_;			// Read ahead of files read sequentially, per file
+	long writeBufferKB_;		// Small writes collected per file, if the write buffer is enabled
+	long threadCount_;			// Requests served at the same time, 0: one per core
+	long firstBlockPrefetchKB_;	// Listed files up to this size get their first block decoded into the block cache
+	bool autoTune_;				// Adapt the sizes and threads while mounted, see CacheAutoTuner
+	long memoryBudgetMB_;		// Upper limit of the auto-tuning, 0: unlimited
+};
+
+#endif
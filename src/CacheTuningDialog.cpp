@@ -0,0 +1,98 @@
+/**
+ * Copyright (C) 2026 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "CommonIncludes.h"
+#include "CacheTuningDialog.h"
+
+CacheTuningDialog::CacheTuningDialog(wxWindow *parent, const wxString &mountName)
+	: wxDialog(parent, wxID_ANY, wxString::Format(wxT("Cache settings of %s"), mountName))
+{
+	wxBoxSizer *pTopSizer = new wxBoxSizer(wxVERTICAL);
+	wxFlexGridSizer *pGridSizer = new wxFlexGridSizer(2, 5, 10);
+	pGridSizer->AddGrowableCol(1);
+
+	pStatCacheSizeSpin_ = addSpinCtrl(pGridSizer, wxT("Cached file infos (0: off):"), 10000000);
+	pStatCacheTimeToLiveSpin_ = addSpinCtrl(pGridSizer, wxT("File info lifetime in ms (0: unlimited):"), 3600000);
+	pBlockCacheMBSpin_ = addSpinCtrl(pGridSizer, wxT("Block cache in MB (0: off):"), 65536);
+	pReadAheadKBSpin_ = addSpinCtrl(pGridSizer, wxT("Read-ahead window in KB (0: off):"), 1024 * 1024);
+	pWriteBufferKBSpin_ = addSpinCtrl(pGridSizer, wxT("Write-back buffer in KB (0: off):"), 1024 * 1024);
+	pThreadCountSpin_ = addSpinCtrl(pGridSizer, wxT("Concurrent requests (0: one per core):"), 256);
+	pFirstBlockPrefetchKBSpin_ = addSpinCtrl(pGridSizer, wxT("Preload listed files up to KB (0: off):"), 1024 * 1024);
+	pMemoryBudgetMBSpin_ = addSpinCtrl(pGridSizer, wxT("Auto-tuning memory budget in MB (0: unlimited):"), 65536);
+	pGridSizer->AddSpacer(0);
+	pListingCacheCheckBox_ = new wxCheckBox(this, wxID_ANY, wxT("Cache folder listings"));
+	pGridSizer->Add(pListingCacheCheckBox_, 0, wxALIGN_CENTER_VERTICAL);
+	pGridSizer->AddSpacer(0);
+	pAutoTuneCheckBox_ = new wxCheckBox(this, wxID_ANY, wxT("Adapt sizes and requests to the use of the drive"));
+	pGridSizer->Add(pAutoTuneCheckBox_, 0, wxALIGN_CENTER_VERTICAL);
+
+	pTopSizer->Add(pGridSizer, 1, wxEXPAND | wxALL, 10);
+	pTopSizer->Add(new wxStaticText(this, wxID_ANY,
+		wxT("Block cache and concurrent requests may only change when mounted again.\n")
+		wxT("Open files keep their buffers until they are closed.\n")
+		wxT("The auto-tuning starts from these sizes and stays within the memory budget.")),
+		0, wxLEFT | wxRIGHT, 10);
+	pTopSizer->Add(CreateStdDialogButtonSizer(wxOK | wxCANCEL), 0, wxEXPAND | wxALL, 10);
+	SetSizerAndFit(pTopSizer);
+
+	setTuning(CacheTuning());
+}
+
+CacheTuningDialog::~CacheTuningDialog()
+{
+}
+
+void CacheTuningDialog::setTuning(const CacheTuning &tuning)
+{
+	pStatCacheSizeSpin_->SetValue(static_cast<int>(tuning.statCacheSize_));
+	pStatCacheTimeToLiveSpin_->SetValue(static_cast<int>(tuning.statCacheTimeToLive_));
+	pBlockCacheMBSpin_->SetValue(static_cast<int>(tuning.blockCacheMB_));
+	pReadAheadKBSpin_->SetValue(static_cast<int>(tuning.readAheadKB_));
+	pWriteBufferKBSpin_->SetValue(static_cast<int>(tuning.writeBufferKB_));
+	pThreadCountSpin_->SetValue(static_cast<int>(tuning.threadCount_));
+	pFirstBlockPrefetchKBSpin_->SetValue(static_cast<int>(tuning.firstBlockPrefetchKB_));
+	pMemoryBudgetMBSpin_->SetValue(static_cast<int>(tuning.memoryBudgetMB_));
+	pListingCacheCheckBox_->SetValue(tuning.listingCache_);
+	pAutoTuneCheckBox_->SetValue(tuning.autoTune_);
+}
+
+CacheTuning CacheTuningDialog::getTuning() const
+{
+	CacheTuning tuning;
+	tuning.statCacheSize_ = pStatCacheSizeSpin_->GetValue();
+	tuning.statCacheTimeToLive_ = pStatCacheTimeToLiveSpin_->GetValue();
+	tuning.blockCacheMB_ = pBlockCacheMBSpin_->GetValue();
+	tuning.readAheadKB_ = pReadAheadKBSpin_->GetValue();
+	tuning.writeBufferKB_ = pWriteBufferKBSpin_->GetValue();
+	tuning.threadCount_ = pThreadCountSpin_->GetValue();
+	tuning.firstBlockPrefetchKB_ = pFirstBlockPrefetchKBSpin_->GetValue();
+	tuning.memoryBudgetMB_ = pMemoryBudgetMBSpin_->GetValue();
+	tuning.listingCache_ = pListingCacheCheckBox_->GetValue();
+	tuning.autoTune_ = pAutoTuneCheckBox_->GetValue();
+	return tuning;
+}
+
+wxSpinCtrl *CacheTuningDialog::addSpinCtrl(wxFlexGridSizer *pSizer, const wxString &label, int maxValue)
+{
+	pSizer->Add(new wxStaticText(this, wxID_ANY, label), 0, wxALIGN_CENTER_VERTICAL);
+	wxSpinCtrl *pSpin = new wxSpinCtrl(this, wxID_ANY, wxEmptyString, wxDefaultPosition,
+		wxDefaultSize, wxSP_ARROW_KEYS, 0, maxValue, 0);
+	pSizer->Add(pSpin, 0, wxEXPAND);
+	return pSpin;
+}
@@ -0,0 +1,55 @@
+/**
+ * Copyright (C) 2026 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CACHETUNINGDIALOG_H
+#define CACHETUNINGDIALOG_H
+
+#include <wx/spinctrl.h>
+
+#include "CacheTuning.h"
+
+/**
+ * Edits the CacheTuning of one mount. Built in code, as it is not part of
+ * the dialogs generated from the form builder project.
+ */
+class CacheTuningDialog: public wxDialog
+{
+public:
+	CacheTuningDialog(wxWindow *parent, const wxString &mountName);
+	virtual ~CacheTuningDialog();
+
+	void setTuning(const CacheTuning &tuning);
+	CacheTuning getTuning() const;
+
+private:
+	wxSpinCtrl *addSpinCtrl(wxFlexGridSizer *pSizer, const wxString &label, int maxValue);
+
+	wxSpinCtrl *pStatCacheSizeSpin_;
+	wxSpinCtrl *pStatCacheTimeToLiveSpin_;
+	wxSpinCtrl *pBlockCacheMBSpin_;
+	wxSpinCtrl *pReadAheadKBSpin_;
+	wxSpinCtrl *pWriteBufferKBSpin_;
+	wxSpinCtrl *pThreadCountSpin_;
+	wxSpinCtrl *pFirstBlockPrefetchKBSpin_;
+	wxSpinCtrl *pMemoryBudgetMBSpin_;
+	wxCheckBox *pListingCacheCheckBox_;
+	wxCheckBox *pAutoTuneCheckBox_;
+};
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "ChangeJournal.h"
+
+#include <sstream>
+
+// The buffer is written to the file when it gets larger than this, or older
+static const size_t journalFlushSize = 64 * 1024;
+static const std::chrono::seconds journalFlushInterval(1);
+// Writes to a file recorded less than this ago are not recorded again
+static const std::chrono::seconds writeRecordInterval(1);
+// Entries of lastWritten_ before it is cleared
+static const size_t maxWriteEntries = 4096;
+
+ChangeJournal::ChangeJournal() : isOpen_(false)
+{
+}
+
+ChangeJournal::~ChangeJournal()
+{
+	close();
+}
+
+bool ChangeJournal::open(const boost::filesystem::path &fileName, const std::string &rootDir)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	out_.open(fileName, std::ios::out | std::ios::binary | std::ios::app);
+	if(!out_)
+		return false;
+
+	rootDir_ = rootDir;
+	while(!rootDir_.empty() && (rootDir_[rootDir_.size() - 1] == '/' || rootDir_[rootDir_.size() - 1] == '\\'))
+		rootDir_.erase(rootDir_.size() - 1);
+	buffer_.clear();
+	buffer_.reserve(journalFlushSize + 4096);
+	lastWritten_.clear();
+	lastFlush_ = std::chrono::steady_clock::now();
+	isOpen_ = true;
+	return true;
+}
+
+void ChangeJournal::close()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	if(!isOpen_)
+		return;
+
+	isOpen_ = false;
+	flush();
+	out_.close();
+	lastWritten_.clear();
+}
+
+void ChangeJournal::record(Change change, const std::string &cipherPath,
+	const std::string &newCipherPath)
+{
+	if(!isOpen())
+		return;
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	int64_t unixMillis = static_cast<int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count());
+
+	boost::mutex::scoped_lock lock(mutex_);
+	if(!isOpen_)
+		return;
+
+	if(change == changeWritten)
+	{
+		// Most writes belong to a file which is being written right now
+		std::unordered_map<std::string, std::chrono::steady_clock::time_point>::iterator iter =
+			lastWritten_.find(cipherPath);
+		if(iter != lastWritten_.end() && now - iter->second < writeRecordInterval)
+			return;
+		if(iter != lastWritten_.end())
+			iter->second = now;
+		else
+		{
+			if(lastWritten_.size() >= maxWriteEntries)
+				lastWritten_.clear();
+			lastWritten_[cipherPath] = now;
+		}
+	}
+	else
+	{
+		// A file written after it was moved or deleted is recorded again
+		lastWritten_.erase(cipherPath);
+	}
+
+	std::ostringstream ostr;
+	ostr << unixMillis << '\t' << static_cast<char>(change) << '\t';
+	buffer_ += ostr.str();
+	appendPath(cipherPath);
+	if(change == changeMoved)
+	{
+		buffer_ += '\t';
+		appendPath(newCipherPath);
+	}
+	buffer_ += '\n';
+
+	if(buffer_.size() >= journalFlushSize || now - lastFlush_ >= journalFlushInterval)
+	{
+		flush();
+		lastFlush_ = now;
+	}
+}
+
+// Requires the lock
+void ChangeJournal::appendPath(const std::string &cipherPath)
+{
+	size_t start = 0;
+	if(cipherPath.compare(0, rootDir_.size(), rootDir_) == 0)
+		start = rootDir_.size();
+	while(start < cipherPath.size() && (cipherPath[start] == '/' || cipherPath[start] == '\\'))
+		start++;
+
+	for(size_t i = start; i < cipherPath.size(); i++)
+	{
+		char c = cipherPath[i];
+		buffer_ += (c == '\\') ? '/' : c;
+	}
+}
+
+// Requires the lock
+void ChangeJournal::flush()
+{
+	if(!buffer_.empty())
+	{
+		out_.write(buffer_.data(), buffer_.size());
+		out_.flush();
+		buffer_.clear();
+	}
+}
@@ -0,0 +1,96 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CHANGEJOURNAL_H
+#define CHANGEJOURNAL_H
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/thread/mutex.hpp>
+
+/**
+ * Append-only text journal of the changes made to the encrypted directory
+ * through a mount.
+ *
+ * Backup and synchronization tools working on the encrypted directory can
+ * read it to find the changed files without scanning the whole tree. Each
+ * line is
+ *
+ *   <milliseconds since 1970> TAB <change> TAB <cipher path> [TAB <new cipher path>]
+ *
+ * with the change C (created), W (contents written or size changed),
+ * D (deleted) or M (moved to the new path). The paths are relative to the
+ * encrypted directory and use '/' as separator. The journal is only
+ * appended to, a tool remembers how far it has read.
+ *
+ * Writes to the same file are recorded at most once per second. Lines are
+ * written to the file in chunks, at the latest one second after the
+ * previous chunk or when the journal is closed.
+ */
+class ChangeJournal
+{
+public:
+	enum Change
+	{
+		changeCreated = 'C', changeWritten = 'W', changeDeleted = 'D', changeMoved = 'M'
+	};
+
+	ChangeJournal();
+	virtual ~ChangeJournal();
+
+	/**
+	 * rootDir is the encrypted directory, it is cut off the recorded paths.
+	 */
+	bool open(const boost::filesystem::path &fileName, const std::string &rootDir);
+	void close();
+	bool isOpen() const { return isOpen_.load(std::memory_order_relaxed); }
+
+	/**
+	 * Records a change of cipherPath, a full path below rootDir.
+	 * newCipherPath is the destination of changeMoved.
+	 */
+	void record(Change change, const std::string &cipherPath,
+		const std::string &newCipherPath = std::string());
+
+private:
+	ChangeJournal(const ChangeJournal &o) = delete;
+	ChangeJournal & operator=(const ChangeJournal & o) = delete;
+
+	void appendPath(const std::string &cipherPath);
+	void flush();
+
+	boost::mutex mutex_;
+	boost::filesystem::ofstream out_;
+	std::string rootDir_;
+	std::string buffer_;		// Written to out_ in chunks
+	std::atomic<bool> isOpen_;
+	std::chrono::steady_clock::time_point lastFlush_;
+	// When files were last recorded as written, to skip the following writes
+	std::unordered_map<std::string, std::chrono::steady_clock::time_point> lastWritten_;
+};
+
+#endif
@@ -0,0 +1,288 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "CipherBenchmark.h"
+
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CIPHERBENCHMARK_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CIPHERBENCHMARK_ARM64 1
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+// libencfs
+#include "Cipher.h"
+#include "CipherKey.h"
+#include "NameIO.h"
+
+// Size of the encoded blocks, a common volume block size
+static const int benchmarkBufferSize = 4096;
+// Minimum time spent on each algorithm and key size
+static const std::chrono::milliseconds benchmarkDuration(15);
+// Cipher used to measure the name encodings
+static const char *benchmarkNameCipher = "AES";
+static const int benchmarkNameKeySize = 256;
+// Typical filenames, of different lengths
+static const char *benchmarkNames[] = {
+	"a.txt",
+	"Makefile",
+	"IMG_20150612_183412.jpg",
+	"Quarterly report 2015 (final version).docx",
+	"node_modules_cache_0123456789abcdef0123456789abcdef.tmp"
+};
+
+#if defined(CIPHERBENCHMARK_X86)
+static void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4])
+{
+#if defined(_MSC_VER)
+	int r[4];
+	__cpuidex(r, (int)leaf, (int)subleaf);
+	for(int i = 0; i < 4; i++)
+		regs[i] = (unsigned int)r[i];
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+#endif
+
+/**
+ * OpenSSL doesn't export its capability flags in all versions, so we ask the
+ * CPU ourselves. OpenSSL uses these instructions whenever they are present.
+ */
+CipherBenchmark::CpuFeatures CipherBenchmark::probeCpu()
+{
+	CpuFeatures features;
+#if defined(CIPHERBENCHMARK_X86)
+	unsigned int regs[4];
+	cpuid(0, 0, regs);
+	unsigned int maxLeaf = regs[0];
+	if(maxLeaf >= 1)
+	{
+		cpuid(1, 0, regs);
+		features.aes = (regs[2] & (1u << 25)) != 0;
+	}
+	if(maxLeaf >= 7)
+	{
+		cpuid(7, 0, regs);
+		features.sha = (regs[1] & (1u << 29)) != 0;
+	}
+	if(features.aes)
+		features.description = "AES-NI";
+#elif defined(CIPHERBENCHMARK_ARM64)
+#if defined(_WIN32)
+	features.aes = features.sha =
+		IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE) != FALSE;
+#elif defined(__linux__)
+	unsigned long hwcap = getauxval(AT_HWCAP);
+	features.aes = (hwcap & HWCAP_AES) != 0;
+	features.sha = (hwcap & HWCAP_SHA2) != 0;
+#elif defined(__APPLE__)
+	// all 64 bit ARM Macs have the crypto extensions
+	features.aes = features.sha = true;
+#endif
+	if(features.aes)
+		features.description = "ARMv8 AES";
+#endif
+	if(features.sha)
+	{
+		if(!features.description.empty())
+			features.description += ", ";
+		features.description += "SHA";
+	}
+	return features;
+}
+
+const CipherBenchmark::CpuFeatures &CipherBenchmark::getCpuFeatures()
+{
+	static const CpuFeatures features = probeCpu();
+	return features;
+}
+
+/**
+ * Encodes blocks of benchmarkBufferSize bytes for benchmarkDuration with a
+ * random key. Returns the speed in MB/s, or 0 in case of failure.
+ */
+double CipherBenchmark::measure(const std::string &algorithm, int keySize, int &cipherBlockSize)
+{
+	std::shared_ptr<encfs::Cipher> cipher = encfs::Cipher::New(algorithm, keySize);
+	if(!cipher)
+		return 0.0;
+	encfs::CipherKey key = cipher->newRandomKey();
+	if(!key)
+		return 0.0;
+	cipherBlockSize = cipher->cipherBlockSize();
+
+	std::vector<unsigned char> buffer(benchmarkBufferSize, 0x5a);
+	uint64_t bytes = 0;
+	uint64_t iv64 = 0;
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::duration elapsed;
+	do
+	{
+		if(!cipher->blockEncode(&buffer[0], benchmarkBufferSize, iv64++, key))
+			return 0.0;
+		bytes += benchmarkBufferSize;
+		elapsed = std::chrono::steady_clock::now() - startTime;
+	} while(elapsed < benchmarkDuration);
+
+	double seconds = std::chrono::duration<double>(elapsed).count();
+	return (double)bytes / (1024.0 * 1024.0) / seconds;
+}
+
+std::vector<CipherBenchmark::Result> CipherBenchmark::measureAll()
+{
+	std::vector<Result> results;
+	encfs::Cipher::AlgorithmList algorithms = encfs::Cipher::GetAlgorithmList();
+	encfs::Cipher::AlgorithmList::const_iterator it;
+	for(it = algorithms.begin(); it != algorithms.end(); ++it)
+	{
+		int keySizeInc = it->keyLength.inc() > 0 ? it->keyLength.inc() : 1;
+		for(int keySize = it->keyLength.min(); keySize <= it->keyLength.max(); keySize += keySizeInc)
+		{
+			Result result;
+			result.algorithm = it->name;
+			result.keySize = keySize;
+			result.cipherBlockSize = 0;
+			result.megabytesPerSecond = measure(it->name, keySize, result.cipherBlockSize);
+			if(result.megabytesPerSecond > 0.0)
+				results.push_back(result);
+		}
+	}
+	return results;
+}
+
+const std::vector<CipherBenchmark::Result> &CipherBenchmark::getResults()
+{
+	static const std::vector<Result> results = measureAll();
+	return results;
+}
+
+const CipherBenchmark::Result *CipherBenchmark::getRecommended()
+{
+	const std::vector<Result> &results = getResults();
+	const Result *recommended = NULL;
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		// Ciphers with 64 bit blocks (Blowfish) are not recommended for new
+		// volumes, and only the largest key size of each algorithm counts
+		const Result &result = results[i];
+		if(result.cipherBlockSize < 16)
+			continue;
+		if(i + 1 < results.size() && results[i + 1].algorithm == result.algorithm)
+			continue;
+		if(recommended == NULL || result.megabytesPerSecond > recommended->megabytesPerSecond)
+			recommended = &result;
+	}
+	return recommended;
+}
+
+double CipherBenchmark::getSpeed(const std::string &algorithm, int keySize)
+{
+	const std::vector<Result> &results = getResults();
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		if(results[i].algorithm == algorithm && results[i].keySize == keySize)
+			return results[i].megabytesPerSecond;
+	}
+	return 0.0;
+}
+
+/**
+ * Encodes and decodes the names in benchmarkNames for benchmarkDuration.
+ * Returns the number of names per second, or 0 in case of failure.
+ */
+double CipherBenchmark::measureName(const std::string &algorithm)
+{
+	std::shared_ptr<encfs::Cipher> cipher = encfs::Cipher::New(benchmarkNameCipher, benchmarkNameKeySize);
+	if(!cipher)
+		return 0.0;
+	encfs::CipherKey key = cipher->newRandomKey();
+	if(!key)
+		return 0.0;
+	std::shared_ptr<encfs::NameIO> nameIO = encfs::NameIO::New(algorithm, cipher, key);
+	if(!nameIO)
+		return 0.0;
+
+	const size_t nameCount = sizeof(benchmarkNames) / sizeof(benchmarkNames[0]);
+	char encoded[encfs::NameBufferSize];
+	char decoded[encfs::NameBufferSize];
+	uint64_t names = 0;
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::duration elapsed;
+	try
+	{
+		do
+		{
+			for(size_t i = 0; i < nameCount; i++)
+			{
+				int len = nameIO->encodeNameInto(benchmarkNames[i], (int)strlen(benchmarkNames[i]),
+					encoded, sizeof(encoded));
+				nameIO->decodeNameInto(encoded, len, decoded, sizeof(decoded));
+			}
+			names += nameCount;
+			elapsed = std::chrono::steady_clock::now() - startTime;
+		} while(elapsed < benchmarkDuration);
+	}
+	catch(...)
+	{
+		return 0.0;
+	}
+
+	double seconds = std::chrono::duration<double>(elapsed).count();
+	return (double)names / seconds;
+}
+
+std::vector<CipherBenchmark::NameResult> CipherBenchmark::measureAllNames()
+{
+	std::vector<NameResult> results;
+	encfs::NameIO::AlgorithmList algorithms = encfs::NameIO::GetAlgorithmList();
+	encfs::NameIO::AlgorithmList::const_iterator it;
+	for(it = algorithms.begin(); it != algorithms.end(); ++it)
+	{
+		NameResult result;
+		result.algorithm = it->name;
+		result.namesPerSecond = measureName(it->name);
+		if(result.namesPerSecond > 0.0)
+			results.push_back(result);
+	}
+	return results;
+}
+
+const std::vector<CipherBenchmark::NameResult> &CipherBenchmark::getNameResults()
+{
+	static const std::vector<NameResult> results = measureAllNames();
+	return results;
+}
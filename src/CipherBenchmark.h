@@ -0,0 +1,97 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef CIPHERBENCHMARK_H
+#define CIPHERBENCHMARK_H
+
+#include <string>
+#include <vector>
+
+/**
+ * Probes the CPU for instructions which speed up the ciphers, and measures
+ * the speed of the block ciphers and name encodings of libencfs on this
+ * machine.
+ *
+ * Used by CreateNewEncFSDialog to show the cost of the cipher choices.
+ */
+class CipherBenchmark
+{
+public:
+	struct CpuFeatures
+	{
+		CpuFeatures() : aes(false), sha(false) { }
+
+		bool aes;		// AES-NI or ARMv8 AES instructions
+		bool sha;		// SHA extensions or ARMv8 SHA instructions
+		std::string description;	// e.g. "AES-NI, SHA", empty if none were found
+	};
+
+	struct Result
+	{
+		std::string algorithm;
+		int keySize;			// in bits
+		int cipherBlockSize;	// in bytes
+		double megabytesPerSecond;
+	};
+
+	struct NameResult
+	{
+		std::string algorithm;
+		double namesPerSecond;	// encoded and decoded again
+	};
+
+	static const CpuFeatures &getCpuFeatures();
+
+	/**
+	 * Block encoding speed of all algorithms and key sizes, in the order of
+	 * Cipher::GetAlgorithmList(). Measured on the first call, which takes a
+	 * few hundred milliseconds.
+	 */
+	static const std::vector<Result> &getResults();
+
+	/**
+	 * The fastest algorithm with 128 bit cipher blocks at its largest key size,
+	 * or NULL if nothing could be measured.
+	 */
+	static const Result *getRecommended();
+
+	/**
+	 * Speed of the given algorithm and key size, 0 if it was not measured.
+	 */
+	static double getSpeed(const std::string &algorithm, int keySize);
+
+	/**
+	 * Filename encoding speed of all name encodings, in the order of
+	 * NameIO::GetAlgorithmList(). Measured on the first call.
+	 */
+	static const std::vector<NameResult> &getNameResults();
+
+private:
+	CipherBenchmark() { }
+	~CipherBenchmark() { }
+
+	static CpuFeatures probeCpu();
+	static std::vector<Result> measureAll();
+	static double measure(const std::string &algorithm, int keySize, int &cipherBlockSize);
+	static std::vector<NameResult> measureAllNames();
+	static double measureName(const std::string &algorithm);
+};
+
+#endif
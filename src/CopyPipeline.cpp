@@ -0,0 +1,40 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "CopyPipeline.h"
+
+#include <algorithm>
+
+// Bytes read and written at once, rounded to whole blocks
+static const size_t targetPieceSize = 1024 * 1024;
+
+int CopyPipeline::threadCount(int requestedCount)
+{
+	return requestedCount > 0 ? requestedCount
+		: std::max(1, static_cast<int>(boost::thread::hardware_concurrency()));
+}
+
+size_t CopyPipeline::pieceSize(int blockSize)
+{
+	if(blockSize <= 0)
+		return targetPieceSize;
+	size_t size = static_cast<size_t>(blockSize);
+	return std::max<size_t>(1, targetPieceSize / size) * size;
+}
@@ -0,0 +1,126 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef COPYPIPELINE_H
+#define COPYPIPELINE_H
+
+#include <deque>
+#include <stddef.h>
+
+#include <boost/thread.hpp>
+
+/**
+ * Parts shared by the pipelines which copy the files of a volume with
+ * several threads (ExportPipeline, ImportPipeline, VolumeConverter).
+ */
+class CopyPipeline
+{
+public:
+	/**
+	 * requestedCount 0: one thread per core.
+	 */
+	static int threadCount(int requestedCount);
+
+	/**
+	 * Size of the pieces read and written at once: whole blocks, about 1 MB.
+	 * blockSize is the data size of the blocks of the file, see
+	 * encfs::FileNode::dataBlockSize().
+	 */
+	static size_t pieceSize(int blockSize);
+
+	/**
+	 * The files found by the walking thread, for the copying threads.
+	 *
+	 * Bounded, so the walk waits while the copying falls behind. After
+	 * close(), pop() returns the remaining files and then false. stop()
+	 * drops the queued files and wakes all threads.
+	 */
+	template<typename Job> class FileQueue
+	{
+	public:
+		FileQueue() : isClosed_(false), isStopped_(false) { }
+
+		/**
+		 * Waits while the queue is full. Returns false if it was stopped.
+		 */
+		bool push(const Job &job)
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			while(jobs_.size() >= maxQueuedFiles && !isStopped_)
+				spaceCond_.wait(lock);
+			if(isStopped_)
+				return false;
+			jobs_.push_back(job);
+			jobCond_.notify_one();
+			return true;
+		}
+
+		/**
+		 * Waits for a file. Returns false once the queue is closed and
+		 * empty, or stopped.
+		 */
+		bool pop(Job &job)
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			while(jobs_.empty() && !isClosed_ && !isStopped_)
+				jobCond_.wait(lock);
+			if(jobs_.empty() || isStopped_)
+				return false;
+			job = jobs_.front();
+			jobs_.pop_front();
+			spaceCond_.notify_one();
+			return true;
+		}
+
+		// No more files are pushed
+		void close()
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			isClosed_ = true;
+			jobCond_.notify_all();
+		}
+
+		void stop()
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			isStopped_ = true;
+			jobs_.clear();
+			jobCond_.notify_all();
+			spaceCond_.notify_all();
+		}
+
+	private:
+		FileQueue(const FileQueue &);
+		FileQueue &operator=(const FileQueue &);
+
+		boost::mutex mutex_;
+		boost::condition_variable jobCond_, spaceCond_;
+		std::deque<Job> jobs_;
+		bool isClosed_, isStopped_;
+	};
+
+	// Files found but not yet being copied
+	static const size_t maxQueuedFiles = 1024;
+
+private:
+	CopyPipeline();
+};
+
+#endif
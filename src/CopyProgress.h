@@ -0,0 +1,43 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef COPYPROGRESS_H
+#define COPYPROGRESS_H
+
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * Counters for showing the progress of an export, import, verification,
+ * conversion or count (see ExportPipeline, ImportPipeline, VolumeScrubber,
+ * VolumeConverter, VolumeStatistics), updated while it is busy. The totals grow while the folders are walked, until walkDone is set.
+ */
+struct CopyProgress
+{
+	CopyProgress() : filesFound(0), filesDone(0), bytesFound(0), bytesDone(0),
+		walkDone(false), cancel(false)
+	{ }
+
+	std::atomic<int64_t> filesFound, filesDone;
+	std::atomic<int64_t> bytesFound, bytesDone;
+	std::atomic<bool> walkDone;
+	std::atomic<bool> cancel;	// Set by the caller to stop the copy
+};
+
+#endif
@@ -24,6 +24,7 @@
 #define EFS_COMPATIBILITY_WORKAROUND 1
 
 #include "CreateNewEncFSDialog.h"
+#include "CipherBenchmark.h"
 #include "MountList.h"
 
 #if wxCHECK_VERSION(2, 9, 0) && defined(_WIN32)
@@ -103,6 +104,26 @@ CreateNewEncFSDialog::CreateNewEncFSDialog(wxWindow* parent)
 	}
 	pCipherAlgorithmChoice_->Select(0);
 
+	// Show the speed of the algorithms on this computer
+	const CipherBenchmark::CpuFeatures &cpuFeatures = CipherBenchmark::getCpuFeatures();
+	wxString speedStr = wxT("Block encoding speed on this computer");
+	if(!cpuFeatures.description.empty())
+		speedStr += wxT(" (") + wxString(cpuFeatures.description.c_str(), *wxConvCurrent) + wxT(")");
+	speedStr += wxT(":");
+	const std::vector<CipherBenchmark::Result> &results = CipherBenchmark::getResults();
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		speedStr += wxT("\n") + wxString(results[i].algorithm.c_str(), *wxConvCurrent)
+			+ wxString::Format(wxT(" %d bit: %.0f MB/s"), results[i].keySize, results[i].megabytesPerSecond);
+	}
+	const CipherBenchmark::Result *recommended = CipherBenchmark::getRecommended();
+	if(recommended != NULL)
+	{
+		speedStr += wxT("\nRecommended: ") + wxString(recommended->algorithm.c_str(), *wxConvCurrent)
+			+ wxString::Format(wxT(" %d bit"), recommended->keySize);
+	}
+	pCipherAlgorithmChoice_->SetToolTip(speedStr);
+
 	pNameEncodingChoice_->Clear();
 	wxString toolTipStr;
 	encfs::NameIO::AlgorithmList nmalgorithms = encfs::NameIO::GetAlgorithmList();
@@ -119,6 +140,18 @@ CreateNewEncFSDialog::CreateNewEncFSDialog(wxWindow* parent)
 		toolTipStr.Append(wxString(nmit->name.c_str(), *wxConvCurrent)
 			+ wxT(": ") + wxString(nmit->description.c_str(), *wxConvCurrent));
 	}
+	const std::vector<CipherBenchmark::NameResult> &nameResults = CipherBenchmark::getNameResults();
+	if(!nameResults.empty())
+		toolTipStr.Append(wxT("\n\nName encoding speed on this computer:"));
+	for(size_t i = 0; i < nameResults.size(); i++)
+	{
+#if defined(EFS_COMPATIBILITY_WORKAROUND)
+		if(nameResults[i].algorithm == std::string("Block32"))
+			continue;
+#endif
+		toolTipStr.Append(wxT("\n") + wxString(nameResults[i].algorithm.c_str(), *wxConvCurrent)
+			+ wxString::Format(wxT(": %.0f names/s"), nameResults[i].namesPerSecond));
+	}
 	pNameEncodingChoice_->Select(0);
 	pNameEncodingChoice_->SetToolTip(toolTipStr);
 
@@ -261,17 +294,35 @@ void CreateNewEncFSDialog::OnCipherAlgorithmChoice( wxCommandEvent& event )
 			pCipherKeysizeChoice_->Append(keySizes);
 			pCipherKeysizeChoice_->Select(keySizes.GetCount() - 1);
 
+			wxString speedStr = wxT("Block encoding speed on this computer:");
+			for(int keySize = keySizeMin; keySize <= keySizeMax; keySize += keySizeInc)
+			{
+				double speed = CipherBenchmark::getSpeed(it->name, keySize);
+				if(speed > 0.0)
+					speedStr += wxString::Format(wxT("\n%d bit: %.0f MB/s"), keySize, speed);
+			}
+			pCipherKeysizeChoice_->SetToolTip(speedStr);
+
+			// Up to 4096 bytes in the increments of the cipher, the large block sizes
+			// for volumes of big files by powers of two
+			const int smallBlockSizeMax = 4096;
 			wxArrayString blockSizes;
 			int blockSizeMin = it->blockSize.min();
 			int blockSizeMax = it->blockSize.max();
 			int blockSizeInc = it->blockSize.inc();
-			for(int blockSize = blockSizeMin; blockSize <= blockSizeMax; blockSize += blockSizeInc)
+			int defaultSelection = -1;
+			for(int blockSize = blockSizeMin; blockSize <= blockSizeMax;
+				blockSize += (blockSize < smallBlockSizeMax ? blockSizeInc : blockSize))
 			{
 				wxString blockSizeStr = wxString::Format(wxT("%d"), blockSize);
 				blockSizes.Add(blockSizeStr);
+				if(blockSize <= smallBlockSizeMax)
+					defaultSelection = static_cast<int>(blockSizes.GetCount()) - 1;
 			}
 			pCipherBlocksizeChoice_->Append(blockSizes);
-			pCipherBlocksizeChoice_->Select(blockSizes.GetCount() - 1);
+			pCipherBlocksizeChoice_->Select(defaultSelection >= 0 ? defaultSelection : blockSizes.GetCount() - 1);
+			pCipherBlocksizeChoice_->SetToolTip(wxT("Blocks of 64 KB and more speed up large files like videos and disk images,\n")
+				wxT("but every smaller write has to read and write a whole block."));
 		}
 	}
 }
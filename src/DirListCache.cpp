@@ -0,0 +1,230 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "DirListCache.h"
+
+#include <algorithm>
+
+// Folders whose last change is remembered, beyond that all are forgotten
+static const size_t maxTrackedChanges = 4096;
+
+DirListCache::DirListCache() : entryCount_(0), changesClearedGeneration_(0),
+	cacheSize_(0), generation_(0), hits_(0), misses_(0)
+{
+}
+
+DirListCache::~DirListCache()
+{
+}
+
+void DirListCache::clearCache()
+{
+	cache_.clear();
+	lru_.clear();
+	entryCount_ = 0;
+	changes_.clear();
+	changesClearedGeneration_ = ++generation_;
+}
+
+void DirListCache::setCacheSize(int cacheSize)
+{
+	cacheSize_ = cacheSize;
+	evict();
+}
+
+DirListCache::ListingPtr DirListCache::getListing(const std::string &dirPath)
+{
+	DirListCacheType::iterator iter = cache_.find(dirPath);
+	if(iter == cache_.end())
+	{
+		misses_++;
+		return ListingPtr();
+	}
+
+	lru_.splice(lru_.begin(), lru_, iter->second.lru_);
+	hits_++;
+	return iter->second.listing_;
+}
+
+void DirListCache::addListing(const std::string &dirPath, int64_t generation,
+	const ListingPtr &listing)
+{
+	if(cacheSize_ <= 0 || listing->size() > static_cast<size_t>(cacheSize_))
+		return;
+
+	// Something was changed in the folder while the listing was collected
+	if(generation < changesClearedGeneration_)
+		return;
+	std::unordered_map<std::string, int64_t>::const_iterator change = changes_.find(dirPath);
+	if(change != changes_.end() && change->second > generation)
+		return;
+
+	DirListCacheType::iterator iter = cache_.find(dirPath);
+	if(iter != cache_.end())
+		eraseEntry(iter);
+
+	iter = cache_.insert(std::make_pair(dirPath, CacheEntry())).first;
+	CacheEntry &entry = iter->second;
+	entry.listing_ = listing;
+	entry.index_.reserve(listing->size());
+	for(size_t i = 0; i < listing->size(); i++)
+		entry.index_[(*listing)[i].name_] = i;
+	entry.lru_ = lru_.insert(lru_.begin(), iter);
+	entryCount_ += listing->size();
+
+	evict();
+}
+
+void DirListCache::getListings(std::vector<std::pair<std::string, ListingPtr> > &listings) const
+{
+	listings.clear();
+	listings.reserve(lru_.size());
+	for(std::list<DirListCacheType::iterator>::const_iterator iter = lru_.begin(); iter != lru_.end(); ++iter)
+		listings.push_back(std::make_pair((*iter)->first, (*iter)->second.listing_));
+}
+
+void DirListCache::forgetListing(const std::string &dirPath)
+{
+	noteChange(dirPath);
+
+	DirListCacheType::iterator iter = cache_.find(dirPath);
+	if(iter != cache_.end())
+		eraseEntry(iter);
+}
+
+void DirListCache::forgetTree(const std::string &dirPath)
+{
+	forgetListing(dirPath);
+
+	std::string prefix = dirPath;
+	if(prefix.empty() || prefix[prefix.length() - 1] != '/')
+		prefix += '/';
+	DirListCacheType::iterator iter = cache_.lower_bound(prefix);
+	while(iter != cache_.end() && iter->first.compare(0, prefix.length(), prefix) == 0)
+	{
+		noteChange(iter->first);
+		DirListCacheType::iterator next = iter;
+		next++;
+		eraseEntry(iter);
+		iter = next;
+	}
+}
+
+void DirListCache::markStale(const std::string &dirPath, const std::string &name)
+{
+	noteChange(dirPath);
+
+	DirListCacheType::iterator iter = cache_.find(dirPath);
+	if(iter == cache_.end())
+		return;
+
+	CacheEntry &entry = iter->second;
+	std::unordered_map<std::string, size_t>::const_iterator pos = entry.index_.find(name);
+	if(pos != entry.index_.end())
+		(*entry.listing_)[pos->second].isStale_ = true;
+	else
+		eraseEntry(iter);	// The listing missed a change
+}
+
+void DirListCache::addName(const std::string &dirPath, const std::string &name)
+{
+	noteChange(dirPath);
+
+	DirListCacheType::iterator iter = cache_.find(dirPath);
+	if(iter == cache_.end())
+		return;
+
+	CacheEntry &entry = iter->second;
+	std::unordered_map<std::string, size_t>::const_iterator pos = entry.index_.find(name);
+	if(pos != entry.index_.end())
+	{
+		// Replaced
+		(*entry.listing_)[pos->second].isStale_ = true;
+		return;
+	}
+
+	makeUnshared(entry);
+	Entry newEntry;
+	newEntry.name_ = name;
+	newEntry.isStale_ = true;
+	entry.index_[name] = entry.listing_->size();
+	entry.listing_->push_back(newEntry);
+	entryCount_++;
+
+	evict();
+}
+
+void DirListCache::removeName(const std::string &dirPath, const std::string &name)
+{
+	noteChange(dirPath);
+
+	DirListCacheType::iterator iter = cache_.find(dirPath);
+	if(iter == cache_.end())
+		return;
+
+	CacheEntry &entry = iter->second;
+	std::unordered_map<std::string, size_t>::iterator pos = entry.index_.find(name);
+	if(pos == entry.index_.end())
+		return;
+
+	// The order of the entries doesn't matter, move the last one into the gap
+	makeUnshared(entry);
+	Listing &listing = *entry.listing_;
+	size_t i = pos->second;
+	entry.index_.erase(pos);
+	if(i + 1 < listing.size())
+	{
+		listing[i] = std::move(listing.back());
+		entry.index_[listing[i].name_] = i;
+	}
+	listing.pop_back();
+	entryCount_--;
+}
+
+void DirListCache::noteChange(const std::string &dirPath)
+{
+	changes_[dirPath] = ++generation_;
+	if(changes_.size() > maxTrackedChanges)
+	{
+		changes_.clear();
+		changesClearedGeneration_ = ++generation_;
+	}
+}
+
+void DirListCache::eraseEntry(DirListCacheType::iterator iter)
+{
+	entryCount_ -= iter->second.listing_->size();
+	lru_.erase(iter->second.lru_);
+	cache_.erase(iter);
+}
+
+/**
+ * Evicts the least recently used listings until the entries fit into the cache size.
+ */
+void DirListCache::evict()
+{
+	while(!lru_.empty() && entryCount_ > static_cast<size_t>(std::max(cacheSize_, 0)))
+		eraseEntry(lru_.back());
+}
+
+void DirListCache::makeUnshared(CacheEntry &entry)
+{
+	if(entry.listing_.use_count() > 1)
+		entry.listing_ = std::make_shared<Listing>(*entry.listing_);
+}
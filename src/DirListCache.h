@@ -0,0 +1,143 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DIRLISTCACHE_H
+#define DIRLISTCACHE_H
+
+#include "config.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#ifndef _INC_WINDOWS
+#define _INC_WINDOWS
+#endif
+
+// Pismo File Mount, required for PfmAttribs
+#include "pfmapi.h"
+
+/**
+ * This class caches complete directory listings.
+ *
+ * Explorer and the file dialogs list the same folders many times, and the
+ * Properties dialog lists a whole tree to sum up its size. Every listing decrypts
+ * all names and reads the header of every file, so it is helpful to keep the
+ * result of the last complete listing of a folder.
+ *
+ * Changes to a folder update its listing instead of dropping it: entries whose
+ * attributes changed are marked stale and refreshed when the listing is used
+ * the next time, names are added and removed in place. Listings are shared with
+ * the List requests serving them, so they must only be accessed with the lock of
+ * the owner held.
+ */
+class DirListCache
+{
+public:
+	struct Entry
+	{
+		Entry() : attribs_(), isStale_(false) { }
+
+		std::string name_;
+		PfmAttribs attribs_;
+		bool isStale_;		// attribs_ must be determined again
+	};
+	typedef std::vector<Entry> Listing;
+	typedef std::shared_ptr<Listing> ListingPtr;
+
+	DirListCache();
+	virtual ~DirListCache();
+
+	void clearCache();
+
+	/**
+	 * The size is the number of entries of all listings together.
+	 */
+	void setCacheSize(int cacheSize);
+	int getCachesize() const { return cacheSize_; }
+
+	/**
+	 * The generation changes whenever a folder is changed.
+	 * A listing collected while its folder changed might be outdated.
+	 */
+	int64_t getGeneration() const { return generation_; }
+
+	ListingPtr getListing(const std::string &dirPath);
+	// Like getListing(), without counting a hit or miss
+	bool hasListing(const std::string &dirPath) const { return cache_.find(dirPath) != cache_.end(); }
+
+	void addListing(const std::string &dirPath, int64_t generation, const ListingPtr &listing);
+
+	// All listings with the paths of their folders, most recently used first
+	void getListings(std::vector<std::pair<std::string, ListingPtr> > &listings) const;
+
+	void forgetListing(const std::string &dirPath);
+	// Forgets the listing of dirPath and of all folders below it
+	void forgetTree(const std::string &dirPath);
+
+	// The attributes of the file changed
+	void markStale(const std::string &dirPath, const std::string &name);
+	// A file was added to or removed from the folder
+	void addName(const std::string &dirPath, const std::string &name);
+	void removeName(const std::string &dirPath, const std::string &name);
+
+	uint64_t getHits() const { return hits_; }
+	uint64_t getMisses() const { return misses_; }
+
+private:
+	struct CacheEntry;
+	typedef std::map<std::string, CacheEntry> DirListCacheType;
+
+	struct CacheEntry
+	{
+		ListingPtr listing_;
+		std::unordered_map<std::string, size_t> index_;		// Position of the names in listing_
+		std::list<DirListCacheType::iterator>::iterator lru_;
+	};
+
+	void noteChange(const std::string &dirPath);
+	void eraseEntry(DirListCacheType::iterator iter);
+	void evict();
+	// A listing may be served by a List request, its size is only changed in a copy
+	static void makeUnshared(CacheEntry &entry);
+
+	DirListCacheType cache_;
+	std::list<DirListCacheType::iterator> lru_;		// Most recently used first
+	size_t entryCount_;
+
+	// Generation of the last change of folders which changed recently, see addListing()
+	std::unordered_map<std::string, int64_t> changes_;
+	int64_t changesClearedGeneration_;
+
+	int cacheSize_;
+	int64_t generation_;
+	uint64_t hits_;
+	uint64_t misses_;
+};
+
+#endif
@@ -31,6 +31,7 @@
 
 #include "PFMProxy.h"
 #include "OpenSSLProxy.h"
+#include "EncFSMPStrings.h"
 
 #include "easylogging++.h"
 
@@ -132,10 +133,12 @@ bool EncFSMPApp::OnInit()
 		{ wxCMD_LINE_PARAM, "Command", "Command", "Command to run", wxCMD_LINE_VAL_STRING, wxCMD_LINE_OPTION_MANDATORY },
 		{ wxCMD_LINE_OPTION, "m", "mount", "The name of the EncFS mount", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
 		{ wxCMD_LINE_OPTION, "p", "password", "The password", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+		{ wxCMD_LINE_PARAM, NULL, NULL, "Names of further EncFS mounts", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL | wxCMD_LINE_PARAM_MULTIPLE },
 #else
 		{ wxCMD_LINE_PARAM, wxT("Command"), wxT("Command"), wxT("Command to run"), wxCMD_LINE_VAL_STRING, wxCMD_LINE_OPTION_MANDATORY },
 		{ wxCMD_LINE_OPTION, wxT("m"), wxT("mount"), wxT("The name of the EncFS mount"), wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
 		{ wxCMD_LINE_OPTION, wxT("p"), wxT("password"), wxT("The password"), wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+		{ wxCMD_LINE_PARAM, NULL, NULL, wxT("Names of further EncFS mounts"), wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL | wxCMD_LINE_PARAM_MULTIPLE },
 #endif
 		{ wxCMD_LINE_NONE }
 	};
@@ -144,7 +147,8 @@ bool EncFSMPApp::OnInit()
 	parser.SetDesc(cmdLineDesc);
 	
 	// Only parse command line if there is at least one argument
-	wxString command, mountName, password;
+	wxString command, password;
+	wxArrayString mountNames;
 	if(argc > 1)
 	{
 		if(parser.Parse() == 0)
@@ -152,7 +156,9 @@ bool EncFSMPApp::OnInit()
 			wxString param;
 			command = parser.GetParam();
 			if(parser.Found(wxT("m"), &param))
-				mountName = param;
+				mountNames.Add(param);
+			for(size_t i = 1; i < parser.GetParamCount(); i++)
+				mountNames.Add(parser.GetParam(i));
 			if(parser.Found(wxT("p"), &param))
 				password = param;
 
@@ -180,7 +186,7 @@ bool EncFSMPApp::OnInit()
 	{
 		if(!command.IsEmpty())
 		{
-			EncFSMPIPC::sendCommand(command, mountName, password);
+			sendCommands(command, mountNames, password);
 			return false;
 		}
 		else
@@ -209,12 +215,64 @@ bool EncFSMPApp::OnInit()
 	// Monitor thread needs top window
 	PFMProxy::getInstance().startMonitorThread();
 
-	if(!command.IsEmpty() && !mountName.IsEmpty())
-		pMainFrame_->sendCommand(command, mountName, password);
+	if(!command.IsEmpty())
+	{
+		if(command.IsSameAs(EncFSMPStrings::commandMountAll_, false))
+			pMainFrame_->sendCommand(command, wxEmptyString, password);
+		for(size_t i = 0; i < mountNames.Count(); i++)
+			pMainFrame_->sendCommand(command, mountNames[i], password);
+	}
 
 	return true;
 }
 
+/**
+ * Sends the command for all mounts to the running instance.
+ *
+ * Uses a single request on the command channel, falling back to one
+ * message per mount if the running instance does not offer the channel.
+ */
+void EncFSMPApp::sendCommands(const wxString &command, const wxArrayString &mountNames,
+	const wxString &password)
+{
+	std::vector<EncFSMPIPCProtocol::Command> commands;
+	EncFSMPIPCProtocol::Command cmd;
+	cmd.command = std::string(command.utf8_str());
+	cmd.password = std::string(password.utf8_str());
+	if(mountNames.IsEmpty())
+		commands.push_back(cmd);
+	for(size_t i = 0; i < mountNames.Count(); i++)
+	{
+		cmd.mountName = std::string(mountNames[i].utf8_str());
+		commands.push_back(cmd);
+	}
+
+	std::vector<EncFSMPIPCProtocol::Result> results;
+	if(!EncFSMPIPC::sendBatch(commands, results))
+	{
+		if(mountNames.IsEmpty())
+			EncFSMPIPC::sendCommand(command, wxEmptyString, password);
+		for(size_t i = 0; i < mountNames.Count(); i++)
+			EncFSMPIPC::sendCommand(command, mountNames[i], password);
+		return;
+	}
+
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		const EncFSMPIPCProtocol::Result &result = results[i];
+		std::cout << result.mountName << "\t";
+		if(result.status != EncFSMPIPCProtocol::StatusOK)
+			std::cout << "failed: " << result.message;
+		else if(result.mountState == MountEntry::MSMounted)
+			std::cout << "mounted\t" << result.mountPoint;
+		else if(result.mountState == MountEntry::MSPending)
+			std::cout << "pending";
+		else
+			std::cout << "not mounted";
+		std::cout << std::endl;
+	}
+}
+
 int EncFSMPApp::OnExit()
 {
 	EncFSMPIPC::cleanup();
@@ -36,6 +36,9 @@ protected:
 	wxDECLARE_EVENT_TABLE();
 
 private:
+	void sendCommands(const wxString &command, const wxArrayString &mountNames,
+		const wxString &password);
+
 	EncFSMPMainFrame *pMainFrame_;
 	wxSingleInstanceChecker *pSingleInstanceChecker_;
 };
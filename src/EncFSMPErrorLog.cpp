@@ -83,6 +83,15 @@ void EncFSMPErrorLog::addText(const wxString &text)
 #endif
 }
 
+/**
+ * Add informational text to the log window, which doesn't show the window
+ * like an error does.
+ */
+void EncFSMPErrorLog::addInfoText(const wxString &text)
+{
+	(*pErrorListTextCtrl_) << text;
+}
+
 void EncFSMPErrorLog::OnClose( wxCloseEvent& event )
 {
 	isWindowShown_ = false;
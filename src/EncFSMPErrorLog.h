@@ -35,6 +35,8 @@ public:
 	bool isWindowShown();
 
 	void addText(const wxString &text);
+	// Adds text without showing the window, only from the GUI thread
+	void addInfoText(const wxString &text);
 	void ping();
 
 protected:
@@ -31,9 +31,19 @@
 #include <wx/tokenzr.h>
 #include <wx/stdpaths.h>
 
+#include <atomic>
+#include <string>
+#include <vector>
+
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
 
 /**
  * This class defines the server.
@@ -94,8 +104,186 @@ protected:
 
 };
 
+/**
+ * Reads and writes the frames of the command channel (see EncFSMPIPCProtocol).
+ */
+static bool readFully(int fd, void *buf, size_t len)
+{
+	char *ptr = static_cast<char *>(buf);
+	while(len > 0)
+	{
+		ssize_t numread = read(fd, ptr, len);
+		if(numread < 0 && errno == EINTR)
+			continue;
+		if(numread <= 0)
+			return false;
+		ptr += numread;
+		len -= numread;
+	}
+	return true;
+}
+
+static bool writeFully(int fd, const void *buf, size_t len)
+{
+	int flags = 0;
+#if defined(MSG_NOSIGNAL)
+	flags = MSG_NOSIGNAL;	// A client which went away must not kill us with SIGPIPE
+#endif
+	const char *ptr = static_cast<const char *>(buf);
+	while(len > 0)
+	{
+		ssize_t numwritten = send(fd, ptr, len, flags);
+		if(numwritten < 0 && errno == EINTR)
+			continue;
+		if(numwritten <= 0)
+			return false;
+		ptr += numwritten;
+		len -= numwritten;
+	}
+	return true;
+}
+
+static bool readFrame(int fd, std::string &payload)
+{
+	unsigned char header[EncFSMPIPCProtocol::frameHeaderSize];
+	if(!readFully(fd, header, sizeof(header)))
+		return false;
+	int64_t length = EncFSMPIPCProtocol::frameLength(header);
+	if(length < 0)
+		return false;
+	payload.resize(static_cast<size_t>(length));
+	return (length == 0 || readFully(fd, &payload[0], payload.size()));
+}
+
+static bool writeFrame(int fd, const std::string &payload)
+{
+	std::string frame = EncFSMPIPCProtocol::makeFrame(payload);
+	return writeFully(fd, frame.data(), frame.size());
+}
+
+static int createChannelSocket(sockaddr_un &addr)
+{
+	std::string path(EncFSMPIPC::getChannelFilename().mb_str());
+	if(path.size() >= sizeof(addr.sun_path))
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+#if defined(SO_NOSIGPIPE)
+	if(fd >= 0)
+	{
+		int noSigPipe = 1;
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+	}
+#endif
+	return fd;
+}
+
+static EncFSMPMainFrame *getMainFrame()
+{
+	EncFSMPMainFrame *pMainFrame = NULL;
+	wxWindow *pTopWindow = wxTheApp->GetTopWindow();
+	if(pTopWindow != NULL)
+		pMainFrame = dynamic_cast<EncFSMPMainFrame*>(pTopWindow);
+	return pMainFrame;
+}
+
+// Set by EncFSMPIPC::cleanup(), the channel server stops accepting connections
+static std::atomic<bool> isChannelStopping(false);
+
+/**
+ * One client of the command channel.
+ *
+ * Serves the requests of the client until it closes the connection.
+ */
+class EncFSMPIPC_ChannelConnection: public wxThread
+{
+public:
+	EncFSMPIPC_ChannelConnection(int fd): wxThread(wxTHREAD_DETACHED), fd_(fd)
+	{
+	}
+	virtual ~EncFSMPIPC_ChannelConnection()
+	{
+		close(fd_);
+	}
+
+protected:
+	wxThread::ExitCode Entry()
+	{
+		std::string request;
+		while(!TestDestroy() && readFrame(fd_, request))
+		{
+			std::vector<EncFSMPIPCProtocol::Command> commands;
+			std::vector<EncFSMPIPCProtocol::Result> results;
+			if(!EncFSMPIPCProtocol::decodeRequest(request, commands))
+				break;
+
+			EncFSMPMainFrame *pMainFrame = getMainFrame();
+			if(pMainFrame == NULL)
+				break;
+			pMainFrame->runCommandBatch(commands, results);
+
+			if(!writeFrame(fd_, EncFSMPIPCProtocol::encodeResponse(results)))
+				break;
+		}
+
+		return (wxThread::ExitCode)0;
+	}
+
+private:
+	int fd_;
+};
+
+/**
+ * Accepts the connections of the command channel, a Unix domain socket.
+ */
+class EncFSMPIPC_ChannelServer: public wxThread
+{
+public:
+	EncFSMPIPC_ChannelServer(int listenFd): wxThread(wxTHREAD_DETACHED), listenFd_(listenFd)
+	{
+	}
+	virtual ~EncFSMPIPC_ChannelServer()
+	{
+		close(listenFd_);
+	}
+
+protected:
+	wxThread::ExitCode Entry()
+	{
+		while(!TestDestroy() && !isChannelStopping)
+		{
+			// Check isChannelStopping a few times per second
+			pollfd pfd;
+			pfd.fd = listenFd_;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			int res = poll(&pfd, 1, 200);
+			if(res < 0 && errno != EINTR)
+				break;
+			if(res <= 0)
+				continue;
+
+			int fd = accept(listenFd_, NULL, NULL);
+			if(fd < 0)
+				continue;
+			EncFSMPIPC_ChannelConnection *pConnection = new EncFSMPIPC_ChannelConnection(fd);
+			if(pConnection->Create() != wxTHREAD_NO_ERROR || pConnection->Run() != wxTHREAD_NO_ERROR)
+				delete pConnection;
+		}
+
+		return (wxThread::ExitCode)0;
+	}
+
+private:
+	int listenFd_;
+};
+
 EncFSMPIPC_Server *EncFSMPIPC::pServer_ = NULL;
 wxString EncFSMPIPC::fifoFilename_;
+wxString EncFSMPIPC::channelFilename_;
 
 void EncFSMPIPC::initialize()
 {
@@ -115,12 +303,35 @@ void EncFSMPIPC::initialize()
 	pServer_ = new EncFSMPIPC_Server();
 	pServer_->Create();
 	pServer_->Run();
+
+	// Command channel, only this user may connect
+	sockaddr_un addr;
+	int listenFd = createChannelSocket(addr);
+	if(listenFd >= 0)
+	{
+		unlink(addr.sun_path);
+		if(bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0
+			&& chmod(addr.sun_path, S_IRUSR | S_IWUSR) == 0
+			&& listen(listenFd, 8) == 0)
+		{
+			isChannelStopping = false;
+			EncFSMPIPC_ChannelServer *pChannelServer = new EncFSMPIPC_ChannelServer(listenFd);
+			if(pChannelServer->Create() != wxTHREAD_NO_ERROR || pChannelServer->Run() != wxTHREAD_NO_ERROR)
+				delete pChannelServer;
+		}
+		else
+			close(listenFd);
+	}
 }
 
 void EncFSMPIPC::cleanup()
 {
 	if(wxFileName::Exists(getFIFOFilename()))
 		wxRemoveFile(getFIFOFilename());
+
+	isChannelStopping = true;
+	if(wxFileName::Exists(getChannelFilename()))
+		wxRemoveFile(getChannelFilename());
 }
 
 void EncFSMPIPC::sendCommand(const wxString &command,
@@ -138,6 +349,23 @@ void EncFSMPIPC::sendCommand(const wxString &command,
 	}
 }
 
+bool EncFSMPIPC::sendBatch(const std::vector<EncFSMPIPCProtocol::Command> &commands,
+	std::vector<EncFSMPIPCProtocol::Result> &results)
+{
+	sockaddr_un addr;
+	int fd = createChannelSocket(addr);
+	if(fd < 0)
+		return false;
+
+	std::string response;
+	bool isOK = (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0
+		&& writeFrame(fd, EncFSMPIPCProtocol::encodeRequest(commands))
+		&& readFrame(fd, response)
+		&& EncFSMPIPCProtocol::decodeResponse(response, results));
+	close(fd);
+	return isOK;
+}
+
 wxString EncFSMPIPC::marshalArguments(const wxString &command,
 	const wxString &mountName,
 	const wxString &password)
@@ -204,3 +432,14 @@ wxString EncFSMPIPC::getFIFOFilename()
 	return fifoFilename_;
 }
 
+wxString EncFSMPIPC::getChannelFilename()
+{
+	if(channelFilename_.IsEmpty())
+	{
+		wxString dataDir = wxStandardPaths::Get().GetUserDataDir();
+		wxFileName fn(dataDir, wxT("ipc_socket"));
+		channelFilename_ = fn.GetFullPath();
+	}
+	return channelFilename_;
+}
+
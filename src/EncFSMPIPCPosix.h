@@ -20,6 +20,10 @@
 #ifndef ENCFSMPIPCPOSIX_H
 #define ENCFSMPIPCPOSIX_H
 
+#include <vector>
+
+#include "EncFSMPIPCProtocol.h"
+
 class EncFSMPIPC_Server;
 
 class EncFSMPIPC
@@ -40,7 +44,15 @@ public:
 		wxString &mountName,
 		wxString &password);
 
+	/**
+	 * Sends the commands over the command channel (see EncFSMPIPCProtocol)
+	 * and waits for their results. Returns false if no instance is listening.
+	 */
+	static bool sendBatch(const std::vector<EncFSMPIPCProtocol::Command> &commands,
+		std::vector<EncFSMPIPCProtocol::Result> &results);
+
 	static wxString getFIFOFilename();
+	static wxString getChannelFilename();
 
 private:
 	EncFSMPIPC() { }
@@ -48,6 +60,7 @@ private:
 
 	static EncFSMPIPC_Server *pServer_;
 	static wxString fifoFilename_;
+	static wxString channelFilename_;
 };
 
 #endif
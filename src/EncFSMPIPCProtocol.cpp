@@ -0,0 +1,178 @@
+/**
+ * Copyright (C) 2026 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "EncFSMPIPCProtocol.h"
+
+namespace
+{
+
+void putUInt32(std::string &out, uint32_t value)
+{
+	for(int i = 0; i < 4; i++)
+		out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+void putString(std::string &out, const std::string &str)
+{
+	putUInt32(out, static_cast<uint32_t>(str.size()));
+	out.append(str);
+}
+
+/**
+ * Reads the fields of a payload, every get fails once the end is passed.
+ */
+class PayloadReader
+{
+public:
+	PayloadReader(const std::string &payload) : payload_(payload), pos_(0) { }
+
+	bool getUInt8(uint8_t &value)
+	{
+		if(payload_.size() - pos_ < 1)
+			return false;
+		value = static_cast<uint8_t>(payload_[pos_++]);
+		return true;
+	}
+
+	bool getUInt32(uint32_t &value)
+	{
+		if(payload_.size() - pos_ < 4)
+			return false;
+		value = 0;
+		for(int i = 0; i < 4; i++)
+			value |= static_cast<uint32_t>(static_cast<unsigned char>(payload_[pos_++])) << (8 * i);
+		return true;
+	}
+
+	bool getString(std::string &str)
+	{
+		uint32_t length = 0;
+		if(!getUInt32(length) || payload_.size() - pos_ < length)
+			return false;
+		str.assign(payload_, pos_, length);
+		pos_ += length;
+		return true;
+	}
+
+	bool isAtEnd() const { return pos_ == payload_.size(); }
+
+	// Each entry takes at least this many bytes, for checking the count before reserving
+	bool canHold(uint32_t count, size_t minEntrySize) const
+	{
+		return count <= (payload_.size() - pos_) / minEntrySize;
+	}
+
+private:
+	const std::string &payload_;
+	size_t pos_;
+};
+
+}
+
+std::string EncFSMPIPCProtocol::encodeRequest(const std::vector<Command> &commands)
+{
+	std::string out;
+	putUInt32(out, requestMagic);
+	putUInt32(out, static_cast<uint32_t>(commands.size()));
+	for(size_t i = 0; i < commands.size(); i++)
+	{
+		putString(out, commands[i].command);
+		putString(out, commands[i].mountName);
+		putString(out, commands[i].password);
+		putString(out, commands[i].query);
+	}
+	return out;
+}
+
+bool EncFSMPIPCProtocol::decodeRequest(const std::string &payload, std::vector<Command> &commands)
+{
+	PayloadReader reader(payload);
+	uint32_t magic = 0, count = 0;
+	if(!reader.getUInt32(magic) || magic != requestMagic
+		|| !reader.getUInt32(count) || !reader.canHold(count, 4 * 4))
+		return false;
+
+	commands.clear();
+	commands.resize(count);
+	for(uint32_t i = 0; i < count; i++)
+	{
+		Command &cmd = commands[i];
+		if(!reader.getString(cmd.command) || !reader.getString(cmd.mountName)
+			|| !reader.getString(cmd.password) || !reader.getString(cmd.query))
+			return false;
+	}
+	return reader.isAtEnd();
+}
+
+std::string EncFSMPIPCProtocol::encodeResponse(const std::vector<Result> &results)
+{
+	std::string out;
+	putUInt32(out, responseMagic);
+	putUInt32(out, static_cast<uint32_t>(results.size()));
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		const Result &result = results[i];
+		out.push_back(static_cast<char>(result.status));
+		out.push_back(static_cast<char>(result.mountState));
+		putString(out, result.mountName);
+		putString(out, result.mountPoint);
+		putString(out, result.message);
+	}
+	return out;
+}
+
+bool EncFSMPIPCProtocol::decodeResponse(const std::string &payload, std::vector<Result> &results)
+{
+	PayloadReader reader(payload);
+	uint32_t magic = 0, count = 0;
+	if(!reader.getUInt32(magic) || magic != responseMagic
+		|| !reader.getUInt32(count) || !reader.canHold(count, 2 + 3 * 4))
+		return false;
+
+	results.clear();
+	results.resize(count);
+	for(uint32_t i = 0; i < count; i++)
+	{
+		Result &result = results[i];
+		if(!reader.getUInt8(result.status) || !reader.getUInt8(result.mountState)
+			|| !reader.getString(result.mountName) || !reader.getString(result.mountPoint)
+			|| !reader.getString(result.message))
+			return false;
+	}
+	return reader.isAtEnd();
+}
+
+std::string EncFSMPIPCProtocol::makeFrame(const std::string &payload)
+{
+	std::string frame;
+	frame.reserve(frameHeaderSize + payload.size());
+	putUInt32(frame, static_cast<uint32_t>(payload.size()));
+	frame.append(payload);
+	return frame;
+}
+
+int64_t EncFSMPIPCProtocol::frameLength(const unsigned char header[frameHeaderSize])
+{
+	uint32_t length = 0;
+	for(size_t i = 0; i < frameHeaderSize; i++)
+		length |= static_cast<uint32_t>(header[i]) << (8 * i);
+	if(length > maxFrameSize)
+		return -1;
+	return length;
+}
@@ -0,0 +1,98 @@
+/**
+ * Copyright (C) 2026 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ENCFSMPIPCPROTOCOL_H
+#define ENCFSMPIPCPROTOCOL_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * Binary messages of the command channel of EncFSMP (see EncFSMPIPC::sendBatch).
+ *
+ * A client connects once and can send any number of requests over the same
+ * connection, each one answered by a response. Every message is a frame:
+ * the length of the payload as uint32, then the payload. All integers are
+ * little endian, strings are UTF-8 with their length as uint32 in front.
+ *
+ *   request:  uint32 requestMagic, uint32 count,
+ *             count times: string command, string mountName, string password,
+ *             string query
+ *   response: uint32 responseMagic, uint32 count,
+ *             count times: uint8 status, uint8 mountState, string mountName,
+ *             string mountPoint, string message
+ *
+ * The commands are the ones of the command line (see EncFSMPStrings), plus
+ * "status" and "search". Every command has one result, except "status" without
+ * a mount name, which returns one result for each mount, and "search".
+ *
+ * "search" looks up the query in the name index of a mounted drive (see
+ * NameIndex::search()), the other commands leave the query empty. Its first result
+ * has the message "complete" or "incomplete", the latter while the index is
+ * being built or if there were too many matches. One result follows for each
+ * match, with the message "path\tsize\tmtime", size -1 for folders.
+ */
+namespace EncFSMPIPCProtocol
+{
+	static const uint32_t requestMagic = 0x32514345;	// "ECQ2", "ECQ1" had no query
+	static const uint32_t responseMagic = 0x31524345;	// "ECR1"
+
+	// Larger frames are rejected, a batch has a few hundred bytes per command
+	static const uint32_t maxFrameSize = 1024 * 1024;
+	static const size_t frameHeaderSize = 4;
+
+	enum Status
+	{
+		StatusOK = 0, StatusFailed
+	};
+
+	struct Command
+	{
+		std::string command, mountName, password, query;
+	};
+
+	struct Result
+	{
+		uint8_t status;
+		uint8_t mountState;		// MountEntry::MountState
+		std::string mountName, mountPoint, message;
+
+		Result() : status(StatusOK), mountState(0) { }
+	};
+
+	std::string encodeRequest(const std::vector<Command> &commands);
+	bool decodeRequest(const std::string &payload, std::vector<Command> &commands);
+
+	std::string encodeResponse(const std::vector<Result> &results);
+	bool decodeResponse(const std::string &payload, std::vector<Result> &results);
+
+	/**
+	 * The frame of a payload, ready to be written.
+	 */
+	std::string makeFrame(const std::string &payload);
+
+	/**
+	 * Length of the payload following the frame header, or -1 if it is
+	 * larger than maxFrameSize.
+	 */
+	int64_t frameLength(const unsigned char header[frameHeaderSize]);
+}
+
+#endif
@@ -32,6 +32,15 @@
 #endif
 #include <wx/tokenzr.h>
 
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+// Buffer sizes of the pipe of the command channel
+static const DWORD channelBufferSize = 64 * 1024;
+
 class EncFSMPIPC_Server;
 
 /**
@@ -129,6 +138,169 @@ public:
 	}
 };
 
+/**
+ * Reads and writes the frames of the command channel (see EncFSMPIPCProtocol).
+ */
+static bool readFully(HANDLE pipe, void *buf, size_t len)
+{
+	char *ptr = static_cast<char *>(buf);
+	while(len > 0)
+	{
+		DWORD numread = 0;
+		if(!ReadFile(pipe, ptr, static_cast<DWORD>(len), &numread, NULL) || numread == 0)
+			return false;
+		ptr += numread;
+		len -= numread;
+	}
+	return true;
+}
+
+static bool writeFully(HANDLE pipe, const void *buf, size_t len)
+{
+	const char *ptr = static_cast<const char *>(buf);
+	while(len > 0)
+	{
+		DWORD numwritten = 0;
+		if(!WriteFile(pipe, ptr, static_cast<DWORD>(len), &numwritten, NULL) || numwritten == 0)
+			return false;
+		ptr += numwritten;
+		len -= numwritten;
+	}
+	return true;
+}
+
+static bool readFrame(HANDLE pipe, std::string &payload)
+{
+	unsigned char header[EncFSMPIPCProtocol::frameHeaderSize];
+	if(!readFully(pipe, header, sizeof(header)))
+		return false;
+	int64_t length = EncFSMPIPCProtocol::frameLength(header);
+	if(length < 0)
+		return false;
+	payload.resize(static_cast<size_t>(length));
+	return (length == 0 || readFully(pipe, &payload[0], payload.size()));
+}
+
+static bool writeFrame(HANDLE pipe, const std::string &payload)
+{
+	std::string frame = EncFSMPIPCProtocol::makeFrame(payload);
+	return writeFully(pipe, frame.data(), frame.size());
+}
+
+/**
+ * Name of the pipe of the command channel, one per user.
+ */
+static std::wstring getChannelPipeName()
+{
+	wxString name = wxT("\\\\.\\pipe\\") + EncFSMPStrings::commandChannelName_
+		+ wxT("-") + wxGetUserId();
+	return std::wstring(name.wc_str());
+}
+
+static EncFSMPMainFrame *getMainFrame()
+{
+	EncFSMPMainFrame *pMainFrame = NULL;
+	wxWindow *pTopWindow = wxTheApp->GetTopWindow();
+	if(pTopWindow != NULL)
+		pMainFrame = dynamic_cast<EncFSMPMainFrame*>(pTopWindow);
+	return pMainFrame;
+}
+
+// Set by EncFSMPIPC::cleanup(), the channel server stops accepting connections
+static std::atomic<bool> isChannelStopping(false);
+
+/**
+ * One client of the command channel.
+ *
+ * Serves the requests of the client until it closes the connection.
+ */
+class EncFSMPIPC_ChannelConnection: public wxThread
+{
+public:
+	EncFSMPIPC_ChannelConnection(HANDLE pipe): wxThread(wxTHREAD_DETACHED), pipe_(pipe)
+	{
+	}
+	virtual ~EncFSMPIPC_ChannelConnection()
+	{
+		DisconnectNamedPipe(pipe_);
+		CloseHandle(pipe_);
+	}
+
+protected:
+	wxThread::ExitCode Entry()
+	{
+		std::string request;
+		while(!TestDestroy() && readFrame(pipe_, request))
+		{
+			std::vector<EncFSMPIPCProtocol::Command> commands;
+			std::vector<EncFSMPIPCProtocol::Result> results;
+			if(!EncFSMPIPCProtocol::decodeRequest(request, commands))
+				break;
+
+			EncFSMPMainFrame *pMainFrame = getMainFrame();
+			if(pMainFrame == NULL)
+				break;
+			pMainFrame->runCommandBatch(commands, results);
+
+			if(!writeFrame(pipe_, EncFSMPIPCProtocol::encodeResponse(results)))
+				break;
+		}
+
+		return (wxThread::ExitCode)0;
+	}
+
+private:
+	HANDLE pipe_;
+};
+
+/**
+ * Accepts the connections of the command channel, a named pipe.
+ */
+class EncFSMPIPC_ChannelServer: public wxThread
+{
+public:
+	EncFSMPIPC_ChannelServer(): wxThread(wxTHREAD_DETACHED)
+	{
+	}
+	virtual ~EncFSMPIPC_ChannelServer()
+	{
+	}
+
+protected:
+	wxThread::ExitCode Entry()
+	{
+		std::wstring pipeName = getChannelPipeName();
+		// Fail instead of sharing the name with a pipe somebody else created first
+		DWORD openMode = PIPE_ACCESS_DUPLEX | FILE_FLAG_FIRST_PIPE_INSTANCE;
+		DWORD pipeMode = PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT;
+#if defined(PIPE_REJECT_REMOTE_CLIENTS)
+		pipeMode |= PIPE_REJECT_REMOTE_CLIENTS;
+#endif
+		while(!TestDestroy() && !isChannelStopping)
+		{
+			HANDLE pipe = CreateNamedPipeW(pipeName.c_str(), openMode, pipeMode,
+				PIPE_UNLIMITED_INSTANCES, channelBufferSize, channelBufferSize, 0, NULL);
+			if(pipe == INVALID_HANDLE_VALUE)
+				break;
+			openMode &= ~FILE_FLAG_FIRST_PIPE_INSTANCE;
+
+			// Blocks until a client connects, cleanup() connects to wake us up
+			bool isConnected = (ConnectNamedPipe(pipe, NULL) || GetLastError() == ERROR_PIPE_CONNECTED);
+			if(!isConnected || isChannelStopping)
+			{
+				CloseHandle(pipe);
+				continue;
+			}
+
+			EncFSMPIPC_ChannelConnection *pConnection = new EncFSMPIPC_ChannelConnection(pipe);
+			if(pConnection->Create() != wxTHREAD_NO_ERROR || pConnection->Run() != wxTHREAD_NO_ERROR)
+				delete pConnection;
+		}
+
+		return (wxThread::ExitCode)0;
+	}
+};
+
 EncFSMPIPC_Server *EncFSMPIPC::pServer_ = NULL;
 
 void EncFSMPIPC::initialize()
@@ -143,6 +315,11 @@ void EncFSMPIPC::initialize()
 			pServer_ = NULL;
 		}
 	}
+
+	isChannelStopping = false;
+	EncFSMPIPC_ChannelServer *pChannelServer = new EncFSMPIPC_ChannelServer();
+	if(pChannelServer->Create() != wxTHREAD_NO_ERROR || pChannelServer->Run() != wxTHREAD_NO_ERROR)
+		delete pChannelServer;
 }
 
 void EncFSMPIPC::cleanup()
@@ -152,6 +329,15 @@ void EncFSMPIPC::cleanup()
 		delete pServer_;
 		pServer_ = NULL;
 	}
+
+	if(!isChannelStopping.exchange(true))
+	{
+		// Wake up the channel server waiting for a client
+		HANDLE pipe = CreateFileW(getChannelPipeName().c_str(), GENERIC_READ | GENERIC_WRITE,
+			0, NULL, OPEN_EXISTING, 0, NULL);
+		if(pipe != INVALID_HANDLE_VALUE)
+			CloseHandle(pipe);
+	}
 }
 
 void EncFSMPIPC::sendCommand(const wxString &command,
@@ -171,6 +357,30 @@ void EncFSMPIPC::sendCommand(const wxString &command,
 	delete pClient;
 }
 
+bool EncFSMPIPC::sendBatch(const std::vector<EncFSMPIPCProtocol::Command> &commands,
+	std::vector<EncFSMPIPCProtocol::Result> &results)
+{
+	std::wstring pipeName = getChannelPipeName();
+	HANDLE pipe = CreateFileW(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE,
+		0, NULL, OPEN_EXISTING, 0, NULL);
+	if(pipe == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PIPE_BUSY)
+	{
+		// All instances are in use, the server creates the next one right away
+		if(WaitNamedPipeW(pipeName.c_str(), 2000))
+			pipe = CreateFileW(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE,
+				0, NULL, OPEN_EXISTING, 0, NULL);
+	}
+	if(pipe == INVALID_HANDLE_VALUE)
+		return false;
+
+	std::string response;
+	bool isOK = (writeFrame(pipe, EncFSMPIPCProtocol::encodeRequest(commands))
+		&& readFrame(pipe, response)
+		&& EncFSMPIPCProtocol::decodeResponse(response, results));
+	CloseHandle(pipe);
+	return isOK;
+}
+
 wxString EncFSMPIPC::marshalArguments(const wxString &command,
 	const wxString &mountName,
 	const wxString &password)
@@ -20,6 +20,10 @@
 #ifndef ENCFSMPIPCWIN_H
 #define ENCFSMPIPCWIN_H
 
+#include <vector>
+
+#include "EncFSMPIPCProtocol.h"
+
 class EncFSMPIPC_Server;
 
 class EncFSMPIPC
@@ -40,6 +44,13 @@ public:
 		wxString &mountName,
 		wxString &password);
 
+	/**
+	 * Sends the commands over the command channel (see EncFSMPIPCProtocol)
+	 * and waits for their results. Returns false if no instance is listening.
+	 */
+	static bool sendBatch(const std::vector<EncFSMPIPCProtocol::Command> &commands,
+		std::vector<EncFSMPIPCProtocol::Result> &results);
+
 private:
 	EncFSMPIPC() { }
 	virtual ~EncFSMPIPC() { }
@@ -31,22 +31,158 @@
 #include "easylogging++.h"
 
 #include <codecvt>
+#include <stdint.h>
+#include <vector>
 
-// Static member
+#include <boost/chrono.hpp>
+
+/**
+ * Bounded queue of log lines for many producers and one consumer.
+ *
+ * Every cell carries a sequence number telling whether it is free for the
+ * producer at that position or filled for the consumer, so push() and pop()
+ * get along with one compare-and-swap respectively none, and never wait.
+ */
+class LogLineQueue
+{
+public:
+	LogLineQueue()
+		: cells_(capacity_), head_(0), tail_(0), dropped_(0)
+	{
+		for(size_t i = 0; i < capacity_; i++)
+			cells_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	/** Returns false and counts the line as dropped if the queue is full */
+	bool push(std::wstring &&line)
+	{
+		size_t pos = tail_.load(std::memory_order_relaxed);
+		Cell *cell;
+		while(true)
+		{
+			cell = &cells_[pos & (capacity_ - 1)];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+			if(diff == 0)
+			{
+				if(tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if(diff < 0)
+			{
+				dropped_.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			else
+				pos = tail_.load(std::memory_order_relaxed);
+		}
+		cell->line = std::move(line);
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	/** Consumer side, must only be called from one thread at a time */
+	bool pop(std::wstring &line)
+	{
+		Cell &cell = cells_[head_ & (capacity_ - 1)];
+		if(cell.sequence.load(std::memory_order_acquire) != head_ + 1)
+			return false;
+		line = std::move(cell.line);
+		cell.line.clear();
+		cell.sequence.store(head_ + capacity_, std::memory_order_release);
+		head_++;
+		return true;
+	}
+
+	/** Returns the number of lines dropped since the last call */
+	uint64_t takeDropped()
+	{
+		return dropped_.exchange(0, std::memory_order_relaxed);
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		std::wstring line;
+	};
+
+	static const size_t capacity_ = 4096;	// must be a power of two
+
+	std::vector<Cell> cells_;
+	size_t head_;	// only used by the consumer
+	std::atomic<size_t> tail_;
+	std::atomic<uint64_t> dropped_;
+};
+
+// Static members, the queue must outlive the logger
+static LogLineQueue logQueue;
 EncFSMPLogger EncFSMPLogger::instance_;
 
 EncFSMPLogger::EncFSMPLogger()
-	: pEncFSMPErrorLog_(NULL)
+	: pEncFSMPErrorLog_(NULL), isWriting_(false)
 {
 }
 
 EncFSMPLogger::~EncFSMPLogger()
 {
+	isWriting_ = false;
+	if(writer_.joinable())
+		writer_.join();
 }
 
 void EncFSMPLogger::setErrorLog(EncFSMPErrorLog *pEncFSMPErrorLog)
 {
-	instance_.pEncFSMPErrorLog_ = pEncFSMPErrorLog;
+	if(instance_.writer_.joinable())
+	{
+		instance_.isWriting_ = false;
+		instance_.writer_.join();
+	}
+
+	if(pEncFSMPErrorLog != NULL)
+	{
+		instance_.pEncFSMPErrorLog_ = pEncFSMPErrorLog;
+		instance_.isWriting_ = true;
+		instance_.writer_ = boost::thread(&EncFSMPLogger::writeLoop, &instance_);
+	}
+	else
+	{
+		instance_.writePending();
+		instance_.pEncFSMPErrorLog_ = NULL;
+	}
+}
+
+void EncFSMPLogger::writeLoop()
+{
+	while(isWriting_)
+	{
+		if(!writePending())
+			boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+	}
+}
+
+bool EncFSMPLogger::writePending()
+{
+	EncFSMPErrorLog *pErrorLog = pEncFSMPErrorLog_;
+	if(pErrorLog == NULL)
+		return false;
+
+	bool hasWritten = false;
+	std::wstring line;
+	while(logQueue.pop(line))
+	{
+		pErrorLog->addText(wxString(line.c_str()));
+		hasWritten = true;
+	}
+
+	uint64_t dropped = logQueue.takeDropped();
+	if(dropped > 0)
+	{
+		pErrorLog->addText(wxString::Format(wxT("%llu log lines dropped\n"),
+			static_cast<unsigned long long>(dropped)));
+		hasWritten = true;
+	}
+	return hasWritten;
 }
 
 void EncFSMPLogger::log(const std::wstring &errStr, const std::string &fn, encfs::Error *pErr)
@@ -69,7 +205,7 @@ void EncFSMPLogger::log(const std::wstring &errStr, const std::string &fn, encfs
 			text.Append(wxString(pErr->what(), *wxConvCurrent));
 		}
 		text.Append(wxT("\n"));
-		instance_.pEncFSMPErrorLog_->addText(text);
+		logQueue.push(std::wstring(text.wc_str()));
 	}
 }
 
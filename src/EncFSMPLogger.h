@@ -20,6 +20,11 @@
 #ifndef ENCFSMPLOGGER_H
 #define ENCFSMPLOGGER_H
 
+#include <atomic>
+#include <string>
+
+#include <boost/thread.hpp>
+
 // Forward declarations
 class EncFSMPErrorLog;
 namespace encfs
@@ -27,10 +32,21 @@ namespace encfs
 	class Error;
 };
 
+/**
+ * Routes the easylogging++ output and the formatter errors to the error log window.
+ *
+ * Lines are handed to a writer thread through a lock-free queue, so logging never
+ * blocks the calling (formatter) thread. If the queue is full, lines are dropped
+ * and the number of dropped lines is logged once there is room again.
+ */
 class EncFSMPLogger
 {
 public:
 
+	/**
+	 * Starts the writer thread if pEncFSMPErrorLog is not NULL, otherwise writes
+	 * the pending lines and stops it.
+	 */
 	static void setErrorLog(EncFSMPErrorLog *pEncFSMPErrorLog);
 
 	static void log(const std::wstring &errStr, const std::string &fn, encfs::Error *pErr);
@@ -41,9 +57,14 @@ private:
 	EncFSMPLogger();
 	virtual ~EncFSMPLogger();
 
+	void writeLoop();
+	bool writePending();
+
 	static EncFSMPLogger instance_;
 
-	EncFSMPErrorLog *pEncFSMPErrorLog_; 
+	std::atomic<EncFSMPErrorLog *> pEncFSMPErrorLog_;
+	boost::thread writer_;
+	std::atomic<bool> isWriting_;
 };
 
 #endif
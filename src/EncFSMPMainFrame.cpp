@@ -26,11 +26,16 @@
 #include "OpenExistingFSDialog.h"
 #include "CreateNewEncFSDialog.h"
 #include "ChangePasswordDialog.h"
+#include "CacheTuningDialog.h"
 #include "EncFSUtilities.h"
 #include "EncFSMPStrings.h"
 #include "EncFSMPTaskBarIcon.h"
 #include "EncFSMPErrorLog.h"
 #include "EncFSMPLogger.h"
+#include "FormatterStats.h"
+#include "PerformancePanel.h"
+#include "KDFCalibration.h"
+#include "OpenSSLProxy.h"
 #if defined(EFS_WIN32)
 #	include "EncFSMPIPCWin.h"
 #else
@@ -38,8 +43,10 @@
 #endif
 
 #include <wx/dirdlg.h>
-#include <wx/busyinfo.h>
 #include <wx/config.h>
+#include <wx/progdlg.h>
+#include <wx/textdlg.h>
+#include <wx/choicdlg.h>
 
 #if defined(__WXMAC__) || defined(__WXOSX__) || defined(__WXOSX_COCOA__)
 #	include "osx/MacMenuWorkaroundBridge.h"
@@ -55,6 +62,8 @@
 #define HAVE_MODE_T		// Workaround for double defined mode_t on Windows
 #endif
 #include "config.h"
+#include "VolumeKeyCache.h"
+#include "Cipher.h"
 
 // OpenSSL
 #include "openssl/ssl.h"
@@ -64,6 +73,12 @@
 
 #include <sstream>
 #include <memory>
+#include <atomic>
+
+#include <boost/function.hpp>
+
+// Names returned by one search of a name index, in the list or over the command channel
+static const size_t maxSearchHits = 1000;
 
 enum
 {
@@ -79,7 +94,23 @@ enum
 	ID_CTXSHOWINFO,
 	ID_CTXCHANGEPASSWD,
 	ID_CTXEXPORT,
-	ID_ENCFS_COMMAND
+	ID_CTXIMPORT,
+	ID_CTXVERIFY,
+	ID_CTXCONVERT,
+	ID_CTXSHOWSTATS,
+	ID_CTXVOLUMESTATS,
+	ID_CTXMOUNTATSTARTUP,
+	ID_CTXMOUNTONDEMAND,
+	ID_CTXNAMEINDEX,
+	ID_CTXMOUNTREADONLY,
+	ID_CTXCACHESNAPSHOT,
+	ID_CTXSEARCH,
+	ID_CTXCACHESETTINGS,
+	ID_MOUNTALLMENUITEM,
+	ID_CHANGEPASSWORDSMENUITEM,
+	ID_ENCFS_COMMAND,
+	ID_ENCFS_BATCH_COMMAND,
+	ID_SHOWPERFORMANCEMENUITEM
 };
 
 const wxEventType myCustomEventType = wxNewEventType();
@@ -89,7 +120,8 @@ EncFSMPMainFrame::EncFSMPMainFrame(wxWindow* parent)
 	aTimer_(this, ID_TIMER), minimizeToTray_(false),
 	disableUnmountDialogOnExit_(false), savePasswordsInRAM_(false),
 	pTaskBarIcon_(NULL), pMountsListPopupMenu_(NULL),
-	firstTimeOnTimer_(false), pEncFSMPErrorLog_(NULL)
+	firstTimeOnTimer_(false), pEncFSMPErrorLog_(NULL),
+	pShowPerformanceMenuItem_(NULL), pPerformancePanel_(NULL)
 {
 	pMountsListCtrl_->ClearAll();
 	pMountsListCtrl_->InsertColumn(0, wxT("Mounted"));
@@ -114,6 +146,17 @@ EncFSMPMainFrame::EncFSMPMainFrame(wxWindow* parent)
 #endif
 	}
 
+	pToolsMenu_->Append(ID_MOUNTALLMENUITEM, wxT("Mount all"), wxEmptyString, wxITEM_NORMAL);
+	pToolsMenu_->Append(ID_CHANGEPASSWORDSMENUITEM, wxT("Change passwords of several mounts..."),
+		wxEmptyString, wxITEM_NORMAL);
+	pShowPerformanceMenuItem_ = pOptionsMenu_->Append(ID_SHOWPERFORMANCEMENUITEM,
+		wxT("Show performance panel"), wxEmptyString, wxITEM_CHECK);
+
+	// Below the list of mounts, hidden unless enabled in the options
+	pPerformancePanel_ = new PerformancePanel(pMainPanel_);
+	pMainPanel_->GetSizer()->Add(pPerformancePanel_, 1, wxALL|wxEXPAND, 3);
+	pPerformancePanel_->Hide();
+
 	// Workaround for OS X: Hide empty menus
 #if defined(__WXMAC__) || defined(__WXOSX__) || defined(__WXOSX_COCOA__)
 	wxMenuItem *tempItem = pToolsMenu_->Append(ID_INFOBUTTON, wxT("Temp item"));
@@ -124,13 +167,16 @@ EncFSMPMainFrame::EncFSMPMainFrame(wxWindow* parent)
 	pEncFSMPErrorLog_ = new EncFSMPErrorLog(this);
 	pEncFSMPErrorLog_->Hide();
 	EncFSMPLogger::setErrorLog(pEncFSMPErrorLog_);
+	// Which AES code runs, to tell slow volumes from missing acceleration
+	pEncFSMPErrorLog_->addInfoText(wxString(OpenSSLProxy::getReport().c_str(), *wxConvCurrent)
+		+ wxT("\n"));
 
 	loadWindowLayoutFromConfig();
 	mountList_.loadFromConfig();
 	updateMountListCtrl();
 	updateButtonStates();
 
-	aTimer_.Start(50);
+	aTimer_.Start(50, wxTIMER_ONE_SHOT);
 }
 
 EncFSMPMainFrame::~EncFSMPMainFrame()
@@ -159,16 +205,37 @@ EncFSMPMainFrame::~EncFSMPMainFrame()
  */
 void EncFSMPMainFrame::addNewMountEvent(bool isMountEvent, bool isError,
 	const std::wstring &mountName, wchar_t driveLetter, const std::wstring &mountPoint)
+{
+	MountEvent evt;
+	evt.isMountEvent_ = isMountEvent;
+	evt.isError_ = isError;
+	evt.mountName_ = mountName;
+	evt.driveLetter_ = driveLetter;
+	evt.mountPoint_ = mountPoint;
+	queueMountEvent(evt);
+}
+
+/**
+ * This method gets called by the PFMHandlerThread when a pending mount reaches the next step.
+ */
+void EncFSMPMainFrame::reportMountProgress(const wxString &mountName, MountEntry::MountProgress progress)
+{
+	MountEvent evt;
+	evt.isProgressEvent_ = true;
+	evt.mountName_ = std::wstring(mountName.c_str());
+	evt.progress_ = progress;
+	queueMountEvent(evt);
+}
+
+void EncFSMPMainFrame::queueMountEvent(const MountEvent &evt)
 {
 	{
 		wxMutexLocker lock(mountEventsMutex_);
-		MountEvent evt;
-		evt.isMountEvent_ = isMountEvent;
-		evt.isError_ = isError;
-		evt.mountName_ = mountName;
-		evt.driveLetter_ = driveLetter;
-		evt.mountPoint_ = mountPoint;
+		// OnMountEvent() handles all queued events, only notify it for the first one of a burst
+		bool isNotified = !mountEvents_.empty();
 		mountEvents_.push_back(evt);
+		if(isNotified)
+			return;
 	}
 
 #if wxCHECK_VERSION(2, 9, 0)
@@ -247,6 +314,57 @@ void EncFSMPMainFrame::unmountAll()
 	}
 }
 
+/**
+ * Mounts all unmounted drives, or only those marked to be mounted at startup.
+ * The passwords are asked for first, then all mounts are started at once.
+ */
+void EncFSMPMainFrame::mountAll(bool startupMountsOnly)
+{
+	if(!PFMProxy::getInstance().isPFMPresent())
+		return;
+
+	std::list<std::pair<MountEntry *, wxString> > mounts;
+	std::list<MountEntry> &mountList = mountList_.getList();
+	std::list<MountEntry>::iterator iter = mountList.begin();
+	while(iter != mountList.end())
+	{
+		MountEntry &cur = (*iter);
+		iter++;
+		if(cur.mountState_ != MountEntry::MSNotMounted
+			|| (startupMountsOnly && !cur.mountAtStartup_))
+			continue;
+
+		wxString password = cur.password_;
+		if(password.IsEmpty())
+			password = cur.volatilePassword_;
+		if(password.IsEmpty())
+		{
+			wxPasswordEntryDialog dlg(this, wxT("Please enter the password:"), wxString(wxT(ENCFSMP_NAME " - Password for ")) + cur.name_);
+			int retVal = dlg.ShowModal();
+			if(retVal == wxID_CANCEL)
+				continue;	// Skip this mount only
+			password = dlg.GetValue();
+			if(savePasswordsInRAM_)
+				cur.volatilePassword_ = password;
+		}
+		mounts.push_back(std::make_pair(&cur, password));
+	}
+
+	// PFMHandlerThread limits how many of them derive their key at the same time
+	std::list<std::pair<MountEntry *, wxString> >::iterator mountIter = mounts.begin();
+	while(mountIter != mounts.end())
+	{
+		startMount(mountIter->first, mountIter->second);
+		mountIter++;
+	}
+
+	if(!mounts.empty())
+	{
+		updateMountListCtrl();
+		updateButtonStates();
+	}
+}
+
 void EncFSMPMainFrame::OnMainFrameClose( wxCloseEvent& evt )
 {
 	// Check whether there are active or pending mounts
@@ -361,6 +479,99 @@ void EncFSMPMainFrame::OnExitMenuItem( wxCommandEvent& WXUNUSED(event) )
 	Close();
 }
 
+/**
+ * Runs an export or import outside the GUI thread.
+ */
+class CopyTreeThread: public wxThread
+{
+public:
+	typedef boost::function<bool (CopyProgress *, wxString &)> CopyFunction;
+
+	CopyTreeThread(const CopyFunction &copyFunction)
+		: wxThread(wxTHREAD_JOINABLE), copyFunction_(copyFunction), result_(false)
+	{ }
+
+	CopyProgress &getProgress() { return progress_; }
+	bool getResult() const { return result_; }
+	const wxString &getErrorMsg() const { return errorMsg_; }
+
+	wxThread::ExitCode Entry()
+	{
+		result_ = copyFunction_(&progress_, errorMsg_);
+		return (wxThread::ExitCode)0;
+	}
+
+private:
+	CopyFunction copyFunction_;
+	CopyProgress progress_;
+	bool result_;
+	wxString errorMsg_;
+};
+
+/**
+ * Runs copyFunction in a CopyTreeThread and shows its progress until it is
+ * done or cancelled. Returns the result of copyFunction.
+ */
+static bool runCopyTree(wxWindow *parent, const wxString &title, const wxString &verb,
+	const CopyTreeThread::CopyFunction &copyFunction, wxString &errorMsg)
+{
+	CopyTreeThread copyThread(copyFunction);
+	if(copyThread.Create() != wxTHREAD_NO_ERROR || copyThread.Run() != wxTHREAD_NO_ERROR)
+	{
+		errorMsg = wxT("Unable to start copying the files");
+		return false;
+	}
+
+	{
+		wxProgressDialog progressDlg(title, verb + wxT(" EncFS files..."),
+			1000, parent, wxPD_APP_MODAL | wxPD_CAN_ABORT | wxPD_ELAPSED_TIME | wxPD_REMAINING_TIME);
+		CopyProgress &progress = copyThread.getProgress();
+		while(copyThread.IsAlive())
+		{
+			int64_t bytesFound = progress.bytesFound;
+			wxString msg = wxString::Format(wxT("%s %lld of %lld files (%.1f of %.1f MB)"),
+				verb, (long long)progress.filesDone, (long long)progress.filesFound,
+				(double)progress.bytesDone / (1024.0 * 1024.0), (double)bytesFound / (1024.0 * 1024.0));
+			bool keepGoing;
+			if(progress.walkDone && bytesFound > 0)
+			{
+				// The totals are only known once all folders are walked
+				int value = (int)(progress.bytesDone * 1000 / bytesFound);
+				keepGoing = progressDlg.Update(value < 999 ? value : 999, msg);
+			}
+			else
+			{
+				keepGoing = progressDlg.Pulse(msg);
+			}
+			if(!keepGoing)
+				progress.cancel = true;
+			wxMilliSleep(100);
+		}
+	}
+	copyThread.Wait();
+
+	errorMsg = copyThread.getErrorMsg();
+	return copyThread.getResult();
+}
+
+bool EncFSMPMainFrame::getPassword(MountEntry *pMountEntry, wxString &password)
+{
+	password = pMountEntry->password_;
+	if(password.IsEmpty())
+		password = pMountEntry->volatilePassword_;
+	if(password.IsEmpty())
+	{
+		wxPasswordEntryDialog dlg(this, wxT("Please enter the password:"), wxString(wxT(ENCFSMP_NAME " - Password for ")) + pMountEntry->name_);
+		int retVal = dlg.ShowModal();
+		if(retVal == wxID_CANCEL)
+			return false;
+		password = dlg.GetValue();
+		if(savePasswordsInRAM_)
+			pMountEntry->volatilePassword_ = password;
+	}
+	return true;
+}
+
 void EncFSMPMainFrame::OnExportMenuItem( wxCommandEvent& event )
 {
 	MountEntry *pMountEntry = getSelectedMount();
@@ -374,30 +585,20 @@ void EncFSMPMainFrame::OnExportMenuItem( wxCommandEvent& event )
 		wxString exportPath = dlg.GetPath();
 
 		// Enter password, if necessary
-		wxString password = pMountEntry->password_;
-		if(password.IsEmpty())
-			password = pMountEntry->volatilePassword_;
-		if(password.IsEmpty())
-		{
-			wxPasswordEntryDialog dlg(this, wxT("Please enter the password:"), wxString(wxT(ENCFSMP_NAME " - Password for ")) + pMountEntry->name_);
-			int retVal = dlg.ShowModal();
-			if(retVal == wxID_CANCEL)
-				return;
-			password = dlg.GetValue();
-			if(savePasswordsInRAM_)
-				pMountEntry->volatilePassword_ = password;
-		}
+		wxString password;
+		if(!getPassword(pMountEntry, password))
+			return;
 
-		// TODO: Show progress bar, start separate thread?
+		wxString encFSPath = pMountEntry->encFSPath_;
+		wxString externalConfigFileName = pMountEntry->externalConfigFileName_;
+		bool useExternalConfigFile = pMountEntry->useExternalConfigFile_;
 		wxString errorMsg;
-		bool isOK = true;
-		{
-			wxWindowDisabler disableAll;
-			wxBusyInfo wait(wxT("Exporting EncFS files..."));
-			isOK = EncFSUtilities::exportEncFS(pMountEntry->encFSPath_,
-				pMountEntry->externalConfigFileName_, pMountEntry->useExternalConfigFile_,
-				password, exportPath, errorMsg);
-		}
+		bool isOK = runCopyTree(this, wxT("Export EncFS"), wxT("Exporting"),
+			[=](CopyProgress *pProgress, wxString &msg)
+			{
+				return EncFSUtilities::exportEncFS(encFSPath, externalConfigFileName,
+					useExternalConfigFile, password, exportPath, msg, pProgress);
+			}, errorMsg);
 		if(isOK)
 		{
 			wxMessageBox(wxT("Exporting EncFS finished."), wxT("Export EncFS"),
@@ -412,6 +613,104 @@ void EncFSMPMainFrame::OnExportMenuItem( wxCommandEvent& event )
 	}
 }
 
+void EncFSMPMainFrame::OnContextMenuImport( wxCommandEvent& event )
+{
+	MountEntry *pMountEntry = getSelectedMount();
+	// The volume is written directly, it must not be mounted meanwhile
+	if(pMountEntry == NULL || pMountEntry->mountState_ != MountEntry::MSNotMounted)
+		return;
+
+	wxDirDialog dlg(this, wxT("Please choose the folder to import:"));
+	if(dlg.ShowModal() != wxID_OK)
+		return;
+
+	wxString srcPath = dlg.GetPath();
+
+	wxString password;
+	if(!getPassword(pMountEntry, password))
+		return;
+
+	wxString encFSPath = pMountEntry->encFSPath_;
+	wxString externalConfigFileName = pMountEntry->externalConfigFileName_;
+	bool useExternalConfigFile = pMountEntry->useExternalConfigFile_;
+	wxString errorMsg;
+	bool isOK = runCopyTree(this, wxT("Import into EncFS"), wxT("Importing"),
+		[=](CopyProgress *pProgress, wxString &msg)
+		{
+			return EncFSUtilities::importTree(srcPath, encFSPath, externalConfigFileName,
+				useExternalConfigFile, password, msg, pProgress);
+		}, errorMsg);
+	if(isOK)
+	{
+		wxMessageBox(wxT("Importing into EncFS finished."), wxT("Import into EncFS"),
+			wxICON_INFORMATION | wxOK, this);
+	}
+	else
+	{
+		wxMessageBox(errorMsg,
+			wxT("Import into EncFS"), wxICON_ERROR | wxOK, this);
+	}
+}
+
+void EncFSMPMainFrame::OnContextMenuVerify( wxCommandEvent& event )
+{
+	MountEntry *pMountEntry = getSelectedMount();
+	// A mount may be writing blocks while they are checked
+	if(pMountEntry == NULL || pMountEntry->mountState_ != MountEntry::MSNotMounted)
+		return;
+
+	wxString password;
+	if(!getPassword(pMountEntry, password))
+		return;
+
+	wxString encFSPath = pMountEntry->encFSPath_;
+	wxString externalConfigFileName = pMountEntry->externalConfigFileName_;
+	bool useExternalConfigFile = pMountEntry->useExternalConfigFile_;
+	VolumeScrubber::Report report;
+	wxString errorMsg;
+	bool isOK = runCopyTree(this, wxT("Verify EncFS"), wxT("Verifying"),
+		[=, &report](CopyProgress *pProgress, wxString &msg)
+		{
+			return EncFSUtilities::scrubEncFS(encFSPath, externalConfigFileName,
+				useExternalConfigFile, password, report, msg, pProgress);
+		}, errorMsg);
+	if(!isOK)
+	{
+		wxMessageBox(errorMsg,
+			wxT("Verify EncFS"), wxICON_ERROR | wxOK, this);
+		return;
+	}
+
+	if(report.damagedFiles.empty() && report.invalidNames.empty())
+	{
+		wxMessageBox(wxT("No damaged blocks or names were found."), wxT("Verify EncFS"),
+			wxICON_INFORMATION | wxOK, this);
+		return;
+	}
+
+	// List the first few, the rest is only counted
+	const size_t maxListed = 20;
+	wxString msg = wxString::Format(wxT("%d damaged files, %d names which can't be decoded:\n"),
+		(int)report.damagedFiles.size(), (int)report.invalidNames.size());
+	size_t listed = 0;
+	for(size_t i = 0; i < report.damagedFiles.size() && listed < maxListed; i++, listed++)
+	{
+		const VolumeScrubber::DamagedFile &damage = report.damagedFiles[i];
+		msg += wxT("\n") + wxString(damage.path.c_str(), wxConvUTF8);
+		if(!damage.badBlocks.empty())
+			msg += wxString::Format(wxT(": %d bad blocks, first %lld"),
+				(int)damage.badBlocks.size(), (long long)damage.badBlocks[0]);
+		if(damage.error != 0)
+			msg += wxString::Format(wxT(" (unreadable, error %d)"), -damage.error);
+	}
+	for(size_t i = 0; i < report.invalidNames.size() && listed < maxListed; i++, listed++)
+		msg += wxT("\n") + wxString(report.invalidNames[i].c_str(), wxConvUTF8);
+	if(listed < report.damagedFiles.size() + report.invalidNames.size())
+		msg += wxT("\n...");
+
+	wxMessageBox(msg, wxT("Verify EncFS"), wxICON_WARNING | wxOK, this);
+}
+
 void EncFSMPMainFrame::OnShowErrorLogMenuItem( wxCommandEvent& event )
 {
 	if(pEncFSMPErrorLog_ != NULL)
@@ -445,6 +744,8 @@ void EncFSMPMainFrame::OnDisableUnmountDialogOnExitMenuItem( wxCommandEvent& eve
 void EncFSMPMainFrame::OnSavePasswordsInRAMMenuItem( wxCommandEvent& event )
 {
 	savePasswordsInRAM_ = event.IsChecked();
+	if(!savePasswordsInRAM_)
+		encfs::VolumeKeyCache::instance().clear();
 	saveWindowLayoutToConfig();
 }
 
@@ -482,23 +783,180 @@ void EncFSMPMainFrame::OnAboutMenuItem( wxCommandEvent& WXUNUSED(event) )
 	wxAboutBox(info);
 }
 
+/**
+ * Measures the key derivation speed if it isn't known yet, and creates the
+ * new volume with the iterations for the chosen duration. Runs outside the
+ * GUI thread, which shows the progress meanwhile.
+ */
+class CreateEncFSThread: public wxThread
+{
+public:
+	CreateEncFSThread(const CreateNewEncFSDialog &dlg, const KDFCalibration::Speed &speed)
+		: wxThread(wxTHREAD_JOINABLE), dlg_(dlg), speed_(speed),
+		calibrating_(!speed.isValid()), result_(false)
+	{ }
+
+	bool isCalibrating() const { return calibrating_; }
+	bool getResult() const { return result_; }
+	const KDFCalibration::Speed &getSpeed() const { return speed_; }
+
+	wxThread::ExitCode Entry()
+	{
+		if(calibrating_)
+		{
+			speed_ = KDFCalibration::measure();
+			calibrating_ = false;
+		}
+
+		int iterations = 0;
+		std::shared_ptr<encfs::Cipher> cipher = encfs::Cipher::New(
+			std::string(dlg_.getCipherAlgorithm().mb_str()), dlg_.getCipherKeySize());
+		if(cipher && speed_.isValid())
+		{
+			iterations = KDFCalibration::getParams(speed_, dlg_.getKeyDerivationDuration(),
+				cipher->keySize() + cipher->cipherBlockSize()).pbkdf2Iterations;
+		}
+
+		result_ = EncFSUtilities::createEncFS(dlg_.getEncFSPath(),
+			dlg_.password_, dlg_.getExternalConfigFileName(), dlg_.getUseExternalConfigFile(),
+			dlg_.getCipherAlgorithm(), dlg_.getCipherKeySize(),
+			dlg_.getCipherBlockSize(), dlg_.getNameEncoding(),
+			dlg_.getKeyDerivationDuration(), iterations, dlg_.perBlockHMAC_,
+			dlg_.uniqueIV_, dlg_.chainedIV_, dlg_.externalIV_);
+		return (wxThread::ExitCode)0;
+	}
+
+private:
+	const CreateNewEncFSDialog &dlg_;
+	KDFCalibration::Speed speed_;
+	std::atomic<bool> calibrating_;
+	bool result_;
+};
+
+/**
+ * Creates the volume chosen in dlg, showing the progress of the key
+ * derivation. Shows the error and returns false if it failed.
+ */
+static bool createVolume(wxWindow *parent, const CreateNewEncFSDialog &dlg)
+{
+	KDFCalibration::Speed speed;
+	bool calibrated = KDFCalibration::load(speed);
+
+	CreateEncFSThread createThread(dlg, speed);
+	if(createThread.Create() != wxTHREAD_NO_ERROR || createThread.Run() != wxTHREAD_NO_ERROR)
+	{
+		wxMessageBox(wxT("Creation of new EncFS failed"), wxT("Error"),
+			wxOK | wxICON_ERROR);
+		return false;
+	}
+
+	{
+		// The key derivation takes the chosen duration, the progress
+		// follows the time. Cancelling isn't possible once it runs.
+		wxProgressDialog progress(wxT("Create new EncFS"), wxT("Measuring the key derivation speed..."),
+			100, parent, wxPD_APP_MODAL | wxPD_AUTO_HIDE);
+		wxStopWatch watch;
+		bool wasCalibrating = !calibrated;
+		long derivationStart = 0;
+		long duration = dlg.getKeyDerivationDuration() > 0 ? dlg.getKeyDerivationDuration() : 1;
+		while(createThread.IsAlive())
+		{
+			if(createThread.isCalibrating())
+			{
+				progress.Pulse();
+			}
+			else
+			{
+				if(wasCalibrating)
+				{
+					wasCalibrating = false;
+					derivationStart = watch.Time();
+				}
+				long elapsed = watch.Time() - derivationStart;
+				int percent = (int)(elapsed * 100 / duration);
+				progress.Update(percent < 99 ? percent : 99, wxT("Deriving the key from the password..."));
+			}
+			wxMilliSleep(50);
+		}
+	}
+	createThread.Wait();
+
+	if(!calibrated)
+		KDFCalibration::store(createThread.getSpeed());
+
+	if(!createThread.getResult())
+	{
+		wxMessageBox(wxT("Creation of new EncFS failed"), wxT("Error"),
+			wxOK | wxICON_ERROR);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Measures the key derivation speed if it isn't known yet, and changes the
+ * passwords with it. Runs outside the GUI thread.
+ */
+class ChangePasswordsThread: public wxThread
+{
+public:
+	ChangePasswordsThread(std::vector<EncFSUtilities::PasswordChange> &changes,
+		const KDFCalibration::Speed &speed)
+		: wxThread(wxTHREAD_JOINABLE), changes_(changes), speed_(speed)
+	{ }
+
+	const KDFCalibration::Speed &getSpeed() const { return speed_; }
+
+	wxThread::ExitCode Entry()
+	{
+		if(!speed_.isValid())
+			speed_ = KDFCalibration::measure();
+		EncFSUtilities::changePasswords(changes_, speed_);
+		return (wxThread::ExitCode)0;
+	}
+
+private:
+	std::vector<EncFSUtilities::PasswordChange> &changes_;
+	KDFCalibration::Speed speed_;
+};
+
+/**
+ * Changes the passwords, showing that it is busy meanwhile. The results are
+ * in the changes. Returns false if the thread could not be started.
+ */
+static bool runPasswordChanges(wxWindow *parent, std::vector<EncFSUtilities::PasswordChange> &changes)
+{
+	KDFCalibration::Speed speed;
+	bool calibrated = KDFCalibration::load(speed);
+
+	ChangePasswordsThread changeThread(changes, speed);
+	if(changeThread.Create() != wxTHREAD_NO_ERROR || changeThread.Run() != wxTHREAD_NO_ERROR)
+		return false;
+
+	{
+		wxProgressDialog progress(wxT("Change password"), wxT("Deriving the keys from the passwords..."),
+			100, parent, wxPD_APP_MODAL | wxPD_AUTO_HIDE);
+		while(changeThread.IsAlive())
+		{
+			progress.Pulse();
+			wxMilliSleep(50);
+		}
+	}
+	changeThread.Wait();
+
+	if(!calibrated)
+		KDFCalibration::store(changeThread.getSpeed());
+	return true;
+}
+
 void EncFSMPMainFrame::OnCreateMountButton( wxCommandEvent& event )
 {
 	CreateNewEncFSDialog dlg(this);
 	dlg.setMountList(&mountList_);
 	if(dlg.ShowModal() == wxID_OK)
 	{
-		if(!EncFSUtilities::createEncFS(dlg.getEncFSPath(),
-			dlg.password_, dlg.getExternalConfigFileName(), dlg.getUseExternalConfigFile(),
-			dlg.getCipherAlgorithm(), dlg.getCipherKeySize(),
-			dlg.getCipherBlockSize(), dlg.getNameEncoding(),
-			dlg.getKeyDerivationDuration(), dlg.perBlockHMAC_,
-			dlg.uniqueIV_, dlg.chainedIV_, dlg.externalIV_))
-		{
-			wxMessageBox(wxT("Creation of new EncFS failed"), wxT("Error"),
-				wxOK | wxICON_ERROR);
+		if(!createVolume(this, dlg))
 			return;
-		}
 
 		wxString password;
 		if(dlg.storePassword_)
@@ -515,6 +973,98 @@ void EncFSMPMainFrame::OnCreateMountButton( wxCommandEvent& event )
 
 }
 
+void EncFSMPMainFrame::OnContextMenuConvert( wxCommandEvent& event )
+{
+	MountEntry *pSrcEntry = getSelectedMount();
+	// Both volumes are read and written directly, neither may be mounted
+	if(pSrcEntry == NULL || pSrcEntry->mountState_ != MountEntry::MSNotMounted)
+		return;
+
+	wxString srcPassword;
+	if(!getPassword(pSrcEntry, srcPassword))
+		return;
+
+	// A conversion of this volume which was cancelled is continued
+	wxString srcDir(EncFSUtilities::wxStringToEncFSPath(pSrcEntry->encFSPath_).c_str(), wxConvUTF8);
+	MountEntry *pDestEntry = NULL;
+	std::list<MountEntry> &entries = mountList_.getList();
+	for(std::list<MountEntry>::iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		wxString convertedDir;
+		if(&(*it) != pSrcEntry && it->mountState_ == MountEntry::MSNotMounted
+			&& EncFSUtilities::getConversionSource(it->encFSPath_, convertedDir)
+			&& convertedDir == srcDir)
+		{
+			int answer = wxMessageBox(wxString(wxT("The conversion into ")) + it->name_
+				+ wxT(" is unfinished. Continue it?"), wxT("Convert EncFS"),
+				wxICON_QUESTION | wxYES_NO | wxCANCEL, this);
+			if(answer == wxCANCEL)
+				return;
+			if(answer == wxYES)
+				pDestEntry = &(*it);
+			break;
+		}
+	}
+
+	wxString destPassword;
+	if(pDestEntry != NULL)
+	{
+		if(!getPassword(pDestEntry, destPassword))
+			return;
+	}
+	else
+	{
+		// The new volume gets the settings it is converted to
+		CreateNewEncFSDialog dlg(this);
+		dlg.setMountList(&mountList_);
+		if(dlg.ShowModal() != wxID_OK)
+			return;
+		if(!createVolume(this, dlg))
+			return;
+
+		wxString password;
+		if(dlg.storePassword_)
+			password = dlg.password_;
+		mountList_.addMount(dlg.mountName_, dlg.getEncFSPath(),
+			dlg.getExternalConfigFileName(), dlg.getDriveLetter(),
+			password, dlg.getUseExternalConfigFile(), dlg.getCachingEnabled(),
+			dlg.worldWritable_, dlg.getIsLocalDrive(), false);
+		mountList_.storeToConfig();
+		updateMountListCtrl();
+
+		pDestEntry = mountList_.findEntryByName(dlg.mountName_);
+		if(pDestEntry == NULL)
+			return;
+		destPassword = dlg.password_;
+	}
+
+	wxString srcPath = pSrcEntry->encFSPath_;
+	wxString srcExternalConfigFileName = pSrcEntry->externalConfigFileName_;
+	bool srcUseExternalConfigFile = pSrcEntry->useExternalConfigFile_;
+	wxString destPath = pDestEntry->encFSPath_;
+	wxString destExternalConfigFileName = pDestEntry->externalConfigFileName_;
+	bool destUseExternalConfigFile = pDestEntry->useExternalConfigFile_;
+	wxString errorMsg;
+	bool isOK = runCopyTree(this, wxT("Convert EncFS"), wxT("Converting"),
+		[=](CopyProgress *pProgress, wxString &msg)
+		{
+			return EncFSUtilities::convertEncFS(srcPath, srcExternalConfigFileName,
+				srcUseExternalConfigFile, srcPassword, destPath, destExternalConfigFileName,
+				destUseExternalConfigFile, destPassword, msg, pProgress);
+		}, errorMsg);
+	if(isOK)
+	{
+		wxMessageBox(wxString(wxT("Converting into ")) + pDestEntry->name_
+			+ wxT(" finished. The old volume can be removed once the new one has been checked."),
+			wxT("Convert EncFS"), wxICON_INFORMATION | wxOK, this);
+	}
+	else
+	{
+		wxMessageBox(errorMsg,
+			wxT("Convert EncFS"), wxICON_ERROR | wxOK, this);
+	}
+}
+
 void EncFSMPMainFrame::OnOpenExistingEncFSButton( wxCommandEvent& event )
 {
 	OpenExistingFSDialog dlg(this);
@@ -588,6 +1138,9 @@ void EncFSMPMainFrame::OnMountsListItemRightClick( wxListEvent& event )
 		if(isPFMPresent)
 			pMountsListPopupMenu_->Append(ID_CTXMOUNT, wxT("Unmount"));
 		pMountsListPopupMenu_->Append(ID_CTXBROWSE, wxT("Browse"));
+		pMountsListPopupMenu_->Append(ID_CTXSHOWSTATS, wxT("Show statistics"));
+		if(pMountEntry->useNameIndex_)
+			pMountsListPopupMenu_->Append(ID_CTXSEARCH, wxT("Search names..."));
 	}
 	else
 	{
@@ -598,7 +1151,18 @@ void EncFSMPMainFrame::OnMountsListItemRightClick( wxListEvent& event )
 		pMountsListPopupMenu_->Append(ID_CTXSHOWINFO, wxT("Show Info"));
 		pMountsListPopupMenu_->Append(ID_CTXCHANGEPASSWD, wxT("Change password"));
 		pMountsListPopupMenu_->Append(ID_CTXEXPORT, wxT("Export"));
+		pMountsListPopupMenu_->Append(ID_CTXIMPORT, wxT("Import folder..."));
+		pMountsListPopupMenu_->Append(ID_CTXVERIFY, wxT("Verify integrity..."));
+		pMountsListPopupMenu_->Append(ID_CTXCONVERT, wxT("Convert to new volume..."));
 	}
+	pMountsListPopupMenu_->Append(ID_CTXVOLUMESTATS, wxT("Count files..."));
+	pMountsListPopupMenu_->Append(ID_CTXCACHESETTINGS, wxT("Cache settings..."));
+	pMountsListPopupMenu_->AppendSeparator();
+	pMountsListPopupMenu_->AppendCheckItem(ID_CTXMOUNTATSTARTUP, wxT("Mount at startup"))->Check(pMountEntry->mountAtStartup_);
+	pMountsListPopupMenu_->AppendCheckItem(ID_CTXMOUNTONDEMAND, wxT("Unlock on first access"))->Check(pMountEntry->mountOnDemand_);
+	pMountsListPopupMenu_->AppendCheckItem(ID_CTXNAMEINDEX, wxT("Keep name index for search"))->Check(pMountEntry->useNameIndex_);
+	pMountsListPopupMenu_->AppendCheckItem(ID_CTXMOUNTREADONLY, wxT("Mount read-only"))->Check(pMountEntry->mountReadOnly_);
+	pMountsListPopupMenu_->AppendCheckItem(ID_CTXCACHESNAPSHOT, wxT("Keep caches between mounts"))->Check(pMountEntry->useCacheSnapshot_);
 
 	PopupMenu(pMountsListPopupMenu_);
 }
@@ -662,18 +1226,8 @@ void EncFSMPMainFrame::OnMountButton( wxCommandEvent& event )
 				if(savePasswordsInRAM_)
 					pMountEntry->volatilePassword_ = password;
 			}
-			bool isWorldWritable = pMountEntry->isWorldWritable_;
 
-			PFMHandlerThread *pPFMHandlerThread = new PFMHandlerThread();
-			pPFMHandlerThread->setParameters(pMountEntry->name_,
-				pMountEntry->encFSPath_, pMountEntry->externalConfigFileName_,
-				pMountEntry->driveLetter_, password,
-				pMountEntry->useExternalConfigFile_, pMountEntry->enableCaching_,
-				isWorldWritable, pMountEntry->isLocalDrive_, false);
-
-			pPFMHandlerThread->Create();
-			pPFMHandlerThread->Run();
-			pMountEntry->mountState_ = MountEntry::MSPending;
+			startMount(pMountEntry, password);
 		}
 
 		updateMountListCtrl();
@@ -827,10 +1381,16 @@ void EncFSMPMainFrame::OnChangePasswordButton( wxCommandEvent& event )
 		ChangePasswordDialog dlg(this);
 		if(dlg.ShowModal() == wxID_OK)
 		{
-			wxString errorMsg;
-			bool isOK = EncFSUtilities::changePassword(path,
-				pMountEntry->externalConfigFileName_, pMountEntry->useExternalConfigFile_,
-				dlg.oldPassword_, dlg.newPassword_, errorMsg);
+			std::vector<EncFSUtilities::PasswordChange> changes(1);
+			changes[0].encFSPath = path;
+			changes[0].externalConfigFileName = pMountEntry->externalConfigFileName_;
+			changes[0].useExternalConfigFile = pMountEntry->useExternalConfigFile_;
+			changes[0].oldPassword = dlg.oldPassword_;
+			changes[0].newPassword = dlg.newPassword_;
+			if(!runPasswordChanges(this, changes))
+				changes[0].message = wxT("Unable to start changing the password");
+			bool isOK = changes[0].isOK;
+			wxString errorMsg = changes[0].message;
 			if(isOK)
 			{
 				if(dlg.storeNewPassword_)
@@ -861,6 +1421,9 @@ void EncFSMPMainFrame::OnTimer( wxTimerEvent & WXUNUSED(event) )
 
 		updateButtonStates();
 	}
+
+	// The timer fires once, after the main frame is shown and the monitor thread runs
+	mountAll(true);
 }
 
 void EncFSMPMainFrame::OnMountEvent( wxCommandEvent &event )
@@ -874,8 +1437,27 @@ void EncFSMPMainFrame::OnMountEvent( wxCommandEvent &event )
 
 		// Update mount list
 		MountEntry *pMountEntry = mountList_.findEntryByName(evt.mountName_);
-		if(pMountEntry != NULL)
+		if(pMountEntry != NULL && evt.isProgressEvent_)
+		{
+			if(pMountEntry->mountState_ == MountEntry::MSPending)
+			{
+				pMountEntry->mountProgress_ = evt.progress_;
+				updateListCtrl = true;
+			}
+			else if(pMountEntry->mountState_ == MountEntry::MSMounted)
+			{
+				// The first access of a drive mounted on demand waits for the key
+				pMountEntry->mountProgress_ = evt.progress_;
+				updateListCtrl = true;
+#if wxCHECK_VERSION(3, 1, 0) && defined(__WXMSW__)
+				if(evt.progress_ == MountEntry::MPUnlocking && pTaskBarIcon_ != NULL)
+					pTaskBarIcon_->ShowBalloon(pMountEntry->name_, wxT("Unlocking the drive..."));
+#endif
+			}
+		}
+		else if(pMountEntry != NULL)
 		{
+			pMountEntry->mountProgress_ = MountEntry::MPNone;
 			if(evt.driveLetter_ == 0)
 				pMountEntry->assignedDriveLetter_ = wxEmptyString;
 			else
@@ -940,6 +1522,23 @@ void EncFSMPMainFrame::OnMinimizeToTrayMenuItem( wxCommandEvent& event )
 #endif
 }
 
+void EncFSMPMainFrame::OnShowPerformanceMenuItem( wxCommandEvent& event )
+{
+	showPerformancePanel(event.IsChecked());
+	saveWindowLayoutToConfig();
+}
+
+void EncFSMPMainFrame::showPerformancePanel(bool show)
+{
+	pShowPerformanceMenuItem_->Check(show);
+	pPerformancePanel_->Show(show);
+	if(show)
+		pPerformancePanel_->start();
+	else
+		pPerformancePanel_->stop();
+	pMainPanel_->Layout();
+}
+
 void EncFSMPMainFrame::OnContextMenuMount( wxCommandEvent& event )
 {
 	OnMountButton(event);
@@ -975,116 +1574,534 @@ void EncFSMPMainFrame::OnContextMenuExport( wxCommandEvent& event )
 	OnExportMenuItem(event);
 }
 
+void EncFSMPMainFrame::OnContextMenuShowStats( wxCommandEvent& event )
+{
+	MountEntry *pMountEntry = getSelectedMount();
+	if(pMountEntry != NULL)
+	{
+		std::string report = FormatterStats::getReport(std::wstring(pMountEntry->name_.wc_str()));
+		if(report.empty())
+			report = "No statistics available, the drive is not mounted.";
+
+		wxMessageBox(wxString(report.c_str(), wxConvUTF8),
+			wxT("Statistics of ") + pMountEntry->name_, wxICON_INFORMATION | wxOK, this);
+	}
+}
+
+void EncFSMPMainFrame::OnContextMenuVolumeStats( wxCommandEvent& event )
+{
+	MountEntry *pMountEntry = getSelectedMount();
+	if(pMountEntry == NULL)
+		return;
+
+	wxString password;
+	if(!getPassword(pMountEntry, password))
+		return;
+
+	// Only reads the volume, a mounted drive may change it meanwhile
+	wxString encFSPath = pMountEntry->encFSPath_;
+	wxString externalConfigFileName = pMountEntry->externalConfigFileName_;
+	bool useExternalConfigFile = pMountEntry->useExternalConfigFile_;
+	VolumeStatistics::Totals totals;
+	wxString errorMsg;
+	bool isOK = runCopyTree(this, wxT("Count files"), wxT("Counting"),
+		[=, &totals](CopyProgress *pProgress, wxString &msg)
+		{
+			return EncFSUtilities::getEncFSStatistics(encFSPath, externalConfigFileName,
+				useExternalConfigFile, password, totals, msg, pProgress);
+		}, errorMsg);
+	if(!isOK)
+	{
+		wxMessageBox(errorMsg,
+			wxT("Count files"), wxICON_ERROR | wxOK, this);
+		return;
+	}
+
+	wxString msg = wxString::Format(
+		wxT("%lld files in %lld folders\n")
+		wxT("%.1f MB of data, %.1f MB in the encrypted folder\n")
+		wxT("%.1f MB of block MACs\n")
+		wxT("%lld names which can't be decoded"),
+		(long long)totals.files, (long long)totals.folders,
+		(double)totals.plaintextBytes / (1024.0 * 1024.0), (double)totals.cipherBytes / (1024.0 * 1024.0),
+		(double)totals.macOverheadBytes / (1024.0 * 1024.0),
+		(long long)totals.invalidNames);
+	wxMessageBox(msg, wxT("Files of ") + pMountEntry->name_,
+		(totals.invalidNames > 0 ? wxICON_WARNING : wxICON_INFORMATION) | wxOK, this);
+}
+
+void EncFSMPMainFrame::OnContextMenuMountAtStartup( wxCommandEvent& event )
+{
+	MountEntry *pMountEntry = getSelectedMount();
+	if(pMountEntry != NULL)
+	{
+		pMountEntry->mountAtStartup_ = event.IsChecked();
+		mountList_.storeToConfig();
+	}
+}
+
+void EncFSMPMainFrame::OnContextMenuMountOnDemand( wxCommandEvent& event )
+{
+	MountEntry *pMountEntry = getSelectedMount();
+	if(pMountEntry != NULL)
+	{
+		pMountEntry->mountOnDemand_ = event.IsChecked();
+		mountList_.storeToConfig();
+	}
+}
+
+void EncFSMPMainFrame::OnContextMenuNameIndex( wxCommandEvent& event )
+{
+	MountEntry *pMountEntry = getSelectedMount();
+	if(pMountEntry != NULL)
+	{
+		// Takes effect when the drive is mounted the next time
+		pMountEntry->useNameIndex_ = event.IsChecked();
+		mountList_.storeToConfig();
+	}
+}
+
+void EncFSMPMainFrame::OnContextMenuMountReadOnly( wxCommandEvent& event )
+{
+	MountEntry *pMountEntry = getSelectedMount();
+	if(pMountEntry != NULL)
+	{
+		// Takes effect when the drive is mounted the next time
+		pMountEntry->mountReadOnly_ = event.IsChecked();
+		mountList_.storeToConfig();
+	}
+}
+
+void EncFSMPMainFrame::OnContextMenuCacheSnapshot( wxCommandEvent& event )
+{
+	MountEntry *pMountEntry = getSelectedMount();
+	if(pMountEntry != NULL)
+	{
+		// Takes effect when the drive is mounted the next time
+		pMountEntry->useCacheSnapshot_ = event.IsChecked();
+		mountList_.storeToConfig();
+	}
+}
+
+void EncFSMPMainFrame::OnContextMenuSearch( wxCommandEvent& event )
+{
+	MountEntry *pMountEntry = getSelectedMount();
+	if(pMountEntry == NULL)
+		return;
+
+	wxTextEntryDialog queryDlg(this,
+		wxT("Part of the file name, or a path starting with / for everything below it:"),
+		wxT("Search ") + pMountEntry->name_);
+	if(queryDlg.ShowModal() != wxID_OK || queryDlg.GetValue().IsEmpty())
+		return;
+
+	std::vector<NameIndex::Hit> hits;
+	bool isComplete = true;
+	if(!PFMHandlerThread::searchNames(pMountEntry->name_, queryDlg.GetValue(), maxSearchHits,
+		hits, isComplete))
+	{
+		wxMessageBox(wxT("The name index is not enabled or the drive is not mounted."),
+			wxT("Search ") + pMountEntry->name_, wxICON_INFORMATION | wxOK, this);
+		return;
+	}
+	if(hits.empty())
+	{
+		wxString msg = wxT("No matching names found.");
+		if(!isComplete)
+			msg.Append(wxT(" The name index is still being built."));
+		wxMessageBox(msg, wxT("Search ") + pMountEntry->name_, wxICON_INFORMATION | wxOK, this);
+		return;
+	}
+
+	wxArrayString names;
+	for(size_t i = 0; i < hits.size(); i++)
+		names.Add(wxString::FromUTF8(hits[i].plainPath.c_str()));
+	wxString msg;
+	msg.Printf(wxT("%d matching names"), static_cast<int>(hits.size()));
+	if(!isComplete)
+		msg.Append(wxT(" (incomplete, the name index is still being built or there are more matches)"));
+	msg.Append(wxT(", select one to show it:"));
+	wxSingleChoiceDialog resultDlg(this, msg, wxT("Search ") + pMountEntry->name_, names);
+	if(resultDlg.ShowModal() != wxID_OK)
+		return;
+
+	// Show the folder of the selected file
+	wxString path = names[resultDlg.GetSelection()];
+#if defined(EFS_WIN32)
+	path.Replace(wxT("/"), wxT("\\"));
+	wxString root = pMountEntry->assignedDriveLetter_;
+	if(!root.IsEmpty())
+		root.Append(wxT(":"));
+	else
+		root = pMountEntry->assignedMountPoint_;
+	wxFileName fn(wxGetOSDirectory(), wxT("Explorer.exe"));
+	if(fn.FileExists())
+		wxExecute(fn.GetFullPath() + wxT(" /select,\"") + root + path + wxT("\""), wxEXEC_ASYNC);
+#elif defined(EFS_MACOSX)
+	wxString cmd(wxT("/usr/bin/open -R \""));
+	cmd.Append(pMountEntry->assignedMountPoint_);
+	cmd.Append(path);
+	cmd.Append(wxT("\""));
+	wxExecute(cmd, wxEXEC_ASYNC);
+#endif
+}
+
+void EncFSMPMainFrame::OnContextMenuCacheSettings( wxCommandEvent& event )
+{
+	MountEntry *pMountEntry = getSelectedMount();
+	if(pMountEntry == NULL)
+		return;
+
+	CacheTuningDialog dlg(this, pMountEntry->name_);
+	dlg.setTuning(pMountEntry->cacheTuning_);
+	if(dlg.ShowModal() != wxID_OK)
+		return;
+
+	CacheTuning cacheTuning = dlg.getTuning();
+	if(cacheTuning == pMountEntry->cacheTuning_)
+		return;
+
+	pMountEntry->cacheTuning_ = cacheTuning;
+	mountList_.storeToConfig();
+
+	// Sizes of the caches of a mounted drive can change right away
+	if(pMountEntry->mountState_ == MountEntry::MSMounted
+		&& !PFMHandlerThread::retune(pMountEntry->name_, cacheTuning.withCaching(pMountEntry->enableCaching_)))
+	{
+		wxMessageBox(wxT("Some of the settings take effect when the drive is mounted again."),
+			wxT("Cache settings of ") + pMountEntry->name_, wxICON_INFORMATION | wxOK, this);
+	}
+}
+
+void EncFSMPMainFrame::OnMountAllMenuItem( wxCommandEvent& event )
+{
+	mountAll(false);
+}
+
+void EncFSMPMainFrame::OnChangePasswordsMenuItem( wxCommandEvent& event )
+{
+	// Only mounts which aren't mounted, like the single change
+	std::list<MountEntry> &mountList = mountList_.getList();
+	std::vector<MountEntry *> entries;
+	wxArrayString names;
+	wxArrayInt selections;
+	std::list<MountEntry>::iterator iter;
+	for(iter = mountList.begin(); iter != mountList.end(); iter++)
+	{
+		if((*iter).mountState_ != MountEntry::MSNotMounted)
+			continue;
+		selections.Add(static_cast<int>(names.GetCount()));
+		names.Add((*iter).name_);
+		entries.push_back(&(*iter));
+	}
+	if(entries.empty())
+	{
+		wxMessageBox(wxT("All mounts are mounted, unmount them first."),
+			wxT("Change passwords"), wxICON_INFORMATION | wxOK, this);
+		return;
+	}
+
+	wxMultiChoiceDialog choiceDlg(this,
+		wxT("Change the password of these mounts, which currently share the same password:"),
+		wxT("Change passwords"), names);
+	choiceDlg.SetSelections(selections);
+	if(choiceDlg.ShowModal() != wxID_OK)
+		return;
+	selections = choiceDlg.GetSelections();
+	if(selections.IsEmpty())
+		return;
+
+	ChangePasswordDialog dlg(this);
+	if(dlg.ShowModal() != wxID_OK)
+		return;
+
+	std::vector<EncFSUtilities::PasswordChange> changes(selections.GetCount());
+	for(size_t i = 0; i < selections.GetCount(); i++)
+	{
+		MountEntry *pMountEntry = entries[selections[i]];
+		changes[i].encFSPath = pMountEntry->encFSPath_;
+		changes[i].externalConfigFileName = pMountEntry->externalConfigFileName_;
+		changes[i].useExternalConfigFile = pMountEntry->useExternalConfigFile_;
+		changes[i].oldPassword = dlg.oldPassword_;
+		changes[i].newPassword = dlg.newPassword_;
+	}
+	if(!runPasswordChanges(this, changes))
+	{
+		wxMessageBox(wxT("Unable to start changing the passwords"),
+			wxT("Change passwords error"), wxICON_ERROR | wxOK, this);
+		return;
+	}
+
+	int changedCount = 0;
+	wxString failures;
+	for(size_t i = 0; i < changes.size(); i++)
+	{
+		MountEntry *pMountEntry = entries[selections[i]];
+		if(!changes[i].isOK)
+		{
+			failures += wxT("\n") + pMountEntry->name_ + wxT(": ") + changes[i].message;
+			continue;
+		}
+		changedCount++;
+		if(dlg.storeNewPassword_)
+			pMountEntry->password_ = dlg.newPassword_;
+		else
+			pMountEntry->password_ = wxEmptyString;
+		pMountEntry->volatilePassword_.Empty();
+	}
+	if(changedCount > 0)
+		mountList_.storeToConfig();
+
+	wxString msg = wxString::Format(wxT("%d of %d passwords changed."),
+		changedCount, static_cast<int>(changes.size()));
+	if(!failures.IsEmpty())
+		msg += wxT("\n") + failures;
+	wxMessageBox(msg, wxT("Change passwords"),
+		(failures.IsEmpty() ? wxICON_INFORMATION : wxICON_WARNING) | wxOK, this);
+}
+
 void EncFSMPMainFrame::OnEncFSCommand( wxCommandEvent &event )
 {
 	wxString command, mountName, passwordCmd;
 	if(EncFSMPIPC::unmarshalArguments(event.GetString(), command,
 		mountName, passwordCmd))
 	{
-		bool isMountCommand = (command.IsSameAs(EncFSMPStrings::commandMount_, false));
-		bool isUnmountCommand = (command.IsSameAs(EncFSMPStrings::commandUnmount_, false));
-		bool isMinimizeCommand = (command.IsSameAs(EncFSMPStrings::commandMinimize_, false));
-		bool isQuitCommand = (command.IsSameAs(EncFSMPStrings::commandQuit_, false));
-		if(!isMountCommand && !isUnmountCommand && !isMinimizeCommand && !isQuitCommand)
+		wxString errorMsg, errorTitle;
+		if(!runCommand(command, mountName, passwordCmd, errorMsg, errorTitle)
+			&& !errorTitle.IsEmpty())
+			wxMessageBox(errorMsg, errorTitle, wxOK | wxICON_ERROR);
+	}
+}
+
+/**
+ * Runs a batch of commands received over the command channel, and waits
+ * until the main thread is done with them.
+ * Called from the thread serving the connection.
+ */
+void EncFSMPMainFrame::runCommandBatch(const std::vector<EncFSMPIPCProtocol::Command> &commands,
+	std::vector<EncFSMPIPCProtocol::Result> &results)
+{
+	CommandBatch batch(commands, results);
+#if wxCHECK_VERSION(2, 9, 0)
+	wxCommandEvent* newEvent = new wxCommandEvent(myCustomEventType, ID_ENCFS_BATCH_COMMAND);
+	newEvent->SetClientData(&batch);
+	wxQueueEvent(this, newEvent);
+#else
+	wxCommandEvent newEvent(myCustomEventType, ID_ENCFS_BATCH_COMMAND);
+	newEvent.SetClientData(&batch);
+	AddPendingEvent(newEvent);
+#endif
+	batch.done_.Wait();
+}
+
+void EncFSMPMainFrame::OnEncFSBatchCommand( wxCommandEvent &event )
+{
+	CommandBatch *pBatch = static_cast<CommandBatch *>(event.GetClientData());
+	std::vector<EncFSMPIPCProtocol::Result> &results = pBatch->results_;
+	results.clear();
+
+	for(size_t i = 0; i < pBatch->commands_.size(); i++)
+	{
+		const EncFSMPIPCProtocol::Command &cmd = pBatch->commands_[i];
+		wxString command = wxString::FromUTF8(cmd.command.c_str());
+		wxString mountName = wxString::FromUTF8(cmd.mountName.c_str());
+		wxString passwordCmd = wxString::FromUTF8(cmd.password.c_str());
+
+		// Status of all mounts
+		if(command.IsSameAs(EncFSMPStrings::commandStatus_, false) && mountName.IsEmpty())
 		{
-			wxMessageBox(wxString(wxT("Unknown command \"")) + command
-				+ wxString(wxT("\" received")),
-				wxT("Unknown command"), wxOK | wxICON_ERROR);
-			return;
+			std::list<MountEntry> &mountList = mountList_.getList();
+			std::list<MountEntry>::const_iterator iter;
+			for(iter = mountList.begin(); iter != mountList.end(); iter++)
+				results.push_back(makeCommandResult(*iter));
+			continue;
 		}
 
-		if(isMinimizeCommand)
+		// Names in the index of a mount
+		if(command.IsSameAs(EncFSMPStrings::commandSearch_, false))
 		{
-			if(IsShown() && !IsIconized())
+			wxString query = wxString::FromUTF8(cmd.query.c_str());
+			MountEntry *pMountEntry = mountList_.findEntryByName(mountName);
+			std::vector<NameIndex::Hit> hits;
+			bool isComplete = true;
+			if(pMountEntry == NULL
+				|| !PFMHandlerThread::searchNames(mountName, query, maxSearchHits, hits, isComplete))
 			{
-#if defined(EFS_MACOSX)
-				wxIconizeEvent dummyEvent(0, true);
-				dummyEvent.SetEventObject(this);
-				OnMainFrameIconize(dummyEvent);
-#else
-				Iconize(true);
-#endif
+				EncFSMPIPCProtocol::Result result;
+				if(pMountEntry != NULL)
+					result = makeCommandResult(*pMountEntry);
+				else
+					result.mountName = cmd.mountName;
+				result.status = EncFSMPIPCProtocol::StatusFailed;
+				result.message = pMountEntry == NULL ? "Mount not found" : "No name index";
+				results.push_back(result);
+				continue;
 			}
-			else
-			{
-				wxIconizeEvent dummyEvent(0, false);
-				dummyEvent.SetEventObject(this);
-				OnMainFrameIconize(dummyEvent);
 
-				Iconize(false);
-				Show(true);
+			EncFSMPIPCProtocol::Result result = makeCommandResult(*pMountEntry);
+			result.message = isComplete ? "complete" : "incomplete";
+			results.push_back(result);
+			for(size_t j = 0; j < hits.size(); j++)
+			{
+				std::ostringstream ostr;
+				ostr << hits[j].plainPath << '\t' << (hits[j].entry.isFolder ? -1 : hits[j].entry.size)
+					<< '\t' << hits[j].entry.mtime;
+				result.message = ostr.str();
+				results.push_back(result);
 			}
+			continue;
 		}
-		else if(isQuitCommand)
+
+		wxString errorMsg, errorTitle;
+		bool isOK = runCommand(command, mountName, passwordCmd, errorMsg, errorTitle);
+
+		EncFSMPIPCProtocol::Result result;
+		MountEntry *pMountEntry = mountList_.findEntryByName(mountName);
+		if(pMountEntry != NULL)
+			result = makeCommandResult(*pMountEntry);
+		else
+			result.mountName = cmd.mountName;
+		if(!isOK)
 		{
-			Close();
+			result.status = EncFSMPIPCProtocol::StatusFailed;
+			result.message = std::string(errorMsg.utf8_str());
 		}
+		results.push_back(result);
+	}
+
+	pBatch->done_.Post();
+}
+
+EncFSMPIPCProtocol::Result EncFSMPMainFrame::makeCommandResult(const MountEntry &entry)
+{
+	EncFSMPIPCProtocol::Result result;
+	result.mountState = static_cast<uint8_t>(entry.mountState_);
+	result.mountName = std::string(entry.name_.utf8_str());
+	if(entry.mountState_ == MountEntry::MSMounted)
+	{
+		if(!entry.assignedMountPoint_.IsEmpty())
+			result.mountPoint = std::string(entry.assignedMountPoint_.utf8_str());
 		else
+			result.mountPoint = std::string(entry.assignedDriveLetter_.utf8_str());
+	}
+	return result;
+}
+
+/**
+ * Runs one command of another instance or of the command channel.
+ * Returns false if it failed, with the message and title for an error box.
+ * The title is empty if the user canceled the command.
+ */
+bool EncFSMPMainFrame::runCommand(const wxString &command, const wxString &mountName,
+	const wxString &passwordCmd, wxString &errorMsg, wxString &errorTitle)
+{
+	bool isMountCommand = (command.IsSameAs(EncFSMPStrings::commandMount_, false));
+	bool isUnmountCommand = (command.IsSameAs(EncFSMPStrings::commandUnmount_, false));
+	bool isMinimizeCommand = (command.IsSameAs(EncFSMPStrings::commandMinimize_, false));
+	bool isQuitCommand = (command.IsSameAs(EncFSMPStrings::commandQuit_, false));
+	bool isMountAllCommand = (command.IsSameAs(EncFSMPStrings::commandMountAll_, false));
+	bool isStatusCommand = (command.IsSameAs(EncFSMPStrings::commandStatus_, false));
+	if(!isMountCommand && !isUnmountCommand && !isMinimizeCommand && !isQuitCommand
+		&& !isMountAllCommand && !isStatusCommand)
+	{
+		errorMsg = wxString(wxT("Unknown command \"")) + command
+			+ wxString(wxT("\" received"));
+		errorTitle = wxT("Unknown command");
+		return false;
+	}
+
+	if(isMinimizeCommand)
+	{
+		if(IsShown() && !IsIconized())
 		{
-			MountEntry *pMountEntry = mountList_.findEntryByName(mountName);
-			if(pMountEntry != NULL)
-			{
-				if(pMountEntry->mountState_ == MountEntry::MSMounted)
-				{
-					if(isUnmountCommand)
-					{
-						PFMProxy::getInstance().unmount(pMountEntry->name_);
-						pMountEntry->mountState_ = MountEntry::MSPending;
-					}
-					else
-					{
-						wxMessageBox(wxT("EncFS folder is already mounted"),
-							wxT("Mount command"), wxOK | wxICON_ERROR);
-						return;
-					}
-				}
-				else if(pMountEntry->mountState_ == MountEntry::MSNotMounted)
-				{
-					if(!isMountCommand)
-					{
-						wxMessageBox(wxT("EncFS folder is not mounted"),
-							wxT("Unmount command"), wxOK | wxICON_ERROR);
-						return;
-					}
-					// Mount: Start a PFMHandlerThread
-					wxString password = pMountEntry->password_;
-					if(password.IsEmpty())
-						password = passwordCmd;
-					if(password.IsEmpty())
-						password = pMountEntry->volatilePassword_;
-					if(password.IsEmpty())
-					{
-						wxPasswordEntryDialog dlg(this, wxT("Please enter the password:"), wxString(wxT(ENCFSMP_NAME " - Password for ")) + pMountEntry->name_);
-						int retVal = dlg.ShowModal();
-						if(retVal == wxID_CANCEL)
-							return;
-						password = dlg.GetValue();
-					}
-					if(savePasswordsInRAM_)
-						pMountEntry->volatilePassword_ = password;
-					bool isWorldWritable = pMountEntry->isWorldWritable_;
-					PFMHandlerThread *pPFMHandlerThread = new PFMHandlerThread();
-					pPFMHandlerThread->setParameters(pMountEntry->name_,
-						pMountEntry->encFSPath_, pMountEntry->externalConfigFileName_,
-						pMountEntry->driveLetter_, password,
-						pMountEntry->useExternalConfigFile_, pMountEntry->enableCaching_,
-						isWorldWritable, pMountEntry->isLocalDrive_, false);
-
-					pPFMHandlerThread->Create();
-					pPFMHandlerThread->Run();
-					pMountEntry->mountState_ = MountEntry::MSPending;
-				}
+#if defined(EFS_MACOSX)
+			wxIconizeEvent dummyEvent(0, true);
+			dummyEvent.SetEventObject(this);
+			OnMainFrameIconize(dummyEvent);
+#else
+			Iconize(true);
+#endif
+		}
+		else
+		{
+			wxIconizeEvent dummyEvent(0, false);
+			dummyEvent.SetEventObject(this);
+			OnMainFrameIconize(dummyEvent);
 
-				updateMountListCtrl();
+			Iconize(false);
+			Show(true);
+		}
+	}
+	else if(isQuitCommand)
+	{
+		Close();
+	}
+	else if(isMountAllCommand)
+	{
+		mountAll(false);
+	}
+	else
+	{
+		MountEntry *pMountEntry = mountList_.findEntryByName(mountName);
+		if(pMountEntry == NULL)
+		{
+			errorMsg = wxString(wxT("Mount \"")) + mountName + wxString(wxT("\" not found"));
+			errorTitle = wxT("Mount not found");
+			return false;
+		}
+
+		if(isStatusCommand)
+			return true;
+
+		if(pMountEntry->mountState_ == MountEntry::MSMounted)
+		{
+			if(isUnmountCommand)
+			{
+				PFMProxy::getInstance().unmount(pMountEntry->name_);
+				pMountEntry->mountState_ = MountEntry::MSPending;
 			}
 			else
 			{
-				wxMessageBox(wxString(wxT("Mount \"")) + mountName + wxString(wxT("\" not found")),
-					wxT("Mount not found"), wxOK | wxICON_ERROR);
+				errorMsg = wxT("EncFS folder is already mounted");
+				errorTitle = wxT("Mount command");
+				return false;
 			}
 		}
+		else if(pMountEntry->mountState_ == MountEntry::MSNotMounted)
+		{
+			if(!isMountCommand)
+			{
+				errorMsg = wxT("EncFS folder is not mounted");
+				errorTitle = wxT("Unmount command");
+				return false;
+			}
+			// Mount: Start a PFMHandlerThread
+			wxString password = pMountEntry->password_;
+			if(password.IsEmpty())
+				password = passwordCmd;
+			if(password.IsEmpty())
+				password = pMountEntry->volatilePassword_;
+			if(password.IsEmpty())
+			{
+				wxPasswordEntryDialog dlg(this, wxT("Please enter the password:"), wxString(wxT(ENCFSMP_NAME " - Password for ")) + pMountEntry->name_);
+				int retVal = dlg.ShowModal();
+				if(retVal == wxID_CANCEL)
+				{
+					errorMsg = wxT("Password entry canceled");
+					return false;
+				}
+				password = dlg.GetValue();
+			}
+			if(savePasswordsInRAM_)
+				pMountEntry->volatilePassword_ = password;
+
+			startMount(pMountEntry, password);
+		}
 
+		updateMountListCtrl();
 	}
+
+	return true;
 }
 
 // Icon: From resource on Win32, from PNG otherwise
@@ -1120,9 +2137,23 @@ void EncFSMPMainFrame::updateMountListCtrl()
 		MountEntry &curEntry = (*iter);
 		wxString mountedString(wxT("No"));
 		if(curEntry.mountState_ == MountEntry::MSMounted)
-			mountedString = wxT("Yes");
+		{
+			if(curEntry.mountProgress_ == MountEntry::MPUnlocking)
+				mountedString = wxT("Unlocking");
+			else
+				mountedString = wxT("Yes");
+		}
 		else if(curEntry.mountState_ == MountEntry::MSPending)
-			mountedString = wxT("Pending");
+		{
+			if(curEntry.mountProgress_ == MountEntry::MPQueued)
+				mountedString = wxT("Queued");
+			else if(curEntry.mountProgress_ == MountEntry::MPDerivingKey)
+				mountedString = wxT("Deriving key");
+			else if(curEntry.mountProgress_ == MountEntry::MPCreatingMount)
+				mountedString = wxT("Mounting");
+			else
+				mountedString = wxT("Pending");
+		}
 
 		if(i >= listCtrlItemCount)
 		{
@@ -1198,6 +2229,40 @@ MountEntry *EncFSMPMainFrame::getSelectedMount()
 	return NULL;
 }
 
+/**
+ * Starts a PFMHandlerThread for the mount, the thread reports its progress and result.
+ */
+void EncFSMPMainFrame::startMount(MountEntry *pMountEntry, const wxString &password)
+{
+	bool isWorldWritable = pMountEntry->isWorldWritable_;
+
+	PFMHandlerThread *pPFMHandlerThread = new PFMHandlerThread();
+	pPFMHandlerThread->setParameters(pMountEntry->name_,
+		pMountEntry->encFSPath_, pMountEntry->externalConfigFileName_,
+		pMountEntry->driveLetter_, password,
+		pMountEntry->useExternalConfigFile_, pMountEntry->enableCaching_,
+		pMountEntry->enableWriteBuffer_, isWorldWritable, pMountEntry->isLocalDrive_, false);
+	pPFMHandlerThread->setCacheVolumeKey(savePasswordsInRAM_);
+	pPFMHandlerThread->setMapBackingFiles(pMountEntry->mapBackingFiles_);
+	pPFMHandlerThread->setUncachedSequentialIO(pMountEntry->uncachedSequentialIO_);
+	pPFMHandlerThread->setFlushPolicy(pMountEntry->flushPolicy_);
+	pPFMHandlerThread->setLazyExtend(pMountEntry->lazyExtend_);
+	pPFMHandlerThread->setNamePatterns(pMountEntry->hiddenNamePatterns_, pMountEntry->skippedNamePatterns_);
+	pPFMHandlerThread->setCacheTuning(pMountEntry->cacheTuning_.withCaching(pMountEntry->enableCaching_));
+	pPFMHandlerThread->setWatchBackingFolder(pMountEntry->watchBackingFolder_);
+	pPFMHandlerThread->setTraceFile(pMountEntry->traceFile_);
+	pPFMHandlerThread->setChangeJournalFile(pMountEntry->changeJournalFile_);
+	pPFMHandlerThread->setMountOnDemand(pMountEntry->mountOnDemand_);
+	pPFMHandlerThread->setUseNameIndex(pMountEntry->useNameIndex_);
+	pPFMHandlerThread->setReadOnly(pMountEntry->mountReadOnly_);
+	pPFMHandlerThread->setUseCacheSnapshot(pMountEntry->useCacheSnapshot_);
+
+	pPFMHandlerThread->Create();
+	pPFMHandlerThread->Run();
+	pMountEntry->mountState_ = MountEntry::MSPending;
+	pMountEntry->mountProgress_ = MountEntry::MPQueued;
+}
+
 void EncFSMPMainFrame::updateButtonStates()
 {
 	bool isPFMPresent = PFMProxy::getInstance().isPFMPresent();
@@ -1282,6 +2347,7 @@ void EncFSMPMainFrame::saveWindowLayoutToConfig()
 	config->Write(EncFSMPStrings::configMinimizeToTray_, minimizeToTray_);
 	config->Write(EncFSMPStrings::configDisableUnmountDialogOnExit_, disableUnmountDialogOnExit_);
 	config->Write(EncFSMPStrings::configSavePasswordsInRAM_, savePasswordsInRAM_);
+	config->Write(EncFSMPStrings::configShowPerformancePanel_, pPerformancePanel_->IsShown());
 
 	if(pEncFSMPErrorLog_ != NULL)
 		config->Write(EncFSMPStrings::configShowErrorLogOnErr_, pEncFSMPErrorLog_->getShowErrorLogOnErr());
@@ -1332,6 +2398,10 @@ void EncFSMPMainFrame::loadWindowLayoutFromConfig()
 		savePasswordsInRAM_ = false;		// Default is false
 	pSavePasswordsInRAMMenuItem_->Check(savePasswordsInRAM_);
 
+	bool showPerformance = false;
+	config->Read(EncFSMPStrings::configShowPerformancePanel_, &showPerformance);
+	showPerformancePanel(showPerformance);
+
 	bool showErrorLogOnErr = false;
 	if(pEncFSMPErrorLog_ != NULL)
 	{
@@ -1354,5 +2424,21 @@ BEGIN_EVENT_TABLE( EncFSMPMainFrame, EncFSMPMainFrameBase )
 	EVT_MENU( ID_CTXSHOWINFO, EncFSMPMainFrame::OnContextMenuShowInfo )
 	EVT_MENU( ID_CTXCHANGEPASSWD, EncFSMPMainFrame::OnContextMenuChangePassword )
 	EVT_MENU( ID_CTXEXPORT, EncFSMPMainFrame::OnContextMenuExport )
+	EVT_MENU( ID_CTXIMPORT, EncFSMPMainFrame::OnContextMenuImport )
+	EVT_MENU( ID_CTXVERIFY, EncFSMPMainFrame::OnContextMenuVerify )
+	EVT_MENU( ID_CTXCONVERT, EncFSMPMainFrame::OnContextMenuConvert )
+	EVT_MENU( ID_CTXSHOWSTATS, EncFSMPMainFrame::OnContextMenuShowStats )
+	EVT_MENU( ID_CTXVOLUMESTATS, EncFSMPMainFrame::OnContextMenuVolumeStats )
+	EVT_MENU( ID_CTXMOUNTATSTARTUP, EncFSMPMainFrame::OnContextMenuMountAtStartup )
+	EVT_MENU( ID_CTXMOUNTONDEMAND, EncFSMPMainFrame::OnContextMenuMountOnDemand )
+	EVT_MENU( ID_CTXNAMEINDEX, EncFSMPMainFrame::OnContextMenuNameIndex )
+	EVT_MENU( ID_CTXMOUNTREADONLY, EncFSMPMainFrame::OnContextMenuMountReadOnly )
+	EVT_MENU( ID_CTXCACHESNAPSHOT, EncFSMPMainFrame::OnContextMenuCacheSnapshot )
+	EVT_MENU( ID_CTXSEARCH, EncFSMPMainFrame::OnContextMenuSearch )
+	EVT_MENU( ID_CTXCACHESETTINGS, EncFSMPMainFrame::OnContextMenuCacheSettings )
+	EVT_MENU( ID_MOUNTALLMENUITEM, EncFSMPMainFrame::OnMountAllMenuItem )
+	EVT_MENU( ID_CHANGEPASSWORDSMENUITEM, EncFSMPMainFrame::OnChangePasswordsMenuItem )
+	EVT_MENU( ID_SHOWPERFORMANCEMENUITEM, EncFSMPMainFrame::OnShowPerformanceMenuItem )
 	EVT_COMMAND(ID_ENCFS_COMMAND, myCustomEventType, EncFSMPMainFrame::OnEncFSCommand)
+	EVT_COMMAND(ID_ENCFS_BATCH_COMMAND, myCustomEventType, EncFSMPMainFrame::OnEncFSBatchCommand)
 END_EVENT_TABLE()
@@ -23,9 +23,12 @@
 class EncFSMPTaskBarIcon;
 class wxMenu;
 class EncFSMPErrorLog;
+class PerformancePanel;
 
 #include <list>
+#include <vector>
 #include "EncFSMPMainFrameBase.h"
+#include "EncFSMPIPCProtocol.h"
 #include "MountList.h"
 
 class EncFSMPMainFrame: public EncFSMPMainFrameBase
@@ -37,13 +40,17 @@ public:
 	void addNewMountEvent(bool isMountEvent, bool isError,
 		const std::wstring &mountName, wchar_t driveLetter, const std::wstring &mountPoint);
 	void reportEncFSError(const wxString &error, const wxString &mountName);
+	void reportMountProgress(const wxString &mountName, MountEntry::MountProgress progress);
 	void sendCommand(const wxString &command,
 		const wxString &mountName,
 		const wxString &password);
 	void sendCommand(const wxString &arg);
+	void runCommandBatch(const std::vector<EncFSMPIPCProtocol::Command> &commands,
+		std::vector<EncFSMPIPCProtocol::Result> &results);
 
 	void unmountAllAndQuit();
 	void unmountAll();
+	void mountAll(bool startupMountsOnly);
 
 	virtual void OnMainFrameIconize( wxIconizeEvent& event );
 
@@ -84,12 +91,34 @@ protected:
 	virtual void OnContextMenuShowInfo( wxCommandEvent& event );
 	virtual void OnContextMenuChangePassword( wxCommandEvent& event );
 	virtual void OnContextMenuExport( wxCommandEvent& event );
+	virtual void OnContextMenuImport( wxCommandEvent& event );
+	virtual void OnContextMenuVerify( wxCommandEvent& event );
+	virtual void OnContextMenuConvert( wxCommandEvent& event );
+	virtual void OnContextMenuShowStats( wxCommandEvent& event );
+	virtual void OnContextMenuVolumeStats( wxCommandEvent& event );
+	virtual void OnContextMenuMountAtStartup( wxCommandEvent& event );
+	virtual void OnContextMenuMountOnDemand( wxCommandEvent& event );
+	virtual void OnContextMenuNameIndex( wxCommandEvent& event );
+	virtual void OnContextMenuMountReadOnly( wxCommandEvent& event );
+	virtual void OnContextMenuCacheSnapshot( wxCommandEvent& event );
+	virtual void OnContextMenuSearch( wxCommandEvent& event );
+	virtual void OnContextMenuCacheSettings( wxCommandEvent& event );
+	virtual void OnMountAllMenuItem( wxCommandEvent& event );
+	virtual void OnChangePasswordsMenuItem( wxCommandEvent& event );
+	virtual void OnShowPerformanceMenuItem( wxCommandEvent& event );
 	virtual void OnEncFSCommand( wxCommandEvent &event );
+	virtual void OnEncFSBatchCommand( wxCommandEvent &event );
 
 	wxIcon getIcon();
 	void updateMountListCtrl();
 	MountEntry *getSelectedMount();
+	bool getPassword(MountEntry *pMountEntry, wxString &password);
+	void startMount(MountEntry *pMountEntry, const wxString &password);
+	bool runCommand(const wxString &command, const wxString &mountName,
+		const wxString &passwordCmd, wxString &errorMsg, wxString &errorTitle);
+	EncFSMPIPCProtocol::Result makeCommandResult(const MountEntry &entry);
 	void updateButtonStates();
+	void showPerformancePanel(bool show);
 	void saveWindowLayoutToConfig();
 	void loadWindowLayoutFromConfig();
 
@@ -106,16 +135,19 @@ private:
 	class MountEvent
 	{
 	public:
-		MountEvent() : isMountEvent_(true), isError_(false), driveLetter_(L'A') { }
+		MountEvent() : isMountEvent_(true), isError_(false), isProgressEvent_(false),
+			driveLetter_(L'A'), progress_(MountEntry::MPNone) { }
 		MountEvent(const MountEvent &o) { copy(o); }
 		virtual ~MountEvent() { }
 		MountEvent &copy(const MountEvent &o)
 		{
 			isMountEvent_ = o.isMountEvent_;
 			isError_ = o.isError_;
+			isProgressEvent_ = o.isProgressEvent_;
 			mountName_ = o.mountName_;
 			driveLetter_ = o.driveLetter_;
 			mountPoint_ = o.mountPoint_;
+			progress_ = o.progress_;
 			return *this;
 		}
 		MountEvent & operator=(const MountEvent & o)
@@ -125,8 +157,24 @@ private:
 
 		bool isMountEvent_;		// true: mount, false: unmount
 		bool isError_;			// Some error occurred during mount
+		bool isProgressEvent_;	// Only progress_ of a pending mount changed
 		std::wstring mountName_, mountPoint_;
 		wchar_t driveLetter_;
+		MountEntry::MountProgress progress_;
+	};
+
+	void queueMountEvent(const MountEvent &evt);
+
+	// Commands of the command channel, run by OnEncFSBatchCommand()
+	struct CommandBatch
+	{
+		CommandBatch(const std::vector<EncFSMPIPCProtocol::Command> &commands,
+			std::vector<EncFSMPIPCProtocol::Result> &results)
+			: commands_(commands), results_(results), done_(0, 1) { }
+
+		const std::vector<EncFSMPIPCProtocol::Command> &commands_;
+		std::vector<EncFSMPIPCProtocol::Result> &results_;
+		wxSemaphore done_;
 	};
 
 
@@ -140,6 +188,9 @@ private:
 
 	EncFSMPErrorLog *pEncFSMPErrorLog_;
 
+	wxMenuItem *pShowPerformanceMenuItem_;
+	PerformancePanel *pPerformancePanel_;
+
 	DECLARE_EVENT_TABLE()
 };
 
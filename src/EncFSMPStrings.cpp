@@ -35,19 +35,50 @@ const wxString EncFSMPStrings::configDriveLetterKey_(wxT("DriveLetter"));
 const wxString EncFSMPStrings::configPasswordKey_(wxT("Password"));
 const wxString EncFSMPStrings::configUseExternalConfigFileKey_(wxT("UseExternalConfigFile"));
 const wxString EncFSMPStrings::configEnableCachingKey_(wxT("EnableCaching"));
+const wxString EncFSMPStrings::configEnableWriteBufferKey_(wxT("EnableWriteBuffer"));
+const wxString EncFSMPStrings::configMapBackingFilesKey_(wxT("MapBackingFiles"));
+const wxString EncFSMPStrings::configUncachedSequentialIOKey_(wxT("UncachedSequentialIO"));
+const wxString EncFSMPStrings::configFlushPolicyKey_(wxT("FlushPolicy"));
+const wxString EncFSMPStrings::configLazyExtendKey_(wxT("LazyExtend"));
+const wxString EncFSMPStrings::configHiddenNamePatternsKey_(wxT("HiddenNamePatterns"));
+const wxString EncFSMPStrings::configSkippedNamePatternsKey_(wxT("SkippedNamePatterns"));
+const wxString EncFSMPStrings::configStatCacheTimeToLiveKey_(wxT("StatCacheTimeToLive"));
+const wxString EncFSMPStrings::configStatCacheSizeKey_(wxT("StatCacheSize"));
+const wxString EncFSMPStrings::configBlockCacheMBKey_(wxT("BlockCacheMB"));
+const wxString EncFSMPStrings::configListingCacheKey_(wxT("ListingCache"));
+const wxString EncFSMPStrings::configReadAheadKBKey_(wxT("ReadAheadKB"));
+const wxString EncFSMPStrings::configWriteBufferKBKey_(wxT("WriteBufferKB"));
+const wxString EncFSMPStrings::configFirstBlockPrefetchKBKey_(wxT("FirstBlockPrefetchKB"));
+const wxString EncFSMPStrings::configAutoTuneKey_(wxT("AutoTune"));
+const wxString EncFSMPStrings::configMemoryBudgetMBKey_(wxT("MemoryBudgetMB"));
+const wxString EncFSMPStrings::configThreadCountKey_(wxT("ThreadCount"));
+const wxString EncFSMPStrings::configWatchBackingFolderKey_(wxT("WatchBackingFolder"));
+const wxString EncFSMPStrings::configTraceFileKey_(wxT("TraceFile"));
+const wxString EncFSMPStrings::configChangeJournalFileKey_(wxT("ChangeJournalFile"));
 const wxString EncFSMPStrings::configIsWorldWritableKey_(wxT("IsWorldWritable"));
 const wxString EncFSMPStrings::configIsLocalDriveKey_(wxT("IsLocalDrive"));
+const wxString EncFSMPStrings::configMountAtStartupKey_(wxT("MountAtStartup"));
+const wxString EncFSMPStrings::configMountOnDemandKey_(wxT("MountOnDemand"));
+const wxString EncFSMPStrings::configUseNameIndexKey_(wxT("UseNameIndex"));
+const wxString EncFSMPStrings::configMountReadOnlyKey_(wxT("MountReadOnly"));
+const wxString EncFSMPStrings::configUseCacheSnapshotKey_(wxT("UseCacheSnapshot"));
 const wxString EncFSMPStrings::configWindowDimensions_(wxT("WindowDimensions"));
 const wxString EncFSMPStrings::configColumnWidths_(wxT("ColumnWidths"));
 const wxString EncFSMPStrings::configMinimizeToTray_(wxT("MinimizeToTray"));
 const wxString EncFSMPStrings::configDisableUnmountDialogOnExit_(wxT("DisableUnmountDialogOnExit"));
 const wxString EncFSMPStrings::configShowErrorLogOnErr_(wxT("ShowErrorLogOnErr"));
 const wxString EncFSMPStrings::configSavePasswordsInRAM_(wxT("SavePasswordsInRAM"));
+const wxString EncFSMPStrings::configShowPerformancePanel_(wxT("ShowPerformancePanel"));
+const wxString EncFSMPStrings::configKDFCalibration_(wxT("KDFCalibration"));
 
 const wxString EncFSMPStrings::commandMount_(wxT("mount"));
 const wxString EncFSMPStrings::commandUnmount_(wxT("unmount"));
 const wxString EncFSMPStrings::commandDDETopic_(wxT("EncFSMP_Command"));
 const wxString EncFSMPStrings::commandDDEServerName_(wxT("EncFSMP_DDEServer"));
+const wxString EncFSMPStrings::commandChannelName_(wxT("EncFSMP_Commands"));
 const wxString EncFSMPStrings::commandMinimize_(wxT("minimize"));
 const wxString EncFSMPStrings::commandQuit_(wxT("quit"));
+const wxString EncFSMPStrings::commandMountAll_(wxT("mountall"));
+const wxString EncFSMPStrings::commandStatus_(wxT("status"));
+const wxString EncFSMPStrings::commandSearch_(wxT("search"));
 
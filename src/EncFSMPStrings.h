@@ -38,21 +38,52 @@ public:
 	const static wxString configPasswordKey_;
 	const static wxString configUseExternalConfigFileKey_;
 	const static wxString configEnableCachingKey_;
+	const static wxString configEnableWriteBufferKey_;
+	const static wxString configMapBackingFilesKey_;
+	const static wxString configUncachedSequentialIOKey_;
+	const static wxString configFlushPolicyKey_;
+	const static wxString configLazyExtendKey_;
+	const static wxString configHiddenNamePatternsKey_;
+	const static wxString configSkippedNamePatternsKey_;
+	const static wxString configStatCacheTimeToLiveKey_;
+	const static wxString configStatCacheSizeKey_;
+	const static wxString configBlockCacheMBKey_;
+	const static wxString configListingCacheKey_;
+	const static wxString configReadAheadKBKey_;
+	const static wxString configWriteBufferKBKey_;
+	const static wxString configFirstBlockPrefetchKBKey_;
+	const static wxString configAutoTuneKey_;
+	const static wxString configMemoryBudgetMBKey_;
+	const static wxString configThreadCountKey_;
+	const static wxString configWatchBackingFolderKey_;
+	const static wxString configTraceFileKey_;
+	const static wxString configChangeJournalFileKey_;
 	const static wxString configIsWorldWritableKey_;
 	const static wxString configIsLocalDriveKey_;
+	const static wxString configMountAtStartupKey_;
+	const static wxString configMountOnDemandKey_;
+	const static wxString configUseNameIndexKey_;
+	const static wxString configMountReadOnlyKey_;
+	const static wxString configUseCacheSnapshotKey_;
 	const static wxString configWindowDimensions_;
 	const static wxString configColumnWidths_;
 	const static wxString configMinimizeToTray_;
 	const static wxString configDisableUnmountDialogOnExit_;
 	const static wxString configShowErrorLogOnErr_;
 	const static wxString configSavePasswordsInRAM_;
+	const static wxString configShowPerformancePanel_;
+	const static wxString configKDFCalibration_;
 
 	const static wxString commandMount_;
 	const static wxString commandUnmount_;
 	const static wxString commandDDETopic_;
 	const static wxString commandDDEServerName_;
+	const static wxString commandChannelName_;
 	const static wxString commandMinimize_;
 	const static wxString commandQuit_;
+	const static wxString commandMountAll_;
+	const static wxString commandStatus_;
+	const static wxString commandSearch_;
 
 private:
 	EncFSMPStrings() { }
@@ -20,9 +20,12 @@
 #include "CommonIncludes.h"
 
 #include "EncFSMPTestApp.h"
+#include "TestBenchmark.h"
 #include "TestBigFile.h"
 #include "TestOpenFileTwice.h"
 #include "TestManyFiles.h"
+#include "TestStress.h"
+#include "TestTraceReplay.h"
 
 #if defined(_WIN32)
 #include "TestFileWin32.h"
@@ -45,6 +48,7 @@
 
  // boost
 #include <boost/version.hpp>
+#include <boost/filesystem/fstream.hpp>
 #include "gtest/gtest.h"
 
 class TestParameters
@@ -52,9 +56,35 @@ class TestParameters
 public:
 	static wxString testPath_;
 	static boost::filesystem::path testPathBoost_;
+	static bool runBenchmark_;
+	static TestBenchmark::Options benchmarkOptions_;
+	static bool runMetadataBenchmark_;
+	static TestManyFiles::BenchmarkOptions metadataBenchmarkOptions_;
+	static bool runStressTest_;
+	static TestStress::Options stressOptions_;
+	static bool runOverlappedBenchmark_;
+#if defined(_WIN32)
+	static TestFileWin32::OverlappedOptions overlappedOptions_;
+#endif
+	static wxString replayTraceFile_;
+	static bool replayFast_;
+	static wxString benchmarkOutput_;
 };
 wxString TestParameters::testPath_;
 boost::filesystem::path TestParameters::testPathBoost_;
+bool TestParameters::runBenchmark_ = false;
+TestBenchmark::Options TestParameters::benchmarkOptions_;
+bool TestParameters::runMetadataBenchmark_ = false;
+TestManyFiles::BenchmarkOptions TestParameters::metadataBenchmarkOptions_;
+bool TestParameters::runStressTest_ = false;
+TestStress::Options TestParameters::stressOptions_;
+bool TestParameters::runOverlappedBenchmark_ = false;
+#if defined(_WIN32)
+TestFileWin32::OverlappedOptions TestParameters::overlappedOptions_;
+#endif
+wxString TestParameters::replayTraceFile_;
+bool TestParameters::replayFast_ = false;
+wxString TestParameters::benchmarkOutput_;
 
 
 // Main program equivalent, creating windows and returning main app frame
@@ -67,6 +97,22 @@ bool EncFSMPTestApp::OnInit()
 	// Parse command line
 	static const wxCmdLineEntryDesc cmdLineDesc[] =
 	{
+		{ wxCMD_LINE_SWITCH, "b", "benchmark", "Run the throughput benchmark instead of the tests" },
+		{ wxCMD_LINE_OPTION, NULL, "bench-size", "Size of the benchmark file in MB (default 4096)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, NULL, "bench-bytes", "MB read or written per benchmark run (default 1024)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_SWITCH, "m", "metadata-benchmark", "Run the metadata benchmark instead of the tests" },
+		{ wxCMD_LINE_OPTION, NULL, "bench-entries", "Largest folder of the metadata benchmark (default 100000)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, NULL, "bench-depth", "Depth of the folder tree of the metadata benchmark, 0 to skip (default 32)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_SWITCH, "s", "stress", "Run the concurrency stress test instead of the tests" },
+		{ wxCMD_LINE_OPTION, NULL, "stress-threads", "Largest number of threads of the stress test (default 8)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, NULL, "stress-seconds", "Duration of every stress test run in seconds (default 10)", wxCMD_LINE_VAL_NUMBER },
+#if defined(_WIN32)
+		{ wxCMD_LINE_SWITCH, "o", "overlapped-benchmark", "Run the overlapped I/O benchmark instead of the tests, with bench-size (default 1024) and bench-bytes (default 256)" },
+		{ wxCMD_LINE_OPTION, NULL, "bench-queue-depth", "Largest queue depth of the overlapped I/O benchmark (default 64)", wxCMD_LINE_VAL_NUMBER },
+#endif
+		{ wxCMD_LINE_OPTION, NULL, "replay", "Replay this trace of a mounted drive instead of the tests", wxCMD_LINE_VAL_STRING },
+		{ wxCMD_LINE_SWITCH, NULL, "replay-fast", "Replay the trace as fast as possible instead of with the original timing" },
+		{ wxCMD_LINE_OPTION, NULL, "bench-output", "File for the benchmark results, CSV or JSON (default: standard output)", wxCMD_LINE_VAL_STRING },
 		{ wxCMD_LINE_PARAM, "test dir", "test directory", "Test directory", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
 		{ wxCMD_LINE_NONE }
 	};
@@ -83,6 +129,42 @@ bool EncFSMPTestApp::OnInit()
 		{
 			testpath = parser.GetParam(i);
 		}
+
+		TestParameters::runBenchmark_ = parser.Found("benchmark");
+		long sizeMB = 0;
+		if(parser.Found("bench-size", &sizeMB) && sizeMB > 0)
+		{
+			TestParameters::benchmarkOptions_.fileSize = static_cast<int64_t>(sizeMB) * 1024LL * 1024LL;
+#if defined(_WIN32)
+			TestParameters::overlappedOptions_.fileSize = TestParameters::benchmarkOptions_.fileSize;
+#endif
+		}
+		if(parser.Found("bench-bytes", &sizeMB) && sizeMB > 0)
+		{
+			TestParameters::benchmarkOptions_.runBytes = static_cast<int64_t>(sizeMB) * 1024LL * 1024LL;
+#if defined(_WIN32)
+			TestParameters::overlappedOptions_.runBytes = TestParameters::benchmarkOptions_.runBytes;
+#endif
+		}
+		TestParameters::runMetadataBenchmark_ = parser.Found("metadata-benchmark");
+		long count = 0;
+		if(parser.Found("bench-entries", &count) && count > 0)
+			TestParameters::metadataBenchmarkOptions_.maxEntries = static_cast<int>(count);
+		if(parser.Found("bench-depth", &count) && count >= 0)
+			TestParameters::metadataBenchmarkOptions_.treeDepth = static_cast<int>(count);
+		TestParameters::runStressTest_ = parser.Found("stress");
+		if(parser.Found("stress-threads", &count) && count > 0)
+			TestParameters::stressOptions_.maxThreads = static_cast<int>(count);
+		if(parser.Found("stress-seconds", &count) && count > 0)
+			TestParameters::stressOptions_.secondsPerRun = static_cast<int>(count);
+#if defined(_WIN32)
+		TestParameters::runOverlappedBenchmark_ = parser.Found("overlapped-benchmark");
+		if(parser.Found("bench-queue-depth", &count) && count > 0)
+			TestParameters::overlappedOptions_.maxQueueDepth = static_cast<int>(count);
+#endif
+		parser.Found("replay", &TestParameters::replayTraceFile_);
+		TestParameters::replayFast_ = parser.Found("replay-fast");
+		parser.Found("bench-output", &TestParameters::benchmarkOutput_);
 	}
 	else
 	{
@@ -106,6 +188,13 @@ bool EncFSMPTestApp::OnInit()
 	boostVersion.Printf(wxT("%d.%d.%d"), BOOST_VERSION / 100000, BOOST_VERSION / 100 % 1000, BOOST_VERSION % 100);
 	std::cout << "boost " << boostVersion.ToStdString().c_str() << std::endl;
 
+	std::vector<std::pair<std::string, std::string> > &buildInfo = TestParameters::metadataBenchmarkOptions_.buildInfo;
+	buildInfo.push_back(std::make_pair("encfsmp", ENCFSMP_VERSION_STRING));
+	buildInfo.push_back(std::make_pair("compiler", ENCFSMP_COMPILER " " ENCFSMP_COMPILER_VERSION));
+	buildInfo.push_back(std::make_pair("encfs", EFS_STRINGIFY(VERSION)));
+	buildInfo.push_back(std::make_pair("openssl", OPENSSL_VERSION_TEXT));
+	buildInfo.push_back(std::make_pair("boost", boostVersion.ToStdString()));
+
 	return true;
 }
 
@@ -134,8 +223,53 @@ TEST(Win32Test, TestSupersede)
 
 #endif
 
+/**
+ * Runs the selected benchmark, writing the results to the output file or the standard output.
+ */
+static bool runBenchmark()
+{
+	boost::filesystem::ofstream outFile;
+	if(!TestParameters::benchmarkOutput_.empty())
+	{
+#if defined(_WIN32)
+		outFile.open(boost::filesystem::path(TestParameters::benchmarkOutput_.wc_str()));
+#else
+		outFile.open(boost::filesystem::path(TestParameters::benchmarkOutput_.mb_str()));
+#endif
+		if(!outFile)
+		{
+			std::cout << "Could not open " << TestParameters::benchmarkOutput_.ToStdString() << std::endl;
+			return false;
+		}
+	}
+	std::ostream &out = outFile.is_open() ? static_cast<std::ostream &>(outFile) : std::cout;
+
+	if(!TestParameters::replayTraceFile_.empty())
+	{
+#if defined(_WIN32)
+		boost::filesystem::path traceFile(TestParameters::replayTraceFile_.wc_str());
+#else
+		boost::filesystem::path traceFile(TestParameters::replayTraceFile_.mb_str());
+#endif
+		return TestTraceReplay::run(TestParameters::testPathBoost_, traceFile, !TestParameters::replayFast_, out);
+	}
+#if defined(_WIN32)
+	if(TestParameters::runOverlappedBenchmark_)
+		return TestFileWin32::overlappedBenchmark(TestParameters::testPathBoost_, TestParameters::overlappedOptions_, out);
+#endif
+	if(TestParameters::runStressTest_)
+		return TestStress::run(TestParameters::testPathBoost_, TestParameters::stressOptions_, out);
+	if(TestParameters::runMetadataBenchmark_)
+		return TestManyFiles::runBenchmark(TestParameters::testPathBoost_, TestParameters::metadataBenchmarkOptions_, out);
+	return TestBenchmark::run(TestParameters::testPathBoost_, TestParameters::benchmarkOptions_, out);
+}
+
 int EncFSMPTestApp::OnRun()
 {
+	if(TestParameters::runBenchmark_ || TestParameters::runMetadataBenchmark_ || TestParameters::runStressTest_
+		|| TestParameters::runOverlappedBenchmark_ || !TestParameters::replayTraceFile_.empty())
+		return runBenchmark() ? 0 : 1;
+
 	return RUN_ALL_TESTS();
 }
 
@@ -34,6 +34,11 @@
 #include "config.h"
 
 #include "EncFSUtilities.h"
+#include "ImportPipeline.h"
+#include "VolumeConverter.h"
+#include "VolumeScrubber.h"
+#include "VolumeStatistics.h"
+#include "UTFConvert.h"
 
 // libencfs
 #include "encfs.h"
@@ -46,15 +51,20 @@
 #include "DirNode.h"
 #include "FileNode.h"
 #include "Cipher.h"
+#include "CompressedFileIO.h"
 #include "StreamNameIO.h"
 #include "BlockNameIO.h"
 #include "NullNameIO.h"
 #include "Context.h"
+#include "Error.h"
+
+#include <algorithm>
+#include <atomic>
 
 // boost
-#include <boost/locale.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/thread.hpp>
 
 // Unfortunately, my version of libencfs is a tiny bit newer than 1.7.4 on Linux.
 // This define restores full compatibility
@@ -73,8 +83,9 @@ const int V6SubVersion = 20100713;	// Not optimal just to copy the data, but wha
 bool EncFSUtilities::createEncFS(const wxString &encFSPath, const wxString &password,
 	const wxString &externalConfigFileName, bool useExternalConfigFile,
 	const wxString &cipherAlgorithm, long cipherKeySize, long cipherBlockSize,
-	const wxString &nameEncoding, long keyDerivationDuration,
-	bool perBlockHMAC, bool uniqueIV, bool chainedIV, bool externalIV)
+	const wxString &nameEncoding, long keyDerivationDuration, int keyDerivationIterations,
+	bool perBlockHMAC, bool uniqueIV, bool chainedIV, bool externalIV,
+	bool holeMap, bool compression)
 {
 #if wxCHECK_VERSION(2, 9, 0)
 	std::string cipherAlgo = cipherAlgorithm.ToStdString();
@@ -126,10 +137,26 @@ bool EncFSUtilities::createEncFS(const wxString &encFSPath, const wxString &pass
 	config->chainedNameIV = chainedIV;
 	config->externalIVChaining = externalIV;
 	config->allowHoles = allowHoles;
+	bool sidecarNames = nameIOIface.name() != encfs::NullNameIO::CurrentInterface().name();
+	if(compression && sidecarNames && !encfs::CompressedFileIO::CurrentInterface().name().empty())
+	{
+		config->compressIface = encfs::CompressedFileIO::CurrentInterface();
+		config->compressBlockSize = 64 * 1024;
+	}
+	config->holeMap = holeMap && allowHoles && sidecarNames
+		&& config->compressIface.name().empty();
 
 	config->salt.clear();
 	config->kdfIterations = 0; // filled in by keying function
 	config->desiredKDFDuration = keyDerivationDuration;
+	if(keyDerivationIterations > 0)
+	{
+		// makeKey() only creates the salt for timed runs
+		config->salt.resize(20);
+		if(!cipher->randomize(config->getSaltData(), (int)config->salt.size(), true))
+			return false;
+		config->kdfIterations = keyDerivationIterations;
+	}
 
 	int encodedKeySize = cipher->encodedKeySize();
 	unsigned char *encodedKey = new unsigned char[ encodedKeySize ];
@@ -216,13 +243,18 @@ bool EncFSUtilities::getEncFSInfo(const wxString &encFSPath, const wxString &ext
 	info.chainedIV = config->chainedNameIV;
 	info.externalIV = config->externalIVChaining;
 	info.allowHoles = config->allowHoles;
+	info.holeMap = config->holeMap;
+	info.compression = wxString(config->compressIface.name().c_str(), *wxConvCurrent);
+	if(!info.compression.IsEmpty() && !encfs::CompressedFileIO::isSupported(config->compressIface))
+		info.compression.Append(wxT(" (NOT supported)"));
 
 	return true;
 }
 
 bool EncFSUtilities::changePassword(const wxString &encFSPath,
 	const wxString &externalConfigFileName, bool useExternalConfigFile,
-	const wxString &oldPassword, const wxString &newPassword, wxString &errorMsg)
+	const wxString &oldPassword, const wxString &newPassword, wxString &errorMsg,
+	const KDFCalibration::Speed &speed)
 {
 	std::string rootDir = wxStringToEncFSPath(encFSPath);
 	std::string externalConfigFileNameStr = wxStringToEncFSFile(externalConfigFileName);
@@ -244,11 +276,57 @@ bool EncFSUtilities::changePassword(const wxString &encFSPath,
 		return false;
     }
 
-	encfs::CipherKey userKey = config->getUserKey(std::string(oldPassword.mb_str()), "");
+	// New salt and iteration count, as makeKey() would choose them. Volumes
+	// without salt keep the old key derivation.
+	std::vector<unsigned char> newSalt;
+	if(!config->salt.empty() || cfgType >= encfs::Config_V6)
+	{
+		newSalt.resize(config->salt.empty() ? 20 : config->salt.size());
+		if(!cipher->randomize(&newSalt[0], (int)newSalt.size(), true))
+		{
+			errorMsg = wxT("Error creating salt.");
+			return false;
+		}
+	}
+	int newIterations = 0;	// Timed by newKey() unless known from the speed
+	if(speed.isValid())
+		newIterations = KDFCalibration::getParams(speed, config->desiredKDFDuration,
+			cipher->keySize() + cipher->cipherBlockSize()).pbkdf2Iterations;
+	long desiredDuration = config->desiredKDFDuration;
+
+	// The new key doesn't depend on the old one, so both are derived at the same time
+	std::string newPasswordStr(newPassword.mb_str());
+	encfs::CipherKey userKey;
+	boost::thread newKeyThread([&]()
+	{
+		try
+		{
+			if(newSalt.empty())
+				userKey = cipher->newKey(newPasswordStr.c_str(), (int)newPasswordStr.length());
+			else
+				userKey = cipher->newKey(newPasswordStr.c_str(), (int)newPasswordStr.length(),
+					newIterations, desiredDuration, &newSalt[0], (int)newSalt.size());
+		}
+		catch(encfs::Error &)
+		{
+			userKey.reset();
+		}
+	});
 
 	// decode volume key using user key -- at this point we detect an incorrect
 	// password if the key checksum does not match (causing readKey to fail).
-	encfs::CipherKey volumeKey = cipher->readKey( config->getKeyData(), userKey );
+	encfs::CipherKey volumeKey;
+	try
+	{
+		encfs::CipherKey oldUserKey = config->getUserKey(std::string(oldPassword.mb_str()), "");
+		volumeKey = cipher->readKey( config->getKeyData(), oldUserKey );
+	}
+	catch(encfs::Error &)
+	{
+		volumeKey.reset();
+	}
+	newKeyThread.join();
+	newPasswordStr.assign(newPasswordStr.length(), '\0');
 
 	if(!volumeKey)
 	{
@@ -256,11 +334,8 @@ bool EncFSUtilities::changePassword(const wxString &encFSPath,
 		return false;
 	}
 
-	userKey.reset();
-	// reinitialize salt and iteration count
-	config->kdfIterations = 0; // generate new
-
-	userKey = config->getUserKey(std::string(newPassword.mb_str()), "");
+	config->salt = newSalt;
+	config->kdfIterations = newIterations;
 
 	// re-encode the volume key using the new user key and write it out..
 	bool isOK = false;
@@ -297,114 +372,46 @@ bool EncFSUtilities::changePassword(const wxString &encFSPath,
 	return isOK;
 }
 
-static bool exportFile(const std::shared_ptr<encfs::EncFS_Root> &rootInfo, 
-	std::string encfsName, std::string targetName)
+void EncFSUtilities::changePasswords(std::vector<PasswordChange> &changes,
+	const KDFCalibration::Speed &speed)
 {
-	std::shared_ptr<encfs::FileNode> node = 
-		rootInfo->root->lookupNode( encfsName.c_str(), "EncFSMP" );
-	if(!node)
-		return false;
-
-	efs_stat st;
-	if(node->getAttr(&st, 0) != 0)
-		return false;
-
-	if(node->open(O_RDONLY) < 0)
-		return false;
-
-	int fd = fs_layer::creat(targetName.c_str(), st.st_mode);
+	// Every change derives two keys at the same time
+	size_t threadCount = std::max(1u, boost::thread::hardware_concurrency() / 2);
+	threadCount = std::min(threadCount, changes.size());
 
-	const int blockSize = 512;
-	int blocks = (node->getSize() + blockSize-1) / blockSize;
-	boost::scoped_array<unsigned char> buf(new unsigned char[blockSize]);
-
-	for(int i = 0; i < blocks; i++)
+	std::atomic<size_t> next(0);
+	boost::thread_group threads;
+	for(size_t i = 0; i < threadCount; i++)
 	{
-		int writeRet = 0;
-		ssize_t readBytes = node->read(i * blockSize, buf.get(), blockSize);
-		if(readBytes > 0)
-			writeRet = fs_layer::write(fd, buf.get(), static_cast<unsigned int>(readBytes));
-
-		if(writeRet < 0)
+		threads.create_thread([&]()
 		{
-			fs_layer::close(fd);
-			return false;
-		}
-	}
-	fs_layer::close(fd);
-
-	return true;
-}
-
-static bool exportDir(const std::shared_ptr<encfs::EncFS_Root> &rootInfo, 
-	std::string volumeDir, std::string destDir)
-{
-	// Create destination directory with the same permissions as original
-	{
-		efs_stat st;
-		std::shared_ptr<encfs::FileNode> dirNode = 
-			rootInfo->root->lookupNode( volumeDir.c_str(), "EncFSMP" );
-		if(dirNode->getAttr(&st, 0))
-			return false;
-
-		fs_layer::mkdir(destDir.c_str(), st.st_mode);
-	}
-
-	// Traverse directory
-	encfs::DirTraverse dt = rootInfo->root->openDir(volumeDir.c_str());
-	if(dt.valid())
-	{
-		std::string name = dt.nextPlaintextName();
-		while(!name.empty())
-		{
-			// Recurse to subdirectories
-			if(name != "." && name != "..")
+			for(size_t j = next++; j < changes.size(); j = next++)
 			{
-				std::string plainPath = volumeDir + name;
-				std::string cpath = rootInfo->root->cipherPath(plainPath.c_str());
-				std::string destName = destDir + name;
-
-				bool retVal = true;
-				efs_stat stBuf;
-				if( !fs_layer::lstat( cpath.c_str(), &stBuf ))
-				{
-					if( S_ISDIR( stBuf.st_mode ) )
-					{
-						// Recursive call
-						exportDir(rootInfo, (plainPath + '/'), 
-							destName + '/');
-					}
-					else if( S_ISREG( stBuf.st_mode ) )
-					{
-						retVal = exportFile(rootInfo, plainPath, destName);
-					}
-				}
-				else
-				{
-					retVal = false;
-				}
-
-				if(!retVal)
-					return retVal;
+				PasswordChange &change = changes[j];
+				change.isOK = changePassword(change.encFSPath, change.externalConfigFileName,
+					change.useExternalConfigFile, change.oldPassword, change.newPassword,
+					change.message, speed);
 			}
-
-			name = dt.nextPlaintextName();
-		}
+		});
 	}
-	return true;
+	threads.join_all();
 }
 
-bool EncFSUtilities::exportEncFS(const wxString &encFSPath,
+/**
+ * Opens the volume with libencfs directly, without mounting it. Returns NULL
+ * and sets errorMsg if it can't be opened.
+ */
+static encfs::RootPtr openVolume(const wxString &encFSPath,
 	const wxString &externalConfigFileName, bool useExternalConfigFile,
-	const wxString &password, const wxString &exportPath, wxString &errorMsg)
+	const wxString &password, bool checkKey, wxString &errorMsg)
 {
-	std::string rootDir = wxStringToEncFSPath(encFSPath);
+	std::string rootDir = EncFSUtilities::wxStringToEncFSPath(encFSPath);
 	std::ostringstream ostr;
 
 	std::shared_ptr<encfs::EncFS_Opts> opts( new encfs::EncFS_Opts() );
 	opts->rootDir = rootDir;
 	opts->createIfNotFound = false;
-	opts->checkKey = false;
+	opts->checkKey = checkKey;
 	opts->passwordProgram = std::string(password.mb_str());
 	opts->externalConfigFileName = EncFSUtilities::wxStringToEncFSFile(externalConfigFileName);
 	opts->useExternalConfigFile = useExternalConfigFile;
@@ -417,12 +424,158 @@ bool EncFSUtilities::exportEncFS(const wxString &encFSPath,
 
 		std::string errMsg1 = ostr.str();
 		errorMsg = wxString(errMsg1.c_str(), *wxConvCurrent);
-		return false;
 	}
+	return rootInfo;
+}
+
+bool EncFSUtilities::exportEncFS(const wxString &encFSPath,
+	const wxString &externalConfigFileName, bool useExternalConfigFile,
+	const wxString &password, const wxString &exportPath, wxString &errorMsg,
+	ExportPipeline::Progress *pProgress)
+{
+	encfs::RootPtr rootInfo = openVolume(encFSPath, externalConfigFileName,
+		useExternalConfigFile, password, false, errorMsg);
+	if(!rootInfo)
+		return false;
 
 	std::string destDir = wxStringToEncFSPath(exportPath);
 
-	return exportDir(rootInfo, "/", destDir);
+	ExportPipeline::Progress progress;
+	ExportPipeline pipeline(rootInfo, pProgress != NULL ? pProgress : &progress);
+	if(!pipeline.run(destDir))
+	{
+		if(pProgress != NULL && pProgress->cancel)
+			errorMsg = wxT("Export cancelled");
+		else
+			errorMsg = wxT("Error exporting files");
+		return false;
+	}
+	return true;
+}
+
+bool EncFSUtilities::importTree(const wxString &srcPath, const wxString &encFSPath,
+	const wxString &externalConfigFileName, bool useExternalConfigFile,
+	const wxString &password, wxString &errorMsg, CopyProgress *pProgress)
+{
+	// Files are written with this key, a wrong password must not get through
+	encfs::RootPtr rootInfo = openVolume(encFSPath, externalConfigFileName,
+		useExternalConfigFile, password, true, errorMsg);
+	if(!rootInfo)
+		return false;
+
+	std::string srcDir = wxStringToEncFSPath(srcPath);
+
+	CopyProgress progress;
+	ImportPipeline pipeline(rootInfo, pProgress != NULL ? pProgress : &progress);
+	if(!pipeline.run(srcDir))
+	{
+		if(pProgress != NULL && pProgress->cancel)
+			errorMsg = wxT("Import cancelled");
+		else
+			errorMsg = wxT("Error importing files");
+		return false;
+	}
+	return true;
+}
+
+bool EncFSUtilities::scrubEncFS(const wxString &encFSPath,
+	const wxString &externalConfigFileName, bool useExternalConfigFile,
+	const wxString &password, VolumeScrubber::Report &report, wxString &errorMsg,
+	CopyProgress *pProgress)
+{
+	// Without block MACs there is nothing to check against
+	encfs::ConfigProbe probe;
+	if(!encfs::probeConfig(wxStringToEncFSPath(encFSPath), useExternalConfigFile,
+		wxStringToEncFSFile(externalConfigFileName), &probe))
+	{
+		errorMsg = wxT("No encrypted filesystem found");
+		return false;
+	}
+	if(probe.config.blockMACBytes == 0)
+	{
+		errorMsg = wxT("The volume has no per-block MACs, its integrity can't be verified");
+		return false;
+	}
+
+	// A wrong key makes every block look damaged
+	encfs::RootPtr rootInfo = openVolume(encFSPath, externalConfigFileName,
+		useExternalConfigFile, password, true, errorMsg);
+	if(!rootInfo)
+		return false;
+
+	CopyProgress progress;
+	VolumeScrubber scrubber(rootInfo, pProgress != NULL ? pProgress : &progress);
+	if(!scrubber.run())
+	{
+		errorMsg = wxT("Verification cancelled");
+		return false;
+	}
+	report = scrubber.getReport();
+	return true;
+}
+
+bool EncFSUtilities::getEncFSStatistics(const wxString &encFSPath,
+	const wxString &externalConfigFileName, bool useExternalConfigFile,
+	const wxString &password, VolumeStatistics::Totals &totals, wxString &errorMsg,
+	CopyProgress *pProgress)
+{
+	// With a wrong key every name would count as invalid
+	encfs::RootPtr rootInfo = openVolume(encFSPath, externalConfigFileName,
+		useExternalConfigFile, password, true, errorMsg);
+	if(!rootInfo)
+		return false;
+
+	CopyProgress progress;
+	VolumeStatistics statistics(rootInfo, pProgress != NULL ? pProgress : &progress);
+	if(!statistics.run())
+	{
+		errorMsg = wxT("Counting cancelled");
+		return false;
+	}
+	totals = statistics.getTotals();
+	return true;
+}
+
+bool EncFSUtilities::convertEncFS(const wxString &srcPath,
+	const wxString &srcExternalConfigFileName, bool srcUseExternalConfigFile,
+	const wxString &srcPassword, const wxString &destPath,
+	const wxString &destExternalConfigFileName, bool destUseExternalConfigFile,
+	const wxString &destPassword, wxString &errorMsg, CopyProgress *pProgress)
+{
+	encfs::RootPtr srcRoot = openVolume(srcPath, srcExternalConfigFileName,
+		srcUseExternalConfigFile, srcPassword, false, errorMsg);
+	if(!srcRoot)
+		return false;
+	// Files are written with this key, a wrong password must not get through
+	encfs::RootPtr destRoot = openVolume(destPath, destExternalConfigFileName,
+		destUseExternalConfigFile, destPassword, true, errorMsg);
+	if(!destRoot)
+		return false;
+
+	std::string destDir = wxStringToEncFSPath(destPath);
+
+	CopyProgress progress;
+	VolumeConverter converter(srcRoot, destRoot, pProgress != NULL ? pProgress : &progress);
+	if(!converter.run(wxStringToEncFSPath(srcPath), VolumeConverter::checkpointFileName(destDir)))
+	{
+		if(pProgress != NULL && pProgress->cancel)
+			errorMsg = wxT("Conversion cancelled, it continues where it stopped when started again");
+		else
+			errorMsg = wxT("Error converting files");
+		return false;
+	}
+	return true;
+}
+
+bool EncFSUtilities::getConversionSource(const wxString &destPath, wxString &srcPath)
+{
+	std::string srcDir;
+	if(!VolumeConverter::readCheckpointSource(
+		VolumeConverter::checkpointFileName(wxStringToEncFSPath(destPath)), srcDir))
+		return false;
+
+	srcPath = wxString(srcDir.c_str(), wxConvUTF8);
+	return true;
 }
 
 std::string EncFSUtilities::wxStringToEncFSPath(const wxString &path)
@@ -444,7 +597,7 @@ std::string EncFSUtilities::wxStringToEncFSPath(const wxString &path)
 	if(separators.Find(lastChar) == wxNOT_FOUND)
 		pathUTF16.push_back((wchar_t)(wxFileName::GetPathSeparator(wxPATH_UNIX)));
 
-	std::string pathUTF8 = boost::locale::conv::utf_to_utf<char>(pathUTF16.c_str());
+	std::string pathUTF8 = UTFConvert::toUTF8(pathUTF16);
 
 	return pathUTF8;
 }
@@ -462,7 +615,7 @@ std::string EncFSUtilities::wxStringToEncFSFile(const wxString &path)
 	}
 #endif
 
-	std::string pathUTF8 = boost::locale::conv::utf_to_utf<char>(pathUTF16.c_str());
+	std::string pathUTF8 = UTFConvert::toUTF8(pathUTF16);
 
 	return pathUTF8;
 }
\ No newline at end of file
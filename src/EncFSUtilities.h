@@ -20,17 +20,32 @@
 #ifndef ENCFSUTILITIES_H
 #define ENCFSUTILITIES_H
 
+#include "ExportPipeline.h"
+#include "KDFCalibration.h"
+#include "VolumeScrubber.h"
+#include "VolumeStatistics.h"
+
 class EncFSUtilities
 {
 public:
 	EncFSUtilities();
 	virtual ~EncFSUtilities();
 
+	/**
+	 * keyDerivationIterations are the PBKDF2 iterations of the password, see
+	 * KDFCalibration. If 0, they are found by timed runs which take about
+	 * twice keyDerivationDuration milliseconds. holeMap keeps the holes of
+	 * each file in a map file next to it (see encfs::HoleMap), it is ignored
+	 * with the Null name encoding. compression compresses the file data if
+	 * this build has a codec (see encfs::CompressedFileIO), it is ignored with
+	 * the Null name encoding too, and replaces the hole maps.
+	 */
 	static bool createEncFS(const wxString &encFSPath, const wxString &password,
 		const wxString &externalConfigFileName, bool useExternalConfigFile,
 		const wxString &cipherAlgorithm, long cipherKeySize, long cipherBlockSize,
-		const wxString &nameEncoding, long keyDerivationDuration,
-		bool perBlockHMAC, bool uniqueIV, bool chainedIV, bool externalIV);
+		const wxString &nameEncoding, long keyDerivationDuration, int keyDerivationIterations,
+		bool perBlockHMAC, bool uniqueIV, bool chainedIV, bool externalIV,
+		bool holeMap = false, bool compression = false);
 
 	struct EncFSInfo
 	{
@@ -39,20 +54,95 @@ public:
 		long cipherKeySize, cipherBlockSize;
 		wxString nameEncoding;
 		long keyDerivationIterations, saltSize;
-		bool perBlockHMAC, uniqueIV, chainedIV, externalIV, allowHoles;
+		bool perBlockHMAC, uniqueIV, chainedIV, externalIV, allowHoles, holeMap;
+		wxString compression;	// Empty if the file data isn't compressed
 	};
 
 	static bool getEncFSInfo(const wxString &encFSPath, const wxString &externalConfigFileName,
 		bool useExternalConfigFile, EncFSInfo &info);
 
+	/**
+	 * The part of the information which needs the password and a walk over
+	 * the whole volume: file count, sizes and names which can't be decoded,
+	 * see VolumeStatistics. pProgress may be NULL.
+	 */
+	static bool getEncFSStatistics(const wxString &encFSPath,
+		const wxString &externalConfigFileName, bool useExternalConfigFile,
+		const wxString &password, VolumeStatistics::Totals &totals, wxString &errorMsg,
+		CopyProgress *pProgress = NULL);
+
+	/**
+	 * The old key and the new one are derived at the same time. The new
+	 * iteration count is computed from speed for the duration the volume was
+	 * created with, an invalid speed times it like before. Takes the key
+	 * derivation time, don't call it on the GUI thread.
+	 */
 	static bool changePassword(const wxString &encFSPath,
 		const wxString &externalConfigFileName, bool useExternalConfigFile,
 		const wxString &oldPassword, const wxString &newPassword,
-		wxString &errorMsg);
+		wxString &errorMsg, const KDFCalibration::Speed &speed = KDFCalibration::Speed());
+
+	struct PasswordChange
+	{
+		PasswordChange() : useExternalConfigFile(false), isOK(false) { }
+
+		wxString encFSPath, externalConfigFileName;
+		bool useExternalConfigFile;
+		wxString oldPassword, newPassword;
+		bool isOK;
+		wxString message;	// Of changePassword()
+	};
 
+	/**
+	 * Changes the passwords of several volumes in parallel, all with the
+	 * iteration counts of the same speed.
+	 */
+	static void changePasswords(std::vector<PasswordChange> &changes,
+		const KDFCalibration::Speed &speed);
+
+	/**
+	 * Writes the decrypted files to exportPath, see ExportPipeline. pProgress
+	 * shows the progress and cancels the export, it may be NULL.
+	 */
 	static bool exportEncFS(const wxString &encFSPath,
 		const wxString &externalConfigFileName, bool useExternalConfigFile,
-		const wxString &password, const wxString &exportPath, wxString &errorMsg);
+		const wxString &password, const wxString &exportPath, wxString &errorMsg,
+		ExportPipeline::Progress *pProgress = NULL);
+
+	/**
+	 * Copies the files below srcPath into the root folder of the volume,
+	 * writing the volume directly instead of through a mount (see
+	 * ImportPipeline). The volume must not be mounted meanwhile.
+	 */
+	static bool importTree(const wxString &srcPath, const wxString &encFSPath,
+		const wxString &externalConfigFileName, bool useExternalConfigFile,
+		const wxString &password, wxString &errorMsg, CopyProgress *pProgress = NULL);
+
+	/**
+	 * Checks the MACs of all blocks of a volume with per-block MACs, see
+	 * VolumeScrubber. Returns true if the check completed, damage is listed
+	 * in report.
+	 */
+	static bool scrubEncFS(const wxString &encFSPath,
+		const wxString &externalConfigFileName, bool useExternalConfigFile,
+		const wxString &password, VolumeScrubber::Report &report, wxString &errorMsg,
+		CopyProgress *pProgress = NULL);
+
+	/**
+	 * Copies all files of the source volume into the destination volume, which
+	 * usually has other settings, see VolumeConverter. Neither may be mounted
+	 * meanwhile. A cancelled conversion continues where it stopped.
+	 */
+	static bool convertEncFS(const wxString &srcPath,
+		const wxString &srcExternalConfigFileName, bool srcUseExternalConfigFile,
+		const wxString &srcPassword, const wxString &destPath,
+		const wxString &destExternalConfigFileName, bool destUseExternalConfigFile,
+		const wxString &destPassword, wxString &errorMsg, CopyProgress *pProgress = NULL);
+	/**
+	 * The source path of an unfinished conversion into destPath, in the form
+	 * of wxStringToEncFSPath().
+	 */
+	static bool getConversionSource(const wxString &destPath, wxString &srcPath);
 
 	static std::string wxStringToEncFSPath(const wxString &path);
 
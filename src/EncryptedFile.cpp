@@ -0,0 +1,123 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "EncryptedFile.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "fs_layer.h"
+
+// libencfs
+#include "Cipher.h"
+
+static const size_t headerSize = EncryptedFile::magicSize + 4 + 8;
+// The payload is encrypted in pieces of this size, each with its own IVs
+static const size_t pieceSize = 64 * 1024;
+// Cipher::streamEncode() takes the IV and the one following it, for its two
+// passes, the IVs of the next piece start after them
+static const uint64_t ivsPerPiece = 2;
+
+static bool encodePieces(std::string &data, size_t start, uint64_t iv,
+	const std::shared_ptr<encfs::Cipher> &cipher, const std::shared_ptr<encfs::AbstractCipherKey> &key,
+	bool encode)
+{
+	for(size_t pos = start; pos < data.size(); pos += pieceSize, iv += ivsPerPiece)
+	{
+		int len = static_cast<int>(std::min(pieceSize, data.size() - pos));
+		unsigned char *piece = reinterpret_cast<unsigned char *>(&data[pos]);
+		bool isOK = encode ? cipher->streamEncode(piece, len, iv, key)
+			: cipher->streamDecode(piece, len, iv, key);
+		if(!isOK)
+			return false;
+	}
+	return true;
+}
+
+bool EncryptedFile::load(const std::string &fileName, const char *magic, uint32_t version,
+	const std::shared_ptr<encfs::Cipher> &cipher, const std::shared_ptr<encfs::AbstractCipherKey> &key,
+	std::string &payload)
+{
+	std::string data = fs_layer::readFileToString(fileName.c_str());
+	if(data.size() < headerSize + 8 || memcmp(data.data(), magic, magicSize) != 0)
+		return false;
+
+	size_t pos = magicSize;
+	uint32_t storedVersion = 0;
+	uint64_t iv = 0;
+	getLE(data, pos, storedVersion);
+	getLE(data, pos, iv);
+	if(storedVersion != version)
+		return false;
+
+	if(!encodePieces(data, headerSize, iv, cipher, key, false))
+		return false;
+
+	// A wrong key or a damaged file give another MAC
+	uint64_t storedMac = 0;
+	getLE(data, pos, storedMac);
+	uint64_t mac = cipher->MAC_64(reinterpret_cast<const unsigned char *>(data.data() + pos),
+		static_cast<int>(data.size() - pos), key);
+	if(mac != storedMac)
+		return false;
+
+	payload.assign(data, pos, std::string::npos);
+	return true;
+}
+
+bool EncryptedFile::save(const std::string &fileName, const char *magic, uint32_t version,
+	const std::shared_ptr<encfs::Cipher> &cipher, const std::shared_ptr<encfs::AbstractCipherKey> &key,
+	const std::string &payload)
+{
+	std::string data(magic, magicSize);
+	putLE(data, version);
+	uint64_t iv = 0;
+	if(!cipher->randomize(reinterpret_cast<unsigned char *>(&iv), sizeof(iv), false))
+		return false;
+	putLE(data, iv);
+	putLE(data, cipher->MAC_64(reinterpret_cast<const unsigned char *>(payload.data()),
+		static_cast<int>(payload.size()), key));
+	data += payload;
+
+	if(!encodePieces(data, headerSize, iv, cipher, key, true))
+		return false;
+
+	std::string tempName = fileName + ".tmp";
+	if(!fs_layer::writeFileFromString(tempName.c_str(), data))
+		return false;
+	return fs_layer::rename(tempName.c_str(), fileName.c_str()) == 0;
+}
+
+void EncryptedFile::putString(std::string &buf, const std::string &s)
+{
+	putLE(buf, static_cast<uint32_t>(s.size()));
+	buf += s;
+}
+
+bool EncryptedFile::getString(const std::string &buf, size_t &pos, std::string &s)
+{
+	uint32_t length = 0;
+	if(!getLE(buf, pos, length) || buf.size() - pos < length)
+		return false;
+	s.assign(buf, pos, length);
+	pos += length;
+	return true;
+}
@@ -0,0 +1,90 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ENCRYPTEDFILE_H
+#define ENCRYPTEDFILE_H
+
+#include <memory>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace encfs
+{
+	class Cipher;
+	class AbstractCipherKey;
+}
+
+/**
+ * Files which EncFSMP stores encrypted with the volume key next to the
+ * configuration of a volume (NameIndex, CacheSnapshot).
+ *
+ * Such a file starts with an 8 byte magic, a 32 bit format version and a
+ * random 64 bit IV, all little endian. The rest is the encrypted payload,
+ * preceded by the MAC of the payload.
+ */
+class EncryptedFile
+{
+public:
+	static const size_t magicSize = 8;
+
+	/**
+	 * Reads fileName into payload. Returns false if there is no such file, if
+	 * it has another magic or version, or if it was written with another key
+	 * or is damaged.
+	 */
+	static bool load(const std::string &fileName, const char *magic, uint32_t version,
+		const std::shared_ptr<encfs::Cipher> &cipher, const std::shared_ptr<encfs::AbstractCipherKey> &key,
+		std::string &payload);
+
+	/**
+	 * Writes payload to fileName. The stored file is replaced only once the
+	 * new one is complete.
+	 */
+	static bool save(const std::string &fileName, const char *magic, uint32_t version,
+		const std::shared_ptr<encfs::Cipher> &cipher, const std::shared_ptr<encfs::AbstractCipherKey> &key,
+		const std::string &payload);
+
+	// Little endian values, and strings preceded by their 32 bit length
+	template<typename T> static void putLE(std::string &buf, T value)
+	{
+		for(size_t i = 0; i < sizeof(T); i++)
+			buf.push_back(static_cast<char>(static_cast<uint64_t>(value) >> (8 * i)));
+	}
+
+	template<typename T> static bool getLE(const std::string &buf, size_t &pos, T &value)
+	{
+		if(buf.size() - pos < sizeof(T))
+			return false;
+		uint64_t v = 0;
+		for(size_t i = 0; i < sizeof(T); i++)
+			v |= static_cast<uint64_t>(static_cast<unsigned char>(buf[pos + i])) << (8 * i);
+		pos += sizeof(T);
+		value = static_cast<T>(v);
+		return true;
+	}
+
+	static void putString(std::string &buf, const std::string &s);
+	static bool getString(const std::string &buf, size_t &pos, std::string &s);
+
+private:
+	EncryptedFile();
+};
+
+#endif
@@ -0,0 +1,292 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "ExportPipeline.h"
+
+#include <algorithm>
+
+#include <fcntl.h>
+
+#include "fs_layer.h"
+
+// libencfs
+#include "Error.h"
+#include "FileUtils.h"
+#include "DirNode.h"
+#include "FileNode.h"
+
+// Decrypted data not yet written
+static const size_t maxQueuedWriteBytes = 64 * 1024 * 1024;
+// The destination is mostly one disk, more writers don't help
+static const int writeThreads = 2;
+
+ExportPipeline::OutputFile::~OutputFile()
+{
+	fs_layer::close(fd_);
+	pProgress_->filesDone++;
+}
+
+ExportPipeline::ExportPipeline(const std::shared_ptr<encfs::EncFS_Root> &rootInfo, Progress *pProgress,
+	int decryptThreads) :
+	rootInfo_(rootInfo),
+	pProgress_(pProgress),
+	decryptThreads_(CopyPipeline::threadCount(decryptThreads)),
+	queuedWriteBytes_(0),
+	decryptActive_(0),
+	failed_(false)
+{
+}
+
+ExportPipeline::~ExportPipeline()
+{
+}
+
+bool ExportPipeline::isStopping() const
+{
+	return failed_ || pProgress_->cancel;
+}
+
+void ExportPipeline::fail()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	stopLocked();
+}
+
+/**
+ * Wakes all threads, which exit as soon as they see isStopping(). Called by
+ * the first thread to notice a failure or the cancellation.
+ */
+void ExportPipeline::stopLocked()
+{
+	failed_ = true;
+	files_.stop();
+	writes_.clear();
+	queuedWriteBytes_ = 0;
+	writeCond_.notify_all();
+	writeSpaceCond_.notify_all();
+}
+
+bool ExportPipeline::run(const std::string &destDir)
+{
+	decryptActive_ = decryptThreads_;
+	boost::thread_group threads;
+	for(int i = 0; i < decryptThreads_; i++)
+		threads.create_thread([this]() { decryptLoop(); });
+	for(int i = 0; i < writeThreads; i++)
+		threads.create_thread([this]() { writeLoop(); });
+
+	bool isOK = walkDir("/", destDir);
+	if(!isOK)
+		fail();
+	files_.close();
+	pProgress_->walkDone = true;
+
+	threads.join_all();
+	return isOK && !isStopping();
+}
+
+bool ExportPipeline::walkDir(const std::string &volumeDir, const std::string &destDir)
+{
+	// Create destination directory with the same permissions as original
+	{
+		efs_stat st;
+		std::shared_ptr<encfs::FileNode> dirNode =
+			rootInfo_->root->lookupNode( volumeDir.c_str(), "EncFSMP" );
+		if(!dirNode || dirNode->getAttr(&st, 0))
+			return false;
+
+		fs_layer::mkdir(destDir.c_str(), st.st_mode);
+	}
+
+	// Traverse directory
+	encfs::DirTraverse dt = rootInfo_->root->openDir(volumeDir.c_str());
+	if(!dt.valid())
+		return true;
+
+	std::string name = dt.nextPlaintextName();
+	while(!name.empty())
+	{
+		if(isStopping())
+			return false;
+
+		if(name != "." && name != "..")
+		{
+			std::string plainPath = volumeDir + name;
+			std::string cpath = rootInfo_->root->cipherPath(plainPath.c_str());
+			std::string destName = destDir + name;
+
+			efs_stat stBuf;
+			if(fs_layer::lstat( cpath.c_str(), &stBuf ))
+				return false;
+
+			if( S_ISDIR( stBuf.st_mode ) )
+			{
+				// Subfolders which can't be read are skipped, as before
+				if(!walkDir(plainPath + '/', destName + '/') && isStopping())
+					return false;
+			}
+			else if( S_ISREG( stBuf.st_mode ) )
+			{
+				FileJob job;
+				job.node = rootInfo_->root->lookupNode( plainPath.c_str(), "EncFSMP" );
+				if(!job.node)
+					return false;
+				job.destName = destName;
+				job.mode = static_cast<unsigned short>(stBuf.st_mode);
+				job.size = job.node->getSize();
+				if(job.size < 0 || !queueFile(job))
+					return false;
+			}
+		}
+
+		name = dt.nextPlaintextName();
+	}
+	return true;
+}
+
+bool ExportPipeline::queueFile(const FileJob &job)
+{
+	pProgress_->filesFound++;
+	pProgress_->bytesFound += job.size;
+	if(isStopping() || !files_.push(job))
+	{
+		fail();
+		return false;
+	}
+	return true;
+}
+
+bool ExportPipeline::queueWrite(const std::shared_ptr<WriteJob> &job)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	// A piece is always accepted into an empty queue, whatever its size
+	while(queuedWriteBytes_ > 0 && queuedWriteBytes_ + job->data.size() > maxQueuedWriteBytes
+		&& !isStopping())
+		writeSpaceCond_.wait(lock);
+	if(isStopping())
+	{
+		stopLocked();
+		return false;
+	}
+
+	writes_.push_back(job);
+	queuedWriteBytes_ += job->data.size();
+	writeCond_.notify_one();
+	return true;
+}
+
+bool ExportPipeline::decryptFile(const FileJob &job)
+{
+	if(job.node->open(O_RDONLY) < 0)
+		return false;
+
+	int fd = fs_layer::creat(job.destName.c_str(), job.mode);
+	if(fd < 0)
+		return false;
+	std::shared_ptr<OutputFile> file(new OutputFile(fd, pProgress_));
+	// Allocate the whole file up front, the pieces are written in any order
+	if(job.size > 0)
+		fs_layer::ftruncate(fd, job.size);
+
+	size_t pieceSize = CopyPipeline::pieceSize(job.node->dataBlockSize());
+	int64_t offset = 0;
+	while(offset < job.size)
+	{
+		if(isStopping())
+			return false;
+
+		std::shared_ptr<WriteJob> piece(new WriteJob);
+		piece->file = file;
+		piece->offset = offset;
+		piece->data.resize(static_cast<size_t>(std::min<int64_t>(pieceSize, job.size - offset)));
+		ssize_t readBytes = job.node->read(offset, &piece->data[0], piece->data.size());
+		if(readBytes < 0)
+			return false;
+		if(readBytes == 0)
+			break;
+		piece->data.resize(static_cast<size_t>(readBytes));
+		offset += readBytes;
+
+		if(!queueWrite(piece))
+			return false;
+	}
+	return true;
+}
+
+void ExportPipeline::decryptLoop()
+{
+	FileJob job;
+	while(files_.pop(job))
+	{
+		if(isStopping())
+		{
+			fail();
+			break;
+		}
+
+		bool isOK = false;
+		try
+		{
+			isOK = decryptFile(job);
+		}
+		catch(encfs::Error &)
+		{
+			isOK = false;
+		}
+		if(!isOK)
+			fail();
+	}
+
+	// The writers stop once all decrypting threads are done and the queue is empty
+	boost::mutex::scoped_lock lock(mutex_);
+	decryptActive_--;
+	writeCond_.notify_all();
+}
+
+void ExportPipeline::writeLoop()
+{
+	for(;;)
+	{
+		std::shared_ptr<WriteJob> job;
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			while(writes_.empty() && decryptActive_ > 0 && !isStopping())
+				writeCond_.wait(lock);
+			if(isStopping())
+				stopLocked();
+			if(writes_.empty() || isStopping())
+				break;
+			job = writes_.front();
+			writes_.pop_front();
+			queuedWriteBytes_ -= job->data.size();
+			writeSpaceCond_.notify_all();
+		}
+
+		int64_t written = fs_layer::pwrite(job->file->fd(), &job->data[0],
+			static_cast<int64_t>(job->data.size()), job->offset);
+		if(written != static_cast<int64_t>(job->data.size()))
+		{
+			fail();
+			break;
+		}
+		pProgress_->bytesDone += written;
+	}
+}
@@ -0,0 +1,126 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef EXPORTPIPELINE_H
+#define EXPORTPIPELINE_H
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/thread.hpp>
+
+#include "CopyPipeline.h"
+#include "CopyProgress.h"
+
+namespace encfs
+{
+	struct EncFS_Root;
+	class FileNode;
+}
+
+/**
+ * Copies the decrypted contents of a volume to a folder.
+ *
+ * The calling thread walks the folders and creates them in the destination.
+ * The files it finds are queued for the decrypting threads, which read them
+ * in large pieces of many blocks. The pieces are queued again for the writing
+ * threads, so that reading the volume and writing the destination overlap.
+ * Both queues are bounded, the walk waits if the decrypting falls behind.
+ */
+class ExportPipeline
+{
+public:
+	typedef CopyProgress Progress;
+
+	/**
+	 * decryptThreads 0: one per core.
+	 */
+	ExportPipeline(const std::shared_ptr<encfs::EncFS_Root> &rootInfo, Progress *pProgress,
+		int decryptThreads = 0);
+	virtual ~ExportPipeline();
+
+	/**
+	 * Exports the volume to destDir, which ends with a separator. Returns false
+	 * if a file could not be exported or the export was cancelled.
+	 */
+	bool run(const std::string &destDir);
+
+private:
+	struct FileJob
+	{
+		std::shared_ptr<encfs::FileNode> node;
+		std::string destName;
+		unsigned short mode;
+		int64_t size;
+	};
+
+	/**
+	 * The destination file, closed when its last piece has been written.
+	 */
+	class OutputFile
+	{
+	public:
+		OutputFile(int fd, Progress *pProgress) : fd_(fd), pProgress_(pProgress) { }
+		~OutputFile();
+
+		int fd() const { return fd_; }
+
+	private:
+		int fd_;
+		Progress *pProgress_;
+	};
+
+	struct WriteJob
+	{
+		std::shared_ptr<OutputFile> file;
+		int64_t offset;
+		std::vector<unsigned char> data;
+	};
+
+	bool walkDir(const std::string &volumeDir, const std::string &destDir);
+	bool queueFile(const FileJob &job);
+	bool decryptFile(const FileJob &job);
+	bool queueWrite(const std::shared_ptr<WriteJob> &job);
+	void decryptLoop();
+	void writeLoop();
+	void fail();
+	void stopLocked();
+	bool isStopping() const;
+
+	ExportPipeline(const ExportPipeline &);
+	ExportPipeline &operator=(const ExportPipeline &);
+
+	std::shared_ptr<encfs::EncFS_Root> rootInfo_;
+	Progress *pProgress_;
+	int decryptThreads_;
+
+	CopyPipeline::FileQueue<FileJob> files_;
+
+	boost::mutex mutex_;		// Protects the queued writes
+	boost::condition_variable writeCond_, writeSpaceCond_;
+	std::deque<std::shared_ptr<WriteJob> > writes_;
+	size_t queuedWriteBytes_;
+	int decryptActive_;			// Decrypting threads which may still queue writes
+	std::atomic<bool> failed_;
+};
+
+#endif
@@ -0,0 +1,238 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "FileIDIndex.h"
+
+FileIDIndex::FileIDIndex()
+	: capacity_(0), dropped_(0)
+{
+}
+
+FileIDIndex::~FileIDIndex()
+{
+}
+
+void FileIDIndex::setCapacity(size_t capacity)
+{
+	capacity_ = capacity;
+	trim();
+}
+
+/**
+ * Returns the node of path ("/" or "/a/b"), or NULL if it has none and create
+ * is false.
+ */
+FileIDIndex::Node *FileIDIndex::findNode(const std::string &path, bool create)
+{
+	Node *node = &root_;
+	size_t pos = 0;
+	while(node != NULL && pos < path.size())
+	{
+		size_t end = path.find('/', pos);
+		if(end == std::string::npos)
+			end = path.size();
+		if(end > pos)
+		{
+			std::string name = path.substr(pos, end - pos);
+			std::unordered_map<std::string, std::unique_ptr<Node> >::iterator iter = node->children.find(name);
+			if(iter != node->children.end())
+				node = iter->second.get();
+			else if(!create)
+				node = NULL;
+			else
+			{
+				std::unique_ptr<Node> child(new Node);
+				child->parent = node;
+				child->name = name;
+				Node *newNode = child.get();
+				node->children[name] = std::move(child);
+				node = newNode;
+			}
+		}
+		pos = end + 1;
+	}
+	return node;
+}
+
+std::string FileIDIndex::pathOf(const Node *node) const
+{
+	if(node->parent == NULL)
+		return std::string("/");
+
+	std::string path;
+	for(; node->parent != NULL; node = node->parent)
+		path.insert(0, "/" + node->name);
+	return path;
+}
+
+int64_t FileIDIndex::find(const encfs::InternedPath &path)
+{
+	Node *node = findNode(path.str(), false);
+	if(node == NULL || node->fileId < 0)
+		return -1;
+	lru_.splice(lru_.begin(), lru_, node->lruPos);
+	return node->fileId;
+}
+
+void FileIDIndex::add(const encfs::InternedPath &path, int64_t fileId)
+{
+	Node *node = findNode(path.str(), true);
+	if(node->fileId == fileId)
+		return;
+	// The ID can only be at one path
+	IdMap::iterator iter = ids_.find(fileId);
+	if(iter != ids_.end())
+	{
+		Node *oldNode = iter->second;
+		clearId(oldNode);
+		prune(oldNode);
+	}
+	clearId(node);
+
+	node->fileId = fileId;
+	lru_.push_front(fileId);
+	node->lruPos = lru_.begin();
+	ids_[fileId] = node;
+	trim();
+}
+
+bool FileIDIndex::rename(int64_t fileId, const encfs::InternedPath &newPath)
+{
+	IdMap::iterator iter = ids_.find(fileId);
+	if(iter == ids_.end())
+		return false;
+
+	Node *node = iter->second;
+	const std::string &path = newPath.str();
+	size_t pos = path.rfind('/');
+	if(node->parent == NULL || pos == std::string::npos || pos + 1 >= path.size())
+		return pathOf(node) == path;		// The root stays where it is
+
+	Node *newParent = findNode(path.substr(0, pos), true);
+	std::string newName = path.substr(pos + 1);
+	if(newParent == node->parent && newName == node->name)
+		return true;
+
+	// The entry moved over is gone, with everything below it
+	std::unordered_map<std::string, std::unique_ptr<Node> >::iterator target = newParent->children.find(newName);
+	if(target != newParent->children.end())
+	{
+		dropTree(target->second.get());
+		newParent->children.erase(target);
+	}
+
+	Node *oldParent = node->parent;
+	std::unique_ptr<Node> moved = std::move(oldParent->children[node->name]);
+	oldParent->children.erase(node->name);
+	node->parent = newParent;
+	node->name = newName;
+	newParent->children[newName] = std::move(moved);
+	prune(oldParent);
+	lru_.splice(lru_.begin(), lru_, node->lruPos);
+	return true;
+}
+
+bool FileIDIndex::remove(int64_t fileId)
+{
+	IdMap::iterator iter = ids_.find(fileId);
+	if(iter == ids_.end())
+		return false;
+
+	Node *node = iter->second;
+	clearId(node);
+	prune(node);
+	return true;
+}
+
+void FileIDIndex::removeBelow(const encfs::InternedPath &path)
+{
+	Node *node = findNode(path, false);
+	if(node == NULL)
+		return;
+
+	for(std::unordered_map<std::string, std::unique_ptr<Node> >::iterator iter = node->children.begin();
+		iter != node->children.end(); ++iter)
+		dropTree(iter->second.get());
+	node->children.clear();
+	prune(node);
+}
+
+/**
+ * The node keeps the entries below it.
+ */
+void FileIDIndex::clearId(Node *node)
+{
+	if(node->fileId < 0)
+		return;
+	lru_.erase(node->lruPos);
+	ids_.erase(node->fileId);
+	node->fileId = -1;
+}
+
+/**
+ * Drops the IDs of node and of all entries below it, before the node is deleted.
+ */
+void FileIDIndex::dropTree(Node *node)
+{
+	clearId(node);
+	for(std::unordered_map<std::string, std::unique_ptr<Node> >::iterator iter = node->children.begin();
+		iter != node->children.end(); ++iter)
+		dropTree(iter->second.get());
+}
+
+/**
+ * Deletes node and the folders above it as long as they have neither an ID
+ * nor other entries.
+ */
+void FileIDIndex::prune(Node *node)
+{
+	while(node->parent != NULL && node->fileId < 0 && node->children.empty())
+	{
+		Node *parent = node->parent;
+		std::string name = node->name;
+		parent->children.erase(name);
+		node = parent;
+	}
+}
+
+/**
+ * Drops the least recently used IDs beyond the capacity. Pinned ones count as
+ * used now, each entry is looked at once at most.
+ */
+void FileIDIndex::trim()
+{
+	if(capacity_ == 0)
+		return;
+
+	size_t tries = lru_.size();
+	while(lru_.size() > capacity_ && tries-- > 0)
+	{
+		int64_t fileId = lru_.back();
+		Node *node = ids_[fileId];
+		if(isPinned_ && isPinned_(encfs::InternedPath(pathOf(node))))
+		{
+			lru_.splice(lru_.begin(), lru_, node->lruPos);
+			continue;
+		}
+		// Its children keep their IDs, they don't depend on the one of the folder
+		clearId(node);
+		prune(node);
+		dropped_++;
+	}
+}
@@ -0,0 +1,118 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FILEIDINDEX_H
+#define FILEIDINDEX_H
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "InternedPath.h"
+
+/**
+ * The file IDs handed out to PFM, by path and by ID.
+ *
+ * The paths are kept as a tree of nodes, one per path component, each
+ * pointing to its folder. Looking a path up walks its components, the path
+ * of an ID is found by walking up to the root. A folder rename moves one
+ * node to its new folder, the entries below it move along without being
+ * visited. Not thread safe, PFMLayer holds its mutex.
+ *
+ * The table is bounded: beyond its capacity, the least recently used IDs are
+ * dropped, except those of pinned paths (the open files). A path whose ID
+ * was dropped gets a new one when it is listed again.
+ */
+class FileIDIndex
+{
+public:
+	typedef std::function<bool (const encfs::InternedPath &path)> PinnedFunction;
+
+	FileIDIndex();
+	virtual ~FileIDIndex();
+
+	/**
+	 * capacity 0: the IDs are never dropped.
+	 */
+	void setCapacity(size_t capacity);
+	void setPinnedFunction(const PinnedFunction &isPinned) { isPinned_ = isPinned; }
+
+	/**
+	 * Returns the ID of path, or -1 if it has none.
+	 */
+	int64_t find(const encfs::InternedPath &path);
+
+	/**
+	 * Gives path the ID fileId. An ID path had before is dropped.
+	 */
+	void add(const encfs::InternedPath &path, int64_t fileId);
+
+	/**
+	 * Moves fileId to newPath, and the IDs below it if it is a folder.
+	 * Returns false if fileId is unknown.
+	 */
+	bool rename(int64_t fileId, const encfs::InternedPath &newPath);
+
+	/**
+	 * Returns false if fileId is unknown.
+	 */
+	bool remove(int64_t fileId);
+
+	/**
+	 * Drops the IDs of all entries below folder path, path keeps its own.
+	 */
+	void removeBelow(const encfs::InternedPath &path);
+
+	size_t size() const { return ids_.size(); }
+	uint64_t getDropped() const { return dropped_; }
+
+private:
+	typedef std::list<int64_t> LruList;		// Most recently used first
+
+	struct Node
+	{
+		Node() : parent(NULL), fileId(-1) { }
+
+		Node *parent;
+		std::string name;		// Of the entry in the folder of parent
+		int64_t fileId;			// -1 if the path has no ID, only entries below it
+		LruList::iterator lruPos;
+		std::unordered_map<std::string, std::unique_ptr<Node> > children;
+	};
+
+	Node *findNode(const std::string &path, bool create);
+	std::string pathOf(const Node *node) const;
+	void clearId(Node *node);
+	void dropTree(Node *node);
+	void prune(Node *node);
+	void trim();
+
+	Node root_;				// "/"
+	typedef std::unordered_map<int64_t, Node *> IdMap;
+	IdMap ids_;				// ID -> node
+	LruList lru_;
+	size_t capacity_;
+	PinnedFunction isPinned_;
+	uint64_t dropped_;
+};
+
+#endif
@@ -19,10 +19,11 @@
 
 #include "FileStatCache.h"
 
-#include <ctime>
-
-FileStatCache::FileStatCache() : cacheSize_(10)
+FileStatCache::FileStatCache() : cacheSize_(0), shardCacheSize_(0),
+	negativeCacheSize_(0), shardNegativeCacheSize_(0), timeToLive_(0), negativeTimeToLive_(0),
+	hits_(0), misses_(0)
 {
+	setCacheSize(10);
 }
 
 FileStatCache::~FileStatCache()
@@ -31,77 +32,244 @@ FileStatCache::~FileStatCache()
 
 void FileStatCache::clearCache()
 {
-	cache_.clear();
+	for(size_t i = 0; i < shardCount; i++)
+	{
+		Shard &shard = shards_[i];
+		boost::mutex::scoped_lock lock(shard.mutex_);
+		shard.cache_.clear();
+		shard.lru_.clear();
+		shard.negativeLru_.clear();
+		shard.generation_++;
+	}
 }
 
 void FileStatCache::setCacheSize(int cacheSize)
 {
 	cacheSize_ = cacheSize;
+	shardCacheSize_ = (cacheSize > 0) ? static_cast<int>((cacheSize + shardCount - 1) / shardCount) : 0;
+	for(size_t i = 0; i < shardCount; i++)
+	{
+		Shard &shard = shards_[i];
+		boost::mutex::scoped_lock lock(shard.mutex_);
+		trimShard(shard);
+		if(shardCacheSize_ > 0)
+			shard.cache_.reserve(shardCacheSize_ + shardNegativeCacheSize_);
+	}
 }
 
-int FileStatCache::stat(const char *path, efs_stat *buffer)
+void FileStatCache::setNegativeCacheSize(int cacheSize)
 {
-	int ret = 0;
-	FileStatCacheType::iterator iter = cache_.find( std::string(path) );
-	if(iter != cache_.end())
+	negativeCacheSize_ = cacheSize;
+	shardNegativeCacheSize_ = (cacheSize > 0) ? static_cast<int>((cacheSize + shardCount - 1) / shardCount) : 0;
+	for(size_t i = 0; i < shardCount; i++)
 	{
-		*buffer = iter->second.stat_;
-		ret = iter->second.retVal_;
+		Shard &shard = shards_[i];
+		boost::mutex::scoped_lock lock(shard.mutex_);
+		trimShard(shard);
 	}
-	else
+}
+
+int FileStatCache::stat(const char *path, efs_stat *buffer, int64_t *plainSize)
+{
+	encfs::InternedPath key(path);
+	Shard &shard = shardOf(key);
+	uint64_t generation = 0;
 	{
-		ret = fs_layer::stat(path, buffer);
-		addStatToCache(path, ret, buffer);
+		boost::mutex::scoped_lock lock(shard.mutex_);
+		FileStatCacheType::iterator iter = shard.cache_.find( key );
+		if(iter != shard.cache_.end())
+		{
+			CacheEntry &entry = iter->second;
+			bool isNegative = (entry.retVal_ < 0);
+			std::chrono::milliseconds timeToLive(isNegative ? negativeTimeToLive_.load() : timeToLive_.load());
+			if(timeToLive.count() > 0 && std::chrono::steady_clock::now() >= entry.expiry_)
+			{
+				// Expired, the entry is updated below
+				iter = shard.cache_.end();
+			}
+		}
+
+		if(iter != shard.cache_.end())
+		{
+			CacheEntry &entry = iter->second;
+			LRUList &lru = (entry.retVal_ < 0) ? shard.negativeLru_ : shard.lru_;
+			lru.splice(lru.begin(), lru, entry.lruPos_);
+			hits_.fetch_add(1, std::memory_order_relaxed);
+			if(entry.retVal_ < 0)
+			{
+				errno = entry.errno_;
+				return entry.retVal_;
+			}
+			*buffer = entry.stat_;
+			if(plainSize != NULL)
+				*plainSize = entry.plainSize_;
+			return entry.retVal_;
+		}
+		generation = shard.generation_;
 	}
+
+	misses_.fetch_add(1, std::memory_order_relaxed);
+	int ret = fs_layer::stat(path, buffer);
+	int errNo = (ret < 0) ? errno : 0;
+	int64_t size = (ret >= 0) ? plainSizeOf(*buffer) : -1;
+
+	{
+		boost::mutex::scoped_lock lock(shard.mutex_);
+		// Don't add the result if an entry of the shard was forgotten meanwhile,
+		// it might have been made before the file was changed
+		if(shard.generation_ == generation && (ret >= 0 || isNegativeResult(ret, errNo)))
+			addToShard(shard, key, ret, errNo, buffer, size);
+	}
+	if(ret < 0)
+		errno = errNo;
+	else if(plainSize != NULL)
+		*plainSize = size;
 	return ret;
 }
 
 void FileStatCache::forgetCachedStat(const char *path)
 {
-	FileStatCacheType::iterator iter = cache_.find( std::string(path) );
-	if(iter != cache_.end())
+	encfs::InternedPath key(path);
+	Shard &shard = shardOf(key);
+	boost::mutex::scoped_lock lock(shard.mutex_);
+	shard.generation_++;
+	FileStatCacheType::iterator iter = shard.cache_.find( key );
+	if(iter != shard.cache_.end())
 	{
-		cache_.erase(iter);
+		LRUList &lru = (iter->second.retVal_ < 0) ? shard.negativeLru_ : shard.lru_;
+		lru.erase(iter->second.lruPos_);
+		shard.cache_.erase(iter);
 	}
 }
 
-void FileStatCache::addStatToCache(const char *path, int retVal, efs_stat *buffer)
+void FileStatCache::forgetTree(const std::string &dirPath)
 {
-	std::string pathS(path);
-	FileStatCacheType::iterator iter = cache_.find( pathS );
-	if(iter != cache_.end())
+	for(size_t i = 0; i < shardCount; i++)
 	{
-		// Update existing entry
+		Shard &shard = shards_[i];
+		boost::mutex::scoped_lock lock(shard.mutex_);
+		shard.generation_++;
+		FileStatCacheType::iterator iter = shard.cache_.begin();
+		while(iter != shard.cache_.end())
+		{
+			const std::string &path = iter->first;
+			if(path.size() > dirPath.size() &&
+				path.compare(0, dirPath.size(), dirPath) == 0 &&
+				(path[dirPath.size()] == '/' || path[dirPath.size()] == '\\'))
+			{
+				LRUList &lru = (iter->second.retVal_ < 0) ? shard.negativeLru_ : shard.lru_;
+				lru.erase(iter->second.lruPos_);
+				iter = shard.cache_.erase(iter);
+			}
+			else
+			{
+				iter++;
+			}
+		}
+	}
+}
+
+void FileStatCache::addStat(const char *path, efs_stat *buffer, int64_t *plainSize)
+{
+	int64_t size = plainSizeOf(*buffer);
+	addStatToCache(encfs::InternedPath(path), 0, buffer, size);
+	if(plainSize != NULL)
+		*plainSize = size;
+}
+
+void FileStatCache::addStatToCache(const encfs::InternedPath &path, int retVal, efs_stat *buffer, int64_t plainSize)
+{
+	Shard &shard = shardOf(path);
+	boost::mutex::scoped_lock lock(shard.mutex_);
+	addToShard(shard, path, retVal, (retVal < 0) ? ENOENT : 0, buffer, plainSize);
+}
+
+int64_t FileStatCache::plainSizeOf(const efs_stat &buffer) const
+{
+	if(!plaintextSize_)
+		return -1;
+	if(!S_ISREG(buffer.st_mode))
+		return buffer.st_size;
+	return plaintextSize_(buffer);
+}
+
+/**
+ * Must be called with the lock of the shard held.
+ */
+void FileStatCache::addToShard(Shard &shard, const encfs::InternedPath &path, int retVal, int errNo,
+	efs_stat *buffer, int64_t plainSize)
+{
+	bool isNegative = (retVal < 0);
+	std::chrono::milliseconds timeToLive(isNegative ? negativeTimeToLive_.load() : timeToLive_.load());
+	TimePoint expiry;
+	if(timeToLive.count() > 0)
+		expiry = std::chrono::steady_clock::now() + timeToLive;
+
+	LRUList &lru = isNegative ? shard.negativeLru_ : shard.lru_;
+	int maxSize = isNegative ? shardNegativeCacheSize_ : shardCacheSize_;
+
+	FileStatCacheType::iterator iter = shard.cache_.find( path );
+	if(iter != shard.cache_.end())
+	{
+		// Update existing entry, move it to the other list if it changed from
+		// existing to missing or vice versa
 		CacheEntry &entry = iter->second;
-		entry.stat_ = *buffer;
+		LRUList &oldLru = (entry.retVal_ < 0) ? shard.negativeLru_ : shard.lru_;
+		lru.splice(lru.begin(), oldLru, entry.lruPos_);
+		if(isNegative)
+		{
+			entry.errno_ = errNo;
+		}
+		else
+		{
+			entry.stat_ = *buffer;
+			entry.plainSize_ = plainSize;
+		}
 		entry.retVal_ = retVal;
+		entry.expiry_ = expiry;
+		if(&lru != &oldLru)
+			trimList(shard, lru, maxSize);
 	}
-	else if(cacheSize_ > 0)
+	else if(maxSize > 0)
 	{
-		// Add new entry
-		if(static_cast<int>(cache_.size()) >= cacheSize_)
+		// Add new entry, evict the least recently used one if the list is full
+		if(static_cast<int>(lru.size()) >= maxSize)
 		{
-			// Find least recently used, evict from cache
-			FileStatCacheType::iterator iterEvict = cache_.begin();
-			FileStatCacheType::iterator iterCheck = cache_.begin();
-			iterCheck++;	// This is safe as cacheSize_ > 0, and cache_.size() >= cacheSize_
-			while(iterCheck != cache_.end())
-			{
-				if(iterCheck->second.time_ < iterEvict->second.time_)
-					iterEvict = iterCheck;
+			shard.cache_.erase(lru.back());
+			lru.pop_back();
+		}
 
-				iterCheck++;
-			}
-			cache_.erase(iterEvict);
+		lru.push_front(path);
+		CacheEntry &entry = shard.cache_[ path ];
+		if(isNegative)
+		{
+			entry.errno_ = errNo;
 		}
+		else
+		{
+			entry.stat_ = *buffer;
+			entry.plainSize_ = plainSize;
+		}
+		entry.retVal_ = retVal;
+		entry.lruPos_ = lru.begin();
+		entry.expiry_ = expiry;
+	}
+}
 
-		std::time_t currentTime;
-		time(&currentTime);
+/**
+ * Must be called with the lock of the shard held.
+ */
+void FileStatCache::trimShard(Shard &shard)
+{
+	trimList(shard, shard.lru_, shardCacheSize_);
+	trimList(shard, shard.negativeLru_, shardNegativeCacheSize_);
+}
 
-		CacheEntry entry;
-		entry.time_ = static_cast<int64_t>(currentTime);
-		entry.stat_ = *buffer;
-		entry.retVal_ = retVal;
-		cache_[ pathS ] = entry;
+void FileStatCache::trimList(Shard &shard, LRUList &lru, int maxSize)
+{
+	while(!lru.empty() && static_cast<int>(lru.size()) > maxSize)
+	{
+		shard.cache_.erase(lru.back());
+		lru.pop_back();
 	}
 }
@@ -22,16 +22,46 @@
 
 #include "config.h"
 
-#include <map>
-#include <deque>
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
+
+#include <boost/thread/mutex.hpp>
 
 // Required for efs_stat
 #include "fs_layer.h"
 
+// libencfs
+#include "InternedPath.h"
+
 /**
  * This class caches results of stat().
  *
  * stat() is used many times, and it is helpful to cache its result.
+ * The least recently used entry is evicted when the cache is full,
+ * all operations take constant time.
+ *
+ * If the backing folder may be changed by others, entries expire after
+ * the time to live and are then fetched again.
+ *
+ * Files found not to exist (ENOENT, ENOTDIR) are kept as negative entries,
+ * in a separate LRU list with its own size and time to live, so that probes
+ * for missing files don't evict the entries of existing files. Other errors
+ * are not cached.
+ *
+ * Along with the stat of a regular file, its plaintext size is cached, so
+ * that callers needing it don't have to go through the FileIO layers.
+ *
+ * The cache is thread-safe, and the sizes and times to live can be changed
+ * while it is used. The entries are split into shards by the hash
+ * of the path, each with its own lock and LRU list, so that concurrent
+ * requests rarely wait for each other. The file system is queried without
+ * holding a lock.
  */
 class FileStatCache
 {
@@ -44,25 +74,104 @@ public:
 	void setCacheSize(int cacheSize);
 	int getCachesize() const { return cacheSize_; }
 
-	int stat(const char *path, efs_stat *buffer);
+	/**
+	 * With 0 (the default), entries never expire.
+	 */
+	void setTimeToLive(std::chrono::milliseconds timeToLive) { timeToLive_ = timeToLive.count(); }
+
+	/**
+	 * Size and time to live of the negative entries (0: never expire).
+	 */
+	void setNegativeCacheSize(int cacheSize);
+	void setNegativeTimeToLive(std::chrono::milliseconds timeToLive) { negativeTimeToLive_ = timeToLive.count(); }
+
+	/**
+	 * Computes the plaintext size of a file from the stat of the backing file,
+	 * or returns -errno if the backing file is invalid.
+	 */
+	typedef std::function<int64_t(const efs_stat &)> PlaintextSizeFunction;
+
+	/**
+	 * Must not be called concurrently with the other methods.
+	 */
+	void setPlaintextSizeFunction(const PlaintextSizeFunction &plaintextSize) { plaintextSize_ = plaintextSize; }
+
+	/**
+	 * If plainSize is given, it is set to the plaintext size of a regular file
+	 * (computed once per entry), to st_size for other types, and to -1 if no
+	 * PlaintextSizeFunction was set.
+	 */
+	int stat(const char *path, efs_stat *buffer, int64_t *plainSize = NULL);
 
 	void forgetCachedStat(const char *path);
 
+	/**
+	 * Forgets all entries below folder dirPath, after it was renamed.
+	 */
+	void forgetTree(const std::string &dirPath);
+
+	/**
+	 * Stores the result of a successful stat obtained elsewhere,
+	 * e.g. while enumerating a folder.
+	 */
+	void addStat(const char *path, efs_stat *buffer, int64_t *plainSize = NULL);
+
+	// Calls of stat() answered from the cache, and those which were not
+	uint64_t getHits() const { return hits_.load(std::memory_order_relaxed); }
+	uint64_t getMisses() const { return misses_.load(std::memory_order_relaxed); }
+
 protected:
-	void addStatToCache(const char *path, int retVal, efs_stat *buffer);
+	void addStatToCache(const encfs::InternedPath &path, int retVal, efs_stat *buffer, int64_t plainSize);
 
 private:
+	typedef std::chrono::steady_clock::time_point TimePoint;
+	typedef std::list<encfs::InternedPath> LRUList;	// Most recently used first
+
 	struct CacheEntry
 	{
-		int64_t time_;		// When the stat was made, used for cache eviction
 		efs_stat stat_;
 		int retVal_;		// Return value of stat
+		int errno_;			// errno if retVal_ < 0
+		int64_t plainSize_;	// See setPlaintextSizeFunction()
+		LRUList::iterator lruPos_;
+		TimePoint expiry_;
 	};
 
-	typedef std::map<std::string, CacheEntry> FileStatCacheType;
-	FileStatCacheType cache_;
+	typedef std::unordered_map<encfs::InternedPath, CacheEntry, encfs::InternedPathHash> FileStatCacheType;
+
+	struct Shard
+	{
+		Shard() : generation_(0) { }
+
+		boost::mutex mutex_;
+		FileStatCacheType cache_;
+		LRUList lru_;
+		LRUList negativeLru_;
+		uint64_t generation_;		// Incremented whenever an entry is forgotten
+	};
+
+	static const size_t shardCount = 16;
+
+	Shard &shardOf(const encfs::InternedPath &path) { return shards_[path.hash() % shardCount]; }
+	void addToShard(Shard &shard, const encfs::InternedPath &path, int retVal, int errNo,
+		efs_stat *buffer, int64_t plainSize);
+	int64_t plainSizeOf(const efs_stat &buffer) const;
+	void trimShard(Shard &shard);
+	static void trimList(Shard &shard, LRUList &lru, int maxSize);
+	static bool isNegativeResult(int retVal, int errNo) { return retVal < 0 && (errNo == ENOENT || errNo == ENOTDIR); }
+
+	Shard shards_[shardCount];
+
+	std::atomic<int> cacheSize_;
+	std::atomic<int> shardCacheSize_;
+	std::atomic<int> negativeCacheSize_;
+	std::atomic<int> shardNegativeCacheSize_;
+	std::atomic<int64_t> timeToLive_;			// Milliseconds
+	std::atomic<int64_t> negativeTimeToLive_;
+	PlaintextSizeFunction plaintextSize_;
 
-	int cacheSize_;
+	std::atomic<uint64_t> hits_;
+	std::atomic<uint64_t> misses_;
 };
 
 #endif
@@ -0,0 +1,238 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "FormatterStats.h"
+#include "PhaseTimer.h"
+#include "TraceEvents.h"
+
+#include <iomanip>
+#include <sstream>
+
+FormatterStats::RegistryType FormatterStats::registry_;
+boost::mutex FormatterStats::registryMutex_;
+
+FormatterStats::OpTimer::OpTimer(FormatterStats &stats, Operation op) :
+	stats_(stats),
+	op_(op),
+	bytes_(0),
+	startTime_(std::chrono::steady_clock::now()),
+	trace_(stats.trace_)
+{
+	TRACE_EVENT1(FormatterOpBegin, "op", op);
+}
+
+FormatterStats::OpTimer::~OpTimer()
+{
+	std::chrono::steady_clock::duration duration = std::chrono::steady_clock::now() - startTime_;
+	uint64_t micros = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+	stats_.record(op_, micros, bytes_);
+	TRACE_EVENT5(FormatterOpEnd, "op", op_, "openId", record_.openId, "result", record_.result,
+		"bytes", bytes_, "micros", micros);
+
+	if(trace_ != NULL && trace_->isOpen())
+	{
+		record_.op = static_cast<uint8_t>(op_);
+		record_.bytes = bytes_;
+		trace_->write(record_, startTime_);
+	}
+}
+
+void FormatterStats::OpTimer::setTraceTarget(int64_t openId, int64_t offset, uint64_t size)
+{
+	record_.openId = openId;
+	record_.offset = offset;
+	record_.size = size;
+}
+
+void FormatterStats::OpTimer::setTracePath(const std::string &path)
+{
+	if(trace_ != NULL)
+		record_.path = path;
+}
+
+void FormatterStats::OpTimer::setTraceResult(int result, int64_t resultOpenId, uint8_t fileType)
+{
+	record_.result = result;
+	record_.resultOpenId = resultOpenId;
+	record_.fileType = fileType;
+}
+
+FormatterStats::FormatterStats() :
+	trace_(NULL)
+{
+	reset();
+}
+
+FormatterStats::~FormatterStats()
+{
+}
+
+void FormatterStats::record(Operation op, uint64_t micros, uint64_t bytes)
+{
+	OpCounters &counters = counters_[op];
+	counters.calls_.fetch_add(1, std::memory_order_relaxed);
+	counters.bytes_.fetch_add(bytes, std::memory_order_relaxed);
+	counters.totalMicros_.fetch_add(micros, std::memory_order_relaxed);
+
+	uint64_t maxMicros = counters.maxMicros_.load(std::memory_order_relaxed);
+	while(micros > maxMicros
+		&& !counters.maxMicros_.compare_exchange_weak(maxMicros, micros, std::memory_order_relaxed))
+	{
+	}
+
+	int bucket = 0;
+	while(bucket < histogramBucketCount - 1 && micros >= (static_cast<uint64_t>(1) << bucket))
+		bucket++;
+	counters.histogram_[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void FormatterStats::reset()
+{
+	for(int i = 0; i < opCount; i++)
+	{
+		OpCounters &counters = counters_[i];
+		counters.calls_ = 0;
+		counters.bytes_ = 0;
+		counters.totalMicros_ = 0;
+		counters.maxMicros_ = 0;
+		for(int j = 0; j < histogramBucketCount; j++)
+			counters.histogram_[j] = 0;
+	}
+}
+
+void FormatterStats::addCounter(const std::string &name, const CounterSource &source)
+{
+	boost::mutex::scoped_lock lock(counterSourcesMutex_);
+	counterSources_.push_back(std::make_pair(name, source));
+}
+
+std::string FormatterStats::report() const
+{
+	std::ostringstream ostr;
+	ostr << std::left << std::setw(12) << "Operation" << std::right
+		<< std::setw(10) << "Calls" << std::setw(14) << "Bytes"
+		<< std::setw(12) << "Avg [us]" << std::setw(12) << "Max [us]"
+		<< "  Histogram [calls below 1, 2, 4, ... us]" << std::endl;
+
+	for(int i = 0; i < opCount; i++)
+	{
+		const OpCounters &counters = counters_[i];
+		uint64_t calls = counters.calls_.load(std::memory_order_relaxed);
+		if(calls == 0)
+			continue;
+		uint64_t totalMicros = counters.totalMicros_.load(std::memory_order_relaxed);
+
+		ostr << std::left << std::setw(12) << getOperationName(static_cast<Operation>(i)) << std::right
+			<< std::setw(10) << calls
+			<< std::setw(14) << counters.bytes_.load(std::memory_order_relaxed)
+			<< std::setw(12) << (totalMicros / calls)
+			<< std::setw(12) << counters.maxMicros_.load(std::memory_order_relaxed) << " ";
+
+		// Leave out the empty buckets at both ends
+		int first = 0, last = histogramBucketCount - 1;
+		while(first < last && counters.histogram_[first].load(std::memory_order_relaxed) == 0)
+			first++;
+		while(last > first && counters.histogram_[last].load(std::memory_order_relaxed) == 0)
+			last--;
+		ostr << " [<" << (static_cast<uint64_t>(1) << first) << " us]";
+		for(int j = first; j <= last; j++)
+			ostr << " " << counters.histogram_[j].load(std::memory_order_relaxed);
+		ostr << std::endl;
+	}
+
+	boost::mutex::scoped_lock lock(counterSourcesMutex_);
+	if(!counterSources_.empty())
+	{
+		ostr << std::endl << std::left << std::setw(24) << "Counter" << std::right
+			<< std::setw(14) << "Value" << std::endl;
+		for(size_t i = 0; i < counterSources_.size(); i++)
+		{
+			ostr << std::left << std::setw(24) << counterSources_[i].first << std::right
+				<< std::setw(14) << counterSources_[i].second() << std::endl;
+		}
+	}
+
+	// Phases of all mounts, only with ENCFS_PHASE_TIMERS
+	if(encfs::PhaseTimers::enabled())
+		ostr << std::endl << encfs::PhaseTimers::report();
+
+	return ostr.str();
+}
+
+uint64_t FormatterStats::Snapshot::getCounter(const std::string &name) const
+{
+	std::map<std::string, uint64_t>::const_iterator iter = counters_.find(name);
+	return (iter != counters_.end()) ? iter->second : 0;
+}
+
+void FormatterStats::takeSnapshot(Snapshot &snapshot) const
+{
+	snapshot.time_ = std::chrono::steady_clock::now();
+	for(int i = 0; i < opCount; i++)
+	{
+		snapshot.calls_[i] = counters_[i].calls_.load(std::memory_order_relaxed);
+		snapshot.bytes_[i] = counters_[i].bytes_.load(std::memory_order_relaxed);
+	}
+
+	boost::mutex::scoped_lock lock(counterSourcesMutex_);
+	snapshot.counters_.clear();
+	for(size_t i = 0; i < counterSources_.size(); i++)
+		snapshot.counters_[counterSources_[i].first] = counterSources_[i].second();
+}
+
+void FormatterStats::registerStats(const std::wstring &mountName, FormatterStats *stats)
+{
+	boost::mutex::scoped_lock lock(registryMutex_);
+	registry_[mountName] = stats;
+}
+
+void FormatterStats::unregisterStats(const std::wstring &mountName)
+{
+	boost::mutex::scoped_lock lock(registryMutex_);
+	registry_.erase(mountName);
+}
+
+std::string FormatterStats::getReport(const std::wstring &mountName)
+{
+	boost::mutex::scoped_lock lock(registryMutex_);
+	RegistryType::const_iterator iter = registry_.find(mountName);
+	if(iter == registry_.end())
+		return std::string();
+
+	return iter->second->report();
+}
+
+void FormatterStats::takeSnapshots(std::map<std::wstring, Snapshot> &snapshots)
+{
+	snapshots.clear();
+	boost::mutex::scoped_lock lock(registryMutex_);
+	for(RegistryType::const_iterator iter = registry_.begin(); iter != registry_.end(); ++iter)
+		iter->second->takeSnapshot(snapshots[iter->first]);
+}
+
+const char *FormatterStats::getOperationName(Operation op)
+{
+	static const char *names[opCount] =
+	{
+		"Open", "Replace", "Move", "MoveReplace", "Delete", "Close", "FlushFile",
+		"List", "ListEnd", "Read", "Write", "SetSize", "Capacity", "FlushMedia",
+		"Control", "MediaInfo", "Access", "ReadXattr", "WriteXattr"
+	};
+	return names[op];
+}
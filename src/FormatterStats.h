@@ -0,0 +1,166 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FORMATTERSTATS_H
+#define FORMATTERSTATS_H
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "OpTrace.h"
+
+/**
+ * Counters and latency histograms for the operations of the PFM formatter.
+ *
+ * Recording only uses atomic operations, so it can be done in every request
+ * without taking a lock. The statistics of all mounted drives are registered
+ * by mount name, so the GUI can show them.
+ */
+class FormatterStats
+{
+public:
+	enum Operation
+	{
+		opOpen = 0, opReplace, opMove, opMoveReplace, opDelete, opClose, opFlushFile,
+		opList, opListEnd, opRead, opWrite, opSetSize, opCapacity, opFlushMedia,
+		opControl, opMediaInfo, opAccess, opReadXattr, opWriteXattr,
+		opCount
+	};
+
+	// Control code for PFMLayer::Control, returns report() as UTF-8 text
+	static const int controlCodeGetStats = 0x45530001;
+	// Control code for PFMLayer::Control on an open folder, deletes everything
+	// in it and returns the number of deleted entries as UTF-8 text
+	static const int controlCodeDeleteContents = 0x45530002;
+
+	/**
+	 * Measures the duration of one operation, from construction to destruction.
+	 * Also writes the operation to the trace, if one is recorded.
+	 */
+	class OpTimer
+	{
+	public:
+		OpTimer(FormatterStats &stats, Operation op);
+		~OpTimer();
+
+		void setBytes(uint64_t bytes) { bytes_ = bytes; }
+
+		// Details for the trace, see OpTrace::Record. Ignored if no trace is recorded.
+		void setTraceTarget(int64_t openId, int64_t offset = 0, uint64_t size = 0);
+		void setTracePath(const std::string &path);
+		void setTraceResult(int result, int64_t resultOpenId = 0, uint8_t fileType = OpTrace::fileTypeNone);
+
+	private:
+		FormatterStats &stats_;
+		Operation op_;
+		uint64_t bytes_;
+		std::chrono::steady_clock::time_point startTime_;
+		OpTrace *trace_;
+		OpTrace::Record record_;
+	};
+
+	FormatterStats();
+	virtual ~FormatterStats();
+
+	void record(Operation op, uint64_t micros, uint64_t bytes);
+	void reset();
+
+	uint64_t callCount(Operation op) const { return counters_[op].calls_.load(std::memory_order_relaxed); }
+	// Total duration of the completed calls
+	uint64_t totalMicros(Operation op) const { return counters_[op].totalMicros_.load(std::memory_order_relaxed); }
+
+	/**
+	 * Add a counter kept elsewhere, e.g. in libencfs, to the report.
+	 * Counters can also be added while the statistics are registered, like
+	 * those of a drive which is unlocked on the first access.
+	 */
+	typedef boost::function<uint64_t ()> CounterSource;
+	void addCounter(const std::string &name, const CounterSource &source);
+
+	std::string report() const;
+
+	/**
+	 * Totals of the operations and the values of the counters at one time,
+	 * cheap enough to be taken every second. Rates follow from the
+	 * difference of two snapshots.
+	 */
+	struct Snapshot
+	{
+		std::chrono::steady_clock::time_point time_;
+		uint64_t calls_[opCount];
+		uint64_t bytes_[opCount];
+		std::map<std::string, uint64_t> counters_;
+
+		// 0 if the counter was not added
+		uint64_t getCounter(const std::string &name) const;
+	};
+	void takeSnapshot(Snapshot &snapshot) const;
+
+	/**
+	 * Record all operations to the trace, NULL to stop. Must be set before
+	 * the first operation, and the trace must outlive the operations.
+	 */
+	void setTrace(OpTrace *trace) { trace_ = trace; }
+
+	static const char *getOperationName(Operation op);
+
+	static void registerStats(const std::wstring &mountName, FormatterStats *stats);
+	static void unregisterStats(const std::wstring &mountName);
+	// Returns an empty string if no drive with this name is mounted
+	static std::string getReport(const std::wstring &mountName);
+	// Snapshots of all mounted drives, by mount name
+	static void takeSnapshots(std::map<std::wstring, Snapshot> &snapshots);
+
+private:
+	FormatterStats(const FormatterStats &o) = delete;
+	FormatterStats & operator=(const FormatterStats & o) = delete;
+
+	// Bucket i counts durations below 2^i microseconds, the last one all others
+	static const int histogramBucketCount = 24;
+
+	struct OpCounters
+	{
+		std::atomic<uint64_t> calls_;
+		std::atomic<uint64_t> bytes_;
+		std::atomic<uint64_t> totalMicros_;
+		std::atomic<uint64_t> maxMicros_;
+		std::atomic<uint64_t> histogram_[histogramBucketCount];
+	};
+	OpCounters counters_[opCount];
+
+	std::vector< std::pair<std::string, CounterSource> > counterSources_;
+	mutable boost::mutex counterSourcesMutex_;
+	OpTrace *trace_;
+
+	typedef std::map<std::wstring, FormatterStats *> RegistryType;
+	static RegistryType registry_;
+	static boost::mutex registryMutex_;
+};
+
+#endif
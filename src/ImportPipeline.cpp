@@ -0,0 +1,218 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "ImportPipeline.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <fcntl.h>
+
+#include "fs_layer.h"
+
+// libencfs
+#include "Error.h"
+#include "FileUtils.h"
+#include "DirNode.h"
+#include "FileNode.h"
+
+ImportPipeline::ImportPipeline(const std::shared_ptr<encfs::EncFS_Root> &rootInfo, CopyProgress *pProgress,
+	int encryptThreads) :
+	rootInfo_(rootInfo),
+	pProgress_(pProgress),
+	encryptThreads_(CopyPipeline::threadCount(encryptThreads)),
+	failed_(false)
+{
+}
+
+ImportPipeline::~ImportPipeline()
+{
+}
+
+bool ImportPipeline::isStopping() const
+{
+	return failed_ || pProgress_->cancel;
+}
+
+/**
+ * Wakes all threads, which exit as soon as they see isStopping().
+ */
+void ImportPipeline::fail()
+{
+	failed_ = true;
+	files_.stop();
+}
+
+bool ImportPipeline::run(const std::string &srcDir)
+{
+	boost::thread_group threads;
+	for(int i = 0; i < encryptThreads_; i++)
+		threads.create_thread([this]() { encryptLoop(); });
+
+	bool isOK = walkDir(srcDir, "/");
+	if(!isOK)
+		fail();
+	files_.close();
+	pProgress_->walkDone = true;
+
+	threads.join_all();
+	return isOK && !isStopping();
+}
+
+bool ImportPipeline::walkDir(const std::string &srcDir, const std::string &volumeDir)
+{
+	fs_layer::DIR *dir = fs_layer::opendir(srcDir.c_str());
+	if(dir == NULL)
+		return false;
+
+	bool isOK = true;
+	fs_layer::fs_dirent *de = nullptr;
+	while(isOK && (de = fs_layer::readdir(dir)) != NULL)
+	{
+		if(isStopping())
+		{
+			isOK = false;
+			break;
+		}
+
+		std::string name(de->d_name);
+		if(name == "." || name == "..")
+			continue;
+
+		std::string srcName = srcDir + name;
+		std::string plainPath = volumeDir + name;
+
+		efs_stat stBuf;
+		if(fs_layer::lstat(srcName.c_str(), &stBuf))
+		{
+			isOK = false;
+		}
+		else if(S_ISDIR(stBuf.st_mode))
+		{
+			// Folders which exist already are imported into
+			int res = rootInfo_->root->mkdir(plainPath.c_str(), stBuf.st_mode);
+			if(res != 0 && res != -EEXIST)
+				isOK = false;
+			else
+				isOK = walkDir(srcName + '/', plainPath + '/');
+		}
+		else if(S_ISREG(stBuf.st_mode))
+		{
+			FileJob job;
+			job.srcName = srcName;
+			job.plainPath = plainPath;
+			job.mode = static_cast<unsigned short>(stBuf.st_mode);
+			job.size = stBuf.st_size;
+			isOK = queueFile(job);
+		}
+	}
+	fs_layer::closedir(dir);
+	return isOK;
+}
+
+bool ImportPipeline::queueFile(const FileJob &job)
+{
+	pProgress_->filesFound++;
+	pProgress_->bytesFound += job.size;
+	if(isStopping() || !files_.push(job))
+	{
+		fail();
+		return false;
+	}
+	return true;
+}
+
+bool ImportPipeline::encryptFile(const FileJob &job)
+{
+	std::shared_ptr<encfs::FileNode> node =
+		rootInfo_->root->lookupNode(job.plainPath.c_str(), "EncFSMP");
+	if(!node)
+		return false;
+
+	int res = node->mknod(job.mode, 0);
+	if(res != 0 && res != -EEXIST)
+		return false;
+	if(node->open(O_RDWR) < 0)
+		return false;
+	if(res == -EEXIST && node->truncate(0) != 0)
+		return false;
+
+	int srcFd = fs_layer::open(job.srcName.c_str(), O_RDONLY);
+	if(srcFd < 0)
+		return false;
+
+	bool isOK = true;
+	std::vector<unsigned char> buf(CopyPipeline::pieceSize(node->dataBlockSize()));
+	int64_t offset = 0;
+	for(;;)
+	{
+		if(isStopping())
+		{
+			isOK = false;
+			break;
+		}
+
+		int64_t readBytes = fs_layer::pread(srcFd, &buf[0], static_cast<int64_t>(buf.size()), offset);
+		if(readBytes < 0)
+			isOK = false;
+		if(readBytes <= 0)
+			break;
+
+		ssize_t written = node->write(offset, &buf[0], static_cast<size_t>(readBytes));
+		if(written != readBytes)
+		{
+			isOK = false;
+			break;
+		}
+		offset += readBytes;
+		pProgress_->bytesDone += readBytes;
+	}
+	fs_layer::close(srcFd);
+
+	if(isOK)
+		pProgress_->filesDone++;
+	return isOK;
+}
+
+void ImportPipeline::encryptLoop()
+{
+	FileJob job;
+	while(files_.pop(job))
+	{
+		if(isStopping())
+		{
+			fail();
+			break;
+		}
+
+		bool isOK = false;
+		try
+		{
+			isOK = encryptFile(job);
+		}
+		catch(encfs::Error &)
+		{
+			isOK = false;
+		}
+		if(!isOK)
+			fail();
+	}
+}
@@ -0,0 +1,91 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef IMPORTPIPELINE_H
+#define IMPORTPIPELINE_H
+
+#include <memory>
+#include <string>
+#include <stdint.h>
+
+#include <boost/thread.hpp>
+
+#include "CopyPipeline.h"
+#include "CopyProgress.h"
+
+namespace encfs
+{
+	struct EncFS_Root;
+}
+
+/**
+ * Copies a folder into a volume which is not mounted, the counterpart of
+ * ExportPipeline.
+ *
+ * The calling thread walks the source folders and creates them in the
+ * volume. The files it finds are queued for the encrypting threads, which
+ * create them and write them in large pieces. FileNode::write() encrypts the
+ * many blocks of a piece in parallel, so a single large file keeps the cores
+ * busy as well. Existing files of the volume are overwritten.
+ */
+class ImportPipeline
+{
+public:
+	/**
+	 * encryptThreads 0: one per core.
+	 */
+	ImportPipeline(const std::shared_ptr<encfs::EncFS_Root> &rootInfo, CopyProgress *pProgress,
+		int encryptThreads = 0);
+	virtual ~ImportPipeline();
+
+	/**
+	 * Imports everything below srcDir, which ends with a separator, into the
+	 * root folder of the volume. Returns false if a file could not be imported
+	 * or the import was cancelled.
+	 */
+	bool run(const std::string &srcDir);
+
+private:
+	struct FileJob
+	{
+		std::string srcName;
+		std::string plainPath;
+		unsigned short mode;
+		int64_t size;
+	};
+
+	bool walkDir(const std::string &srcDir, const std::string &volumeDir);
+	bool queueFile(const FileJob &job);
+	bool encryptFile(const FileJob &job);
+	void encryptLoop();
+	void fail();
+	bool isStopping() const;
+
+	ImportPipeline(const ImportPipeline &);
+	ImportPipeline &operator=(const ImportPipeline &);
+
+	std::shared_ptr<encfs::EncFS_Root> rootInfo_;
+	CopyProgress *pProgress_;
+	int encryptThreads_;
+
+	CopyPipeline::FileQueue<FileJob> files_;
+	std::atomic<bool> failed_;
+};
+
+#endif
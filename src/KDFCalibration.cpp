@@ -0,0 +1,201 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "CommonIncludes.h"
+
+#include "KDFCalibration.h"
+#include "CipherBenchmark.h"
+#include "EncFSMPStrings.h"
+
+#include <wx/config.h>
+#include <wx/utils.h>
+
+#include <chrono>
+#include <memory>
+#include <sstream>
+
+#include <openssl/evp.h>
+#include <openssl/opensslv.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(LIBRESSL_VERSION_NUMBER) && !defined(OPENSSL_NO_SCRYPT)
+#define KDFCALIBRATION_SCRYPT 1
+#endif
+
+// Minimum time of one measured run
+static const std::chrono::milliseconds calibrationDuration(200);
+// Output size of SHA1, PBKDF2 runs all iterations once per output block
+static const int pbkdf2BlockSize = 20;
+// scrypt memory of the measurement, N * r * 128 bytes = 16 MB
+static const uint64_t calibrationScryptN = 1 << 14;
+static const int calibrationScryptR = 8;
+
+static const unsigned char calibrationSalt[20] = { 0 };
+static const char calibrationPassword[] = "calibration";
+
+/**
+ * Identifies the machine and the OpenSSL build the speed belongs to. A
+ * configuration copied to another machine, or a new OpenSSL, is measured again.
+ */
+static wxString getMachineId()
+{
+	wxString id = wxGetFullHostName();
+	id += wxT("|");
+	id += wxString(CipherBenchmark::getCpuFeatures().description.c_str(), *wxConvCurrent);
+	id += wxT("|");
+	id += wxString(wxT(OPENSSL_VERSION_TEXT));
+	return id;
+}
+
+bool KDFCalibration::load(Speed &speed)
+{
+	std::auto_ptr<wxConfig> config(new wxConfig(EncFSMPStrings::configAppName_,
+		EncFSMPStrings::configOrganizationName_));
+	config->SetPath(wxT("/"));
+
+	wxString stored;
+	if(!config->Read(EncFSMPStrings::configKDFCalibration_, &stored))
+		return false;
+
+	// "<machine id>\t<pbkdf2PerSecond> <scryptPerSecond>"
+	wxString machineId = stored.BeforeFirst(wxT('\t'));
+	if(machineId != getMachineId())
+		return false;
+
+	Speed storedSpeed;
+	std::wistringstream istr(std::wstring(stored.AfterFirst(wxT('\t')).c_str()));
+	istr >> storedSpeed.pbkdf2PerSecond >> storedSpeed.scryptPerSecond;
+	if(istr.fail() || !storedSpeed.isValid())
+		return false;
+
+	speed = storedSpeed;
+	return true;
+}
+
+void KDFCalibration::store(const Speed &speed)
+{
+	if(!speed.isValid())
+		return;
+
+	std::auto_ptr<wxConfig> config(new wxConfig(EncFSMPStrings::configAppName_,
+		EncFSMPStrings::configOrganizationName_));
+	config->SetPath(wxT("/"));
+
+	std::wostringstream ostr;
+	ostr << speed.pbkdf2PerSecond << L" " << speed.scryptPerSecond;
+	wxString stored = getMachineId() + wxT("\t") + wxString(ostr.str().c_str());
+	config->Write(EncFSMPStrings::configKDFCalibration_, stored);
+}
+
+/**
+ * Doubles the iterations until one run takes calibrationDuration. Returns the
+ * iterations per second, or 0 in case of failure.
+ */
+double KDFCalibration::measurePBKDF2()
+{
+	unsigned char out[pbkdf2BlockSize];
+	int iterations = 1000;
+	for(;;)
+	{
+		std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+		if(PKCS5_PBKDF2_HMAC_SHA1(calibrationPassword, sizeof(calibrationPassword) - 1,
+			calibrationSalt, sizeof(calibrationSalt), iterations, sizeof(out), out) != 1)
+			return 0.0;
+		std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - startTime;
+
+		if(elapsed >= calibrationDuration || iterations > (1 << 28))
+		{
+			double seconds = std::chrono::duration<double>(elapsed).count();
+			return seconds > 0.0 ? (double)iterations / seconds : 0.0;
+		}
+		iterations *= 2;
+	}
+}
+
+/**
+ * Runs scrypt with 16 MB until calibrationDuration has passed. Returns N * r
+ * per second, or 0 if scrypt is not available.
+ */
+double KDFCalibration::measureScrypt()
+{
+#if defined(KDFCALIBRATION_SCRYPT)
+	unsigned char out[32];
+	uint64_t work = 0;
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::duration elapsed;
+	do
+	{
+		if(EVP_PBE_scrypt(calibrationPassword, sizeof(calibrationPassword) - 1,
+			calibrationSalt, sizeof(calibrationSalt), calibrationScryptN, calibrationScryptR, 1,
+			2 * calibrationScryptN * calibrationScryptR * 128, out, sizeof(out)) != 1)
+			return 0.0;
+		work += calibrationScryptN * calibrationScryptR;
+		elapsed = std::chrono::steady_clock::now() - startTime;
+	} while(elapsed < calibrationDuration);
+
+	double seconds = std::chrono::duration<double>(elapsed).count();
+	return (double)work / seconds;
+#else
+	return 0.0;
+#endif
+}
+
+KDFCalibration::Speed KDFCalibration::measure()
+{
+	Speed speed;
+	speed.pbkdf2PerSecond = measurePBKDF2();
+	speed.scryptPerSecond = measureScrypt();
+	return speed;
+}
+
+KDFCalibration::Params KDFCalibration::getParams(const Speed &speed, long durationMs,
+	int keyLength, uint64_t maxMemory)
+{
+	Params params;
+	double seconds = (double)durationMs / 1000.0;
+
+	if(speed.pbkdf2PerSecond > 0.0)
+	{
+		int blocks = (keyLength + pbkdf2BlockSize - 1) / pbkdf2BlockSize;
+		if(blocks < 1)
+			blocks = 1;
+		double iterations = speed.pbkdf2PerSecond * seconds / (double)blocks;
+		// The minimum of SSL_Cipher::newKey(), and a limit kdfIterations can hold
+		if(iterations < 1000.0)
+			iterations = 1000.0;
+		if(iterations > 2000000000.0)
+			iterations = 2000000000.0;
+		params.pbkdf2Iterations = (int)iterations;
+	}
+
+	if(speed.scryptPerSecond > 0.0)
+	{
+		// The largest N which fits the time and the memory, then p for the
+		// time left over if the memory ran out first
+		double work = speed.scryptPerSecond * seconds;
+		uint64_t maxN = maxMemory / (128 * (uint64_t)params.scryptR);
+		uint64_t n = 2;
+		while(n * 2 <= maxN && (double)(n * 2 * params.scryptR) <= work)
+			n *= 2;
+		params.scryptN = n;
+		double p = work / (double)(n * params.scryptR);
+		params.scryptP = p < 1.0 ? 1 : (p > 1024.0 ? 1024 : (int)p);
+	}
+
+	return params;
+}
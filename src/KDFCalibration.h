@@ -0,0 +1,79 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef KDFCALIBRATION_H
+#define KDFCALIBRATION_H
+
+#include <stdint.h>
+
+/**
+ * Speed of the password key derivation functions on this machine, and the
+ * parameters which make a derivation take a given time.
+ *
+ * The speed is measured once per machine and stored in the configuration,
+ * so new volumes get their iteration count without the timed runs of
+ * SSL_Cipher::newKey(). load() and store() use wxConfig and belong on the
+ * GUI thread, measure() takes about half a second and runs anywhere.
+ */
+class KDFCalibration
+{
+public:
+	struct Speed
+	{
+		Speed() : pbkdf2PerSecond(0.0), scryptPerSecond(0.0) { }
+
+		bool isValid() const { return pbkdf2PerSecond > 0.0; }
+
+		double pbkdf2PerSecond;		// PBKDF2-HMAC-SHA1 iterations of one 20 byte output block
+		double scryptPerSecond;		// scrypt N * r * p, 0 if OpenSSL has no scrypt
+	};
+
+	struct Params
+	{
+		Params() : pbkdf2Iterations(0), scryptN(0), scryptR(8), scryptP(1) { }
+
+		int pbkdf2Iterations;		// As stored in kdfIterations of EncFS volumes
+		uint64_t scryptN;			// Power of 2, 0 if scrypt was not measured
+		int scryptR, scryptP;
+	};
+
+	/**
+	 * The stored speed, if it was measured on this machine with this OpenSSL.
+	 */
+	static bool load(Speed &speed);
+	static void store(const Speed &speed);
+
+	static Speed measure();
+
+	/**
+	 * Parameters which take durationMs to derive keyLength bytes. scrypt uses
+	 * at most maxMemory bytes and gets more time by parallelism beyond that.
+	 */
+	static Params getParams(const Speed &speed, long durationMs, int keyLength,
+		uint64_t maxMemory = 64 * 1024 * 1024);
+
+private:
+	KDFCalibration() { }
+	~KDFCalibration() { }
+
+	static double measurePBKDF2();
+	static double measureScrypt();
+};
+
+#endif
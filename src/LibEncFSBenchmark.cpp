@@ -0,0 +1,686 @@
+/**
+ * Copyright (C) 2026 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * Micro-benchmarks of the libencfs layers, without PFM.
+ *
+ * Creates a volume in a temporary folder and measures the ciphers, the name
+ * coding, the FileIO chain of FileNode and FileStatCache one at a time, so
+ * that they can be profiled in isolation. With --mounts, measures the phases
+ * of mounting volumes instead. Build the EncFSMPBench target and
+ * run "EncFSMPBench --help" for the options.
+ */
+
+#include "FileStatCache.h"
+#include "fs_layer.h"
+
+#include "Cipher.h"
+#include "Context.h"
+#include "DirNode.h"
+#include "FileNode.h"
+#include "FileUtils.h"
+#include "NameIO.h"
+#include "PhaseTimer.h"
+#include "openssl.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/chrono.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+#if defined(BOOST_CHRONO_HAS_THREAD_CLOCK)
+typedef boost::chrono::thread_clock CpuClock;
+#else
+typedef boost::chrono::process_user_cpu_clock CpuClock;
+#endif
+typedef boost::chrono::steady_clock WallClock;
+
+static const int benchmarkFileSize = 4 * 1024 * 1024;
+static const int benchmarkNameCount = 1024;
+
+struct BenchmarkOptions
+{
+	BenchmarkOptions() : minTimeMs(200), repetitions(5), mounts(0) { }
+
+	std::string filter;		// run only the benchmarks whose name contains this
+	int minTimeMs;			// shortest duration of a repetition
+	int repetitions;		// runs of the calibrated iteration count
+	std::string folder;		// parent of the temporary volume, empty for the temp folder
+	int mounts;				// > 0: run the mount benchmark with this many volumes instead
+};
+
+/**
+ * A benchmark runs its operation iterations times and returns false on failure.
+ * bytesPerOp is 0 if there is no throughput to report.
+ */
+struct Benchmark
+{
+	std::string name;
+	int64_t bytesPerOp;
+	std::function<bool(int64_t iterations)> run;
+};
+
+struct Measurement
+{
+	double wallNs;
+	double cpuNs;
+};
+
+static bool measure(const Benchmark &benchmark, int64_t iterations, Measurement &m)
+{
+	WallClock::time_point wallStart = WallClock::now();
+	CpuClock::time_point cpuStart = CpuClock::now();
+	if(!benchmark.run(iterations))
+		return false;
+	CpuClock::time_point cpuEnd = CpuClock::now();
+	WallClock::time_point wallEnd = WallClock::now();
+
+	m.wallNs = static_cast<double>(boost::chrono::duration_cast<boost::chrono::nanoseconds>(wallEnd - wallStart).count());
+	m.cpuNs = static_cast<double>(boost::chrono::duration_cast<boost::chrono::nanoseconds>(cpuEnd - cpuStart).count());
+	return true;
+}
+
+/**
+ * Raises the iteration count until a run takes at least minTimeMs, then measures
+ * the given number of repetitions with that count and reports the median, so that
+ * the results of consecutive runs are comparable.
+ */
+static bool runBenchmark(const Benchmark &benchmark, const BenchmarkOptions &options, std::ostream &out)
+{
+	const double minTimeNs = options.minTimeMs * 1e6;
+	int64_t iterations = 1;
+	Measurement m;
+	while(true)
+	{
+		if(!measure(benchmark, iterations, m))
+			return false;
+		if(m.wallNs >= minTimeNs || iterations >= (static_cast<int64_t>(1) << 40))
+			break;
+		// Aim a bit above the minimum, but never grow more than 10 times at once
+		double factor = (m.wallNs > 0) ? 1.2 * minTimeNs / m.wallNs : 10.0;
+		iterations = static_cast<int64_t>(iterations * std::min(std::max(factor, 2.0), 10.0));
+	}
+
+	std::vector<Measurement> results;
+	for(int i = 0; i < options.repetitions; i++)
+	{
+		if(!measure(benchmark, iterations, m))
+			return false;
+		results.push_back(m);
+	}
+
+	std::vector<double> wall, cpu;
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		wall.push_back(results[i].wallNs / iterations);
+		cpu.push_back(results[i].cpuNs / iterations);
+	}
+	std::sort(wall.begin(), wall.end());
+	std::sort(cpu.begin(), cpu.end());
+	double wallMedian = wall[wall.size() / 2];
+	double mbPerSecond = (benchmark.bytesPerOp > 0 && wallMedian > 0) ?
+		benchmark.bytesPerOp / (wallMedian * 1e-9) / (1024.0 * 1024.0) : 0.0;
+
+	out << benchmark.name << ',' << iterations << ',' << results.size() << ','
+		<< std::fixed << std::setprecision(1) << wallMedian << ',' << cpu[cpu.size() / 2] << ','
+		<< wall.front() << ',' << wall.back() << ',' << mbPerSecond << std::endl;
+	return true;
+}
+
+static void addCipherBenchmarks(std::vector<Benchmark> &benchmarks, const encfs::RootPtr &rootInfo,
+	std::vector<unsigned char> &buffer)
+{
+	const std::shared_ptr<encfs::Cipher> cipher = rootInfo->cipher;
+	const encfs::CipherKey key = rootInfo->volumeKey;
+	unsigned char *data = &buffer[0];
+	int size = static_cast<int>(buffer.size());
+
+	Benchmark b;
+	b.bytesPerOp = size;
+
+	b.name = "cipher/blockEncode";
+	b.run = [=](int64_t iterations) -> bool {
+		for(int64_t i = 0; i < iterations; i++)
+		{
+			if(!cipher->blockEncode(data, size, static_cast<uint64_t>(i), key))
+				return false;
+		}
+		return true;
+	};
+	benchmarks.push_back(b);
+
+	b.name = "cipher/blockDecode";
+	b.run = [=](int64_t iterations) -> bool {
+		for(int64_t i = 0; i < iterations; i++)
+		{
+			if(!cipher->blockDecode(data, size, static_cast<uint64_t>(i), key))
+				return false;
+		}
+		return true;
+	};
+	benchmarks.push_back(b);
+
+	// The partial last block of a file
+	b.name = "cipher/streamEncode";
+	b.bytesPerOp = size / 2 + 1;
+	b.run = [=](int64_t iterations) -> bool {
+		for(int64_t i = 0; i < iterations; i++)
+		{
+			if(!cipher->streamEncode(data, size / 2 + 1, static_cast<uint64_t>(i), key))
+				return false;
+		}
+		return true;
+	};
+	benchmarks.push_back(b);
+
+	b.name = "cipher/MAC_64";
+	b.bytesPerOp = size;
+	b.run = [=](int64_t iterations) -> bool {
+		uint64_t mac = 0;
+		for(int64_t i = 0; i < iterations; i++)
+			mac ^= cipher->MAC_64(data, size, key);
+		data[0] = static_cast<unsigned char>(mac);	// keep the result alive
+		return true;
+	};
+	benchmarks.push_back(b);
+}
+
+static void addNameBenchmarks(std::vector<Benchmark> &benchmarks, const std::shared_ptr<encfs::NameIO> &nameIO)
+{
+	std::shared_ptr<std::vector<std::string> > plainNames(new std::vector<std::string>());
+	std::shared_ptr<std::vector<std::string> > cipherNames(new std::vector<std::string>());
+	for(int i = 0; i < benchmarkNameCount; i++)
+	{
+		std::ostringstream name;
+		name << "Document " << i << " - final version.docx";
+		plainNames->push_back(name.str());
+		cipherNames->push_back(nameIO->encodeName(name.str().c_str(), static_cast<int>(name.str().length())));
+	}
+
+	std::string deepPath;
+	for(int i = 0; i < 8; i++)
+		deepPath += "/folder " + std::to_string(i);
+	std::string deepCipherPath = nameIO->encodePath(deepPath.c_str());
+
+	Benchmark b;
+	b.bytesPerOp = 0;
+
+	b.name = "names/encodeName";
+	b.run = [=](int64_t iterations) -> bool {
+		for(int64_t i = 0; i < iterations; i++)
+		{
+			const std::string &name = (*plainNames)[i % benchmarkNameCount];
+			if(nameIO->encodeName(name.c_str(), static_cast<int>(name.length())).empty())
+				return false;
+		}
+		return true;
+	};
+	benchmarks.push_back(b);
+
+	b.name = "names/decodeName";
+	b.run = [=](int64_t iterations) -> bool {
+		for(int64_t i = 0; i < iterations; i++)
+		{
+			const std::string &name = (*cipherNames)[i % benchmarkNameCount];
+			if(nameIO->decodeName(name.c_str(), static_cast<int>(name.length())).empty())
+				return false;
+		}
+		return true;
+	};
+	benchmarks.push_back(b);
+
+	b.name = "names/encodePath_depth8";
+	b.run = [=](int64_t iterations) -> bool {
+		for(int64_t i = 0; i < iterations; i++)
+		{
+			if(nameIO->encodePath(deepPath.c_str()).empty())
+				return false;
+		}
+		return true;
+	};
+	benchmarks.push_back(b);
+
+	b.name = "names/decodePath_depth8";
+	b.run = [=](int64_t iterations) -> bool {
+		for(int64_t i = 0; i < iterations; i++)
+		{
+			if(nameIO->decodePath(deepCipherPath.c_str()).empty())
+				return false;
+		}
+		return true;
+	};
+	benchmarks.push_back(b);
+}
+
+/**
+ * Reads and writes go through the whole FileIO chain of FileNode, that is
+ * MACFileIO, CipherFileIO and RawFileIO. The volume is created with block
+ * MACs and without caches, so every read verifies and decodes one block.
+ */
+static bool addFileBenchmarks(std::vector<Benchmark> &benchmarks, const encfs::RootPtr &rootInfo,
+	const encfs::EncFSConfig &config, FileStatCache *statCache)
+{
+	encfs::DirNode *root = rootInfo->root.get();
+	int res = 0;
+	std::shared_ptr<encfs::FileNode> node = root->lookupNode("/bench", "bench");
+	if(!node || node->mknod(S_IFREG | 0644, 0, 0, 0) != 0)
+		return false;
+	node = root->openNode("/bench", "bench", O_RDWR, &res);
+	if(!node)
+		return false;
+
+	// The payload of a block is smaller than the block size with MACs
+	int payload = config.blockSize - config.blockMACBytes - config.blockMACRandBytes;
+	int blockCount = benchmarkFileSize / payload;
+	std::shared_ptr<std::vector<unsigned char> > buffer(new std::vector<unsigned char>(payload, 0x5a));
+	for(int i = 0; i < blockCount; i++)
+	{
+		if(!node->write(static_cast<off_t>(i) * payload, &(*buffer)[0], payload))
+			return false;
+	}
+
+	Benchmark b;
+	b.bytesPerOp = payload;
+
+	b.name = "file/readBlock";
+	b.run = [=](int64_t iterations) -> bool {
+		for(int64_t i = 0; i < iterations; i++)
+		{
+			off_t offset = static_cast<off_t>(i % blockCount) * payload;
+			if(node->read(offset, &(*buffer)[0], payload) != payload)
+				return false;
+		}
+		return true;
+	};
+	benchmarks.push_back(b);
+
+	b.name = "file/writeBlock";
+	b.run = [=](int64_t iterations) -> bool {
+		for(int64_t i = 0; i < iterations; i++)
+		{
+			off_t offset = static_cast<off_t>(i % blockCount) * payload;
+			if(!node->write(offset, &(*buffer)[0], payload))
+				return false;
+		}
+		return true;
+	};
+	benchmarks.push_back(b);
+
+	b.bytesPerOp = 0;
+	b.name = "file/getAttr";
+	b.run = [=](int64_t iterations) -> bool {
+		efs_stat buf;
+		for(int64_t i = 0; i < iterations; i++)
+		{
+			if(node->getAttr(&buf, NULL) != 0)
+				return false;
+		}
+		return true;
+	};
+	benchmarks.push_back(b);
+
+	b.name = "stat/FileStatCache_hit";
+	std::string cipherPath = node->cipherName();
+	b.run = [=](int64_t iterations) -> bool {
+		efs_stat buf;
+		for(int64_t i = 0; i < iterations; i++)
+		{
+			if(statCache->stat(cipherPath.c_str(), &buf) != 0)
+				return false;
+		}
+		return true;
+	};
+	benchmarks.push_back(b);
+
+	b.name = "stat/FileStatCache_miss";
+	b.run = [=](int64_t iterations) -> bool {
+		efs_stat buf;
+		for(int64_t i = 0; i < iterations; i++)
+		{
+			statCache->forgetCachedStat(cipherPath.c_str());
+			if(statCache->stat(cipherPath.c_str(), &buf) != 0)
+				return false;
+		}
+		return true;
+	};
+	benchmarks.push_back(b);
+
+	b.name = "file/getAttr_statCache";
+	b.run = [=](int64_t iterations) -> bool {
+		efs_stat buf;
+		for(int64_t i = 0; i < iterations; i++)
+		{
+			if(node->getAttr(&buf, statCache) != 0)
+				return false;
+		}
+		return true;
+	};
+	benchmarks.push_back(b);
+
+	return true;
+}
+
+/**
+ * Durations of the phases of mounting a volume, in milliseconds.
+ *
+ * readConfig, makeKey (the PBKDF2 of the password) and readKey (decoding the
+ * volume key) are measured on their own; initFS then does all of them again,
+ * the way a mount does. firstList is the first listing of the root folder.
+ */
+struct MountTimes
+{
+	MountTimes() : readConfigMs(0), makeKeyMs(0), readKeyMs(0), initFSMs(0), firstListMs(0) { }
+
+	double readConfigMs;
+	double makeKeyMs;
+	double readKeyMs;
+	double initFSMs;
+	double firstListMs;
+};
+
+static const char *mountBenchmarkPassword = "benchmark";
+static const int mountBenchmarkRootEntries = 100;
+
+static double millisecondsSince(WallClock::time_point start)
+{
+	return boost::chrono::duration_cast<boost::chrono::microseconds>(WallClock::now() - start).count() / 1000.0;
+}
+
+static std::shared_ptr<encfs::EncFS_Opts> mountOptions(const std::string &rootDir, bool create)
+{
+	std::shared_ptr<encfs::EncFS_Opts> opts(new encfs::EncFS_Opts());
+	opts->rootDir = rootDir;
+	opts->createIfNotFound = create;
+	opts->checkKey = true;
+	opts->configMode = encfs::Config_Standard;
+	opts->passwordProgram = mountBenchmarkPassword;
+	return opts;
+}
+
+/**
+ * Creates a standard volume with some files in its root folder.
+ */
+static bool createVolume(const std::string &rootDir)
+{
+	boost::filesystem::create_directories(rootDir);
+	std::shared_ptr<encfs::EncFS_Opts> opts = mountOptions(rootDir, true);
+	std::ostringstream ostr;
+	encfs::EncFS_Context ctx;
+	ctx.opts = opts;
+	encfs::RootPtr rootInfo = encfs::initFS(&ctx, opts, ostr);
+	if(!rootInfo)
+		return false;
+
+	for(int i = 0; i < mountBenchmarkRootEntries; i++)
+	{
+		std::string name = "file " + std::to_string(i);
+		std::string path = "/" + name;
+		std::shared_ptr<encfs::FileNode> node = rootInfo->root->lookupNode(path.c_str(), "bench");
+		if(!node || node->mknod(S_IFREG | 0644, 0, 0, 0) != 0)
+			return false;
+	}
+	return true;
+}
+
+static bool mountVolume(const std::string &rootDir, MountTimes &times)
+{
+	WallClock::time_point start = WallClock::now();
+	encfs::EncFSConfig config;
+	if(encfs::readConfig(rootDir, &config, false, "") == encfs::Config_None)
+		return false;
+	times.readConfigMs = millisecondsSince(start);
+
+	std::shared_ptr<encfs::Cipher> cipher = config.getCipher();
+	if(!cipher)
+		return false;
+	start = WallClock::now();
+	// Runs makeKey() with the password passed as the password program
+	encfs::CipherKey userKey = config.getUserKey(mountBenchmarkPassword, rootDir);
+	times.makeKeyMs = millisecondsSince(start);
+	if(!userKey)
+		return false;
+
+	start = WallClock::now();
+	encfs::CipherKey volumeKey = cipher->readKey(config.getKeyData(), userKey, true);
+	times.readKeyMs = millisecondsSince(start);
+	if(!volumeKey)
+		return false;
+
+	std::shared_ptr<encfs::EncFS_Opts> opts = mountOptions(rootDir, false);
+	std::ostringstream ostr;
+	encfs::EncFS_Context ctx;
+	ctx.opts = opts;
+	start = WallClock::now();
+	encfs::RootPtr rootInfo = encfs::initFS(&ctx, opts, ostr);
+	times.initFSMs = millisecondsSince(start);
+	if(!rootInfo)
+		return false;
+
+	start = WallClock::now();
+	encfs::DirTraverse dt = rootInfo->root->openDir("/");
+	if(!dt.valid())
+		return false;
+	int entryCount = 0;
+	while(!dt.nextPlaintextName().empty())
+		entryCount++;
+	times.firstListMs = millisecondsSince(start);
+	return entryCount >= mountBenchmarkRootEntries;
+}
+
+static void printMountPhase(std::ostream &out, const char *mode, const char *phase, std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+	double total = 0.0;
+	for(size_t i = 0; i < values.size(); i++)
+		total += values[i];
+	out << mode << ',' << phase << ',' << values.size() << ',' << std::fixed << std::setprecision(2)
+		<< values[values.size() / 2] << ',' << values.back() << ',' << total << std::endl;
+}
+
+static void printMountTimes(std::ostream &out, const char *mode, const std::vector<MountTimes> &times, double batchMs)
+{
+	std::vector<double> readConfig, makeKey, readKey, initFS, firstList;
+	for(size_t i = 0; i < times.size(); i++)
+	{
+		readConfig.push_back(times[i].readConfigMs);
+		makeKey.push_back(times[i].makeKeyMs);
+		readKey.push_back(times[i].readKeyMs);
+		initFS.push_back(times[i].initFSMs);
+		firstList.push_back(times[i].firstListMs);
+	}
+	printMountPhase(out, mode, "readConfig", readConfig);
+	printMountPhase(out, mode, "makeKey", makeKey);
+	printMountPhase(out, mode, "readKey", readKey);
+	printMountPhase(out, mode, "initFS", initFS);
+	printMountPhase(out, mode, "firstList", firstList);
+	printMountPhase(out, mode, "batch", std::vector<double>(1, batchMs));
+}
+
+/**
+ * Mounts count volumes one after the other, then all at the same time, as when
+ * many volumes are mounted at login. Creating a volume also writes its config,
+ * so the config files are in the system cache. PfmApi::MountCreate is not part
+ * of this benchmark, PFMLayer reports its duration in the statistics of a mount.
+ */
+static bool runMountBenchmark(const boost::filesystem::path &volumePath, int count, std::ostream &out)
+{
+	std::vector<std::string> rootDirs;
+	for(int i = 0; i < count; i++)
+	{
+		rootDirs.push_back((volumePath / ("volume" + std::to_string(i))).string() + "/");
+		if(!createVolume(rootDirs.back()))
+		{
+			std::cerr << "Could not create the volume " << rootDirs.back() << std::endl;
+			return false;
+		}
+	}
+
+	out << "mode,phase,mounts,median_ms,max_ms,total_ms" << std::endl;
+
+	std::vector<MountTimes> times(count);
+	WallClock::time_point start = WallClock::now();
+	for(int i = 0; i < count; i++)
+	{
+		if(!mountVolume(rootDirs[i], times[i]))
+			return false;
+	}
+	printMountTimes(out, "sequential", times, millisecondsSince(start));
+
+	std::vector<char> results(count, 0);
+	start = WallClock::now();
+	boost::thread_group threads;
+	for(int i = 0; i < count; i++)
+	{
+		threads.create_thread([&rootDirs, &times, &results, i]()
+			{ results[i] = mountVolume(rootDirs[i], times[i]) ? 1 : 0; });
+	}
+	threads.join_all();
+	double batchMs = millisecondsSince(start);
+	if(std::find(results.begin(), results.end(), 0) != results.end())
+		return false;
+	printMountTimes(out, "parallel", times, batchMs);
+	return true;
+}
+
+static void printUsage()
+{
+	std::cout << "Usage: EncFSMPBench [options]\n"
+		"  --filter=TEXT       run only the benchmarks whose name contains TEXT\n"
+		"  --min-time=MS       shortest duration of a repetition (default 200)\n"
+		"  --repetitions=N     repetitions per benchmark, the median is reported (default 5)\n"
+		"  --folder=PATH       create the temporary volume below PATH\n"
+		"  --mounts=N          measure the phases of mounting N volumes instead\n";
+}
+
+static bool parseArguments(int argc, char **argv, BenchmarkOptions &options)
+{
+	for(int i = 1; i < argc; i++)
+	{
+		std::string arg(argv[i]);
+		std::string::size_type pos = arg.find('=');
+		std::string key = arg.substr(0, pos);
+		std::string value = (pos == std::string::npos) ? std::string() : arg.substr(pos + 1);
+		if(key == "--filter")
+			options.filter = value;
+		else if(key == "--min-time")
+			options.minTimeMs = std::max(1, atoi(value.c_str()));
+		else if(key == "--repetitions")
+			options.repetitions = std::max(1, atoi(value.c_str()));
+		else if(key == "--folder")
+			options.folder = value;
+		else if(key == "--mounts")
+			options.mounts = std::max(1, atoi(value.c_str()));
+		else
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	BenchmarkOptions options;
+	if(!parseArguments(argc, argv, options))
+	{
+		printUsage();
+		return 2;
+	}
+
+	encfs::openssl_init(true);
+
+	boost::filesystem::path volumePath = options.folder.empty() ?
+		boost::filesystem::temp_directory_path() : boost::filesystem::path(options.folder);
+	volumePath /= boost::filesystem::unique_path("encfsmp-bench-%%%%-%%%%");
+	boost::filesystem::create_directories(volumePath);
+
+	int retVal = 1;
+	if(options.mounts > 0)
+		retVal = runMountBenchmark(volumePath, options.mounts, std::cout) ? 0 : 1;
+	else
+	{
+		std::shared_ptr<encfs::EncFS_Opts> opts(new encfs::EncFS_Opts());
+		opts->rootDir = volumePath.string() + "/";
+		opts->createIfNotFound = true;
+		opts->checkKey = false;
+		opts->configMode = encfs::Config_Standard;
+		opts->requireMac = true;
+		opts->noCache = true;
+		opts->passwordProgram = "benchmark";
+
+		std::ostringstream ostr;
+		encfs::EncFS_Context ctx;
+		ctx.opts = opts;
+		encfs::RootPtr rootInfo = encfs::initFS(&ctx, opts, ostr);
+		if(rootInfo)
+		{
+			ctx.setRoot(rootInfo->root);
+
+			encfs::EncFSConfig config;
+			encfs::readConfig(opts->rootDir, &config, false, "");
+			std::shared_ptr<encfs::NameIO> nameIO = encfs::NameIO::New(config.nameIface, rootInfo->cipher, rootInfo->volumeKey);
+			nameIO->setChainedNameIV(config.chainedNameIV);
+
+			FileStatCache statCache;
+			statCache.setCacheSize(1000);
+			std::vector<unsigned char> cipherBuffer(config.blockSize, 0xa5);
+			std::vector<Benchmark> benchmarks;
+			addCipherBenchmarks(benchmarks, rootInfo, cipherBuffer);
+			addNameBenchmarks(benchmarks, nameIO);
+			if(addFileBenchmarks(benchmarks, rootInfo, config, &statCache))
+			{
+				std::cout << "benchmark,iterations,repetitions,wall_ns_per_op,cpu_ns_per_op,"
+					"min_wall_ns_per_op,max_wall_ns_per_op,mb_per_s" << std::endl;
+				retVal = 0;
+				for(size_t i = 0; i < benchmarks.size() && retVal == 0; i++)
+				{
+					if(benchmarks[i].name.find(options.filter) == std::string::npos)
+						continue;
+					if(!runBenchmark(benchmarks[i], options, std::cout))
+					{
+						std::cerr << "Benchmark " << benchmarks[i].name << " failed" << std::endl;
+						retVal = 1;
+					}
+				}
+			}
+			else
+				std::cerr << "Could not create the benchmark file" << std::endl;
+			ctx.setRoot(std::shared_ptr<encfs::DirNode>());
+		}
+		else
+			std::cerr << "Could not create the volume: " << ostr.str() << std::endl;
+	}
+
+	boost::system::error_code ec;
+	boost::filesystem::remove_all(volumePath, ec);
+
+	if(encfs::PhaseTimers::enabled())
+		std::cerr << encfs::PhaseTimers::report();
+
+	encfs::openssl_shutdown(true);
+	return retVal;
+}
@@ -110,8 +110,33 @@ bool MountList::storeToConfig()
 			config->Write(EncFSMPStrings::configPasswordKey_, cur.password_);
 		config->Write(EncFSMPStrings::configUseExternalConfigFileKey_, cur.useExternalConfigFile_);
 		config->Write(EncFSMPStrings::configEnableCachingKey_, cur.enableCaching_);
+		config->Write(EncFSMPStrings::configEnableWriteBufferKey_, cur.enableWriteBuffer_);
+		config->Write(EncFSMPStrings::configMapBackingFilesKey_, cur.mapBackingFiles_);
+		config->Write(EncFSMPStrings::configUncachedSequentialIOKey_, cur.uncachedSequentialIO_);
+		config->Write(EncFSMPStrings::configFlushPolicyKey_, cur.flushPolicy_);
+		config->Write(EncFSMPStrings::configLazyExtendKey_, cur.lazyExtend_);
+		config->Write(EncFSMPStrings::configHiddenNamePatternsKey_, cur.hiddenNamePatterns_);
+		config->Write(EncFSMPStrings::configSkippedNamePatternsKey_, cur.skippedNamePatterns_);
+		config->Write(EncFSMPStrings::configStatCacheSizeKey_, cur.cacheTuning_.statCacheSize_);
+		config->Write(EncFSMPStrings::configStatCacheTimeToLiveKey_, cur.cacheTuning_.statCacheTimeToLive_);
+		config->Write(EncFSMPStrings::configBlockCacheMBKey_, cur.cacheTuning_.blockCacheMB_);
+		config->Write(EncFSMPStrings::configListingCacheKey_, cur.cacheTuning_.listingCache_);
+		config->Write(EncFSMPStrings::configReadAheadKBKey_, cur.cacheTuning_.readAheadKB_);
+		config->Write(EncFSMPStrings::configWriteBufferKBKey_, cur.cacheTuning_.writeBufferKB_);
+		config->Write(EncFSMPStrings::configThreadCountKey_, cur.cacheTuning_.threadCount_);
+		config->Write(EncFSMPStrings::configFirstBlockPrefetchKBKey_, cur.cacheTuning_.firstBlockPrefetchKB_);
+		config->Write(EncFSMPStrings::configAutoTuneKey_, cur.cacheTuning_.autoTune_);
+		config->Write(EncFSMPStrings::configMemoryBudgetMBKey_, cur.cacheTuning_.memoryBudgetMB_);
+		config->Write(EncFSMPStrings::configWatchBackingFolderKey_, cur.watchBackingFolder_);
+		config->Write(EncFSMPStrings::configTraceFileKey_, cur.traceFile_);
+		config->Write(EncFSMPStrings::configChangeJournalFileKey_, cur.changeJournalFile_);
 		config->Write(EncFSMPStrings::configIsWorldWritableKey_, cur.isWorldWritable_);
 		config->Write(EncFSMPStrings::configIsLocalDriveKey_, cur.isLocalDrive_);
+		config->Write(EncFSMPStrings::configMountAtStartupKey_, cur.mountAtStartup_);
+		config->Write(EncFSMPStrings::configMountOnDemandKey_, cur.mountOnDemand_);
+		config->Write(EncFSMPStrings::configUseNameIndexKey_, cur.useNameIndex_);
+		config->Write(EncFSMPStrings::configMountReadOnlyKey_, cur.mountReadOnly_);
+		config->Write(EncFSMPStrings::configUseCacheSnapshotKey_, cur.useCacheSnapshot_);
 
 		config->SetPath(wxT(".."));
 
@@ -144,8 +169,35 @@ bool MountList::loadFromConfig()
 		config->Read(EncFSMPStrings::configPasswordKey_, &cur.password_);
 		config->Read(EncFSMPStrings::configUseExternalConfigFileKey_, &cur.useExternalConfigFile_, false);
 		config->Read(EncFSMPStrings::configEnableCachingKey_, &cur.enableCaching_, false);
+		config->Read(EncFSMPStrings::configEnableWriteBufferKey_, &cur.enableWriteBuffer_, false);
+		config->Read(EncFSMPStrings::configMapBackingFilesKey_, &cur.mapBackingFiles_, false);
+		config->Read(EncFSMPStrings::configUncachedSequentialIOKey_, &cur.uncachedSequentialIO_, false);
+		config->Read(EncFSMPStrings::configFlushPolicyKey_, &cur.flushPolicy_, 0L);
+		config->Read(EncFSMPStrings::configLazyExtendKey_, &cur.lazyExtend_, false);
+		config->Read(EncFSMPStrings::configHiddenNamePatternsKey_, &cur.hiddenNamePatterns_);
+		config->Read(EncFSMPStrings::configSkippedNamePatternsKey_, &cur.skippedNamePatterns_);
+		// Mounts stored before the tuning existed get the defaults
+		CacheTuning &tuning = cur.cacheTuning_;
+		config->Read(EncFSMPStrings::configStatCacheSizeKey_, &tuning.statCacheSize_, tuning.statCacheSize_);
+		config->Read(EncFSMPStrings::configStatCacheTimeToLiveKey_, &tuning.statCacheTimeToLive_, tuning.statCacheTimeToLive_);
+		config->Read(EncFSMPStrings::configBlockCacheMBKey_, &tuning.blockCacheMB_, tuning.blockCacheMB_);
+		config->Read(EncFSMPStrings::configListingCacheKey_, &tuning.listingCache_, tuning.listingCache_);
+		config->Read(EncFSMPStrings::configReadAheadKBKey_, &tuning.readAheadKB_, tuning.readAheadKB_);
+		config->Read(EncFSMPStrings::configWriteBufferKBKey_, &tuning.writeBufferKB_, tuning.writeBufferKB_);
+		config->Read(EncFSMPStrings::configThreadCountKey_, &tuning.threadCount_, tuning.threadCount_);
+		config->Read(EncFSMPStrings::configFirstBlockPrefetchKBKey_, &tuning.firstBlockPrefetchKB_, tuning.firstBlockPrefetchKB_);
+		config->Read(EncFSMPStrings::configAutoTuneKey_, &tuning.autoTune_, tuning.autoTune_);
+		config->Read(EncFSMPStrings::configMemoryBudgetMBKey_, &tuning.memoryBudgetMB_, tuning.memoryBudgetMB_);
+		config->Read(EncFSMPStrings::configWatchBackingFolderKey_, &cur.watchBackingFolder_, false);
+		config->Read(EncFSMPStrings::configTraceFileKey_, &cur.traceFile_);
+		config->Read(EncFSMPStrings::configChangeJournalFileKey_, &cur.changeJournalFile_);
 		config->Read(EncFSMPStrings::configIsWorldWritableKey_, &cur.isWorldWritable_);
 		config->Read(EncFSMPStrings::configIsLocalDriveKey_, &cur.isLocalDrive_, true);
+		config->Read(EncFSMPStrings::configMountAtStartupKey_, &cur.mountAtStartup_, false);
+		config->Read(EncFSMPStrings::configMountOnDemandKey_, &cur.mountOnDemand_, false);
+		config->Read(EncFSMPStrings::configUseNameIndexKey_, &cur.useNameIndex_, false);
+		config->Read(EncFSMPStrings::configMountReadOnlyKey_, &cur.mountReadOnly_, false);
+		config->Read(EncFSMPStrings::configUseCacheSnapshotKey_, &cur.useCacheSnapshot_, false);
 
 		cur.assignedDriveLetter_ = wxEmptyString;
 		cur.mountState_ = MountEntry::MSNotMounted;
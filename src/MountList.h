@@ -22,6 +22,8 @@
 
 #include <list>
 
+#include "CacheTuning.h"
+
 /**
  * Data-only class for holding information about a mount.
  */
@@ -34,9 +36,20 @@ public:
 		MSNotMounted = 0, MSPending, MSMounted
 	};
 
+	/**
+	 * Progress of a pending mount, reported by its PFMHandlerThread.
+	 * MPUnlocking: a drive mounted on demand derives its key on the first access.
+	 */
+	enum MountProgress
+	{
+		MPNone = 0, MPQueued, MPDerivingKey, MPCreatingMount, MPUnlocking
+	};
+
 	MountEntry()
-		: isWorldWritable_(false), isLocalDrive_(true),
-		mountState_(MSNotMounted)
+		: enableWriteBuffer_(false), mapBackingFiles_(false), uncachedSequentialIO_(false),
+		flushPolicy_(0), lazyExtend_(false), watchBackingFolder_(false), isWorldWritable_(false), isLocalDrive_(true),
+		mountAtStartup_(false), mountOnDemand_(false), useNameIndex_(false), mountReadOnly_(false), useCacheSnapshot_(false),
+		mountState_(MSNotMounted), mountProgress_(MPNone)
 	{ }
 	MountEntry(const MountEntry &o) { copy(o); }
 	virtual ~MountEntry() { }
@@ -52,9 +65,26 @@ public:
 		volatilePassword_ = o.volatilePassword_;
 		useExternalConfigFile_ = o.useExternalConfigFile_;
 		enableCaching_ = o.enableCaching_;
+		enableWriteBuffer_ = o.enableWriteBuffer_;
+		mapBackingFiles_ = o.mapBackingFiles_;
+		uncachedSequentialIO_ = o.uncachedSequentialIO_;
+		flushPolicy_ = o.flushPolicy_;
+		lazyExtend_ = o.lazyExtend_;
+		hiddenNamePatterns_ = o.hiddenNamePatterns_;
+		skippedNamePatterns_ = o.skippedNamePatterns_;
+		watchBackingFolder_ = o.watchBackingFolder_;
+		traceFile_ = o.traceFile_;
+		changeJournalFile_ = o.changeJournalFile_;
+		cacheTuning_ = o.cacheTuning_;
 		isWorldWritable_ = o.isWorldWritable_;
 		isLocalDrive_ = o.isLocalDrive_;
+		mountAtStartup_ = o.mountAtStartup_;
+		mountOnDemand_ = o.mountOnDemand_;
+		useNameIndex_ = o.useNameIndex_;
+		mountReadOnly_ = o.mountReadOnly_;
+		useCacheSnapshot_ = o.useCacheSnapshot_;
 		mountState_ = o.mountState_;
+		mountProgress_ = o.mountProgress_;
 		return *this;
 	}
 	MountEntry & operator=(const MountEntry & o)
@@ -64,8 +94,21 @@ public:
 
 	wxString name_, encFSPath_, externalConfigFileName_, driveLetter_, assignedDriveLetter_, password_;
 	wxString assignedMountPoint_, volatilePassword_;	// Not persistent attributes
-	bool useExternalConfigFile_, enableCaching_, isWorldWritable_, isLocalDrive_;
+	wxString hiddenNamePatterns_, skippedNamePatterns_;	// See NameMatcher for the format
+	wxString traceFile_;	// Operations are recorded to this file if not empty, see OpTrace
+	wxString changeJournalFile_;	// Changes are appended to this file if not empty, see ChangeJournal
+	bool useExternalConfigFile_, enableCaching_, enableWriteBuffer_, mapBackingFiles_, uncachedSequentialIO_;
+	long flushPolicy_;	// When FlushFile writes out the write buffer, see PFMLayer::FlushPolicy
+	bool lazyExtend_;	// Growing a file only sets its size until it is written or closed
+	bool watchBackingFolder_, isWorldWritable_, isLocalDrive_;
+	bool mountAtStartup_;	// Mounted together with the other marked mounts when EncFSMP starts
+	bool mountOnDemand_;	// The drive appears right away, the volume key is derived on the first access
+	bool useNameIndex_;	// File names are indexed while mounted, for searching them, see NameIndex
+	bool mountReadOnly_;	// Mounted read-only, the volume is sealed and cached without expiry, see PFMLayer::setReadOnly()
+	bool useCacheSnapshot_;	// The name cache and the listings are kept from one mount to the next, see CacheSnapshot
+	CacheTuning cacheTuning_;	// Used as far as enableCaching_ allows, see CacheTuning::withCaching()
 	MountState mountState_;
+	MountProgress mountProgress_;	// Not persistent, only meaningful while mountState_ is MSPending, or MPUnlocking while MSMounted
 };
 
 
@@ -0,0 +1,282 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "NameIndex.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "EncryptedFile.h"
+
+static const char indexMagic[EncryptedFile::magicSize] = { 'E', 'F', 'S', 'I', 'N', 'D', 'E', 'X' };
+
+static char lowerAscii(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+static bool equalsIgnoreCase(char a, char b)
+{
+	return lowerAscii(a) == lowerAscii(b);
+}
+
+NameIndex::NameIndex() : isRebuilding_(false)
+{
+}
+
+NameIndex::~NameIndex()
+{
+}
+
+bool NameIndex::load(const std::string &fileName, const std::shared_ptr<encfs::Cipher> &cipher,
+	const std::shared_ptr<encfs::AbstractCipherKey> &key)
+{
+	std::string data;
+	if(!EncryptedFile::load(fileName, indexMagic, formatVersion, cipher, key, data))
+		return false;
+
+	Map index;
+	Map::iterator hint = index.end();
+	size_t pos = 0;
+	while(pos < data.size())
+	{
+		std::string path;
+		Entry entry;
+		uint8_t isFolder = 0;
+		if(!(EncryptedFile::getString(data, pos, path) && EncryptedFile::getLE(data, pos, entry.size)
+			&& EncryptedFile::getLE(data, pos, entry.mtime) && EncryptedFile::getLE(data, pos, isFolder)))
+			return false;
+		entry.isFolder = (isFolder != 0);
+		// Stored in order, each entry goes to the end
+		hint = index.insert(hint, Map::value_type(path, entry));
+	}
+
+	boost::mutex::scoped_lock lock(mutex_);
+	index_.swap(index);
+	return true;
+}
+
+bool NameIndex::save(const std::string &fileName, const std::shared_ptr<encfs::Cipher> &cipher,
+	const std::shared_ptr<encfs::AbstractCipherKey> &key)
+{
+	std::string data;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		for(Map::const_iterator iter = index_.begin(); iter != index_.end(); ++iter)
+		{
+			EncryptedFile::putString(data, iter->first);
+			EncryptedFile::putLE(data, iter->second.size);
+			EncryptedFile::putLE(data, iter->second.mtime);
+			EncryptedFile::putLE(data, static_cast<uint8_t>(iter->second.isFolder ? 1 : 0));
+		}
+	}
+	return EncryptedFile::save(fileName, indexMagic, formatVersion, cipher, key, data);
+}
+
+void NameIndex::apply(Map &index, const Change &change)
+{
+	switch(change.type)
+	{
+	case changeAdd:
+		index[change.path] = change.entry;
+		break;
+	case changeRemove:
+		index.erase(change.path);
+		break;
+	case changeRemoveContents:
+		{
+			std::string prefix = change.path + '/';
+			Map::iterator iter = index.lower_bound(prefix);
+			while(iter != index.end() && iter->first.compare(0, prefix.size(), prefix) == 0)
+				index.erase(iter++);
+		}
+		break;
+	case changeMove:
+		{
+			// The folder itself, then everything below it
+			std::vector<Map::value_type> moved;
+			Map::iterator iter = index.find(change.path);
+			if(iter != index.end())
+			{
+				moved.push_back(Map::value_type(change.newPath, iter->second));
+				index.erase(iter);
+			}
+			std::string prefix = change.path + '/';
+			iter = index.lower_bound(prefix);
+			while(iter != index.end() && iter->first.compare(0, prefix.size(), prefix) == 0)
+			{
+				moved.push_back(Map::value_type(change.newPath + iter->first.substr(change.path.size()), iter->second));
+				index.erase(iter++);
+			}
+			for(size_t i = 0; i < moved.size(); i++)
+				index[moved[i].first] = moved[i].second;
+		}
+		break;
+	case changeWritten:
+		{
+			Map::iterator iter = index.find(change.path);
+			if(iter != index.end())
+			{
+				if(change.setSize || change.entry.size > iter->second.size)
+					iter->second.size = change.entry.size;
+				iter->second.mtime = change.entry.mtime;
+			}
+		}
+		break;
+	}
+}
+
+void NameIndex::record(const Change &change)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	apply(index_, change);
+	if(isRebuilding_)
+		rebuildChanges_.push_back(change);
+}
+
+void NameIndex::add(const std::string &plainPath, const Entry &entry)
+{
+	Change change;
+	change.type = changeAdd;
+	change.path = plainPath;
+	change.entry = entry;
+	change.setSize = false;
+	record(change);
+}
+
+void NameIndex::remove(const std::string &plainPath)
+{
+	Change change;
+	change.type = changeRemove;
+	change.path = plainPath;
+	change.setSize = false;
+	record(change);
+}
+
+void NameIndex::removeContents(const std::string &folderPath)
+{
+	Change change;
+	change.type = changeRemoveContents;
+	change.path = folderPath;
+	change.setSize = false;
+	record(change);
+}
+
+void NameIndex::move(const std::string &oldPath, const std::string &newPath)
+{
+	Change change;
+	change.type = changeMove;
+	change.path = oldPath;
+	change.newPath = newPath;
+	change.setSize = false;
+	record(change);
+}
+
+/**
+ * A write up to size, or a change of the size to size if setSize.
+ */
+void NameIndex::written(const std::string &plainPath, int64_t size, int64_t mtime, bool setSize)
+{
+	Change change;
+	change.type = changeWritten;
+	change.path = plainPath;
+	change.entry.size = size;
+	change.entry.mtime = mtime;
+	change.setSize = setSize;
+	record(change);
+}
+
+bool NameIndex::search(const std::string &query, size_t maxHits, std::vector<Hit> &hits) const
+{
+	hits.clear();
+	if(query.empty())
+		return true;
+
+	boost::mutex::scoped_lock lock(mutex_);
+	if(query[0] == '/')
+	{
+		// Prefix of the path, the map is sorted case-sensitively
+		for(Map::const_iterator iter = index_.lower_bound(query);
+			iter != index_.end() && iter->first.compare(0, query.size(), query) == 0; ++iter)
+		{
+			if(hits.size() >= maxHits)
+				return false;
+			Hit hit;
+			hit.plainPath = iter->first;
+			hit.entry = iter->second;
+			hits.push_back(hit);
+		}
+		return true;
+	}
+
+	for(Map::const_iterator iter = index_.begin(); iter != index_.end(); ++iter)
+	{
+		const std::string &path = iter->first;
+		std::string::const_iterator nameStart = path.begin() + (path.rfind('/') + 1);
+		if(std::search(nameStart, path.end(), query.begin(), query.end(), equalsIgnoreCase) == path.end())
+			continue;
+		if(hits.size() >= maxHits)
+			return false;
+		Hit hit;
+		hit.plainPath = path;
+		hit.entry = iter->second;
+		hits.push_back(hit);
+	}
+	return true;
+}
+
+size_t NameIndex::size() const
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	return index_.size();
+}
+
+bool NameIndex::isRebuilding() const
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	return isRebuilding_;
+}
+
+void NameIndex::beginRebuild()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	isRebuilding_ = true;
+	rebuildChanges_.clear();
+}
+
+void NameIndex::endRebuild(Map &freshIndex)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	// Changes during the walk may or may not be part of freshIndex already,
+	// applying them again gives the same result
+	for(size_t i = 0; i < rebuildChanges_.size(); i++)
+		apply(freshIndex, rebuildChanges_[i]);
+	index_.swap(freshIndex);
+	isRebuilding_ = false;
+	rebuildChanges_.clear();
+}
+
+void NameIndex::cancelRebuild()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	isRebuilding_ = false;
+	rebuildChanges_.clear();
+}
@@ -0,0 +1,137 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef NAMEINDEX_H
+#define NAMEINDEX_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/thread/mutex.hpp>
+
+namespace encfs
+{
+	class Cipher;
+	class AbstractCipherKey;
+}
+
+/**
+ * Index of the plaintext paths of a mounted volume, for searching it by name
+ * without listing and decoding every folder.
+ *
+ * The index is kept up to date by the changes made through the mount. It is
+ * stored encrypted with the volume key next to the configuration of the
+ * volume, so that it is available right after the next mount. As the volume
+ * may have been changed elsewhere meanwhile, a fresh index is built in the
+ * background after each mount (see beginRebuild()); searches use the stored
+ * one until then.
+ *
+ * The file is an EncryptedFile with the magic "EFSINDEX", its payload is the
+ * list of entries.
+ */
+class NameIndex
+{
+public:
+	struct Entry
+	{
+		Entry() : size(0), mtime(0), isFolder(false) { }
+
+		int64_t size;		// Plaintext size
+		int64_t mtime;		// Seconds since 1970
+		bool isFolder;
+	};
+
+	struct Hit
+	{
+		std::string plainPath;
+		Entry entry;
+	};
+
+	typedef std::map<std::string, Entry> Map;	// By plaintext path
+
+	NameIndex();
+	virtual ~NameIndex();
+
+	/**
+	 * Replaces the index by the one stored in fileName. Returns false if there
+	 * is none, or if it was written with another key or is damaged.
+	 */
+	bool load(const std::string &fileName, const std::shared_ptr<encfs::Cipher> &cipher,
+		const std::shared_ptr<encfs::AbstractCipherKey> &key);
+	bool save(const std::string &fileName, const std::shared_ptr<encfs::Cipher> &cipher,
+		const std::shared_ptr<encfs::AbstractCipherKey> &key);
+
+	// Changes made through the mount
+	void add(const std::string &plainPath, const Entry &entry);
+	void remove(const std::string &plainPath);
+	void removeContents(const std::string &folderPath);	// Everything below the folder
+	void move(const std::string &oldPath, const std::string &newPath);	// With the contents of folders
+	void written(const std::string &plainPath, int64_t size, int64_t mtime, bool setSize);
+
+	/**
+	 * Paths starting with query if it starts with '/', otherwise paths whose
+	 * file name contains query. Letters are compared case-insensitively.
+	 * Returns false if more than maxHits paths matched.
+	 */
+	bool search(const std::string &query, size_t maxHits, std::vector<Hit> &hits) const;
+
+	size_t size() const;
+	bool isRebuilding() const;
+
+	/**
+	 * Between beginRebuild() and endRebuild(), the changes are also recorded
+	 * and applied again to the fresh index, which was built from the volume
+	 * at the same time.
+	 */
+	void beginRebuild();
+	void endRebuild(Map &freshIndex);
+	void cancelRebuild();
+
+private:
+	NameIndex(const NameIndex &o) = delete;
+	NameIndex & operator=(const NameIndex & o) = delete;
+
+	enum ChangeType
+	{
+		changeAdd, changeRemove, changeRemoveContents, changeMove, changeWritten
+	};
+
+	struct Change
+	{
+		ChangeType type;
+		std::string path, newPath;
+		Entry entry;
+		bool setSize;
+	};
+
+	static void apply(Map &index, const Change &change);
+	void record(const Change &change);
+
+	static const uint32_t formatVersion = 2;	// 2: the IVs of the pieces don't overlap
+
+	mutable boost::mutex mutex_;
+	Map index_;
+	bool isRebuilding_;
+	std::vector<Change> rebuildChanges_;
+};
+
+#endif
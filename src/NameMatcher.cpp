@@ -0,0 +1,136 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "NameMatcher.h"
+
+#include <cstring>
+
+NameMatcher::NameMatcher()
+{
+}
+
+NameMatcher::~NameMatcher()
+{
+}
+
+void NameMatcher::setPatterns(const std::string &patterns)
+{
+	rootSet_.clear();
+	anySet_.clear();
+
+	size_t start = 0;
+	while(start <= patterns.length())
+	{
+		size_t end = patterns.find(';', start);
+		if(end == std::string::npos)
+			end = patterns.length();
+		std::string pattern = patterns.substr(start, end - start);
+		start = end + 1;
+
+		if(pattern.empty())
+			continue;
+		if(pattern[0] == '/')
+		{
+			if(pattern.length() > 1)
+				rootSet_.add(pattern.substr(1));
+		}
+		else
+			anySet_.add(pattern);
+	}
+}
+
+bool NameMatcher::matches(const std::string &path) const
+{
+	size_t slashPos = path.rfind('/');
+	size_t nameStart = (slashPos == std::string::npos) ? 0 : slashPos + 1;
+	const char *name = path.c_str() + nameStart;
+	size_t length = path.length() - nameStart;
+	if(length == 0)
+		return false;
+
+	if(anySet_.matches(name, length))
+		return true;
+	// Files in the root folder have no other separator
+	return (slashPos == 0 || slashPos == std::string::npos)
+		&& rootSet_.matches(name, length);
+}
+
+NameMatcher::PatternSet::PatternSet()
+{
+	clear();
+}
+
+void NameMatcher::PatternSet::clear()
+{
+	names_.clear();
+	wildcards_.clear();
+	memset(firstChars_, 0, sizeof(firstChars_));
+	memset(lastChars_, 0, sizeof(lastChars_));
+	matchAll_ = false;
+}
+
+void NameMatcher::PatternSet::add(const std::string &pattern)
+{
+	size_t starPos = pattern.find('*');
+	if(starPos == std::string::npos)
+	{
+		names_.insert(pattern);
+		firstChars_[static_cast<unsigned char>(pattern[0])] = true;
+		return;
+	}
+
+	// Further '*' are compared literally
+	WildcardPattern wildcard;
+	wildcard.prefix_ = pattern.substr(0, starPos);
+	wildcard.suffix_ = pattern.substr(starPos + 1);
+	if(!wildcard.prefix_.empty())
+		firstChars_[static_cast<unsigned char>(wildcard.prefix_[0])] = true;
+	else if(!wildcard.suffix_.empty())
+		lastChars_[static_cast<unsigned char>(wildcard.suffix_[wildcard.suffix_.length() - 1])] = true;
+	else
+		matchAll_ = true;
+	wildcards_.push_back(wildcard);
+}
+
+bool NameMatcher::PatternSet::matches(const char *name, size_t length) const
+{
+	if(matchAll_)
+		return true;
+	bool first = firstChars_[static_cast<unsigned char>(name[0])];
+	bool last = lastChars_[static_cast<unsigned char>(name[length - 1])];
+	if(!first && !last)
+		return false;
+
+	if(first && !names_.empty()
+		&& names_.find(std::string(name, length)) != names_.end())
+		return true;
+
+	for(size_t i = 0; i < wildcards_.size(); i++)
+	{
+		const WildcardPattern &wildcard = wildcards_[i];
+		size_t prefixLength = wildcard.prefix_.length();
+		size_t suffixLength = wildcard.suffix_.length();
+		if(prefixLength + suffixLength > length)
+			continue;
+		if(memcmp(name, wildcard.prefix_.c_str(), prefixLength) == 0
+			&& memcmp(name + length - suffixLength, wildcard.suffix_.c_str(), suffixLength) == 0)
+			return true;
+	}
+	return false;
+}
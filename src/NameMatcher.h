@@ -0,0 +1,83 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef NAMEMATCHER_H
+#define NAMEMATCHER_H
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Matches file names against a list of patterns, e.g. for the files which
+ * are hidden or skipped in listings.
+ *
+ * The patterns are separated by ';'. A pattern matches the file name without
+ * the folder, and may contain one '*' which matches any number of characters,
+ * e.g. "desktop.ini;~$*;*.tmp". A pattern starting with '/' only matches files
+ * in the root folder. Names are compared case-sensitively.
+ *
+ * The patterns are compiled once, a check looks at the file name only once
+ * and usually rejects it after looking up its first and last characters.
+ */
+class NameMatcher
+{
+public:
+	NameMatcher();
+	virtual ~NameMatcher();
+
+	void setPatterns(const std::string &patterns);
+	bool isEmpty() const { return rootSet_.isEmpty() && anySet_.isEmpty(); }
+
+	/**
+	 * Returns true if the file name of path matches one of the patterns.
+	 * path is the full path in the volume, with '/' separators.
+	 */
+	bool matches(const std::string &path) const;
+
+private:
+	struct WildcardPattern
+	{
+		std::string prefix_, suffix_;	// The parts before and after the '*'
+	};
+
+	class PatternSet
+	{
+	public:
+		PatternSet();
+
+		void clear();
+		void add(const std::string &pattern);
+		bool isEmpty() const { return names_.empty() && wildcards_.empty(); }
+		bool matches(const char *name, size_t length) const;
+
+	private:
+		std::unordered_set<std::string> names_;	// Patterns without '*'
+		std::vector<WildcardPattern> wildcards_;
+		// Possible first characters of names_ and the prefixes, and possible
+		// last characters of the suffixes of patterns without prefix
+		bool firstChars_[256], lastChars_[256];
+		bool matchAll_;		// There is a pattern "*"
+	};
+
+	PatternSet rootSet_;	// Patterns for the root folder only
+	PatternSet anySet_;
+};
+
+#endif
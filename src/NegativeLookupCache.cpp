@@ -0,0 +1,129 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "NegativeLookupCache.h"
+
+NegativeLookupCache::NegativeLookupCache() : cacheSize_(0), timeToLive_(2000), hits_(0)
+{
+}
+
+NegativeLookupCache::~NegativeLookupCache()
+{
+}
+
+void NegativeLookupCache::clearCache()
+{
+	cache_.clear();
+}
+
+void NegativeLookupCache::setCacheSize(int cacheSize)
+{
+	cacheSize_ = cacheSize;
+	if(cacheSize_ <= 0)
+		cache_.clear();
+}
+
+bool NegativeLookupCache::isMissing(const std::string &path)
+{
+	NegativeLookupCacheType::iterator iter = cache_.find(path);
+	if(iter == cache_.end())
+		return false;
+
+	if(iter->second <= std::chrono::steady_clock::now())
+	{
+		cache_.erase(iter);
+		return false;
+	}
+
+	hits_++;
+	return true;
+}
+
+void NegativeLookupCache::addMissing(const std::string &path)
+{
+	if(cacheSize_ <= 0)
+		return;
+
+	TimePoint now = std::chrono::steady_clock::now();
+	if(cache_.find(path) == cache_.end()
+		&& static_cast<int>(cache_.size()) >= cacheSize_)
+		evictOne(now);
+
+	if(timeToLive_.count() > 0)
+		cache_[path] = now + timeToLive_;
+	else
+		cache_[path] = TimePoint::max();
+}
+
+void NegativeLookupCache::forgetFolder(const std::string &dirPath)
+{
+	std::string prefix(dirPath);
+	if(prefix.empty() || prefix[prefix.length() - 1] != '/')
+		prefix += '/';
+
+	NegativeLookupCacheType::iterator iter = cache_.lower_bound(prefix);
+	while(iter != cache_.end()
+		&& iter->first.compare(0, prefix.length(), prefix) == 0)
+	{
+		// Keep the entries in subfolders
+		if(iter->first.find('/', prefix.length()) == std::string::npos)
+			iter = cache_.erase(iter);
+		else
+			iter++;
+	}
+}
+
+void NegativeLookupCache::forgetTree(const std::string &path)
+{
+	cache_.erase(path);
+
+	std::string prefix(path);
+	if(prefix.empty() || prefix[prefix.length() - 1] != '/')
+		prefix += '/';
+
+	NegativeLookupCacheType::iterator iter = cache_.lower_bound(prefix);
+	while(iter != cache_.end()
+		&& iter->first.compare(0, prefix.length(), prefix) == 0)
+		iter = cache_.erase(iter);
+}
+
+/**
+ * Evicts the entry which expires first. All entries have the same time to
+ * live, so this is the oldest one.
+ */
+void NegativeLookupCache::evictOne(const TimePoint &now)
+{
+	NegativeLookupCacheType::iterator iterEvict = cache_.begin();
+	NegativeLookupCacheType::iterator iterCheck = cache_.begin();
+	while(iterCheck != cache_.end())
+	{
+		// Expired entries can go right away
+		if(iterCheck->second <= now)
+		{
+			cache_.erase(iterCheck);
+			return;
+		}
+		if(iterCheck->second < iterEvict->second)
+			iterEvict = iterCheck;
+
+		iterCheck++;
+	}
+	if(iterEvict != cache_.end())
+		cache_.erase(iterEvict);
+}
@@ -0,0 +1,87 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef NEGATIVELOOKUPCACHE_H
+#define NEGATIVELOOKUPCACHE_H
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <stdint.h>
+
+/**
+ * This class remembers plaintext paths which were found not to exist.
+ *
+ * Windows probes for many files which don't exist (desktop.ini, thumbs.db,
+ * DLLs along the search path). Every probe encodes the path and asks the
+ * file system, so repeated misses are answered from here. The entries
+ * expire after a short time, as the backing folder may change behind our back.
+ */
+class NegativeLookupCache
+{
+public:
+	NegativeLookupCache();
+	virtual ~NegativeLookupCache();
+
+	void clearCache();
+
+	void setCacheSize(int cacheSize);
+	int getCachesize() const { return cacheSize_; }
+
+	/**
+	 * With 0, entries never expire, for volumes which don't change.
+	 */
+	void setTimeToLive(std::chrono::milliseconds timeToLive) { timeToLive_ = timeToLive; }
+
+	/**
+	 * Returns true if path was recently found not to exist.
+	 */
+	bool isMissing(const std::string &path);
+
+	void addMissing(const std::string &path);
+
+	/**
+	 * Forgets the entries of all files directly in folder dirPath,
+	 * after something was created in it.
+	 */
+	void forgetFolder(const std::string &dirPath);
+
+	/**
+	 * Forgets path and all entries below it, after something was moved there.
+	 */
+	void forgetTree(const std::string &path);
+
+	uint64_t getHits() const { return hits_; }
+
+private:
+	typedef std::chrono::steady_clock::time_point TimePoint;
+	typedef std::map<std::string, TimePoint> NegativeLookupCacheType;	// Path -> expiry time
+	NegativeLookupCacheType cache_;
+
+	void evictOne(const TimePoint &now);
+
+	int cacheSize_;
+	std::chrono::milliseconds timeToLive_;
+	std::atomic<uint64_t> hits_;
+};
+
+#endif
@@ -0,0 +1,151 @@
+/**
+ * Copyright (C) 2026 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "OpTrace.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const char traceMagic[8] = { 'E', 'F', 'S', 'T', 'R', 'A', 'C', 'E' };
+
+// The buffer is written to the file when it gets larger than this
+static const size_t traceFlushSize = 64 * 1024;
+
+template<typename T> static void putLE(std::vector<char> &buf, T value)
+{
+	for(size_t i = 0; i < sizeof(T); i++)
+		buf.push_back(static_cast<char>(static_cast<uint64_t>(value) >> (8 * i)));
+}
+
+template<typename T> static bool getLE(std::istream &in, T &value)
+{
+	unsigned char bytes[sizeof(T)];
+	if(!in.read(reinterpret_cast<char *>(bytes), sizeof(T)))
+		return false;
+	uint64_t v = 0;
+	for(size_t i = 0; i < sizeof(T); i++)
+		v |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+	value = static_cast<T>(v);
+	return true;
+}
+
+OpTrace::OpTrace() : isOpen_(false)
+{
+}
+
+OpTrace::~OpTrace()
+{
+	close();
+}
+
+bool OpTrace::open(const boost::filesystem::path &fileName)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	out_.open(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+	if(!out_)
+		return false;
+
+	buffer_.clear();
+	buffer_.reserve(traceFlushSize + 4096);
+	buffer_.insert(buffer_.end(), traceMagic, traceMagic + sizeof(traceMagic));
+	putLE(buffer_, formatVersion);
+	traceStartTime_ = std::chrono::steady_clock::now();
+	isOpen_ = true;
+	return true;
+}
+
+void OpTrace::close()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	if(!isOpen_)
+		return;
+
+	isOpen_ = false;
+	flush();
+	out_.close();
+}
+
+void OpTrace::write(Record &record, std::chrono::steady_clock::time_point startTime)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	boost::mutex::scoped_lock lock(mutex_);
+	if(!isOpen_)
+		return;
+
+	// Operations started before the trace are recorded as starting with it
+	if(startTime < traceStartTime_)
+		startTime = traceStartTime_;
+	record.startMicros = static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::microseconds>(startTime - traceStartTime_).count());
+	record.durationMicros = static_cast<uint32_t>(
+		std::chrono::duration_cast<std::chrono::microseconds>(now - startTime).count());
+
+	size_t pathLength = std::min(record.path.length(), static_cast<size_t>(0xffff));
+	putLE(buffer_, record.op);
+	putLE(buffer_, record.fileType);
+	putLE(buffer_, record.result);
+	putLE(buffer_, record.openId);
+	putLE(buffer_, record.resultOpenId);
+	putLE(buffer_, record.offset);
+	putLE(buffer_, record.size);
+	putLE(buffer_, record.bytes);
+	putLE(buffer_, record.startMicros);
+	putLE(buffer_, record.durationMicros);
+	putLE(buffer_, static_cast<uint16_t>(pathLength));
+	buffer_.insert(buffer_.end(), record.path.begin(), record.path.begin() + pathLength);
+
+	if(buffer_.size() >= traceFlushSize)
+		flush();
+}
+
+// Requires the lock
+void OpTrace::flush()
+{
+	if(!buffer_.empty())
+	{
+		out_.write(&buffer_[0], buffer_.size());
+		out_.flush();
+		buffer_.clear();
+	}
+}
+
+bool OpTrace::readHeader(std::istream &in)
+{
+	char magic[sizeof(traceMagic)];
+	uint32_t version = 0;
+	if(!in.read(magic, sizeof(magic)) || memcmp(magic, traceMagic, sizeof(magic)) != 0)
+		return false;
+	return getLE(in, version) && version == formatVersion;
+}
+
+bool OpTrace::read(std::istream &in, Record &record)
+{
+	uint16_t pathLength = 0;
+	if(!(getLE(in, record.op) && getLE(in, record.fileType) && getLE(in, record.result)
+		&& getLE(in, record.openId) && getLE(in, record.resultOpenId) && getLE(in, record.offset)
+		&& getLE(in, record.size) && getLE(in, record.bytes) && getLE(in, record.startMicros)
+		&& getLE(in, record.durationMicros) && getLE(in, pathLength)))
+		return false;
+
+	record.path.resize(pathLength);
+	if(pathLength > 0 && !in.read(&record.path[0], pathLength))
+		return false;
+	return true;
+}
@@ -0,0 +1,103 @@
+/**
+ * Copyright (C) 2026 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef OPTRACE_H
+#define OPTRACE_H
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <istream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/thread/mutex.hpp>
+
+/**
+ * Binary trace of the operations of the PFM formatter.
+ *
+ * Every completed operation is appended as a record with its type, open id,
+ * offset, size and timing, and the plain path where the operation has one.
+ * A trace of a real workload can be replayed against a test volume by
+ * EncFSMPTest (see TestTraceReplay), to reproduce performance problems.
+ *
+ * The file starts with the magic "EFSTRACE" and a 32 bit format version, all
+ * numbers are stored little endian.
+ */
+class OpTrace
+{
+public:
+	enum FileType
+	{
+		fileTypeNone = 0, fileTypeFile, fileTypeFolder
+	};
+
+	struct Record
+	{
+		Record() : op(0), fileType(fileTypeNone), result(0), openId(0), resultOpenId(0),
+			offset(0), size(0), bytes(0), startMicros(0), durationMicros(0) { }
+
+		uint8_t op;				// FormatterStats::Operation
+		uint8_t fileType;		// Of the opened file, for Open and Move
+		int32_t result;			// PFM error code, 0 on success
+		int64_t openId;			// Open id the operation refers to
+		int64_t resultOpenId;	// Open id returned by Open, Replace and Move
+		int64_t offset;			// File offset of Read and Write, new size of SetSize
+		uint64_t size;			// Requested size of Read and Write
+		uint64_t bytes;			// Transferred bytes
+		uint64_t startMicros;	// Since the start of the trace
+		uint32_t durationMicros;
+		std::string path;		// UTF-8, for Open (opened path) and Move (new path)
+	};
+
+	OpTrace();
+	virtual ~OpTrace();
+
+	bool open(const boost::filesystem::path &fileName);
+	void close();
+	bool isOpen() const { return isOpen_.load(std::memory_order_relaxed); }
+
+	/**
+	 * Appends a record, timed from startTime to now.
+	 */
+	void write(Record &record, std::chrono::steady_clock::time_point startTime);
+
+	// For reading a trace: call readHeader() once, then read() until it returns false
+	static bool readHeader(std::istream &in);
+	static bool read(std::istream &in, Record &record);
+
+private:
+	OpTrace(const OpTrace &o) = delete;
+	OpTrace & operator=(const OpTrace & o) = delete;
+
+	void flush();
+
+	static const uint32_t formatVersion = 1;
+
+	boost::mutex mutex_;
+	boost::filesystem::ofstream out_;
+	std::vector<char> buffer_;		// Written to out_ in large chunks
+	std::atomic<bool> isOpen_;
+	std::chrono::steady_clock::time_point traceStartTime_;
+};
+
+#endif
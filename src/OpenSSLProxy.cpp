@@ -22,20 +22,28 @@
 #include <openssl/ssl.h>
 #include <openssl/engine.h>
 
+// libencfs
+#include "openssl.h"
+
+/**
+ * Uses the initialization of libencfs, which also installs the locking
+ * callbacks that OpenSSL before 1.1 needs when several volumes are mounted
+ * or coded in parallel, and fetches the ciphers and digests of the volumes
+ * from the OpenSSL 3 providers once.
+ */
 void OpenSSLProxy::initialize()
 {
-	SSL_load_error_strings();
-	SSL_library_init();
-
-	ENGINE_load_builtin_engines();
-	ENGINE_register_all_ciphers();
-	ENGINE_register_all_digests();
-	ENGINE_register_all_RAND();
+	encfs::openssl_init(true);
 }
 
 void OpenSSLProxy::uninitialize()
 {
-	ENGINE_cleanup();
+	encfs::openssl_shutdown(true);
 
 	ERR_free_strings();
 }
+
+std::string OpenSSLProxy::getReport()
+{
+	return encfs::openssl_report();
+}
@@ -20,12 +20,17 @@
 #ifndef OPENSSLPROXY_H
 #define OPENSSLPROXY_H
 
+#include <string>
+
 class OpenSSLProxy
 {
 public:
 	static void initialize();
 	static void uninitialize();
 
+	// Version of OpenSSL and the AES implementation it uses, for the error log
+	static std::string getReport();
+
 private:
 	OpenSSLProxy() { }
 	~OpenSSLProxy() { }
@@ -0,0 +1,172 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "PFMDispatchPool.h"
+
+// Reads of at least this size, and writes of any size, are bulk ops
+static const size_t bulkReadMinSize = 64 * 1024;
+// Jobs started per turn of the queues
+static const int metadataWeight = 4;
+static const int smallReadWeight = 2;
+
+PFMDispatchPool::PFMDispatchPool(PfmFormatterDispatch *target) :
+	target_(target),
+	metadataQueue_(SharedExecutor::PriorityForeground),
+	smallReadQueue_(SharedExecutor::PriorityForeground),
+	bulkQueue_(SharedExecutor::PriorityForeground)
+{
+	metadataQueue_.setWeight(metadataWeight);
+	smallReadQueue_.setWeight(smallReadWeight);
+}
+
+PFMDispatchPool::~PFMDispatchPool()
+{
+	stop();
+}
+
+void PFMDispatchPool::start(int threadCount)
+{
+	openQueues(threadCount);
+}
+
+void PFMDispatchPool::setThreadCount(int threadCount)
+{
+	openQueues(threadCount);
+}
+
+void PFMDispatchPool::openQueues(int threadCount)
+{
+	metadataQueue_.open(threadCount);
+	smallReadQueue_.open(threadCount);
+	// Keep a thread for browsing while files are copied
+	bulkQueue_.open(threadCount > 1 ? threadCount - 1 : threadCount);
+}
+
+/**
+ * Waits until all queued ops are completed.
+ */
+void PFMDispatchPool::stop()
+{
+	metadataQueue_.close();
+	smallReadQueue_.close();
+	bulkQueue_.close();
+}
+
+void PFMDispatchPool::post(SharedExecutor::Queue &queue, const JobType &job)
+{
+	// Every op must be completed, run it here if the pool is stopped already
+	if(!queue.post(job))
+		job();
+}
+
+void CCALL PFMDispatchPool::Open(PfmMarshallerOpenOp* op, void* formatterUse)
+{
+	post(metadataQueue_, [=]() { target_->Open(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::Replace(PfmMarshallerReplaceOp* op, void* formatterUse)
+{
+	post(metadataQueue_, [=]() { target_->Replace(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::Move(PfmMarshallerMoveOp* op, void* formatterUse)
+{
+	post(metadataQueue_, [=]() { target_->Move(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::MoveReplace(PfmMarshallerMoveReplaceOp* op, void* formatterUse)
+{
+	post(metadataQueue_, [=]() { target_->MoveReplace(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::Delete(PfmMarshallerDeleteOp* op, void* formatterUse)
+{
+	post(metadataQueue_, [=]() { target_->Delete(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::Close(PfmMarshallerCloseOp* op, void* formatterUse)
+{
+	post(metadataQueue_, [=]() { target_->Close(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::FlushFile(PfmMarshallerFlushFileOp* op, void* formatterUse)
+{
+	post(bulkQueue_, [=]() { target_->FlushFile(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::List(PfmMarshallerListOp* op, void* formatterUse)
+{
+	post(metadataQueue_, [=]() { target_->List(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::ListEnd(PfmMarshallerListEndOp* op, void* formatterUse)
+{
+	post(metadataQueue_, [=]() { target_->ListEnd(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::Read(PfmMarshallerReadOp* op, void* formatterUse)
+{
+	SharedExecutor::Queue &queue = (op->RequestedSize() >= bulkReadMinSize) ? bulkQueue_ : smallReadQueue_;
+	post(queue, [=]() { target_->Read(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::Write(PfmMarshallerWriteOp* op, void* formatterUse)
+{
+	post(bulkQueue_, [=]() { target_->Write(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::SetSize(PfmMarshallerSetSizeOp* op, void* formatterUse)
+{
+	post(bulkQueue_, [=]() { target_->SetSize(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::Capacity(PfmMarshallerCapacityOp* op, void* formatterUse)
+{
+	post(metadataQueue_, [=]() { target_->Capacity(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::FlushMedia(PfmMarshallerFlushMediaOp* op, void* formatterUse)
+{
+	post(bulkQueue_, [=]() { target_->FlushMedia(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::Control(PfmMarshallerControlOp* op, void* formatterUse)
+{
+	post(metadataQueue_, [=]() { target_->Control(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::MediaInfo(PfmMarshallerMediaInfoOp* op, void* formatterUse)
+{
+	post(metadataQueue_, [=]() { target_->MediaInfo(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::Access(PfmMarshallerAccessOp* op, void* formatterUse)
+{
+	post(metadataQueue_, [=]() { target_->Access(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::ReadXattr(PfmMarshallerReadXattrOp* op, void* formatterUse)
+{
+	post(metadataQueue_, [=]() { target_->ReadXattr(op, formatterUse); });
+}
+
+void CCALL PFMDispatchPool::WriteXattr(PfmMarshallerWriteXattrOp* op, void* formatterUse)
+{
+	post(metadataQueue_, [=]() { target_->WriteXattr(op, formatterUse); });
+}
@@ -0,0 +1,96 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PFMDISPATCHPOOL_H
+#define PFMDISPATCHPOOL_H
+
+#include <boost/function.hpp>
+
+#include "pfm_layer.h"
+#include "SharedExecutor.h"
+
+/**
+ * Dispatches PFM operations to the worker threads of the SharedExecutor.
+ *
+ * The marshaller calls the dispatch methods from its single serve thread.
+ * Every op is queued and handed to the target dispatch on one of the
+ * worker threads, which completes it with op->Complete().
+ * This way, a slow read of one file does not block the other files on the
+ * same drive.
+ *
+ * The ops are classified into three queues, so that a copy of big files does
+ * not hold up browsing the drive: the metadata ops (open, list, close, ...),
+ * small reads, and the bulk ops writing or reading the data of files. The
+ * first two get more jobs started per turn (see SharedExecutor::Queue::setWeight()),
+ * and the bulk ops leave one thread to them. Ops on the data of one file
+ * stay in one queue, and are started in the order they arrive. Work done in
+ * advance, like the read-ahead, runs in background queues of its own.
+ */
+class PFMDispatchPool: public PfmFormatterDispatch
+{
+public:
+	PFMDispatchPool(PfmFormatterDispatch *target);
+	virtual ~PFMDispatchPool();
+
+	/**
+	 * Runs at most threadCount ops of each queue at the same time.
+	 */
+	void start(int threadCount);
+	void stop();
+
+	/**
+	 * Changes the number of ops run at the same time while started.
+	 */
+	void setThreadCount(int threadCount);
+
+	// PfmFormatterDispatch
+	void CCALL Open(PfmMarshallerOpenOp* op, void* formatterUse);
+	void CCALL Replace(PfmMarshallerReplaceOp* op, void* formatterUse);
+	void CCALL Move(PfmMarshallerMoveOp* op, void* formatterUse);
+	void CCALL MoveReplace(PfmMarshallerMoveReplaceOp* op, void* formatterUse);
+	void CCALL Delete(PfmMarshallerDeleteOp* op, void* formatterUse);
+	void CCALL Close(PfmMarshallerCloseOp* op, void* formatterUse);
+	void CCALL FlushFile(PfmMarshallerFlushFileOp* op, void* formatterUse);
+	void CCALL List(PfmMarshallerListOp* op, void* formatterUse);
+	void CCALL ListEnd(PfmMarshallerListEndOp* op, void* formatterUse);
+	void CCALL Read(PfmMarshallerReadOp* op, void* formatterUse);
+	void CCALL Write(PfmMarshallerWriteOp* op, void* formatterUse);
+	void CCALL SetSize(PfmMarshallerSetSizeOp* op, void* formatterUse);
+	void CCALL Capacity(PfmMarshallerCapacityOp* op, void* formatterUse);
+	void CCALL FlushMedia(PfmMarshallerFlushMediaOp* op, void* formatterUse);
+	void CCALL Control(PfmMarshallerControlOp* op, void* formatterUse);
+	void CCALL MediaInfo(PfmMarshallerMediaInfoOp* op, void* formatterUse);
+	void CCALL Access(PfmMarshallerAccessOp* op, void* formatterUse);
+	void CCALL ReadXattr(PfmMarshallerReadXattrOp* op, void* formatterUse);
+	void CCALL WriteXattr(PfmMarshallerWriteXattrOp* op, void* formatterUse);
+
+private:
+	typedef boost::function<void ()> JobType;
+
+	void post(SharedExecutor::Queue &queue, const JobType &job);
+	void openQueues(int threadCount);
+
+	PfmFormatterDispatch *target_;
+
+	SharedExecutor::Queue metadataQueue_;
+	SharedExecutor::Queue smallReadQueue_;
+	SharedExecutor::Queue bulkQueue_;
+};
+
+#endif
@@ -46,14 +46,76 @@
 #include "NullNameIO.h"
 #include "Context.h"
 
+#include <algorithm>
+
 // boost
 #include <boost/locale.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/thread.hpp>
+
+// Backing file descriptors kept open after close, for files opened again soon
+static const int descriptorPoolSize = 64;
+// Handles of backing folders, files in them are opened by their name only
+static const int dirHandleCacheSize = 64;
+// Free memory pool blocks kept for reuse by all mounts, the rest is returned to the heap
+static const size_t memoryPoolMaxFreeBytes = 32 * 1024 * 1024;
+
+// Mounts reading their configuration and deriving the volume key at the moment
+static boost::mutex keyDerivationMutex;
+static boost::condition_variable keyDerivationFinished;
+static int keyDerivationCount = 0;
+
+/**
+ * Waits until fewer mounts than there are cores derive their key, and holds
+ * the slot until destroyed.
+ */
+class KeyDerivationSlot
+{
+public:
+	KeyDerivationSlot()
+	{
+		boost::unique_lock<boost::mutex> lock(keyDerivationMutex);
+		int maxCount = std::max(1, static_cast<int>(boost::thread::hardware_concurrency()));
+		while(keyDerivationCount >= maxCount)
+			keyDerivationFinished.wait(lock);
+		keyDerivationCount++;
+	}
+
+	~KeyDerivationSlot()
+	{
+		{
+			boost::lock_guard<boost::mutex> lock(keyDerivationMutex);
+			keyDerivationCount--;
+		}
+		keyDerivationFinished.notify_one();
+	}
+};
+
+static EncFSMPMainFrame *getMainFrame()
+{
+	EncFSMPMainFrame *pMainFrame = NULL;
+	wxWindow *pTopWindow = wxTheApp->GetTopWindow();
+	if(pTopWindow != NULL)
+	{
+		pMainFrame = dynamic_cast<EncFSMPMainFrame *>(pTopWindow);
+	}
+	return pMainFrame;
+}
+
+static void reportMountProgress(const wxString &mountName, MountEntry::MountProgress progress)
+{
+	EncFSMPMainFrame *pMainFrame = getMainFrame();
+	if(pMainFrame != NULL)
+		pMainFrame->reportMountProgress(mountName, progress);
+}
 
 PFMHandlerThread::PFMHandlerThread() : wxThread(wxTHREAD_DETACHED),
-	useExternalConfigFile_(false), enableCaching_(false),
-	worldWrite_(false), localDrive_(false), startBrowser_(true)
+	useExternalConfigFile_(false), enableCaching_(false), enableWriteBuffer_(false),
+	worldWrite_(false), localDrive_(false), startBrowser_(true), cacheVolumeKey_(false),
+	mapBackingFiles_(false), uncachedSequentialIO_(false), watchBackingFolder_(false),
+	mountOnDemand_(false),
+	useNameIndex_(false), lazyExtend_(false), readOnly_(false), useCacheSnapshot_(false), flushPolicy_(0)
 {
 }
 
@@ -65,7 +127,7 @@ void PFMHandlerThread::setParameters(const wxString &mountName,
 		const wxString &path, const wxString &externalConfigFile,
 		const wxString &driveLetter,
 		const wxString &password,
-		bool useExternalConfigFile, bool enableCaching,
+		bool useExternalConfigFile, bool enableCaching, bool enableWriteBuffer,
 		bool worldWrite, bool localDrive, bool startBrowser)
 {
 	mountName_ = mountName;
@@ -75,11 +137,24 @@ void PFMHandlerThread::setParameters(const wxString &mountName,
 	password_ = password;
 	useExternalConfigFile_ = useExternalConfigFile;
 	enableCaching_ = enableCaching;
+	enableWriteBuffer_ = enableWriteBuffer;
 	worldWrite_ = worldWrite;
 	localDrive_ = localDrive;
 	startBrowser_ = startBrowser;
 }
 
+bool PFMHandlerThread::retune(const wxString &mountName, const CacheTuning &cacheTuning)
+{
+	return PFMLayer::retune(std::wstring(mountName.wc_str()), cacheTuning);
+}
+
+bool PFMHandlerThread::searchNames(const wxString &mountName, const wxString &query, size_t maxHits,
+	std::vector<NameIndex::Hit> &hits, bool &isComplete)
+{
+	return PFMLayer::searchNames(std::wstring(mountName.wc_str()), std::string(query.utf8_str()),
+		maxHits, hits, isComplete);
+}
+
 wxThread::ExitCode PFMHandlerThread::Entry()
 {
 	RootPtr rootFS;
@@ -106,18 +181,100 @@ wxThread::ExitCode PFMHandlerThread::Entry()
 		opts->passwordProgram = std::string(password_.mb_str());	//passwordUTF8;	// Abusing this parameter here, so that it uses EncFSConfig::getUserKey with password program
 		opts->externalConfigFileName = EncFSUtilities::wxStringToEncFSFile(externalConfigFileName_);
 		opts->useExternalConfigFile = useExternalConfigFile_;
+		opts->cacheVolumeKey = cacheVolumeKey_;
+		opts->mapBackingFiles = mapBackingFiles_;
+		opts->uncachedSequentialIO = uncachedSequentialIO_;
+		opts->lazyExtend = lazyExtend_;
+		opts->readOnly = readOnly_;
+		if(enableCaching_)
+		{
+			opts->sharedBlockCacheBytes = static_cast<size_t>(cacheTuning_.blockCacheMB_) * 1024 * 1024;
+			opts->descriptorPoolSize = descriptorPoolSize;
+			opts->dirHandleCacheSize = dirHandleCacheSize;
+		}
 
 		std::unique_ptr<encfs::EncFS_Context> ctx( new encfs::EncFS_Context() );
-		rootFS = initFS( ctx.get(), opts, ostr );
+		encfs::MemoryPool::setMaxFreeBytes(memoryPoolMaxFreeBytes);
+		if(!mountOnDemand_)
+		{
+			// PBKDF2 keeps a core busy, when many drives are mounted at once
+			// only some of them derive their key at the same time
+			KeyDerivationSlot slot;
+			reportMountProgress(mountName_, MountEntry::MPDerivingKey);
+			rootFS = initFS( ctx.get(), opts, ostr );
+		}
 
-		if(rootFS)
+		if(rootFS || mountOnDemand_)
 		{
+			reportMountProgress(mountName_, MountEntry::MPCreatingMount);
+
 			PFMLayer pfm;
 			wchar_t driveLetterW = driveLetter_[0];
 			PfmApi *pfmApi = PFMProxy::getInstance().getPfmApi();
 
+			// Serve up to one request per core at the same time, unless tuned otherwise
+			int threadCount = static_cast<int>(cacheTuning_.threadCount_);
+			if(threadCount <= 0)
+				threadCount = static_cast<int>(boost::thread::hardware_concurrency());
+			pfm.setDispatchThreadCount(threadCount);
+			pfm.setUseWriteBuffer(enableWriteBuffer_);
+			if(flushPolicy_ == PFMLayer::FPCoalesced || flushPolicy_ == PFMLayer::FPOnClose)
+				pfm.setFlushPolicy(static_cast<PFMLayer::FlushPolicy>(flushPolicy_));
+			pfm.setNamePatterns(std::string(hiddenNamePatterns_.utf8_str()),
+				std::string(skippedNamePatterns_.utf8_str()));
+			pfm.setCacheTuning(cacheTuning_);
+			pfm.setWatchBackingFolder(watchBackingFolder_);
+			pfm.setUseNameIndex(useNameIndex_);
+			pfm.setReadOnly(readOnly_);
+			pfm.setUseCacheSnapshot(useCacheSnapshot_);
+			if(!traceFile_.IsEmpty())
+#if defined(_WIN32)
+				pfm.setTraceFile(boost::filesystem::path(traceFile_.wc_str()));
+#else
+				pfm.setTraceFile(boost::filesystem::path(traceFile_.mb_str()));
+#endif
+			if(!changeJournalFile_.IsEmpty())
+#if defined(_WIN32)
+				pfm.setChangeJournalFile(boost::filesystem::path(changeJournalFile_.wc_str()));
+#else
+				pfm.setChangeJournalFile(boost::filesystem::path(changeJournalFile_.mb_str()));
+#endif
+			if(mountOnDemand_)
+			{
+				// Runs on the first Open, which waits for it
+				encfs::EncFS_Context *pCtx = ctx.get();
+				pfm.setDeferredUnlock(pathUTF8, [this, pCtx, opts]() -> RootPtr
+				{
+					std::ostringstream unlockOstr;
+					RootPtr unlockedFS;
+					{
+						KeyDerivationSlot slot;
+						reportMountProgress(mountName_, MountEntry::MPUnlocking);
+						unlockedFS = initFS(pCtx, opts, unlockOstr);
+					}
+					reportMountProgress(mountName_, MountEntry::MPNone);
+
+					if(!unlockedFS)
+					{
+						if(unlockOstr.str().length() == 0)
+							unlockOstr << "No encrypted filesystem found";
+						EncFSMPMainFrame *pMainFrame = getMainFrame();
+						if(pMainFrame != NULL)
+							pMainFrame->reportEncFSError(wxString(unlockOstr.str().c_str(), *wxConvCurrent), mountName_);
+
+						// The drive is of no use without the key. Unmount it from another
+						// thread, the driver waits for the Open which is served here
+						wxString mountName = mountName_;
+						boost::thread([mountName]() { PFMProxy::getInstance().unmount(mountName); }).detach();
+					}
+					return unlockedFS;
+				});
+			}
 			pfm.startFS(rootFS, mountName_.c_str(), pfmApi, driveLetterW,	// Will not return before unmount
 				enableCaching_, worldWrite_, localDrive_, startBrowser_, ostr);
+
+			// Return the buffers of the mount to the heap
+			encfs::MemoryPool::destroyAll();
 		}
 		else
 		{
@@ -132,12 +289,7 @@ wxThread::ExitCode PFMHandlerThread::Entry()
 	if(errorMsg.Length() > 0)
 	{
 		// Send error to main frame
-		EncFSMPMainFrame *pMainFrame = NULL;
-		wxWindow *pTopWindow = wxTheApp->GetTopWindow();
-		if(pTopWindow != NULL)
-		{
-			pMainFrame = dynamic_cast<EncFSMPMainFrame *>(pTopWindow);
-		}
+		EncFSMPMainFrame *pMainFrame = getMainFrame();
 		if(pMainFrame != NULL)
 		{
 			pMainFrame->reportEncFSError(errorMsg, mountName_);
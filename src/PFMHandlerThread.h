@@ -20,6 +20,9 @@
 #ifndef PFMHANDLERTHREAD_H
 #define PFMHANDLERTHREAD_H
 
+#include "CacheTuning.h"
+#include "NameIndex.h"
+
 class PFMHandlerThread: public wxThread
 {
 public:
@@ -30,9 +33,113 @@ public:
 		const wxString &path, const wxString &externalConfigFile,
 		const wxString &driveLetter,
 		const wxString &password,
-		bool useExternalConfigFile, bool enableCaching,
+		bool useExternalConfigFile, bool enableCaching, bool enableWriteBuffer,
 		bool worldWrite, bool localDrive, bool startBrowser);
 
+	/**
+	 * Keep the decoded volume key for later mounts, so that they skip the key
+	 * derivation. Only set if the user allows passwords to be kept in RAM.
+	 */
+	void setCacheVolumeKey(bool cacheVolumeKey) { cacheVolumeKey_ = cacheVolumeKey; }
+
+	/**
+	 * Read files which are only open for reading through mapped views of the
+	 * backing files. Files on network shares are always read normally.
+	 */
+	void setMapBackingFiles(bool mapBackingFiles) { mapBackingFiles_ = mapBackingFiles; }
+
+	/**
+	 * Keep large sequential reads and writes of the backing files out of the
+	 * system cache, so that copying big files doesn't evict everything else.
+	 */
+	void setUncachedSequentialIO(bool uncached) { uncachedSequentialIO_ = uncached; }
+
+	/**
+	 * When a flush of a file writes out its write buffer, see PFMLayer::FlushPolicy.
+	 * Only used with the write buffer enabled.
+	 */
+	void setFlushPolicy(long flushPolicy) { flushPolicy_ = flushPolicy; }
+
+	/**
+	 * Growing a file by setting its size doesn't write the zeros, they are
+	 * written when the file is closed unless the application wrote them.
+	 */
+	void setLazyExtend(bool lazyExtend) { lazyExtend_ = lazyExtend; }
+
+	/**
+	 * File names shown as hidden and file names not shown at all, separated
+	 * by ';' (see NameMatcher).
+	 */
+	void setNamePatterns(const wxString &hiddenPatterns, const wxString &skippedPatterns)
+	{
+		hiddenNamePatterns_ = hiddenPatterns;
+		skippedNamePatterns_ = skippedPatterns;
+	}
+
+	/**
+	 * Cache and buffer sizes, as returned by CacheTuning::withCaching() for the
+	 * caching enabled in setParameters().
+	 */
+	void setCacheTuning(const CacheTuning &cacheTuning) { cacheTuning_ = cacheTuning; }
+
+	/**
+	 * Watch the backing folder for changes made by others (e.g. by a sync
+	 * client). Only used with caching enabled.
+	 */
+	void setWatchBackingFolder(bool watchBackingFolder) { watchBackingFolder_ = watchBackingFolder; }
+
+	/**
+	 * Record all operations of the mount to this file, for replaying them
+	 * with EncFSMPTest. Empty for no trace.
+	 */
+	void setTraceFile(const wxString &traceFile) { traceFile_ = traceFile; }
+
+	/**
+	 * Append the changes of the encrypted directory to this file, for
+	 * incremental backups of it. Empty for no journal.
+	 */
+	void setChangeJournalFile(const wxString &journalFile) { changeJournalFile_ = journalFile; }
+
+	/**
+	 * Mount the drive right away and read the configuration and derive the
+	 * volume key only when the drive is accessed for the first time.
+	 * A wrong password is noticed only then, and the drive is unmounted.
+	 */
+	void setMountOnDemand(bool mountOnDemand) { mountOnDemand_ = mountOnDemand; }
+
+	/**
+	 * Keep an encrypted index of the file names in the volume, for
+	 * searchNames(). It is rebuilt in the background after each mount.
+	 */
+	void setUseNameIndex(bool useNameIndex) { useNameIndex_ = useNameIndex; }
+
+	/**
+	 * Mount the volume read-only. Nothing may change the encrypted directory
+	 * while it is mounted, so its contents are cached without expiry, see
+	 * PFMLayer::setReadOnly().
+	 */
+	void setReadOnly(bool readOnly) { readOnly_ = readOnly; }
+
+	/**
+	 * Keep the decoded names and the folder listings from one mount to the
+	 * next, see PFMLayer::setUseCacheSnapshot().
+	 */
+	void setUseCacheSnapshot(bool useCacheSnapshot) { useCacheSnapshot_ = useCacheSnapshot; }
+
+	/**
+	 * Applies a changed tuning to the mounted drive mountName, see PFMLayer::retune().
+	 * Returns false if the drive is not mounted, or if some of the settings
+	 * only take effect when it is mounted again.
+	 */
+	static bool retune(const wxString &mountName, const CacheTuning &cacheTuning);
+
+	/**
+	 * Searches the name index of the mounted drive mountName, see
+	 * PFMLayer::searchNames(). Returns false if it has no index.
+	 */
+	static bool searchNames(const wxString &mountName, const wxString &query, size_t maxHits,
+		std::vector<NameIndex::Hit> &hits, bool &isComplete);
+
 protected:
 	virtual wxThread::ExitCode Entry();
 
@@ -42,7 +149,14 @@ private:
 	wxString externalConfigFileName_;
 	wxString driveLetter_;
 	wxString password_;
-	bool useExternalConfigFile_, enableCaching_, worldWrite_, localDrive_, startBrowser_;
+	wxString hiddenNamePatterns_, skippedNamePatterns_;
+	wxString traceFile_;
+	wxString changeJournalFile_;
+	bool useExternalConfigFile_, enableCaching_, enableWriteBuffer_, worldWrite_, localDrive_, startBrowser_;
+	bool cacheVolumeKey_, mapBackingFiles_, uncachedSequentialIO_, watchBackingFolder_, mountOnDemand_;
+	bool useNameIndex_, lazyExtend_, readOnly_, useCacheSnapshot_;
+	long flushPolicy_;
+	CacheTuning cacheTuning_;
 };
 
 #endif
@@ -37,7 +37,8 @@
 
 PFMMonitorThread::PFMMonitorThread()
 	: wxThread(wxTHREAD_JOINABLE),
-	pfmMonitor_(NULL), mutex_(), sendEvents_(true)
+	pfmMonitor_(NULL), mutex_(), sendEvents_(true),
+	isStopping_(false), stopSignal_(0, 1)
 {
 }
 
@@ -67,6 +68,9 @@ void PFMMonitorThread::stopThread()
 {
 	if(this->IsRunning())
 	{
+		isStopping_ = true;
+		stopSignal_.Post();
+		// Makes the current and all further waits of the monitor return
 		pfmMonitor_->Cancel();
 		Delete();
 	}
@@ -80,7 +84,7 @@ void PFMMonitorThread::sendEvents(bool sendEvents)
 
 wxThread::ExitCode PFMMonitorThread::Entry()
 {
-	const int timeoutMSecs = 50;
+	const int waitForever = -1;	// No timeout
 	long long startChangeInstance = 0, nextChangeInstance = 0;
 	PfmApi *pfmApi = PFMProxy::getInstance().getPfmApi();
 
@@ -92,16 +96,20 @@ wxThread::ExitCode PFMMonitorThread::Entry()
 		pMainFrame = dynamic_cast<EncFSMPMainFrame *>(pTopWindow);
 	}
 
-	while(!TestDestroy())
+	while(!isStopping_ && !TestDestroy())
 	{
-		int retVal = pfmMonitor_->Wait(nextChangeInstance, timeoutMSecs);
+		// Block until the mount list changed since nextChangeInstance
+		pfmMonitor_->Wait(nextChangeInstance, waitForever);
+		if(isStopping_)
+			break;
+
 		bool sendEvents = true;
 		{
 			wxMutexLocker lock(mutex_);
 			sendEvents = sendEvents_;
 		}
 
-		if(sendEvents)
+		// Always iterate, so that nextChangeInstance advances and the next wait blocks
 		{
 			PfmIterator *iter = NULL;
 			pfmApi->MountIterate(startChangeInstance, &nextChangeInstance, &iter);
@@ -131,7 +139,7 @@ wxThread::ExitCode PFMMonitorThread::Entry()
 							std::wstring ownerId(curMount->GetOwnerId());
 							std::wstring mountPoint(curMount->GetMountPoint());
 
-							if(formatterName == EncFSMPStrings::formatterName_)
+							if(sendEvents && formatterName == EncFSMPStrings::formatterName_)
 							{
 								if((statusFlags & (pfmStatusFlagReady | pfmStatusFlagDisconnected | pfmStatusFlagClosed)) != 0)
 								{
@@ -151,15 +159,9 @@ wxThread::ExitCode PFMMonitorThread::Entry()
 			}
 			else
 			{
-				// Workaround for problem, shouldn't happen
-#if defined(EFS_WIN32)
-				Sleep(50);
-#else
-				struct timespec tm;
-				tm.tv_sec = 0;
-				tm.tv_nsec = 50000000L;
-				nanosleep(&tm, NULL);
-#endif
+				// Workaround for problem, shouldn't happen. Retry later, unless stopped meanwhile
+				if(stopSignal_.WaitTimeout(50) == wxSEMA_NO_ERROR)
+					break;
 			}
 		}
 	}
@@ -20,8 +20,15 @@
 #ifndef PFMMONITORTHREAD_H
 #define PFMMONITORTHREAD_H
 
+#include <atomic>
+
 struct PfmMountMonitor;
 
+/**
+ * Waits for changes of the PFM mount list and reports mounts and unmounts of
+ * our formatter to the main frame. Sleeps until something changes, stopThread()
+ * wakes it up.
+ */
 class PFMMonitorThread: public wxThread
 {
 public:
@@ -40,6 +47,9 @@ private:
 
 	wxMutex mutex_;
 	bool sendEvents_;
+
+	std::atomic<bool> isStopping_;
+	wxSemaphore stopSignal_;
 };
 
 #endif
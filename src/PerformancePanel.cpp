@@ -0,0 +1,210 @@
+/**
+ * Copyright (C) 2026 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "CommonIncludes.h"
+#include "PerformancePanel.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+enum
+{
+	ID_PERFORMANCETIMER = 3100
+};
+
+enum
+{
+	colName = 0, colRead, colWrite, colOps, colStatHits, colBlockHits,
+	colNameHits, colListingHits, colMemoryPool, colCrypto, colBusiestOps
+};
+
+// Operations shown per drive, the busiest ones of the last second
+static const size_t busiestOpsCount = 3;
+
+static const double bytesPerMB = 1024.0 * 1024.0;
+
+PerformancePanel::PerformancePanel(wxWindow *parent, wxWindowID id)
+	: wxPanel(parent, id), timer_(this, ID_PERFORMANCETIMER)
+{
+	wxStaticBoxSizer *pSizer = new wxStaticBoxSizer(
+		new wxStaticBox(this, wxID_ANY, wxT("Performance")), wxVERTICAL);
+	pListCtrl_ = new wxListCtrl(this, wxID_ANY, wxDefaultPosition, wxSize(-1, 100),
+		wxLC_NO_SORT_HEADER|wxLC_REPORT|wxLC_SINGLE_SEL);
+	pSizer->Add(pListCtrl_, 1, wxALL|wxEXPAND, 3);
+	SetSizer(pSizer);
+
+	pListCtrl_->InsertColumn(colName, wxT("Name"));
+	pListCtrl_->InsertColumn(colRead, wxT("Read MB/s"), wxLIST_FORMAT_RIGHT);
+	pListCtrl_->InsertColumn(colWrite, wxT("Write MB/s"), wxLIST_FORMAT_RIGHT);
+	pListCtrl_->InsertColumn(colOps, wxT("Ops/s"), wxLIST_FORMAT_RIGHT);
+	pListCtrl_->InsertColumn(colStatHits, wxT("Stat hits"), wxLIST_FORMAT_RIGHT);
+	pListCtrl_->InsertColumn(colBlockHits, wxT("Block hits"), wxLIST_FORMAT_RIGHT);
+	pListCtrl_->InsertColumn(colNameHits, wxT("Name hits"), wxLIST_FORMAT_RIGHT);
+	pListCtrl_->InsertColumn(colListingHits, wxT("Listing hits"), wxLIST_FORMAT_RIGHT);
+	pListCtrl_->InsertColumn(colMemoryPool, wxT("Pool MB used/kept"), wxLIST_FORMAT_RIGHT);
+	pListCtrl_->InsertColumn(colCrypto, wxT("Crypto"), wxLIST_FORMAT_RIGHT);
+	pListCtrl_->InsertColumn(colBusiestOps, wxT("Ops/s by type"));
+}
+
+PerformancePanel::~PerformancePanel()
+{
+	timer_.Stop();
+}
+
+void PerformancePanel::start()
+{
+	sample();
+	timer_.Start(1000);
+}
+
+void PerformancePanel::stop()
+{
+	timer_.Stop();
+	snapshots_.clear();
+}
+
+void PerformancePanel::OnTimer( wxTimerEvent & WXUNUSED(event) )
+{
+	sample();
+}
+
+void PerformancePanel::sample()
+{
+	std::map<std::wstring, FormatterStats::Snapshot> snapshots;
+	FormatterStats::takeSnapshots(snapshots);
+
+	// Rows are in the order of the mount names, rebuild them if a drive
+	// was mounted or unmounted
+	bool isSameDrives = (snapshots.size() == snapshots_.size());
+	std::map<std::wstring, FormatterStats::Snapshot>::const_iterator iter, prevIter;
+	for(iter = snapshots.begin(), prevIter = snapshots_.begin();
+		isSameDrives && iter != snapshots.end(); ++iter, ++prevIter)
+	{
+		isSameDrives = (iter->first == prevIter->first);
+	}
+	if(!isSameDrives)
+	{
+		pListCtrl_->DeleteAllItems();
+		long row = 0;
+		for(iter = snapshots.begin(); iter != snapshots.end(); ++iter, ++row)
+			pListCtrl_->InsertItem(row, wxString(iter->first.c_str()));
+	}
+
+	long row = 0;
+	for(iter = snapshots.begin(); iter != snapshots.end(); ++iter, ++row)
+	{
+		prevIter = snapshots_.find(iter->first);
+		updateRow(row, iter->second, (prevIter != snapshots_.end()) ? &prevIter->second : NULL);
+	}
+
+	snapshots_.swap(snapshots);
+}
+
+void PerformancePanel::updateRow(long row, const FormatterStats::Snapshot &snapshot,
+	const FormatterStats::Snapshot *previous)
+{
+	pListCtrl_->SetItem(row, colStatHits, formatHitRate(snapshot, "Stat cache hits", "Stat cache misses"));
+	pListCtrl_->SetItem(row, colBlockHits, formatHitRate(snapshot, "Block cache hits", "Block cache misses"));
+	pListCtrl_->SetItem(row, colNameHits, formatHitRate(snapshot, "Name cache hits", "Name cache misses"));
+	pListCtrl_->SetItem(row, colListingHits, formatHitRate(snapshot, "Folder listing hits", "Folder listing misses"));
+
+	uint64_t residentBytes = snapshot.getCounter("Memory pool bytes");
+	uint64_t freeBytes = std::min(snapshot.getCounter("Memory pool free bytes"), residentBytes);
+	pListCtrl_->SetItem(row, colMemoryPool, wxString::Format(wxT("%.1f / %.1f"),
+		(residentBytes - freeBytes) / bytesPerMB, residentBytes / bytesPerMB));
+
+	// The totals only decrease if the drive was mounted again meanwhile
+	bool isSameMount = (previous != NULL);
+	for(int i = 0; isSameMount && i < FormatterStats::opCount; i++)
+		isSameMount = (snapshot.calls_[i] >= previous->calls_[i]);
+	double seconds = 0.0;
+	if(isSameMount)
+		seconds = std::chrono::duration<double>(snapshot.time_ - previous->time_).count();
+	if(seconds <= 0.0)
+	{
+		// The first sample of this mount
+		pListCtrl_->SetItem(row, colRead, wxT("-"));
+		pListCtrl_->SetItem(row, colWrite, wxT("-"));
+		pListCtrl_->SetItem(row, colOps, wxT("-"));
+		pListCtrl_->SetItem(row, colCrypto, wxT("-"));
+		pListCtrl_->SetItem(row, colBusiestOps, wxEmptyString);
+		return;
+	}
+
+	uint64_t readBytes = snapshot.bytes_[FormatterStats::opRead] - previous->bytes_[FormatterStats::opRead];
+	uint64_t writeBytes = snapshot.bytes_[FormatterStats::opWrite] - previous->bytes_[FormatterStats::opWrite];
+	uint64_t calls = 0;
+	for(int i = 0; i < FormatterStats::opCount; i++)
+		calls += snapshot.calls_[i] - previous->calls_[i];
+	uint64_t cryptoMicros = snapshot.getCounter("Crypto microseconds") - previous->getCounter("Crypto microseconds");
+
+	pListCtrl_->SetItem(row, colRead, wxString::Format(wxT("%.1f"), readBytes / bytesPerMB / seconds));
+	pListCtrl_->SetItem(row, colWrite, wxString::Format(wxT("%.1f"), writeBytes / bytesPerMB / seconds));
+	pListCtrl_->SetItem(row, colOps, wxString::Format(wxT("%.0f"), calls / seconds));
+	// Share of one core, can be above 100% with several threads coding
+	pListCtrl_->SetItem(row, colCrypto, wxString::Format(wxT("%.0f%%"),
+		cryptoMicros / (seconds * 10000.0)));
+	pListCtrl_->SetItem(row, colBusiestOps, formatOperations(snapshot, *previous, seconds));
+}
+
+/**
+ * Hit rate since the drive was mounted, "-" if the cache was not used.
+ */
+wxString PerformancePanel::formatHitRate(const FormatterStats::Snapshot &snapshot,
+	const char *hitsName, const char *missesName)
+{
+	uint64_t hits = snapshot.getCounter(hitsName);
+	uint64_t lookups = hits + snapshot.getCounter(missesName);
+	if(lookups == 0)
+		return wxT("-");
+	return wxString::Format(wxT("%.1f%%"), (100.0 * hits) / lookups);
+}
+
+/**
+ * The busiest operations since the previous snapshot, e.g. "Read 120, Open 8".
+ */
+wxString PerformancePanel::formatOperations(const FormatterStats::Snapshot &snapshot,
+	const FormatterStats::Snapshot &previous, double seconds)
+{
+	std::vector< std::pair<uint64_t, int> > ops;
+	for(int i = 0; i < FormatterStats::opCount; i++)
+	{
+		uint64_t calls = snapshot.calls_[i] - previous.calls_[i];
+		if(calls > 0)
+			ops.push_back(std::make_pair(calls, i));
+	}
+	std::sort(ops.begin(), ops.end(), std::greater< std::pair<uint64_t, int> >());
+
+	wxString str;
+	for(size_t i = 0; i < ops.size() && i < busiestOpsCount; i++)
+	{
+		if(!str.IsEmpty())
+			str.Append(wxT(", "));
+		str.Append(wxString::FromAscii(FormatterStats::getOperationName(
+			static_cast<FormatterStats::Operation>(ops[i].second))));
+		str.Append(wxString::Format(wxT(" %.0f"), ops[i].first / seconds));
+	}
+	return str;
+}
+
+BEGIN_EVENT_TABLE( PerformancePanel, wxPanel )
+	EVT_TIMER(ID_PERFORMANCETIMER, PerformancePanel::OnTimer)
+END_EVENT_TABLE()
@@ -0,0 +1,70 @@
+/**
+ * Copyright (C) 2026 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PERFORMANCEPANEL_H
+#define PERFORMANCEPANEL_H
+
+#include <map>
+#include <string>
+
+#include <wx/listctrl.h>
+
+#include "FormatterStats.h"
+
+/**
+ * Live statistics of all mounted drives, one row per drive.
+ *
+ * Every second, takes a snapshot of the FormatterStats of each drive and
+ * shows the rates since the previous one: throughput, operations per second
+ * and the share of one core spent coding file data. The cache hit rates are
+ * the ones since the drive was mounted, which is what their sizes are
+ * chosen by. The memory pool is shared by all drives.
+ *
+ * Sampling only runs between start() and stop(), while the panel is shown.
+ */
+class PerformancePanel: public wxPanel
+{
+public:
+	PerformancePanel(wxWindow *parent, wxWindowID id = wxID_ANY);
+	virtual ~PerformancePanel();
+
+	void start();
+	void stop();
+
+protected:
+	virtual void OnTimer( wxTimerEvent &event );
+
+private:
+	void sample();
+	void updateRow(long row, const FormatterStats::Snapshot &snapshot,
+		const FormatterStats::Snapshot *previous);
+	static wxString formatHitRate(const FormatterStats::Snapshot &snapshot,
+		const char *hitsName, const char *missesName);
+	static wxString formatOperations(const FormatterStats::Snapshot &snapshot,
+		const FormatterStats::Snapshot &previous, double seconds);
+
+	wxListCtrl *pListCtrl_;
+	wxTimer timer_;
+	// Snapshots of the previous sample, by mount name
+	std::map<std::wstring, FormatterStats::Snapshot> snapshots_;
+
+	DECLARE_EVENT_TABLE()
+};
+
+#endif
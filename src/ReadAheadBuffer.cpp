@@ -0,0 +1,182 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "ReadAheadBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+// libencfs
+#include "Error.h"
+
+// Number of sequential reads before the read-ahead starts
+static const int sequentialReadThreshold = 2;
+
+ReadAheadBuffer::ReadAheadBuffer(size_t bufferSize) :
+	bufferSize_(bufferSize),
+	nextOffset_(0),
+	sequentialCount_(0),
+	bufferOffset_(0),
+	bufferHasEOF_(false),
+	isFilling_(false),
+	generation_(0)
+{
+}
+
+ReadAheadBuffer::~ReadAheadBuffer()
+{
+}
+
+bool ReadAheadBuffer::read(uint64_t offset, unsigned char *data, size_t size, size_t &actualSize)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+
+	uint64_t bufferEnd = bufferOffset_ + buffer_.size();
+	if(buffer_.empty() || offset < bufferOffset_ || offset > bufferEnd)
+		return false;
+	// Partially buffered ranges are only served at the end of the file
+	if(offset + size > bufferEnd && !bufferHasEOF_)
+		return false;
+
+	actualSize = static_cast<size_t>(std::min<uint64_t>(size, bufferEnd - offset));
+	if(actualSize > 0)
+		memcpy(data, &buffer_[static_cast<size_t>(offset - bufferOffset_)], actualSize);
+
+	return true;
+}
+
+bool ReadAheadBuffer::registerRead(uint64_t offset, size_t size)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+
+	if(offset == nextOffset_)
+		sequentialCount_++;
+	else
+		sequentialCount_ = 0;
+	nextOffset_ = offset + size;
+
+	if(sequentialCount_ < sequentialReadThreshold || isFilling_)
+		return false;
+
+	// Start reading ahead when less than half of the buffer is left
+	uint64_t bufferEnd = bufferOffset_ + buffer_.size();
+	if(nextOffset_ >= bufferOffset_ && nextOffset_ <= bufferEnd)
+	{
+		if(bufferHasEOF_ || bufferEnd - nextOffset_ >= bufferSize_ / 2)
+			return false;
+	}
+
+	isFilling_ = true;
+	return true;
+}
+
+void ReadAheadBuffer::fill(std::weak_ptr<encfs::FileNode> fileNode)
+{
+	uint64_t readOffset = 0;
+	size_t keepOffset = 0, keepSize = 0;
+	int64_t generation = 0;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		generation = generation_;
+
+		// Keep the part of the buffer which was not read yet, only read what follows it
+		uint64_t bufferEnd = bufferOffset_ + buffer_.size();
+		if(nextOffset_ >= bufferOffset_ && nextOffset_ <= bufferEnd)
+		{
+			keepOffset = static_cast<size_t>(nextOffset_ - bufferOffset_);
+			keepSize = buffer_.size() - keepOffset;
+			readOffset = bufferEnd;
+		}
+		else
+			readOffset = nextOffset_;
+	}
+
+	std::vector<unsigned char> newData(bufferSize_ - keepSize);
+	ssize_t readSize = -1;
+	{
+		// Don't keep the file open longer than necessary
+		std::shared_ptr<encfs::FileNode> node = fileNode.lock();
+		if(node)
+		{
+			try
+			{
+				readSize = node->read(static_cast<off_t>(readOffset), newData.data(), newData.size());
+			}
+			catch(encfs::Error &)
+			{
+				readSize = -1;
+			}
+		}
+	}
+
+	boost::mutex::scoped_lock lock(mutex_);
+	if(readSize >= 0 && generation == generation_)
+	{
+		std::vector<unsigned char> buffer(buffer_.begin() + keepOffset, buffer_.begin() + keepOffset + keepSize);
+		buffer.insert(buffer.end(), newData.begin(), newData.begin() + readSize);
+		buffer_.swap(buffer);
+		bufferOffset_ = readOffset - keepSize;
+		bufferHasEOF_ = (static_cast<size_t>(readSize) < newData.size());
+	}
+	isFilling_ = false;
+	fillDoneCond_.notify_all();
+}
+
+void ReadAheadBuffer::invalidate()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	while(isFilling_)
+		fillDoneCond_.wait(lock);
+
+	generation_++;
+	buffer_.clear();
+	bufferOffset_ = 0;
+	bufferHasEOF_ = false;
+	sequentialCount_ = 0;
+}
+
+ReadAheadWorker::ReadAheadWorker() :
+	queue_(SharedExecutor::PriorityBackground)
+{
+}
+
+ReadAheadWorker::~ReadAheadWorker()
+{
+	stop();
+}
+
+void ReadAheadWorker::start()
+{
+	queue_.open();
+}
+
+/**
+ * Waits until all queued read-aheads are completed.
+ */
+void ReadAheadWorker::stop()
+{
+	queue_.close();
+}
+
+void ReadAheadWorker::post(std::shared_ptr<ReadAheadBuffer> readAhead, std::weak_ptr<encfs::FileNode> fileNode)
+{
+	SharedExecutor::JobType job = [readAhead, fileNode]() { readAhead->fill(fileNode); };
+	if(!queue_.post(job))
+		job();		// Not started, fill() must be called anyway
+}
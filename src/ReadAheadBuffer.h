@@ -0,0 +1,113 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef READAHEADBUFFER_H
+#define READAHEADBUFFER_H
+
+#include "config.h"
+
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/thread.hpp>
+
+#include "SharedExecutor.h"
+
+// libencfs
+#include "FileNode.h"
+
+/**
+ * Read-ahead for one open file.
+ *
+ * Media players and file copies read files strictly sequentially. When a
+ * sequential access pattern is detected, the following data is read and
+ * decrypted by a background thread (see ReadAheadWorker), so the next reads
+ * can be served from memory.
+ *
+ * All methods are thread safe.
+ */
+class ReadAheadBuffer
+{
+public:
+	ReadAheadBuffer(size_t bufferSize);
+	virtual ~ReadAheadBuffer();
+
+	/**
+	 * Copies the requested range from the buffer.
+	 * Returns false if the range is not buffered.
+	 */
+	bool read(uint64_t offset, unsigned char *data, size_t size, size_t &actualSize);
+
+	/**
+	 * Tells the detector about a completed read.
+	 * Returns true if the buffer should be filled with fill(). In this case,
+	 * fill() must be called, otherwise no further read-ahead takes place.
+	 */
+	bool registerRead(uint64_t offset, size_t size);
+
+	/**
+	 * Reads the data following the last registered read into the buffer.
+	 * Called by the background thread.
+	 */
+	void fill(std::weak_ptr<encfs::FileNode> fileNode);
+
+	/**
+	 * Discards the buffered data, e.g. because the file was written to.
+	 * Waits until a running fill() is completed.
+	 */
+	void invalidate();
+
+private:
+	boost::mutex mutex_;
+	boost::condition_variable fillDoneCond_;
+
+	size_t bufferSize_;
+
+	uint64_t nextOffset_;		// Offset of the next read, if the access is sequential
+	int sequentialCount_;		// Number of sequential reads in a row
+
+	std::vector<unsigned char> buffer_;
+	uint64_t bufferOffset_;		// File offset of buffer_[0]
+	bool bufferHasEOF_;			// buffer_ ends at the end of the file
+
+	bool isFilling_;
+	int64_t generation_;		// Incremented by invalidate()
+};
+
+/**
+ * Does the read-ahead for all open files of a mount, as background jobs of
+ * the SharedExecutor.
+ */
+class ReadAheadWorker
+{
+public:
+	ReadAheadWorker();
+	virtual ~ReadAheadWorker();
+
+	void start();
+	void stop();
+
+	void post(std::shared_ptr<ReadAheadBuffer> readAhead, std::weak_ptr<encfs::FileNode> fileNode);
+
+private:
+	SharedExecutor::Queue queue_;
+};
+
+#endif
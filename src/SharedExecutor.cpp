@@ -0,0 +1,197 @@
+/**
+ * Copyright (C) 2026 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "SharedExecutor.h"
+
+#include <algorithm>
+
+SharedExecutor::Queue::Queue(Priority priority) :
+	priority_(priority),
+	maxActive_(0),
+	activeCount_(0),
+	weight_(1),
+	isOpen_(false)
+{
+}
+
+SharedExecutor::Queue::~Queue()
+{
+	close();
+}
+
+void SharedExecutor::Queue::open(int maxActive)
+{
+	SharedExecutor &executor = SharedExecutor::instance();
+	{
+		boost::mutex::scoped_lock lock(executor.mutex_);
+		maxActive_ = maxActive;
+		if(!isOpen_)
+		{
+			isOpen_ = true;
+			if(std::find(executor.queues_.begin(), executor.queues_.end(), this) == executor.queues_.end())
+				executor.queues_.push_back(this);
+		}
+	}
+	// Queued jobs may be started now if maxActive was raised
+	executor.workCond_.notify_all();
+	if(priority_ == PriorityBackground)
+		executor.backgroundCond_.notify_all();
+}
+
+void SharedExecutor::Queue::setWeight(int weight)
+{
+	SharedExecutor &executor = SharedExecutor::instance();
+	boost::mutex::scoped_lock lock(executor.mutex_);
+	weight_ = std::max(1, weight);
+}
+
+bool SharedExecutor::Queue::post(const JobType &job)
+{
+	SharedExecutor &executor = SharedExecutor::instance();
+	{
+		boost::mutex::scoped_lock lock(executor.mutex_);
+		if(!isOpen_)
+			return false;
+		jobs_.push_back(job);
+	}
+	executor.workCond_.notify_one();
+	if(priority_ == PriorityBackground)
+		executor.backgroundCond_.notify_one();
+	return true;
+}
+
+void SharedExecutor::Queue::close()
+{
+	SharedExecutor &executor = SharedExecutor::instance();
+	boost::mutex::scoped_lock lock(executor.mutex_);
+	isOpen_ = false;
+	while(!jobs_.empty() || activeCount_ > 0)
+		idleCond_.wait(lock);
+
+	std::vector<Queue *>::iterator iter = std::find(executor.queues_.begin(), executor.queues_.end(), this);
+	if(iter != executor.queues_.end())
+		executor.queues_.erase(iter);
+}
+
+SharedExecutor &SharedExecutor::instance()
+{
+	// Operations mostly wait for the disk or the network, not for the CPU
+	static SharedExecutor executor(std::max(4, 2 * static_cast<int>(boost::thread::hardware_concurrency())));
+	return executor;
+}
+
+SharedExecutor::SharedExecutor(int threadCount) :
+	threadCount_(threadCount),
+	nextQueue_(0),
+	turnsTaken_(0),
+	isStopping_(false)
+{
+	for(int i = 0; i < threadCount; i++)
+		workers_.create_thread([this]() { workerLoop(false); });
+	workers_.create_thread([this]() { workerLoop(true); });
+}
+
+SharedExecutor::~SharedExecutor()
+{
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		isStopping_ = true;
+	}
+	workCond_.notify_all();
+	backgroundCond_.notify_all();
+	workers_.join_all();
+}
+
+/**
+ * Returns the next queue with a job which may be started, or NULL.
+ * Must be called with mutex_ locked.
+ */
+SharedExecutor::Queue *SharedExecutor::nextQueue(bool backgroundOnly)
+{
+	// Keep one thread free for the other drives
+	int maxActivePerQueue = std::max(1, threadCount_ - 1);
+	size_t queueCount = queues_.size();
+	for(int priority = (backgroundOnly ? PriorityBackground : PriorityForeground);
+		priority <= PriorityBackground; priority++)
+	{
+		for(size_t i = 0; i < queueCount; i++)
+		{
+			size_t index = (nextQueue_ + i) % queueCount;
+			Queue *queue = queues_[index];
+			int maxActive = maxActivePerQueue;
+			if(queue->maxActive_ > 0)
+				maxActive = std::min(maxActive, queue->maxActive_);
+			if(queue->priority_ == priority && !queue->jobs_.empty()
+				&& queue->activeCount_ < maxActive)
+			{
+				// Stays the turn of the queue until it started weight_ jobs
+				turnsTaken_ = (i == 0) ? turnsTaken_ + 1 : 1;
+				if(turnsTaken_ < queue->weight_)
+					nextQueue_ = index;
+				else
+				{
+					turnsTaken_ = 0;
+					nextQueue_ = index + 1;
+				}
+				return queue;
+			}
+		}
+	}
+	return NULL;
+}
+
+void SharedExecutor::workerLoop(bool backgroundOnly)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	while(true)
+	{
+		Queue *queue = nextQueue(backgroundOnly);
+		if(queue == NULL)
+		{
+			if(isStopping_)
+				return;
+			if(backgroundOnly)
+				backgroundCond_.wait(lock);
+			else
+				workCond_.wait(lock);
+			continue;
+		}
+
+		JobType job = queue->jobs_.front();
+		queue->jobs_.pop_front();
+		queue->activeCount_++;
+
+		lock.unlock();
+		job();
+		job = JobType();
+		lock.lock();
+
+		queue->activeCount_--;
+		if(queue->jobs_.empty())
+		{
+			if(queue->activeCount_ == 0)
+				queue->idleCond_.notify_all();
+		}
+		else
+		{
+			// A job held back by the limit of the queue may be started now
+			workCond_.notify_one();
+		}
+	}
+}
@@ -0,0 +1,121 @@
+/**
+ * Copyright (C) 2026 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SHAREDEXECUTOR_H
+#define SHAREDEXECUTOR_H
+
+#include <deque>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+/**
+ * Worker threads shared by all mounts of the process, for the PFM operations
+ * (see PFMDispatchPool) and the read-ahead (see ReadAheadWorker).
+ *
+ * Every mount posts its jobs to its own queues. The threads serve the queues
+ * round-robin, foreground queues before background queues, and run at most
+ * a limited number of jobs of one queue at the same time, so that a busy or
+ * slow drive does not hold up the others. A queue with a weight above 1
+ * gets that many jobs started in its turn. One thread only runs background
+ * jobs, operations waiting for a read-ahead to complete can't starve it.
+ *
+ * The CPU bound coding of many blocks is split further by encfs::WorkerPool,
+ * which is shared by all mounts as well.
+ */
+class SharedExecutor
+{
+public:
+	enum Priority
+	{
+		PriorityForeground = 0,	// Operations somebody is waiting for
+		PriorityBackground		// Work done in advance, like reading ahead
+	};
+
+	typedef boost::function<void ()> JobType;
+
+	/**
+	 * Jobs of one mount with the same priority, started in the order posted.
+	 */
+	class Queue
+	{
+	public:
+		Queue(Priority priority);
+		virtual ~Queue();
+
+		/**
+		 * Accepts jobs from now on, running at most maxActive of them at the
+		 * same time (0: as many as the executor allows). Can be called again
+		 * to change maxActive.
+		 */
+		void open(int maxActive = 0);
+
+		/**
+		 * Jobs started in a row when it is the turn of the queue (default 1).
+		 */
+		void setWeight(int weight);
+
+		/**
+		 * Returns false if the queue is not open, the job is not run then.
+		 */
+		bool post(const JobType &job);
+
+		/**
+		 * Stops accepting jobs and waits until the queued ones are completed.
+		 */
+		void close();
+
+	private:
+		friend class SharedExecutor;
+
+		Priority priority_;
+		std::deque<JobType> jobs_;
+		int maxActive_;
+		int activeCount_;
+		int weight_;
+		bool isOpen_;
+		boost::condition_variable idleCond_;
+	};
+
+	static SharedExecutor &instance();
+
+	int threadCount() const { return threadCount_; }
+
+private:
+	SharedExecutor(int threadCount);
+	~SharedExecutor();
+
+	SharedExecutor(const SharedExecutor &);
+	SharedExecutor &operator=(const SharedExecutor &);
+
+	Queue *nextQueue(bool backgroundOnly);
+	void workerLoop(bool backgroundOnly);
+
+	int threadCount_;
+	boost::thread_group workers_;
+	boost::mutex mutex_;
+	boost::condition_variable workCond_, backgroundCond_;
+	std::vector<Queue *> queues_;	// Open queues and closed ones with jobs left
+	size_t nextQueue_;				// Round-robin position in queues_
+	int turnsTaken_;				// Jobs started in the turn of the queue at nextQueue_
+	bool isStopping_;
+};
+
+#endif
@@ -0,0 +1,215 @@
+/**
+* Copyright (C) 2026 Roman Hiestand
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify, merge, publish, distribute,
+* sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial
+* portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TestBenchmark.h"
+#include "TestBigFile.h"
+#include "TestFileHelper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <boost/thread.hpp>
+
+static const int64_t benchmarkBlockSizes[] = { 4 * 1024, 64 * 1024, 1024 * 1024, 4 * 1024 * 1024 };
+static const int benchmarkThreadCounts[] = { 1, 4 };
+
+/**
+ * Runs all combinations of block size, access pattern and thread count.
+ *
+ * The reads come first, while the file still holds the data of TestBigFile::gendata,
+ * so that the last block read by every thread can be checked.
+ */
+bool TestBenchmark::run(const boost::filesystem::path &testpath, const Options &options,
+	std::ostream &out)
+{
+	boost::filesystem::path testfile(testpath);
+	testfile /= boost::filesystem::unique_path();
+
+	std::cerr << "Creating test file of " << options.fileSize / (1024 * 1024) << " MB" << std::endl;
+	if(!TestBigFile::gentestfile(testfile, options.fileSize))
+		return false;
+
+	out << "op,pattern,block_size,threads,bytes,seconds,mb_per_s,"
+		"lat_p50_us,lat_p90_us,lat_p99_us,lat_p999_us,lat_max_us" << std::endl;
+
+	bool retVal = true;
+	for(int isWrite = 0; isWrite < 2 && retVal; isWrite++)
+	{
+		for(int isRandom = 0; isRandom < 2 && retVal; isRandom++)
+		{
+			for(size_t i = 0; i < sizeof(benchmarkBlockSizes) / sizeof(benchmarkBlockSizes[0]) && retVal; i++)
+			{
+				for(size_t j = 0; j < sizeof(benchmarkThreadCounts) / sizeof(benchmarkThreadCounts[0]) && retVal; j++)
+				{
+					Run run;
+					run.isWrite = (isWrite != 0);
+					run.isRandom = (isRandom != 0);
+					run.blockSize = benchmarkBlockSizes[i];
+					run.threadCount = benchmarkThreadCounts[j];
+					if(run.blockSize <= options.fileSize)
+						retVal = runOne(testfile, options, run, out);
+				}
+			}
+		}
+	}
+
+	boost::system::error_code ec;
+	if(!boost::filesystem::remove(testfile, ec))
+		retVal = false;
+
+	return retVal;
+}
+
+bool TestBenchmark::runOne(const boost::filesystem::path &testfile, const Options &options,
+	const Run &run, std::ostream &out)
+{
+	std::vector<ThreadResult> results(run.threadCount);
+
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	boost::thread_group threads;
+	for(int i = 0; i < run.threadCount; i++)
+	{
+		ThreadResult &result = results[i];
+		threads.create_thread([&testfile, &options, &run, i, &result]()
+			{ runThread(testfile, options, run, i, result); });
+	}
+	threads.join_all();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	int64_t bytes = 0;
+	std::vector<uint32_t> latencies;
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		const ThreadResult &result = results[i];
+		if(!result.isOK)
+			return false;
+
+		if(result.lastOffset >= 0)
+		{
+			std::vector<unsigned char> expected(result.lastBlock.size());
+			TestBigFile::gendata(result.lastOffset, expected.size(), expected.data());
+			if(expected != result.lastBlock)
+			{
+				std::cerr << "Wrong data read at " << result.lastOffset << std::endl;
+				return false;
+			}
+		}
+
+		bytes += result.bytes;
+		latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+	}
+	std::sort(latencies.begin(), latencies.end());
+
+	out << (run.isWrite ? "write" : "read") << ","
+		<< (run.isRandom ? "random" : "sequential") << ","
+		<< run.blockSize << ","
+		<< run.threadCount << ","
+		<< bytes << ","
+		<< seconds << ","
+		<< (seconds > 0.0 ? static_cast<double>(bytes) / (1024.0 * 1024.0) / seconds : 0.0) << ","
+		<< percentile(latencies, 0.5) << ","
+		<< percentile(latencies, 0.9) << ","
+		<< percentile(latencies, 0.99) << ","
+		<< percentile(latencies, 0.999) << ","
+		<< (latencies.empty() ? 0 : latencies.back()) << std::endl;
+
+	return true;
+}
+
+/**
+ * Reads or writes the share of a run of one thread, with its own file handle.
+ *
+ * Sequential runs split the file into one range per thread. Random runs use
+ * offsets aligned to the block size, from a generator seeded per thread.
+ */
+void TestBenchmark::runThread(const boost::filesystem::path &testfile, const Options &options,
+	const Run &run, int threadIndex, ThreadResult &result)
+{
+	FILE *fp = TestFileHelper::fopen_shared(testfile, run.isWrite ? "r+b" : "rb");
+	if(fp == NULL)
+	{
+		result.isOK = false;
+		return;
+	}
+	// Every request goes to the file system with the size of the run
+	setvbuf(fp, NULL, _IONBF, 0);
+
+	int64_t blockCount = options.fileSize / run.blockSize;
+	int64_t opCount = std::max(std::min(options.runBytes, options.fileSize) / run.blockSize
+		/ run.threadCount, static_cast<int64_t>(1));
+	int64_t firstBlock = 0;
+	if(!run.isRandom)
+		firstBlock = std::min(blockCount / run.threadCount * threadIndex, blockCount - 1);
+	std::mt19937_64 rng(static_cast<uint64_t>(threadIndex) + 1);
+	std::uniform_int_distribution<int64_t> randomBlock(0, blockCount - 1);
+
+	std::vector<unsigned char> buf(static_cast<size_t>(run.blockSize));
+	if(run.isWrite)
+		TestBigFile::gendata(0, run.blockSize, buf.data());
+	result.latencies.reserve(static_cast<size_t>(opCount));
+
+	int64_t block = firstBlock;
+	for(int64_t i = 0; i < opCount; i++)
+	{
+		if(run.isRandom)
+			block = randomBlock(rng);
+		else if(block >= blockCount)
+			block = 0;
+		int64_t offset = block * run.blockSize;
+
+		std::chrono::steady_clock::time_point opStart = std::chrono::steady_clock::now();
+		size_t done = 0;
+		if(TestFileHelper::fseek64(fp, offset) == 0)
+		{
+			if(run.isWrite)
+				done = fwrite(buf.data(), 1, buf.size(), fp);
+			else
+				done = fread(buf.data(), 1, buf.size(), fp);
+		}
+		std::chrono::steady_clock::duration opTime = std::chrono::steady_clock::now() - opStart;
+
+		if(done != buf.size())
+		{
+			std::cerr << (run.isWrite ? "fwrite" : "fread") << " failed at " << offset
+				<< ": " << errno << std::endl;
+			result.isOK = false;
+			break;
+		}
+		result.latencies.push_back(static_cast<uint32_t>(
+			std::chrono::duration_cast<std::chrono::microseconds>(opTime).count()));
+		result.bytes += done;
+		block++;
+
+		if(!run.isWrite)
+			result.lastOffset = offset;
+	}
+
+	if(result.lastOffset >= 0)
+		result.lastBlock = buf;
+	fclose(fp);
+}
+
+uint32_t TestBenchmark::percentile(const std::vector<uint32_t> &sorted, double fraction)
+{
+	if(sorted.empty())
+		return 0;
+	size_t index = static_cast<size_t>(fraction * static_cast<double>(sorted.size() - 1) + 0.5);
+	return sorted[std::min(index, sorted.size() - 1)];
+}
@@ -0,0 +1,81 @@
+/**
+* Copyright (C) 2026 Roman Hiestand
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify, merge, publish, distribute,
+* sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial
+* portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef TESTBENCHMARK_H
+#define TESTBENCHMARK_H
+
+#include <ostream>
+#include <stdint.h>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+
+/**
+ * Throughput benchmark of a mounted volume.
+ *
+ * Writes a test file with the data of TestBigFile, then reads and writes it with
+ * several block sizes, sequentially and at random offsets, from one or more threads.
+ * Every run prints a CSV line with the throughput and the latency percentiles
+ * of the single requests, so that results of different releases can be compared.
+ */
+class TestBenchmark
+{
+public:
+	struct Options
+	{
+		Options() : fileSize(4096LL * 1024LL * 1024LL), runBytes(1024LL * 1024LL * 1024LL) { }
+
+		int64_t fileSize;		// Size of the test file
+		int64_t runBytes;		// Bytes read or written per run
+	};
+
+	static bool run(const boost::filesystem::path &testpath, const Options &options,
+		std::ostream &out);
+
+private:
+	TestBenchmark() { }
+	virtual ~TestBenchmark() { }
+
+	struct Run
+	{
+		bool isWrite;
+		bool isRandom;
+		int64_t blockSize;
+		int threadCount;
+	};
+
+	struct ThreadResult
+	{
+		ThreadResult() : isOK(true), bytes(0), lastOffset(-1) { }
+
+		bool isOK;
+		int64_t bytes;
+		std::vector<uint32_t> latencies;	// Microseconds
+		std::vector<unsigned char> lastBlock;	// Last block read, checked after the run
+		int64_t lastOffset;
+	};
+
+	static bool runOne(const boost::filesystem::path &testfile, const Options &options,
+		const Run &run, std::ostream &out);
+	static void runThread(const boost::filesystem::path &testfile, const Options &options,
+		const Run &run, int threadIndex, ThreadResult &result);
+	static uint32_t percentile(const std::vector<uint32_t> &sorted, double fraction);
+};
+
+#endif
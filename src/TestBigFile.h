@@ -27,16 +27,17 @@ class TestBigFile
 public:
 	static bool runTest(const boost::filesystem::path &testpath);
 
+	// Deterministic "random" data, depending only on the offset
+	static void gendata(int64_t offset, int64_t sz, unsigned char *data);
+	static bool gentestfile(const boost::filesystem::path &filename, int64_t filesize);
+
 private:
 	TestBigFile() { }
 	virtual ~TestBigFile() { }
 
-	static void encipher_xtea(unsigned int num_rounds, uint32_t v[2], uint32_t const key[4]);
 	static uint64_t gendata_single(int64_t offset);
 	static void copydata(unsigned char *dataout, uint64_t datain);
-	static void gendata(int64_t offset, int64_t sz, unsigned char *data);
 	static void test_bigchunk(int64_t offset);
-	static bool gentestfile(const boost::filesystem::path &filename, int64_t filesize);
 	static bool checkfile(const boost::filesystem::path &filename, int64_t filesize);
 };
 #endif
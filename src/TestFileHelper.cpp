@@ -44,7 +44,7 @@ FILE *TestFileHelper::fopen(const boost::filesystem::path &filename, const char
 	#endif
 #else
 	// On other platforms, c_str() is char *
-	fp = fopen(filename.c_str(), mode);
+	fp = ::fopen(filename.c_str(), mode);
 #endif
 
 	return fp;
@@ -62,8 +62,17 @@ FILE *TestFileHelper::fopen_shared(const boost::filesystem::path &filename, cons
 	fp = _wfsopen(filename.c_str(), mode_w.c_str(), _SH_DENYNO);
 #else
 	// On other platforms, c_str() is char *
-	fp = fopen(filename.c_str(), mode);
+	fp = ::fopen(filename.c_str(), mode);
 #endif
 
 	return fp;
 }
+
+int TestFileHelper::fseek64(FILE *fp, int64_t offset)
+{
+#if defined(_WIN32)
+	return _fseeki64(fp, offset, SEEK_SET);
+#else
+	return fseeko(fp, static_cast<off_t>(offset), SEEK_SET);
+#endif
+}
@@ -21,6 +21,7 @@
 #define TEST_FILE_HELPER_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include "boost/filesystem.hpp"
 
 /**
@@ -40,6 +41,11 @@ public:
 	*/
 	static FILE *fopen_shared(const boost::filesystem::path &filename, const char *mode);
 
+	/**
+	* Seek to a 64 bit offset from the beginning of the file.
+	*/
+	static int fseek64(FILE *fp, int64_t offset);
+
 private:
 	TestFileHelper() { }
 	virtual ~TestFileHelper() { }
@@ -19,8 +19,16 @@
 
 #include "CommonIncludes.h"
 #include "TestFileWin32.h"
+#include "TestBigFile.h"
 #include "TestFileHelper.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
 #define WIN32_LEAN_AND_MEAN
 #include "windows.h"
 
@@ -288,3 +296,224 @@ bool TestFileWin32::checkPFMRegrTest(const boost::filesystem::path &testpath)
 
 	return retVal;
 }
+
+// Sizes of the requests of the overlapped benchmark, one picked at random per request
+static const DWORD overlappedRequestSizes[] = { 4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024 };
+static const DWORD overlappedMaxRequestSize = 1024 * 1024;
+// Offsets and sizes are multiples of the sector size without buffering
+static const int64_t overlappedAlignment = 4096;
+
+struct OverlappedRequest
+{
+	OVERLAPPED overlapped;	// First member, the completion port returns its address
+	unsigned char *buffer;
+	DWORD size;
+	int64_t offset;
+	std::chrono::steady_clock::time_point startTime;
+};
+
+/**
+ * Starts request with a random size at a random offset. Returns false if
+ * it could not be started, GetLastError() tells why.
+ */
+static bool startOverlappedRequest(HANDLE fh, bool isWrite, int64_t fileSize,
+	OverlappedRequest &request, std::mt19937_64 &rng)
+{
+	std::uniform_int_distribution<size_t> randomSize(0,
+		sizeof(overlappedRequestSizes) / sizeof(overlappedRequestSizes[0]) - 1);
+	request.size = overlappedRequestSizes[randomSize(rng)];
+	std::uniform_int_distribution<int64_t> randomOffset(0, (fileSize - request.size) / overlappedAlignment);
+	request.offset = randomOffset(rng) * overlappedAlignment;
+
+	ZeroMemory(&request.overlapped, sizeof(request.overlapped));
+	request.overlapped.Offset = static_cast<DWORD>(request.offset);
+	request.overlapped.OffsetHigh = static_cast<DWORD>(request.offset >> 32);
+	request.startTime = std::chrono::steady_clock::now();
+	BOOL isOK = isWrite ? WriteFile(fh, request.buffer, request.size, NULL, &request.overlapped)
+		: ReadFile(fh, request.buffer, request.size, NULL, &request.overlapped);
+	// Also completed synchronously, the completion is queued to the port
+	return isOK || GetLastError() == ERROR_IO_PENDING;
+}
+
+static uint32_t overlappedPercentile(const std::vector<uint32_t> &sorted, double fraction)
+{
+	if(sorted.empty())
+		return 0;
+	size_t index = static_cast<size_t>(fraction * static_cast<double>(sorted.size() - 1) + 0.5);
+	return sorted[std::min(index, sorted.size() - 1)];
+}
+
+bool TestFileWin32::overlappedBenchmark(const boost::filesystem::path &testpath,
+	const OverlappedOptions &options, std::ostream &out)
+{
+	if(options.fileSize < static_cast<int64_t>(overlappedMaxRequestSize) || options.maxQueueDepth < 1)
+		return false;
+
+	boost::filesystem::path testfile(testpath);
+	testfile /= boost::filesystem::unique_path();
+
+	std::wcerr << L"Creating test file of " << options.fileSize / (1024 * 1024) << L" MB" << std::endl;
+	if(!TestBigFile::gentestfile(testfile, options.fileSize))
+		return false;
+
+	out << "op,queue_depth,requests,bytes,seconds,iops,mb_per_s,"
+		"lat_avg_us,lat_p50_us,lat_p90_us,lat_p99_us,lat_max_us" << std::endl;
+
+	bool retVal = true;
+	for(int isWrite = 0; isWrite < 2 && retVal; isWrite++)
+	{
+		for(int queueDepth = 1; queueDepth <= options.maxQueueDepth && retVal; queueDepth *= 2)
+			retVal = runOverlapped(testfile, options, isWrite != 0, queueDepth, out);
+	}
+
+	boost::system::error_code ec;
+	if(!boost::filesystem::remove(testfile, ec))
+		retVal = false;
+
+	return retVal;
+}
+
+/**
+ * Runs one queue depth: starts queueDepth requests, and a new one whenever
+ * one completes, until runBytes were started. The data of the first
+ * completed read is checked.
+ */
+bool TestFileWin32::runOverlapped(const boost::filesystem::path &testfile, const OverlappedOptions &options,
+	bool isWrite, int queueDepth, std::ostream &out)
+{
+	// Without buffering, every request goes to the file system of the mount
+	HANDLE fh = CreateFileW(testfile.c_str(), isWrite ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | FILE_FLAG_NO_BUFFERING, NULL);
+	if(fh == INVALID_HANDLE_VALUE)
+	{
+		printLastError();
+		return false;
+	}
+	HANDLE port = CreateIoCompletionPort(fh, NULL, 0, 1);
+	if(port == NULL)
+	{
+		printLastError();
+		CloseHandle(fh);
+		return false;
+	}
+
+	bool retVal = true;
+	std::vector<OverlappedRequest> requests(queueDepth);
+	for(size_t i = 0; i < requests.size(); i++)
+	{
+		// Page aligned, as required without buffering
+		requests[i].buffer = static_cast<unsigned char *>(VirtualAlloc(NULL, overlappedMaxRequestSize,
+			MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+		if(requests[i].buffer == NULL)
+			retVal = false;
+		else if(isWrite)
+			TestBigFile::gendata(0, overlappedMaxRequestSize, requests[i].buffer);
+	}
+
+	std::mt19937_64 rng(static_cast<uint64_t>(queueDepth));
+	std::vector<uint32_t> latencies;
+	int64_t bytes = 0, startedBytes = 0;
+	int pendingCount = 0;
+	bool isChecked = isWrite;
+
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < requests.size() && retVal && startedBytes < options.runBytes; i++)
+	{
+		if(!startOverlappedRequest(fh, isWrite, options.fileSize, requests[i], rng))
+		{
+			printLastError();
+			retVal = false;
+			break;
+		}
+		pendingCount++;
+		startedBytes += requests[i].size;
+	}
+
+	while(pendingCount > 0)
+	{
+		DWORD transferred = 0;
+		ULONG_PTR key = 0;
+		LPOVERLAPPED pOverlapped = NULL;
+		BOOL isOK = GetQueuedCompletionStatus(port, &transferred, &key, &pOverlapped, INFINITE);
+		if(pOverlapped == NULL)
+		{
+			// The port failed, the pending requests are cancelled when the handle is closed
+			printLastError();
+			CancelIoEx(fh, NULL);
+			retVal = false;
+			break;
+		}
+		pendingCount--;
+
+		OverlappedRequest &request = *reinterpret_cast<OverlappedRequest *>(pOverlapped);
+		std::chrono::steady_clock::duration opTime = std::chrono::steady_clock::now() - request.startTime;
+		if(!isOK || transferred != request.size)
+		{
+			if(!isOK)
+				printLastError();
+			std::wcerr << (isWrite ? L"WriteFile" : L"ReadFile") << L" failed at " << request.offset
+				<< L": " << transferred << L" of " << request.size << L" bytes" << std::endl;
+			retVal = false;
+			continue;
+		}
+		latencies.push_back(static_cast<uint32_t>(
+			std::chrono::duration_cast<std::chrono::microseconds>(opTime).count()));
+		bytes += transferred;
+
+		if(!isChecked)
+		{
+			std::vector<unsigned char> expected(request.size);
+			TestBigFile::gendata(request.offset, request.size, expected.data());
+			if(memcmp(expected.data(), request.buffer, request.size) != 0)
+			{
+				std::wcerr << L"Wrong data read at " << request.offset << std::endl;
+				retVal = false;
+			}
+			isChecked = true;
+		}
+
+		if(retVal && startedBytes < options.runBytes)
+		{
+			if(!startOverlappedRequest(fh, isWrite, options.fileSize, request, rng))
+			{
+				printLastError();
+				retVal = false;
+				continue;
+			}
+			pendingCount++;
+			startedBytes += request.size;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	CloseHandle(port);
+	CloseHandle(fh);
+	for(size_t i = 0; i < requests.size(); i++)
+	{
+		if(requests[i].buffer != NULL)
+			VirtualFree(requests[i].buffer, 0, MEM_RELEASE);
+	}
+	if(!retVal)
+		return false;
+
+	std::sort(latencies.begin(), latencies.end());
+	uint64_t totalLatency = 0;
+	for(size_t i = 0; i < latencies.size(); i++)
+		totalLatency += latencies[i];
+
+	out << (isWrite ? "write" : "read") << ","
+		<< queueDepth << ","
+		<< latencies.size() << ","
+		<< bytes << ","
+		<< seconds << ","
+		<< (seconds > 0.0 ? static_cast<double>(latencies.size()) / seconds : 0.0) << ","
+		<< (seconds > 0.0 ? static_cast<double>(bytes) / (1024.0 * 1024.0) / seconds : 0.0) << ","
+		<< (latencies.empty() ? 0 : totalLatency / latencies.size()) << ","
+		<< overlappedPercentile(latencies, 0.5) << ","
+		<< overlappedPercentile(latencies, 0.9) << ","
+		<< overlappedPercentile(latencies, 0.99) << ","
+		<< (latencies.empty() ? 0 : latencies.back()) << std::endl;
+
+	return true;
+}
@@ -20,6 +20,9 @@
 #ifndef TEST_FILE_WIN32_H
 #define TEST_FILE_WIN32_H
 
+#include <ostream>
+#include <stdint.h>
+
 #include "boost/filesystem.hpp"
 
 class TestFileWin32
@@ -30,12 +33,39 @@ public:
 	static bool replaceTest(const boost::filesystem::path &testpath);
 	static bool checkPFMRegrTest(const boost::filesystem::path &testpath);
 
+	struct OverlappedOptions
+	{
+		OverlappedOptions() : fileSize(1024LL * 1024LL * 1024LL), runBytes(256LL * 1024LL * 1024LL),
+			maxQueueDepth(64) { }
+
+		int64_t fileSize;		// Size of the test file, at least 1 MB
+		int64_t runBytes;		// Bytes read or written per queue depth
+		int maxQueueDepth;		// Runs with 1, 2, 4, ... requests in flight, up to this
+	};
+
+	/**
+	 * Benchmark of overlapped ReadFile and WriteFile, the way Windows
+	 * applications like Explorer copies, backup tools and databases drive a
+	 * disk, to see whether the mount serves requests in parallel.
+	 *
+	 * Keeps a fixed number of requests in flight on one unbuffered handle,
+	 * with an I/O completion port, at random offsets and with sizes from 4 KB
+	 * to 1 MB. Reads run before writes, while the file holds the data of
+	 * TestBigFile::gendata. Every queue depth prints a CSV line with the
+	 * IOPS, the throughput and the latency percentiles.
+	 */
+	static bool overlappedBenchmark(const boost::filesystem::path &testpath,
+		const OverlappedOptions &options, std::ostream &out);
+
 protected:
 	static void printLastError();
 
 private:
 	TestFileWin32() { }
 	virtual ~TestFileWin32() { }
+
+	static bool runOverlapped(const boost::filesystem::path &testfile, const OverlappedOptions &options,
+		bool isWrite, int queueDepth, std::ostream &out);
 };
 
 #endif
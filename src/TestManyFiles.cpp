@@ -20,6 +20,8 @@
 #include "TestManyFiles.h"
 #include "TestFileHelper.h"
 
+#include <chrono>
+#include <iomanip>
 #include <iostream>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
@@ -78,3 +80,269 @@ bool TestManyFiles::runTest(const boost::filesystem::path &testpath)
 
 	return retVal;
 }
+
+static double secondsSince(const std::chrono::steady_clock::time_point &start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double perSecond(int64_t count, double seconds)
+{
+	return (seconds > 0.0) ? static_cast<double>(count) / seconds : 0.0;
+}
+
+static boost::filesystem::path benchmarkFileName(const boost::filesystem::path &dirpath,
+	const char *prefix, int i)
+{
+	return dirpath / (std::string(prefix) + boost::lexical_cast<std::string>(i) + std::string(".txt"));
+}
+
+/**
+ * Measures the metadata operations in folders of 1000, 10000, ... entries, and in
+ * a tree of nested folders. The latter exercises the encoding of long paths, in
+ * particular with chained name IVs, where renaming a folder renames everything below it.
+ *
+ * The results are written as a single JSON object, with the build information of
+ * the options, so that the results of several builds can be collected and compared.
+ */
+bool TestManyFiles::runBenchmark(const boost::filesystem::path &testpath,
+	const BenchmarkOptions &options, std::ostream &out)
+{
+	std::ios::fmtflags oldFlags = out.flags();
+	std::streamsize oldPrecision = out.precision();
+	out << std::fixed << std::setprecision(3);
+
+	out << "{" << std::endl << "  \"build\": {";
+	for(size_t i = 0; i < options.buildInfo.size(); i++)
+	{
+		out << (i > 0 ? ", " : " ") << jsonString(options.buildInfo[i].first) << ": "
+			<< jsonString(options.buildInfo[i].second);
+	}
+	out << " }," << std::endl << "  \"results\": [" << std::endl;
+
+	bool retVal = true;
+	bool isFirst = true;
+	for(int entryCount = 1000; entryCount <= options.maxEntries && retVal; entryCount *= 10)
+	{
+		if(!isFirst)
+			out << "," << std::endl;
+		isFirst = false;
+		std::cerr << "Folder with " << entryCount << " entries" << std::endl;
+		retVal = benchmarkFolder(testpath, entryCount, out);
+	}
+	if(options.treeDepth > 0 && retVal)
+	{
+		if(!isFirst)
+			out << "," << std::endl;
+		std::cerr << "Tree of depth " << options.treeDepth << std::endl;
+		retVal = benchmarkTree(testpath, options, out);
+	}
+
+	out << std::endl << "  ]" << std::endl << "}" << std::endl;
+	out.flags(oldFlags);
+	out.precision(oldPrecision);
+
+	return retVal;
+}
+
+bool TestManyFiles::benchmarkFolder(const boost::filesystem::path &testpath, int entryCount,
+	std::ostream &out)
+{
+	boost::system::error_code ec;
+	boost::filesystem::path tmptestpath = testpath / boost::filesystem::unique_path();
+	if(!boost::filesystem::create_directories(tmptestpath, ec))
+		return false;
+
+	bool retVal = true;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(int i = 0; i < entryCount && retVal; i++)
+		retVal = createFile(benchmarkFileName(tmptestpath, "file_", i));
+	double createSeconds = secondsSince(start);
+
+	// The second listing may be served from the listing cache of the volume
+	size_t listedCount = 0, listedAgainCount = 0;
+	double listSeconds = listFolder(tmptestpath, listedCount);
+	double listAgainSeconds = listFolder(tmptestpath, listedAgainCount);
+	if(listedCount != static_cast<size_t>(entryCount) || listedAgainCount != listedCount)
+		retVal = false;
+
+	start = std::chrono::steady_clock::now();
+	for(int i = 0; i < entryCount && retVal; i++)
+	{
+		if(boost::filesystem::file_size(benchmarkFileName(tmptestpath, "file_", i), ec) != 10)
+			retVal = false;
+	}
+	double statSeconds = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	for(int i = 0; i < entryCount && retVal; i++)
+	{
+		FILE *fd = TestFileHelper::fopen(benchmarkFileName(tmptestpath, "file_", i), "rb");
+		if(fd == NULL)
+			retVal = false;
+		else
+			fclose(fd);
+	}
+	double openSeconds = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	for(int i = 0; i < entryCount && retVal; i++)
+	{
+		boost::filesystem::rename(benchmarkFileName(tmptestpath, "file_", i),
+			benchmarkFileName(tmptestpath, "renamed_", i), ec);
+		if(ec)
+			retVal = false;
+	}
+	double renameSeconds = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	for(int i = 0; i < entryCount && retVal; i++)
+	{
+		if(!boost::filesystem::remove(benchmarkFileName(tmptestpath, "renamed_", i), ec))
+			retVal = false;
+	}
+	double deleteSeconds = secondsSince(start);
+
+	boost::filesystem::remove_all(tmptestpath, ec);
+	if(!retVal)
+		return false;
+
+	out << "    { \"test\": \"folder\", \"entries\": " << entryCount
+		<< ", \"creates_per_s\": " << perSecond(entryCount, createSeconds)
+		<< ", \"stats_per_s\": " << perSecond(entryCount, statSeconds)
+		<< ", \"opens_per_s\": " << perSecond(entryCount, openSeconds)
+		<< ", \"renames_per_s\": " << perSecond(entryCount, renameSeconds)
+		<< ", \"deletes_per_s\": " << perSecond(entryCount, deleteSeconds)
+		<< ", \"list_ms\": " << listSeconds * 1000.0
+		<< ", \"list_again_ms\": " << listAgainSeconds * 1000.0 << " }";
+	return true;
+}
+
+bool TestManyFiles::benchmarkTree(const boost::filesystem::path &testpath,
+	const BenchmarkOptions &options, std::ostream &out)
+{
+	boost::system::error_code ec;
+	boost::filesystem::path tmptestpath = testpath / boost::filesystem::unique_path();
+	if(!boost::filesystem::create_directories(tmptestpath, ec))
+		return false;
+
+	bool retVal = true;
+	std::vector<boost::filesystem::path> levels;
+	boost::filesystem::path current = tmptestpath;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(int i = 0; i < options.treeDepth && retVal; i++)
+	{
+		current /= std::string("level_") + boost::lexical_cast<std::string>(i);
+		if(!boost::filesystem::create_directory(current, ec))
+			retVal = false;
+		levels.push_back(current);
+	}
+	double mkdirSeconds = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < levels.size() && retVal; i++)
+	{
+		for(int j = 0; j < options.filesPerLevel && retVal; j++)
+			retVal = createFile(benchmarkFileName(levels[i], "file_", j));
+	}
+	double createSeconds = secondsSince(start);
+	int64_t fileCount = static_cast<int64_t>(levels.size()) * options.filesPerLevel;
+
+	start = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < levels.size() && retVal; i++)
+	{
+		for(int j = 0; j < options.filesPerLevel && retVal; j++)
+		{
+			if(boost::filesystem::file_size(benchmarkFileName(levels[i], "file_", j), ec) != 10)
+				retVal = false;
+		}
+	}
+	double statSeconds = secondsSince(start);
+
+	double listSeconds = 0.0;
+	for(size_t i = 0; i < levels.size() && retVal; i++)
+	{
+		size_t listedCount = 0;
+		listSeconds += listFolder(levels[i], listedCount);
+		size_t expectedCount = options.filesPerLevel + ((i + 1 < levels.size()) ? 1 : 0);
+		if(listedCount != expectedCount)
+			retVal = false;
+	}
+
+	// Renames every name below it if the names are chained
+	double renameSeconds = 0.0;
+	if(retVal && !levels.empty())
+	{
+		boost::filesystem::path movedpath = tmptestpath / "moved_0";
+		start = std::chrono::steady_clock::now();
+		boost::filesystem::rename(levels[0], movedpath, ec);
+		renameSeconds = secondsSince(start);
+
+		boost::filesystem::path deepest = movedpath;
+		for(size_t i = 1; i < levels.size(); i++)
+			deepest /= levels[i].filename();
+		if(ec || !boost::filesystem::exists(benchmarkFileName(deepest, "file_", 0), ec))
+			retVal = false;
+	}
+
+	start = std::chrono::steady_clock::now();
+	if(boost::filesystem::remove_all(tmptestpath, ec) == 0 || ec)
+		retVal = false;
+	double deleteSeconds = secondsSince(start);
+	if(!retVal)
+		return false;
+
+	out << "    { \"test\": \"tree\", \"depth\": " << options.treeDepth
+		<< ", \"files_per_level\": " << options.filesPerLevel
+		<< ", \"mkdirs_per_s\": " << perSecond(options.treeDepth, mkdirSeconds)
+		<< ", \"creates_per_s\": " << perSecond(fileCount, createSeconds)
+		<< ", \"stats_per_s\": " << perSecond(fileCount, statSeconds)
+		<< ", \"list_ms\": " << listSeconds * 1000.0
+		<< ", \"rename_top_ms\": " << renameSeconds * 1000.0
+		<< ", \"delete_tree_ms\": " << deleteSeconds * 1000.0 << " }";
+	return true;
+}
+
+bool TestManyFiles::createFile(const boost::filesystem::path &filename)
+{
+	FILE *fd = TestFileHelper::fopen(filename, "wb");
+	if(fd == NULL)
+		return false;
+
+	unsigned char buf[10];
+	for(int i = 0; i < 10; i++)
+		buf[i] = static_cast<unsigned char>(i);
+	bool retVal = (fwrite(buf, 1, 10, fd) == 10);
+	fclose(fd);
+	return retVal;
+}
+
+/**
+ * Lists the folder, returns the time it took in seconds.
+ */
+double TestManyFiles::listFolder(const boost::filesystem::path &dirpath, size_t &entryCount)
+{
+	boost::system::error_code ec;
+	entryCount = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	boost::filesystem::directory_iterator dir_iter(dirpath, ec);
+	while(!ec && dir_iter != boost::filesystem::directory_iterator())
+	{
+		entryCount++;
+		dir_iter.increment(ec);
+	}
+	return secondsSince(start);
+}
+
+std::string TestManyFiles::jsonString(const std::string &str)
+{
+	std::string result("\"");
+	for(size_t i = 0; i < str.length(); i++)
+	{
+		if(str[i] == '"' || str[i] == '\\')
+			result += '\\';
+		result += str[i];
+	}
+	result += '"';
+	return result;
+}
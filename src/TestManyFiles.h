@@ -20,6 +20,11 @@
 #ifndef TESTMANYFILES_H
 #define TESTMANYFILES_H
 
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "boost/filesystem.hpp"
 
 class TestManyFiles
@@ -28,10 +33,33 @@ public:
 
 	static bool runTest(const boost::filesystem::path &testpath);
 
+	struct BenchmarkOptions
+	{
+		BenchmarkOptions() : maxEntries(100000), treeDepth(32), filesPerLevel(10) { }
+
+		int maxEntries;		// Folders of 1000, 10000, ... entries up to maxEntries are measured
+		int treeDepth;		// Depth of the tree of nested folders, 0 to skip it
+		int filesPerLevel;
+		std::vector<std::pair<std::string, std::string> > buildInfo;	// Written to the "build" object
+	};
+
+	/**
+	 * Measures metadata operations, and writes the results as JSON to out.
+	 */
+	static bool runBenchmark(const boost::filesystem::path &testpath,
+		const BenchmarkOptions &options, std::ostream &out);
 
 private:
 	TestManyFiles() { }
 	virtual ~TestManyFiles() { }
+
+	static bool benchmarkFolder(const boost::filesystem::path &testpath, int entryCount,
+		std::ostream &out);
+	static bool benchmarkTree(const boost::filesystem::path &testpath,
+		const BenchmarkOptions &options, std::ostream &out);
+	static bool createFile(const boost::filesystem::path &filename);
+	static double listFolder(const boost::filesystem::path &dirpath, size_t &entryCount);
+	static std::string jsonString(const std::string &str);
 };
 
 #endif
@@ -0,0 +1,275 @@
+/**
+* Copyright (C) 2026 Roman Hiestand
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify, merge, publish, distribute,
+* sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial
+* portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TestStress.h"
+#include "TestBigFile.h"
+#include "TestFileHelper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string.h>
+#include <boost/thread.hpp>
+
+// Tags of the initial data have writer 0 and the block index as sequence number
+static const int tagWriterShift = 40;
+
+// Only the first errors are printed, the others are just counted
+static const int64_t maxPrintedErrors = 10;
+
+/**
+ * Runs the stress test with 1, 2, 4, ... and finally maxThreads threads.
+ *
+ * The files stay in place between the runs, and so do the tags of the private
+ * files, which are checked against the data written by the previous runs.
+ */
+bool TestStress::run(const boost::filesystem::path &testpath, const Options &inOptions,
+	std::ostream &out)
+{
+	Options options(inOptions);
+	options.maxThreads = std::max(options.maxThreads, 1);
+	// gendata() offsets of the tags must not overlap, see fillBlock()
+	options.blockSize = std::min(std::max(options.blockSize, 16), 65536);
+
+	boost::system::error_code ec;
+	boost::filesystem::path testdir = testpath / boost::filesystem::unique_path();
+	if(!boost::filesystem::create_directories(testdir, ec))
+		return false;
+
+	std::cerr << "Creating " << options.maxThreads + 1 << " test files" << std::endl;
+	std::vector<uint64_t> sharedTags;
+	bool retVal = writeFile(testdir / L"shared.bin", options.sharedFileSize, options.blockSize, sharedTags);
+	std::vector<std::vector<uint64_t> > privateTags(options.maxThreads);
+	for(int i = 0; i < options.maxThreads && retVal; i++)
+		retVal = writeFile(privateFileName(testdir, i), options.privateFileSize, options.blockSize, privateTags[i]);
+
+	out << "threads,seconds,reads,writes,stats,lists,ops_per_s,mb_per_s,scaling,errors" << std::endl;
+
+	double singleThreadOpsPerSecond = 0.0;
+	int threadCount = 1;
+	while(retVal)
+	{
+		std::cerr << "Running with " << threadCount << " threads" << std::endl;
+		std::vector<ThreadResult> results(threadCount);
+		std::atomic<bool> isStopping(false);
+
+		std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+		boost::thread_group threads;
+		for(int i = 0; i < threadCount; i++)
+		{
+			ThreadResult &result = results[i];
+			std::vector<uint64_t> &tags = privateTags[i];
+			threads.create_thread([&testdir, &options, i, &tags, &isStopping, &result]()
+				{ runThread(testdir, options, i, options.maxThreads + 1, tags, isStopping, result); });
+		}
+		boost::this_thread::sleep_for(boost::chrono::seconds(options.secondsPerRun));
+		isStopping = true;
+		threads.join_all();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+		ThreadResult total;
+		for(size_t i = 0; i < results.size(); i++)
+		{
+			total.reads += results[i].reads;
+			total.writes += results[i].writes;
+			total.stats += results[i].stats;
+			total.lists += results[i].lists;
+			total.bytes += results[i].bytes;
+			total.errors += results[i].errors;
+		}
+		int64_t ops = total.reads + total.writes + total.stats + total.lists;
+		double opsPerSecond = (seconds > 0.0) ? static_cast<double>(ops) / seconds : 0.0;
+		if(threadCount == 1)
+			singleThreadOpsPerSecond = opsPerSecond;
+
+		out << threadCount << ","
+			<< seconds << ","
+			<< total.reads << ","
+			<< total.writes << ","
+			<< total.stats << ","
+			<< total.lists << ","
+			<< opsPerSecond << ","
+			<< (seconds > 0.0 ? static_cast<double>(total.bytes) / (1024.0 * 1024.0) / seconds : 0.0) << ","
+			<< (singleThreadOpsPerSecond > 0.0 ? opsPerSecond / singleThreadOpsPerSecond : 0.0) << ","
+			<< total.errors << std::endl;
+
+		if(total.errors > 0)
+			retVal = false;
+		if(threadCount == options.maxThreads)
+			break;
+		threadCount = std::min(threadCount * 2, options.maxThreads);
+	}
+
+	if(!boost::filesystem::remove_all(testdir, ec))
+		retVal = false;
+
+	return retVal;
+}
+
+/**
+ * Does random operations until isStopping is set: 40% reads, 30% writes of one
+ * block, 20% stats and 10% listings of the test folder. Half of the reads and
+ * writes go to the shared file, the other half to the private file of the thread.
+ */
+void TestStress::runThread(const boost::filesystem::path &testdir, const Options &options,
+	int threadIndex, int entryCount, std::vector<uint64_t> &privateTags,
+	const std::atomic<bool> &isStopping, ThreadResult &result)
+{
+	boost::filesystem::path sharedName = testdir / L"shared.bin";
+	boost::filesystem::path privateName = privateFileName(testdir, threadIndex);
+	FILE *files[2];
+	files[0] = TestFileHelper::fopen_shared(sharedName, "r+b");
+	files[1] = TestFileHelper::fopen_shared(privateName, "r+b");
+	for(int i = 0; i < 2; i++)
+	{
+		if(files[i] == NULL)
+			result.errors++;
+		else
+			setvbuf(files[i], NULL, _IONBF, 0);		// One request per block
+	}
+
+	const int64_t blockCounts[2] = { options.sharedFileSize / options.blockSize,
+		options.privateFileSize / options.blockSize };
+	const int64_t fileSizes[2] = { blockCounts[0] * options.blockSize, blockCounts[1] * options.blockSize };
+	std::mt19937_64 rng(static_cast<uint64_t>(threadIndex) * 7919 + 1);
+	uint64_t sequence = 0;
+	std::vector<unsigned char> block(options.blockSize);
+
+	while(!isStopping && result.errors == 0)
+	{
+		int op = static_cast<int>(rng() % 10);
+		int fileIndex = static_cast<int>(rng() % 2);
+		FILE *fp = files[fileIndex];
+		int64_t blockIndex = static_cast<int64_t>(rng() % static_cast<uint64_t>(std::max(blockCounts[fileIndex], static_cast<int64_t>(1))));
+		int64_t offset = blockIndex * options.blockSize;
+		std::string error;
+
+		if(op < 4)
+		{
+			uint64_t tag = 0;
+			if(TestFileHelper::fseek64(fp, offset) != 0 || fread(block.data(), 1, block.size(), fp) != block.size())
+				error = "fread failed";
+			else if(!checkBlock(block, &tag))
+				error = "corrupt block";
+			else if(fileIndex == 1 && tag != privateTags[blockIndex])
+				error = "lost write";
+			result.reads++;
+			result.bytes += block.size();
+		}
+		else if(op < 7)
+		{
+			uint64_t tag = (static_cast<uint64_t>(threadIndex + 1) << tagWriterShift) | ++sequence;
+			fillBlock(tag, block);
+			if(TestFileHelper::fseek64(fp, offset) != 0 || fwrite(block.data(), 1, block.size(), fp) != block.size())
+				error = "fwrite failed";
+			else if(fileIndex == 1)
+				privateTags[blockIndex] = tag;
+			result.writes++;
+			result.bytes += block.size();
+		}
+		else if(op < 9)
+		{
+			boost::system::error_code ec;
+			boost::uintmax_t size = boost::filesystem::file_size(fileIndex == 0 ? sharedName : privateName, ec);
+			if(ec || static_cast<int64_t>(size) != fileSizes[fileIndex])
+				error = "wrong file size";
+			result.stats++;
+		}
+		else
+		{
+			boost::system::error_code ec;
+			int count = 0;
+			for(boost::filesystem::directory_iterator it(testdir, ec), end; !ec && it != end; it.increment(ec))
+				count++;
+			if(ec || count != entryCount)
+				error = "wrong folder listing";
+			result.lists++;
+		}
+
+		if(!error.empty())
+		{
+			if(result.errors < maxPrintedErrors)
+			{
+				std::cerr << "Thread " << threadIndex << ": " << error << " in "
+					<< (fileIndex == 0 ? "shared" : "private") << " file at " << offset << std::endl;
+			}
+			result.errors++;
+		}
+	}
+
+	for(int i = 0; i < 2; i++)
+	{
+		if(files[i] != NULL)
+			fclose(files[i]);
+	}
+}
+
+/**
+ * Stores the tag in the first 8 bytes of the block and fills the rest with
+ * TestBigFile::gendata() at an offset derived from the tag.
+ */
+void TestStress::fillBlock(uint64_t tag, std::vector<unsigned char> &block)
+{
+	for(int i = 0; i < 8; i++)
+		block[i] = static_cast<unsigned char>(tag >> (8 * i));
+	TestBigFile::gendata(static_cast<int64_t>(tag << 16), static_cast<int64_t>(block.size()) - 8, block.data() + 8);
+}
+
+bool TestStress::checkBlock(const std::vector<unsigned char> &block, uint64_t *tag)
+{
+	uint64_t t = 0;
+	for(int i = 0; i < 8; i++)
+		t |= static_cast<uint64_t>(block[i]) << (8 * i);
+
+	std::vector<unsigned char> expected(block.size());
+	fillBlock(t, expected);
+	*tag = t;
+	return memcmp(block.data(), expected.data(), block.size()) == 0;
+}
+
+/**
+ * Creates a file of whole blocks with the initial tags, and returns the tags.
+ */
+bool TestStress::writeFile(const boost::filesystem::path &filename, int64_t size, int blockSize,
+	std::vector<uint64_t> &tags)
+{
+	FILE *fp = TestFileHelper::fopen(filename, "wb");
+	if(fp == NULL)
+		return false;
+
+	bool retVal = true;
+	std::vector<unsigned char> block(blockSize);
+	int64_t blockCount = size / blockSize;
+	tags.resize(static_cast<size_t>(blockCount));
+	for(int64_t i = 0; i < blockCount && retVal; i++)
+	{
+		tags[i] = static_cast<uint64_t>(i);
+		fillBlock(tags[i], block);
+		retVal = (fwrite(block.data(), 1, block.size(), fp) == block.size());
+	}
+	fclose(fp);
+
+	return retVal;
+}
+
+boost::filesystem::path TestStress::privateFileName(const boost::filesystem::path &testdir, int threadIndex)
+{
+	return testdir / ("private" + std::to_string(threadIndex) + ".bin");
+}
@@ -0,0 +1,86 @@
+/**
+* Copyright (C) 2026 Roman Hiestand
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify, merge, publish, distribute,
+* sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial
+* portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef TESTSTRESS_H
+#define TESTSTRESS_H
+
+#include <atomic>
+#include <ostream>
+#include <stdint.h>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+
+/**
+ * Concurrency stress test and benchmark of a mounted volume.
+ *
+ * Like TestOpenFileTwice, but with many handles at once: every thread reads,
+ * writes, stats and lists a file shared by all threads and a private file of its
+ * own, at random. Each block carries a tag from which the rest of its data is
+ * generated, so a torn or misplaced block is detected on every read. The blocks
+ * of the private files must in addition hold the last tag written by their owner.
+ *
+ * The test runs with 1, 2, 4, ... threads up to the maximum and prints a CSV line
+ * per thread count, with the throughput relative to the single thread run.
+ */
+class TestStress
+{
+public:
+	struct Options
+	{
+		Options() : maxThreads(8), secondsPerRun(10), sharedFileSize(16 * 1024 * 1024),
+			privateFileSize(4 * 1024 * 1024), blockSize(4096) { }
+
+		int maxThreads;
+		int secondsPerRun;
+		int64_t sharedFileSize;
+		int64_t privateFileSize;
+		int blockSize;
+	};
+
+	static bool run(const boost::filesystem::path &testpath, const Options &options,
+		std::ostream &out);
+
+private:
+	TestStress() { }
+	virtual ~TestStress() { }
+
+	struct ThreadResult
+	{
+		ThreadResult() : reads(0), writes(0), stats(0), lists(0), bytes(0), errors(0) { }
+
+		int64_t reads;
+		int64_t writes;
+		int64_t stats;
+		int64_t lists;
+		int64_t bytes;
+		int64_t errors;
+	};
+
+	static void runThread(const boost::filesystem::path &testdir, const Options &options,
+		int threadIndex, int entryCount, std::vector<uint64_t> &privateTags,
+		const std::atomic<bool> &isStopping, ThreadResult &result);
+	static void fillBlock(uint64_t tag, std::vector<unsigned char> &block);
+	static bool checkBlock(const std::vector<unsigned char> &block, uint64_t *tag);
+	static bool writeFile(const boost::filesystem::path &filename, int64_t size, int blockSize,
+		std::vector<uint64_t> &tags);
+	static boost::filesystem::path privateFileName(const boost::filesystem::path &testdir, int threadIndex);
+};
+
+#endif
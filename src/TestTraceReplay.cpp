@@ -0,0 +1,335 @@
+/**
+* Copyright (C) 2026 Roman Hiestand
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify, merge, publish, distribute,
+* sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial
+* portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "TestTraceReplay.h"
+#include "TestBigFile.h"
+#include "TestFileHelper.h"
+#include "FormatterStats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#if defined(_WIN32)
+#include <codecvt>
+#include <locale>
+#endif
+#include <thread>
+#include <boost/filesystem/fstream.hpp>
+
+static bool startsEarlier(const OpTrace::Record &a, const OpTrace::Record &b)
+{
+	return a.startMicros < b.startMicros;
+}
+
+/**
+ * Loads the whole trace, replays it below a new folder of testpath and prints the
+ * durations per operation type.
+ */
+bool TestTraceReplay::run(const boost::filesystem::path &testpath, const boost::filesystem::path &traceFile,
+	bool originalTiming, std::ostream &out)
+{
+	boost::filesystem::ifstream in(traceFile, std::ios::in | std::ios::binary);
+	if(!in || !OpTrace::readHeader(in))
+	{
+		std::cerr << "Not a trace file: " << traceFile.string() << std::endl;
+		return false;
+	}
+	std::vector<OpTrace::Record> records;
+	OpTrace::Record record;
+	while(OpTrace::read(in, record))
+	{
+		if(record.op < FormatterStats::opCount)
+			records.push_back(record);
+	}
+	in.close();
+
+	// Records are written when the operations complete
+	std::stable_sort(records.begin(), records.end(), startsEarlier);
+
+	// Files which don't exist yet are created with the size up to the last byte read,
+	// so the reads of files which existed before the trace return data
+	std::map<int64_t, std::string> openPaths;
+	std::map<std::string, int64_t> fileSizes;
+	for(size_t i = 0; i < records.size(); i++)
+	{
+		const OpTrace::Record &r = records[i];
+		if((r.op == FormatterStats::opOpen || r.op == FormatterStats::opMove) && r.result == 0)
+			openPaths[r.resultOpenId] = r.path;
+		else if(r.op == FormatterStats::opRead && r.result == 0 && openPaths.count(r.openId) > 0)
+		{
+			int64_t &fileSize = fileSizes[openPaths[r.openId]];
+			fileSize = std::max(fileSize, r.offset + static_cast<int64_t>(r.bytes));
+		}
+	}
+
+	boost::system::error_code ec;
+	boost::filesystem::path testdir = testpath / boost::filesystem::unique_path();
+	if(!boost::filesystem::create_directories(testdir, ec))
+		return false;
+
+	std::cerr << "Replaying " << records.size() << " operations"
+		<< (originalTiming ? " with the original timing" : "") << std::endl;
+
+	std::vector<int64_t> counts(FormatterStats::opCount, 0), skipped(FormatterStats::opCount, 0);
+	std::vector<uint64_t> recordedMicros(FormatterStats::opCount, 0), replayMicros(FormatterStats::opCount, 0);
+	OpenFileMap openFiles;
+	std::vector<unsigned char> buffer;
+
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < records.size(); i++)
+	{
+		const OpTrace::Record &r = records[i];
+		if(originalTiming)
+			std::this_thread::sleep_until(startTime + std::chrono::microseconds(r.startMicros));
+
+		std::chrono::steady_clock::time_point opStartTime = std::chrono::steady_clock::now();
+		bool isReplayed = replay(r, testdir, fileSizes, openFiles, buffer);
+		uint64_t micros = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - opStartTime).count());
+
+		if(isReplayed)
+		{
+			counts[r.op]++;
+			recordedMicros[r.op] += r.durationMicros;
+			replayMicros[r.op] += micros;
+		}
+		else
+			skipped[r.op]++;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	for(OpenFileMap::iterator iter = openFiles.begin(); iter != openFiles.end(); ++iter)
+		closeFile(iter->second);
+	boost::filesystem::remove_all(testdir, ec);
+
+	out << "operation,count,skipped,recorded_avg_us,replay_avg_us" << std::endl;
+	int64_t totalCount = 0, totalSkipped = 0;
+	uint64_t totalRecordedMicros = 0, totalReplayMicros = 0;
+	for(int op = 0; op < FormatterStats::opCount; op++)
+	{
+		if(counts[op] == 0 && skipped[op] == 0)
+			continue;
+		out << FormatterStats::getOperationName(static_cast<FormatterStats::Operation>(op))
+			<< "," << counts[op] << "," << skipped[op]
+			<< "," << (counts[op] > 0 ? recordedMicros[op] / counts[op] : 0)
+			<< "," << (counts[op] > 0 ? replayMicros[op] / counts[op] : 0) << std::endl;
+		totalCount += counts[op];
+		totalSkipped += skipped[op];
+		totalRecordedMicros += recordedMicros[op];
+		totalReplayMicros += replayMicros[op];
+	}
+	out << "total," << totalCount << "," << totalSkipped
+		<< "," << (totalCount > 0 ? totalRecordedMicros / totalCount : 0)
+		<< "," << (totalCount > 0 ? totalReplayMicros / totalCount : 0) << std::endl;
+
+	double recordedSeconds = records.empty() ? 0.0 : records.back().startMicros / 1e6;
+	std::cerr << "Replayed in " << seconds << " s, recorded " << recordedSeconds << " s" << std::endl;
+	return true;
+}
+
+bool TestTraceReplay::replay(const OpTrace::Record &record, const boost::filesystem::path &testdir,
+	const std::map<std::string, int64_t> &fileSizes, OpenFileMap &openFiles,
+	std::vector<unsigned char> &buffer)
+{
+	boost::system::error_code ec;
+
+	if(record.op == FormatterStats::opOpen)
+	{
+		boost::filesystem::path path = localPath(testdir, record.path);
+		if(record.result != 0)
+		{
+			// Lookup of a file which doesn't exist
+			boost::filesystem::exists(path, ec);
+			return true;
+		}
+		if(openFiles.count(record.resultOpenId) > 0)
+			return true;		// Opened again with the same open id
+
+		OpenFile &openFile = openFiles[record.resultOpenId];
+		openFile.path = path;
+		openFile.isFolder = (record.fileType == OpTrace::fileTypeFolder);
+		if(openFile.isFolder)
+		{
+			if(!boost::filesystem::exists(path, ec))
+				boost::filesystem::create_directories(path, ec);
+			return true;
+		}
+		if(!boost::filesystem::exists(path, ec))
+		{
+			boost::filesystem::create_directories(path.parent_path(), ec);
+			FILE *fp = TestFileHelper::fopen(path, "wb");
+			if(fp == NULL)
+				return false;
+			fclose(fp);
+			std::map<std::string, int64_t>::const_iterator iter = fileSizes.find(record.path);
+			if(iter != fileSizes.end())
+				boost::filesystem::resize_file(path, static_cast<uintmax_t>(iter->second), ec);
+		}
+		openFile.fp = TestFileHelper::fopen_shared(path, "r+b");
+		if(openFile.fp == NULL)
+			openFile.fp = TestFileHelper::fopen_shared(path, "rb");
+		return openFile.fp != NULL;
+	}
+
+	// All other operations refer to an open file
+	if(record.result != 0)
+		return false;
+	OpenFileMap::iterator iter = openFiles.find(record.openId);
+	if(iter == openFiles.end())
+		return false;
+	OpenFile &openFile = iter->second;
+	if(openFile.isDeleted && record.op != FormatterStats::opClose)
+		return false;
+
+	switch(record.op)
+	{
+	case FormatterStats::opReplace:
+		{
+			// The target is replaced by a new, empty file
+			closeFile(openFile);
+			OpenFile &newFile = openFiles[record.resultOpenId];
+			newFile.path = openFile.path;
+			newFile.fp = TestFileHelper::fopen_shared(newFile.path, "w+b");
+			return newFile.fp != NULL;
+		}
+
+	case FormatterStats::opMove:
+		{
+			boost::filesystem::path newPath = localPath(testdir, record.path);
+			closeFile(openFile);
+			boost::filesystem::create_directories(newPath.parent_path(), ec);
+			boost::filesystem::rename(openFile.path, newPath, ec);
+			openFile.path = newPath;
+			if(record.resultOpenId != record.openId && openFiles.count(record.resultOpenId) == 0)
+			{
+				OpenFile &newFile = openFiles[record.resultOpenId];
+				newFile.path = newPath;
+				newFile.isFolder = openFile.isFolder;
+			}
+			return !ec;
+		}
+
+	case FormatterStats::opMoveReplace:
+		{
+			// resultOpenId is the open id of the replaced target
+			OpenFileMap::iterator targetIter = openFiles.find(record.resultOpenId);
+			if(targetIter == openFiles.end())
+				return false;
+			closeFile(openFile);
+			closeFile(targetIter->second);
+			boost::filesystem::remove(targetIter->second.path, ec);
+			boost::filesystem::rename(openFile.path, targetIter->second.path, ec);
+			openFile.path = targetIter->second.path;
+			targetIter->second.isDeleted = true;
+			return !ec;
+		}
+
+	case FormatterStats::opDelete:
+		closeFile(openFile);
+		if(openFile.isFolder)
+			boost::filesystem::remove_all(openFile.path, ec);
+		else
+			boost::filesystem::remove(openFile.path, ec);
+		openFile.isDeleted = true;
+		return !ec;
+
+	case FormatterStats::opClose:
+		closeFile(openFile);
+		openFiles.erase(iter);
+		return true;
+
+	case FormatterStats::opFlushFile:
+		if(openFile.fp != NULL)
+			fflush(openFile.fp);
+		return true;
+
+	case FormatterStats::opList:
+		{
+			boost::filesystem::directory_iterator dirIter(openFile.path, ec), endIter;
+			while(!ec && dirIter != endIter)
+				dirIter.increment(ec);
+			return !ec;
+		}
+
+	case FormatterStats::opListEnd:
+		return true;
+
+	case FormatterStats::opRead:
+	case FormatterStats::opWrite:
+		{
+			// Files are opened again after a move
+			if(openFile.fp == NULL && !openFile.isFolder)
+				openFile.fp = TestFileHelper::fopen_shared(openFile.path, "r+b");
+			if(openFile.fp == NULL || TestFileHelper::fseek64(openFile.fp, record.offset) != 0)
+				return false;
+			size_t size = static_cast<size_t>(record.size);
+			if(buffer.size() < size)
+				buffer.resize(size);
+			if(size == 0)
+				return true;
+			if(record.op == FormatterStats::opRead)
+			{
+				fread(&buffer[0], 1, size, openFile.fp);
+				return true;
+			}
+			TestBigFile::gendata(record.offset, static_cast<int64_t>(size), &buffer[0]);
+			return fwrite(&buffer[0], 1, size, openFile.fp) == size;
+		}
+
+	case FormatterStats::opSetSize:
+		closeFile(openFile);
+		boost::filesystem::resize_file(openFile.path, static_cast<uintmax_t>(record.offset), ec);
+		return !ec;
+
+	case FormatterStats::opAccess:
+		boost::filesystem::status(openFile.path, ec);
+		return !ec;
+
+	default:
+		// Capacity, media info, control and xattrs have no equivalent in the file API
+		return false;
+	}
+}
+
+void TestTraceReplay::closeFile(OpenFile &openFile)
+{
+	if(openFile.fp != NULL)
+	{
+		fclose(openFile.fp);
+		openFile.fp = NULL;
+	}
+}
+
+/**
+ * Maps the UTF-8 path of the trace, relative to the root of the traced volume, to testdir.
+ */
+boost::filesystem::path TestTraceReplay::localPath(const boost::filesystem::path &testdir, const std::string &path)
+{
+	std::string relativePath = path;
+	while(!relativePath.empty() && relativePath[0] == '/')
+		relativePath.erase(0, 1);
+	if(relativePath.empty())
+		return testdir;
+#if defined(_WIN32)
+	std::wstring_convert<std::codecvt_utf8_utf16<wchar_t> > converter;
+	return testdir / boost::filesystem::path(converter.from_bytes(relativePath)).make_preferred();
+#else
+	return testdir / relativePath;
+#endif
+}
@@ -0,0 +1,77 @@
+/**
+* Copyright (C) 2026 Roman Hiestand
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+* and associated documentation files (the "Software"), to deal in the Software without restriction,
+* including without limitation the rights to use, copy, modify, merge, publish, distribute,
+* sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial
+* portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+* LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef TESTTRACEREPLAY_H
+#define TESTTRACEREPLAY_H
+
+#include <map>
+#include <ostream>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+
+#include "OpTrace.h"
+
+/**
+ * Replays a trace recorded by the formatter (see OpTrace) against a mounted volume.
+ *
+ * The operations are turned back into file system calls below a new folder of the
+ * test path: opens create the files and folders which don't exist yet, reads and
+ * writes go to the same offsets with the same sizes, and so on. Operations without
+ * an equivalent in the file API (capacity, media info, control, xattrs) are skipped.
+ *
+ * The operations run one after the other, in the order they were started. With the
+ * original timing, every operation waits for its recorded start time; otherwise the
+ * trace is replayed as fast as possible. A CSV line per operation type compares the
+ * recorded with the replayed average duration.
+ */
+class TestTraceReplay
+{
+public:
+	static bool run(const boost::filesystem::path &testpath, const boost::filesystem::path &traceFile,
+		bool originalTiming, std::ostream &out);
+
+private:
+	TestTraceReplay() { }
+	virtual ~TestTraceReplay() { }
+
+	struct OpenFile
+	{
+		OpenFile() : isFolder(false), isDeleted(false), fp(NULL) { }
+
+		boost::filesystem::path path;
+		bool isFolder;
+		bool isDeleted;		// Deleted or replaced, only the close is left
+		FILE *fp;
+	};
+
+	typedef std::map<int64_t, OpenFile> OpenFileMap;
+
+	// Returns false if the operation can't be replayed
+	static bool replay(const OpTrace::Record &record, const boost::filesystem::path &testdir,
+		const std::map<std::string, int64_t> &fileSizes, OpenFileMap &openFiles,
+		std::vector<unsigned char> &buffer);
+	static void closeFile(OpenFile &openFile);
+	static boost::filesystem::path localPath(const boost::filesystem::path &testdir, const std::string &path);
+};
+
+#endif
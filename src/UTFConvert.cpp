@@ -0,0 +1,335 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "UTFConvert.h"
+
+#include <algorithm>
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTF_CONVERT_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define UTF_CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+// Characters converted per iteration of the vector loops
+static const size_t vectorStride = 16;
+
+static inline uint32_t codeUnit(wchar_t c)
+{
+	return (sizeof(wchar_t) == 2) ? static_cast<uint16_t>(c) : static_cast<uint32_t>(c);
+}
+
+/**
+ * Widens the ASCII characters at the start of src into dst, vectorStride at a
+ * time. Returns the number of characters converted, stops before the first
+ * block with a non-ASCII character, or with less than vectorStride characters.
+ */
+static size_t widenASCII(const unsigned char *src, size_t len, wchar_t *dst)
+{
+	size_t i = 0;
+#if defined(UTF_CONVERT_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	for(; i + vectorStride <= len; i += vectorStride)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+		if(_mm_movemask_epi8(v) != 0)
+			break;
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
+		__m128i *out = reinterpret_cast<__m128i *>(dst + i);
+		if(sizeof(wchar_t) == 2)
+		{
+			_mm_storeu_si128(out, lo);
+			_mm_storeu_si128(out + 1, hi);
+		}
+		else
+		{
+			_mm_storeu_si128(out, _mm_unpacklo_epi16(lo, zero));
+			_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(lo, zero));
+			_mm_storeu_si128(out + 2, _mm_unpacklo_epi16(hi, zero));
+			_mm_storeu_si128(out + 3, _mm_unpackhi_epi16(hi, zero));
+		}
+	}
+#elif defined(UTF_CONVERT_NEON)
+	for(; i + vectorStride <= len; i += vectorStride)
+	{
+		uint8x16_t v = vld1q_u8(src + i);
+		if(vmaxvq_u8(v) >= 0x80)
+			break;
+		uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+		uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+		if(sizeof(wchar_t) == 2)
+		{
+			uint16_t *out = reinterpret_cast<uint16_t *>(dst + i);
+			vst1q_u16(out, lo);
+			vst1q_u16(out + 8, hi);
+		}
+		else
+		{
+			uint32_t *out = reinterpret_cast<uint32_t *>(dst + i);
+			vst1q_u32(out, vmovl_u16(vget_low_u16(lo)));
+			vst1q_u32(out + 4, vmovl_u16(vget_high_u16(lo)));
+			vst1q_u32(out + 8, vmovl_u16(vget_low_u16(hi)));
+			vst1q_u32(out + 12, vmovl_u16(vget_high_u16(hi)));
+		}
+	}
+#endif
+	return i;
+}
+
+/**
+ * The reverse of widenASCII().
+ */
+static size_t narrowASCII(const wchar_t *src, size_t len, unsigned char *dst)
+{
+	size_t i = 0;
+#if defined(UTF_CONVERT_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	for(; i + vectorStride <= len; i += vectorStride)
+	{
+		const __m128i *in = reinterpret_cast<const __m128i *>(src + i);
+		__m128i packed;
+		if(sizeof(wchar_t) == 2)
+		{
+			__m128i a = _mm_loadu_si128(in);
+			__m128i b = _mm_loadu_si128(in + 1);
+			__m128i high = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16(static_cast<short>(0xff80)));
+			if(_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xffff)
+				break;
+			packed = _mm_packus_epi16(a, b);
+		}
+		else
+		{
+			__m128i a = _mm_loadu_si128(in);
+			__m128i b = _mm_loadu_si128(in + 1);
+			__m128i c = _mm_loadu_si128(in + 2);
+			__m128i d = _mm_loadu_si128(in + 3);
+			__m128i high = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)),
+				_mm_set1_epi32(static_cast<int>(0xffffff80)));
+			if(_mm_movemask_epi8(_mm_cmpeq_epi32(high, zero)) != 0xffff)
+				break;
+			// All below 0x80, the saturating packs keep the values
+			packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), packed);
+	}
+#elif defined(UTF_CONVERT_NEON)
+	for(; i + vectorStride <= len; i += vectorStride)
+	{
+		uint8x16_t packed;
+		if(sizeof(wchar_t) == 2)
+		{
+			const uint16_t *in = reinterpret_cast<const uint16_t *>(src + i);
+			uint16x8_t a = vld1q_u16(in);
+			uint16x8_t b = vld1q_u16(in + 8);
+			if(vmaxvq_u16(vorrq_u16(a, b)) >= 0x80)
+				break;
+			packed = vcombine_u8(vmovn_u16(a), vmovn_u16(b));
+		}
+		else
+		{
+			const uint32_t *in = reinterpret_cast<const uint32_t *>(src + i);
+			uint32x4_t a = vld1q_u32(in);
+			uint32x4_t b = vld1q_u32(in + 4);
+			uint32x4_t c = vld1q_u32(in + 8);
+			uint32x4_t d = vld1q_u32(in + 12);
+			if(vmaxvq_u32(vorrq_u32(vorrq_u32(a, b), vorrq_u32(c, d))) >= 0x80)
+				break;
+			packed = vcombine_u8(vmovn_u16(vcombine_u16(vmovn_u32(a), vmovn_u32(b))),
+				vmovn_u16(vcombine_u16(vmovn_u32(c), vmovn_u32(d))));
+		}
+		vst1q_u8(dst + i, packed);
+	}
+#endif
+	return i;
+}
+
+ptrdiff_t UTFConvert::toWide(const char *src, size_t len, wchar_t *dst, size_t dstLen)
+{
+	// The smallest value of the sequences with 1, 2 and 3 continuation bytes
+	static const uint32_t minValue[4] = { 0, 0x80, 0x800, 0x10000 };
+
+	const unsigned char *s = reinterpret_cast<const unsigned char *>(src);
+	size_t i = 0, n = 0;
+	while(i < len)
+	{
+		if(s[i] < 0x80)
+		{
+			size_t ascii = widenASCII(s + i, std::min(len - i, dstLen - n), dst + n);
+			i += ascii;
+			n += ascii;
+			// The rest of the run, up to the next multi-byte character
+			for(; i < len && s[i] < 0x80; i++)
+			{
+				if(n >= dstLen)
+					return -1;
+				dst[n++] = static_cast<wchar_t>(s[i]);
+			}
+			continue;
+		}
+
+		uint32_t c;
+		size_t extra;
+		if((s[i] & 0xe0) == 0xc0)
+		{
+			c = s[i] & 0x1f;
+			extra = 1;
+		}
+		else if((s[i] & 0xf0) == 0xe0)
+		{
+			c = s[i] & 0x0f;
+			extra = 2;
+		}
+		else if((s[i] & 0xf8) == 0xf0)
+		{
+			c = s[i] & 0x07;
+			extra = 3;
+		}
+		else
+		{
+			// A continuation byte without a lead byte, or no UTF-8 at all
+			i++;
+			continue;
+		}
+		if(len - i <= extra)
+		{
+			i++;
+			continue;
+		}
+		size_t k = 1;
+		for(; k <= extra && (s[i + k] & 0xc0) == 0x80; k++)
+			c = (c << 6) | (s[i + k] & 0x3f);
+		i += k;
+		// Truncated sequences, overlong forms, surrogates and values beyond Unicode
+		if(k <= extra || c < minValue[extra] || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff))
+			continue;
+
+		if(sizeof(wchar_t) == 2 && c >= 0x10000)
+		{
+			if(dstLen - n < 2)
+				return -1;
+			c -= 0x10000;
+			dst[n++] = static_cast<wchar_t>(0xd800 + (c >> 10));
+			dst[n++] = static_cast<wchar_t>(0xdc00 + (c & 0x3ff));
+		}
+		else
+		{
+			if(n >= dstLen)
+				return -1;
+			dst[n++] = static_cast<wchar_t>(c);
+		}
+	}
+	dst[n] = L'\0';
+	return static_cast<ptrdiff_t>(n);
+}
+
+void UTFConvert::toWide(const char *src, size_t len, std::wstring &dst)
+{
+	// Every byte gives at most one character, surrogate pairs come from 4 bytes
+	dst.resize(len);
+	ptrdiff_t n = toWide(src, len, &dst[0], len);
+	dst.resize(static_cast<size_t>(n));
+}
+
+std::wstring UTFConvert::toWide(const std::string &src)
+{
+	std::wstring dst;
+	toWide(src.data(), src.length(), dst);
+	return dst;
+}
+
+ptrdiff_t UTFConvert::toUTF8(const wchar_t *src, size_t len, char *dst, size_t dstLen)
+{
+	unsigned char *d = reinterpret_cast<unsigned char *>(dst);
+	size_t i = 0, n = 0;
+	while(i < len)
+	{
+		uint32_t c = codeUnit(src[i]);
+		if(c < 0x80)
+		{
+			size_t ascii = narrowASCII(src + i, std::min(len - i, dstLen - n), d + n);
+			i += ascii;
+			n += ascii;
+			for(; i < len && codeUnit(src[i]) < 0x80; i++)
+			{
+				if(n >= dstLen)
+					return -1;
+				d[n++] = static_cast<unsigned char>(src[i]);
+			}
+			continue;
+		}
+
+		i++;
+		if(sizeof(wchar_t) == 2 && c >= 0xd800 && c <= 0xdbff)
+		{
+			uint32_t low = (i < len) ? codeUnit(src[i]) : 0;
+			if(low < 0xdc00 || low > 0xdfff)
+				continue;		// A high surrogate without a low one
+			i++;
+			c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+		}
+		else if((c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff)
+		{
+			continue;
+		}
+
+		if(c < 0x800)
+		{
+			if(dstLen - n < 2)
+				return -1;
+			d[n++] = static_cast<unsigned char>(0xc0 | (c >> 6));
+		}
+		else if(c < 0x10000)
+		{
+			if(dstLen - n < 3)
+				return -1;
+			d[n++] = static_cast<unsigned char>(0xe0 | (c >> 12));
+			d[n++] = static_cast<unsigned char>(0x80 | ((c >> 6) & 0x3f));
+		}
+		else
+		{
+			if(dstLen - n < 4)
+				return -1;
+			d[n++] = static_cast<unsigned char>(0xf0 | (c >> 18));
+			d[n++] = static_cast<unsigned char>(0x80 | ((c >> 12) & 0x3f));
+			d[n++] = static_cast<unsigned char>(0x80 | ((c >> 6) & 0x3f));
+		}
+		d[n++] = static_cast<unsigned char>(0x80 | (c & 0x3f));
+	}
+	d[n] = '\0';
+	return static_cast<ptrdiff_t>(n);
+}
+
+void UTFConvert::toUTF8(const wchar_t *src, size_t len, std::string &dst)
+{
+	size_t maxLen = maxUTF8Length(len);
+	dst.resize(maxLen);
+	ptrdiff_t n = toUTF8(src, len, &dst[0], maxLen);
+	dst.resize(static_cast<size_t>(n));
+}
+
+std::string UTFConvert::toUTF8(const std::wstring &src)
+{
+	std::string dst;
+	toUTF8(src.data(), src.length(), dst);
+	return dst;
+}
@@ -0,0 +1,59 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef UTFCONVERT_H
+#define UTFCONVERT_H
+
+#include <string>
+#include <stddef.h>
+
+/**
+ * Conversion between UTF-8 and wchar_t strings, UTF-16 on Windows and UTF-32
+ * elsewhere. Replaces boost::locale::conv::utf_to_utf for the names and paths
+ * converted per request.
+ *
+ * Runs of ASCII characters, which most names consist of, are converted 16 at
+ * a time with SSE2 or NEON. Invalid sequences are dropped, like utf_to_utf
+ * does.
+ */
+class UTFConvert
+{
+public:
+	/**
+	 * Converts len bytes of src into dst, which has room for dstLen characters
+	 * plus the terminating zero. Returns the number of characters, or -1 if
+	 * they don't fit. dst needs at most len characters.
+	 */
+	static ptrdiff_t toWide(const char *src, size_t len, wchar_t *dst, size_t dstLen);
+	// The capacity of dst is reused
+	static void toWide(const char *src, size_t len, std::wstring &dst);
+	static std::wstring toWide(const std::string &src);
+
+	/**
+	 * Converts len characters of src into dst, the same way. dst needs at most
+	 * maxUTF8Length(len) bytes.
+	 */
+	static ptrdiff_t toUTF8(const wchar_t *src, size_t len, char *dst, size_t dstLen);
+	static void toUTF8(const wchar_t *src, size_t len, std::string &dst);
+	static std::string toUTF8(const std::wstring &src);
+
+	static size_t maxUTF8Length(size_t wideLen) { return wideLen * (sizeof(wchar_t) == 2 ? 3 : 4); }
+};
+
+#endif
@@ -0,0 +1,317 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "VolumeConverter.h"
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+
+#include "fs_layer.h"
+
+// libencfs
+#include "Error.h"
+#include "FileUtils.h"
+#include "DirNode.h"
+#include "FileNode.h"
+
+// Entries decoded at once while walking a folder
+static const size_t walkBatchSize = 256;
+
+static const char checkpointSuffix[] = ".encfsmp-convert";
+
+VolumeConverter::VolumeConverter(const std::shared_ptr<encfs::EncFS_Root> &srcRoot,
+	const std::shared_ptr<encfs::EncFS_Root> &destRoot, CopyProgress *pProgress,
+	int convertThreads) :
+	srcRoot_(srcRoot),
+	destRoot_(destRoot),
+	pProgress_(pProgress),
+	convertThreads_(CopyPipeline::threadCount(convertThreads)),
+	checkpointFd_(-1),
+	checkpointSize_(0),
+	failed_(false)
+{
+}
+
+VolumeConverter::~VolumeConverter()
+{
+	if(checkpointFd_ >= 0)
+		fs_layer::close(checkpointFd_);
+}
+
+std::string VolumeConverter::checkpointFileName(const std::string &destDir)
+{
+	std::string dir(destDir);
+	while(dir.size() > 1 && (dir[dir.size() - 1] == '/' || dir[dir.size() - 1] == '\\'))
+		dir.erase(dir.size() - 1);
+	return dir + checkpointSuffix;
+}
+
+bool VolumeConverter::readCheckpointSource(const std::string &checkpointFile, std::string &srcDir)
+{
+	efs_stat st;
+	if(fs_layer::stat(checkpointFile.c_str(), &st) != 0)
+		return false;
+
+	// The first line is the source, the converted files follow
+	std::string contents = fs_layer::readFileToString(checkpointFile.c_str());
+	size_t lineEnd = contents.find('\n');
+	if(lineEnd == std::string::npos || lineEnd == 0)
+		return false;
+	srcDir = contents.substr(0, lineEnd);
+	return true;
+}
+
+bool VolumeConverter::openCheckpoint(const std::string &srcDir, const std::string &checkpointFile)
+{
+	std::string checkpointSrc;
+	if(readCheckpointSource(checkpointFile, checkpointSrc))
+	{
+		if(checkpointSrc != srcDir)
+			return false;
+
+		std::istringstream istr(fs_layer::readFileToString(checkpointFile.c_str()));
+		std::string line;
+		std::getline(istr, line);
+		checkpointSize_ = static_cast<int64_t>(line.size()) + 1;
+		// A line without its end was cut off while being written and is dropped
+		while(std::getline(istr, line) && !istr.eof())
+		{
+			doneFiles_.insert(line);
+			checkpointSize_ += static_cast<int64_t>(line.size()) + 1;
+		}
+	}
+
+	checkpointFd_ = fs_layer::open(checkpointFile.c_str(), O_WRONLY | O_CREAT, 0600);
+	if(checkpointFd_ < 0)
+		return false;
+	if(checkpointSize_ == 0)
+	{
+		std::string header = srcDir + '\n';
+		if(fs_layer::pwrite(checkpointFd_, header.c_str(), static_cast<int64_t>(header.size()), 0)
+			!= static_cast<int64_t>(header.size()))
+			return false;
+		checkpointSize_ = static_cast<int64_t>(header.size());
+	}
+	return fs_layer::ftruncate(checkpointFd_, checkpointSize_) == 0;
+}
+
+bool VolumeConverter::recordDone(const std::string &plainPath)
+{
+	std::string line = plainPath + '\n';
+	boost::mutex::scoped_lock lock(mutex_);
+	if(fs_layer::pwrite(checkpointFd_, line.c_str(), static_cast<int64_t>(line.size()), checkpointSize_)
+		!= static_cast<int64_t>(line.size()))
+		return false;
+	checkpointSize_ += static_cast<int64_t>(line.size());
+	return true;
+}
+
+bool VolumeConverter::isStopping() const
+{
+	return failed_ || pProgress_->cancel;
+}
+
+/**
+ * Wakes all threads, which exit as soon as they see isStopping().
+ */
+void VolumeConverter::fail()
+{
+	failed_ = true;
+	files_.stop();
+}
+
+bool VolumeConverter::run(const std::string &srcDir, const std::string &checkpointFile)
+{
+	if(!openCheckpoint(srcDir, checkpointFile))
+		return false;
+
+	boost::thread_group threads;
+	for(int i = 0; i < convertThreads_; i++)
+		threads.create_thread([this]() { convertLoop(); });
+
+	bool isOK = walkDir("/");
+	if(!isOK)
+		fail();
+	files_.close();
+	pProgress_->walkDone = true;
+
+	threads.join_all();
+	isOK = isOK && !isStopping();
+
+	fs_layer::close(checkpointFd_);
+	checkpointFd_ = -1;
+	if(isOK)
+		fs_layer::unlink(checkpointFile.c_str());
+	return isOK;
+}
+
+bool VolumeConverter::walkDir(const std::string &volumeDir)
+{
+	encfs::DirTraverse dt = srcRoot_->root->openDir(volumeDir.c_str());
+	if(!dt.valid())
+		return false;
+
+	std::vector<encfs::DirTraverse::Entry> entries = dt.nextBatch(walkBatchSize);
+	while(!entries.empty())
+	{
+		for(size_t i = 0; i < entries.size(); i++)
+		{
+			if(isStopping())
+				return false;
+
+			const encfs::DirTraverse::Entry &entry = entries[i];
+			if(entry.plainName == "." || entry.plainName == "..")
+				continue;
+
+			std::string plainPath = volumeDir + entry.plainName;
+			efs_stat stBuf = entry.stat;
+			if(!entry.hasStat)
+			{
+				std::string cpath = srcRoot_->root->cipherPath(plainPath.c_str());
+				if(fs_layer::lstat(cpath.c_str(), &stBuf))
+					return false;
+			}
+
+			if(S_ISDIR(stBuf.st_mode))
+			{
+				// Folders of an earlier run exist already
+				int res = destRoot_->root->mkdir(plainPath.c_str(), stBuf.st_mode);
+				if(res != 0 && res != -EEXIST)
+					return false;
+				if(!walkDir(plainPath + '/'))
+					return false;
+			}
+			else if(S_ISREG(stBuf.st_mode))
+			{
+				FileJob job;
+				job.srcNode = srcRoot_->root->lookupNode(plainPath.c_str(), "EncFSMP");
+				if(!job.srcNode)
+					return false;
+				job.plainPath = plainPath;
+				job.mode = static_cast<unsigned short>(stBuf.st_mode);
+				job.size = job.srcNode->getSize();
+				if(job.size < 0)
+					return false;
+
+				if(doneFiles_.count(plainPath) != 0)
+				{
+					pProgress_->filesFound++;
+					pProgress_->filesDone++;
+					pProgress_->bytesFound += job.size;
+					pProgress_->bytesDone += job.size;
+				}
+				else if(!queueFile(job))
+				{
+					return false;
+				}
+			}
+		}
+		entries = dt.nextBatch(walkBatchSize);
+	}
+	return true;
+}
+
+bool VolumeConverter::queueFile(const FileJob &job)
+{
+	pProgress_->filesFound++;
+	pProgress_->bytesFound += job.size;
+	if(isStopping() || !files_.push(job))
+	{
+		fail();
+		return false;
+	}
+	return true;
+}
+
+bool VolumeConverter::convertFile(const FileJob &job)
+{
+	if(job.srcNode->open(O_RDONLY) < 0)
+		return false;
+
+	std::shared_ptr<encfs::FileNode> destNode =
+		destRoot_->root->lookupNode(job.plainPath.c_str(), "EncFSMP");
+	if(!destNode)
+		return false;
+
+	// A file which exists was cut off by an interrupted run
+	int res = destNode->mknod(job.mode, 0);
+	if(res != 0 && res != -EEXIST)
+		return false;
+	if(destNode->open(O_RDWR) < 0)
+		return false;
+	if(res == -EEXIST && destNode->truncate(0) != 0)
+		return false;
+
+	// Whole blocks of the destination, the source blocks may be of another size
+	std::vector<unsigned char> buf(CopyPipeline::pieceSize(destNode->dataBlockSize()));
+	int64_t offset = 0;
+	while(offset < job.size)
+	{
+		if(isStopping())
+			return false;
+
+		ssize_t readBytes = job.srcNode->read(offset, &buf[0], buf.size());
+		if(readBytes < 0)
+			return false;
+		if(readBytes == 0)
+			break;
+
+		ssize_t written = destNode->write(offset, &buf[0], static_cast<size_t>(readBytes));
+		if(written != readBytes)
+			return false;
+		offset += readBytes;
+		pProgress_->bytesDone += readBytes;
+	}
+
+	// Only files which are on disk are recorded as done
+	if(destNode->sync(true) != 0 || !recordDone(job.plainPath))
+		return false;
+	pProgress_->filesDone++;
+	return true;
+}
+
+void VolumeConverter::convertLoop()
+{
+	FileJob job;
+	while(files_.pop(job))
+	{
+		if(isStopping())
+		{
+			fail();
+			break;
+		}
+
+		bool isOK = false;
+		try
+		{
+			isOK = convertFile(job);
+		}
+		catch(encfs::Error &)
+		{
+			isOK = false;
+		}
+		if(!isOK)
+			fail();
+	}
+}
@@ -0,0 +1,120 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VOLUMECONVERTER_H
+#define VOLUMECONVERTER_H
+
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <stdint.h>
+
+#include <boost/thread.hpp>
+
+#include "CopyPipeline.h"
+#include "CopyProgress.h"
+
+namespace encfs
+{
+	struct EncFS_Root;
+	class FileNode;
+}
+
+/**
+ * Copies the contents of one volume into another one, usually a new volume
+ * with a different cipher, block size or MAC setting.
+ *
+ * The calling thread walks the source folders and creates them in the
+ * destination. The files it finds are queued for the converting threads,
+ * which read them from the source in large pieces and write the pieces to
+ * the destination right away. FileNode::read() and FileNode::write() decrypt
+ * and encrypt the many blocks of a piece in parallel, and each thread holds a
+ * single piece, so the memory stays bounded for any size of volume.
+ *
+ * Each converted file is appended to a checkpoint file next to the
+ * destination folder. A conversion which was cancelled or interrupted skips
+ * these files when it is run again with the same checkpoint file.
+ */
+class VolumeConverter
+{
+public:
+	/**
+	 * convertThreads 0: one per core.
+	 */
+	VolumeConverter(const std::shared_ptr<encfs::EncFS_Root> &srcRoot,
+		const std::shared_ptr<encfs::EncFS_Root> &destRoot, CopyProgress *pProgress,
+		int convertThreads = 0);
+	virtual ~VolumeConverter();
+
+	/**
+	 * Converts the whole volume. srcDir identifies the source in the checkpoint
+	 * file, a checkpoint of another source is not continued. Returns false if a
+	 * file could not be converted or the conversion was cancelled, the
+	 * checkpoint file is kept then.
+	 */
+	bool run(const std::string &srcDir, const std::string &checkpointFile);
+
+	/**
+	 * The checkpoint file of a conversion into destDir, which ends with a
+	 * separator. It is outside of destDir, where it would show up as an
+	 * undecodable name.
+	 */
+	static std::string checkpointFileName(const std::string &destDir);
+
+	/**
+	 * The srcDir of the conversion which wrote checkpointFile, false if there
+	 * is no such file.
+	 */
+	static bool readCheckpointSource(const std::string &checkpointFile, std::string &srcDir);
+
+private:
+	struct FileJob
+	{
+		std::shared_ptr<encfs::FileNode> srcNode;
+		std::string plainPath;
+		unsigned short mode;
+		int64_t size;
+	};
+
+	bool openCheckpoint(const std::string &srcDir, const std::string &checkpointFile);
+	bool recordDone(const std::string &plainPath);
+	bool walkDir(const std::string &volumeDir);
+	bool queueFile(const FileJob &job);
+	bool convertFile(const FileJob &job);
+	void convertLoop();
+	void fail();
+	bool isStopping() const;
+
+	VolumeConverter(const VolumeConverter &);
+	VolumeConverter &operator=(const VolumeConverter &);
+
+	std::shared_ptr<encfs::EncFS_Root> srcRoot_, destRoot_;
+	CopyProgress *pProgress_;
+	int convertThreads_;
+
+	std::unordered_set<std::string> doneFiles_;	// Converted by an earlier run
+	int checkpointFd_;
+	int64_t checkpointSize_;
+
+	boost::mutex mutex_;		// Protects the checkpoint file
+	CopyPipeline::FileQueue<FileJob> files_;
+	std::atomic<bool> failed_;
+};
+
+#endif
@@ -0,0 +1,246 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "VolumeScrubber.h"
+
+#include <algorithm>
+
+#include <fcntl.h>
+
+#include "fs_layer.h"
+
+// libencfs
+#include "Error.h"
+#include "FileUtils.h"
+#include "DirNode.h"
+#include "FileNode.h"
+
+// Bytes of blocks checked at once
+static const size_t scrubPieceSize = 1024 * 1024;
+// Files found but not yet being checked
+static const size_t maxQueuedFiles = 1024;
+// Entries decoded at once while walking a folder
+static const size_t walkBatchSize = 256;
+
+VolumeScrubber::VolumeScrubber(const std::shared_ptr<encfs::EncFS_Root> &rootInfo, CopyProgress *pProgress,
+	int checkThreads) :
+	rootInfo_(rootInfo),
+	pProgress_(pProgress),
+	checkThreads_(checkThreads > 0 ? checkThreads
+		: std::max(1, static_cast<int>(boost::thread::hardware_concurrency()))),
+	walkDone_(false)
+{
+}
+
+VolumeScrubber::~VolumeScrubber()
+{
+}
+
+bool VolumeScrubber::run()
+{
+	boost::thread_group threads;
+	for(int i = 0; i < checkThreads_; i++)
+		threads.create_thread([this]() { checkLoop(); });
+
+	walkDir("/");
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		walkDone_ = true;
+		fileCond_.notify_all();
+	}
+	pProgress_->walkDone = true;
+
+	threads.join_all();
+	return !isStopping();
+}
+
+void VolumeScrubber::walkDir(const std::string &volumeDir)
+{
+	// Names which can't be decoded, the normal traversal skips them
+	{
+		encfs::DirTraverse dt = rootInfo_->root->openDir(volumeDir.c_str());
+		if(!dt.valid())
+		{
+			DamagedFile damage;
+			damage.path = volumeDir;
+			damage.error = -EIO;
+			addDamage(damage);
+			return;
+		}
+		std::string cipherPath = rootInfo_->root->cipherPath(volumeDir.c_str());
+		for(std::string name = dt.nextInvalid(); !name.empty(); name = dt.nextInvalid())
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			report_.invalidNames.push_back(fs_layer::concat_path(cipherPath, name, true));
+		}
+	}
+
+	encfs::DirTraverse dt = rootInfo_->root->openDir(volumeDir.c_str());
+	std::vector<encfs::DirTraverse::Entry> entries = dt.nextBatch(walkBatchSize);
+	while(!entries.empty())
+	{
+		for(size_t i = 0; i < entries.size(); i++)
+		{
+			if(isStopping())
+				return;
+
+			const encfs::DirTraverse::Entry &entry = entries[i];
+			if(entry.plainName == "." || entry.plainName == "..")
+				continue;
+
+			std::string plainPath = volumeDir + entry.plainName;
+			efs_stat stBuf = entry.stat;
+			if(!entry.hasStat)
+			{
+				std::string cpath = rootInfo_->root->cipherPath(plainPath.c_str());
+				if(fs_layer::lstat(cpath.c_str(), &stBuf))
+				{
+					DamagedFile damage;
+					damage.path = plainPath;
+					damage.error = -errno;
+					addDamage(damage);
+					continue;
+				}
+			}
+
+			if(S_ISDIR(stBuf.st_mode))
+			{
+				walkDir(plainPath + '/');
+			}
+			else if(S_ISREG(stBuf.st_mode))
+			{
+				FileJob job;
+				job.node = rootInfo_->root->lookupNode(plainPath.c_str(), "EncFSMP");
+				job.plainPath = plainPath;
+				job.size = job.node ? job.node->getSize() : -1;
+				if(job.size < 0)
+				{
+					DamagedFile damage;
+					damage.path = plainPath;
+					damage.error = -EIO;
+					addDamage(damage);
+				}
+				else if(!queueFile(job))
+				{
+					return;
+				}
+			}
+		}
+		entries = dt.nextBatch(walkBatchSize);
+	}
+}
+
+bool VolumeScrubber::queueFile(const FileJob &job)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	while(files_.size() >= maxQueuedFiles && !isStopping())
+		fileSpaceCond_.wait(lock);
+	if(isStopping())
+	{
+		fileCond_.notify_all();
+		return false;
+	}
+
+	files_.push_back(job);
+	pProgress_->filesFound++;
+	pProgress_->bytesFound += job.size;
+	fileCond_.notify_one();
+	return true;
+}
+
+void VolumeScrubber::addDamage(const DamagedFile &damage)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	report_.damagedFiles.push_back(damage);
+}
+
+void VolumeScrubber::checkFile(const FileJob &job)
+{
+	DamagedFile damage;
+	damage.path = job.plainPath;
+
+	int res = job.node->open(O_RDONLY);
+	if(res < 0)
+	{
+		damage.error = res;
+		addDamage(damage);
+		return;
+	}
+
+	int dataSize = job.node->dataBlockSize();
+	size_t pieceBlocks = std::max<size_t>(1, scrubPieceSize / dataSize);
+	int64_t expectedBlocks = (job.size + dataSize - 1) / dataSize;
+	int64_t block = 0;
+	while(block < expectedBlocks)
+	{
+		if(isStopping())
+			return;
+
+		ssize_t blocks = job.node->verifyBlocks(block, pieceBlocks, damage.badBlocks);
+		if(blocks <= 0)
+		{
+			// The file ends before its size says, or can't be read
+			damage.error = blocks < 0 ? (int)blocks : -EIO;
+			break;
+		}
+		int64_t bytes = std::min<int64_t>(blocks * (int64_t)dataSize, job.size - block * dataSize);
+		pProgress_->bytesDone += bytes;
+		block += blocks;
+	}
+	pProgress_->filesDone++;
+
+	if(!damage.badBlocks.empty() || damage.error != 0)
+		addDamage(damage);
+}
+
+void VolumeScrubber::checkLoop()
+{
+	for(;;)
+	{
+		FileJob job;
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			while(files_.empty() && !walkDone_ && !isStopping())
+				fileCond_.wait(lock);
+			if(files_.empty() || isStopping())
+			{
+				// Wake the walk in case it waits for space in a full queue
+				fileSpaceCond_.notify_all();
+				break;
+			}
+			job = files_.front();
+			files_.pop_front();
+			fileSpaceCond_.notify_one();
+		}
+
+		try
+		{
+			checkFile(job);
+		}
+		catch(encfs::Error &)
+		{
+			DamagedFile damage;
+			damage.path = job.plainPath;
+			damage.error = -EIO;
+			addDamage(damage);
+		}
+	}
+}
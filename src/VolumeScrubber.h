@@ -0,0 +1,112 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VOLUMESCRUBBER_H
+#define VOLUMESCRUBBER_H
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <boost/thread.hpp>
+
+#include "CopyProgress.h"
+
+namespace encfs
+{
+	struct EncFS_Root;
+	class FileNode;
+}
+
+/**
+ * Checks the MAC of every block of a volume with block MACs, without
+ * mounting it.
+ *
+ * The calling thread walks the folders, collects the names which can't be
+ * decoded, and queues the files for the checking threads. These read the
+ * files in large pieces of many blocks, whose MACs are computed in parallel
+ * by MACFileIO::verifyBlocks(). Unlike reading the files, a bad block doesn't
+ * stop the check of the file, all of them are reported.
+ */
+class VolumeScrubber
+{
+public:
+	struct DamagedFile
+	{
+		DamagedFile() : error(0) { }
+
+		std::string path;				// Plaintext path in the volume
+		std::vector<off_t> badBlocks;		// Blocks whose MAC doesn't match
+		int error;						// -errno if the file could not be read to its end
+	};
+
+	struct Report
+	{
+		std::vector<DamagedFile> damagedFiles;
+		std::vector<std::string> invalidNames;	// Cipher paths of names which can't be decoded
+	};
+
+	/**
+	 * checkThreads 0: one per core.
+	 */
+	VolumeScrubber(const std::shared_ptr<encfs::EncFS_Root> &rootInfo, CopyProgress *pProgress,
+		int checkThreads = 0);
+	virtual ~VolumeScrubber();
+
+	/**
+	 * Checks the whole volume. Returns false if the check was cancelled,
+	 * damage is reported in getReport() only.
+	 */
+	bool run();
+
+	const Report &getReport() const { return report_; }
+
+private:
+	struct FileJob
+	{
+		std::shared_ptr<encfs::FileNode> node;
+		std::string plainPath;
+		int64_t size;
+	};
+
+	void walkDir(const std::string &volumeDir);
+	bool queueFile(const FileJob &job);
+	void checkFile(const FileJob &job);
+	void checkLoop();
+	void addDamage(const DamagedFile &damage);
+	bool isStopping() const { return pProgress_->cancel; }
+
+	VolumeScrubber(const VolumeScrubber &);
+	VolumeScrubber &operator=(const VolumeScrubber &);
+
+	std::shared_ptr<encfs::EncFS_Root> rootInfo_;
+	CopyProgress *pProgress_;
+	int checkThreads_;
+
+	boost::mutex mutex_;
+	boost::condition_variable fileCond_, fileSpaceCond_;
+	std::deque<FileJob> files_;
+	bool walkDone_;
+	Report report_;
+};
+
+#endif
@@ -0,0 +1,172 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "VolumeStatistics.h"
+
+#include <algorithm>
+
+#include "fs_layer.h"
+
+// libencfs
+#include "Error.h"
+#include "FileUtils.h"
+#include "DirNode.h"
+#include "FileNode.h"
+
+// Entries decoded at once while listing a folder
+static const size_t walkBatchSize = 256;
+
+void VolumeStatistics::Totals::add(const Totals &o)
+{
+	files += o.files;
+	folders += o.folders;
+	plaintextBytes += o.plaintextBytes;
+	cipherBytes += o.cipherBytes;
+	macOverheadBytes += o.macOverheadBytes;
+	invalidNames += o.invalidNames;
+}
+
+VolumeStatistics::VolumeStatistics(const std::shared_ptr<encfs::EncFS_Root> &rootInfo,
+	CopyProgress *pProgress, int walkThreads) :
+	rootInfo_(rootInfo),
+	pProgress_(pProgress),
+	walkThreads_(walkThreads > 0 ? walkThreads
+		: std::max(1, static_cast<int>(boost::thread::hardware_concurrency()))),
+	busyThreads_(0)
+{
+}
+
+VolumeStatistics::~VolumeStatistics()
+{
+}
+
+bool VolumeStatistics::run()
+{
+	dirs_.push_back("/");
+
+	boost::thread_group threads;
+	for(int i = 0; i < walkThreads_; i++)
+		threads.create_thread([this]() { walkLoop(); });
+	threads.join_all();
+
+	pProgress_->walkDone = true;
+	return !isStopping();
+}
+
+void VolumeStatistics::walkLoop()
+{
+	Totals totals;
+	for(;;)
+	{
+		std::string dir;
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			// Done when no folder is queued and no thread can queue one anymore
+			while(dirs_.empty() && busyThreads_ > 0 && !isStopping())
+				dirCond_.wait(lock);
+			if(dirs_.empty() || isStopping())
+				break;
+			dir = dirs_.front();
+			dirs_.pop_front();
+			busyThreads_++;
+		}
+
+		std::vector<std::string> subDirs;
+		int64_t files = totals.files, bytes = totals.plaintextBytes;
+		try
+		{
+			scanDir(dir, totals, subDirs);
+		}
+		catch(encfs::Error &)
+		{
+			// Counted as far as it could be listed
+		}
+		pProgress_->filesFound += totals.files - files;
+		pProgress_->filesDone += totals.files - files;
+		pProgress_->bytesFound += totals.plaintextBytes - bytes;
+		pProgress_->bytesDone += totals.plaintextBytes - bytes;
+
+		boost::mutex::scoped_lock lock(mutex_);
+		dirs_.insert(dirs_.end(), subDirs.begin(), subDirs.end());
+		busyThreads_--;
+		dirCond_.notify_all();
+	}
+
+	boost::mutex::scoped_lock lock(mutex_);
+	totals_.add(totals);
+	dirCond_.notify_all();
+}
+
+void VolumeStatistics::scanDir(const std::string &volumeDir, Totals &totals,
+	std::vector<std::string> &subDirs)
+{
+	encfs::DirTraverse dt = rootInfo_->root->openDir(volumeDir.c_str());
+	if(!dt.valid())
+		return;
+
+	std::vector<encfs::DirTraverse::Entry> entries = dt.nextBatch(walkBatchSize);
+	while(!entries.empty())
+	{
+		if(isStopping())
+			return;
+
+		for(size_t i = 0; i < entries.size(); i++)
+		{
+			const encfs::DirTraverse::Entry &entry = entries[i];
+			if(entry.plainName == "." || entry.plainName == "..")
+				continue;
+
+			std::string plainPath = volumeDir + entry.plainName;
+			efs_stat stBuf = entry.stat;
+			if(!entry.hasStat)
+			{
+				std::string cpath = rootInfo_->root->cipherPath(plainPath.c_str());
+				if(fs_layer::lstat(cpath.c_str(), &stBuf))
+					continue;
+			}
+
+			if(S_ISDIR(stBuf.st_mode))
+			{
+				totals.folders++;
+				subDirs.push_back(plainPath + '/');
+			}
+			else if(S_ISREG(stBuf.st_mode))
+			{
+				totals.files++;
+				totals.cipherBytes += stBuf.st_size;
+				off_t size = rootInfo_->root->plaintextSizeFromStat(stBuf);
+				if(size == -ENOTSUP)
+				{
+					// Compressed volume: the size is in the index of the file
+					std::shared_ptr<encfs::FileNode> node =
+						rootInfo_->root->lookupNode(plainPath.c_str(), "EncFSMP");
+					if(node)
+						size = node->getSize();
+				}
+				if(size > 0)
+					totals.plaintextBytes += size;
+				totals.macOverheadBytes += rootInfo_->root->blockMACBytesFromStat(stBuf);
+			}
+		}
+		entries = dt.nextBatch(walkBatchSize);
+	}
+	totals.invalidNames += static_cast<int64_t>(dt.skippedInvalid());
+}
@@ -0,0 +1,98 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VOLUMESTATISTICS_H
+#define VOLUMESTATISTICS_H
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/thread.hpp>
+
+#include "CopyProgress.h"
+
+namespace encfs
+{
+	struct EncFS_Root;
+}
+
+/**
+ * Counts the files and their sizes of a volume, without mounting it.
+ *
+ * The folders are listed by several threads at once, each one takes the
+ * next folder from a shared queue and adds the subfolders it finds. The
+ * names of a folder are decoded in batches (see DirTraverse::nextBatch()),
+ * and the sizes are computed from the stat of the backing files, so no file
+ * is opened.
+ */
+class VolumeStatistics
+{
+public:
+	struct Totals
+	{
+		Totals() : files(0), folders(0), plaintextBytes(0), cipherBytes(0),
+			macOverheadBytes(0), invalidNames(0)
+		{ }
+
+		void add(const Totals &o);
+
+		int64_t files, folders;
+		int64_t plaintextBytes;		// Sum of the decrypted file sizes
+		int64_t cipherBytes;		// Sum of the backing file sizes
+		int64_t macOverheadBytes;	// Part of cipherBytes taken by the block MACs
+		int64_t invalidNames;		// Names which can't be decoded
+	};
+
+	/**
+	 * walkThreads 0: one per core.
+	 */
+	VolumeStatistics(const std::shared_ptr<encfs::EncFS_Root> &rootInfo, CopyProgress *pProgress,
+		int walkThreads = 0);
+	virtual ~VolumeStatistics();
+
+	/**
+	 * Walks the whole volume. Returns false if it was cancelled.
+	 */
+	bool run();
+
+	const Totals &getTotals() const { return totals_; }
+
+private:
+	void walkLoop();
+	void scanDir(const std::string &volumeDir, Totals &totals, std::vector<std::string> &subDirs);
+	bool isStopping() const { return pProgress_->cancel; }
+
+	VolumeStatistics(const VolumeStatistics &);
+	VolumeStatistics &operator=(const VolumeStatistics &);
+
+	std::shared_ptr<encfs::EncFS_Root> rootInfo_;
+	CopyProgress *pProgress_;
+	int walkThreads_;
+
+	boost::mutex mutex_;
+	boost::condition_variable dirCond_;
+	std::deque<std::string> dirs_;		// Plaintext paths ending with '/'
+	int busyThreads_;					// Threads listing a folder, which may queue more
+	Totals totals_;
+};
+
+#endif
@@ -0,0 +1,95 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "WriteBuffer.h"
+
+#include <cstring>
+
+WriteBuffer::WriteBuffer(size_t maxSize) :
+	maxSize_(maxSize),
+	bufferOffset_(0)
+{
+}
+
+WriteBuffer::~WriteBuffer()
+{
+}
+
+bool WriteBuffer::write(const std::shared_ptr<encfs::FileNode> &fileNode, uint64_t offset,
+	const unsigned char *data, size_t size)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+
+	// Only data overlapping or directly following the buffered data is added
+	uint64_t bufferEnd = bufferOffset_ + buffer_.size();
+	if(!buffer_.empty() && (offset < bufferOffset_ || offset > bufferEnd))
+	{
+		if(!flushLocked(fileNode))
+			return false;
+	}
+
+	if(buffer_.empty())
+	{
+		// Large writes don't profit from the buffer
+		if(size >= maxSize_)
+			return (fileNode->write(static_cast<off_t>(offset), const_cast<unsigned char *>(data), size) >= 0);
+
+		bufferOffset_ = offset;
+	}
+
+	size_t pos = static_cast<size_t>(offset - bufferOffset_);
+	if(pos + size > buffer_.size())
+		buffer_.resize(pos + size);
+	memcpy(&buffer_[pos], data, size);
+
+	if(buffer_.size() >= maxSize_)
+		return flushLocked(fileNode);
+
+	return true;
+}
+
+bool WriteBuffer::flush(const std::shared_ptr<encfs::FileNode> &fileNode)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	return flushLocked(fileNode);
+}
+
+bool WriteBuffer::isEmpty()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	return buffer_.empty();
+}
+
+uint64_t WriteBuffer::endOffset()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	return buffer_.empty() ? 0 : bufferOffset_ + buffer_.size();
+}
+
+bool WriteBuffer::flushLocked(const std::shared_ptr<encfs::FileNode> &fileNode)
+{
+	if(buffer_.empty())
+		return true;
+
+	// Clear the buffer before writing, in case write throws
+	std::vector<unsigned char> data;
+	data.swap(buffer_);
+
+	return (fileNode->write(static_cast<off_t>(bufferOffset_), data.data(), data.size()) >= 0);
+}
@@ -0,0 +1,82 @@
+/**
+ * Copyright (C) 2015 Roman Hiestand
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef WRITEBUFFER_H
+#define WRITEBUFFER_H
+
+#include "config.h"
+
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/thread/mutex.hpp>
+
+// libencfs
+#include "FileNode.h"
+
+/**
+ * Write-back buffer for one open file.
+ *
+ * Applications often write in small pieces (e.g. 4 KB or 512 bytes). Every
+ * write of a partial block results in a read, decrypt, encrypt and write of
+ * the whole block. This buffer collects adjacent writes, so they reach the
+ * FileNode as one large write of full blocks.
+ *
+ * All methods are thread safe. Exceptions of FileNode::write are passed on.
+ */
+class WriteBuffer
+{
+public:
+	WriteBuffer(size_t maxSize);
+	virtual ~WriteBuffer();
+
+	/**
+	 * Adds the data to the buffer. Writes the buffer to fileNode first if the
+	 * data doesn't continue it, and afterwards if it exceeds the maximum size.
+	 * Returns false if writing to fileNode failed.
+	 */
+	bool write(const std::shared_ptr<encfs::FileNode> &fileNode, uint64_t offset,
+		const unsigned char *data, size_t size);
+
+	/**
+	 * Writes the buffered data to fileNode.
+	 * Returns false if writing failed, the data is discarded in this case.
+	 */
+	bool flush(const std::shared_ptr<encfs::FileNode> &fileNode);
+
+	bool isEmpty();
+
+	/**
+	 * Returns the file offset following the buffered data, 0 if the buffer
+	 * is empty. The file reaches at least this size once it is flushed.
+	 */
+	uint64_t endOffset();
+
+private:
+	bool flushLocked(const std::shared_ptr<encfs::FileNode> &fileNode);
+
+	boost::mutex mutex_;
+
+	size_t maxSize_;
+	uint64_t bufferOffset_;		// File offset of buffer_[0]
+	std::vector<unsigned char> buffer_;
+};
+
+#endif
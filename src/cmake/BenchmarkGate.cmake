@@ -0,0 +1,158 @@
+# - Run a benchmark and compare its results to a baseline
+# Script for "cmake -P", used by the bench target. Runs BENCH_COMMAND, writes
+# its CSV output to RESULT_FILE and compares every row to the row with the
+# same key in BASELINE_FILE. Fails if a row got slower by more than TOLERANCE
+# percent. Without a baseline, or with UPDATE_BASELINE set, the results are
+# stored as the new baseline.
+#
+# Variables:
+#  BENCH_COMMAND - the benchmark and its arguments, separated by ';'
+#  RESULT_FILE - CSV file for the results
+#  BENCH_WRITES_RESULT_FILE - the benchmark writes RESULT_FILE itself instead
+#    of its standard output
+#  BASELINE_FILE - CSV file with the baseline
+#  KEY_COLUMNS - the columns identifying a row, separated by ';'
+#  THROUGHPUT_COLUMN - higher is better; rows where it is 0 use TIME_COLUMN
+#  TIME_COLUMN - lower is better, optional
+#  TOLERANCE - allowed slowdown in percent (default 10)
+#  UPDATE_BASELINE - replace the baseline with the results
+
+#=============================================================================
+# Copyright 2026 Roman Hiestand
+#
+# Distributed under the MIT License.
+#
+# This software is distributed WITHOUT ANY WARRANTY; without even the
+# implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the License for more information.
+#=============================================================================
+
+if(NOT DEFINED TOLERANCE OR TOLERANCE STREQUAL "")
+	set(TOLERANCE 10)
+endif()
+
+if(BENCH_WRITES_RESULT_FILE)
+	execute_process(COMMAND ${BENCH_COMMAND}
+		RESULT_VARIABLE benchResult)
+else()
+	execute_process(COMMAND ${BENCH_COMMAND}
+		OUTPUT_FILE ${RESULT_FILE}
+		RESULT_VARIABLE benchResult)
+endif()
+if(NOT benchResult EQUAL 0)
+	message(FATAL_ERROR "Benchmark failed: ${benchResult}")
+endif()
+if(NOT EXISTS ${RESULT_FILE})
+	message(FATAL_ERROR "The benchmark wrote no results to ${RESULT_FILE}")
+endif()
+
+if(UPDATE_BASELINE OR NOT EXISTS ${BASELINE_FILE})
+	get_filename_component(baselineDir ${BASELINE_FILE} PATH)
+	file(MAKE_DIRECTORY ${baselineDir})
+	configure_file(${RESULT_FILE} ${BASELINE_FILE} COPYONLY)
+	message(STATUS "Stored the results as the baseline ${BASELINE_FILE}")
+	return()
+endif()
+
+# Converts a decimal number to an integer in thousandths, CMake has no floating point math
+function(to_milli value outVar)
+	if(value MATCHES "^([0-9]+)(\\.([0-9]*))?$")
+		set(fraction "${CMAKE_MATCH_3}000")
+		string(SUBSTRING ${fraction} 0 3 fraction)
+		math(EXPR milli "${CMAKE_MATCH_1} * 1000 + 1${fraction} - 1000")
+		set(${outVar} ${milli} PARENT_SCOPE)
+	else()
+		set(${outVar} "" PARENT_SCOPE)
+	endif()
+endfunction()
+
+# Reads the CSV file into <prefix>_keys and <prefix>_<key>_<column> variables
+macro(read_csv fileName prefix)
+	file(STRINGS ${fileName} csvLines)
+	list(GET csvLines 0 csvHeader)
+	list(REMOVE_AT csvLines 0)
+	string(REPLACE "," ";" csvColumns "${csvHeader}")
+	set(${prefix}_keys)
+	foreach(csvLine ${csvLines})
+		string(REPLACE "," ";" csvValues "${csvLine}")
+		set(csvKey)
+		foreach(keyColumn ${KEY_COLUMNS})
+			list(FIND csvColumns ${keyColumn} csvIndex)
+			if(csvIndex LESS 0)
+				message(FATAL_ERROR "No column ${keyColumn} in ${fileName}")
+			endif()
+			list(GET csvValues ${csvIndex} csvValue)
+			if(csvKey)
+				set(csvKey "${csvKey}/${csvValue}")
+			else()
+				set(csvKey "${csvValue}")
+			endif()
+		endforeach()
+		list(APPEND ${prefix}_keys ${csvKey})
+		foreach(valueColumn ${THROUGHPUT_COLUMN} ${TIME_COLUMN})
+			list(FIND csvColumns ${valueColumn} csvIndex)
+			if(csvIndex LESS 0)
+				message(FATAL_ERROR "No column ${valueColumn} in ${fileName}")
+			endif()
+			list(GET csvValues ${csvIndex} csvValue)
+			set(${prefix}_${csvKey}_${valueColumn} ${csvValue})
+		endforeach()
+	endforeach()
+endmacro()
+
+read_csv(${BASELINE_FILE} baseline)
+read_csv(${RESULT_FILE} current)
+
+set(regressions 0)
+foreach(key ${current_keys})
+	list(FIND baseline_keys ${key} baselineIndex)
+	if(baselineIndex LESS 0)
+		message(STATUS "${key}: not in the baseline")
+		continue()
+	endif()
+
+	to_milli("${baseline_${key}_${THROUGHPUT_COLUMN}}" baselineValue)
+	to_milli("${current_${key}_${THROUGHPUT_COLUMN}}" currentValue)
+	set(column ${THROUGHPUT_COLUMN})
+	set(higherIsBetter TRUE)
+	if((NOT baselineValue OR NOT currentValue) AND TIME_COLUMN)
+		to_milli("${baseline_${key}_${TIME_COLUMN}}" baselineValue)
+		to_milli("${current_${key}_${TIME_COLUMN}}" currentValue)
+		set(column ${TIME_COLUMN})
+		set(higherIsBetter FALSE)
+	endif()
+	if(NOT baselineValue OR NOT currentValue)
+		continue()
+	endif()
+
+	math(EXPR change "(${currentValue} - ${baselineValue}) * 100 / ${baselineValue}")
+	if(higherIsBetter)
+		math(EXPR limit "${baselineValue} * (100 - ${TOLERANCE})")
+		math(EXPR scaled "${currentValue} * 100")
+		if(scaled LESS limit)
+			set(isRegression TRUE)
+		else()
+			set(isRegression FALSE)
+		endif()
+	else()
+		math(EXPR limit "${baselineValue} * (100 + ${TOLERANCE})")
+		math(EXPR scaled "${currentValue} * 100")
+		if(scaled GREATER limit)
+			set(isRegression TRUE)
+		else()
+			set(isRegression FALSE)
+		endif()
+	endif()
+
+	set(report "${key}: ${column} ${baseline_${key}_${column}} -> ${current_${key}_${column}} (${change}%)")
+	if(isRegression)
+		message(STATUS "REGRESSION ${report}")
+		math(EXPR regressions "${regressions} + 1")
+	else()
+		message(STATUS "${report}")
+	endif()
+endforeach()
+
+if(regressions GREATER 0)
+	message(FATAL_ERROR "${regressions} benchmarks are more than ${TOLERANCE}% slower than the baseline ${BASELINE_FILE}")
+endif()
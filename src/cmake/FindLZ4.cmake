@@ -0,0 +1,29 @@
+# - Find the LZ4 compression library (https://lz4.github.io/lz4/)
+# This module defines the following variables:
+#  LZ4_INCLUDE_DIR - include directories for LZ4
+#  LZ4_LIBRARIES - libraries to link against LZ4
+#  LZ4_FOUND - true if LZ4 has been found and can be used
+
+#=============================================================================
+# Copyright 2015 Roman Hiestand
+#
+# Distributed under the MIT License.
+#
+# This software is distributed WITHOUT ANY WARRANTY; without even the
+# implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the License for more information.
+#=============================================================================
+
+find_path(LZ4_INCLUDE_DIR lz4.h
+	HINTS ${LZ4_ROOT} $ENV{LZ4_ROOT}
+	PATH_SUFFIXES include inc)
+
+find_library(LZ4_LIBRARIES NAMES lz4 liblz4 liblz4_static
+	HINTS ${LZ4_ROOT} $ENV{LZ4_ROOT}
+	PATH_SUFFIXES lib dll)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LZ4
+                                  REQUIRED_VARS LZ4_LIBRARIES LZ4_INCLUDE_DIR)
+
+mark_as_advanced(LZ4_INCLUDE_DIR LZ4_LIBRARIES)
@@ -0,0 +1,298 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BlockCache.h"
+
+#include <algorithm>  // for max
+#include <cstring>    // for memcpy
+
+#include "Mutex.h"
+
+namespace encfs {
+
+// files opened but never read still have an entry for their stamp, these are
+// dropped when the number of entries reaches _maxFiles
+static const size_t minMaxFiles = 1024;
+
+BlockCache::BlockCache(size_t budget)
+    : _budget(budget),
+      _bytesUsed(0),
+      _hand(0),
+      _maxFiles(minMaxFiles),
+      _hits(0),
+      _misses(0) {}
+
+BlockCache::~BlockCache() = default;
+
+ssize_t BlockCache::read(const std::string &path, off_t block,
+                         unsigned char *data, size_t len) {
+  Lock _lock(_mutex);
+
+  FileMap::const_iterator it = _files.find(path);
+  if (it != _files.end()) {
+    std::map<off_t, size_t>::const_iterator bit = it->second.blocks.find(block);
+    if (bit != it->second.blocks.end()) {
+      Slot &slot = _slots[bit->second];
+      slot.referenced = true;
+      if (slot.data.size() < len) {
+        len = slot.data.size();  // last block of the file
+      }
+      memcpy(data, slot.data.data(), len);
+      ++_hits;
+      return len;
+    }
+  }
+
+  ++_misses;
+  return -1;
+}
+
+void BlockCache::insert(const std::string &path, off_t block,
+                        const unsigned char *data, size_t len) {
+  Lock _lock(_mutex);
+
+  if (len == 0 || len > _budget) {
+    return;
+  }
+
+  FileEntry &entry = _files[path];
+  std::map<off_t, size_t>::iterator bit = entry.blocks.find(block);
+  if (bit != entry.blocks.end()) {
+    // replace the data of a block we already have
+    Slot &slot = _slots[bit->second];
+    _bytesUsed -= slot.data.size();
+    slot.data.assign(data, data + len);
+    slot.referenced = true;
+    _bytesUsed += len;
+    while (_bytesUsed > _budget) {
+      evictOne();
+    }
+    return;
+  }
+
+  while (_bytesUsed + len > _budget) {
+    evictOne();
+  }
+
+  size_t index;
+  if (!_freeSlots.empty()) {
+    index = _freeSlots.back();
+    _freeSlots.pop_back();
+  } else {
+    index = _slots.size();
+    _slots.push_back(Slot());
+  }
+
+  Slot &slot = _slots[index];
+  slot.path = path;
+  slot.block = block;
+  slot.data.assign(data, data + len);
+  slot.used = true;
+  slot.referenced = false;
+  _bytesUsed += len;
+
+  // evictOne() may have removed the entry of this file, look it up again
+  _files[path].blocks[block] = index;
+}
+
+void BlockCache::forget(const std::string &path) {
+  Lock _lock(_mutex);
+
+  FileMap::iterator it = _files.find(path);
+  if (it != _files.end()) {
+    forgetEntry(it);
+  }
+}
+
+void BlockCache::forgetBlock(const std::string &path, off_t block) {
+  Lock _lock(_mutex);
+
+  FileMap::iterator it = _files.find(path);
+  if (it == _files.end()) {
+    return;
+  }
+  std::map<off_t, size_t>::iterator bit = it->second.blocks.find(block);
+  if (bit != it->second.blocks.end()) {
+    releaseSlot(bit->second);
+    it->second.blocks.erase(bit);
+  }
+}
+
+void BlockCache::forgetFrom(const std::string &path, off_t firstBlock) {
+  Lock _lock(_mutex);
+
+  FileMap::iterator it = _files.find(path);
+  if (it == _files.end()) {
+    return;
+  }
+  std::map<off_t, size_t> &blocks = it->second.blocks;
+  std::map<off_t, size_t>::iterator bit = blocks.lower_bound(firstBlock);
+  while (bit != blocks.end()) {
+    releaseSlot(bit->second);
+    bit = blocks.erase(bit);
+  }
+}
+
+void BlockCache::forgetTree(const std::string &dirPath) {
+  Lock _lock(_mutex);
+
+  FileMap::iterator it = _files.begin();
+  while (it != _files.end()) {
+    const std::string &path = it->first;
+    if (path.size() > dirPath.size() &&
+        path.compare(0, dirPath.size(), dirPath) == 0 &&
+        (path[dirPath.size()] == '/' || path[dirPath.size()] == '\\')) {
+      FileMap::iterator next = it;
+      ++next;
+      forgetEntry(it);
+      it = next;
+    } else {
+      ++it;
+    }
+  }
+}
+
+void BlockCache::validate(const std::string &path, off_t size,
+                          int64_t mtime) {
+  Lock _lock(_mutex);
+
+  FileMap::iterator it = _files.find(path);
+  if (it == _files.end()) {
+    it = _files.insert(std::make_pair(path, FileEntry())).first;
+  }
+
+  // blocks without a stamp were cached after the entry had been evicted,
+  // so we can't tell whether they are still valid
+  FileEntry &entry = it->second;
+  if (!entry.hasStamp || entry.size != size || entry.mtime != mtime) {
+    std::map<off_t, size_t>::iterator bit;
+    for (bit = entry.blocks.begin(); bit != entry.blocks.end(); ++bit) {
+      releaseSlot(bit->second);
+    }
+    entry.blocks.clear();
+  }
+  entry.hasStamp = true;
+  entry.size = size;
+  entry.mtime = mtime;
+
+  if (_files.size() >= _maxFiles) {
+    purgeEmptyEntries(path);
+  }
+}
+
+void BlockCache::trim(size_t maxBytes) {
+  Lock _lock(_mutex);
+
+  while (_bytesUsed > maxBytes) {
+    evictOne();
+  }
+
+  // releaseSlot() keeps the buffers for the next insert
+  for (size_t i = 0; i < _freeSlots.size(); ++i) {
+    std::vector<unsigned char>().swap(_slots[_freeSlots[i]].data);
+  }
+  if (_bytesUsed == 0) {
+    _slots.clear();
+    _freeSlots.clear();
+    _hand = 0;
+  }
+  purgeEmptyEntries(std::string());
+}
+
+void BlockCache::setBudget(size_t budget) {
+  Lock _lock(_mutex);
+
+  _budget = budget;
+  while (_bytesUsed > _budget) {
+    evictOne();
+  }
+}
+
+size_t BlockCache::budget() const {
+  Lock _lock(_mutex);
+  return _budget;
+}
+
+size_t BlockCache::bytesUsed() const {
+  Lock _lock(_mutex);
+  return _bytesUsed;
+}
+
+// the caller removes the slot from the block map of its file
+void BlockCache::releaseSlot(size_t slot) {
+  Slot &s = _slots[slot];
+  _bytesUsed -= s.data.size();
+  s.used = false;
+  s.referenced = false;
+  s.path.clear();
+  s.data.clear();
+  _freeSlots.push_back(slot);
+}
+
+/**
+ * Advance the clock hand to the first slot which was not referenced since
+ * the hand passed it the last time, and release it.
+ */
+void BlockCache::evictOne() {
+  while (true) {
+    if (_hand >= _slots.size()) {
+      _hand = 0;
+    }
+    Slot &slot = _slots[_hand++];
+    if (!slot.used) {
+      continue;
+    }
+    if (slot.referenced) {
+      slot.referenced = false;
+      continue;
+    }
+
+    FileMap::iterator it = _files.find(slot.path);
+    it->second.blocks.erase(slot.block);
+    // keep the stamp of files which are still cached
+    if (it->second.blocks.empty()) {
+      _files.erase(it);
+    }
+    releaseSlot(_hand - 1);
+    return;
+  }
+}
+
+void BlockCache::purgeEmptyEntries(const std::string &keepPath) {
+  FileMap::iterator it = _files.begin();
+  while (it != _files.end()) {
+    if (it->second.blocks.empty() && it->first != keepPath) {
+      it = _files.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  _maxFiles = std::max(minMaxFiles, 2 * _files.size());
+}
+
+void BlockCache::forgetEntry(FileMap::iterator it) {
+  std::map<off_t, size_t>::iterator bit;
+  for (bit = it->second.blocks.begin(); bit != it->second.blocks.end(); ++bit) {
+    releaseSlot(bit->second);
+  }
+  _files.erase(it);
+}
+
+}  // namespace encfs
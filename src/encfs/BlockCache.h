@@ -0,0 +1,128 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BlockCache_incl_
+#define _BlockCache_incl_
+
+#include <atomic>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+namespace encfs {
+
+/*
+    Cache of decoded blocks, shared by all files of a filesystem.
+
+    Blocks are identified by the cipher path of the file and the block
+    index, and evicted with the clock algorithm once the byte budget is
+    used up.  BlockFileIO consults it after its own per-file cache.
+
+    The cache assumes that the backing files are only modified through
+    this filesystem.  Changes behind our back are detected when a file is
+    opened, by comparing the size and modification time (see validate()).
+*/
+class BlockCache {
+ public:
+  BlockCache(size_t budget);
+  ~BlockCache();
+
+  // copies at most len bytes of the cached block to data.  Returns the
+  // number of bytes copied, or -1 if the block is not cached.
+  ssize_t read(const std::string &path, off_t block, unsigned char *data,
+               size_t len);
+  void insert(const std::string &path, off_t block, const unsigned char *data,
+              size_t len);
+
+  void forget(const std::string &path);
+  void forgetBlock(const std::string &path, off_t block);
+  // forget the blocks starting at index firstBlock, after a truncate
+  void forgetFrom(const std::string &path, off_t firstBlock);
+  // forget all files below directory dirPath, after a rename
+  void forgetTree(const std::string &dirPath);
+
+  // forget the blocks of path if the file changed since the last call.
+  // Called when a file is opened.
+  void validate(const std::string &path, off_t size, int64_t mtime);
+
+  // evict blocks until at most maxBytes are used, and return the memory of
+  // the evicted blocks to the heap.  Called while the filesystem is idle.
+  void trim(size_t maxBytes);
+
+  // change the budget while in use, evicting blocks if it shrinks
+  void setBudget(size_t budget);
+  size_t budget() const;
+
+  uint64_t hits() const { return _hits; }
+  uint64_t misses() const { return _misses; }
+  size_t bytesUsed() const;
+
+ private:
+  BlockCache(const BlockCache &src);             // not allowed
+  BlockCache &operator=(const BlockCache &src);  // not allowed
+
+  struct Slot {
+    std::string path;
+    off_t block;
+    std::vector<unsigned char> data;
+    bool used;
+    bool referenced;  // set on every hit, cleared by the clock hand
+  };
+
+  struct FileEntry {
+    std::map<off_t, size_t> blocks;  // block index -> slot index
+    bool hasStamp;
+    off_t size;
+    int64_t mtime;
+
+    FileEntry() : hasStamp(false), size(0), mtime(0) {}
+  };
+
+  typedef std::unordered_map<std::string, FileEntry> FileMap;
+
+  void releaseSlot(size_t slot);
+  void evictOne();
+  void forgetEntry(FileMap::iterator it);
+  void purgeEmptyEntries(const std::string &keepPath);
+
+  size_t _budget;
+  size_t _bytesUsed;
+
+  std::vector<Slot> _slots;
+  std::vector<size_t> _freeSlots;
+  size_t _hand;
+
+  FileMap _files;
+  size_t _maxFiles;
+
+  std::atomic<uint64_t> _hits;
+  std::atomic<uint64_t> _misses;
+
+  mutable boost::mutex _mutex;
+};
+
+}  // namespace encfs
+
+#endif
@@ -20,13 +20,20 @@
 
 #include "BlockFileIO.h"
 
+#include <algorithm>  // for max
+#include <atomic>
+#include <cerrno>
 #include <cstring>  // for memset, memcpy, NULL
+#include <future>
 
 #include "Error.h"
 #include "FSConfig.h"    // for FSConfigPtr
 #include "FileIO.h"      // for IORequest, FileIO
 #include "FileUtils.h"   // for EncFS_Opts
+#include "IOPool.h"      // for IOPool
 #include "MemoryPool.h"  // for MemBlock, release, allocation
+#include "TraceEvents.h"
+#include "WorkerPool.h"  // for WorkerPool
 
 #undef min
 #undef max
@@ -38,21 +45,161 @@ inline Type min(Type A, Type B) {
   return (B < A) ? B : A;
 }
 
+// requests of at least this many blocks are passed down as one run
+static const size_t parallelReadMinBlocks = 16;
+static const size_t parallelWriteMinBlocks = 16;
+// number of blocks coded by one call of the worker
+static const size_t parallelChunkBlocks = 16;
+// the counts of blocks above are for blocks of a few KB.  With large blocks
+// they are limited to this many bytes, so that the work is still split
+static const size_t parallelMaxBytes = 64 << 10;
+// runs of at least two segments are read segment by segment, the next one
+// while the blocks of the previous one are decoded
+static const size_t pipelineSegmentBytes = 256 << 10;
+// zero blocks written by padFile() with one request, at most padRunMaxBytes
+static const size_t padRunBlocks = 256;
+static const size_t padRunMaxBytes = 1 << 20;
+// our own cache holds at most this many bytes of large blocks
+static const size_t fileCacheMaxBytes = 1 << 20;
+// growing a file by at least this much reserves the space first
+static const off_t preallocMinBytes = (off_t)1 << 20;
+
+// count blocks, but no more than fit in maxBytes, and at least minBlocks
+static size_t blocksUpTo(size_t count, size_t maxBytes, unsigned int blockSize,
+                         size_t minBlocks) {
+  return std::max(min(count, maxBytes / blockSize), minBlocks);
+}
+
 static void clearCache(IORequest &req, unsigned int blockSize) {
   memset(req.data, 0, blockSize);
   req.dataLen = 0;
 }
 
 BlockFileIO::BlockFileIO(unsigned int blockSize, const FSConfigPtr &cfg)
-    : _blockSize(blockSize), _allowHoles(cfg->config->allowHoles) {
+    : _blockSize(blockSize),
+      _allowHoles(cfg->config->allowHoles),
+      _cacheUseCount(0),
+      _padding(false),
+      _knownSize(-1),
+      _codeInPlace(false),
+      _shareBlocks(true) {
   CHECK(_blockSize > 1);
-  _cache.data = new unsigned char[_blockSize];
   _noCache = cfg->opts->noCache;
+  _optNoCache = _noCache;
+
+  _runMinBlocks = blocksUpTo(parallelReadMinBlocks, parallelMaxBytes,
+                             _blockSize, 2);
+  _writeRunMinBlocks = blocksUpTo(parallelWriteMinBlocks, parallelMaxBytes,
+                                  _blockSize, 2);
+  _chunkBlocks =
+      blocksUpTo(parallelChunkBlocks, parallelMaxBytes, _blockSize, 1);
+  _padBlocks = blocksUpTo(padRunBlocks, padRunMaxBytes, _blockSize, 1);
+
+  // even without caching, one entry is used as buffer for the lower layer
+  int cacheSize = (int)blocksUpTo(cfg->opts->blockCacheSize, fileCacheMaxBytes,
+                                  _blockSize, 1);
+  if (_noCache || cfg->opts->blockCacheSize < 1) {
+    cacheSize = 1;
+  }
+  _cache.resize(cacheSize);
+  for (auto &entry : _cache) {
+    entry.req.data = new unsigned char[_blockSize];
+    entry.req.dataLen = 0;
+    entry.lastUse = 0;
+  }
+  _tail.offset = 0;
+  _tail.data = new unsigned char[_blockSize];
+  _tail.dataLen = 0;
 }
 
 BlockFileIO::~BlockFileIO() {
-  clearCache(_cache, _blockSize);
-  delete[] _cache.data;
+  for (auto &entry : _cache) {
+    clearCache(entry.req, _blockSize);
+    delete[] entry.req.data;
+  }
+  delete[] _tail.data;
+}
+
+void BlockFileIO::setSharedCache(const std::shared_ptr<BlockCache> &cache) {
+  _sharedCache = cache;
+}
+
+void BlockFileIO::setCodeInPlace(bool codeInPlace) {
+  _codeInPlace = codeInPlace;
+}
+
+void BlockFileIO::setHoleMap(const std::shared_ptr<HoleMap> &holeMap) {
+  _holeMap = holeMap;
+}
+
+void BlockFileIO::forgetSize() const { _knownSize = -1; }
+
+void BlockFileIO::setAccessHint(AccessHint hint) {
+  bool noCache = _optNoCache || hint == Access_NoCache;
+  if (noCache != _noCache) {
+    // reads without the cache add entries without looking for the old ones,
+    // so none of them are kept across the change
+    clearCacheBeyond(0);
+    _tail.dataLen = 0;
+    _noCache = noCache;
+  }
+  _shareBlocks = hint == Access_Normal || hint == Access_Random;
+}
+
+BlockFileIO::CacheEntry *BlockFileIO::findCacheEntry(off_t offset) const {
+  for (auto &entry : _cache) {
+    if ((entry.req.dataLen != 0) && (entry.req.offset == offset)) {
+      entry.lastUse = ++_cacheUseCount;
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Return an unused, or else the least recently used cache entry, cleared.
+ */
+BlockFileIO::CacheEntry &BlockFileIO::newCacheEntry() const {
+  CacheEntry *lru = &_cache[0];
+  for (auto &entry : _cache) {
+    if (entry.req.dataLen == 0) {
+      lru = &entry;
+      break;
+    }
+    if (entry.lastUse < lru->lastUse) {
+      lru = &entry;
+    }
+  }
+  if (lru->req.dataLen > 0) {
+    clearCache(lru->req, _blockSize);
+  }
+  lru->lastUse = ++_cacheUseCount;
+  return *lru;
+}
+
+/**
+ * Forget cached data after the end of a truncated file.
+ */
+void BlockFileIO::clearCacheBeyond(off_t size) const {
+  for (auto &entry : _cache) {
+    if ((entry.req.dataLen > 0) &&
+        (entry.req.offset + (off_t)entry.req.dataLen > size)) {
+      clearCache(entry.req, _blockSize);
+    }
+  }
+}
+
+/**
+ * Forget cached blocks starting in [begin, end), after they were written
+ * without going through the cache.
+ */
+void BlockFileIO::clearCacheRange(off_t begin, off_t end) const {
+  for (auto &entry : _cache) {
+    if ((entry.req.dataLen > 0) && (entry.req.offset >= begin) &&
+        (entry.req.offset < end)) {
+      clearCache(entry.req, _blockSize);
+    }
+  }
 }
 
 /**
@@ -65,58 +212,430 @@ ssize_t BlockFileIO::cacheReadOneBlock(const IORequest &req) const {
   CHECK(req.dataLen <= _blockSize);
   CHECK(req.offset % _blockSize == 0);
 
-  /* we can satisfy the request even if _cache.dataLen is too short, because
-   * we always request a full block during reads. This just means we are
-   * in the last block of a file, which may be smaller than the blocksize.
+  // known holes are whole blocks before the end of the file
+  if (_holeMap && _holeMap->isHole(req.offset / _blockSize)) {
+    memset(req.data, 0, req.dataLen);
+    return req.dataLen;
+  }
+
+  /* we can satisfy the request even if the cached dataLen is too short,
+   * because we always request a full block during reads. This just means we
+   * are in the last block of a file, which may be smaller than the blocksize.
    * For reverse encryption, the cache must not be used at all, because
    * the lower file may have changed behind our back. */
-  if ((!_noCache) && (req.offset == _cache.offset) && (_cache.dataLen != 0)) {
-    // satisfy request from cache
-    size_t len = req.dataLen;
-    if (_cache.dataLen < len) {
-      len = _cache.dataLen;  // Don't read past EOF
+  if (!_noCache) {
+    boost::mutex::scoped_lock lock(_cacheMutex);
+    CacheEntry *cached = findCacheEntry(req.offset);
+    if (cached != nullptr) {
+      // satisfy request from cache
+      size_t len = req.dataLen;
+      if (cached->req.dataLen < len) {
+        len = cached->req.dataLen;  // Don't read past EOF
+      }
+      memcpy(req.data, cached->req.data, len);
+      TRACE_EVENT3(BlockCacheHit, "offset", req.offset, "bytes", len,
+                   "shared", 0);
+      return len;
+    }
+    lock.unlock();
+
+    if (_sharedCache) {
+      ssize_t len = _sharedCache->read(getFileName(), req.offset / _blockSize,
+                                       req.data, req.dataLen);
+      if (len >= 0) {
+        TRACE_EVENT3(BlockCacheHit, "offset", req.offset, "bytes", len,
+                     "shared", 1);
+        return len;
+      }
     }
-    memcpy(req.data, _cache.data, len);
-    return len;
   }
-  if (_cache.dataLen > 0) {
-    clearCache(_cache, _blockSize);
+  TRACE_EVENT2(BlockCacheMiss, "offset", req.offset, "bytes", req.dataLen);
+
+  if (_codeInPlace && req.dataLen == _blockSize) {
+    // the caller caches the data, no need to keep a copy
+    return readOneBlock(req);
   }
 
-  // cache results of read -- issue reads for full blocks
+  // cache results of read -- issue reads for full blocks.  Other readers
+  // use the cache meanwhile, so the block is read into the caller's buffer
+  // or a temporary one and copied to the cache afterwards.
+  MemBlock mb;
   IORequest tmp;
   tmp.offset = req.offset;
-  tmp.data = _cache.data;
   tmp.dataLen = _blockSize;
+  if (req.dataLen == _blockSize) {
+    tmp.data = req.data;
+  } else {
+    mb = MemoryPool::allocate(_blockSize);
+    tmp.data = mb.data;
+  }
   ssize_t result = readOneBlock(tmp);
   if (result > 0) {
-    _cache.offset = req.offset;
-    _cache.dataLen = result;  // the amount we really have
+    {
+      boost::mutex::scoped_lock lock(_cacheMutex);
+      IORequest &cache = newCacheEntry().req;
+      memcpy(cache.data, tmp.data, result);
+      cache.offset = req.offset;
+      cache.dataLen = result;  // the amount we really have
+    }
+    if (_sharedCache && _shareBlocks) {
+      _sharedCache->insert(getFileName(), req.offset / _blockSize, tmp.data,
+                           result);
+    }
     if ((size_t)result > req.dataLen) {
       result = req.dataLen;  // only as much as requested
     }
-    memcpy(req.data, _cache.data, result);
+    if (tmp.data != req.data) {
+      memcpy(req.data, tmp.data, result);
+    }
+  }
+  if (mb.data != nullptr) {
+    MemoryPool::release(mb);
   }
   return result;
 }
 
+/**
+ * Remember the plaintext of a block we wrote if it is shorter than a full
+ * block, which it only is at the end of the file.
+ */
+void BlockFileIO::rememberTail(const IORequest &req) {
+  if (!_noCache && req.dataLen < _blockSize) {
+    memcpy(_tail.data, req.data, req.dataLen);
+    _tail.offset = req.offset;
+    _tail.dataLen = req.dataLen;
+  } else if (req.offset == _tail.offset) {
+    _tail.dataLen = 0;
+  }
+}
+
+/**
+ * Split a run of count blocks starting at blockNum at the holes of the
+ * backing file.  Returns the number of leading blocks which lie in a hole
+ * and before the end of the file, which read as zeros with zero-block
+ * pass-through.  Sets dataBlocks to the number of blocks after them which
+ * may contain data, at least one unless the whole run is a hole.
+ */
+size_t BlockFileIO::holeBlocks(off_t blockNum, size_t count,
+                               size_t &dataBlocks) const {
+  dataBlocks = count;
+  off_t offset = blockNum * _blockSize;
+  off_t begin, end;
+  if (!findData(offset, begin, end)) {
+    return 0;
+  }
+  off_t fileSize = getSize();
+  if (fileSize < 0) {
+    return 0;
+  }
+
+  // a partial last block is not passed through if it is zero
+  off_t holeEnd = min(begin, (fileSize / _blockSize) * _blockSize);
+  size_t holes = 0;
+  if (holeEnd > offset) {
+    holes = (size_t)min((holeEnd - offset) / _blockSize, (off_t)count);
+  }
+  if (holes < count && end > begin) {
+    off_t dataEndBlock = (end + _blockSize - 1) / _blockSize;
+    off_t n = dataEndBlock - (blockNum + (off_t)holes);
+    dataBlocks = (size_t)std::max((off_t)1, min(n, (off_t)(count - holes)));
+  } else {
+    dataBlocks = count - holes;
+  }
+  return holes;
+}
+
+bool BlockFileIO::canDecodeBlocks() const { return false; }
+
+ssize_t BlockFileIO::readRawBlocks(const IORequest & /*req*/) const {
+  return -ENOSYS;
+}
+
+bool BlockFileIO::decodeBlock(unsigned char * /*data*/, int /*size*/,
+                              off_t /*blockNum*/) const {
+  return false;
+}
+
+bool BlockFileIO::decodeBlocks(unsigned char *data, size_t len,
+                               off_t blockNum) const {
+  for (size_t offset = 0; offset < len; offset += _blockSize) {
+    int size = (int)min(len - offset, (size_t)_blockSize);
+    if (!decodeBlock(data + offset, size, blockNum++)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Decode len bytes of blocks read with readRawBlocks() on the worker pool.
+ */
+bool BlockFileIO::decodeRun(unsigned char *data, size_t len,
+                            off_t blockNum) const {
+  // the last block is shorter at the end of the file
+  size_t blocks = (len + _blockSize - 1) / _blockSize;
+  size_t chunks = (blocks + _chunkBlocks - 1) / _chunkBlocks;
+  std::atomic<bool> ok(true);
+  WorkerPool::instance().parallelFor(chunks, [&](size_t chunk) {
+    size_t first = chunk * _chunkBlocks;
+    size_t offset = first * _blockSize;
+    size_t chunkLen = min(len - offset, _chunkBlocks * _blockSize);
+    if (ok && !decodeBlocks(data + offset, chunkLen, blockNum + (off_t)first)) {
+      ok = false;
+    }
+  });
+  return ok;
+}
+
+/**
+ * Read a run of whole blocks at a block-aligned offset.  If the derived
+ * class provides the raw read and decode steps, the run is read from the
+ * lower layer and decoded on the worker pool.  A long run is read in
+ * segments, the read of the next one runs on the IOPool while the previous
+ * one is decoded.
+ * Returns the number of bytes read, or -errno in case of failure.
+ */
+ssize_t BlockFileIO::readBlocks(const IORequest &req) const {
+  CHECK(req.offset % _blockSize == 0);
+  off_t blockNum = req.offset / _blockSize;
+
+  if (!canDecodeBlocks()) {
+    // one block at a time, through the cache
+    size_t result = 0;
+    IORequest blockReq;
+    blockReq.dataLen = _blockSize;
+    while (result + _blockSize <= req.dataLen) {
+      blockReq.offset = req.offset + (off_t)result;
+      blockReq.data = req.data + result;
+      ssize_t readSize = cacheReadOneBlock(blockReq);
+      if (readSize < 0) {
+        return readSize;
+      }
+      result += (size_t)readSize;
+      if ((size_t)readSize < _blockSize) {
+        break;
+      }
+    }
+    return (ssize_t)result;
+  }
+
+  size_t segmentLen =
+      std::max(pipelineSegmentBytes / _blockSize, _chunkBlocks) *
+      _blockSize;
+  if (req.dataLen < 2 * segmentLen) {
+    segmentLen = req.dataLen;
+  }
+
+  IORequest segReq = req;
+  segReq.dataLen = segmentLen;
+  ssize_t readSize = readRawBlocks(segReq);
+  size_t result = 0;
+  while (readSize > 0) {
+    size_t rest = req.dataLen - result - (size_t)readSize;
+    bool readNext = (size_t)readSize == segReq.dataLen && rest > 0;
+    IORequest nextReq;
+    std::future<ssize_t> nextSize;
+    if (readNext) {
+      nextReq.offset = segReq.offset + readSize;
+      nextReq.data = segReq.data + readSize;
+      nextReq.dataLen = min(segmentLen, rest);
+      auto nextRead = std::make_shared<std::promise<ssize_t>>();
+      nextSize = nextRead->get_future();
+      IOPool::instance().post([this, nextReq, nextRead]() {
+        nextRead->set_value(readRawBlocks(nextReq));
+      });
+    }
+
+    off_t segBlock = blockNum + (off_t)(result / _blockSize);
+    bool ok = decodeRun(segReq.data, (size_t)readSize, segBlock);
+    if (ok) {
+      shareBlocks(segReq.data, segBlock, readSize);
+    }
+    // the next segment must have arrived before the buffer is given back
+    ssize_t size = readNext ? nextSize.get() : 0;
+    if (!ok) {
+      return -EBADMSG;
+    }
+
+    result += (size_t)readSize;
+    if (!readNext) {
+      break;
+    }
+    segReq = nextReq;
+    readSize = size;
+  }
+  if (readSize < 0) {
+    return readSize;
+  }
+  return (ssize_t)result;
+}
+
+bool BlockFileIO::prepareEncodeBlocks() { return false; }
+
+bool BlockFileIO::encodeBlock(unsigned char * /*data*/, int /*size*/,
+                              off_t /*blockNum*/) const {
+  return false;
+}
+
+bool BlockFileIO::encodeBlocks(unsigned char *data, size_t len,
+                               off_t blockNum) const {
+  for (size_t offset = 0; offset < len; offset += _blockSize) {
+    int size = (int)min(len - offset, (size_t)_blockSize);
+    if (!encodeBlock(data + offset, size, blockNum++)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+ssize_t BlockFileIO::writeRawBlocks(const IORequest & /*req*/) {
+  return -ENOSYS;
+}
+
+/**
+ * Write a run of full blocks at a block-aligned offset.  If the derived
+ * class provides the encode and raw write steps, the blocks are encoded on
+ * the worker pool into a staging buffer, then written with one request to
+ * the lower layer.
+ * Returns the number of bytes written, or -errno in case of failure.
+ */
+ssize_t BlockFileIO::writeBlocks(const IORequest &req) {
+  CHECK(req.offset % _blockSize == 0);
+  CHECK(req.dataLen % _blockSize == 0);
+  off_t blockNum = req.offset / _blockSize;
+  size_t count = req.dataLen / _blockSize;
+
+  if (!prepareEncodeBlocks()) {
+    // one block at a time, through the cache
+    IORequest blockReq;
+    blockReq.dataLen = _blockSize;
+    for (size_t i = 0; i < count; ++i) {
+      blockReq.offset = req.offset + i * _blockSize;
+      blockReq.data = req.data + i * _blockSize;
+      ssize_t res = cacheWriteOneBlock(blockReq);
+      if (res < 0) {
+        return res;
+      }
+    }
+    return req.dataLen;
+  }
+
+  // encoding works in place, the caller's buffer must not be modified unless
+  // setCodeInPlace() allows it.  The zero buffer of padFile() is reused.
+  bool inPlace = _codeInPlace && !_padding;
+  MemBlock mb;
+  unsigned char *data = req.data;
+  if (!inPlace) {
+    mb = MemoryPool::allocate((int)req.dataLen);
+    data = mb.data;
+  }
+
+  size_t chunks = (count + _chunkBlocks - 1) / _chunkBlocks;
+  std::atomic<bool> ok(true);
+  WorkerPool::instance().parallelFor(chunks, [&](size_t chunk) {
+    size_t first = chunk * _chunkBlocks;
+    size_t last = min(first + _chunkBlocks, count);
+    if (!inPlace) {
+      memcpy(data + first * _blockSize, req.data + first * _blockSize,
+             (last - first) * _blockSize);
+    }
+    if (ok && !encodeBlocks(data + first * _blockSize,
+                            (last - first) * _blockSize,
+                            blockNum + (off_t)first)) {
+      ok = false;
+    }
+  });
+
+  ssize_t res = -EBADMSG;
+  if (ok) {
+    IORequest rawReq;
+    rawReq.offset = req.offset;
+    rawReq.data = data;
+    rawReq.dataLen = req.dataLen;
+    res = writeRawBlocks(rawReq);
+  }
+  if (mb.data != nullptr) {
+    MemoryPool::release(mb);
+  }
+
+  blocksWritten(req.data, blockNum, count, res >= 0);
+  return res;
+}
+
+/**
+ * Add blocks read without cacheReadOneBlock() to the shared cache.
+ */
+void BlockFileIO::shareBlocks(const unsigned char *data, off_t blockNum,
+                              size_t len) const {
+  if (!_sharedCache || !_shareBlocks) {
+    return;
+  }
+  for (size_t offset = 0; offset < len; offset += _blockSize) {
+    _sharedCache->insert(getFileName(), blockNum + (off_t)(offset / _blockSize),
+                         data + offset, min(len - offset, (size_t)_blockSize));
+  }
+}
+
+/**
+ * Update the caches after count full blocks were written without
+ * cacheWriteOneBlock().
+ */
+void BlockFileIO::blocksWritten(const unsigned char *data, off_t blockNum,
+                                size_t count, bool ok) {
+  clearCacheRange(blockNum * _blockSize, (blockNum + count) * _blockSize);
+  if (_tail.offset >= blockNum * _blockSize &&
+      _tail.offset < (off_t)((blockNum + count) * _blockSize)) {
+    _tail.dataLen = 0;
+  }
+  if (!_sharedCache || _padding) {
+    return;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (ok && _shareBlocks) {
+      _sharedCache->insert(getFileName(), blockNum + (off_t)i,
+                           data + i * _blockSize, _blockSize);
+    } else {
+      _sharedCache->forgetBlock(getFileName(), blockNum + (off_t)i);
+    }
+  }
+}
+
 ssize_t BlockFileIO::cacheWriteOneBlock(const IORequest &req) {
-  // Let's point request buffer to our own buffer, as it may be modified by
-  // encryption : originating process may not like to have its buffer modified
-  memcpy(_cache.data, req.data, req.dataLen);
-  IORequest tmp;
-  tmp.offset = req.offset;
-  tmp.data = _cache.data;
-  tmp.dataLen = req.dataLen;
-  ssize_t res = writeOneBlock(tmp);
+  if (_codeInPlace && !_padding) {
+    // the caller caches the plaintext itself
+    clearCacheRange(req.offset, req.offset + _blockSize);
+    if (req.offset == _tail.offset) {
+      _tail.dataLen = 0;
+    }
+    return writeOneBlock(req);
+  }
+
+  // writeOneBlock() leaves the request as it is, the layers code it into
+  // buffers of their own.  So the plaintext is only copied to the cache once
+  // the block is written.
+  ssize_t res = writeOneBlock(req);
   if (res < 0) {
-    clearCache(_cache, _blockSize);
+    clearCacheRange(req.offset, req.offset + _blockSize);
+    if (_sharedCache) {
+      _sharedCache->forgetBlock(getFileName(), req.offset / _blockSize);
+    }
+    if (req.offset == _tail.offset) {
+      _tail.dataLen = 0;
+    }
   }
   else {
-    // And now we can cache the write buffer from the request
-    memcpy(_cache.data, req.data, req.dataLen);
-    _cache.offset = req.offset;
-    _cache.dataLen = req.dataLen;
+    CacheEntry *cached = findCacheEntry(req.offset);
+    IORequest &cache = (cached != nullptr) ? cached->req : newCacheEntry().req;
+    memcpy(cache.data, req.data, req.dataLen);
+    cache.offset = req.offset;
+    cache.dataLen = req.dataLen;
+    if (_sharedCache && _shareBlocks) {
+      _sharedCache->insert(getFileName(), req.offset / _blockSize, req.data,
+                           req.dataLen);
+    } else if (_sharedCache) {
+      _sharedCache->forgetBlock(getFileName(), req.offset / _blockSize);
+    }
+    rememberTail(req);
   }
   return res;
 }
@@ -152,6 +671,52 @@ ssize_t BlockFileIO::read(const IORequest &req) const {
   blockReq.data = nullptr;
 
   unsigned char *out = req.data;
+
+  // large aligned requests are passed down as runs of blocks, split at the
+  // holes of the backing file.  The remaining partial block is read below.
+  if (partialOffset == 0 && size >= _runMinBlocks * _blockSize) {
+    size_t count = size / _blockSize;
+    while (count > 0) {
+      size_t dataBlocks = count;
+      size_t holes = 0;
+      if (_holeMap) {
+        // known holes need no query, the others are still found below
+        holes = _holeMap->holeBlocks(blockNum, count, dataBlocks);
+      }
+      if (holes == 0 && _allowHoles) {
+        holes = holeBlocks(blockNum, dataBlocks, dataBlocks);
+      }
+      if (holes > 0) {
+        // zero blocks are passed through, no need to read them
+        memset(out, 0, holes * _blockSize);
+        result += holes * _blockSize;
+        size -= holes * _blockSize;
+        out += holes * _blockSize;
+        blockNum += holes;
+        count -= holes;
+        continue;
+      }
+
+      IORequest runReq;
+      runReq.offset = blockNum * _blockSize;
+      runReq.data = out;
+      runReq.dataLen = dataBlocks * _blockSize;
+      ssize_t readSize = readBlocks(runReq);
+      if (readSize < 0) {
+        return readSize;
+      }
+
+      result += readSize;
+      if ((size_t)readSize < dataBlocks * _blockSize) {
+        return result;  // end of file
+      }
+      size -= readSize;
+      out += readSize;
+      blockNum += dataBlocks;
+      count -= dataBlocks;
+    }
+  }
+
   while (size != 0u) {
     blockReq.offset = blockNum * _blockSize;
 
@@ -207,11 +772,23 @@ ssize_t BlockFileIO::read(const IORequest &req) const {
 ssize_t BlockFileIO::write(const IORequest &req) {
   CHECK(_blockSize != 0);
 
-  off_t fileSize = getSize();
+  off_t fileSize = _knownSize;
   if (fileSize < 0) {
-    return fileSize;
+    fileSize = getSize();
+    if (fileSize < 0) {
+      return fileSize;
+    }
+  }
+  // known again once the write succeeded
+  _knownSize = -1;
+  ssize_t res = writeRequest(req, fileSize);
+  if (res >= 0) {
+    _knownSize = std::max(fileSize, req.offset + (off_t)req.dataLen);
   }
+  return res;
+}
 
+ssize_t BlockFileIO::writeRequest(const IORequest &req, off_t fileSize) {
   // where write request begins
   off_t blockNum = req.offset / _blockSize;
   int partialOffset =
@@ -235,6 +812,11 @@ ssize_t BlockFileIO::write(const IORequest &req) {
     }
   }
 
+  if (_holeMap && req.dataLen > 0) {
+    off_t lastBlock = (req.offset + (off_t)req.dataLen - 1) / _blockSize;
+    _holeMap->removeHoles(blockNum, lastBlock - blockNum + 1);
+  }
+
   // check against edge cases where we can just let the base class handle the
   // request as-is..
   if (partialOffset == 0 && req.dataLen <= _blockSize) {
@@ -261,6 +843,23 @@ ssize_t BlockFileIO::write(const IORequest &req) {
   size_t size = req.dataLen;
   unsigned char *inPtr = req.data;
   while (size != 0u) {
+    // runs of full blocks are passed down at once
+    if (partialOffset == 0 && size >= _writeRunMinBlocks * _blockSize) {
+      size_t count = size / _blockSize;
+      IORequest runReq;
+      runReq.offset = blockNum * _blockSize;
+      runReq.data = inPtr;
+      runReq.dataLen = count * _blockSize;
+      res = writeBlocks(runReq);
+      if (res < 0) {
+        break;
+      }
+      size -= count * _blockSize;
+      inPtr += count * _blockSize;
+      blockNum += count;
+      continue;
+    }
+
     blockReq.offset = blockNum * _blockSize;
     size_t toCopy = min((size_t)_blockSize - (size_t)partialOffset, size);
 
@@ -283,6 +882,14 @@ ssize_t BlockFileIO::write(const IORequest &req) {
       if (blockNum > lastNonEmptyBlock) {
         // just pad..
         blockReq.dataLen = partialOffset + toCopy;
+      } else if (_tail.dataLen > 0 && _tail.offset == blockReq.offset &&
+                 _tail.offset + (off_t)_tail.dataLen == fileSize) {
+        // appending to the last block we wrote, no need to read it back
+        memcpy(blockReq.data, _tail.data, _tail.dataLen);
+        blockReq.dataLen = _tail.dataLen;
+        if (partialOffset + toCopy > blockReq.dataLen) {
+          blockReq.dataLen = partialOffset + toCopy;
+        }
       } else {
         // have to merge with existing block data..
         blockReq.dataLen = _blockSize;
@@ -383,13 +990,15 @@ int BlockFileIO::padFile(off_t oldSize, off_t newSize, bool forceWrite) {
     }
 
     // 2, pad zero blocks unless holes are allowed
-    if (!_allowHoles) {
-      for (; (res >= 0) && (oldLastBlock != newLastBlock); ++oldLastBlock) {
-        VLOG(1) << "padding block " << oldLastBlock;
-        req.offset = oldLastBlock * _blockSize;
-        req.dataLen = _blockSize;
-        memset(mb.data, 0, req.dataLen);
-        res = cacheWriteOneBlock(req);
+    if ((res >= 0) && (oldLastBlock != newLastBlock)) {
+      if (!_allowHoles) {
+        res = writeZeroBlocks(oldLastBlock, newLastBlock - oldLastBlock);
+      } else {
+        // failing is fine, the hole is just allocated then
+        setSparse();
+        if (_holeMap) {
+          _holeMap->addHoles(oldLastBlock, newLastBlock - oldLastBlock);
+        }
       }
     }
 
@@ -412,6 +1021,43 @@ int BlockFileIO::padFile(off_t oldSize, off_t newSize, bool forceWrite) {
   return 0;
 }
 
+/**
+ * Write count zero blocks starting at blockNum, in runs which are encoded
+ * in parallel by writeBlocks().  The same zero buffer is used for all runs,
+ * writeBlocks() doesn't modify it.
+ * Returns 0 in case of success, or -errno in case of failure.
+ */
+int BlockFileIO::writeZeroBlocks(off_t blockNum, off_t count) {
+  size_t runBlocks = (size_t)min(count, (off_t)_padBlocks);
+  MemBlock mb = MemoryPool::allocate((int)(runBlocks * _blockSize));
+  memset(mb.data, 0, runBlocks * _blockSize);
+
+  // the blocks are beyond the end of the file, so they are not in the
+  // shared cache, and zeros shouldn't push out the data of other files
+  _padding = true;
+
+  IORequest req;
+  req.data = mb.data;
+  ssize_t res = 0;
+  while ((res >= 0) && (count > 0)) {
+    size_t n = (size_t)min(count, (off_t)runBlocks);
+    VLOG(1) << "padding blocks " << blockNum << " to " << blockNum + n - 1;
+    req.offset = blockNum * _blockSize;
+    req.dataLen = n * _blockSize;
+    res = writeBlocks(req);
+    blockNum += n;
+    count -= n;
+  }
+
+  _padding = false;
+  MemoryPool::release(mb);
+
+  if (res < 0) {
+    return (int)res;
+  }
+  return 0;
+}
+
 /**
  * Returns 0 in case of success, or -errno in case of failure.
  */
@@ -421,11 +1067,26 @@ int BlockFileIO::truncateBase(off_t size, FileIO *base) {
 
   off_t oldSize = getSize();
 
+  // a partial last block is remembered again when it is written below
+  _tail.dataLen = 0;
+  // the layers doing the truncate may change the size once more afterwards
+  _knownSize = -1;
+
+  if (_holeMap && size < oldSize) {
+    // a partial last block is written again below, it reads as zeros from
+    // the cipher file if it was a hole
+    _holeMap->truncate(size / _blockSize);
+  }
+
   if (size > oldSize) {
     // truncate can be used to extend a file as well.  truncate man page
     // states that it will pad with 0's.
     // do the truncate so that the underlying filesystem can allocate
     // the space, and then we'll fill it in padFile..
+    if (size - oldSize >= preallocMinBytes) {
+      // failing is fine, the space is then allocated by the writes
+      preallocate(size);
+    }
     if (base != nullptr) {
       res = base->truncate(size);
     }
@@ -476,6 +1137,14 @@ int BlockFileIO::truncateBase(off_t size, FileIO *base) {
     }
   }
 
+  // blocks after the new end of the file must not be served from the cache
+  clearCacheBeyond(size);
+  if (_sharedCache) {
+    // the partial last block has been written again above
+    _sharedCache->forgetFrom(getFileName(),
+                             (size + _blockSize - 1) / _blockSize);
+  }
+
   return res;
 }
 
@@ -21,10 +21,17 @@
 #ifndef _BlockFileIO_incl_
 #define _BlockFileIO_incl_
 
+#include <memory>
+#include <stdint.h>
 #include <sys/types.h>
+#include <vector>
 
+#include <boost/thread/mutex.hpp>
+
+#include "BlockCache.h"
 #include "FSConfig.h"
 #include "FileIO.h"
+#include "HoleMap.h"
 
 namespace encfs {
 
@@ -47,24 +54,135 @@ class BlockFileIO : public FileIO {
 
   virtual unsigned int blockSize() const;
 
+  // use a cache shared with the other files in addition to our own blocks.
+  // Only set on the outermost layer, the keys are our block offsets.
+  void setSharedCache(const std::shared_ptr<BlockCache> &cache);
+
+  // read and code the blocks of read() and write() requests in the caller's
+  // buffer instead of staging them in our cache.  Only set on the layer
+  // below MACFileIO, whose requests point to its own temporary buffers and
+  // which caches the plaintext itself.
+  void setCodeInPlace(bool codeInPlace);
+
+  // the blocks of the file which are known holes, kept up to date by our
+  // writes and truncates.  Only set on the outermost layer, needs
+  // allowHoles.
+  void setHoleMap(const std::shared_ptr<HoleMap> &holeMap);
+
+  // Access_NoCache bypasses our cache and the shared one like the noCache
+  // option, Access_Sequential and Access_WriteOnce only keep their blocks
+  // out of the shared cache.  Set while no reads or writes run.
+  void setAccessHint(AccessHint hint);
+
+  // write() keeps the size of the file from one call to the next, so that
+  // it doesn't go through the layers below for every write.  To be called
+  // when the file may have changed behind our back, i.e. when it is opened.
+  void forgetSize() const;
+
  protected:
   int truncateBase(off_t size, FileIO *base);
   int padFile(off_t oldSize, off_t newSize, bool forceWrite);
+  int writeZeroBlocks(off_t blockNum, off_t count);
 
   // same as read(), except that the request.offset field is guarenteed to be
   // block aligned, and the request size will not be larger then 1 block.
+  // writeOneBlock() must not modify the data of the request, so that it can
+  // be cached afterwards.
   virtual ssize_t readOneBlock(const IORequest &req) const = 0;
   virtual ssize_t writeOneBlock(const IORequest &req) = 0;
 
   ssize_t cacheReadOneBlock(const IORequest &req) const;
   ssize_t cacheWriteOneBlock(const IORequest &req);
 
+  // read or write a run of whole blocks starting at a block-aligned offset,
+  // used by read() and write() for large requests.  The default versions
+  // code the blocks in parallel with the steps below if the derived class
+  // provides them, and go through the cache one block at a time otherwise.
+  virtual ssize_t readBlocks(const IORequest &req) const;
+  virtual ssize_t writeBlocks(const IORequest &req);
+
+  // update the caches for blocks coded by readBlocks() and writeBlocks()
+  void shareBlocks(const unsigned char *data, off_t blockNum,
+                   size_t len) const;
+  void blocksWritten(const unsigned char *data, off_t blockNum, size_t count,
+                     bool ok);
+
+  size_t holeBlocks(off_t blockNum, size_t count, size_t &dataBlocks) const;
+
+  // optional steps for the parallel coding of runs.  readRawBlocks() reads
+  // whole blocks starting at a block-aligned offset without decoding them,
+  // decodeBlock() decodes one of them.  decodeBlocks() decodes len bytes of
+  // consecutive blocks, by default with decodeBlock().
+  virtual bool canDecodeBlocks() const;
+  virtual ssize_t readRawBlocks(const IORequest &req) const;
+  virtual bool decodeBlock(unsigned char *data, int size, off_t blockNum) const;
+  virtual bool decodeBlocks(unsigned char *data, size_t len,
+                            off_t blockNum) const;
+
+  // optional, the same for write().  prepareEncodeBlocks() returns false if
+  // the blocks can't be encoded right now, e.g. without a file header.
+  virtual bool prepareEncodeBlocks();
+  virtual bool encodeBlock(unsigned char *data, int size, off_t blockNum) const;
+  virtual bool encodeBlocks(unsigned char *data, size_t len,
+                            off_t blockNum) const;
+  virtual ssize_t writeRawBlocks(const IORequest &req);
+
   unsigned int _blockSize;
   bool _allowHoles;
   bool _noCache;
 
-  // cache last block for speed...
-  mutable IORequest _cache;
+ private:
+  struct CacheEntry {
+    IORequest req;     // req.data holds _blockSize bytes, unused if dataLen is 0
+    uint64_t lastUse;  // for LRU eviction
+  };
+
+  // write() with the size of the file before the request
+  ssize_t writeRequest(const IORequest &req, off_t fileSize);
+
+  bool decodeRun(unsigned char *data, size_t len, off_t blockNum) const;
+
+  CacheEntry *findCacheEntry(off_t offset) const;
+  CacheEntry &newCacheEntry() const;
+  void clearCacheBeyond(off_t size) const;
+  void clearCacheRange(off_t begin, off_t end) const;
+  void rememberTail(const IORequest &req);
+
+  // the counts of blocks of the runs and chunks in BlockFileIO.cpp, fewer
+  // of them for large blocks
+  size_t _runMinBlocks;
+  size_t _writeRunMinBlocks;
+  size_t _chunkBlocks;
+  size_t _padBlocks;
+
+  // cache the last used blocks for speed...
+  mutable std::vector<CacheEntry> _cache;
+  mutable uint64_t _cacheUseCount;
+  // taken by readers, which may run concurrently.  Writers don't need it,
+  // they exclude the readers (see FileNode).
+  mutable boost::mutex _cacheMutex;
+
+  // plaintext of the partial last block from our last write to it, so that
+  // appends don't have to read it back.  Unused if dataLen is 0, only valid
+  // while its end is still the end of the file.
+  IORequest _tail;
+
+  // set while padFile() writes zero blocks
+  bool _padding;
+
+  // size of the file after our last write, -1 if not known.  Only used and
+  // changed by writers, truncateBase() forgets it.
+  mutable off_t _knownSize;
+
+  bool _codeInPlace;
+
+  // the noCache option, which a hint can't turn off
+  bool _optNoCache;
+  // our blocks go to the shared cache, otherwise they are only removed
+  bool _shareBlocks;
+
+  std::shared_ptr<BlockCache> _sharedCache;
+  std::shared_ptr<HoleMap> _holeMap;
 };
 
 }  // namespace encfs
@@ -175,11 +175,7 @@ int BlockNameIO::encodeName(const char *plaintextName, int length, uint64_t *iv,
   int encLen;
 
   if (_caseInsensitive) {
-    encLen = B256ToB32Bytes(encodedStreamLen);
-
-    changeBase2Inline((unsigned char *)encodedName, encodedStreamLen, 8, 5,
-                      true);
-    B32ToAscii((unsigned char *)encodedName, encLen);
+    encLen = B256ToB32Ascii((unsigned char *)encodedName, encodedStreamLen);
   } else {
     encLen = B256ToB64Bytes(encodedStreamLen);
 
@@ -193,22 +189,51 @@ int BlockNameIO::encodeName(const char *plaintextName, int length, uint64_t *iv,
 
 int BlockNameIO::decodeName(const char *encodedName, int length, uint64_t *iv,
                             char *plaintextName, int bufferLength) const {
+  int finalSize =
+      tryDecodeName(encodedName, length, iv, plaintextName, bufferLength);
+  if (finalSize < 0) {
+    throw Error("Invalid filename, decode failed");
+  }
+  return finalSize;
+}
+
+bool BlockNameIO::isValidEncodedName(const char *encodedName,
+                                     int length) const {
+  // the encoded stream has 2 checksum bytes and whole cipher blocks, and
+  // encodeName() produces the shortest ASCII form of it
   int decLen256 =
       _caseInsensitive ? B32ToB256Bytes(length) : B64ToB256Bytes(length);
   int decodedStreamLen = decLen256 - 2;
+  if (decodedStreamLen < _bs || decodedStreamLen % _bs != 0) {
+    return false;
+  }
+  if (_caseInsensitive) {
+    return B256ToB32Bytes(decLen256) == length &&
+           IsB32Ascii((const unsigned char *)encodedName, length);
+  }
+  return B256ToB64Bytes(decLen256) == length &&
+         IsB64Ascii((const unsigned char *)encodedName, length);
+}
 
-  // don't bother trying to decode files which are too small
-  if (decodedStreamLen < _bs) {
+int BlockNameIO::tryDecodeName(const char *encodedName, int length,
+                               uint64_t *iv, char *plaintextName,
+                               int bufferLength) const {
+  // don't bother trying to decode names which encodeName() can't produce
+  if (!isValidEncodedName(encodedName, length)) {
     VLOG(1) << "Rejecting filename " << encodedName;
-    throw Error("Filename too small to decode");
+    return -1;
   }
 
-  BUFFER_INIT(tmpBuf, 32, (unsigned int)length);
+  int decLen256 =
+      _caseInsensitive ? B32ToB256Bytes(length) : B64ToB256Bytes(length);
+  int decodedStreamLen = decLen256 - 2;
+
+  BUFFER_INIT(tmpBuf, NameBufferSize, (unsigned int)length);
 
   // decode into tmpBuf,
   if (_caseInsensitive) {
-    AsciiToB32((unsigned char *)tmpBuf, (unsigned char *)encodedName, length);
-    changeBase2Inline((unsigned char *)tmpBuf, length, 5, 8, false);
+    B32AsciiToB256((unsigned char *)tmpBuf, (unsigned char *)encodedName,
+                   length);
   } else {
     AsciiToB64((unsigned char *)tmpBuf, (unsigned char *)encodedName, length);
     changeBase2Inline((unsigned char *)tmpBuf, length, 6, 8, false);
@@ -227,7 +252,9 @@ int BlockNameIO::decodeName(const char *encodedName, int length, uint64_t *iv,
   ok = _cipher->blockDecode((unsigned char *)tmpBuf + 2, decodedStreamLen,
                             (uint64_t)mac ^ tmpIV, _key);
   if (!ok) {
-    throw Error("block decode failed in filename decode");
+    VLOG(1) << "block decode failed in filename decode";
+    BUFFER_RESET(tmpBuf);
+    return -1;
   }
 
   // find out true string length
@@ -238,7 +265,8 @@ int BlockNameIO::decodeName(const char *encodedName, int length, uint64_t *iv,
   if (padding > _bs || finalSize < 0) {
     VLOG(1) << "padding, _bx, finalSize = " << padding << ", " << _bs << ", "
             << finalSize;
-    throw Error("invalid padding size");
+    BUFFER_RESET(tmpBuf);
+    return -1;
   }
 
   // copy out the result..
@@ -255,7 +283,7 @@ int BlockNameIO::decodeName(const char *encodedName, int length, uint64_t *iv,
   if (mac2 != mac) {
     VLOG(1) << "checksum mismatch: expected " << mac << ", got " << mac2
             << " on decode of " << finalSize << " bytes";
-    throw Error("checksum mismatch in filename decode");
+    return -1;
   }
 
   return finalSize;
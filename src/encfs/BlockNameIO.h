@@ -61,6 +61,9 @@ class BlockNameIO : public NameIO {
                          char *encodedName, int bufferLength) const;
   virtual int decodeName(const char *encodedName, int length, uint64_t *iv,
                          char *plaintextName, int bufferLength) const;
+  virtual bool isValidEncodedName(const char *encodedName, int length) const;
+  virtual int tryDecodeName(const char *encodedName, int length, uint64_t *iv,
+                            char *plaintextName, int bufferLength) const;
 
  private:
   int _interface;
@@ -19,6 +19,7 @@
  */
 
 #include <cstddef>
+#include <cstring>
 #include <iostream>
 #include <list>
 #include <map>
@@ -175,6 +176,14 @@ unsigned int Cipher::MAC_16(const unsigned char *src, int len,
   return mac16;
 }
 
+void Cipher::MAC_64_many(const unsigned char *src, int len, int stride,
+                         int count, const CipherKey &key,
+                         uint64_t *macs) const {
+  for (int i = 0; i < count; ++i) {
+    macs[i] = MAC_64(src + (size_t)i * stride, len, key);
+  }
+}
+
 bool Cipher::nameEncode(unsigned char *data, int len, uint64_t iv64,
                         const CipherKey &key) const {
   return streamEncode(data, len, iv64, key);
@@ -185,6 +194,35 @@ bool Cipher::nameDecode(unsigned char *data, int len, uint64_t iv64,
   return streamDecode(data, len, iv64, key);
 }
 
+bool Cipher::blockEncodeTo(const unsigned char *src, unsigned char *dst,
+                           int size, uint64_t iv64,
+                           const CipherKey &key) const {
+  if (dst != src) {
+    memcpy(dst, src, size);
+  }
+  return blockEncode(dst, size, iv64, key);
+}
+
+bool Cipher::blockEncodeMany(const Block *blocks, int count, int size,
+                             const CipherKey &key) const {
+  for (int i = 0; i < count; ++i) {
+    if (!blockEncode(blocks[i].buf, size, blocks[i].iv64, key)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Cipher::blockDecodeMany(const Block *blocks, int count, int size,
+                             const CipherKey &key) const {
+  for (int i = 0; i < count; ++i) {
+    if (!blockDecode(blocks[i].buf, size, blocks[i].iv64, key)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 string Cipher::encodeAsString(const CipherKey &key,
                               const CipherKey &encodingKey) {
   int encodedKeySize = this->encodedKeySize();
@@ -124,6 +124,11 @@ class Cipher {
                       uint64_t *chainedIV = 0) const;
   unsigned int MAC_16(const unsigned char *src, int len, const CipherKey &key,
                       uint64_t *chainedIV = 0) const;
+  // MAC_64 of count buffers of len bytes each, stride bytes apart, without
+  // chained IV.  The default version calls MAC_64 for every buffer.
+  virtual void MAC_64_many(const unsigned char *src, int len, int stride,
+                           int count, const CipherKey &key,
+                           uint64_t *macs) const;
 
   // functional interfaces
   /*
@@ -153,6 +158,29 @@ class Cipher {
                            const CipherKey &key) const = 0;
   virtual bool blockDecode(unsigned char *buf, int size, uint64_t iv64,
                            const CipherKey &key) const = 0;
+
+  /*
+      Block encoding of size bytes from src into dst, leaving src as it is.
+      The buffers must not overlap unless they are the same.  The default
+      version copies src to dst and encodes it there.
+  */
+  virtual bool blockEncodeTo(const unsigned char *src, unsigned char *dst,
+                             int size, uint64_t iv64,
+                             const CipherKey &key) const;
+
+  /*
+      Block encoding of count buffers of size bytes each, with one IV per
+      buffer.  Saves the per-call setup of blockEncode / blockDecode, the
+      default versions simply call them for every buffer.
+  */
+  struct Block {
+    unsigned char *buf;
+    uint64_t iv64;
+  };
+  virtual bool blockEncodeMany(const Block *blocks, int count, int size,
+                               const CipherKey &key) const;
+  virtual bool blockDecodeMany(const Block *blocks, int count, int size,
+                               const CipherKey &key) const;
 };
 
 }  // namespace encfs
@@ -21,7 +21,9 @@
 #include "CipherFileIO.h"
 
 #include "easylogging++.h"
+#include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <cinttypes>
 #include <cstring>
 #include <fcntl.h>
@@ -29,12 +31,17 @@
 #include <openssl/sha.h>
 #include <sys/stat.h>
 #include <utility>
+#include <vector>
 
 #include "BlockFileIO.h"
 #include "Cipher.h"
 #include "CipherKey.h"
 #include "Error.h"
 #include "FileIO.h"
+#include "FileIVCache.h"
+#include "MemoryPool.h"
+#include "PhaseTimer.h"
+#include "ZeroBlock.h"
 
 namespace encfs {
 
@@ -48,6 +55,40 @@ static Interface CipherFileIO_iface("FileIO/Cipher", 2, 0, 1);
 
 const int HEADER_SIZE = 8;  // 64 bit initialization vector..
 
+// the blocks encrypted ahead of sequential reads in reverse mode.  Large
+// enough to keep every worker busy with a run of its own.
+static const size_t reverseReadAheadBytes = 1 << 20;
+
+/*
+    Adds the duration of its scope to FSConfig::codingNanos, unless that is
+    null.
+*/
+class CodingTimer {
+ public:
+  explicit CodingTimer(const FSConfigPtr &cfg)
+      : _nanos(cfg->codingNanos.get()) {
+    if (_nanos != nullptr) {
+      _start = std::chrono::steady_clock::now();
+    }
+  }
+  ~CodingTimer() {
+    if (_nanos != nullptr) {
+      _nanos->fetch_add(
+          (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - _start)
+              .count(),
+          std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  CodingTimer(const CodingTimer &src);             // not allowed
+  CodingTimer &operator=(const CodingTimer &src);  // not allowed
+
+  std::atomic<uint64_t> *_nanos;
+  std::chrono::steady_clock::time_point _start;
+};
+
 CipherFileIO::CipherFileIO(std::shared_ptr<FileIO> _base,
                            const FSConfigPtr &cfg)
     : BlockFileIO(cfg->config->blockSize, cfg),
@@ -55,7 +96,11 @@ CipherFileIO::CipherFileIO(std::shared_ptr<FileIO> _base,
       haveHeader(cfg->config->uniqueIV),
       externalIV(0),
       fileIV(0),
-      lastFlags(0) {
+      lastFlags(0),
+      haveReverseHeader(false),
+      aheadOffset(0),
+      aheadLen(0),
+      aheadNext(0) {
   fsConfig = cfg;
   cipher = cfg->cipher;
   key = cfg->key;
@@ -64,7 +109,11 @@ CipherFileIO::CipherFileIO(std::shared_ptr<FileIO> _base,
       << "FS block size must be multiple of cipher block size";
 }
 
-CipherFileIO::~CipherFileIO() = default;
+CipherFileIO::~CipherFileIO() {
+  if (aheadBuf.data != nullptr) {
+    MemoryPool::release(aheadBuf);
+  }
+}
 
 Interface CipherFileIO::interface() const { return CipherFileIO_iface; }
 
@@ -79,6 +128,8 @@ int CipherFileIO::open(int flags) {
 }
 
 void CipherFileIO::setFileName(const char *fileName) {
+  haveReverseHeader = false;
+  forgetReadAhead();
   base->setFileName(fileName);
 }
 
@@ -87,6 +138,8 @@ const char *CipherFileIO::getFileName() const { return base->getFileName(); }
 bool CipherFileIO::setIV(uint64_t iv) {
   VLOG(1) << "in setIV, current IV = " << externalIV << ", new IV = " << iv
           << ", fileIV = " << fileIV;
+  haveReverseHeader = false;
+  forgetReadAhead();
   if (externalIV == 0) {
     // we're just being told about which IV to use.  since we haven't
     // initialized the fileIV, there is no need to just yet..
@@ -95,6 +148,10 @@ bool CipherFileIO::setIV(uint64_t iv) {
       RLOG(WARNING) << "fileIV initialized before externalIV: " << fileIV
                     << ", " << externalIV;
     }
+  } else if (emptyWithoutHeader()) {
+    // nothing on disk was encoded with the old IV, the header is created
+    // with the new one on the first write
+    externalIV = iv;
   } else if (haveHeader) {
     // we have an old IV, and now a new IV, so we need to update the fileIV
     // on disk.
@@ -116,6 +173,11 @@ bool CipherFileIO::setIV(uint64_t iv) {
       }
     }
 
+    // the header is encoded again with the new external IV
+    if (fsConfig->ivCache) {
+      fsConfig->ivCache->forget(getFileName());
+    }
+
     uint64_t oldIV = externalIV;
     externalIV = iv;
     if (!writeHeader()) {
@@ -138,18 +200,8 @@ int CipherFileIO::getAttr(efs_stat *stbuf, void *statCache) const {
   int res = base->getAttr(stbuf, statCache);
 
   // adjust size if we have a file header
-  if ((res == 0) && haveHeader && S_ISREG(stbuf->st_mode) &&
-      (stbuf->st_size > 0)) {
-    if (!fsConfig->reverseEncryption) {
-      /* In normal mode, the upper file (plaintext) is smaller
-       * than the backing ciphertext file */
-      rAssert(stbuf->st_size >= HEADER_SIZE);
-      stbuf->st_size -= HEADER_SIZE;
-    } else {
-      /* In reverse mode, the upper file (ciphertext) is larger than
-       * the backing plaintext file */
-      stbuf->st_size += HEADER_SIZE;
-    }
+  if ((res == 0) && S_ISREG(stbuf->st_mode)) {
+    stbuf->st_size = plainSize(stbuf->st_size);
   }
 
   return res;
@@ -157,27 +209,60 @@ int CipherFileIO::getAttr(efs_stat *stbuf, void *statCache) const {
 
 /**
  * Get the size for an upper file
- * See getAttr() for an explaination of the reverse handling
+ * See plainSize() for an explaination of the reverse handling
  */
 off_t CipherFileIO::getSize() const {
-  off_t size = base->getSize();
   // No check on S_ISREG here -- don't call getSize over getAttr unless this
   // is a normal file!
-  if (haveHeader && size > 0) {
+  return plainSize(base->getSize());
+}
+
+off_t CipherFileIO::plainSize(off_t rawSize) const {
+  if (haveHeader && rawSize > 0) {
     if (!fsConfig->reverseEncryption) {
-      rAssert(size >= HEADER_SIZE);
-      size -= HEADER_SIZE;
-    } else {
-      size += HEADER_SIZE;
+      /* In normal mode, the upper file (plaintext) is smaller
+       * than the backing ciphertext file */
+      rAssert(rawSize >= HEADER_SIZE);
+      return rawSize - HEADER_SIZE;
     }
+    /* In reverse mode, the upper file (ciphertext) is larger than
+     * the backing plaintext file */
+    return rawSize + HEADER_SIZE;
   }
-  return size;
+  return rawSize;
+}
+
+bool CipherFileIO::emptyWithoutHeader() const {
+  return haveHeader && fileIV == 0 && !fsConfig->reverseEncryption &&
+         base->getSize() == 0;
 }
 
 int CipherFileIO::initHeader() {
   // check if the file has a header, and read it if it does..  Otherwise,
   // create one.
-  off_t rawSize = base->getSize();
+  off_t rawSize;
+  efs_stat stbuf;
+  const std::shared_ptr<FileIVCache> &ivCache = fsConfig->ivCache;
+  if (ivCache) {
+    // the stamp for the cache, stat() replaces the one in getSize()
+    int res = base->getAttr(&stbuf, nullptr);
+    if (res < 0) {
+      return res;
+    }
+    rawSize = stbuf.st_size;
+  } else {
+    rawSize = base->getSize();
+  }
+
+  if (rawSize >= HEADER_SIZE && ivCache) {
+    fileIV = ivCache->lookup(getFileName(), externalIV, stbuf.st_ino, rawSize,
+                             stbuf.st_mtime);
+    if (fileIV != 0) {
+      VLOG(1) << "initHeader from cache, fileIV = " << fileIV;
+      return 0;
+    }
+  }
+
   if (rawSize >= HEADER_SIZE) {
     VLOG(1) << "reading existing header, rawSize = " << rawSize;
     // has a header.. read it
@@ -202,6 +287,11 @@ int CipherFileIO::initHeader() {
     }
 
     rAssert(fileIV != 0);  // 0 is never used..
+
+    if (ivCache) {
+      ivCache->insert(getFileName(), externalIV, stbuf.st_ino, rawSize,
+                      stbuf.st_mtime, fileIV);
+    }
   } else {
     VLOG(1) << "creating new file IV header";
 
@@ -326,9 +416,27 @@ int CipherFileIO::generateReverseHeader(unsigned char *headerBuf) {
  * Read block from backing plaintext file, then encrypt it (reverse mode)
  */
 ssize_t CipherFileIO::readOneBlock(const IORequest &req) const {
-  int bs = blockSize();
-  off_t blockNum = req.offset / bs;
+  off_t blockNum = req.offset / blockSize();
 
+  ssize_t readSize = readRawBlocks(req);
+  if (readSize > 0) {
+    // cast works because we work on a block and blocksize fit an int
+    if (!decodeBlock(req.data, (int)readSize, blockNum)) {
+      readSize = -EBADMSG;
+    }
+  } else if (readSize == 0) {
+    VLOG(1) << "readSize zero for offset " << req.offset;
+  }
+
+  return readSize;
+}
+
+bool CipherFileIO::canDecodeBlocks() const { return true; }
+
+/**
+ * Read one or more blocks from the backing file without decoding them.
+ */
+ssize_t CipherFileIO::readRawBlocks(const IORequest &req) const {
   IORequest tmpReq = req;
 
   // adjust offset if we have a file header
@@ -337,36 +445,87 @@ ssize_t CipherFileIO::readOneBlock(const IORequest &req) const {
   }
   ssize_t readSize = base->read(tmpReq);
 
-  bool ok;
-  if (readSize > 0) {
-    if (haveHeader && fileIV == 0) {
+  if (readSize > 0 && haveHeader) {
+    boost::mutex::scoped_lock lock(headerMutex);
+    if (fileIV == 0) {
       int res = const_cast<CipherFileIO *>(this)->initHeader();
       if (res < 0) {
         return res;
       }
     }
+  }
 
-    if (readSize != bs) {
-      VLOG(1) << "streamRead(data, " << readSize << ", IV)";
-      ok = streamRead(tmpReq.data, (int)readSize,
-                      blockNum ^ fileIV);  // cast works because we work on a
-                                           // block and blocksize fit an int
-    } else {
-      ok = blockRead(tmpReq.data, (int)readSize,
-                     blockNum ^ fileIV);  // cast works because we work on a
-                                          // block and blocksize fit an int
+  return readSize;
+}
+
+/**
+ * Decrypt a block read with readRawBlocks() (normal mode)
+ * or
+ * encrypt it (reverse mode).
+ * Only reads the state of the file, so several blocks can be decoded at
+ * the same time.
+ */
+bool CipherFileIO::decodeBlock(unsigned char *data, int size,
+                               off_t blockNum) const {
+  CodingTimer timer(fsConfig);
+  bool ok;
+  if (size != (int)blockSize()) {
+    VLOG(1) << "streamRead(data, " << size << ", IV)";
+    ok = streamRead(data, size, blockNum ^ fileIV);
+  } else {
+    ok = blockRead(data, size, blockNum ^ fileIV);
+  }
+
+  if (!ok) {
+    VLOG(1) << "decodeBlock failed for block " << blockNum << ", size "
+            << size;
+  }
+  return ok;
+}
+
+/**
+ * Decode the blocks of a run read with readRawBlocks().  The full blocks are
+ * passed to the cipher with one call, a partial last block is decoded with
+ * decodeBlock().
+ */
+bool CipherFileIO::decodeBlocks(unsigned char *data, size_t len,
+                                off_t blockNum) const {
+  const size_t bs = blockSize();
+  std::vector<Cipher::Block> blocks;
+  blocks.reserve(len / bs);
+
+  size_t offset = 0;
+  for (; offset + bs <= len; offset += bs, ++blockNum) {
+    // special case - leave all 0's alone, see blockRead()
+    if (!fsConfig->reverseEncryption && _allowHoles &&
+        isAllZero(data + offset, bs)) {
+      continue;
     }
+    Cipher::Block block = {data + offset, (uint64_t)blockNum ^ fileIV};
+    blocks.push_back(block);
+  }
 
+  if (!blocks.empty()) {
+    TIMED_PHASE(PhaseDecrypt);
+    CodingTimer timer(fsConfig);
+    bool ok;
+    if (fsConfig->reverseEncryption) {
+      ok = cipher->blockEncodeMany(blocks.data(), (int)blocks.size(), (int)bs,
+                                   key);
+    } else {
+      ok = cipher->blockDecodeMany(blocks.data(), (int)blocks.size(), (int)bs,
+                                   key);
+    }
     if (!ok) {
-      VLOG(1) << "decodeBlock failed for block " << blockNum << ", size "
-              << readSize;
-      readSize = -EBADMSG;
+      VLOG(1) << "decodeBlocks failed for " << blocks.size() << " blocks";
+      return false;
     }
-  } else if (readSize == 0) {
-    VLOG(1) << "readSize zero for offset " << req.offset;
   }
 
-  return readSize;
+  if (offset < len) {
+    return decodeBlock(data + offset, (int)(len - offset), blockNum);
+  }
+  return true;
 }
 
 ssize_t CipherFileIO::writeOneBlock(const IORequest &req) {
@@ -377,8 +536,7 @@ ssize_t CipherFileIO::writeOneBlock(const IORequest &req) {
     return -EPERM;
   }
 
-  unsigned int bs = blockSize();
-  off_t blockNum = req.offset / bs;
+  off_t blockNum = req.offset / blockSize();
 
   if (haveHeader && fileIV == 0) {
     int res = initHeader();
@@ -387,32 +545,117 @@ ssize_t CipherFileIO::writeOneBlock(const IORequest &req) {
     }
   }
 
+  // the ciphertext goes to a staging buffer, the caller's plaintext stays
+  // as it is and can be cached without a copy of its own.  The cast works
+  // because we work on a block and blocksize fit an int
+  MemBlock mb = MemoryPool::allocate((int)req.dataLen);
+  ssize_t res = -EBADMSG;
+  if (encodeBlockTo(req.data, mb.data, (int)req.dataLen, blockNum)) {
+    IORequest tmpReq = req;
+    tmpReq.data = mb.data;
+    res = writeRawBlocks(tmpReq);
+  }
+  MemoryPool::release(mb);
+  return res;
+}
+
+bool CipherFileIO::prepareEncodeBlocks() {
+  if (haveHeader && fsConfig->reverseEncryption) {
+    return false;
+  }
+  // the header is needed for the IV, writeOneBlock() reports the error
+  return !(haveHeader && fileIV == 0 && initHeader() < 0);
+}
+
+/**
+ * Encrypt a block in place.  Only reads the state of the file, so several
+ * blocks can be encoded at the same time.
+ */
+bool CipherFileIO::encodeBlock(unsigned char *data, int size,
+                               off_t blockNum) const {
+  return encodeBlockTo(data, data, size, blockNum);
+}
+
+/**
+ * Encrypt a block from src into dst.  Full blocks are coded from one buffer
+ * into the other, the stream coding of a partial block works in place.
+ */
+bool CipherFileIO::encodeBlockTo(const unsigned char *src, unsigned char *dst,
+                                 int size, off_t blockNum) const {
+  CodingTimer timer(fsConfig);
   bool ok;
-  if (req.dataLen != bs) {
-    ok = streamWrite(req.data, (int)req.dataLen,
-                     blockNum ^ fileIV);  // cast works because we work on a
-                                          // block and blocksize fit an int
+  if (size == (int)blockSize() && !fsConfig->reverseEncryption) {
+    VLOG(1) << "Called blockWrite";
+    ok = cipher->blockEncodeTo(src, dst, size, blockNum ^ fileIV, key);
   } else {
-    ok = blockWrite(req.data, (int)req.dataLen,
-                    blockNum ^ fileIV);  // cast works because we work on a
-                                         // block and blocksize fit an int
+    if (dst != src) {
+      memcpy(dst, src, size);
+    }
+    if (size != (int)blockSize()) {
+      ok = streamWrite(dst, size, blockNum ^ fileIV);
+    } else {
+      ok = blockWrite(dst, size, blockNum ^ fileIV);
+    }
+  }
+
+  if (!ok) {
+    VLOG(1) << "encodeBlock failed for block " << blockNum << ", size "
+            << size;
+  }
+  return ok;
+}
+
+/**
+ * Encrypt the blocks of a run in place, the full blocks with one call to the
+ * cipher.
+ */
+bool CipherFileIO::encodeBlocks(unsigned char *data, size_t len,
+                                off_t blockNum) const {
+  const size_t bs = blockSize();
+  std::vector<Cipher::Block> blocks;
+  blocks.reserve(len / bs);
+
+  size_t offset = 0;
+  for (; offset + bs <= len; offset += bs, ++blockNum) {
+    Cipher::Block block = {data + offset, (uint64_t)blockNum ^ fileIV};
+    blocks.push_back(block);
   }
 
-  ssize_t res = 0;
-  if (ok) {
-    if (haveHeader) {
-      IORequest tmpReq = req;
-      tmpReq.offset += HEADER_SIZE;
-      res = base->write(tmpReq);
+  if (!blocks.empty()) {
+    CodingTimer timer(fsConfig);
+    bool ok;
+    if (!fsConfig->reverseEncryption) {
+      ok = cipher->blockEncodeMany(blocks.data(), (int)blocks.size(), (int)bs,
+                                   key);
     } else {
-      res = base->write(req);
+      ok = cipher->blockDecodeMany(blocks.data(), (int)blocks.size(), (int)bs,
+                                   key);
+    }
+    if (!ok) {
+      VLOG(1) << "encodeBlocks failed for " << blocks.size() << " blocks";
+      return false;
     }
-  } else {
-    VLOG(1) << "encodeBlock failed for block " << blockNum << ", size "
-            << req.dataLen;
-    res = -EBADMSG;
   }
-  return res;
+
+  if (offset < len) {
+    return encodeBlock(data + offset, (int)(len - offset), blockNum);
+  }
+  return true;
+}
+
+/**
+ * Write one or more encoded blocks to the backing file.
+ */
+ssize_t CipherFileIO::writeRawBlocks(const IORequest &req) {
+  if (fsConfig->reverseEncryption) {
+    forgetReadAhead();
+  }
+  if (haveHeader) {
+    IORequest tmpReq = req;
+    tmpReq.offset += HEADER_SIZE;
+    return base->write(tmpReq);
+  }
+  return base->write(req);
 }
 
 bool CipherFileIO::blockWrite(unsigned char *buf, int size,
@@ -435,17 +678,12 @@ bool CipherFileIO::streamWrite(unsigned char *buf, int size,
 
 bool CipherFileIO::blockRead(unsigned char *buf, int size,
                              uint64_t _iv64) const {
+  TIMED_PHASE(PhaseDecrypt);
   if (fsConfig->reverseEncryption) {
     return cipher->blockEncode(buf, size, _iv64, key);
   }
-  if (_allowHoles) {
+  if (_allowHoles && isAllZero(buf, size)) {
     // special case - leave all 0's alone
-    for (int i = 0; i < size; ++i) {
-      if (buf[i] != 0) {
-        return cipher->blockDecode(buf, size, _iv64, key);
-      }
-    }
-
     return true;
   }
   return cipher->blockDecode(buf, size, _iv64, key);
@@ -453,6 +691,7 @@ bool CipherFileIO::blockRead(unsigned char *buf, int size,
 
 bool CipherFileIO::streamRead(unsigned char *buf, int size,
                               uint64_t _iv64) const {
+  TIMED_PHASE(PhaseDecrypt);
   if (fsConfig->reverseEncryption) {
     return cipher->streamEncode(buf, size, _iv64, key);
   }
@@ -462,6 +701,7 @@ bool CipherFileIO::streamRead(unsigned char *buf, int size,
 int CipherFileIO::truncate(off_t size) {
   int res = 0;
   int reopen = 0;
+  forgetReadAhead();
   // well, we will truncate, so we need a write access to the file
   if (!base->isWritable()) {
     int newFlags = lastFlags | O_RDWR;
@@ -475,6 +715,10 @@ int CipherFileIO::truncate(off_t size) {
   }
   if (!haveHeader) {
     res = BlockFileIO::truncateBase(size, base.get());
+  } else if (size == 0 && emptyWithoutHeader()) {
+    // stays empty, like a new file truncated by the application, no header
+    // is needed yet
+    res = BlockFileIO::truncateBase(0, nullptr);
   } else {
     if (0 == fileIV) {
       // empty file.. create the header..
@@ -508,6 +752,9 @@ ssize_t CipherFileIO::read(const IORequest &origReq) const {
   if (!(fsConfig->reverseEncryption && haveHeader)) {
     VLOG(1) << "relaying request to base class: offset=" << origReq.offset
             << ", dataLen=" << origReq.dataLen;
+    if (fsConfig->reverseEncryption) {
+      return readAhead(origReq);
+    }
     return BlockFileIO::read(origReq);
   }
 
@@ -515,12 +762,22 @@ ssize_t CipherFileIO::read(const IORequest &origReq) const {
           << ", dataLen=" << origReq.dataLen;
 
   // generate the file IV header
-  // this is needed in any case - without IV the file cannot be decoded
-  unsigned char headerBuf[HEADER_SIZE];
-  int res = const_cast<CipherFileIO *>(this)->generateReverseHeader(headerBuf);
-  if (res < 0) {
-    return res;
+  // this is needed in any case - without IV the file cannot be decoded.
+  // It only depends on the inode and the external IV, so it is kept until
+  // the file is renamed.  Reads go to the descriptor opened for the old
+  // inode anyway.
+  {
+    boost::mutex::scoped_lock lock(headerMutex);
+    if (!haveReverseHeader) {
+      CipherFileIO *self = const_cast<CipherFileIO *>(this);
+      int res = self->generateReverseHeader(self->reverseHeader);
+      if (res < 0) {
+        return res;
+      }
+      self->haveReverseHeader = true;
+    }
   }
+  const unsigned char *headerBuf = reverseHeader;
 
   // Copy the request so we can modify it without affecting the caller
   IORequest req = origReq;
@@ -560,7 +817,7 @@ ssize_t CipherFileIO::read(const IORequest &origReq) const {
   }
 
   // read the payload
-  ssize_t readBytes = BlockFileIO::read(req);
+  ssize_t readBytes = readAhead(req);
   VLOG(1) << "read " << readBytes << " bytes from backing file";
   if (readBytes < 0) {
     return readBytes;  // Return error code
@@ -571,6 +828,91 @@ ssize_t CipherFileIO::read(const IORequest &origReq) const {
   return sum;
 }
 
+/**
+ * Reverse mode is mostly read by backup tools, file after file from start to
+ * end.  Their reads are encrypted block by block, and with the header in
+ * front, none of them starts at a block boundary.  A read which continues
+ * the previous one is served from a window of the following blocks instead,
+ * encrypted as one aligned run by BlockFileIO on the worker pool.  Other
+ * reads go to BlockFileIO as they are.
+ */
+ssize_t CipherFileIO::readAhead(const IORequest &req) const {
+  boost::mutex::scoped_lock lock(aheadMutex);
+
+  off_t end = req.offset + (off_t)req.dataLen;
+  bool inWindow =
+      req.offset >= aheadOffset && req.offset < aheadOffset + (off_t)aheadLen;
+  if (!inWindow && req.offset != aheadNext) {
+    aheadNext = end;
+    lock.unlock();
+    return BlockFileIO::read(req);
+  }
+  aheadNext = end;
+
+  size_t done = 0;
+  while (done < req.dataLen) {
+    off_t offset = req.offset + (off_t)done;
+    off_t windowEnd = aheadOffset + (off_t)aheadLen;
+    if (offset >= aheadOffset && offset < windowEnd) {
+      size_t len = std::min(req.dataLen - done, (size_t)(windowEnd - offset));
+      memcpy(req.data + done, aheadBuf.data + (offset - aheadOffset), len);
+      done += len;
+      continue;
+    }
+    if (offset == windowEnd && aheadLen > 0 &&
+        aheadLen < reverseReadAheadBytes) {
+      break;  // the window ended at the end of the file
+    }
+
+    if (aheadBuf.data == nullptr) {
+      aheadBuf = MemoryPool::allocate((int)reverseReadAheadBytes);
+    }
+    IORequest windowReq;
+    windowReq.offset = offset - offset % blockSize();
+    windowReq.data = aheadBuf.data;
+    windowReq.dataLen = reverseReadAheadBytes;
+    ssize_t readSize = BlockFileIO::read(windowReq);
+    if (readSize < 0) {
+      aheadLen = 0;
+      return done > 0 ? (ssize_t)done : readSize;
+    }
+    aheadOffset = windowReq.offset;
+    aheadLen = (size_t)readSize;
+    if (aheadOffset + (off_t)aheadLen <= offset) {
+      break;  // at or beyond the end of the file
+    }
+  }
+  return (ssize_t)done;
+}
+
+void CipherFileIO::forgetReadAhead() {
+  boost::mutex::scoped_lock lock(aheadMutex);
+  aheadLen = 0;
+}
+
+int CipherFileIO::setSparse() { return base->setSparse(); }
+
+bool CipherFileIO::findData(off_t offset, off_t &begin, off_t &end) const {
+  // holes of the encrypted file are only holes of ours when zero blocks are
+  // passed through
+  if (fsConfig->reverseEncryption || !_allowHoles) {
+    return false;
+  }
+  off_t headerSize = haveHeader ? HEADER_SIZE : 0;
+  if (!base->findData(offset + headerSize, begin, end)) {
+    return false;
+  }
+  begin = std::max(begin - headerSize, offset);
+  end = std::max(end - headerSize, begin);
+  return true;
+}
+
+int CipherFileIO::preallocate(off_t size) {
+  return base->preallocate(size + (haveHeader ? HEADER_SIZE : 0));
+}
+
+int CipherFileIO::sync(bool datasync) { return base->sync(datasync); }
+
 bool CipherFileIO::isWritable() const { return base->isWritable(); }
 
 }  // namespace encfs
@@ -26,11 +26,14 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <boost/thread/mutex.hpp>
+
 #include "BlockFileIO.h"
 #include "CipherKey.h"
 #include "FSConfig.h"
 #include "FileUtils.h"
 #include "Interface.h"
+#include "MemoryPool.h"
 
 namespace encfs {
 
@@ -58,8 +61,14 @@ class CipherFileIO : public BlockFileIO {
 
   virtual int getAttr(efs_stat *stbuf, void *statCache) const;
   virtual off_t getSize() const;
+  // the size seen through this layer of a backing file of rawSize bytes
+  off_t plainSize(off_t rawSize) const;
 
   virtual int truncate(off_t size);
+  virtual int setSparse();
+  virtual bool findData(off_t offset, off_t &begin, off_t &end) const;
+  virtual int preallocate(off_t size);
+  virtual int sync(bool datasync);
 
   virtual bool isWritable() const;
 
@@ -68,14 +77,32 @@ class CipherFileIO : public BlockFileIO {
   virtual ssize_t writeOneBlock(const IORequest &req);
   virtual int generateReverseHeader(unsigned char *data);
 
+  virtual bool canDecodeBlocks() const;
+  virtual ssize_t readRawBlocks(const IORequest &req) const;
+  virtual bool decodeBlock(unsigned char *data, int size, off_t blockNum) const;
+  virtual bool decodeBlocks(unsigned char *data, size_t len,
+                            off_t blockNum) const;
+  virtual bool prepareEncodeBlocks();
+  virtual bool encodeBlock(unsigned char *data, int size, off_t blockNum) const;
+  bool encodeBlockTo(const unsigned char *src, unsigned char *dst, int size,
+                     off_t blockNum) const;
+  virtual bool encodeBlocks(unsigned char *data, size_t len,
+                            off_t blockNum) const;
+  virtual ssize_t writeRawBlocks(const IORequest &req);
+
   int initHeader();
   bool writeHeader();
+  // a new file gets its header with the first data, an empty one has none
+  bool emptyWithoutHeader() const;
   bool blockRead(unsigned char *buf, int size, uint64_t iv64) const;
   bool streamRead(unsigned char *buf, int size, uint64_t iv64) const;
   bool blockWrite(unsigned char *buf, int size, uint64_t iv64) const;
   bool streamWrite(unsigned char *buf, int size, uint64_t iv64) const;
 
   ssize_t read(const IORequest &req) const;
+  // reverse mode: read() of the payload, through the read-ahead window
+  ssize_t readAhead(const IORequest &req) const;
+  void forgetReadAhead();
 
   std::shared_ptr<FileIO> base;
 
@@ -88,6 +115,23 @@ class CipherFileIO : public BlockFileIO {
   uint64_t fileIV;
   int lastFlags;
 
+  // reverse mode: the header returned by read(), generated by the first
+  // read after construction, rename or setIV()
+  bool haveReverseHeader;
+  unsigned char reverseHeader[8];
+
+  // serializes the header initialization of concurrent readers
+  mutable boost::mutex headerMutex;
+
+  // reverse mode: the encrypted blocks from the last sequential read on,
+  // coded ahead as one run on the worker pool.  Offsets are those of
+  // BlockFileIO, without the header.  Guarded by aheadMutex
+  mutable boost::mutex aheadMutex;
+  mutable MemBlock aheadBuf;
+  mutable off_t aheadOffset;
+  mutable size_t aheadLen;
+  mutable off_t aheadNext;  // where the next sequential read starts
+
   std::shared_ptr<Cipher> cipher;
   CipherKey key;
 };
@@ -0,0 +1,501 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "CompressedFileIO.h"
+
+#include "easylogging++.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <utility>
+
+#if defined(HAVE_LZ4)
+#include <lz4.h>
+#endif
+
+#include "fs_layer.h"
+
+#include "Error.h"
+#include "FileIO.h"
+#include "MemoryPool.h"
+#include "Mutex.h"
+#include "ZeroBlock.h"
+
+namespace encfs {
+
+static Interface LZ4_iface("compression/lz4", 1, 0, 0);
+
+// names encoded by the block and stream name codings never contain a '.'
+const char CompressedFileIO::indexSuffix[] = ".encfs6.cidx";
+
+// "EFSCIDX1" and the size of the file, then offset, space and 4 unused bytes
+// of the record of each block.  All numbers little endian.
+static const char indexMagic[8] = {'E', 'F', 'S', 'C', 'I', 'D', 'X', '1'};
+static const off_t indexHeaderSize = 16;
+static const off_t indexRecordSize = 16;
+
+// the record header holds the stored length, and rawFlag if the block is
+// stored uncompressed
+static const size_t recordHeaderSize = 4;
+static const uint32_t rawFlag = 0x80000000u;
+// the space of a record is rounded up, so that it can be rewritten in place
+// after a small change
+static const uint32_t recordGranularity = 256;
+
+static void putValue(unsigned char *out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    out[i] = (unsigned char)(value & 0xff);
+    value >>= 8;
+  }
+}
+
+static uint64_t getValue(const unsigned char *in, int bytes) {
+  uint64_t value = 0;
+  for (int i = bytes - 1; i >= 0; --i) {
+    value = (value << 8) | in[i];
+  }
+  return value;
+}
+
+#if defined(HAVE_LZ4)
+static int compressBound(int size) { return LZ4_compressBound(size); }
+
+// returns the compressed size, or 0 if it doesn't fit
+static int compressData(const unsigned char *src, int size, unsigned char *dst,
+                        int capacity) {
+  return LZ4_compress_default((const char *)src, (char *)dst, size, capacity);
+}
+
+// returns the decompressed size, or -1 if the data is damaged
+static int decompressData(const unsigned char *src, int size,
+                          unsigned char *dst, int capacity) {
+  int res = LZ4_decompress_safe((const char *)src, (char *)dst, size, capacity);
+  return res < 0 ? -1 : res;
+}
+#else
+// volumes with compression aren't opened without a codec (see isSupported)
+static int compressBound(int size) { return size; }
+
+static int compressData(const unsigned char *, int, unsigned char *, int) {
+  return 0;
+}
+
+static int decompressData(const unsigned char *, int, unsigned char *, int) {
+  return -1;
+}
+#endif
+
+CompressedFileIO::CompressedFileIO(std::shared_ptr<FileIO> _base,
+                                   std::shared_ptr<FileIO> _index,
+                                   const FSConfigPtr &cfg)
+    : BlockFileIO(cfg->config->compressBlockSize, cfg),
+      base(std::move(_base)),
+      index(std::move(_index)),
+      _loaded(false),
+      _size(0),
+      _dataEnd(0) {
+  rAssert(cfg->config->compressBlockSize > 0 &&
+          (uint32_t)cfg->config->compressBlockSize < rawFlag);
+}
+
+CompressedFileIO::~CompressedFileIO() = default;
+
+std::string CompressedFileIO::indexPath(const std::string &cipherPath) {
+  return cipherPath + indexSuffix;
+}
+
+bool CompressedFileIO::isIndexName(const char *name) {
+  size_t len = strlen(name);
+  size_t suffixLen = sizeof(indexSuffix) - 1;
+  return len > suffixLen && strcmp(name + len - suffixLen, indexSuffix) == 0;
+}
+
+Interface CompressedFileIO::CurrentInterface() {
+#if defined(HAVE_LZ4)
+  return LZ4_iface;
+#else
+  return Interface();
+#endif
+}
+
+bool CompressedFileIO::isSupported(const Interface &iface) {
+#if defined(HAVE_LZ4)
+  return LZ4_iface.implements(iface);
+#else
+  (void)iface;
+  return false;
+#endif
+}
+
+Interface CompressedFileIO::interface() const { return LZ4_iface; }
+
+void CompressedFileIO::setFileName(const char *fileName) {
+  base->setFileName(fileName);
+  index->setFileName(indexPath(fileName).c_str());
+}
+
+const char *CompressedFileIO::getFileName() const {
+  return base->getFileName();
+}
+
+bool CompressedFileIO::setIV(uint64_t iv) {
+  // the index is encrypted with the IV of the file
+  return base->setIV(iv) && index->setIV(iv);
+}
+
+/**
+ * Opens the index along with the file.  A file opened for writing gets an
+ * empty index if it has none yet, a file without one can only be empty.
+ */
+int CompressedFileIO::open(int flags) {
+  int res = base->open(flags);
+  if (res < 0) {
+    return res;
+  }
+
+  bool requestWrite = ((flags & O_RDWR) != 0) || ((flags & O_WRONLY) != 0);
+  std::string indexName = index->getFileName();
+  efs_stat st;
+  if (fs_layer::lstat(indexName.c_str(), &st) != 0) {
+    if (!requestWrite) {
+      return res;
+    }
+    efs_stat baseSt;
+    int mode = (base->getAttr(&baseSt, nullptr) == 0)
+                   ? (int)(baseSt.st_mode & 0777)
+                   : 0600;
+    int fd = fs_layer::open(indexName.c_str(), O_CREAT | O_EXCL | O_WRONLY,
+                            mode | 0600);
+    if (fd < 0) {
+      int eno = errno;
+      RLOG(WARNING) << "unable to create compression index " << indexName
+                    << ": " << strerror(eno);
+      return -eno;
+    }
+    fs_layer::close(fd);
+  }
+
+  int indexRes = index->open(flags);
+  return indexRes < 0 ? indexRes : res;
+}
+
+int CompressedFileIO::getAttr(efs_stat *stbuf, void *statCache) const {
+  int res = base->getAttr(stbuf, statCache);
+
+  if (res == 0 && S_ISREG(stbuf->st_mode)) {
+    Lock _lock(_mutex);
+    res = loadIndex();
+    if (res == 0) {
+      stbuf->st_size = _size;
+    }
+  }
+
+  return res;
+}
+
+off_t CompressedFileIO::getSize() const {
+  Lock _lock(_mutex);
+  int res = loadIndex();
+  return res < 0 ? res : _size;
+}
+
+/**
+ * Reads the whole index.  A missing or empty index belongs to a file which
+ * was never written.
+ */
+int CompressedFileIO::loadIndex() const {
+  if (_loaded) {
+    return 0;
+  }
+
+  efs_stat st;
+  off_t indexSize = 0;
+  if (index->getAttr(&st, nullptr) == 0) {
+    int res = index->open(O_RDONLY);
+    if (res < 0) {
+      return res;
+    }
+    indexSize = index->getSize();
+  }
+
+  if (indexSize == 0) {
+    if (base->getSize() > 0) {
+      RLOG(WARNING) << "missing compression index of " << getFileName();
+      return -EBADMSG;
+    }
+    _size = 0;
+    _dataEnd = 0;
+    _records.clear();
+    _loaded = true;
+    return 0;
+  }
+
+  if (indexSize < indexHeaderSize ||
+      (indexSize - indexHeaderSize) % indexRecordSize != 0) {
+    RLOG(WARNING) << "damaged compression index of " << getFileName();
+    return -EBADMSG;
+  }
+
+  std::vector<unsigned char> data((size_t)indexSize);
+  IORequest req;
+  req.offset = 0;
+  req.data = &data[0];
+  req.dataLen = data.size();
+  ssize_t readSize = index->read(req);
+  if (readSize < 0) {
+    return (int)readSize;
+  }
+  if (readSize != indexSize ||
+      memcmp(&data[0], indexMagic, sizeof(indexMagic)) != 0) {
+    RLOG(WARNING) << "damaged compression index of " << getFileName();
+    return -EBADMSG;
+  }
+
+  _size = (off_t)getValue(&data[8], 8);
+  _dataEnd = 0;
+  _records.resize((size_t)((indexSize - indexHeaderSize) / indexRecordSize));
+  for (size_t i = 0; i < _records.size(); ++i) {
+    const unsigned char *entry =
+        &data[(size_t)(indexHeaderSize + (off_t)i * indexRecordSize)];
+    _records[i].offset = getValue(entry, 8);
+    _records[i].capacity = (uint32_t)getValue(entry + 8, 4);
+    if (_records[i].capacity != 0) {
+      _dataEnd = std::max(
+          _dataEnd, (off_t)(_records[i].offset + _records[i].capacity));
+    }
+  }
+  _loaded = true;
+  return 0;
+}
+
+int CompressedFileIO::writeRecord(off_t blockNum) {
+  unsigned char entry[indexRecordSize];
+  memset(entry, 0, sizeof(entry));
+  putValue(entry, _records[(size_t)blockNum].offset, 8);
+  putValue(entry + 8, _records[(size_t)blockNum].capacity, 4);
+
+  IORequest req;
+  req.offset = indexHeaderSize + blockNum * indexRecordSize;
+  req.data = entry;
+  req.dataLen = sizeof(entry);
+  ssize_t res = index->write(req);
+  return res < 0 ? (int)res : 0;
+}
+
+int CompressedFileIO::writeSize() {
+  unsigned char header[indexHeaderSize];
+  memcpy(header, indexMagic, sizeof(indexMagic));
+  putValue(header + 8, (uint64_t)_size, 8);
+
+  IORequest req;
+  req.offset = 0;
+  req.data = header;
+  req.dataLen = sizeof(header);
+  ssize_t res = index->write(req);
+  return res < 0 ? (int)res : 0;
+}
+
+ssize_t CompressedFileIO::readOneBlock(const IORequest &req) const {
+  off_t blockNum = req.offset / _blockSize;
+  Record record = Record();
+  ssize_t len;
+  {
+    Lock _lock(_mutex);
+    int res = loadIndex();
+    if (res < 0) {
+      return res;
+    }
+    if (req.offset >= _size) {
+      return 0;
+    }
+    len = (ssize_t)std::min((off_t)req.dataLen, _size - req.offset);
+    if (blockNum < (off_t)_records.size()) {
+      record = _records[(size_t)blockNum];
+    }
+  }
+
+  if (record.capacity == 0) {
+    // never written
+    memset(req.data, 0, len);
+    return len;
+  }
+
+  MemBlock mb = MemoryPool::allocate(record.capacity);
+  IORequest tmp;
+  tmp.offset = (off_t)record.offset;
+  tmp.data = mb.data;
+  tmp.dataLen = record.capacity;
+  ssize_t readSize = base->read(tmp);
+
+  ssize_t res = readSize < 0 ? readSize : -EBADMSG;
+  if (readSize >= (ssize_t)recordHeaderSize) {
+    uint32_t header = (uint32_t)getValue(mb.data, 4);
+    ssize_t stored = header & ~rawFlag;
+    const unsigned char *src = mb.data + recordHeaderSize;
+    ssize_t got = -1;
+    if (stored + (ssize_t)recordHeaderSize <= readSize) {
+      if ((header & rawFlag) != 0) {
+        got = std::min(stored, len);
+        memcpy(req.data, src, got);
+      } else {
+        got = decompressData(src, (int)stored, req.data, (int)req.dataLen);
+      }
+    }
+    if (got >= 0) {
+      // a block extended by a truncate without being written again
+      if (got < len) {
+        memset(req.data + got, 0, len - got);
+      }
+      res = len;
+    }
+  }
+  MemoryPool::release(mb);
+
+  if (res == -EBADMSG) {
+    RLOG(WARNING) << "damaged compressed block " << blockNum << " in "
+                  << getFileName();
+  }
+  return res;
+}
+
+ssize_t CompressedFileIO::writeOneBlock(const IORequest &req) {
+  off_t blockNum = req.offset / _blockSize;
+  int len = (int)req.dataLen;
+
+  Lock _lock(_mutex);
+  int res = loadIndex();
+  if (res < 0) {
+    return res;
+  }
+
+  Record record = Record();
+  if (blockNum < (off_t)_records.size()) {
+    record = _records[(size_t)blockNum];
+  }
+
+  // padding with zeros leaves the blocks without a record
+  if (record.capacity != 0 || !isAllZero(req.data, req.dataLen)) {
+    int bound = std::max(len, compressBound(len));
+    MemBlock mb = MemoryPool::allocate(recordHeaderSize + bound);
+    unsigned char *dst = mb.data + recordHeaderSize;
+    int stored = compressData(req.data, len, dst, bound);
+    uint32_t header = (uint32_t)stored;
+    if (stored <= 0 || stored >= len) {
+      memcpy(dst, req.data, len);
+      stored = len;
+      header = (uint32_t)len | rawFlag;
+    }
+    putValue(mb.data, header, 4);
+    uint32_t recordLen = (uint32_t)(recordHeaderSize + stored);
+
+    // in place if it fits, see the class comment for what a crash leaves
+    bool moved = record.capacity < recordLen;
+    if (moved) {
+      record.offset = (uint64_t)_dataEnd;
+      record.capacity = ((recordLen + recordGranularity - 1) /
+                         recordGranularity) * recordGranularity;
+    }
+
+    IORequest tmp;
+    tmp.offset = (off_t)record.offset;
+    tmp.data = mb.data;
+    tmp.dataLen = recordLen;
+    ssize_t written = base->write(tmp);
+    MemoryPool::release(mb);
+    if (written < 0) {
+      return written;
+    }
+
+    if (moved) {
+      // the old record stays readable until the index points to the new one
+      if (blockNum >= (off_t)_records.size()) {
+        _records.resize((size_t)blockNum + 1, Record());
+      }
+      _records[(size_t)blockNum] = record;
+      _dataEnd = (off_t)(record.offset + record.capacity);
+      res = writeRecord(blockNum);
+      if (res < 0) {
+        return res;
+      }
+    }
+  }
+
+  if (req.offset + len > _size) {
+    _size = req.offset + len;
+    res = writeSize();
+    if (res < 0) {
+      return res;
+    }
+  }
+  return req.dataLen;
+}
+
+int CompressedFileIO::truncate(off_t size) {
+  {
+    Lock _lock(_mutex);
+    int res = loadIndex();
+    if (res < 0) {
+      return res;
+    }
+  }
+
+  int res = BlockFileIO::truncateBase(size, nullptr);
+  if (res < 0) {
+    return res;
+  }
+
+  Lock _lock(_mutex);
+  off_t blockCount = (size + _blockSize - 1) / _blockSize;
+  if ((off_t)_records.size() > blockCount) {
+    // the records beyond the end go, the space of the others is kept
+    _records.resize((size_t)blockCount);
+    _dataEnd = 0;
+    for (const Record &record : _records) {
+      if (record.capacity != 0) {
+        _dataEnd = std::max(_dataEnd, (off_t)(record.offset + record.capacity));
+      }
+    }
+    res = index->truncate(indexHeaderSize + blockCount * indexRecordSize);
+    if (res == 0 && base->getSize() > _dataEnd) {
+      res = base->truncate(_dataEnd);
+    }
+  }
+  if (res == 0 && _size != size) {
+    _size = size;
+    res = writeSize();
+  }
+  return res;
+}
+
+int CompressedFileIO::sync(bool datasync) {
+  int res = base->sync(datasync);
+  if (res == 0) {
+    res = index->sync(datasync);
+  }
+  return res;
+}
+
+bool CompressedFileIO::isWritable() const { return base->isWritable(); }
+
+}  // namespace encfs
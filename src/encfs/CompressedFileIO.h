@@ -0,0 +1,126 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CompressedFileIO_incl_
+#define _CompressedFileIO_incl_
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+#include "BlockFileIO.h"
+#include "FSConfig.h"
+#include "Interface.h"
+
+namespace encfs {
+
+class FileIO;
+struct IORequest;
+
+/*
+    Compresses the data of a file block by block, before it is encrypted.
+
+    Our blocks are compressed one by one and stored as records in the data
+    of the layer below (CipherFileIO, or MACFileIO), each with a 4 byte
+    header holding its length.  A block which doesn't get smaller is stored
+    as it is.  Where the record of each block lies is kept in an index, the
+    file of the cipher name with indexSuffix appended, encrypted by its own
+    CipherFileIO.  It holds the size of the file and the offset and space of
+    the record of every block, so that a random read takes one lookup in
+    the index, which is loaded once, and one read of the record.
+
+    A record is rewritten in place if it still fits the space of the old
+    one, otherwise it goes to the end of the data.  The space of the old
+    record is only given back when the file is truncated.  Blocks which were
+    never written have no record and read as zeros.
+
+    Like a block of an uncompressed file, a record rewritten in place is
+    not crash-safe: a write cut off by a crash leaves the block unreadable.
+    Only a record which moves keeps its old version until the index points
+    to the new one.
+*/
+class CompressedFileIO : public BlockFileIO {
+ public:
+  // base holds the records, index the offsets of the records
+  CompressedFileIO(std::shared_ptr<FileIO> base, std::shared_ptr<FileIO> index,
+                   const FSConfigPtr &cfg);
+  virtual ~CompressedFileIO();
+
+  static const char indexSuffix[];
+
+  static std::string indexPath(const std::string &cipherPath);
+  static bool isIndexName(const char *name);
+
+  // the codec of a new volume, or an empty interface if this build has none
+  static Interface CurrentInterface();
+  // if this build can read and write volumes compressed with iface
+  static bool isSupported(const Interface &iface);
+
+  virtual Interface interface() const;
+
+  virtual void setFileName(const char *fileName);
+  virtual const char *getFileName() const;
+  virtual bool setIV(uint64_t iv);
+
+  virtual int open(int flags);
+  virtual int getAttr(efs_stat *stbuf, void *statCache) const;
+  virtual off_t getSize() const;
+
+  virtual int truncate(off_t size);
+  virtual int sync(bool datasync);
+
+  virtual bool isWritable() const;
+
+ private:
+  CompressedFileIO(const CompressedFileIO &src);             // not allowed
+  CompressedFileIO &operator=(const CompressedFileIO &src);  // not allowed
+
+  virtual ssize_t readOneBlock(const IORequest &req) const;
+  virtual ssize_t writeOneBlock(const IORequest &req);
+
+  struct Record {
+    uint64_t offset;    // in the data of base
+    uint32_t capacity;  // space of the record, 0 if the block has none
+  };
+
+  // reads the index on first use, with _mutex held
+  int loadIndex() const;
+  int writeRecord(off_t blockNum);
+  int writeSize();
+
+  std::shared_ptr<FileIO> base;
+  std::shared_ptr<FileIO> index;
+
+  // the index, as far as loaded.  Reads may run concurrently and share it,
+  // writes exclude them (see FileNode).
+  mutable boost::mutex _mutex;
+  mutable bool _loaded;
+  mutable off_t _size;     // of the uncompressed file
+  mutable off_t _dataEnd;  // end of the last record in base
+  mutable std::vector<Record> _records;
+};
+
+}  // namespace encfs
+
+#endif
@@ -35,11 +35,33 @@ EncFS_Context::EncFS_Context() :
   idleCount = -1;
   isUnmounting = false;
   currentFuseFh = 1;
+  fuseFhSlotCount = 0;
+  for (uint32_t i = 0; i < fuseFhMaxChunks; i++) {
+    fuseFhChunks[i] = nullptr;
+  }
 }
 
 EncFS_Context::~EncFS_Context() {
   // release all entries from map
-  openFiles.clear();
+  for (int i = 0; i < nodeShardCount; i++) {
+    nodeShards[i].openFiles.clear();
+  }
+  for (uint32_t i = 0; i < fuseFhMaxChunks; i++) {
+    delete[] fuseFhChunks[i].load();
+  }
+}
+
+int EncFS_Context::shardIndex(const InternedPath &path) const {
+  return static_cast<int>(path.hash() % nodeShardCount);
+}
+
+size_t EncFS_Context::openFileCount() {
+  size_t count = 0;
+  for (int i = 0; i < nodeShardCount; i++) {
+    Lock lock(nodeShards[i].mutex);
+    count += nodeShards[i].openFiles.size();
+  }
+  return count;
 }
 
 std::shared_ptr<DirNode> EncFS_Context::getRoot(int *errCode) {
@@ -107,9 +129,10 @@ bool EncFS_Context::usageAndUnmount(int timeoutCycles) {
       return false;
     }
 
-    if (!openFiles.empty()) {
+    size_t openCount = openFileCount();
+    if (openCount != 0) {
       if (idleCount % timeoutCycles == 0) {
-        RLOG(WARNING) << "Filesystem inactive, but " << openFiles.size()
+        RLOG(WARNING) << "Filesystem inactive, but " << openCount
                       << " files opened: " << this->opts->unmountPoint;
       }
       return false;
@@ -125,25 +148,61 @@ bool EncFS_Context::usageAndUnmount(int timeoutCycles) {
 }
 
 std::shared_ptr<FileNode> EncFS_Context::lookupNode(const char *path) {
-  Lock lock(contextMutex);
+  InternedPath key(path);
+  NodeShard &shard = nodeShards[shardIndex(key)];
+  Lock lock(shard.mutex);
 
-  auto it = openFiles.find(std::string(path));
-  if (it != openFiles.end()) {
+  auto it = shard.openFiles.find(key);
+  if (it != shard.openFiles.end()) {
     // every entry in the list is fine... so just use the
-    // first
-    return it->second.front();
+    // last one added
+    return it->second.back();
   }
   return std::shared_ptr<FileNode>();
 }
 
+bool EncFS_Context::hasNodeBelow(const char *dirPath) {
+  std::string prefix(dirPath);
+  if (prefix.empty() || prefix[prefix.size() - 1] != '/') {
+    prefix.push_back('/');
+  }
+  for (int i = 0; i < nodeShardCount; i++) {
+    Lock lock(nodeShards[i].mutex);
+    for (const auto &entry : nodeShards[i].openFiles) {
+      const std::string &path = entry.first.str();
+      if (!entry.second.empty() &&
+          path.compare(0, prefix.size(), prefix) == 0) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 void EncFS_Context::renameNode(const char *from, const char *to) {
-  Lock lock(contextMutex);
+  InternedPath fromKey(from);
+  InternedPath toKey(to);
+  int fromIndex = shardIndex(fromKey);
+  int toIndex = shardIndex(toKey);
 
-  auto it = openFiles.find(std::string(from));
-  if (it != openFiles.end()) {
-    auto val = it->second;
-    openFiles.erase(it);
-    openFiles[std::string(to)] = val;
+  // lock only the shards involved, in index order
+  boost::unique_lock<boost::mutex> firstLock(
+      nodeShards[std::min(fromIndex, toIndex)].mutex);
+  boost::unique_lock<boost::mutex> secondLock;
+  if (fromIndex != toIndex) {
+    secondLock = boost::unique_lock<boost::mutex>(
+        nodeShards[std::max(fromIndex, toIndex)].mutex);
+  }
+
+  FileMap &fromFiles = nodeShards[fromIndex].openFiles;
+  auto it = fromFiles.find(fromKey);
+  if (it != fromFiles.end()) {
+    NodeList val = std::move(it->second);
+    fromFiles.erase(it);
+    // nodes of a replaced file stay until they are erased, the renamed
+    // ones are added last so that lookupNode() returns them
+    NodeList &toList = nodeShards[toIndex].openFiles[toKey];
+    toList.insert(toList.end(), val.begin(), val.end());
   }
 }
 
@@ -151,30 +210,37 @@ void EncFS_Context::renameNode(const char *from, const char *to) {
 // increments the reference count if the key already exists.
 void EncFS_Context::putNode(const char *path,
                             const std::shared_ptr<FileNode> &node) {
-  Lock lock(contextMutex);
-  auto &list = openFiles[std::string(path)];
+  InternedPath key(path);
+  NodeShard &shard = nodeShards[shardIndex(key)];
+  Lock lock(shard.mutex);
+  auto &list = shard.openFiles[key];
+  // A node gets a slot in the handle table when it is registered first.
+  if (std::find(list.begin(), list.end(), node) == list.end()) {
+    node->fuseFh = allocFuseFh(node);
+  }
   // The length of "list" serves as the reference count.
-  list.push_front(node);
-  fuseFhMap[node->fuseFh] = node;
+  list.push_back(node);
 }
 
 // eraseNode is called by encfs_release in response to the RELEASE
 // FUSE-command we get from the kernel.
 void EncFS_Context::eraseNode(const char *path,
                               const std::shared_ptr<FileNode> &fnode) {
-  Lock lock(contextMutex);
+  InternedPath key(path);
+  NodeShard &shard = nodeShards[shardIndex(key)];
+  Lock lock(shard.mutex);
 
-  auto it = openFiles.find(std::string(path));
+  auto it = shard.openFiles.find(key);
 #ifdef __CYGWIN__
   // When renaming a file, Windows first opens it, renames it and then closes it
   // Filenode may have then been renamed too
-  if (it == openFiles.end()) {
+  if (it == shard.openFiles.end()) {
     RLOG(WARNING) << "Filenode to erase not found, file has certainly be renamed: "
                   << path;
     return;
   }
 #endif
-  rAssert(it != openFiles.end());
+  rAssert(it != shard.openFiles.end());
   auto &list = it->second;
 
   // Find "fnode" in the list of FileNodes registered under this path.
@@ -182,36 +248,91 @@ void EncFS_Context::eraseNode(const char *path,
   rAssert(findIter != list.end());
   list.erase(findIter);
 
-  // If no reference to "fnode" remains, drop the entry from fuseFhMap
+  // If no reference to "fnode" remains, free its slot in the handle table
   // and overwrite the canary.
   findIter = std::find(list.begin(), list.end(), fnode);
   if (findIter == list.end()) {
-    fuseFhMap.erase(fnode->fuseFh);
+    freeFuseFh(fnode->fuseFh);
     fnode->canary = CANARY_RELEASED;
   }
 
   // If no FileNode is registered at this path anymore, drop the entry
   // from openFiles.
   if (list.empty()) {
-    openFiles.erase(it);
+    shard.openFiles.erase(it);
   }
 }
 
-// nextFuseFh returns the next unused uint64 to serve as the FUSE file
-// handle for the kernel.
+// Handles of nodes which are not registered have the top bit set, slot
+// generations stay below it.
+static const uint64_t unregisteredFuseFh = 1ULL << 63;
+static const uint32_t fuseFhGenerationMask = 0x7fffffff;
+
+// nextFuseFh returns the next unused uint64 to serve as the handle of a new
+// FileNode.  putNode() replaces it by the handle of a slot.
 uint64_t EncFS_Context::nextFuseFh() {
   // This is thread-safe because currentFuseFh is declared as std::atomic
-  return currentFuseFh++;
+  return unregisteredFuseFh | currentFuseFh++;
+}
+
+uint64_t EncFS_Context::allocFuseFh(const std::shared_ptr<FileNode> &node) {
+  Lock lock(fuseFhMutex);
+  uint32_t index;
+  if (!freeFuseFhSlots.empty()) {
+    index = freeFuseFhSlots.back();
+    freeFuseFhSlots.pop_back();
+  } else {
+    index = fuseFhSlotCount;
+    uint32_t chunk = index / fuseFhChunkSize;
+    rAssert(chunk < fuseFhMaxChunks);
+    if (fuseFhChunks[chunk].load() == nullptr) {
+      fuseFhChunks[chunk].store(new FuseFhSlot[fuseFhChunkSize]);
+    }
+    ++fuseFhSlotCount;
+  }
+
+  FuseFhSlot &slot = fuseFhChunks[index / fuseFhChunkSize]
+                         .load()[index % fuseFhChunkSize];
+  std::atomic_store(&slot.node, node);
+  return (static_cast<uint64_t>(slot.generation.load()) << 32) | index;
+}
+
+void EncFS_Context::freeFuseFh(uint64_t fh) {
+  uint32_t index = static_cast<uint32_t>(fh);
+  Lock lock(fuseFhMutex);
+  FuseFhSlot &slot = fuseFhChunks[index / fuseFhChunkSize]
+                         .load()[index % fuseFhChunkSize];
+  std::atomic_store(&slot.node, std::shared_ptr<FileNode>());
+  uint32_t generation = (slot.generation.load() + 1) & fuseFhGenerationMask;
+  slot.generation.store(generation == 0 ? 1 : generation);
+  freeFuseFhSlots.push_back(index);
 }
 
-// lookupFuseFh finds "n" in "fuseFhMap" and returns the FileNode.
+// lookupFuseFh returns the FileNode of handle "n", or nullptr if "n" is
+// stale or was never registered.  It doesn't take a lock.
 std::shared_ptr<FileNode> EncFS_Context::lookupFuseFh(uint64_t n) {
-  Lock lock(contextMutex);
-  auto it = fuseFhMap.find(n);
-  if (it == fuseFhMap.end()) {
+  if ((n & unregisteredFuseFh) != 0) {
+    return nullptr;
+  }
+  uint32_t index = static_cast<uint32_t>(n);
+  uint32_t generation = static_cast<uint32_t>(n >> 32);
+  if (index / fuseFhChunkSize >= fuseFhMaxChunks) {
+    return nullptr;
+  }
+  FuseFhSlot *chunk = fuseFhChunks[index / fuseFhChunkSize].load();
+  if (chunk == nullptr) {
+    return nullptr;
+  }
+  FuseFhSlot &slot = chunk[index % fuseFhChunkSize];
+  if (slot.generation.load() != generation) {
+    return nullptr;
+  }
+  std::shared_ptr<FileNode> node = std::atomic_load(&slot.node);
+  // the slot may have been freed and reused while we loaded the node
+  if (slot.generation.load() != generation) {
     return nullptr;
   }
-  return it->second;
+  return node;
 }
 
 }  // namespace encfs
@@ -23,13 +23,15 @@
 
 #include <algorithm>
 #include <atomic>
-#include <list>
 #include <memory>
+#include <boost/container/small_vector.hpp>
 #include <boost/thread.hpp>
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include "InternedPath.h"
 #include "encfs.h"
 
 namespace encfs {
@@ -46,6 +48,9 @@ class EncFS_Context {
 
   std::shared_ptr<FileNode> lookupNode(const char *path);
 
+  // if a node of a file in the folder dirPath, or further below, is open
+  bool hasNodeBelow(const char *dirPath);
+
   bool usageAndUnmount(int timeoutCycles);
 
   void putNode(const char *path, const std::shared_ptr<FileNode> &node);
@@ -83,21 +88,55 @@ class EncFS_Context {
    * store a unique Placeholder for each open() until the corresponding
    * release() is called.  std::shared_ptr then does our reference counting for
    * us.
+   *
+   * Almost every path has a single Placeholder, so they are kept in a small
+   * inline vector.
    */
 
-  using FileMap =
-      std::unordered_map<std::string, std::list<std::shared_ptr<FileNode>>>;
+  using NodeList = boost::container::small_vector<std::shared_ptr<FileNode>, 1>;
+  using FileMap = std::unordered_map<InternedPath, NodeList, InternedPathHash>;
+
+  // the open files are distributed over several shards by the hash of
+  // their path, each with its own lock
+  struct NodeShard {
+    boost::mutex mutex;
+    FileMap openFiles;
+  };
+  static const int nodeShardCount = 16;
+  NodeShard nodeShards[nodeShardCount];
+  int shardIndex(const InternedPath &path) const;
+  size_t openFileCount();
 
   mutable boost::mutex contextMutex;
-  FileMap openFiles;
 
   int usageCount;
   int idleCount;
   bool isUnmounting;
   std::shared_ptr<DirNode> root;
 
+  // A registered node's fuse handle is the index of its slot in the handle
+  // table, with the generation of the slot in the upper 32 bits.  The
+  // generation is bumped whenever a slot is freed, so stale handles don't
+  // find the node which reuses the slot.  The table grows by chunks which
+  // are never moved, lookupFuseFh() reads it without taking a lock.
+  struct FuseFhSlot {
+    std::atomic<uint32_t> generation;
+    std::shared_ptr<FileNode> node;  // accessed with std::atomic_load/store
+
+    FuseFhSlot() : generation(1) {}
+  };
+  static const uint32_t fuseFhChunkSize = 1024;
+  static const uint32_t fuseFhMaxChunks = 4096;
+  std::atomic<FuseFhSlot *> fuseFhChunks[fuseFhMaxChunks];
+  uint64_t allocFuseFh(const std::shared_ptr<FileNode> &node);
+  void freeFuseFh(uint64_t fh);
+
   std::atomic<std::uint64_t> currentFuseFh;
-  std::unordered_map<uint64_t, std::shared_ptr<FileNode>> fuseFhMap;
+  // taken after the lock of a shard, guards allocation and freeing of
+  // the slots
+  boost::mutex fuseFhMutex;
+  std::vector<uint32_t> freeFuseFhSlots;
+  uint32_t fuseFhSlotCount;
 };
 
 int remountFS(EncFS_Context *ctx);
@@ -0,0 +1,189 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DescriptorPool.h"
+
+#include "fs_layer.h"
+
+namespace encfs {
+
+static boost::posix_time::ptime now() {
+  return boost::posix_time::microsec_clock::universal_time();
+}
+
+DescriptorPool::DescriptorPool(size_t maxEntries, int maxIdle)
+    : _maxEntries(maxEntries),
+      _maxIdle(boost::posix_time::milliseconds(maxIdle)),
+      _stopping(false),
+      _hits(0),
+      _misses(0) {
+  _worker = boost::thread([this]() { workerLoop(); });
+}
+
+DescriptorPool::~DescriptorPool() {
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    _stopping = true;
+  }
+  _cond.notify_all();
+  _worker.join();
+
+  EntryList::iterator it;
+  for (it = _entries.begin(); it != _entries.end(); ++it) {
+    fs_layer::close(it->fd);
+  }
+}
+
+int DescriptorPool::take(const std::string &path, bool writable) {
+  int fd = -1;
+  std::vector<int> toClose;
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    EntryList::iterator it = _entries.begin();
+    while (it != _entries.end()) {
+      if (it->path != path) {
+        ++it;
+      } else {
+        if (fd < 0 && it->writable == writable) {
+          fd = it->fd;
+        } else {
+          toClose.push_back(it->fd);
+        }
+        it = _entries.erase(it);
+      }
+    }
+  }
+  closeAll(toClose);
+
+  if (fd >= 0) {
+    ++_hits;
+  } else {
+    ++_misses;
+  }
+  return fd;
+}
+
+void DescriptorPool::give(const std::string &path, bool writable, int fd) {
+  std::vector<int> toClose;
+  bool wasEmpty;
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    wasEmpty = _entries.empty();
+
+    Entry entry;
+    entry.path = path;
+    entry.writable = writable;
+    entry.fd = fd;
+    entry.pooled = now();
+    _entries.push_front(entry);
+
+    while (_entries.size() > _maxEntries) {
+      toClose.push_back(_entries.back().fd);
+      _entries.pop_back();
+    }
+  }
+  closeAll(toClose);
+
+  // the worker sleeps until the first entry arrives
+  if (wasEmpty) {
+    _cond.notify_one();
+  }
+}
+
+void DescriptorPool::forget(const std::string &path) {
+  std::vector<int> toClose;
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    EntryList::iterator it = _entries.begin();
+    while (it != _entries.end()) {
+      if (it->path == path) {
+        toClose.push_back(it->fd);
+        it = _entries.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  closeAll(toClose);
+}
+
+void DescriptorPool::forgetTree(const std::string &dirPath) {
+  std::vector<int> toClose;
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    EntryList::iterator it = _entries.begin();
+    while (it != _entries.end()) {
+      const std::string &path = it->path;
+      if (path.size() > dirPath.size() &&
+          path.compare(0, dirPath.size(), dirPath) == 0 &&
+          (path[dirPath.size()] == '/' || path[dirPath.size()] == '\\')) {
+        toClose.push_back(it->fd);
+        it = _entries.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  closeAll(toClose);
+}
+
+// Remove the entries which are idle for too long.  Must be called with
+// _mutex locked, the descriptors are closed by the caller afterwards.
+void DescriptorPool::expire(std::vector<int> &toClose) {
+  boost::posix_time::ptime limit = now() - _maxIdle;
+  while (!_entries.empty() && _entries.back().pooled <= limit) {
+    toClose.push_back(_entries.back().fd);
+    _entries.pop_back();
+  }
+}
+
+// closing can take a while on Windows, so it is done without the lock
+void DescriptorPool::closeAll(const std::vector<int> &toClose) {
+  std::vector<int>::const_iterator it;
+  for (it = toClose.begin(); it != toClose.end(); ++it) {
+    fs_layer::close(*it);
+  }
+}
+
+void DescriptorPool::workerLoop() {
+  boost::mutex::scoped_lock lock(_mutex);
+  while (!_stopping) {
+    if (_entries.empty()) {
+      _cond.wait(lock);
+      continue;
+    }
+
+    // sleep until the oldest entry expires
+    boost::posix_time::time_duration wait =
+        _entries.back().pooled + _maxIdle - now();
+    if (wait > boost::posix_time::time_duration(0, 0, 0, 0)) {
+      _cond.timed_wait(lock, wait);
+      continue;
+    }
+
+    std::vector<int> toClose;
+    expire(toClose);
+    lock.unlock();
+    closeAll(toClose);
+    lock.lock();
+  }
+}
+
+}  // namespace encfs
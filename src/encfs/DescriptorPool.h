@@ -0,0 +1,104 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DescriptorPool_incl_
+#define _DescriptorPool_incl_
+
+#include <atomic>
+#include <list>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread.hpp>
+
+namespace encfs {
+
+/*
+    Pool of open backing file descriptors, shared by all files of a
+    filesystem.
+
+    A RawFileIO hands its descriptor to the pool when it goes away, and the
+    next RawFileIO opening the same file with the same access mode takes it
+    instead of opening the file again.  At most maxEntries descriptors are
+    kept; the least recently pooled one is closed first.  A background thread
+    closes descriptors which were not taken again within maxIdle
+    milliseconds, because on Windows they keep other processes from opening
+    the backing files.
+
+    Like BlockCache, the pool assumes that the backing files are only changed
+    through this filesystem.  DirNode calls forget() / forgetTree() before it
+    renames or deletes backing files.
+*/
+class DescriptorPool {
+ public:
+  DescriptorPool(size_t maxEntries, int maxIdle);
+  ~DescriptorPool();
+
+  // returns a pooled descriptor of path, which is owned by the caller then,
+  // or -1.  Pooled descriptors of path with the other access mode are
+  // closed, Windows wouldn't allow opening the file with it.
+  int take(const std::string &path, bool writable);
+  // hand over the descriptor of path, it is owned by the pool then
+  void give(const std::string &path, bool writable, int fd);
+
+  void forget(const std::string &path);
+  // forget all files below directory dirPath, before a rename
+  void forgetTree(const std::string &dirPath);
+
+  uint64_t hits() const { return _hits; }
+  uint64_t misses() const { return _misses; }
+
+ private:
+  DescriptorPool(const DescriptorPool &src);             // not allowed
+  DescriptorPool &operator=(const DescriptorPool &src);  // not allowed
+
+  struct Entry {
+    std::string path;
+    bool writable;
+    int fd;
+    boost::posix_time::ptime pooled;
+  };
+
+  // most recently pooled first.  The pool is small, so searching it is
+  // much cheaper than the open it saves.
+  typedef std::list<Entry> EntryList;
+
+  void expire(std::vector<int> &toClose);
+  void closeAll(const std::vector<int> &toClose);
+  void workerLoop();
+
+  size_t _maxEntries;
+  boost::posix_time::time_duration _maxIdle;
+  EntryList _entries;
+  bool _stopping;
+
+  std::atomic<uint64_t> _hits;
+  std::atomic<uint64_t> _misses;
+
+  boost::mutex _mutex;
+  boost::condition_variable _cond;
+  boost::thread _worker;
+};
+
+}  // namespace encfs
+
+#endif
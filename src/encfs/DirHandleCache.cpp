@@ -0,0 +1,122 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "DirHandleCache.h"
+
+#include <vector>
+
+namespace encfs {
+
+DirHandleCache::DirHandleCache(size_t maxEntries)
+    : _maxEntries(maxEntries), _generation(0), _hits(0), _misses(0) {}
+
+DirHandleCache::~DirHandleCache() = default;
+
+int DirHandleCache::open(const std::string &path, int flags, int mode) {
+  std::string name;
+  HandlePtr handle = parentHandle(path, name);
+  if (!handle) {
+    return fs_layer::open(path.c_str(), flags, mode);
+  }
+  return fs_layer::open_at(handle->dir, name.c_str(), flags, mode);
+}
+
+int DirHandleCache::stat(const std::string &path, efs_stat *buffer) {
+  std::string name;
+  HandlePtr handle = parentHandle(path, name);
+  if (!handle) {
+    return fs_layer::stat(path.c_str(), buffer);
+  }
+  return fs_layer::stat_at(handle->dir, name.c_str(), buffer);
+}
+
+void DirHandleCache::forgetTree(const std::string &dirPath) {
+  // the handles are closed after the lock is released
+  std::vector<HandlePtr> toClose;
+  boost::mutex::scoped_lock lock(_mutex);
+  ++_generation;
+  EntryList::iterator it = _entries.begin();
+  while (it != _entries.end()) {
+    const std::string &path = it->path;
+    if (path.compare(0, dirPath.size(), dirPath) == 0 &&
+        (path.size() == dirPath.size() || path[dirPath.size()] == '/' ||
+         path[dirPath.size()] == '\\')) {
+      toClose.push_back(it->handle);
+      _index.erase(path);
+      it = _entries.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+DirHandleCache::HandlePtr DirHandleCache::parentHandle(const std::string &path,
+                                                       std::string &name) {
+  size_t pos = path.find_last_of("/\\");
+  if (pos == std::string::npos || pos == 0 || pos + 1 >= path.size()) {
+    return HandlePtr();
+  }
+  std::string dirPath = path.substr(0, pos);
+  name = path.substr(pos + 1);
+
+  uint64_t generation;
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    std::unordered_map<std::string, EntryList::iterator>::iterator it =
+        _index.find(dirPath);
+    if (it != _index.end()) {
+      _entries.splice(_entries.begin(), _entries, it->second);
+      ++_hits;
+      return it->second->handle;
+    }
+    generation = _generation;
+  }
+
+  ++_misses;
+  fs_layer::dir_handle dir;
+  if (!fs_layer::open_dir_handle(dirPath.c_str(), dir)) {
+    return HandlePtr();
+  }
+  HandlePtr handle = std::make_shared<Handle>(dir);
+
+  HandlePtr evicted;
+  boost::mutex::scoped_lock lock(_mutex);
+  std::unordered_map<std::string, EntryList::iterator>::iterator it =
+      _index.find(dirPath);
+  if (it != _index.end() || generation != _generation) {
+    // opened by another thread meanwhile, or the folder may have been
+    // renamed since we opened it.  Ours is closed when we're done.
+    return handle;
+  }
+  Entry entry;
+  entry.path = dirPath;
+  entry.handle = handle;
+  _entries.push_front(entry);
+  _index[dirPath] = _entries.begin();
+  if (_entries.size() > _maxEntries) {
+    evicted = _entries.back().handle;
+    _index.erase(_entries.back().path);
+    _entries.pop_back();
+  }
+  return handle;
+}
+
+}  // namespace encfs
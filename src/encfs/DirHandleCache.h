@@ -0,0 +1,105 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _DirHandleCache_incl_
+#define _DirHandleCache_incl_
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+#include <boost/thread/mutex.hpp>
+
+#include "fs_layer.h"
+
+namespace encfs {
+
+/*
+    Open handles of recently used backing folders, shared by all files of a
+    filesystem.
+
+    Opening or stat'ing a backing file by its full path makes the system
+    walk the whole path again, which is slow for deep paths on network
+    shares.  With a handle of the parent folder, only the last component is
+    resolved (openat / fstatat, NtCreateFile with a root directory).  At most
+    maxEntries handles are kept; the least recently used one is closed first.
+
+    A handle follows its folder when the folder is renamed, and on Windows
+    it keeps a deleted folder around until it is closed.  DirNode calls
+    forgetTree() before it renames folders, and so must everyone removing
+    or renaming backing folders.
+*/
+class DirHandleCache {
+ public:
+  DirHandleCache(size_t maxEntries);
+  ~DirHandleCache();
+
+  // same as fs_layer::open() and fs_layer::stat() of the backing file path
+  int open(const std::string &path, int flags, int mode = 0);
+  int stat(const std::string &path, efs_stat *buffer);
+
+  // close the handles of dirPath and of all folders below it
+  void forgetTree(const std::string &dirPath);
+
+  uint64_t hits() const { return _hits; }
+  uint64_t misses() const { return _misses; }
+
+ private:
+  DirHandleCache(const DirHandleCache &src);             // not allowed
+  DirHandleCache &operator=(const DirHandleCache &src);  // not allowed
+
+  // closes the handle when the last user is done with it, an operation
+  // may still use a handle which was evicted meanwhile
+  struct Handle {
+    fs_layer::dir_handle dir;
+
+    explicit Handle(fs_layer::dir_handle d) : dir(d) {}
+    ~Handle() { fs_layer::close_dir_handle(dir); }
+  };
+  typedef std::shared_ptr<Handle> HandlePtr;
+
+  struct Entry {
+    std::string path;
+    HandlePtr handle;
+  };
+  typedef std::list<Entry> EntryList;  // most recently used first
+
+  // returns the handle of the parent folder of path and sets name to the
+  // last component, or returns null if the folder can't be opened
+  HandlePtr parentHandle(const std::string &path, std::string &name);
+
+  size_t _maxEntries;
+  EntryList _entries;
+  std::unordered_map<std::string, EntryList::iterator> _index;
+  uint64_t _generation;  // incremented by forgetTree()
+
+  std::atomic<uint64_t> _hits;
+  std::atomic<uint64_t> _misses;
+
+  boost::mutex _mutex;
+};
+
+}  // namespace encfs
+
+#endif
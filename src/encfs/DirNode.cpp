@@ -20,9 +20,13 @@
 
 #include "DirNode.h"
 
+#include <algorithm>  // for min
 #include <cerrno>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <limits>
+#include <fcntl.h>
 #ifdef __linux__
 #include <sys/fsuid.h>
 #endif
@@ -39,27 +43,86 @@
 #include <utime.h>
 #endif
 
+#include "BlockCache.h"
 #include "Context.h"
+#include "DescriptorPool.h"
+#include "DirHandleCache.h"
 #include "Error.h"
 #include "FSConfig.h"
+#include "FileIVCache.h"
 #include "FileNode.h"
 #include "FileUtils.h"
+#include "CompressedFileIO.h"
+#include "HoleMap.h"
 #include "Mutex.h"
 #include "NameIO.h"
+#include "WorkerPool.h"
 #include "easylogging++.h"
 
 using namespace std;
 
 namespace encfs {
 
+// kept in the root of the backing directory while a recursive rename is
+// applied, see RenameJournal
+static const char renameJournalName[] = ".encfs6.rename";
+
+// kept in the root of the backing directory by the application, see
+// DirNode::nameIndexPath()
+static const char nameIndexName[] = ".encfs6.index";
+// the same for DirNode::cacheSnapshotPath()
+static const char cacheSnapshotName[] = ".encfs6.snapshot";
+
+// files in the root of the backing directory which aren't part of the
+// filesystem
+static bool isControlFile(const char *name) {
+  return strcmp(".encfs6.xml", name) == 0 ||
+         strcmp(renameJournalName, name) == 0 ||
+         strcmp(nameIndexName, name) == 0 ||
+         strcmp(cacheSnapshotName, name) == 0;
+}
+
+// files next to a cipher file which belong to it (see HoleMap and
+// CompressedFileIO)
+static bool isSidecarName(const char *name) {
+  return HoleMap::isMapName(name) || CompressedFileIO::isIndexName(name);
+}
+
 class DirDeleter {
  public:
   void operator()(fs_layer::DIR *d) { fs_layer::closedir(d); }
 };
 
+std::string DirTraverse::ResumeCookie::toString() const {
+  return std::to_string(offset) + ':' + name;
+}
+
+bool DirTraverse::ResumeCookie::fromString(const std::string &str) {
+  size_t colon = str.find(':');
+  if (colon == 0 || colon == std::string::npos) {
+    return false;
+  }
+  char *end = nullptr;
+  unsigned long long value = strtoull(str.c_str(), &end, 10);
+  if (end != str.c_str() + colon) {
+    return false;
+  }
+  offset = value;
+  name = str.substr(colon + 1);
+  return true;
+}
+
 DirTraverse::DirTraverse(std::shared_ptr<fs_layer::DIR> _dirPtr, uint64_t _iv,
-                         std::shared_ptr<NameIO> _naming, bool _root)
-    : dir(std::move(_dirPtr)), iv(_iv), naming(std::move(_naming)), root(_root) {}
+                         std::shared_ptr<NameIO> _naming, bool _root,
+                         std::string _cipherDir)
+    : dir(std::move(_dirPtr)),
+      iv(_iv),
+      naming(std::move(_naming)),
+      root(_root),
+      cipherDir(std::move(_cipherDir)),
+      atEnd(false),
+      invalidCount(0),
+      skipSidecars(false) {}
 
 DirTraverse &DirTraverse::operator=(const DirTraverse &src) = default;
 
@@ -71,8 +134,13 @@ DirTraverse::~DirTraverse() {
 }
 
 static bool _nextName(fs_layer::fs_dirent *&de, const std::shared_ptr<fs_layer::DIR> &dir,
-                      int *fileType, ino_t *inode) {
-  de = fs_layer::readdir(dir.get());
+                      int *fileType, ino_t *inode, efs_stat *stat = nullptr,
+                      bool *hasStat = nullptr) {
+  if (stat != nullptr) {
+    de = fs_layer::readdirplus(dir.get(), stat, *hasStat);
+  } else {
+    de = fs_layer::readdir(dir.get());
+  }
 
   if (de != nullptr) {
     if (fileType != nullptr) {
@@ -96,38 +164,201 @@ static bool _nextName(fs_layer::fs_dirent *&de, const std::shared_ptr<fs_layer::
   return false;
 }
 
+bool DirTraverse::pause() {
+  if (!dir || cipherDir.empty()) {
+    return false;
+  }
+  dir.reset();
+  return true;
+}
+
+bool DirTraverse::resume(const ResumeCookie &cookie) {
+  if (cipherDir.empty()) {
+    return false;
+  }
+  position = cookie;
+  atEnd = false;
+  dir.reset();
+  return reopen();
+}
+
+// opens cipherDir again and skips the names up to position.  Neither
+// FindFirstFile nor the directory iterators can seek, so the names are
+// read again, but not decoded.
+bool DirTraverse::reopen() {
+  auto openAt = [this](uint64_t skip, const std::string *stopAt,
+                       uint64_t &count) -> bool {
+    fs_layer::DIR *d = fs_layer::opendir(cipherDir.c_str());
+    if (d == nullptr) {
+      int eno = errno;
+      VLOG(1) << "opendir error " << strerror(eno);
+      return false;
+    }
+    dir.reset(d, DirDeleter());
+    count = 0;
+    fs_layer::fs_dirent *de;
+    while (count < skip && (de = fs_layer::readdir(dir.get())) != nullptr) {
+      ++count;
+      if (stopAt != nullptr && *stopAt == de->d_name) {
+        return true;
+      }
+    }
+    return stopAt == nullptr;
+  };
+
+  const ResumeCookie target = position;
+  uint64_t count = 0;
+  if (target.offset == 0) {
+    return openAt(0, nullptr, count);
+  }
+
+  // usually the last name is still at its offset
+  if (!openAt(target.offset - 1, nullptr, count)) {
+    return false;
+  }
+  fs_layer::fs_dirent *de = nullptr;
+  if (count == target.offset - 1 &&
+      (de = fs_layer::readdir(dir.get())) != nullptr &&
+      target.name == de->d_name) {
+    return true;
+  }
+
+  // names were added or removed before it, look for the name.  If it is
+  // gone too, continue at the old offset.
+  uint64_t all = std::numeric_limits<uint64_t>::max();
+  if (openAt(all, &target.name, count)) {
+    position.offset = count;
+    return true;
+  }
+  if (!openAt(target.offset, nullptr, count)) {
+    return false;
+  }
+  position.offset = count;
+  return true;
+}
+
+fs_layer::fs_dirent *DirTraverse::readEntry(int *fileType, ino_t *inode,
+                                            efs_stat *stat, bool *hasStat) {
+  fs_layer::fs_dirent *de = nullptr;
+  if (atEnd || (!dir && (cipherDir.empty() || !reopen()))) {
+    if (fileType != nullptr) {
+      *fileType = 0;
+    }
+    return nullptr;
+  }
+  if (!_nextName(de, dir, fileType, inode, stat, hasStat)) {
+    atEnd = true;
+    return nullptr;
+  }
+  ++position.offset;
+  position.name = de->d_name;
+  return de;
+}
+
 std::string DirTraverse::nextPlaintextName(int *fileType, ino_t *inode) {
+  std::string cipherName;
+  return nextPlaintextName(cipherName, fileType, inode);
+}
+
+std::string DirTraverse::nextPlaintextName(std::string &cipherName,
+                                           int *fileType, ino_t *inode) {
   fs_layer::fs_dirent *de = nullptr;
-  while (_nextName(de, dir, fileType, inode)) {
-    if (root && (strcmp(".encfs6.xml", de->d_name) == 0)) {
+  while ((de = readEntry(fileType, inode)) != nullptr) {
+    if ((root && isControlFile(de->d_name)) ||
+        (skipSidecars && isSidecarName(de->d_name))) {
       VLOG(1) << "skipping filename: " << de->d_name;
       continue;
     }
-    try {
-      uint64_t localIv = iv;
-      return naming->decodePath(de->d_name, &localIv);
-    } catch (encfs::Error &ex) {
-      // .. .problem decoding, ignore it and continue on to next name..
-      VLOG(1) << "error decoding filename: " << de->d_name;
+    uint64_t localIv = iv;
+    std::string plainName;
+    if (naming->tryDecodePath(de->d_name, &localIv, plainName)) {
+      cipherName = de->d_name;
+      return plainName;
     }
+    // .. .problem decoding, ignore it and continue on to next name..
+    VLOG(1) << "error decoding filename: " << de->d_name;
   }
 
+  cipherName.clear();
   return string();
 }
 
+// names decoded per call on the worker pool
+static const size_t parallelNameChunk = 16;
+
+std::vector<DirTraverse::Entry> DirTraverse::nextBatch(size_t maxEntries) {
+  std::vector<Entry> entries;
+  bool atEnd = false;
+  while (entries.empty() && !atEnd) {
+    fs_layer::fs_dirent *de = nullptr;
+    Entry entry;
+    while (entries.size() < maxEntries) {
+      de = readEntry(&entry.fileType, &entry.inode, &entry.stat,
+                     &entry.hasStat);
+      if (de == nullptr) {
+        atEnd = true;
+        break;
+      }
+      if ((root && isControlFile(de->d_name)) ||
+          (skipSidecars && isSidecarName(de->d_name))) {
+        VLOG(1) << "skipping filename: " << de->d_name;
+        continue;
+      }
+      entry.cipherName = de->d_name;
+      entries.push_back(entry);
+    }
+
+    // the names of a directory all start from its IV, so they can be
+    // decoded independently
+    std::vector<char> decoded(entries.size(), 0);
+    size_t chunks =
+        (entries.size() + parallelNameChunk - 1) / parallelNameChunk;
+    WorkerPool::instance().parallelFor(chunks, [&](size_t chunk) {
+      size_t first = chunk * parallelNameChunk;
+      size_t last = min(first + parallelNameChunk, entries.size());
+      for (size_t i = first; i < last; ++i) {
+        // errors are reported below, parallelFor() calls must not throw
+        try {
+          uint64_t localIv = iv;
+          if (naming->tryDecodePath(entries[i].cipherName.c_str(), &localIv,
+                                    entries[i].plainName)) {
+            decoded[i] = 1;
+          }
+        } catch (encfs::Error &ex) {
+        }
+      }
+    });
+
+    size_t kept = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (decoded[i] == 0) {
+        VLOG(1) << "error decoding filename: " << entries[i].cipherName;
+        ++invalidCount;
+        continue;
+      }
+      if (kept != i) {
+        entries[kept] = std::move(entries[i]);
+      }
+      ++kept;
+    }
+    entries.resize(kept);
+  }
+
+  return entries;
+}
+
 std::string DirTraverse::nextInvalid() {
   fs_layer::fs_dirent *de = nullptr;
+  std::string plainName;
   // find the first name which produces a decoding error...
-  while (_nextName(de, dir, (int *)nullptr, (ino_t *)nullptr)) {
-    if (root && (strcmp(".encfs6.xml", de->d_name) == 0)) {
+  while ((de = readEntry((int *)nullptr, (ino_t *)nullptr)) != nullptr) {
+    if ((root && isControlFile(de->d_name)) ||
+        (skipSidecars && isSidecarName(de->d_name))) {
       VLOG(1) << "skipping filename: " << de->d_name;
       continue;
     }
-    try {
-      uint64_t localIv = iv;
-      naming->decodePath(de->d_name, &localIv);
-      continue;
-    } catch (encfs::Error &ex) {
+    uint64_t localIv = iv;
+    if (!naming->tryDecodePath(de->d_name, &localIv, plainName)) {
       return string(de->d_name);
     }
   }
@@ -145,17 +376,172 @@ struct RenameEl {
   string newPName;
 
   bool isDirectory;
+
+  // with external IV chaining, the file header before the rename, so that
+  // a resumed rename can tell whether it has already been changed
+  string header;
+  bool headerDone;
 };
 
+// CipherFileIO: 64 bit file IV header, rewritten by a rename with external
+// IV chaining
+static const int fileHeaderSize = 8;
+
+static string readFileHeader(const string &cipherName) {
+  string header;
+  int fd = fs_layer::open(cipherName.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    char buf[fileHeaderSize];
+    if (fs_layer::pread(fd, buf, fileHeaderSize, 0) == fileHeaderSize) {
+      header.assign(buf, fileHeaderSize);
+    }
+    fs_layer::close(fd);
+  }
+  return header;
+}
+
+static string toHex(const string &data) {
+  static const char digits[] = "0123456789abcdef";
+  string hex;
+  for (unsigned char c : data) {
+    hex += digits[c >> 4];
+    hex += digits[c & 0x0f];
+  }
+  return hex;
+}
+
+static string fromHex(const string &hex) {
+  string data;
+  for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+    data += static_cast<char>(strtoul(hex.substr(i, 2).c_str(), nullptr, 16));
+  }
+  return data;
+}
+
+static const char renameJournalHeader[] = "EncFS rename journal 1";
+static const char renameJournalEnd[] = "end";
+static const char renameJournalDone[] = "+";
+
+/*
+    Journal of a recursive rename, so that it can be finished when it was
+    interrupted.  It holds the cipher names, relative to the root directory,
+    of the renamed directory and of all entries in the order they are renamed,
+    and the file headers which the rename changes.  Then one line is appended
+    per renamed entry.  No plaintext names are written.
+*/
+class RenameJournal {
+ public:
+  RenameJournal() : fd(-1) {}
+  ~RenameJournal();
+
+  RenameJournal(const RenameJournal &src) = delete;
+  RenameJournal &operator=(const RenameJournal &src) = delete;
+
+  bool create(const string &rootDir, const string &fromCName,
+              const string &toCName, const list<RenameEl> &renameList);
+  // continue a journal found at mount time
+  bool reopen(const string &rootDir);
+
+  // record that the next entry has been renamed
+  void entryDone();
+  // the rename has been finished or undone
+  void remove();
+
+ private:
+  string path;
+  int fd;
+};
+
+RenameJournal::~RenameJournal() {
+  if (fd >= 0) {
+    fs_layer::close(fd);
+  }
+}
+
+bool RenameJournal::create(const string &rootDir, const string &fromCName,
+                           const string &toCName,
+                           const list<RenameEl> &renameList) {
+  path = rootDir + renameJournalName;
+
+  string contents = string(renameJournalHeader) + '\n';
+  contents += fromCName.substr(rootDir.size()) + '\t' +
+              toCName.substr(rootDir.size()) + '\n';
+  for (const RenameEl &ren : renameList) {
+    contents += ren.oldCName.substr(rootDir.size()) + '\t' +
+                ren.newCName.substr(rootDir.size());
+    if (!ren.header.empty()) {
+      contents += '\t' + toHex(ren.header);
+    }
+    contents += '\n';
+  }
+  contents += string(renameJournalEnd) + '\n';
+
+  fd = fs_layer::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    int eno = errno;
+    RLOG(WARNING) << "can't create rename journal " << path << ": "
+                  << strerror(eno);
+    return false;
+  }
+
+  // the list has to be complete on disk before the first entry is renamed
+  size_t pos = 0;
+  bool ok = true;
+  while (ok && pos < contents.size()) {
+    unsigned int len =
+        static_cast<unsigned int>(min(contents.size() - pos, size_t(1 << 20)));
+    int res = fs_layer::write(fd, contents.data() + pos, len);
+    ok = res > 0;
+    if (ok) {
+      pos += res;
+    }
+  }
+  if (!ok || fs_layer::fsync(fd) != 0) {
+    int eno = errno;
+    RLOG(WARNING) << "can't write rename journal " << path << ": "
+                  << strerror(eno);
+    remove();
+    return false;
+  }
+  return true;
+}
+
+bool RenameJournal::reopen(const string &rootDir) {
+  path = rootDir + renameJournalName;
+  fd = fs_layer::open(path.c_str(), O_WRONLY | O_APPEND);
+  return fd >= 0;
+}
+
+void RenameJournal::entryDone() {
+  // no sync, entries renamed but not recorded are recognized by their names
+  if (fd >= 0) {
+    string line = string(renameJournalDone) + '\n';
+    fs_layer::write(fd, line.data(), static_cast<unsigned int>(line.size()));
+  }
+}
+
+void RenameJournal::remove() {
+  if (fd >= 0) {
+    fs_layer::close(fd);
+    fd = -1;
+  }
+  fs_layer::unlink(path.c_str());
+}
+
 class RenameOp {
  private:
   DirNode *dn;
   std::shared_ptr<list<RenameEl> > renameList;
   list<RenameEl>::const_iterator last;
+  RenameJournal *journal;
+  bool resuming;
+
+  void entryDone();
 
  public:
   RenameOp(DirNode *_dn, std::shared_ptr<list<RenameEl> > _renameList)
-      : dn(_dn), renameList(std::move(_renameList)) {
+      : dn(_dn), renameList(std::move(_renameList)), journal(nullptr),
+        resuming(false) {
     last = renameList->begin();
   }
 
@@ -169,6 +555,11 @@ class RenameOp {
 
   explicit operator bool() const { return renameList != nullptr; }
 
+  const list<RenameEl> &entries() const { return *renameList; }
+  void setJournal(RenameJournal *_journal) { journal = _journal; }
+  // continue an interrupted rename after the first doneCount entries
+  void resume(size_t doneCount);
+
   bool apply();
   void undo();
 };
@@ -185,6 +576,21 @@ RenameOp::~RenameOp() {
   }
 }
 
+void RenameOp::resume(size_t doneCount) {
+  resuming = true;
+  while (doneCount > 0 && last != renameList->end()) {
+    ++last;
+    --doneCount;
+  }
+}
+
+void RenameOp::entryDone() {
+  if (journal != nullptr) {
+    journal->entryDone();
+  }
+  ++dn->_renameDone;
+}
+
 bool RenameOp::apply() {
   try {
     while (last != renameList->end()) {
@@ -194,8 +600,18 @@ bool RenameOp::apply() {
       struct stat st;
       bool preserve_mtime = ::stat(last->oldCName.c_str(), &st) == 0;
 
+      // the interrupted rename may have renamed entries it didn't record
+      if (resuming && !preserve_mtime &&
+          ::stat(last->newCName.c_str(), &st) == 0) {
+        ++last;
+        entryDone();
+        continue;
+      }
+
       // internal node rename..
-      dn->renameNode(last->oldPName.c_str(), last->newPName.c_str());
+      if (!last->headerDone) {
+        dn->renameNode(last->oldPName.c_str(), last->newPName.c_str());
+      }
 
       // rename on disk..
       if (::rename(last->oldCName.c_str(), last->newCName.c_str()) == -1) {
@@ -205,6 +621,7 @@ bool RenameOp::apply() {
         dn->renameNode(last->newPName.c_str(), last->oldPName.c_str(), false);
         return false;
       }
+      dn->renameSidecars(last->oldCName, last->newCName);
 
       if (preserve_mtime) {
         struct utimbuf ut;
@@ -214,6 +631,7 @@ bool RenameOp::apply() {
       }
 
       ++last;
+      entryDone();
     }
 
     return true;
@@ -242,6 +660,7 @@ void RenameOp::undo() {
     VLOG(1) << "undo: renaming " << it->newCName << " -> " << it->oldCName;
 
     ::rename(it->newCName.c_str(), it->oldCName.c_str());
+    dn->renameSidecars(it->newCName, it->oldCName);
     try {
       dn->renameNode(it->newPName.c_str(), it->oldPName.c_str(), false);
     } catch (encfs::Error &err) {
@@ -256,13 +675,16 @@ void RenameOp::undo() {
 
 DirNode::DirNode(EncFS_Context *_ctx, const string &sourceDir,
                  const FSConfigPtr &_config) {
-  Lock _lock(mutex);
+  ExclusiveLock _lock(mutex);
 
   ctx = _ctx;
   rootDir = sourceDir;  // .. and fsConfig->opts->mountPoint have trailing slash
   fsConfig = _config;
 
   naming = fsConfig->nameCoding;
+
+  _renameTotal = 0;
+  _renameDone = 0;
 }
 
 DirNode::~DirNode() = default;
@@ -278,6 +700,12 @@ string DirNode::rootDirectory() {
   return string(rootDir, 0, rootDir.length() - 1);
 }
 
+string DirNode::nameIndexPath() const { return rootDir + nameIndexName; }
+
+string DirNode::cacheSnapshotPath() const {
+  return rootDir + cacheSnapshotName;
+}
+
 bool DirNode::touchesMountpoint(const char *realPath) const {
   const string &mountPoint = fsConfig->opts->mountPoint;
   // compare mountPoint up to the leading slash.
@@ -299,6 +727,57 @@ bool DirNode::touchesMountpoint(const char *realPath) const {
   return false;
 }
 
+/**
+ * Plain-text size of a file from the stat of its cipher file, without
+ * opening it. -ENOTSUP if the size is only known from the file contents.
+ */
+off_t DirNode::plaintextSizeFromStat(const efs_stat &stbuf) const {
+  if (!fsConfig->config->compressIface.name().empty()) {
+    return -ENOTSUP;
+  }
+  off_t size = stbuf.st_size;
+
+  // CipherFileIO: 64 bit file IV header, see HEADER_SIZE in CipherFileIO.cpp
+  const int ivHeaderSize = 8;
+  if (fsConfig->config->uniqueIV && size > 0) {
+    if (!fsConfig->reverseEncryption) {
+      if (size < ivHeaderSize) {
+        return -EBADMSG;
+      }
+      size -= ivHeaderSize;
+    } else {
+      size += ivHeaderSize;
+    }
+  }
+
+  // MACFileIO: MAC and random bytes in front of every block
+  int headerSize =
+      fsConfig->config->blockMACBytes + fsConfig->config->blockMACRandBytes;
+  if (headerSize != 0) {
+    int bs = fsConfig->config->blockSize;
+    off_t blockNum = (size + bs - 1) / bs;
+    size -= blockNum * headerSize;
+  }
+
+  return size;
+}
+
+off_t DirNode::blockMACBytesFromStat(const efs_stat &stbuf) const {
+  int headerSize =
+      fsConfig->config->blockMACBytes + fsConfig->config->blockMACRandBytes;
+  if (headerSize == 0 || fsConfig->reverseEncryption) {
+    return 0;
+  }
+
+  off_t size = stbuf.st_size;
+  const int ivHeaderSize = 8;
+  if (fsConfig->config->uniqueIV) {
+    size = size > ivHeaderSize ? size - ivHeaderSize : 0;
+  }
+  int bs = fsConfig->config->blockSize;
+  return ((size + bs - 1) / bs) * headerSize;
+}
+
 /**
  * Encrypt a plain-text file path to the ciphertext path with the
  * ciphertext root directory name prefixed.
@@ -384,7 +863,24 @@ DirTraverse DirNode::openDir(const char *plaintextPath) {
   } catch (encfs::Error &err) {
     RLOG(ERROR) << "encode err: " << err.what();
   }
-  return DirTraverse(dp, iv, naming, (strlen(plaintextPath) == 1));
+  DirTraverse dt(dp, iv, naming, (strlen(plaintextPath) == 1), cyName);
+  dt.setSkipSidecars(fsConfig->holeMaps ||
+                     !fsConfig->config->compressIface.name().empty());
+  return dt;
+}
+
+void DirNode::renameSidecars(const string &fromCName,
+                             const string &toCName) {
+  if (fsConfig->holeMaps) {
+    string toMap = HoleMap::mapPath(toCName);
+    fs_layer::unlink(toMap.c_str());
+    fs_layer::rename(HoleMap::mapPath(fromCName).c_str(), toMap.c_str());
+  }
+  if (!fsConfig->config->compressIface.name().empty()) {
+    string toIndex = CompressedFileIO::indexPath(toCName);
+    fs_layer::unlink(toIndex.c_str());
+    fs_layer::rename(CompressedFileIO::indexPath(fromCName).c_str(), toIndex.c_str());
+  }
 }
 
 bool DirNode::genRenameList(list<RenameEl> &renameList, const char *fromP,
@@ -411,12 +907,13 @@ bool DirNode::genRenameList(list<RenameEl> &renameList, const char *fromP,
     return false;
   }
 
+  // collect the names first, they are recoded on the worker pool and the
+  // types which the directory listing doesn't provide are queried at once
+  std::vector<RenameEl> entries;
+  std::vector<string> cipherNames;
+  std::vector<char> typeKnown;
   fs_layer::fs_dirent *de = nullptr;
   while ((de = fs_layer::readdir(dir.get())) != nullptr) {
-    // decode the name using the oldIV
-    uint64_t localIV = fromIV;
-    string plainName;
-
     if ((de->d_name[0] == '.') &&
         ((de->d_name[1] == '\0') ||
          ((de->d_name[1] == '.') && (de->d_name[2] == '\0')))) {
@@ -424,64 +921,142 @@ bool DirNode::genRenameList(list<RenameEl> &renameList, const char *fromP,
       continue;
     }
 
-    try {
-      plainName = naming->decodePath(de->d_name, &localIV);
-    } catch (encfs::Error &ex) {
-      // if filename can't be decoded, then ignore it..
-      continue;
-    }
-
-    // any error in the following will trigger a rename failure.
-    try {
-      // re-encode using the new IV..
-      localIV = toIV;
-      string newName = naming->encodePath(plainName.c_str(), &localIV);
-
-      // store rename information..
-      string oldFull = sourcePath + '/' + de->d_name;
-      string newFull = sourcePath + '/' + newName;
-
-      RenameEl ren;
-      ren.oldCName = oldFull;
-      ren.newCName = newFull;
-      ren.oldPName = string(fromP) + '/' + plainName;
-      ren.newPName = string(toP) + '/' + plainName;
-
-      bool isDir;
+    RenameEl ren;
+    ren.isDirectory = false;
+    ren.headerDone = false;
+    bool isKnown = false;
 #if defined(HAVE_DIRENT_D_TYPE)
-      if (de->d_type != DT_UNKNOWN) {
-        isDir = (de->d_type == DT_DIR);
-      } else
+    if (de->d_type != DT_UNKNOWN) {
+      ren.isDirectory = (de->d_type == DT_DIR);
+      isKnown = true;
+    }
 #endif
-      {
-        isDir = isDirectory(oldFull.c_str());
-      }
-
-      ren.isDirectory = isDir;
+    typeKnown.push_back(isKnown ? 1 : 0);
+    cipherNames.push_back(de->d_name);
+    entries.push_back(ren);
+  }
+  dir.reset();
 
-      if (isDir) {
-        // recurse..  We want to add subdirectory elements before the
-        // parent, as that is the logical rename order..
-        if (!genRenameList(renameList, ren.oldPName.c_str(),
-                           ren.newPName.c_str())) {
-          return false;
+  // decode the names using the old IV and re-encode them using the new one.
+  // The names of a directory all start from its IV, so they can be recoded
+  // independently
+  enum { recoded, notDecoded, notEncoded };
+  std::vector<char> state(entries.size(), notEncoded);
+  size_t chunks = (entries.size() + parallelNameChunk - 1) / parallelNameChunk;
+  WorkerPool::instance().parallelFor(chunks, [&](size_t chunk) {
+    size_t first = chunk * parallelNameChunk;
+    size_t last = min(first + parallelNameChunk, entries.size());
+    for (size_t i = first; i < last; ++i) {
+      // errors are reported below, parallelFor() calls must not throw
+      try {
+        uint64_t localIV = fromIV;
+        string plainName;
+        if (!naming->tryDecodePath(cipherNames[i].c_str(), &localIV,
+                                   plainName)) {
+          state[i] = notDecoded;
+          continue;
         }
-      }
 
-      VLOG(1) << "adding file " << oldFull << " to rename list";
+        localIV = toIV;
+        string newName = naming->encodePath(plainName.c_str(), &localIV);
+
+        RenameEl &ren = entries[i];
+        ren.oldCName = sourcePath + '/' + cipherNames[i];
+        ren.newCName = sourcePath + '/' + newName;
+        ren.oldPName = string(fromP) + '/' + plainName;
+        ren.newPName = string(toP) + '/' + plainName;
+        state[i] = recoded;
+      } catch (encfs::Error &err) {
+        RLOG(WARNING) << err.what();
+      }
+    }
+  });
 
-      renameList.push_back(ren);
-    } catch (encfs::Error &err) {
+  std::vector<string> unknownPaths;
+  size_t kept = 0;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    // if filename can't be decoded, then ignore it..
+    if (state[i] == notDecoded) {
+      continue;
+    }
+    if (state[i] == notEncoded) {
       // We can't convert this name, because we don't have a valid IV for
       // it (or perhaps a valid key).. It will be inaccessible..
       RLOG(WARNING) << "Aborting rename: error on file: "
-                    << fromCPart.append(1, '/').append(de->d_name);
-      RLOG(WARNING) << err.what();
+                    << fromCPart.append(1, '/').append(cipherNames[i]);
 
       // abort.. Err on the side of safety and disallow rename, rather
       // then loosing files..
       return false;
     }
+    if (typeKnown[i] == 0) {
+      unknownPaths.push_back(entries[i].oldCName);
+    }
+    if (kept != i) {
+      entries[kept] = std::move(entries[i]);
+      typeKnown[kept] = typeKnown[i];
+    }
+    ++kept;
+  }
+  entries.resize(kept);
+
+  std::vector<efs_stat> stats;
+  std::vector<int> statResults;
+  fs_layer::statMany(unknownPaths, stats, statResults);
+
+  std::vector<size_t> subDirs;
+  size_t unknownPos = 0;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    RenameEl &ren = entries[i];
+    if (typeKnown[i] == 0) {
+      ren.isDirectory = statResults[unknownPos] == 0 &&
+                        S_ISDIR(stats[unknownPos].st_mode);
+      ++unknownPos;
+    }
+    if (ren.isDirectory) {
+      subDirs.push_back(i);
+    }
+  }
+
+  if (fsConfig->config->externalIVChaining) {
+    WorkerPool::instance().parallelFor(entries.size(), [&](size_t i) {
+      if (!entries[i].isDirectory) {
+        entries[i].header = readFileHeader(entries[i].oldCName);
+      }
+    });
+  }
+
+  // the subdirectories are independent as well, each one is walked into a
+  // list of its own
+  std::vector<list<RenameEl> > subLists(subDirs.size());
+  std::vector<char> subResults(subDirs.size(), 0);
+  WorkerPool::instance().parallelFor(subDirs.size(), [&](size_t d) {
+    const RenameEl &ren = entries[subDirs[d]];
+    try {
+      subResults[d] = genRenameList(subLists[d], ren.oldPName.c_str(),
+                                    ren.newPName.c_str())
+                          ? 1
+                          : 0;
+    } catch (encfs::Error &err) {
+      RLOG(WARNING) << err.what();
+    }
+  });
+
+  size_t subDir = 0;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (entries[i].isDirectory) {
+      // We want to add subdirectory elements before the parent, as that is
+      // the logical rename order..
+      if (subResults[subDir] == 0) {
+        return false;
+      }
+      renameList.splice(renameList.end(), subLists[subDir]);
+      ++subDir;
+    }
+
+    VLOG(1) << "adding file " << entries[i].oldCName << " to rename list";
+
+    renameList.push_back(std::move(entries[i]));
   }
 
   return true;
@@ -504,9 +1079,157 @@ std::shared_ptr<RenameOp> DirNode::newRenameOp(const char *fromP,
     RLOG(WARNING) << "Error during generation of recursive rename list";
     return std::shared_ptr<RenameOp>();
   }
+  _renameTotal = renameList->size();
+  _renameDone = 0;
   return std::make_shared<RenameOp>(this, renameList);
 }
 
+// decodes a cipher path relative to the root directory
+static string decodeRelativePath(const NameIO &naming, const string &path) {
+  string plainPath = naming.decodePath(path.c_str());
+  if (plainPath.empty() || plainPath[0] != '/') {
+    plainPath.insert(0, 1, '/');
+  }
+  return plainPath;
+}
+
+void DirNode::resumeRename() {
+  string journalPath = rootDir + renameJournalName;
+  efs_stat stbuf;
+  if (fs_layer::stat(journalPath.c_str(), &stbuf) != 0) {
+    return;
+  }
+  if (fsConfig->opts->readOnly) {
+    RLOG(WARNING) << "Interrupted rename can't be finished on a read-only "
+                     "filesystem";
+    return;
+  }
+
+  ExclusiveLock _lock(mutex);
+
+  std::vector<string> lines;
+  {
+    string contents = fs_layer::readFileToString(journalPath.c_str());
+    size_t pos = 0;
+    while (pos < contents.size()) {
+      size_t end = contents.find('\n', pos);
+      if (end == string::npos) {
+        break;  // the last line is incomplete
+      }
+      lines.push_back(contents.substr(pos, end - pos));
+      pos = end + 1;
+    }
+  }
+
+  // the journal is complete on disk before anything is renamed, so nothing
+  // has to be done if it isn't
+  std::vector<string>::const_iterator endIt =
+      std::find(lines.begin(), lines.end(), string(renameJournalEnd));
+  if (lines.size() < 2 || lines[0] != renameJournalHeader ||
+      endIt == lines.end()) {
+    RLOG(WARNING) << "Removing incomplete rename journal " << journalPath;
+    fs_layer::unlink(journalPath.c_str());
+    return;
+  }
+  size_t doneCount = std::count(endIt + 1, lines.cend(),
+                                string(renameJournalDone));
+
+  // the old and new name, and the file header
+  struct JournalEntry {
+    string oldName;
+    string newName;
+    string header;
+  };
+  std::vector<JournalEntry> names;
+  for (std::vector<string>::const_iterator it = lines.begin() + 1;
+       it != endIt; ++it) {
+    size_t tab = it->find('\t');
+    if (tab == string::npos) {
+      RLOG(ERROR) << "Invalid rename journal " << journalPath;
+      return;
+    }
+    JournalEntry entry;
+    entry.oldName = it->substr(0, tab);
+    entry.newName = it->substr(tab + 1);
+    size_t headerTab = entry.newName.find('\t');
+    if (headerTab != string::npos) {
+      entry.header = fromHex(entry.newName.substr(headerTab + 1));
+      entry.newName.erase(headerTab);
+    }
+    names.push_back(entry);
+  }
+
+  const string fromCName = rootDir + names[0].oldName;
+  const string toCName = rootDir + names[0].newName;
+  RLOG(WARNING) << "Finishing interrupted rename of " << fromCName;
+
+  std::shared_ptr<list<RenameEl> > renameList(new list<RenameEl>);
+  try {
+    string fromP = decodeRelativePath(*naming, names[0].oldName);
+    string toP = decodeRelativePath(*naming, names[0].newName);
+    for (size_t i = 1; i < names.size(); ++i) {
+      // the names are renamed within their directory, and directories after
+      // their contents.  So the old path of every pending entry still exists
+      RenameEl ren;
+      ren.oldCName = rootDir + names[i].oldName;
+      ren.newCName = rootDir + names[i].newName;
+      ren.oldPName = decodeRelativePath(*naming, names[i].oldName);
+      if (ren.oldPName.compare(0, fromP.size(), fromP) != 0) {
+        RLOG(ERROR) << "Invalid rename journal " << journalPath;
+        return;
+      }
+      ren.newPName = toP + ren.oldPName.substr(fromP.size());
+      ren.isDirectory = false;
+      ren.header = names[i].header;
+      // the header is changed right before the rename, so this is only
+      // the case for the entry which was being renamed
+      ren.headerDone = !ren.header.empty() && i > doneCount &&
+                       readFileHeader(ren.oldCName) != ren.header;
+      renameList->push_back(ren);
+    }
+  } catch (encfs::Error &err) {
+    RLOG(ERROR) << "Can't decode rename journal " << journalPath << ": "
+                << err.what();
+    return;
+  }
+
+  RenameJournal journal;
+  if (!journal.reopen(rootDir)) {
+    RLOG(ERROR) << "Can't open rename journal " << journalPath;
+    return;
+  }
+
+  _renameTotal = renameList->size();
+  _renameDone = min(doneCount, renameList->size());
+  RenameOp renameOp(this, renameList);
+  renameOp.setJournal(&journal);
+  renameOp.resume(doneCount);
+  bool ok = renameOp.apply();
+
+  efs_stat st;
+  if (ok && fs_layer::stat(fromCName.c_str(), &st) == 0) {
+    ok = fs_layer::rename(fromCName.c_str(), toCName.c_str()) == 0;
+    if (ok) {
+      renameSidecars(fromCName, toCName);
+      struct utimbuf ut;
+      ut.actime = st.st_atime;
+      ut.modtime = st.st_mtime;
+      ::utime(toCName.c_str(), &ut);
+    }
+  }
+  _renameTotal = 0;
+  _renameDone = 0;
+
+  if (!ok) {
+    // keep the journal, so the next mount tries again
+    RLOG(ERROR) << "Interrupted rename could not be finished: " << fromCName;
+    return;
+  }
+  journal.remove();
+  naming->clearNameCache();
+  VLOG(1) << "interrupted rename finished";
+}
+
 int DirNode::mkdir(const char *plaintextPath, mode_t mode, uid_t uid,
                    gid_t gid) {
   string cyName = rootDir + naming->encodePath(plaintextPath);
@@ -534,6 +1257,7 @@ int DirNode::mkdir(const char *plaintextPath, mode_t mode, uid_t uid,
     }
   }*/
 
+  ExclusiveLock _lock(mutex);
   int res = fs_layer::mkdir(cyName.c_str(), mode);
 
   if (res == -1) {
@@ -562,7 +1286,7 @@ int DirNode::mkdir(const char *plaintextPath, mode_t mode, uid_t uid,
 }
 
 int DirNode::rename(const char *fromPlaintext, const char *toPlaintext) {
-  Lock _lock(mutex);
+  ExclusiveLock _lock(mutex);
 
   string fromCName = rootDir + naming->encodePath(fromPlaintext);
   string toCName = rootDir + naming->encodePath(toPlaintext);
@@ -573,15 +1297,41 @@ int DirNode::rename(const char *fromPlaintext, const char *toPlaintext) {
 
   std::shared_ptr<FileNode> toNode = findOrCreate(toPlaintext);
 
+  // pooled descriptors would keep Windows from renaming the files
+  if (fsConfig->fdPool) {
+    fsConfig->fdPool->forget(fromCName);
+    fsConfig->fdPool->forget(toCName);
+    fsConfig->fdPool->forgetTree(fromCName);
+  }
+  // cached folder handles would follow the renamed folders
+  if (fsConfig->dirHandles) {
+    fsConfig->dirHandles->forgetTree(fromCName);
+    fsConfig->dirHandles->forgetTree(toCName);
+  }
+
   std::shared_ptr<RenameOp> renameOp;
+  RenameJournal journal;
   if (hasDirectoryNameDependency() && isDirectory(fromCName.c_str())) {
     VLOG(1) << "recursive rename begin";
     renameOp = newRenameOp(fromPlaintext, toPlaintext);
 
+    // without the journal an interruption would leave the names of the
+    // subtree half converted
+    if (renameOp && !journal.create(rootDir, fromCName, toCName,
+                                    renameOp->entries())) {
+      renameOp.reset();
+    }
+    if (renameOp) {
+      renameOp->setJournal(&journal);
+    }
+
     if (!renameOp || !renameOp->apply()) {
       if (renameOp) {
         renameOp->undo();
+        journal.remove();
       }
+      _renameTotal = 0;
+      _renameDone = 0;
 
       RLOG(WARNING) << "rename aborted";
       return -EACCES;
@@ -595,7 +1345,8 @@ int DirNode::rename(const char *fromPlaintext, const char *toPlaintext) {
     bool preserve_mtime = ::stat(fromCName.c_str(), &st) == 0;
 
     renameNode(fromPlaintext, toPlaintext);
-    res = ::rename(fromCName.c_str(), toCName.c_str());
+    // replaces an existing file in one step, on Windows as well
+    res = fs_layer::rename(fromCName.c_str(), toCName.c_str());
 
     if (res == -1) {
       // undo
@@ -604,9 +1355,14 @@ int DirNode::rename(const char *fromPlaintext, const char *toPlaintext) {
 
       if (renameOp) {
         renameOp->undo();
+        journal.remove();
       }
     }
     else {
+      if (renameOp) {
+        journal.remove();
+      }
+      renameSidecars(fromCName, toCName);
 #ifdef __CYGWIN__
       // When renaming a file, Windows first opens it, renames it and then closes it
       // We then must decrease the target openFiles count
@@ -625,12 +1381,32 @@ int DirNode::rename(const char *fromPlaintext, const char *toPlaintext) {
         ut.modtime = st.st_mtime;
         ::utime(toCName.c_str(), &ut);
       }
+
+      // cached blocks are keyed by the cipher name of the file
+      if (fsConfig->blockCache) {
+        fsConfig->blockCache->forget(fromCName);
+        fsConfig->blockCache->forget(toCName);
+        fsConfig->blockCache->forgetTree(fromCName);
+        fsConfig->blockCache->forgetTree(toCName);
+      }
+      if (fsConfig->ivCache) {
+        fsConfig->ivCache->forget(fromCName);
+        fsConfig->ivCache->forget(toCName);
+        fsConfig->ivCache->forgetTree(fromCName);
+        fsConfig->ivCache->forgetTree(toCName);
+      }
+      naming->clearNameCache();
+      naming->forgetNameTree(fromPlaintext);
+      naming->forgetNameTree(toPlaintext);
     }
   } catch (encfs::Error &err) {
     // exception from renameNode, just show the error and continue..
+    // the journal is kept, the rename is finished at the next mount
     RLOG(WARNING) << err.what();
     res = -EIO;
   }
+  _renameTotal = 0;
+  _renameDone = 0;
 
   if (res != 0) {
     VLOG(1) << "rename failed: " << strerror(-res);
@@ -640,7 +1416,7 @@ int DirNode::rename(const char *fromPlaintext, const char *toPlaintext) {
 }
 
 int DirNode::link(const char *to, const char *from) {
-  Lock _lock(mutex);
+  ExclusiveLock _lock(mutex);
 
   string toCName = rootDir + naming->encodePath(to);
   string fromCName = rootDir + naming->encodePath(from);
@@ -713,8 +1489,9 @@ std::shared_ptr<FileNode> DirNode::findOrCreate(const char *plainName) {
       uint64_t iv = 0;
       string cipherName = naming->encodePath(plainName, &iv);
       uint64_t fuseFh = ctx->nextFuseFh();
-      node.reset(new FileNode(this, fsConfig, plainName,
-                              (rootDir + cipherName).c_str(), fuseFh));
+      // one allocation for the node, its FileIO layers and the count
+      node = std::make_shared<FileNode>(this, fsConfig, plainName,
+                                        (rootDir + cipherName).c_str(), fuseFh);
 
       if (fsConfig->config->externalIVChaining) {
         node->setName(nullptr, nullptr, iv);
@@ -729,10 +1506,25 @@ std::shared_ptr<FileNode> DirNode::findOrCreate(const char *plainName) {
 
 shared_ptr<FileNode> DirNode::lookupNode(const char *plainName,
                                          const char * /* requestor */) {
-  Lock _lock(mutex);
+  SharedLock _lock(mutex);
   return findOrCreate(plainName);
 }
 
+// the lock keeps renames from changing the name of the node meanwhile
+void DirNode::retainNode(const std::shared_ptr<FileNode> &node) {
+  SharedLock _lock(mutex);
+  if (ctx != nullptr) {
+    ctx->putNode(node->plaintextName(), node);
+  }
+}
+
+void DirNode::releaseNode(const std::shared_ptr<FileNode> &node) {
+  SharedLock _lock(mutex);
+  if (ctx != nullptr) {
+    ctx->eraseNode(node->plaintextName(), node);
+  }
+}
+
 /*
     Similar to lookupNode, except that we also call open() and only return a
     node on sucess.  This is done in one step to avoid any race conditions
@@ -744,7 +1536,7 @@ std::shared_ptr<FileNode> DirNode::openNode(const char *plainName,
                                             int *result) {
   (void)requestor;
   rAssert(result != nullptr);
-  Lock _lock(mutex);
+  SharedLock _lock(mutex);
 
   std::shared_ptr<FileNode> node = findOrCreate(plainName);
 
@@ -758,7 +1550,7 @@ int DirNode::unlink(const char *plaintextName) {
   string cyName = naming->encodePath(plaintextName);
   VLOG(1) << "unlink " << cyName;
 
-  Lock _lock(mutex);
+  ExclusiveLock _lock(mutex);
 
 // Windows does not allow deleting opened files, so no need to check
 // There is this "issue" however : https://github.com/billziss-gh/winfsp/issues/157
@@ -776,13 +1568,161 @@ int DirNode::unlink(const char *plaintextName) {
 
   int res = 0;
   string fullName = rootDir + cyName;
+  if (fsConfig->fdPool) {
+    fsConfig->fdPool->forget(fullName);
+  }
   res = ::unlink(fullName.c_str());
   if (res == -1) {
     res = -errno;
     VLOG(1) << "unlink error: " << strerror(-res);
+  } else {
+    if (fsConfig->blockCache) {
+      fsConfig->blockCache->forget(fullName);
+    }
+    if (fsConfig->ivCache) {
+      fsConfig->ivCache->forget(fullName);
+    }
+    if (fsConfig->holeMaps) {
+      fs_layer::unlink(HoleMap::mapPath(fullName).c_str());
+    }
+    if (!fsConfig->config->compressIface.name().empty()) {
+      fs_layer::unlink(CompressedFileIO::indexPath(fullName).c_str());
+    }
   }
 
   return res;
 }
 
+// removes everything in the cipher folder dirName and, unless keepDir, the
+// folder itself.  See removeFolderContents()
+static int removeCipherTree(const string &dirName, bool keepDir,
+                            std::vector<string> &removed) {
+  std::vector<string> paths;
+  std::vector<string> unknownPaths;
+  std::vector<char> isDir;
+  {
+    fs_layer::DIR *dir = fs_layer::opendir(dirName.c_str());
+    if (dir == nullptr) {
+      return -errno;
+    }
+    efs_stat stbuf;
+    bool hasStat = false;
+    fs_layer::fs_dirent *de;
+    while ((de = fs_layer::readdirplus(dir, &stbuf, hasStat)) != nullptr) {
+      if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+        continue;
+      }
+      paths.push_back(dirName + '/' + de->d_name);
+      if (hasStat) {
+        isDir.push_back(S_ISDIR(stbuf.st_mode) ? 1 : 0);
+      } else {
+        isDir.push_back(2);
+        unknownPaths.push_back(paths.back());
+      }
+    }
+    fs_layer::closedir(dir);
+  }
+
+  std::vector<efs_stat> stats;
+  std::vector<int> statResults;
+  fs_layer::statMany(unknownPaths, stats, statResults);
+
+  std::vector<size_t> files, subDirs;
+  size_t unknownPos = 0;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (isDir[i] == 2) {
+      isDir[i] = statResults[unknownPos] == 0 &&
+                 S_ISDIR(stats[unknownPos].st_mode);
+      ++unknownPos;
+    }
+    (isDir[i] ? subDirs : files).push_back(i);
+  }
+
+  // the subdirectories are independent, each one collects a list of its own
+  std::vector<int> subResults(subDirs.size(), 0);
+  std::vector<std::vector<string> > subRemoved(subDirs.size());
+  WorkerPool::instance().parallelFor(subDirs.size(), [&](size_t d) {
+    subResults[d] = removeCipherTree(paths[subDirs[d]], false, subRemoved[d]);
+  });
+  std::vector<int> results(files.size(), 0);
+  size_t chunks = (files.size() + parallelNameChunk - 1) / parallelNameChunk;
+  WorkerPool::instance().parallelFor(chunks, [&](size_t chunk) {
+    size_t first = chunk * parallelNameChunk;
+    size_t last = min(first + parallelNameChunk, files.size());
+    for (size_t i = first; i < last; ++i) {
+      if (fs_layer::unlink(paths[files[i]].c_str()) != 0) {
+        results[i] = -errno;
+      }
+    }
+  });
+
+  int res = 0;
+  for (size_t d = 0; d < subDirs.size(); ++d) {
+    removed.insert(removed.end(), subRemoved[d].begin(), subRemoved[d].end());
+    if (subResults[d] != 0) {
+      res = subResults[d];
+    }
+  }
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (results[i] != 0) {
+      res = results[i];
+    } else if (!isSidecarName(
+                   fs_layer::extract_filename(paths[files[i]]).c_str())) {
+      removed.push_back(std::move(paths[files[i]]));
+    }
+  }
+  if (res != 0 || keepDir) {
+    return res;
+  }
+
+  if (fs_layer::rmdir(dirName.c_str()) != 0) {
+    // a read-only folder can't be removed on Windows
+    fs_layer::chmod(dirName.c_str(), S_IRUSR | S_IWUSR | S_IXUSR);
+    if (fs_layer::rmdir(dirName.c_str()) != 0) {
+      return -errno;
+    }
+  }
+  removed.push_back(dirName);
+  return 0;
+}
+
+int DirNode::removeFolderContents(const char *plaintextPath,
+                                  std::vector<string> &removed) {
+  string cyName = naming->encodePath(plaintextPath);
+  string fullName = rootDir + cyName;
+  VLOG(1) << "removeFolderContents " << cyName;
+
+  ExclusiveLock _lock(mutex);
+
+  // the root directory holds the configuration
+  if (cyName.empty() || cyName == "/" || !isDirectory(fullName.c_str())) {
+    return -EINVAL;
+  }
+  if ((ctx != nullptr) && ctx->hasNodeBelow(plaintextPath)) {
+    RLOG(WARNING) << "Refusing to remove folder with open files: " << cyName;
+    return -EBUSY;
+  }
+
+  // pooled descriptors would keep Windows from deleting the files
+  if (fsConfig->fdPool) {
+    fsConfig->fdPool->forgetTree(fullName);
+  }
+  // and cached handles the folders
+  if (fsConfig->dirHandles) {
+    fsConfig->dirHandles->forgetTree(fullName);
+  }
+
+  int res = removeCipherTree(fullName, true, removed);
+
+  // also the part which was removed before a failure
+  if (fsConfig->blockCache) {
+    fsConfig->blockCache->forgetTree(fullName);
+  }
+  if (fsConfig->ivCache) {
+    fsConfig->ivCache->forgetTree(fullName);
+  }
+  naming->forgetNameTree(plaintextPath);
+  return res;
+}
+
 }  // namespace encfs
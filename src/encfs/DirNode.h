@@ -29,6 +29,7 @@
 #if defined(HAVE_INTTYPES_H)
 #include <inttypes.h>
 #endif
+#include <atomic>
 #include <list>
 #include <map>
 #include <memory>
@@ -58,8 +59,26 @@ struct RenameEl;
 
 class DirTraverse {
  public:
+  // position of a traversal, which stays usable after the directory handle
+  // was closed.  offset counts the names read from the directory, name is
+  // the cipher name read last.  It is used to find the position again when
+  // names were added or removed in between.
+  struct ResumeCookie {
+    uint64_t offset;
+    std::string name;
+
+    ResumeCookie() : offset(0) {}
+
+    // "offset:name"
+    std::string toString() const;
+    bool fromString(const std::string &str);
+  };
+
+  // cipherDir is the directory dirPtr was opened for, it is needed to
+  // resume the traversal after pause()
   DirTraverse(std::shared_ptr<fs_layer::DIR> dirPtr, uint64_t iv,
-              std::shared_ptr<NameIO> naming, bool root);
+              std::shared_ptr<NameIO> naming, bool root,
+              std::string cipherDir = std::string());
   ~DirTraverse();
 
   DirTraverse &operator=(const DirTraverse &src);
@@ -68,25 +87,79 @@ class DirTraverse {
   // an invalid directory is requested for traversal)
   bool valid() const;
 
+  ResumeCookie cookie() const { return position; }
+
+  // leave out the map files of HoleMap and the indexes of CompressedFileIO,
+  // which are not undecodable names
+  void setSkipSidecars(bool skip) { skipSidecars = skip; }
+
+  // closes the directory handle, the next read opens the directory again
+  // and continues at cookie().  Returns false if the traversal can't be
+  // resumed, it is left unchanged then.
+  bool pause();
+  bool paused() const { return !dir && !atEnd && !cipherDir.empty(); }
+
+  // continue at a cookie returned earlier, possibly by another
+  // DirTraverse of the same directory.  Returns false if the directory
+  // can't be opened.
+  bool resume(const ResumeCookie &cookie);
+
   // return next plaintext filename
   // If fileType is not 0, then it is used to return the filetype (or 0 if
   // unknown)
   std::string nextPlaintextName(int *fileType = 0, ino_t *inode = 0);
 
+  // same as nextPlaintextName(), but also returns the ciphertext name the
+  // plaintext name was decoded from, so it doesn't have to be encoded again
+  std::string nextPlaintextName(std::string &cipherName, int *fileType = 0,
+                                ino_t *inode = 0);
+
+  struct Entry {
+    std::string plainName;
+    std::string cipherName;
+    int fileType;  // 0 if unknown
+    ino_t inode;
+    bool hasStat;  // stat of the cipher file, if the enumeration returned it
+    efs_stat stat;
+  };
+
+  // returns up to maxEntries of the next names, decoded in parallel.  Like
+  // nextPlaintextName(), undecodable names are skipped.  Returns an empty
+  // list at the end of the directory.  Where the directory enumeration
+  // provides it (see fs_layer::readdirplus), the entries carry the stat data.
+  std::vector<Entry> nextBatch(size_t maxEntries);
+
+  // number of names nextBatch() skipped so far because they couldn't be
+  // decoded, so they can be counted without listing the directory again
+  size_t skippedInvalid() const { return invalidCount; }
+
   /* Return cipher name of next undecodable filename..
      The opposite of nextPlaintextName(), as that skips undecodable names..
   */
   std::string nextInvalid();
 
  private:
+  // reads the next name and advances the position, resumes a paused
+  // traversal first
+  fs_layer::fs_dirent *readEntry(int *fileType, ino_t *inode,
+                                 efs_stat *stat = nullptr,
+                                 bool *hasStat = nullptr);
+  bool reopen();
+
   std::shared_ptr<fs_layer::DIR> dir;  // struct DIR
   // initialization vector to use.  Not very general purpose, but makes it
   // more efficient to support filename IV chaining..
   uint64_t iv;
   std::shared_ptr<NameIO> naming;
   bool root;
+
+  std::string cipherDir;
+  ResumeCookie position;
+  bool atEnd;
+  size_t invalidCount;
+  bool skipSidecars;
 };
-inline bool DirTraverse::valid() const { return dir.get() != 0; }
+inline bool DirTraverse::valid() const { return dir.get() != 0 || paused(); }
 
 class DirNode {
  public:
@@ -98,6 +171,12 @@ class DirNode {
   // return the path to the root directory
   std::string rootDirectory();
 
+  // file in the root of the backing directory where the application may
+  // keep an index of the names, skipped in listings like the config file
+  std::string nameIndexPath() const;
+  // the same for a snapshot of the caches of the application
+  std::string cacheSnapshotPath() const;
+
   // recursive lookup check
   bool touchesMountpoint(const char *realPath) const;
 
@@ -113,6 +192,25 @@ class DirNode {
                                      const char *requestor, int flags,
                                      int *openResult);
 
+  /*
+      Keep a node which the caller has opened in the context, so that
+      further lookups, opens and renames of the same file use it.  Every
+      retainNode() is paired with a releaseNode(), the node is shared until
+      the last one.  Does nothing without a context.
+  */
+  void retainNode(const std::shared_ptr<FileNode> &node);
+  void releaseNode(const std::shared_ptr<FileNode> &node);
+
+  // size of the plaintext of a regular file, computed from the stat of its
+  // ciphertext file the same way as FileNode::getAttr(), but without
+  // constructing a FileNode.  Returns -errno on failure, -ENOTSUP if the
+  // volume is compressed, the size is then only known from the FileNode
+  off_t plaintextSizeFromStat(const efs_stat &stbuf) const;
+
+  // bytes of the block MACs and their random bytes in the ciphertext file,
+  // part of the difference between its size and plaintextSizeFromStat()
+  off_t blockMACBytesFromStat(const efs_stat &stbuf) const;
+
   std::string cipherPath(const char *plaintextPath);
   std::string cipherPathWithoutRoot(const char *plaintextPath);
   std::string plainPath(const char *cipherPath);
@@ -132,6 +230,18 @@ class DirNode {
   // unlink the specified file
   int unlink(const char *plaintextName);
 
+  /*
+      Removes everything in the folder plaintextPath, the folder itself
+      stays.  The cipher folders are walked as they are, without decoding a
+      name, and the files of each folder are unlinked in parallel.  Fails
+      with -EBUSY, removing nothing, if a file below the folder is open.  A
+      failure part way leaves the rest in place.  removed receives the
+      cipher paths of the files and folders removed, those below a folder
+      before it, without the sidecars of the files.
+  */
+  int removeFolderContents(const char *plaintextPath,
+                           std::vector<std::string> &removed);
+
   // traverse directory
   DirTraverse openDir(const char *plainDirName);
 
@@ -141,6 +251,18 @@ class DirNode {
 
   int rename(const char *fromPlaintext, const char *toPlaintext);
 
+  /*
+      A recursive rename is recorded in a journal in the root directory
+      while it is applied.  If it was interrupted, e.g. by a crash, this
+      finishes it.  Called once after the filesystem has been opened.
+  */
+  void resumeRename();
+
+  // progress of the running recursive rename, for display.  Both are zero
+  // if there is none
+  uint64_t renameEntriesTotal() const { return _renameTotal; }
+  uint64_t renameEntriesDone() const { return _renameDone; }
+
   int link(const char *to, const char *from);
 
   // returns idle time of filesystem in seconds
@@ -171,9 +293,17 @@ class DirNode {
   bool genRenameList(std::list<RenameEl> &list, const char *fromP,
                      const char *toP);
 
+  // moves the hole map and the compression index of a cipher file along
+  // with it, see HoleMap and CompressedFileIO.  Those left at the
+  // destination belong to the file being replaced.
+  void renameSidecars(const std::string &fromCName,
+                      const std::string &toCName);
+
   std::shared_ptr<FileNode> findOrCreate(const char *plainName);
 
-  boost::mutex mutex;
+  // lookups and opens share the lock, changes of the namespace (mkdir,
+  // rename, link, unlink) hold it exclusively
+  boost::shared_mutex mutex;
 
   EncFS_Context *ctx;
 
@@ -182,6 +312,9 @@ class DirNode {
   FSConfigPtr fsConfig;
 
   std::shared_ptr<NameIO> naming;
+
+  std::atomic<uint64_t> _renameTotal;
+  std::atomic<uint64_t> _renameDone;
 };
 
 }  // namespace encfs
@@ -21,7 +21,9 @@
 #ifndef _FSConfig_incl_
 #define _FSConfig_incl_
 
+#include <atomic>
 #include <memory>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -41,7 +43,11 @@ enum ConfigType {
 };
 
 struct EncFS_Opts;
+class BlockCache;
 class Cipher;
+class DescriptorPool;
+class DirHandleCache;
+class FileIVCache;
 class NameIO;
 
 /**
@@ -77,6 +83,12 @@ struct EncFSConfig {
 
   bool chainedNameIV;  // filename IV chaining
   bool allowHoles;     // allow holes in files (implicit zero blocks)
+  bool holeMap;        // remember the holes of each file, see HoleMap
+
+  // codec compressing the file data, empty name if the data isn't
+  // compressed, see CompressedFileIO
+  Interface compressIface;
+  int compressBlockSize;  // bytes of file data compressed together
 
   EncFSConfig() : keyData(), salt() {
     cfgType = Config_None;
@@ -88,6 +100,8 @@ struct EncFSConfig {
     externalIVChaining = false;
     chainedNameIV = false;
     allowHoles = false;
+    holeMap = false;
+    compressBlockSize = 0;
 
     kdfIterations = 0;
     desiredKDFDuration = 500;
@@ -124,13 +138,30 @@ struct FSConfig {
   CipherKey key;
   std::shared_ptr<NameIO> nameCoding;
 
+  // decoded blocks shared by all files, may be null
+  std::shared_ptr<BlockCache> blockCache;
+  // decoded file IV headers, may be null
+  std::shared_ptr<FileIVCache> ivCache;
+  // backing file descriptors kept for reuse, may be null
+  std::shared_ptr<DescriptorPool> fdPool;
+  // handles of backing folders, for opening files by their last component,
+  // may be null
+  std::shared_ptr<DirHandleCache> dirHandles;
+  // nanoseconds spent coding file data in CipherFileIO, may be null
+  std::shared_ptr<std::atomic<uint64_t>> codingNanos;
+
   bool forceDecode;        // force decode on MAC block failures
   bool reverseEncryption;  // reverse encryption operation
+  // holeMap of the config, if it can be used with this volume and mount
+  bool holeMaps;
 
   bool idleTracking;  // turn on idle monitoring of filesystem
 
   FSConfig()
-      : forceDecode(false), reverseEncryption(false), idleTracking(false) {}
+      : forceDecode(false),
+        reverseEncryption(false),
+        holeMaps(false),
+        idleTracking(false) {}
 };
 
 using FSConfigPtr = std::shared_ptr<FSConfig>;
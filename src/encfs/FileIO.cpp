@@ -20,6 +20,8 @@
 
 #include "FileIO.h"
 
+#include "IOPool.h"
+
 namespace encfs {
 
 FileIO::FileIO() = default;
@@ -33,4 +35,48 @@ bool FileIO::setIV(uint64_t iv) {
   return true;
 }
 
+ssize_t FileIO::readv(const IORequest *reqs, int count) const {
+  ssize_t total = 0;
+  for (int i = 0; i < count; ++i) {
+    ssize_t readSize = read(reqs[i]);
+    if (readSize < 0) {
+      return readSize;
+    }
+    total += readSize;
+    if ((size_t)readSize < reqs[i].dataLen) {
+      break;
+    }
+  }
+  return total;
+}
+
+ssize_t FileIO::writev(const IORequest *reqs, int count) {
+  ssize_t total = 0;
+  for (int i = 0; i < count; ++i) {
+    ssize_t writeSize = write(reqs[i]);
+    if (writeSize < 0) {
+      return writeSize;
+    }
+    total += writeSize;
+  }
+  return total;
+}
+
+void FileIO::readAsync(const IORequest &req, const Completion &done) const {
+  IOPool::instance().post([this, req, done]() { done(read(req)); });
+}
+
+void FileIO::writeAsync(const IORequest &req, const Completion &done) {
+  IOPool::instance().post([this, req, done]() { done(write(req)); });
+}
+
+int FileIO::setSparse() { return 0; }
+
+bool FileIO::findData(off_t /*offset*/, off_t & /*begin*/,
+                      off_t & /*end*/) const {
+  return false;
+}
+
+int FileIO::preallocate(off_t /*size*/) { return 0; }
+
 }  // namespace encfs
@@ -21,6 +21,7 @@
 #ifndef _FileIO_incl_
 #define _FileIO_incl_
 
+#include <functional>
 #include <inttypes.h>
 #include <stdint.h>
 #include <sys/types.h>
@@ -46,6 +47,16 @@ struct IORequest {
 
 inline IORequest::IORequest() : offset(0), dataLen(0), data(0) {}
 
+// how a file is going to be used, given when it is opened, see
+// FileNode::setAccessHint()
+enum AccessHint {
+  Access_Normal = 0,
+  Access_Sequential,
+  Access_Random,
+  Access_WriteOnce,
+  Access_NoCache
+};
+
 class FileIO {
  public:
   FileIO();
@@ -64,7 +75,9 @@ class FileIO {
   virtual bool setIV(uint64_t iv);
 
   // open file for specified mode.  There is no corresponding close, so a
-  // file is open until the FileIO interface is destroyed.
+  // file is open until the FileIO interface is destroyed.  Returns a value
+  // >= 0 in case of success, which is not necessarily a file descriptor,
+  // see RawFileIO::open().
   virtual int open(int flags) = 0;
 
   // get filesystem attributes for a file
@@ -74,8 +87,43 @@ class FileIO {
   virtual ssize_t read(const IORequest &req) const = 0;
   virtual ssize_t write(const IORequest &req) = 0;
 
+  // read or write several ranges, in the order given.  Reading stops at the
+  // first short read.  Returns the total number of bytes, or -errno.
+  // The default implementation calls read() / write() for every request.
+  virtual ssize_t readv(const IORequest *reqs, int count) const;
+  virtual ssize_t writev(const IORequest *reqs, int count);
+
+  // the result of readAsync() or writeAsync(), the number of bytes or -errno
+  typedef std::function<void(ssize_t)> Completion;
+
+  // read() or write() without waiting for the result: done is called once,
+  // on another thread or before the call returns.  The buffer of req and
+  // this FileIO must stay valid until then.  The default implementation
+  // runs read() / write() on the IOPool.
+  virtual void readAsync(const IORequest &req, const Completion &done) const;
+  virtual void writeAsync(const IORequest &req, const Completion &done);
+
   virtual int truncate(off_t size) = 0;
 
+  // hint that the file will have holes, so that the backing file doesn't
+  // allocate the ranges which are never written.  Returns 0 or -errno.
+  virtual int setSparse();
+
+  // find the first range at or after offset which may contain data.  Sets
+  // [begin, end) to that range, so [offset, begin) is a hole; begin and end
+  // are the size of the file if there is no data after offset.  Returns
+  // false if holes are not known, the default.
+  virtual bool findData(off_t offset, off_t &begin, off_t &end) const;
+
+  // reserve the space of the backing file for a file of size bytes, without
+  // changing its size, so that it isn't extended piece by piece.  Returns 0
+  // or -errno; the default does nothing.
+  virtual int preallocate(off_t size);
+
+  // flush the data (and the metadata unless datasync) of the backing file
+  // to disk.  Returns 0 or -errno.
+  virtual int sync(bool datasync) = 0;
+
   virtual bool isWritable() const = 0;
 
  private:
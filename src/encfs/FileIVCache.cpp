@@ -0,0 +1,86 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FileIVCache.h"
+
+#include "Mutex.h"
+
+namespace encfs {
+
+FileIVCache::FileIVCache(size_t maxEntries) : _maxEntries(maxEntries) {}
+
+FileIVCache::~FileIVCache() = default;
+
+uint64_t FileIVCache::lookup(const std::string &path, uint64_t externalIV,
+                             uint64_t ino, off_t size, int64_t mtime) const {
+  Lock _lock(_mutex);
+
+  auto it = _entries.find(path);
+  if (it == _entries.end()) {
+    return 0;
+  }
+  const Entry &entry = it->second;
+  if (entry.externalIV != externalIV || entry.ino != ino ||
+      entry.size != size || entry.mtime != mtime) {
+    return 0;
+  }
+  return entry.fileIV;
+}
+
+void FileIVCache::insert(const std::string &path, uint64_t externalIV,
+                         uint64_t ino, off_t size, int64_t mtime,
+                         uint64_t fileIV) {
+  Lock _lock(_mutex);
+
+  if (_entries.size() >= _maxEntries && _entries.count(path) == 0) {
+    // no need for anything smarter, the IV is cheap to read again
+    _entries.erase(_entries.begin());
+  }
+
+  Entry &entry = _entries[path];
+  entry.externalIV = externalIV;
+  entry.ino = ino;
+  entry.size = size;
+  entry.mtime = mtime;
+  entry.fileIV = fileIV;
+}
+
+void FileIVCache::forget(const std::string &path) {
+  Lock _lock(_mutex);
+  _entries.erase(path);
+}
+
+void FileIVCache::forgetTree(const std::string &dirPath) {
+  Lock _lock(_mutex);
+
+  auto it = _entries.begin();
+  while (it != _entries.end()) {
+    const std::string &path = it->first;
+    if (path.size() > dirPath.size() &&
+        path.compare(0, dirPath.size(), dirPath) == 0 &&
+        (path[dirPath.size()] == '/' || path[dirPath.size()] == '\\')) {
+      it = _entries.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+}  // namespace encfs
@@ -0,0 +1,79 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FileIVCache_incl_
+#define _FileIVCache_incl_
+
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+
+#include <boost/thread/mutex.hpp>
+
+namespace encfs {
+
+/*
+    Cache of decoded per-file IV headers, shared by all files of a
+    filesystem.
+
+    CipherFileIO reads and decodes the 8 byte header of a file the first
+    time it needs the file IV, and FileNodes are created again and again
+    for the same files.  The cache remembers the IV by cipher path,
+    together with the external IV it was decoded with and a stamp of the
+    backing file (inode number, size and modification time).  An entry is
+    only used while all of these still match.
+*/
+class FileIVCache {
+ public:
+  FileIVCache(size_t maxEntries);
+  ~FileIVCache();
+
+  // returns the cached IV, or 0 if there is none for this stamp
+  uint64_t lookup(const std::string &path, uint64_t externalIV, uint64_t ino,
+                  off_t size, int64_t mtime) const;
+  void insert(const std::string &path, uint64_t externalIV, uint64_t ino,
+              off_t size, int64_t mtime, uint64_t fileIV);
+
+  void forget(const std::string &path);
+  // forget all files below directory dirPath, after a rename
+  void forgetTree(const std::string &dirPath);
+
+ private:
+  FileIVCache(const FileIVCache &src);             // not allowed
+  FileIVCache &operator=(const FileIVCache &src);  // not allowed
+
+  struct Entry {
+    uint64_t externalIV;
+    uint64_t ino;
+    off_t size;
+    int64_t mtime;
+    uint64_t fileIV;
+  };
+
+  size_t _maxEntries;
+  std::unordered_map<std::string, Entry> _entries;
+
+  mutable boost::mutex _mutex;
+};
+
+}  // namespace encfs
+
+#endif
@@ -20,6 +20,7 @@
 
 #include "FileNode.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <cinttypes>
 #include <cstring>
@@ -35,7 +36,11 @@
 
 #include "fs_layer.h"
 
+#include "BlockCache.h"
 #include "CipherFileIO.h"
+#include "CompressedFileIO.h"
+#include "DescriptorPool.h"
+#include "DirHandleCache.h"
 #include "Error.h"
 #include "FileIO.h"
 #include "FileUtils.h"
@@ -48,38 +53,85 @@ using namespace std;
 namespace encfs {
 
 /*
-   TODO: locking at the FileNode level is inefficient, since this precludes
-   multiple IO operations from going on concurrently within the same file.
-
-   There is no reason why simultainous reads cannot be satisfied, or why one
-   read has to wait for the decoding of the previous read before it can be
-   sent to the IO subsystem!
+   Reads of the same file run concurrently, they only take the FileNode
+   lock shared.  Writes, truncates and syncs still wait for all of them.
 */
 
+// pointer to a layer of the FileNode, without a reference count
+static std::shared_ptr<FileIO> layerPtr(FileIO *layer) {
+  return std::shared_ptr<FileIO>(std::shared_ptr<FileIO>(), layer);
+}
+
+// the lock of a reader, not taken for a sealed file (see FileNode::open())
+static SharedLock readerLock(boost::shared_mutex &mutex, bool sealed) {
+  return sealed ? SharedLock(mutex, boost::defer_lock) : SharedLock(mutex);
+}
+
 FileNode::FileNode(DirNode *parent_, const FSConfigPtr &cfg,
                    const char *plaintextName_, const char *cipherName_,
-                   uint64_t fuseFh) {
+                   uint64_t fuseFh)
+    : fsConfig(cfg),
+      rawIO(cipherName_),
+      cipherIO(layerPtr(&rawIO), cfg) {
 
-  Lock _lock(mutex);
+  ExclusiveLock _lock(mutex);
 
   this->canary = CANARY_OK;
 
   this->_pname = plaintextName_;
   this->_cname = cipherName_;
   this->parent = parent_;
-
-  this->fsConfig = cfg;
+  this->_extendedSize = -1;
 
   this->fuseFh = fuseFh;
-
-  // chain RawFileIO & CipherFileIO
-  std::shared_ptr<FileIO> rawIO(new RawFileIO(_cname));
-  io = std::shared_ptr<FileIO>(new CipherFileIO(rawIO, fsConfig));
+  this->sealed = cfg->opts->readOnly;
+  this->sealedOpenResult = -1;
+  this->hinted = false;
+
+  // chain RawFileIO & CipherFileIO.  Read-only descriptors of a sealed
+  // volume are always mapped, the files don't change under the views
+  rawIO.setUseMap(cfg->opts->mapBackingFiles || sealed);
+  rawIO.setUncachedSequential(cfg->opts->uncachedSequentialIO);
+  rawIO.setDescriptorPool(cfg->fdPool);
+  rawIO.setDirHandleCache(cfg->dirHandles);
+  BlockFileIO *blockIO = &cipherIO;
 
   if ((cfg->config->blockMACBytes != 0) ||
       (cfg->config->blockMACRandBytes != 0)) {
-    io = std::shared_ptr<FileIO>(new MACFileIO(io, fsConfig));
+    // MACFileIO passes its own temporary blocks down, which can be coded in
+    // place without another copy
+    cipherIO.setCodeInPlace(true);
+    macIO.emplace(layerPtr(&cipherIO), fsConfig);
+    blockIO = macIO.get_ptr();
+  }
+
+  if (!cfg->config->compressIface.name().empty()) {
+    // the data is compressed before it is encrypted.  The index is
+    // encrypted like a file of its own, without MACs.
+    indexRawIO.emplace(CompressedFileIO::indexPath(_cname));
+    indexCipherIO.emplace(layerPtr(indexRawIO.get_ptr()), cfg);
+    compressIO.emplace(layerPtr(blockIO), layerPtr(indexCipherIO.get_ptr()),
+                       cfg);
+    blockIO = compressIO.get_ptr();
   }
+
+  passThrough = cfg->cipher->interface().name() == "nullCipher" &&
+                !cfg->config->uniqueIV && !macIO && !compressIO &&
+                !cfg->holeMaps && !cfg->reverseEncryption;
+
+  // the shared cache holds the blocks as seen by the user, so only the
+  // outermost layer uses it.  Pass-through files bypass the layers and the
+  // cache.
+  if (cfg->blockCache && !passThrough) {
+    blockIO->setSharedCache(cfg->blockCache);
+  }
+  // so is the hole map, its blocks are ours
+  if (cfg->holeMaps) {
+    holeMap = std::make_shared<HoleMap>();
+    holeMap->setPath(_cname);
+    blockIO->setHoleMap(holeMap);
+  }
+  io = layerPtr(blockIO);
 }
 
 FileNode::~FileNode() {
@@ -87,6 +139,12 @@ FileNode::~FileNode() {
   // pthread_mutex_lock( &mutex );
 
   canary = CANARY_DESTROYED;
+  if (_extendedSize >= 0 && extendLocked() < 0) {
+    RLOG(WARNING) << "unable to extend " << _cname << " to its size";
+  }
+  if (holeMap) {
+    holeMap->save();
+  }
   _pname.assign(_pname.length(), '\0');
   _cname.assign(_cname.length(), '\0');
   io.reset();
@@ -125,6 +183,9 @@ bool FileNode::setName(const char *plaintextName_, const char *cipherName_,
     if (cipherName_ != nullptr) {
       this->_cname = cipherName_;
       io->setFileName(cipherName_);
+      if (holeMap) {
+        holeMap->setPath(_cname);
+      }
     }
   } else {
     std::string oldPName = _pname;
@@ -138,9 +199,16 @@ bool FileNode::setName(const char *plaintextName_, const char *cipherName_,
       io->setFileName(cipherName_);
     }
 
+    if (holeMap) {
+      holeMap->setPath(_cname);
+    }
+
     if (fsConfig->config->externalIVChaining && !setIV(io, iv)) {
       _pname = oldPName;
       _cname = oldCName;
+      if (holeMap) {
+        holeMap->setPath(_cname);
+      }
       return false;
     }
   }
@@ -149,7 +217,7 @@ bool FileNode::setName(const char *plaintextName_, const char *cipherName_,
 }
 
 int FileNode::mknod(mode_t mode, dev_t rdev, uid_t uid, gid_t gid) {
-  Lock _lock(mutex);
+  ExclusiveLock _lock(mutex);
 
   int res;
   int olduid = -1;
@@ -177,7 +245,12 @@ int FileNode::mknod(mode_t mode, dev_t rdev, uid_t uid, gid_t gid) {
    * were a create method (advised to have)
    */
   if (S_ISREG(mode)) {
-    res = fs_layer::open(_cname.c_str(), O_CREAT | O_EXCL | O_WRONLY, mode);
+    if (fsConfig->dirHandles) {
+      res = fsConfig->dirHandles->open(_cname, O_CREAT | O_EXCL | O_WRONLY,
+                                       mode);
+    } else {
+      res = fs_layer::open(_cname.c_str(), O_CREAT | O_EXCL | O_WRONLY, mode);
+    }
     if (res >= 0) {
       res = fs_layer::close(res);
     }
@@ -212,24 +285,127 @@ int FileNode::mknod(mode_t mode, dev_t rdev, uid_t uid, gid_t gid) {
 }
 
 int FileNode::open(int flags) const {
-  Lock _lock(mutex);
+  ExclusiveLock _lock(mutex);
+
+  if (sealed) {
+    // nothing changes the file while mounted, so sizes and cached blocks
+    // need no check, and the layers aren't touched once it was opened.
+    // The readers rely on this and run without the lock.
+    if (sealedOpenResult >= 0) {
+      return sealedOpenResult;
+    }
+    int res = io->open(flags & ~(O_RDWR | O_WRONLY | O_CREAT | O_TRUNC));
+    if (res >= 0) {
+      if (holeMap) {
+        holeMap->load(true);
+      }
+      sealedOpenResult = res;
+    }
+    return res;
+  }
 
   int res = io->open(flags);
+  if (res >= 0 && !passThrough) {
+    // the file may have been changed by other programs since it was written
+    cipherIO.forgetSize();
+    if (macIO) {
+      macIO->forgetSize();
+    }
+    if (compressIO) {
+      compressIO->forgetSize();
+    }
+  }
+  if (res >= 0 && holeMap) {
+    holeMap->load();
+  }
+  if (res >= 0 && fsConfig->blockCache) {
+    // drop cached blocks if the file was modified behind our back
+    efs_stat stbuf;
+    if (io->getAttr(&stbuf, 0) == 0) {
+      fsConfig->blockCache->validate(_cname, stbuf.st_size, stbuf.st_mtime);
+    } else {
+      fsConfig->blockCache->forget(_cname);
+    }
+  }
   return res;
 }
 
+void FileNode::setAccessHint(AccessHint hint) {
+  ExclusiveLock _lock(mutex);
+
+  if (sealed) {
+    // set right after the first open, before the lockless readers start
+    if (hinted) {
+      return;
+    }
+    hinted = true;
+  }
+  rawIO.setUncachedSequential(fsConfig->opts->uncachedSequentialIO ||
+                              hint == Access_Sequential ||
+                              hint == Access_NoCache);
+  if (passThrough) {
+    return;
+  }
+  cipherIO.setAccessHint(hint);
+  if (macIO) {
+    macIO->setAccessHint(hint);
+  }
+  if (compressIO) {
+    compressIO->setAccessHint(hint);
+  }
+}
+
+// Without block MACs, the plaintext size follows from the size of the
+// backing file and the header, so the size queries skip the layers in
+// between.  The layers are members, the calls aren't dispatched virtually.
+// A compressed file has its size in its index.
 int FileNode::getAttr(efs_stat *stbuf, void *statCache) const {
-  Lock _lock(mutex);
+  SharedLock _lock = readerLock(mutex, sealed);
 
-  int res = io->getAttr(stbuf, statCache);
+  if (compressIO || macIO) {
+    int res = compressIO ? compressIO->getAttr(stbuf, statCache)
+                         : macIO->getAttr(stbuf, statCache);
+    if (res == 0 && stbuf->st_size < _extendedSize) {
+      stbuf->st_size = _extendedSize;
+    }
+    return res;
+  }
+  int res = rawIO.getAttr(stbuf, statCache);
+  if (res == 0 && S_ISREG(stbuf->st_mode)) {
+    stbuf->st_size = cipherIO.plainSize(stbuf->st_size);
+  }
+  if (res == 0 && stbuf->st_size < _extendedSize) {
+    stbuf->st_size = _extendedSize;
+  }
   return res;
 }
 
+bool FileNode::getOpenAttr(efs_stat *cipherStat, off_t *plainSize) const {
+  SharedLock _lock = readerLock(mutex, sealed);
+
+  if (compressIO || macIO || _extendedSize >= 0 ||
+      !rawIO.getOpenStat(cipherStat) || !S_ISREG(cipherStat->st_mode)) {
+    return false;
+  }
+  *plainSize = cipherIO.plainSize(cipherStat->st_size);
+  return *plainSize >= 0;
+}
+
 off_t FileNode::getSize() const {
-  Lock _lock(mutex);
+  SharedLock _lock = readerLock(mutex, sealed);
 
-  off_t res = io->getSize();
-  return res;
+  off_t size;
+  if (compressIO) {
+    size = compressIO->getSize();
+  } else if (macIO) {
+    size = macIO->getSize();
+  } else {
+    size = cipherIO.plainSize(rawIO.getSize());
+  }
+  if (size >= 0 && size < _extendedSize) {
+    return _extendedSize;
+  }
+  return size;
 }
 
 ssize_t FileNode::read(off_t offset, unsigned char *data, size_t size) const {
@@ -238,9 +414,32 @@ ssize_t FileNode::read(off_t offset, unsigned char *data, size_t size) const {
   req.dataLen = size;
   req.data = data;
 
-  Lock _lock(mutex);
+  SharedLock _lock = readerLock(mutex, sealed);
 
-  return io->read(req);
+  ssize_t res = passThrough ? rawIO.read(req) : io->read(req);
+  // the data ends before the lazily extended size
+  if (res >= 0 && (size_t)res < size && offset + res < _extendedSize) {
+    size_t zeros = (size_t)min((off_t)(size - res), _extendedSize - offset - res);
+    memset(data + res, 0, zeros);
+    res += zeros;
+  }
+  return res;
+}
+
+ssize_t FileNode::verifyBlocks(off_t firstBlock, size_t count,
+                               std::vector<off_t> &badBlocks) const {
+  if (!macIO || fsConfig->config->blockMACBytes == 0) {
+    return -ENOTSUP;
+  }
+
+  SharedLock _lock = readerLock(mutex, sealed);
+
+  return macIO->verifyBlocks(firstBlock, count, badBlocks);
+}
+
+int FileNode::dataBlockSize() const {
+  return fsConfig->config->blockSize - fsConfig->config->blockMACBytes -
+         fsConfig->config->blockMACRandBytes;
 }
 
 ssize_t FileNode::write(off_t offset, unsigned char *data, size_t size) {
@@ -251,46 +450,82 @@ ssize_t FileNode::write(off_t offset, unsigned char *data, size_t size) {
   req.dataLen = size;
   req.data = data;
 
-  Lock _lock(mutex);
+  if (sealed) {
+    return -EROFS;
+  }
+  ExclusiveLock _lock(mutex);
 
-  ssize_t res = io->write(req);
+  ssize_t res = passThrough ? rawIO.write(req) : io->write(req);
   // Of course due to encryption we genrally write more than requested
   if (res < 0) {
     return res;
   }
+  if (_extendedSize >= 0 && offset + (off_t)size >= _extendedSize) {
+    _extendedSize = -1;
+  }
   return size;
 }
 
 int FileNode::truncate(off_t size) {
-  Lock _lock(mutex);
+  if (sealed) {
+    return -EROFS;
+  }
+  ExclusiveLock _lock(mutex);
+
+  if (fsConfig->opts->lazyExtend) {
+    // applications which set the size before writing the data, like most
+    // copy engines, would pay for padding which is overwritten right away
+    off_t dataSize = io->getSize();
+    if (dataSize >= 0 && size > dataSize) {
+      _extendedSize = size;
+      return 0;
+    }
+  }
+  _extendedSize = -1;
+  return passThrough ? rawIO.truncate(size) : io->truncate(size);
+}
+
+int FileNode::applyExtendedSize() {
+  if (sealed) {
+    return 0;
+  }
+  ExclusiveLock _lock(mutex);
+
+  if (_extendedSize < 0) {
+    return 0;
+  }
+  int res = extendLocked();
+  return (res < 0) ? res : 1;
+}
 
-  return io->truncate(size);
+bool FileNode::hasExtendedSize() const {
+  SharedLock _lock = readerLock(mutex, sealed);
+  return _extendedSize >= 0;
+}
+
+int FileNode::extendLocked() {
+  off_t size = _extendedSize;
+  _extendedSize = -1;
+  return passThrough ? rawIO.truncate(size) : io->truncate(size);
 }
 
 int FileNode::sync(bool datasync) {
-  Lock _lock(mutex);
-
-  int fh = io->open(O_RDONLY);
-  if (fh >= 0) {
-    int res = -EIO;
-#if defined(HAVE_FDATASYNC)
-    if (datasync) {
-      res = fdatasync(fh);
-    } else {
-      res = fsync(fh);
-    }
-#else
-    (void)datasync;
-    res = fs_layer::fsync(fh);
-#endif
+  if (sealed) {
+    return 0;  // nothing was written
+  }
+  ExclusiveLock _lock(mutex);
 
-    if (res == -1) {
-      res = -errno;
+  if (_extendedSize >= 0) {
+    int res = extendLocked();
+    if (res < 0) {
+      return res;
     }
-
-    return res;
   }
-  return fh;
+  int res = io->sync(datasync);
+  if (res == 0 && holeMap) {
+    holeMap->save();
+  }
+  return res;
 }
 
 }  // namespace encfs
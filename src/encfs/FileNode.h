@@ -24,14 +24,21 @@
 #include <atomic>
 #include <inttypes.h>
 #include <memory>
+#include <boost/optional.hpp>
 #include <boost/thread.hpp>
 #include <stdint.h>
 #include <string>
 #include <sys/types.h>
+#include <vector>
 
+#include "CipherFileIO.h"
 #include "CipherKey.h"
+#include "CompressedFileIO.h"
 #include "FSConfig.h"
 #include "FileUtils.h"
+#include "HoleMap.h"
+#include "MACFileIO.h"
+#include "RawFileIO.h"
 #include "encfs.h"
 
 #define CANARY_OK 0x46040975
@@ -78,16 +85,43 @@ class FileNode {
   // getAttr returns 0 on success, -errno on failure
   int getAttr(efs_stat *stbuf, void *statCache) const;
   off_t getSize() const;
+  // the attributes of the backing file taken by the last open(), and the
+  // plaintext size following from them, see RawFileIO::getOpenStat().
+  // Returns false if they aren't known, or the size needs the layers or is
+  // extended lazily.
+  bool getOpenAttr(efs_stat *cipherStat, off_t *plainSize) const;
 
   ssize_t read(off_t offset, unsigned char *data, size_t size) const;
+
+  // check the MACs of count blocks from block firstBlock on, see
+  // MACFileIO::verifyBlocks().  Returns -ENOTSUP if the volume has no MACs
+  ssize_t verifyBlocks(off_t firstBlock, size_t count,
+                       std::vector<off_t> &badBlocks) const;
+  // size of the data of a block, without the MAC header
+  int dataBlockSize() const;
   ssize_t write(off_t offset, unsigned char *data, size_t size);
 
-  // truncate the file to a particular size
+  // truncate the file to a particular size.  With the lazyExtend option, a
+  // file which grows only gets its new size, the data from its end on reads
+  // as zeros until it is written, or until the node is synced or destroyed
   int truncate(off_t size);
+  // writes out the size of a lazy extension, when the file is closed.
+  // Returns 1 if the file was extended, 0 if it wasn't extended lazily
+  int applyExtendedSize();
+  // whether the file was extended lazily and its size isn't written out yet:
+  // the size follows from getAttr() or getSize() only, not from the stat of
+  // the backing file
+  bool hasExtendedSize() const;
 
   // datasync or full sync
   int sync(bool dataSync);
 
+  // how the file is used until the next hint.  Sequential files are kept
+  // out of the system cache (see RawFileIO::setUncachedSequential()) and,
+  // like write-once files, out of the shared block cache.  Uncached files
+  // bypass the block caches altogether, see BlockFileIO::setAccessHint().
+  void setAccessHint(AccessHint hint);
+
  private:
   // doing locking at the FileNode level isn't as efficient as at the
   // lowest level of RawFileIO, since that means locks are held longer
@@ -95,11 +129,39 @@ class FileNode {
   // easier to avoid any race conditions with operations such as
   // truncate() which may result in multiple calls down to the FileIO
   // level.
-  mutable boost::mutex mutex;
+  // Reads, getAttr() and getSize() share the lock, the FileIO layers
+  // protect the state they change while reading.  Everything else holds
+  // it exclusively.  On a sealed volume the readers don't take it at all,
+  // see open().
+  mutable boost::shared_mutex mutex;
 
   FSConfigPtr fsConfig;
 
+  // the FileIO layers are members, so that a FileNode is a single
+  // allocation.  io and the bases of the layers don't own them
+  RawFileIO rawIO;
+  CipherFileIO cipherIO;
+  boost::optional<MACFileIO> macIO;
+  // the index of a compressed file and the layer compressing it
+  boost::optional<RawFileIO> indexRawIO;
+  boost::optional<CipherFileIO> indexCipherIO;
+  boost::optional<CompressedFileIO> compressIO;
   std::shared_ptr<FileIO> io;
+  // holes of the file, if the volume keeps hole maps
+  std::shared_ptr<HoleMap> holeMap;
+  // the data is stored as it is (null cipher, no header, MACs, compression or
+  // hole map), reads, writes and truncates go straight to rawIO
+  bool passThrough;
+  // the volume is mounted read-only and doesn't change while mounted: the
+  // file is never written, and what the layers learned of it stays valid
+  bool sealed;
+  // of a sealed file, the result of the first successful open(), or -1.
+  // Later opens return it without touching the layers
+  mutable int sealedOpenResult;
+  bool hinted;  // a sealed file keeps the hint it was first opened with
+  // size set by a lazy extending truncate, beyond the end of the data of io,
+  // or -1
+  off_t _extendedSize;
   std::string _pname;  // plaintext name
   std::string _cname;  // encrypted name
   DirNode *parent;
@@ -107,6 +169,9 @@ class FileNode {
  private:
   FileNode(const FileNode &src);
   FileNode &operator=(const FileNode &src);
+
+  // extends the file to _extendedSize, with the lock held
+  int extendLocked();
 };
 
 }  // namespace encfs
@@ -48,19 +48,27 @@
 #endif
 #include <vector>
 
+#include "BlockCache.h"
 #include "BlockNameIO.h"
 #include "Cipher.h"
 #include "CipherKey.h"
+#include "CompressedFileIO.h"
 #include "ConfigReader.h"
 #include "ConfigVar.h"
 #include "Context.h"
+#include "DescriptorPool.h"
+#include "DirHandleCache.h"
 #include "DirNode.h"
 #include "Error.h"
 #include "FSConfig.h"
+#include "FileIVCache.h"
 #include "FileUtils.h"
 #include "Interface.h"
+#include "NameCodingCache.h"
 #include "NameIO.h"
+#include "NullNameIO.h"
 #include "Range.h"
+#include "VolumeKeyCache.h"
 #include "XmlReader.h"
 #include "autosprintf.h"
 #include "base64.h"
@@ -75,6 +83,8 @@ using gnu::autosprintf;
 namespace encfs {
 
 static const int DefaultBlockSize = 1024;
+// bytes of file data compressed together, if compression is enabled
+static const int DefaultCompressBlockSize = 64 * 1024;
 // The maximum length of text passwords.  If longer are needed,
 // use the extpass option, as extpass can return arbitrary length binary data.
 static const int MaxPassBuf = 512;
@@ -82,6 +92,15 @@ static const int MaxPassBuf = 512;
 static const int NormalKDFDuration = 500;     // 1/2 a second
 static const int ParanoiaKDFDuration = 3000;  // 3 seconds
 
+// number of file IV headers remembered per filesystem
+static const size_t FileIVCacheEntries = 4096;
+// number of coded filename components remembered per filesystem
+static const size_t NameCodingCacheEntries = 8192;
+// number of directory paths whose coding is remembered per filesystem
+static const size_t NameCodingCacheDirs = 4096;
+// milliseconds a pooled backing file descriptor stays open without reuse
+static const int DescriptorPoolMaxIdle = 2000;
+
 // environment variable names for values encfs stores in the environment when
 // calling an external password program.
 static const char ENCFS_ENV_ROOTDIR[] = "encfs_root";
@@ -125,6 +144,17 @@ struct ConfigInfo {
     {".encfs", Config_Prehistoric, nullptr, nullptr, nullptr, 0, 0},
     {nullptr, Config_None, nullptr, nullptr, nullptr, 0, 0}};
 
+/**
+ * The hole maps need zero-block pass-through, and cipher names which can't
+ * end in HoleMap::holeMapSuffix.  Reverse mode has no holes to remember, a
+ * compressed file keeps its holes in its index.
+ */
+static bool useHoleMaps(const EncFSConfig *config, bool reverseEncryption) {
+  return config->holeMap && config->allowHoles && !reverseEncryption &&
+         config->compressIface.name().empty() &&
+         config->nameIface.name() != NullNameIO::CurrentInterface().name();
+}
+
 EncFS_Root::EncFS_Root() = default;
 
 EncFS_Root::~EncFS_Root() = default;
@@ -226,10 +256,14 @@ ConfigType readConfig_load(ConfigInfo *nm, const char *path,
 
 /**
  * Try to locate the config file
- * Tries the most recent format first, then looks for older versions
+ * Tries the most recent format first, then looks for older versions.
+ * Sets isOverride if the file is named by the environment, which is returned
+ * without checking whether it exists.
  */
-ConfigType readConfig(const string &rootDir, EncFSConfig *config,
-	bool useExternalConfigFile, const std::string &externalConfigFileName) {
+static ConfigInfo *findConfig(const string &rootDir, bool useExternalConfigFile,
+                              const std::string &externalConfigFileName,
+                              string *path, bool *isOverride) {
+  *isOverride = false;
   ConfigInfo *nm = ConfigFileMapping;
   while (nm->fileName != nullptr) {
    // allow command line argument to override default config path 
@@ -245,31 +279,104 @@ ConfigType readConfig(const string &rootDir, EncFSConfig *config,
     if (nm->environmentOverride != nullptr) {
       char *envFile = getenv(nm->environmentOverride);
       if (envFile != nullptr) {
-        if (!fileExists(envFile)) {
-          RLOG(ERROR)
-              << "fatal: config file specified by environment does not exist: "
-              << envFile;
-          exit(1);
-        }
-        return readConfig_load(nm, envFile, config);
+        *path = envFile;
+        *isOverride = true;
+        return nm;
       }
     }
     // Added by R. Hiestand
     if( useExternalConfigFile )
     {
         if( fileExists( externalConfigFileName.c_str() ) )
-            return readConfig_load( nm, externalConfigFileName.c_str(), config );
+        {
+            *path = externalConfigFileName;
+            return nm;
+        }
     }
     // the standard place to look is in the root directory
-    string path = rootDir + nm->fileName;
-    if (fileExists(path.c_str())) {
-      return readConfig_load(nm, path.c_str(), config);
+    *path = rootDir + nm->fileName;
+    if (fileExists(path->c_str())) {
+      return nm;
     }
 
     ++nm;
   }
 
-  return Config_None;
+  return nullptr;
+}
+
+ConfigType readConfig(const string &rootDir, EncFSConfig *config,
+	bool useExternalConfigFile, const std::string &externalConfigFileName) {
+  string path;
+  bool isOverride;
+  ConfigInfo *nm = findConfig(rootDir, useExternalConfigFile,
+                              externalConfigFileName, &path, &isOverride);
+  if (nm == nullptr) {
+    return Config_None;
+  }
+  if (isOverride && !fileExists(path.c_str())) {
+    RLOG(ERROR)
+        << "fatal: config file specified by environment does not exist: "
+        << path;
+    exit(1);
+  }
+  return readConfig_load(nm, path.c_str(), config);
+}
+
+static XmlValuePtr findV6Config(const XmlReader &rdr, const char *configFile);
+static bool readV6Params(const XmlValuePtr &config, EncFSConfig *cfg);
+
+bool probeConfig(const string &rootDir, bool useExternalConfigFile,
+                 const std::string &externalConfigFileName,
+                 ConfigProbe *probe) {
+  *probe = ConfigProbe();
+
+  bool isOverride;
+  ConfigInfo *nm = findConfig(rootDir, useExternalConfigFile,
+                              externalConfigFileName, &probe->fileName,
+                              &isOverride);
+  if (nm == nullptr) {
+    return false;
+  }
+  if (isOverride && !fileExists(probe->fileName.c_str())) {
+    RLOG(WARNING) << "config file specified by environment does not exist: "
+                  << probe->fileName;
+    return false;
+  }
+
+  EncFSConfig *cfg = &probe->config;
+  bool ok = false;
+  try {
+    if (nm->type == Config_V6) {
+      XmlReader rdr;
+      if (rdr.load(probe->fileName.c_str())) {
+        XmlValuePtr config = findV6Config(rdr, probe->fileName.c_str());
+        ok = config && readV6Params(config, cfg);
+        if (ok && cfg->subVersion >= 20080816) {
+          config->read("saltLen", &probe->saltLen);
+        }
+      }
+    } else if (nm->loadFunc != nullptr) {
+      // the old formats are small and keep the key as text, so they are
+      // read completely and the key dropped
+      ok = (*nm->loadFunc)(probe->fileName.c_str(), cfg, nm);
+      cfg->keyData.clear();
+    } else {
+      ok = true;  // unsupported type, only the type is known
+    }
+  } catch (encfs::Error &err) {
+    RLOG(WARNING) << "probeConfig error: " << err.what();
+    ok = false;
+  }
+
+  if (!ok) {
+    RLOG(WARNING) << "Found config file " << probe->fileName
+                  << ", but failed to parse it";
+    return false;
+  }
+  cfg->cfgType = nm->type;
+  probe->type = nm->type;
+  return true;
 }
 
 /**
@@ -286,6 +393,31 @@ bool readV6Config(const char *configFile, EncFSConfig *cfg, ConfigInfo *info) {
     return false;
   }
 
+  XmlValuePtr config = findV6Config(rdr, configFile);
+  if (!config || !readV6Params(config, cfg)) {
+    return false;
+  }
+
+  int encodedSize;
+  config->read("encodedKeySize", &encodedSize);
+  auto *key = new unsigned char[encodedSize];
+  config->readB64("encodedKeyData", key, encodedSize);
+  cfg->assignKeyData(key, encodedSize);
+  delete[] key;
+
+  if (cfg->subVersion >= 20080816) {
+    int saltLen;
+    config->read("saltLen", &saltLen);
+    auto *salt = new unsigned char[saltLen];
+    config->readB64("saltData", salt, saltLen);
+    cfg->assignSaltData(salt, saltLen);
+    delete[] salt;
+  }
+
+  return true;
+}
+
+static XmlValuePtr findV6Config(const XmlReader &rdr, const char *configFile) {
   XmlValuePtr serialization = rdr["boost_serialization"];
   XmlValuePtr config = (*serialization)["cfg"];
   if (!config) {
@@ -293,9 +425,14 @@ bool readV6Config(const char *configFile, EncFSConfig *cfg, ConfigInfo *info) {
   }
   if (!config) {
     RLOG(ERROR) << "Unable to find XML configuration in file " << configFile;
-    return false;
   }
+  return config;
+}
 
+/**
+ * Reads everything of a V6 config except the key data and the salt
+ */
+static bool readV6Params(const XmlValuePtr &config, EncFSConfig *cfg) {
   int version;
   if (!config->read("version", &version) &&
       !config->read("@version", &version)) {
@@ -335,22 +472,11 @@ bool readV6Config(const char *configFile, EncFSConfig *cfg, ConfigInfo *info) {
   config->read("blockMACBytes", &cfg->blockMACBytes);
   config->read("blockMACRandBytes", &cfg->blockMACRandBytes);
   config->read("allowHoles", &cfg->allowHoles);
-
-  int encodedSize;
-  config->read("encodedKeySize", &encodedSize);
-  auto *key = new unsigned char[encodedSize];
-  config->readB64("encodedKeyData", key, encodedSize);
-  cfg->assignKeyData(key, encodedSize);
-  delete[] key;
+  config->read("holeMap", &cfg->holeMap);
+  config->read("compression", &cfg->compressIface);
+  config->read("compressBlockSize", &cfg->compressBlockSize);
 
   if (cfg->subVersion >= 20080816) {
-    int saltLen;
-    config->read("saltLen", &saltLen);
-    auto *salt = new unsigned char[saltLen];
-    config->readB64("saltData", salt, saltLen);
-    cfg->assignSaltData(salt, saltLen);
-    delete[] salt;
-
     config->read("kdfIterations", &cfg->kdfIterations);
     config->read("desiredKDFDuration", &cfg->desiredKDFDuration);
   } else {
@@ -570,6 +696,16 @@ bool writeV6Config(const char *configFile, const EncFSConfig *cfg) {
   addEl(doc, config, "blockMACBytes", cfg->blockMACBytes);
   addEl(doc, config, "blockMACRandBytes", cfg->blockMACRandBytes);
   addEl(doc, config, "allowHoles", (int)cfg->allowHoles);
+  if (cfg->holeMap) {
+    // only written when set, so other versions see the config they know
+    addEl(doc, config, "holeMap", (int)cfg->holeMap);
+  }
+  if (!cfg->compressIface.name().empty()) {
+    // only written when set.  Versions without compression ignore it, and
+    // show the compressed data as it is
+    addEl(doc, config, "compression", cfg->compressIface);
+    addEl(doc, config, "compressBlockSize", cfg->compressBlockSize);
+  }
   addEl(doc, config, "encodedKeySize", (int)cfg->keyData.size());
   addEl(doc, config, "encodedKeyData", cfg->keyData);
   addEl(doc, config, "saltLen", (int)cfg->salt.size());
@@ -817,6 +953,8 @@ static int selectBlockSize(const Cipher::CipherAlgorithm &alg) {
       // xgroup(setup)
       _("Select a block size in bytes.  The cipher you have chosen\n"
         "supports sizes from %i to %i bytes in increments of %i.\n"
+        "Blocks of 64 KB and more speed up large files, but every\n"
+        "smaller write has to read and write a whole block.\n"
         "Or just hit enter for the default (%i bytes)\n"),
       alg.blockSize.min(), alg.blockSize.max(), alg.blockSize.inc(),
       DefaultBlockSize);
@@ -1007,6 +1145,20 @@ static bool selectZeroBlockPassThrough() {
         "This avoids writing encrypted blocks when file holes are created."));
 }
 
+/**
+ * Ask the user if the file data should be compressed, if this build can
+ */
+static bool selectCompression() {
+  if (CompressedFileIO::CurrentInterface().name().empty()) {
+    return false;
+  }
+  // xgroup(setup)
+  return boolDefaultNo(
+      _("Enable compression of file data?\n"
+        "This saves space with compressible files, but the volume can only\n"
+        "be used with versions which support it."));
+}
+
 RootPtr createV6Config(EncFS_Context *ctx,
                        const std::shared_ptr<EncFS_Opts> &opts) {
   const std::string rootDir = opts->rootDir;
@@ -1056,6 +1208,7 @@ RootPtr createV6Config(EncFS_Context *ctx,
   bool chainedIV = true;        // selectChainedIV()
   bool externalIV = false;      // selectExternalChainedIV()
   bool allowHoles = true;       // selectZeroBlockPassThrough()
+  bool compress = false;        // selectCompression()
   long desiredKDFDuration = NormalKDFDuration;
 
   if (reverseEncryption) {
@@ -1167,6 +1320,10 @@ RootPtr createV6Config(EncFS_Context *ctx,
         }
         selectBlockMAC(&blockMACBytes, &blockMACRandBytes, opts->requireMac);
         allowHoles = selectZeroBlockPassThrough();
+        // the index files need cipher names which can't end in their suffix
+        compress =
+            nameIOIface.name() != NullNameIO::CurrentInterface().name() &&
+            selectCompression();
       }
     }
   }
@@ -1197,6 +1354,10 @@ RootPtr createV6Config(EncFS_Context *ctx,
   config->chainedNameIV = chainedIV;
   config->externalIVChaining = externalIV;
   config->allowHoles = allowHoles;
+  if (compress) {
+    config->compressIface = CompressedFileIO::CurrentInterface();
+    config->compressBlockSize = DefaultCompressBlockSize;
+  }
 
   config->salt.clear();
   config->kdfIterations = 0;  // filled in by keying function
@@ -1277,6 +1438,10 @@ RootPtr createV6Config(EncFS_Context *ctx,
 
   nameCoder->setChainedNameIV(config->chainedNameIV);
   nameCoder->setReverseEncryption(reverseEncryption);
+  if (!opts->noCache) {
+    nameCoder->setNameCache(std::make_shared<NameCodingCache>(
+        NameCodingCacheEntries, NameCodingCacheDirs));
+  }
 
   FSConfigPtr fsConfig(new FSConfig);
   if (plainData) {
@@ -1291,13 +1456,34 @@ RootPtr createV6Config(EncFS_Context *ctx,
   fsConfig->config = config;
   fsConfig->forceDecode = forceDecode;
   fsConfig->reverseEncryption = reverseEncryption;
+  fsConfig->holeMaps = useHoleMaps(config.get(), reverseEncryption);
   fsConfig->idleTracking = enableIdleTracking;
   fsConfig->opts = opts;
+  if (opts->sharedBlockCacheBytes > 0 && !opts->noCache && !reverseEncryption) {
+    fsConfig->blockCache =
+        std::make_shared<BlockCache>(opts->sharedBlockCacheBytes);
+  }
+  if (config->uniqueIV && !opts->noCache && !reverseEncryption) {
+    fsConfig->ivCache = std::make_shared<FileIVCache>(FileIVCacheEntries);
+  }
+  if (opts->descriptorPoolSize > 0 && !opts->noCache && !reverseEncryption) {
+    fsConfig->fdPool = std::make_shared<DescriptorPool>(
+        opts->descriptorPoolSize, DescriptorPoolMaxIdle);
+  }
+  if (opts->dirHandleCacheSize > 0 && !opts->noCache) {
+    fsConfig->dirHandles =
+        std::make_shared<DirHandleCache>(opts->dirHandleCacheSize);
+  }
+  fsConfig->codingNanos = std::make_shared<std::atomic<uint64_t>>(0);
 
   rootInfo = std::make_shared<encfs::EncFS_Root>();
   rootInfo->cipher = cipher;
   rootInfo->volumeKey = volumeKey;
   rootInfo->root = std::make_shared<DirNode>(ctx, rootDir, fsConfig);
+  rootInfo->blockCache = fsConfig->blockCache;
+  rootInfo->dirHandles = fsConfig->dirHandles;
+  rootInfo->nameCache = nameCoder->getNameCache();
+  rootInfo->codingNanos = fsConfig->codingNanos;
 
   return rootInfo;
 }
@@ -1405,6 +1591,23 @@ void showFSInfo(const EncFSConfig *config) {
     // xgroup(diag)
     cout << _("File holes passed through to ciphertext.\n");
   }
+  if (config->holeMap) {
+    // xgroup(diag)
+    cout << _("File holes remembered in hole maps.\n");
+  }
+  if (!config->compressIface.name().empty()) {
+    // xgroup(diag)
+    cout << autosprintf(_("File data compressed using \"%s\" in blocks of "
+                          "%i bytes"),
+                        config->compressIface.name().c_str(),
+                        config->compressBlockSize);
+    if (!CompressedFileIO::isSupported(config->compressIface)) {
+      // xgroup(diag)
+      cout << _(" (NOT supported)\n");
+    } else {
+      cout << "\n";
+    }
+  }
   cout << "\n";
 }
 std::shared_ptr<Cipher> EncFSConfig::getCipher() const {
@@ -1608,33 +1811,58 @@ RootPtr initFS(EncFS_Context *ctx, const std::shared_ptr<EncFS_Opts> &opts,
       return rootInfo;
     }
 
-    // get user key
-    CipherKey userKey;
+    // a volume mounted before with the same password doesn't need the key
+    // derivation again.  The password is passed in passwordProgram.
+    const bool useKeyCache =
+        opts->cacheVolumeKey && !opts->passwordProgram.empty();
+    std::string volumeId = opts->rootDir;
+    if (opts->useExternalConfigFile) {
+      volumeId += '\n' + opts->externalConfigFileName;
+    }
 
-    if (opts->passwordProgram.empty()) {
-      VLOG(1) << "useStdin: " << opts->useStdin;
-      if (opts->annotate) {
-        ostr << "$PROMPT$ passwd" << endl;
+    CipherKey volumeKey;
+    if (useKeyCache) {
+      volumeKey = VolumeKeyCache::instance().lookup(volumeId, config->keyData,
+                                                    opts->passwordProgram);
+      if (volumeKey) {
+        VLOG(1) << "using the cached volume key";
       }
-      userKey = config->getUserKey(opts->useStdin);
-    } else {
-      userKey = config->getUserKey(opts->passwordProgram, opts->rootDir);
     }
 
-    if (!userKey) {
-      return rootInfo;
-    }
+    if (!volumeKey) {
+      // get user key
+      CipherKey userKey;
 
-    VLOG(1) << "cipher key size = " << cipher->encodedKeySize();
-    // decode volume key..
-    CipherKey volumeKey =
-        cipher->readKey(config->getKeyData(), userKey, opts->checkKey);
-    userKey.reset();
+      if (opts->passwordProgram.empty()) {
+        VLOG(1) << "useStdin: " << opts->useStdin;
+        if (opts->annotate) {
+          ostr << "$PROMPT$ passwd" << endl;
+        }
+        userKey = config->getUserKey(opts->useStdin);
+      } else {
+        userKey = config->getUserKey(opts->passwordProgram, opts->rootDir);
+      }
 
-    if (!volumeKey) {
-      // xgroup(diag)
-      ostr << _("Error decoding volume key, password incorrect\n");
-      return rootInfo;
+      if (!userKey) {
+        return rootInfo;
+      }
+
+      VLOG(1) << "cipher key size = " << cipher->encodedKeySize();
+      // decode volume key..
+      volumeKey =
+          cipher->readKey(config->getKeyData(), userKey, opts->checkKey);
+      userKey.reset();
+
+      if (!volumeKey) {
+        // xgroup(diag)
+        ostr << _("Error decoding volume key, password incorrect\n");
+        return rootInfo;
+      }
+
+      if (useKeyCache) {
+        VolumeKeyCache::instance().insert(volumeId, config->keyData,
+                                          opts->passwordProgram, volumeKey);
+      }
     }
 
     std::shared_ptr<NameIO> nameCoder =
@@ -1651,8 +1879,27 @@ RootPtr initFS(EncFS_Context *ctx, const std::shared_ptr<EncFS_Opts> &opts,
       return rootInfo;
     }
 
+    if (!config->compressIface.name().empty() &&
+        (!CompressedFileIO::isSupported(config->compressIface) ||
+         config->compressBlockSize <= 0 || opts->reverseEncryption)) {
+      ostr << autosprintf(
+          _("Unable to find compression interface '%s', version %i:%i:%i"),
+          config->compressIface.name().c_str(),
+          config->compressIface.current(), config->compressIface.revision(),
+          config->compressIface.age());
+      // xgroup(diag)
+      ostr << _(
+          "The requested compression interface is "
+          "not available\n");
+      return rootInfo;
+    }
+
     nameCoder->setChainedNameIV(config->chainedNameIV);
     nameCoder->setReverseEncryption(opts->reverseEncryption);
+    if (!opts->noCache) {
+      nameCoder->setNameCache(std::make_shared<NameCodingCache>(
+          NameCodingCacheEntries, NameCodingCacheDirs));
+    }
 
     FSConfigPtr fsConfig(new FSConfig);
     if (config->plainData) {
@@ -1671,12 +1918,40 @@ RootPtr initFS(EncFS_Context *ctx, const std::shared_ptr<EncFS_Opts> &opts,
     fsConfig->config = config;
     fsConfig->forceDecode = opts->forceDecode;
     fsConfig->reverseEncryption = opts->reverseEncryption;
+    fsConfig->holeMaps = useHoleMaps(config.get(), opts->reverseEncryption);
     fsConfig->opts = opts;
+    if (opts->sharedBlockCacheBytes > 0 && !opts->noCache &&
+        !opts->reverseEncryption) {
+      // reverse mode can't cache, the plaintext files may change any time
+      fsConfig->blockCache =
+          std::make_shared<BlockCache>(opts->sharedBlockCacheBytes);
+    }
+    if (config->uniqueIV && !opts->noCache && !opts->reverseEncryption) {
+      fsConfig->ivCache = std::make_shared<FileIVCache>(FileIVCacheEntries);
+    }
+    if (opts->descriptorPoolSize > 0 && !opts->noCache &&
+        !opts->reverseEncryption) {
+      fsConfig->fdPool = std::make_shared<DescriptorPool>(
+          opts->descriptorPoolSize, DescriptorPoolMaxIdle);
+    }
+    if (opts->dirHandleCacheSize > 0 && !opts->noCache) {
+      fsConfig->dirHandles =
+          std::make_shared<DirHandleCache>(opts->dirHandleCacheSize);
+    }
+    fsConfig->codingNanos = std::make_shared<std::atomic<uint64_t>>(0);
 
     rootInfo = std::make_shared<encfs::EncFS_Root>();
     rootInfo->cipher = cipher;
     rootInfo->volumeKey = volumeKey;
     rootInfo->root = std::make_shared<DirNode>(ctx, opts->rootDir, fsConfig);
+    rootInfo->blockCache = fsConfig->blockCache;
+    rootInfo->dirHandles = fsConfig->dirHandles;
+    rootInfo->nameCache = nameCoder->getNameCache();
+    rootInfo->codingNanos = fsConfig->codingNanos;
+
+    if (rootInfo->root->hasDirectoryNameDependency()) {
+      rootInfo->root->resumeRename();
+    }
   } else {
     if (opts->createIfNotFound) {
       // creating a new encrypted filesystem
@@ -52,11 +52,16 @@ bool userAllowMkdir(int promptno, const char *dirPath, mode_t mode);
 
 class Cipher;
 class DirNode;
+class NameCodingCache;
 
 struct EncFS_Root {
   std::shared_ptr<Cipher> cipher;
   CipherKey volumeKey;
   std::shared_ptr<DirNode> root;
+  std::shared_ptr<BlockCache> blockCache;  // from FSConfig, may be null
+  std::shared_ptr<DirHandleCache> dirHandles;  // from FSConfig, may be null
+  std::shared_ptr<NameCodingCache> nameCache;  // from the NameIO, may be null
+  std::shared_ptr<std::atomic<uint64_t>> codingNanos;  // from FSConfig
 
   EncFS_Root();
   ~EncFS_Root();
@@ -98,12 +103,28 @@ struct EncFS_Opts {
                  * behind the back of EncFS (for example, in reverse mode).
                  * See main.cpp for a longer explaination. */
 
-  bool readOnly;  // Mount read-only
+  int blockCacheSize;  // number of blocks cached per file by BlockFileIO
+  size_t sharedBlockCacheBytes;  // budget of the cache shared by all files,
+                                 // 0 to disable it
+  int descriptorPoolSize;  // backing file descriptors kept open for reuse
+                           // after the files are closed, 0 to disable it
+  int dirHandleCacheSize;  // backing folder handles kept open, 0 to disable
+
+  bool readOnly;  // Mount read-only.  The volume is sealed: nothing changes
+                  // it while mounted, see FileNode
 
   bool insecure; // Allow to use plain data / to disable data encoding
 
   bool requireMac;  // Throw an error if MAC is disabled
 
+  bool cacheVolumeKey;  // remember the volume key for later mounts of this
+                        // process, see VolumeKeyCache
+
+  bool mapBackingFiles;  // read files open for reading through mapped views
+  bool uncachedSequentialIO;  // keep large sequential transfers out of the
+                              // system cache
+  bool lazyExtend;  // extending truncates only set the size, see FileNode
+
   ConfigMode configMode;
   std::string config;  // path to configuration file (or empty)
 
@@ -125,9 +146,17 @@ struct EncFS_Opts {
     reverseEncryption = false;
     configMode = Config_Prompt;
     noCache = false;
+    blockCacheSize = 8;
+    sharedBlockCacheBytes = 0;
+    descriptorPoolSize = 0;
+    dirHandleCacheSize = 0;
     readOnly = false;
     insecure = false;
     requireMac = false;
+    cacheVolumeKey = false;
+    mapBackingFiles = false;
+    uncachedSequentialIO = false;
+    lazyExtend = false;
     useExternalConfigFile = false;
   }
 };
@@ -138,6 +167,29 @@ struct EncFS_Opts {
 ConfigType readConfig(const std::string &rootDir, EncFSConfig *config,
 	bool useExternalConfigFile, const std::string &externalConfigFileName);
 
+/*
+    What probeConfig() found out about a volume without loading its key.
+    config has everything but the key data and the salt.
+*/
+struct ConfigProbe {
+  ConfigType type;
+  std::string fileName;  // the config file which was read
+  EncFSConfig config;
+  int saltLen;           // bytes of salt, 0 if the format has none
+
+  ConfigProbe() : type(Config_None), saltLen(0) {}
+};
+
+/*
+    Find the config file like readConfig() and read the format, cipher,
+    block size and flags with one parse, without decoding the key data.
+    Meant for listing many volumes: returns false if there is no config
+    or it can't be parsed, where readConfig() exits.
+*/
+bool probeConfig(const std::string &rootDir, bool useExternalConfigFile,
+                 const std::string &externalConfigFileName,
+                 ConfigProbe *probe);
+
 /*
     Save the configuration.  Saves back as the same configuration type as was
     read from.
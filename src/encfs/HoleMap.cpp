@@ -0,0 +1,282 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "HoleMap.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "fs_layer.h"
+
+#include "Error.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+// names encoded by the block and stream name codings never contain a '.'
+const char HoleMap::holeMapSuffix[] = ".encfs6.holes";
+
+// "EFSHOLE1", size and mtime of the cipher file, number of holes, then first
+// block and count of each hole.  All numbers 64 bit little endian.
+static const char holeMapMagic[8] = {'E', 'F', 'S', 'H', 'O', 'L', 'E', '1'};
+static const size_t holeMapHeaderSize = 8 + 3 * 8;
+
+static void putValue(std::string &out, uint64_t value) {
+  for (int i = 0; i < 8; ++i) {
+    out.push_back((char)(value & 0xff));
+    value >>= 8;
+  }
+}
+
+static uint64_t getValue(const std::string &in, size_t pos) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; --i) {
+    value = (value << 8) | (unsigned char)in[pos + i];
+  }
+  return value;
+}
+
+HoleMap::HoleMap() : _modified(false), _onDisk(true) {}
+
+HoleMap::~HoleMap() = default;
+
+std::string HoleMap::mapPath(const std::string &cipherPath) {
+  return cipherPath + holeMapSuffix;
+}
+
+bool HoleMap::isMapName(const char *name) {
+  size_t len = strlen(name);
+  size_t suffixLen = sizeof(holeMapSuffix) - 1;
+  return len > suffixLen &&
+         strcmp(name + len - suffixLen, holeMapSuffix) == 0;
+}
+
+void HoleMap::setPath(const std::string &cipherPath) {
+  Lock _lock(_mutex);
+  _path = cipherPath;
+}
+
+bool HoleMap::load(bool readOnly) {
+  Lock _lock(_mutex);
+
+  if (_modified) {
+    // opened again, what we have is newer than the map file
+    return true;
+  }
+  _holes.clear();
+  std::string mapFile = mapPath(_path);
+
+  efs_stat st;
+  if (fs_layer::stat(mapFile.c_str(), &st) != 0) {
+    _onDisk = false;
+    return false;
+  }
+  std::string data = fs_layer::readFileToString(mapFile.c_str());
+
+  efs_stat cipherSt;
+  bool ok = fs_layer::stat(_path.c_str(), &cipherSt) == 0 &&
+            data.size() >= holeMapHeaderSize &&
+            memcmp(data.data(), holeMapMagic, sizeof(holeMapMagic)) == 0 &&
+            getValue(data, 8) == (uint64_t)cipherSt.st_size &&
+            (int64_t)getValue(data, 16) == (int64_t)cipherSt.st_mtime;
+  if (ok) {
+    uint64_t count = getValue(data, 24);
+    ok = (data.size() - holeMapHeaderSize) / 16 == count &&
+         (data.size() - holeMapHeaderSize) % 16 == 0;
+    for (size_t pos = holeMapHeaderSize; ok && pos < data.size(); pos += 16) {
+      off_t first = (off_t)getValue(data, pos);
+      off_t blocks = (off_t)getValue(data, pos + 8);
+      ok = first >= 0 && blocks > 0 &&
+           (_holes.empty() ||
+            _holes.rbegin()->first + _holes.rbegin()->second < first);
+      if (ok) {
+        _holes[first] = blocks;
+      }
+    }
+  }
+
+  if (!ok) {
+    // a map of an older version of the file, or damaged
+    _holes.clear();
+    if (readOnly) {
+      // left for a mount which can write
+      VLOG(1) << "ignoring stale hole map " << mapFile;
+      return false;
+    }
+    VLOG(1) << "removing stale hole map " << mapFile;
+    fs_layer::unlink(mapFile.c_str());
+    _onDisk = false;
+    return false;
+  }
+  _onDisk = true;
+  return true;
+}
+
+bool HoleMap::save() {
+  Lock _lock(_mutex);
+
+  if (!_modified) {
+    return true;
+  }
+  _modified = false;
+  std::string mapFile = mapPath(_path);
+  if (_onDisk) {
+    fs_layer::unlink(mapFile.c_str());
+    _onDisk = false;
+  }
+
+  efs_stat cipherSt;
+  if (_holes.empty() || fs_layer::stat(_path.c_str(), &cipherSt) != 0) {
+    return true;
+  }
+
+  std::string data(holeMapMagic, sizeof(holeMapMagic));
+  putValue(data, (uint64_t)cipherSt.st_size);
+  putValue(data, (uint64_t)(int64_t)cipherSt.st_mtime);
+  putValue(data, (uint64_t)_holes.size());
+  for (const auto &hole : _holes) {
+    putValue(data, (uint64_t)hole.first);
+    putValue(data, (uint64_t)hole.second);
+  }
+  _onDisk = true;
+  return fs_layer::writeFileFromString(mapFile.c_str(), data);
+}
+
+/**
+ * Called before the holes change, the map file must not outlive them.
+ */
+void HoleMap::changing() {
+  _modified = true;
+  if (_onDisk) {
+    fs_layer::unlink(mapPath(_path).c_str());
+    _onDisk = false;
+  }
+}
+
+bool HoleMap::isHole(off_t blockNum) const {
+  Lock _lock(_mutex);
+
+  auto it = _holes.upper_bound(blockNum);
+  if (it == _holes.begin()) {
+    return false;
+  }
+  --it;
+  return blockNum < it->first + it->second;
+}
+
+size_t HoleMap::holeBlocks(off_t blockNum, size_t count,
+                           size_t &dataBlocks) const {
+  Lock _lock(_mutex);
+
+  off_t end = blockNum + (off_t)count;
+  auto it = _holes.upper_bound(blockNum);
+  if (it != _holes.begin()) {
+    auto prev = it;
+    --prev;
+    off_t holeEnd = prev->first + prev->second;
+    if (blockNum < holeEnd) {
+      size_t holes = (size_t)(std::min(holeEnd, end) - blockNum);
+      dataBlocks = count - holes;
+      return holes;
+    }
+  }
+  off_t dataEnd = (it == _holes.end()) ? end : std::min(it->first, end);
+  dataBlocks = (size_t)(dataEnd - blockNum);
+  return 0;
+}
+
+void HoleMap::addHoles(off_t blockNum, off_t count) {
+  if (count <= 0) {
+    return;
+  }
+  Lock _lock(_mutex);
+
+  changing();
+  off_t first = blockNum;
+  off_t end = blockNum + count;
+  // merge with the holes it touches or overlaps
+  auto it = _holes.upper_bound(first);
+  if (it != _holes.begin()) {
+    auto prev = it;
+    --prev;
+    if (prev->first + prev->second >= first) {
+      it = prev;
+    }
+  }
+  while (it != _holes.end() && it->first <= end) {
+    first = std::min(first, it->first);
+    end = std::max(end, it->first + it->second);
+    it = _holes.erase(it);
+  }
+  _holes[first] = end - first;
+}
+
+void HoleMap::removeHoles(off_t blockNum, off_t count) {
+  if (count <= 0) {
+    return;
+  }
+  Lock _lock(_mutex);
+
+  if (_holes.empty()) {
+    return;
+  }
+  // the size and time of the cipher file change, the map file is written
+  // again even if the holes stay the same
+  _modified = true;
+  removeLocked(blockNum, blockNum + count);
+}
+
+void HoleMap::removeLocked(off_t blockNum, off_t end) {
+  auto it = _holes.upper_bound(blockNum);
+  if (it != _holes.begin()) {
+    --it;
+  }
+  while (it != _holes.end() && it->first < end) {
+    off_t holeFirst = it->first;
+    off_t holeEnd = holeFirst + it->second;
+    if (holeEnd <= blockNum) {
+      ++it;
+      continue;
+    }
+    changing();
+    it = _holes.erase(it);
+    if (holeFirst < blockNum) {
+      _holes[holeFirst] = blockNum - holeFirst;
+    }
+    if (holeEnd > end) {
+      _holes[end] = holeEnd - end;
+    }
+  }
+}
+
+void HoleMap::truncate(off_t blockCount) {
+  Lock _lock(_mutex);
+
+  if (_holes.empty()) {
+    return;
+  }
+  _modified = true;
+  off_t end = _holes.rbegin()->first + _holes.rbegin()->second;
+  if (end > blockCount) {
+    removeLocked(blockCount, end);
+  }
+}
+
+}  // namespace encfs
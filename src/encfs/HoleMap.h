@@ -0,0 +1,103 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HoleMap_incl_
+#define _HoleMap_incl_
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+
+#include <boost/thread/mutex.hpp>
+
+namespace encfs {
+
+/*
+    The blocks of a file which were never written, kept in a small file
+    next to the cipher file (the cipher name with holeMapSuffix appended).
+
+    With allowHoles, padding a file leaves the skipped blocks out of the
+    cipher file, and they read as zeros.  Finding them again needs a query
+    of the backing filesystem per run of blocks, or reading them.  The map
+    remembers them instead, in blocks of the outermost FileIO layer, so
+    BlockFileIO returns their zeros without any I/O.  The cipher file itself
+    is the same as without the map, volumes stay readable by every EncFS.
+
+    The map file stores the size and modification time of the cipher file
+    it belongs to, and is only used while both still match.  Before the
+    holes change, the map file is removed, so a crash leaves no map which
+    claims a hole where data was written.  A change of the cipher file by
+    another program within the same second and without a change of its
+    size goes unnoticed, it is written through the volume anyway.
+*/
+class HoleMap {
+ public:
+  HoleMap();
+  ~HoleMap();
+
+  static const char holeMapSuffix[];
+
+  static std::string mapPath(const std::string &cipherPath);
+  static bool isMapName(const char *name);
+
+  // the cipher file the map belongs to, follows renames of the file
+  void setPath(const std::string &cipherPath);
+
+  // reads the map file, if it belongs to the current cipher file.  A map
+  // file which doesn't is removed, unless readOnly is set.  Returns false
+  // without a usable map.
+  bool load(bool readOnly = false);
+  // writes the map file if the map changed, or removes it if there are no
+  // holes left.  Returns false in case of failure.
+  bool save();
+
+  bool isHole(off_t blockNum) const;
+  // like BlockFileIO::holeBlocks(): returns the number of leading blocks of
+  // the run which are holes, dataBlocks the number of blocks after them up
+  // to the next hole
+  size_t holeBlocks(off_t blockNum, size_t count, size_t &dataBlocks) const;
+
+  void addHoles(off_t blockNum, off_t count);
+  // blocks which are about to be written
+  void removeHoles(off_t blockNum, off_t count);
+  // the file now ends before block blockCount
+  void truncate(off_t blockCount);
+
+ private:
+  HoleMap(const HoleMap &src);             // not allowed
+  HoleMap &operator=(const HoleMap &src);  // not allowed
+
+  void changing();
+  // removes the holes in [blockNum, end), with the mutex held
+  void removeLocked(off_t blockNum, off_t end);
+
+  std::string _path;
+  // first block of a hole -> number of blocks, the holes don't touch
+  std::map<off_t, off_t> _holes;
+  bool _modified;
+  bool _onDisk;  // the map file may exist
+
+  mutable boost::mutex _mutex;
+};
+
+}  // namespace encfs
+
+#endif
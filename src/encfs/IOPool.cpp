@@ -0,0 +1,85 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "IOPool.h"
+
+#include "Mutex.h"
+
+namespace encfs {
+
+// enough for the outstanding requests of a few concurrent transfers, the
+// threads mostly wait for the disk
+static const int ioPoolThreads = 4;
+
+static thread_local bool tInPool = false;
+
+IOPool &IOPool::instance() {
+  static IOPool pool(ioPoolThreads);
+  return pool;
+}
+
+IOPool::IOPool(int threadCount) : _stopping(false) {
+  for (int i = 0; i < threadCount; i++) {
+    _threads.create_thread([this]() { workerLoop(); });
+  }
+}
+
+IOPool::~IOPool() {
+  {
+    Lock _lock(_mutex);
+    _stopping = true;
+  }
+  _cond.notify_all();
+  _threads.join_all();
+}
+
+void IOPool::post(const std::function<void()> &fn) {
+  if (tInPool) {
+    fn();
+    return;
+  }
+  {
+    Lock _lock(_mutex);
+    _jobs.push_back(fn);
+  }
+  _cond.notify_one();
+}
+
+void IOPool::workerLoop() {
+  tInPool = true;
+  while (true) {
+    std::function<void()> job;
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      while (_jobs.empty() && !_stopping) {
+        _cond.wait(lock);
+      }
+      // the jobs left are run, their callers wait for them
+      if (_jobs.empty()) {
+        return;
+      }
+      job = std::move(_jobs.front());
+      _jobs.pop_front();
+    }
+    job();
+  }
+}
+
+}  // namespace encfs
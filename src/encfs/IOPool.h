@@ -0,0 +1,65 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IOPool_incl_
+#define _IOPool_incl_
+
+#include <deque>
+#include <functional>
+
+#include <boost/thread.hpp>
+
+namespace encfs {
+
+/*
+    Small pool of threads shared by all filesystems of the process, for the
+    blocking reads and writes of backing files which the caller doesn't wait
+    for (see FileIO::readAsync()).  Meanwhile the caller codes the blocks it
+    already has, on its own thread and the WorkerPool.
+
+    A job posted by one of the pool threads runs right away on that thread,
+    so nested asynchronous requests never wait for a free pool thread.
+*/
+class IOPool {
+ public:
+  static IOPool &instance();
+
+  IOPool(int threadCount);
+  ~IOPool();
+
+  // runs fn on a pool thread.  fn must not throw.
+  void post(const std::function<void()> &fn);
+
+ private:
+  IOPool(const IOPool &src);             // not allowed
+  IOPool &operator=(const IOPool &src);  // not allowed
+
+  void workerLoop();
+
+  boost::thread_group _threads;
+  boost::mutex _mutex;
+  boost::condition_variable _cond;
+  std::deque<std::function<void()>> _jobs;
+  bool _stopping;
+};
+
+}  // namespace encfs
+
+#endif
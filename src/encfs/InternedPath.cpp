@@ -0,0 +1,137 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "InternedPath.h"
+
+#include <functional>
+#include <unordered_map>
+
+#include <boost/thread/mutex.hpp>
+
+#include "Mutex.h"
+
+namespace encfs {
+
+// the table is split by hash, so that threads interning different paths
+// rarely wait for each other
+static const size_t internShardCount = 16;
+
+namespace {
+
+// the string of an entry, or of a path being looked up, with its hash
+struct InternKey {
+  const std::string *path;
+  size_t hash;
+};
+
+struct InternKeyHash {
+  size_t operator()(const InternKey &key) const { return key.hash; }
+};
+
+struct InternKeyEqual {
+  bool operator()(const InternKey &a, const InternKey &b) const {
+    return a.hash == b.hash && *a.path == *b.path;
+  }
+};
+
+}  // namespace
+
+/*
+    Each shard maps the string of an entry, which lives inside the entry
+    itself, to a weak reference to the entry.  An entry whose last handle
+    went away may still be found until release() got the lock, it is then
+    replaced by a new entry for the same path.
+*/
+struct InternShard {
+  boost::mutex mutex;
+  std::unordered_map<InternKey, std::weak_ptr<const void>, InternKeyHash,
+                     InternKeyEqual>
+      entries;
+};
+
+static InternShard *internShards() {
+  // never destroyed, handles in static objects may outlive other statics
+  static InternShard *shards = new InternShard[internShardCount];
+  return shards;
+}
+
+static const InternedPath &emptyPath() {
+  static const InternedPath *empty = new InternedPath(std::string());
+  return *empty;
+}
+
+InternedPath::InternedPath() : _entry(emptyPath()._entry) {}
+
+InternedPath::InternedPath(const std::string &path) : _entry(intern(path)) {}
+
+InternedPath::InternedPath(const char *path)
+    : _entry(intern(std::string(path))) {}
+
+std::shared_ptr<const InternedPath::Entry> InternedPath::intern(
+    const std::string &path) {
+  size_t hash = std::hash<std::string>()(path);
+  InternShard &shard = internShards()[hash % internShardCount];
+
+  InternKey key = {&path, hash};
+  Lock _lock(shard.mutex);
+  auto it = shard.entries.find(key);
+  if (it != shard.entries.end()) {
+    std::shared_ptr<const void> existing = it->second.lock();
+    if (existing) {
+      return std::static_pointer_cast<const Entry>(existing);
+    }
+    // the last handle is gone, release() is waiting for the lock
+    shard.entries.erase(it);
+  }
+
+  Entry *entry = new Entry;
+  entry->path = path;
+  entry->hash = hash;
+  std::shared_ptr<const Entry> result(entry, &InternedPath::release);
+  key.path = &entry->path;
+  shard.entries[key] = result;
+  return result;
+}
+
+void InternedPath::release(Entry *entry) {
+  InternShard &shard = internShards()[entry->hash % internShardCount];
+  InternKey key = {&entry->path, entry->hash};
+  {
+    Lock _lock(shard.mutex);
+    auto it = shard.entries.find(key);
+    // only remove our own entry, not a newer one for the same path
+    if (it != shard.entries.end() && it->first.path == &entry->path) {
+      shard.entries.erase(it);
+    }
+  }
+  delete entry;
+}
+
+size_t InternedPath::tableSize() {
+  size_t size = 0;
+  for (size_t i = 0; i < internShardCount; ++i) {
+    InternShard &shard = internShards()[i];
+    Lock _lock(shard.mutex);
+    size += shard.entries.size();
+  }
+  return size;
+}
+
+}  // namespace encfs
@@ -0,0 +1,80 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _InternedPath_incl_
+#define _InternedPath_incl_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace encfs {
+
+/*
+    Handle of a path string in a process wide intern table.
+
+    All handles of equal paths share one copy of the string and its hash,
+    which is computed once when the path is interned.  Handles compare and
+    hash by the identity of the shared entry, so maps keyed by them never
+    compare or hash the characters again.  The entry is removed from the
+    table when its last handle goes away.
+
+    The formatter keeps the path of every open file in several maps, and
+    libencfs keeps it in the open file table of the context, so the same
+    strings are otherwise held many times.
+*/
+class InternedPath {
+ public:
+  InternedPath();  // the empty path
+  InternedPath(const std::string &path);
+  InternedPath(const char *path);
+
+  const std::string &str() const { return _entry->path; }
+  const char *c_str() const { return _entry->path.c_str(); }
+  bool empty() const { return _entry->path.empty(); }
+  size_t hash() const { return _entry->hash; }
+
+  operator const std::string &() const { return _entry->path; }
+
+  bool operator==(const InternedPath &o) const { return _entry == o._entry; }
+  bool operator!=(const InternedPath &o) const { return _entry != o._entry; }
+
+  // number of different paths currently interned
+  static size_t tableSize();
+
+ private:
+  struct Entry {
+    std::string path;
+    size_t hash;
+  };
+
+  static std::shared_ptr<const Entry> intern(const std::string &path);
+  static void release(Entry *entry);
+
+  std::shared_ptr<const Entry> _entry;
+};
+
+struct InternedPathHash {
+  size_t operator()(const InternedPath &path) const { return path.hash(); }
+};
+
+}  // namespace encfs
+
+#endif
@@ -21,10 +21,13 @@
 #include "MACFileIO.h"
 
 #include "easylogging++.h"
+#include <algorithm>
+#include <atomic>
 #include <cinttypes>
 #include <cstring>
 #include <sys/stat.h>
 #include <utility>
+#include <vector>
 
 #include "BlockFileIO.h"
 #include "Cipher.h"
@@ -32,6 +35,9 @@
 #include "FileIO.h"
 #include "FileUtils.h"
 #include "MemoryPool.h"
+#include "PhaseTimer.h"
+#include "WorkerPool.h"
+#include "ZeroBlock.h"
 #include "i18n.h"
 
 using namespace std;
@@ -52,6 +58,9 @@ namespace encfs {
 //
 static Interface MACFileIO_iface("FileIO/MAC", 2, 1, 0);
 
+// number of blocks whose MACs are computed together by one thread
+static const size_t macChunkBlocks = 16;
+
 int dataBlockSize(const FSConfigPtr &cfg) {
   return cfg->config->blockSize - cfg->config->blockMACBytes -
          cfg->config->blockMACRandBytes;
@@ -159,59 +168,139 @@ ssize_t MACFileIO::readOneBlock(const IORequest &req) const {
   // get the data from the base FileIO layer
   ssize_t readSize = base->read(tmp);
 
+  if (readSize > 0) {
+    readSize = checkBlock(tmp.data, readSize, req.offset / bs);
+    if (readSize > 0) {
+      // now copy the data to the output buffer
+      memcpy(req.data, tmp.data + headerSize, readSize);
+    }
+  }
+
+  MemoryPool::release(mb);
+
+  return readSize;
+}
+
+/**
+ * Check the MAC of a block read from the base FileIO with its header.
+ * mac is the MAC of the block if it was already computed.
+ * Returns the size of the data following the header, or -EBADMSG.
+ */
+ssize_t MACFileIO::checkBlock(const unsigned char *data, ssize_t readSize,
+                              off_t blockNum, const uint64_t *mac) const {
+  int headerSize = macBytes + randBytes;
+
+  if (readSize <= headerSize) {
+    VLOG(1) << "readSize " << readSize << " in block " << blockNum;
+    return 0;
+  }
+
+  if (!macMatches(data, readSize, mac)) {
+    // uh oh..
+    RLOG(WARNING) << "MAC comparison failure in block " << blockNum;
+    if (!warnOnly) {
+      return -EBADMSG;
+    }
+  }
+
+  return readSize - headerSize;
+}
+
+/**
+ * Compare the MAC stored in the header of a block read from the base FileIO
+ * with the MAC of its data.  Blocks without data, and holes if they are
+ * allowed, have nothing to compare and match.
+ */
+bool MACFileIO::macMatches(const unsigned char *data, ssize_t readSize,
+                           const uint64_t *mac) const {
+  if (readSize <= macBytes + randBytes) {
+    return true;
+  }
+
   // don't store zeros if configured for zero-block pass-through
   bool skipBlock = true;
   if (_allowHoles) {
-    for (int i = 0; i < readSize; ++i) {
-      if (tmp.data[i] != 0) {
-        skipBlock = false;
-        break;
-      }
-    }
+    skipBlock = isAllZero(data, readSize);
   } else if (macBytes > 0) {
     skipBlock = false;
   }
+  if (skipBlock) {
+    return true;
+  }
 
-  if (readSize > headerSize) {
-    if (!skipBlock) {
-      // At this point the data has been decoded.  So, compute the MAC of
-      // the block and check against the checksum stored in the header..
-      uint64_t mac =
-          cipher->MAC_64(tmp.data + macBytes, readSize - macBytes, key);
+  TIMED_PHASE(PhaseMACVerify);
+  // At this point the data has been decoded.  So, compute the MAC of
+  // the block and check against the checksum stored in the header..
+  uint64_t computed =
+      (mac != nullptr)
+          ? *mac
+          : cipher->MAC_64(data + macBytes, readSize - macBytes, key);
+
+  // Constant time comparision to prevent timing attacks
+  unsigned char fail = 0;
+  for (int i = 0; i < macBytes; ++i, computed >>= 8) {
+    int test = computed & 0xff;
+    int stored = data[i];
+
+    fail |= (test ^ stored);
+  }
 
-      // Constant time comparision to prevent timing attacks
-      unsigned char fail = 0;
-      for (int i = 0; i < macBytes; ++i, mac >>= 8) {
-        int test = mac & 0xff;
-        int stored = tmp.data[i];
+  return fail == 0;
+}
 
-        fail |= (test ^ stored);
-      }
+ssize_t MACFileIO::verifyBlocks(off_t firstBlock, size_t count,
+                                std::vector<off_t> &badBlocks) const {
+  int headerSize = macBytes + randBytes;
+  size_t bs = blockSize() + headerSize;
+  if (count == 0) {
+    return 0;
+  }
 
-      if (fail > 0) {
-        // uh oh..
-        long blockNum = req.offset / bs;
-        RLOG(WARNING) << "MAC comparison failure in block " << blockNum;
-        if (!warnOnly) {
-          MemoryPool::release(mb);
-          return -EBADMSG;
-        }
-      }
-    }
+  MemBlock mb = MemoryPool::allocate((int)(count * bs));
 
-    // now copy the data to the output buffer
-    readSize -= headerSize;
-    memcpy(req.data, tmp.data + headerSize, readSize);
-  } else {
-    VLOG(1) << "readSize " << readSize << " at offset " << req.offset;
-    if (readSize > 0) {
-      readSize = 0;
-    }
+  IORequest tmp;
+  tmp.offset = firstBlock * (off_t)bs;
+  tmp.data = mb.data;
+  tmp.dataLen = count * bs;
+
+  ssize_t readSize = base->read(tmp);
+  if (readSize <= 0) {
+    MemoryPool::release(mb);
+    return readSize;
   }
 
+  size_t blocks = ((size_t)readSize + bs - 1) / bs;
+  size_t fullBlocks = (size_t)readSize / bs;
+  size_t chunks = (blocks + macChunkBlocks - 1) / macChunkBlocks;
+  std::vector<char> bad(blocks, 0);
+  WorkerPool::instance().parallelFor(chunks, [&](size_t chunk) {
+    size_t first = chunk * macChunkBlocks;
+    size_t last = std::min(first + macChunkBlocks, blocks);
+    size_t full = std::min(last, fullBlocks);
+
+    uint64_t macs[macChunkBlocks];
+    if (macBytes > 0 && full > first) {
+      TIMED_PHASE(PhaseMACVerify);
+      cipher->MAC_64_many(tmp.data + first * bs + macBytes,
+                          (int)bs - macBytes, (int)bs, (int)(full - first),
+                          key, macs);
+    }
+
+    for (size_t i = first; i < last; ++i) {
+      ssize_t size = std::min((ssize_t)bs, readSize - (ssize_t)(i * bs));
+      const uint64_t *mac =
+          (macBytes > 0 && i < full) ? &macs[i - first] : nullptr;
+      bad[i] = macMatches(tmp.data + i * bs, size, mac) ? 0 : 1;
+    }
+  });
   MemoryPool::release(mb);
 
-  return readSize;
+  for (size_t i = 0; i < blocks; ++i) {
+    if (bad[i]) {
+      badBlocks.push_back(firstBlock + (off_t)i);
+    }
+  }
+  return (ssize_t)blocks;
 }
 
 ssize_t MACFileIO::writeOneBlock(const IORequest &req) {
@@ -227,31 +316,172 @@ ssize_t MACFileIO::writeOneBlock(const IORequest &req) {
   newReq.data = mb.data;
   newReq.dataLen = headerSize + req.dataLen;
 
-  memset(newReq.data, 0, headerSize);
   memcpy(newReq.data + headerSize, req.data, req.dataLen);
-  if (randBytes > 0) {
-    if (!cipher->randomize(newReq.data + macBytes, randBytes, false)) {
-      return -EBADMSG;
+  if (!makeHeaders(newReq.data, req.dataLen, 1)) {
+    MemoryPool::release(mb);
+    return -EBADMSG;
+  }
+
+  // now, we can let the next level have it..
+  ssize_t writeSize = base->write(newReq);
+
+  MemoryPool::release(mb);
+
+  return writeSize;
+}
+
+/**
+ * Fill in the headers of count consecutive blocks with dataLen bytes of data
+ * each.  count must not exceed macChunkBlocks.
+ */
+bool MACFileIO::makeHeaders(unsigned char *data, size_t dataLen,
+                            int count) const {
+  int headerSize = macBytes + randBytes;
+  size_t bs = dataLen + headerSize;
+  rAssert(count > 0 && (size_t)count <= macChunkBlocks);
+
+  for (int i = 0; i < count; ++i) {
+    unsigned char *block = data + i * bs;
+    memset(block, 0, headerSize);
+    if (randBytes > 0) {
+      if (!cipher->randomize(block + macBytes, randBytes, false)) {
+        return false;
+      }
     }
   }
 
   if (macBytes > 0) {
-    // compute the mac (which includes the random data) and fill it in
-    uint64_t mac =
-        cipher->MAC_64(newReq.data + macBytes, req.dataLen + randBytes, key);
+    // compute the macs (which include the random data) and fill them in
+    uint64_t macs[macChunkBlocks];
+    cipher->MAC_64_many(data + macBytes, dataLen + randBytes, (int)bs, count,
+                        key, macs);
+
+    for (int i = 0; i < count; ++i) {
+      unsigned char *block = data + i * bs;
+      uint64_t mac = macs[i];
+      for (int j = 0; j < macBytes; ++j) {
+        block[j] = mac & 0xff;
+        mac >>= 8;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * Read a run of blocks with their headers in one request, so the base
+ * FileIO can decode them as a whole, then check the MACs in parallel, in
+ * chunks of macChunkBlocks blocks.
+ */
+ssize_t MACFileIO::readBlocks(const IORequest &req) const {
+  int headerSize = macBytes + randBytes;
+  size_t dataSize = blockSize();
+  size_t bs = dataSize + headerSize;
+  size_t count = req.dataLen / dataSize;
+
+  MemBlock mb = MemoryPool::allocate((int)(count * bs));
+
+  IORequest tmp;
+  tmp.offset = locWithHeader(req.offset, bs, headerSize);
+  tmp.data = mb.data;
+  tmp.dataLen = count * bs;
+
+  ssize_t readSize = base->read(tmp);
+  if (readSize <= 0) {
+    MemoryPool::release(mb);
+    return readSize;
+  }
+
+  off_t firstBlock = req.offset / dataSize;
+  size_t blocks = ((size_t)readSize + bs - 1) / bs;
+  size_t fullBlocks = (size_t)readSize / bs;
+  size_t chunks = (blocks + macChunkBlocks - 1) / macChunkBlocks;
+  std::vector<ssize_t> sizes(blocks);
+  WorkerPool::instance().parallelFor(chunks, [&](size_t chunk) {
+    size_t first = chunk * macChunkBlocks;
+    size_t last = std::min(first + macChunkBlocks, blocks);
+    size_t full = std::min(last, fullBlocks);
+
+    // the short last block is left to checkBlock
+    uint64_t macs[macChunkBlocks];
+    if (macBytes > 0 && full > first) {
+      TIMED_PHASE(PhaseMACVerify);
+      cipher->MAC_64_many(tmp.data + first * bs + macBytes,
+                          (int)bs - macBytes, (int)bs, (int)(full - first),
+                          key, macs);
+    }
+
+    for (size_t i = first; i < last; ++i) {
+      ssize_t size = std::min((ssize_t)bs, readSize - (ssize_t)(i * bs));
+      const uint64_t *mac =
+          (macBytes > 0 && i < full) ? &macs[i - first] : nullptr;
+      sizes[i] =
+          checkBlock(tmp.data + i * bs, size, firstBlock + (off_t)i, mac);
+      if (sizes[i] > 0) {
+        memcpy(req.data + i * dataSize, tmp.data + i * bs + headerSize,
+               sizes[i]);
+      }
+    }
+  });
+  MemoryPool::release(mb);
 
-    for (int i = 0; i < macBytes; ++i) {
-      newReq.data[i] = mac & 0xff;
-      mac >>= 8;
+  ssize_t result = 0;
+  for (size_t i = 0; i < blocks; ++i) {
+    if (sizes[i] < 0) {
+      return sizes[i];
+    }
+    result += sizes[i];
+    if ((size_t)sizes[i] < dataSize) {
+      break;
     }
   }
 
-  // now, we can let the next level have it..
-  ssize_t writeSize = base->write(newReq);
+  shareBlocks(req.data, firstBlock, result);
+  return result;
+}
 
+/**
+ * Add the headers to a run of full blocks in parallel, in chunks of
+ * macChunkBlocks blocks, then write them in one request, so the base FileIO
+ * can encode them as a whole.
+ */
+ssize_t MACFileIO::writeBlocks(const IORequest &req) {
+  int headerSize = macBytes + randBytes;
+  size_t dataSize = blockSize();
+  size_t bs = dataSize + headerSize;
+  size_t count = req.dataLen / dataSize;
+
+  MemBlock mb = MemoryPool::allocate((int)(count * bs));
+
+  size_t chunks = (count + macChunkBlocks - 1) / macChunkBlocks;
+  std::atomic<bool> ok(true);
+  WorkerPool::instance().parallelFor(chunks, [&](size_t chunk) {
+    size_t first = chunk * macChunkBlocks;
+    size_t last = std::min(first + macChunkBlocks, count);
+    for (size_t i = first; i < last; ++i) {
+      memcpy(mb.data + i * bs + headerSize, req.data + i * dataSize,
+             dataSize);
+    }
+    if (!makeHeaders(mb.data + first * bs, dataSize, (int)(last - first))) {
+      ok = false;
+    }
+  });
+
+  ssize_t res = -EBADMSG;
+  if (ok) {
+    IORequest newReq;
+    newReq.offset = locWithHeader(req.offset, bs, headerSize);
+    newReq.data = mb.data;
+    newReq.dataLen = count * bs;
+    res = base->write(newReq);
+    if (res >= 0) {
+      res = req.dataLen;
+    }
+  }
   MemoryPool::release(mb);
 
-  return writeSize;
+  blocksWritten(req.data, req.offset / dataSize, count, res >= 0);
+  return res;
 }
 
 int MACFileIO::truncate(off_t size) {
@@ -267,6 +497,42 @@ int MACFileIO::truncate(off_t size) {
   return res;
 }
 
+int MACFileIO::setSparse() { return base->setSparse(); }
+
+/**
+ * A block of ours is only a hole if its whole block with the header is one
+ * in the base file, so the hole is rounded in and the data range out.
+ */
+bool MACFileIO::findData(off_t offset, off_t &begin, off_t &end) const {
+  if (!_allowHoles) {
+    return false;
+  }
+  int headerSize = macBytes + randBytes;
+  off_t dataSize = blockSize();
+  off_t bs = dataSize + headerSize;
+
+  off_t baseBegin, baseEnd;
+  if (!base->findData((offset / dataSize) * bs, baseBegin, baseEnd)) {
+    return false;
+  }
+  if (baseBegin == baseEnd) {
+    // no data after offset
+    begin = end = std::max(locWithoutHeader(baseEnd, bs, headerSize), offset);
+    return true;
+  }
+  begin = std::max((baseBegin / bs) * dataSize, offset);
+  end = std::max(roundUpDivide(baseEnd, bs) * dataSize, begin);
+  return true;
+}
+
+int MACFileIO::preallocate(off_t size) {
+  int headerSize = macBytes + randBytes;
+  int bs = blockSize() + headerSize;
+  return base->preallocate(locWithHeader(size, bs, headerSize));
+}
+
+int MACFileIO::sync(bool datasync) { return base->sync(datasync); }
+
 bool MACFileIO::isWritable() const { return base->isWritable(); }
 
 }  // namespace encfs
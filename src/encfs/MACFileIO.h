@@ -24,6 +24,7 @@
 #include <memory>
 #include <stdint.h>
 #include <sys/types.h>
+#include <vector>
 
 #include "BlockFileIO.h"
 #include "Cipher.h"
@@ -59,12 +60,33 @@ class MACFileIO : public BlockFileIO {
   virtual off_t getSize() const;
 
   virtual int truncate(off_t size);
+  virtual int setSparse();
+  virtual bool findData(off_t offset, off_t &begin, off_t &end) const;
+  virtual int preallocate(off_t size);
+  virtual int sync(bool datasync);
 
   virtual bool isWritable() const;
 
+  /*
+      Check the MACs of up to count blocks from block firstBlock on, without
+      passing the data on.  Adds the blocks whose MAC doesn't match to
+      badBlocks, also in warnOnly mode.  Returns the number of blocks read,
+      0 at the end of the file, or -errno.
+  */
+  ssize_t verifyBlocks(off_t firstBlock, size_t count,
+                       std::vector<off_t> &badBlocks) const;
+
  private:
   virtual ssize_t readOneBlock(const IORequest &req) const;
   virtual ssize_t writeOneBlock(const IORequest &req);
+  virtual ssize_t readBlocks(const IORequest &req) const;
+  virtual ssize_t writeBlocks(const IORequest &req);
+
+  ssize_t checkBlock(const unsigned char *data, ssize_t readSize,
+                     off_t blockNum, const uint64_t *mac = nullptr) const;
+  bool macMatches(const unsigned char *data, ssize_t readSize,
+                  const uint64_t *mac) const;
+  bool makeHeaders(unsigned char *data, size_t dataLen, int count) const;
 
   std::shared_ptr<FileIO> base;
   std::shared_ptr<Cipher> cipher;
@@ -20,9 +20,17 @@
 
 #include "MemoryPool.h"
 
+#include <atomic>
+#include <cstdlib>
 #include <cstring>
-#include <openssl/ossl_typ.h>
-#include <boost/thread.hpp>
+#include <new>
+#include <set>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+#include "Mutex.h"
+#include "easylogging++.h"
 
 #ifdef HAVE_VALGRIND_MEMCHECK_H
 #include <valgrind/memcheck.h>
@@ -31,104 +39,381 @@
 #define VALGRIND_MAKE_MEM_UNDEFINED(a, b)
 #endif
 
-#include <openssl/buffer.h>
+namespace encfs {
+
+/*
+    Blocks are grouped into size classes, four per power of two from 64
+    bytes to 16 MB, so that a request takes the first free block of its
+    class instead of searching for one which is large enough.  Larger
+    requests are not pooled.  Page-aligned blocks have size classes of
+    their own.
 
-#define BLOCKDATA(BLOCK) (unsigned char *)(BLOCK)->data->data
+    The data of a block is aligned to a cache line (or page), and its
+    header is allocated separately, so that the header neither breaks the
+    alignment nor shares a cache line with the data.
 
-namespace encfs {
+    Free blocks are kept in a cache per thread, and the blocks a thread has
+    too many of go to a global depot per class.  Beyond the limit set with
+    setMaxFreeBytes(), they are freed instead.  The depot is a lock-free
+    stack which is only ever pushed with compare-and-swap, and emptied as a
+    whole with exchange, so it doesn't suffer from the ABA problem.
+*/
 
-struct BlockList {
-  BlockList *next;
-  int size;
-  BUF_MEM *data;
+struct BlockHeader {
+  BlockHeader *next;
+  unsigned char *data;
+  int pool;  // sizeClass, plus numClasses if page-aligned.  -1 or -2 for
+             // blocks which are not pooled.
+  int used;  // bytes requested by allocate(), scrubbed by release()
 };
 
-static BlockList *allocBlock(int size) {
-  auto *block = new BlockList;
-  block->size = size;
-  block->data = BUF_MEM_new();
-  BUF_MEM_grow(block->data, size);
-  VALGRIND_MAKE_MEM_NOACCESS(block->data->data, block->data->max);
+static const int minClassShift = 6;   // 64 bytes
+static const int maxClassShift = 24;  // 16 MB
+static const int classesPerDouble = 4;
+static const int numClasses =
+    (maxClassShift - minClassShift) * classesPerDouble + 1;
+// size classes of the cache-line-aligned and of the page-aligned blocks
+static const int numPools = 2 * numClasses;
+
+// bytes of each size class a thread keeps for itself
+static const size_t threadCacheBytes = 256 * 1024;
+
+static size_t classSize(int sizeClass) {
+  size_t base = (size_t)1 << (minClassShift + sizeClass / classesPerDouble);
+  return base + (base / classesPerDouble) * (sizeClass % classesPerDouble);
+}
+
+// smallest class of at least size bytes, or -1 if size is too large
+static int sizeClassOf(size_t size) {
+  if (size <= ((size_t)1 << minClassShift)) {
+    return 0;
+  }
+  if (size > ((size_t)1 << maxClassShift)) {
+    return -1;
+  }
+  // base < size <= 2 * base
+  int shift = minClassShift;
+  while (((size - 1) >> (shift + 1)) != 0) {
+    ++shift;
+  }
+  size_t base = (size_t)1 << shift;
+  size_t step = base / classesPerDouble;
+  int sub = (int)((size - base + step - 1) / step);  // 1 .. classesPerDouble
+  return (shift - minClassShift) * classesPerDouble + sub;
+}
+
+static size_t poolSize(int pool) { return classSize(pool % numClasses); }
+
+// blocks larger than threadCacheBytes go to the depot right away
+static int cacheLimit(int pool) {
+  return (int)(threadCacheBytes / poolSize(pool));
+}
+
+static size_t dataSize(const BlockHeader *block) {
+  return (block->pool < 0) ? (size_t)block->used : poolSize(block->pool);
+}
+
+// bytes of all blocks, and the most there ever were
+static std::atomic<uint64_t> gResidentBytes(0);
+static std::atomic<uint64_t> gPeakResidentBytes(0);
+static std::atomic<uint64_t> gNewBlocks(0);
+static std::atomic<uint64_t> gDestroyedBytes(0);
+// free bytes in the depot, and the most it may hold (0 for no limit)
+static std::atomic<uint64_t> gDepotBytes(0);
+static std::atomic<uint64_t> gMaxFreeBytes(0);
+
+static BlockHeader *allocBlock(size_t size, bool pageAligned, int pool) {
+  size_t alignment = pageAligned ? MemoryPool::pageAlignment
+                                 : MemoryPool::cacheLineAlignment;
+  void *mem = nullptr;
+#if defined(_WIN32)
+  mem = _aligned_malloc(size, alignment);
+#else
+  if (posix_memalign(&mem, alignment, size) != 0) {
+    mem = nullptr;
+  }
+#endif
+  if (mem == nullptr) {
+    throw std::bad_alloc();
+  }
+
+  auto *block = new BlockHeader;
+  block->next = nullptr;
+  block->data = static_cast<unsigned char *>(mem);
+  block->pool = pool;
+  block->used = 0;
+  VALGRIND_MAKE_MEM_NOACCESS(block->data, size);
+
+  ++gNewBlocks;
+  uint64_t resident = (gResidentBytes += size);
+  uint64_t peak = gPeakResidentBytes.load(std::memory_order_relaxed);
+  while (resident > peak &&
+         !gPeakResidentBytes.compare_exchange_weak(peak, resident)) {
+  }
 
   return block;
 }
 
-static void freeBlock(BlockList *el) {
-  VALGRIND_MAKE_MEM_UNDEFINED(el->data->data, el->data->max);
-  BUF_MEM_free(el->data);
+static void freeBlock(BlockHeader *block) {
+  size_t size = dataSize(block);
+  VALGRIND_MAKE_MEM_UNDEFINED(block->data, size);
+#if defined(_WIN32)
+  _aligned_free(block->data);
+#else
+  free(block->data);
+#endif
+  delete block;
+  gResidentBytes -= size;
+}
 
-  delete el;
+static void freeChain(BlockHeader *block) {
+  while (block != nullptr) {
+    BlockHeader *next = block->next;
+
+    freeBlock(block);
+    block = next;
+  }
 }
 
-static boost::mutex gMPoolMutex;
-static BlockList *gMemPool = nullptr;
+// zero-initialized before any thread runs
+static std::atomic<BlockHeader *> gDepot[numPools];
 
-MemBlock MemoryPool::allocate(int size) {
-  BlockList *block = nullptr;
-  {
-    boost::lock_guard<boost::mutex> lock(gMPoolMutex);
-
-    BlockList *parent = nullptr;
-    block = gMemPool;
-    // check if we already have a large enough block available..
-    while (block != nullptr && block->size < size) {
-      parent = block;
-      block = block->next;
+// push the chain first .. last to the depot of the pool
+static void depotPush(int pool, BlockHeader *first, BlockHeader *last) {
+  BlockHeader *head = gDepot[pool].load(std::memory_order_relaxed);
+  do {
+    last->next = head;
+  } while (!gDepot[pool].compare_exchange_weak(
+      head, first, std::memory_order_release, std::memory_order_relaxed));
+}
+
+static BlockHeader *depotTakeAll(int pool) {
+  return gDepot[pool].exchange(nullptr, std::memory_order_acquire);
+}
+
+// counters which are only changed by their own thread, and read by stats()
+static void addTo(std::atomic<uint64_t> &counter, uint64_t n) {
+  counter.store(counter.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+}
+
+struct ThreadCache;
+
+// the caches of all threads, for stats().  Never destroyed, threads may
+// end after the static objects are gone.
+struct CacheRegistry {
+  boost::mutex mutex;
+  std::set<ThreadCache *> caches;
+  uint64_t endedAllocations;  // of the threads which have ended
+  uint64_t endedReused;
+
+  CacheRegistry() : endedAllocations(0), endedReused(0) {}
+};
+
+static CacheRegistry &registry() {
+  static CacheRegistry *r = new CacheRegistry;
+  return *r;
+}
+
+struct ThreadCache {
+  BlockHeader *lists[numPools];
+  int counts[numPools];
+
+  std::atomic<uint64_t> allocations;
+  std::atomic<uint64_t> reused;
+  std::atomic<uint64_t> cachedBytes;
+
+  ThreadCache() : allocations(0), reused(0), cachedBytes(0) {
+    for (int c = 0; c < numPools; ++c) {
+      lists[c] = nullptr;
+      counts[c] = 0;
     }
+    CacheRegistry &r = registry();
+    Lock _lock(r.mutex);
+    r.caches.insert(this);
+  }
 
-    // unlink block from list
-    if (block != nullptr) {
-      if (parent == nullptr) {
-        gMemPool = block->next;
-      } else {
-        parent->next = block->next;
+  // the blocks of a thread which ends are left to the others
+  ~ThreadCache() {
+    for (int c = 0; c < numPools; ++c) {
+      moveToDepot(c, counts[c]);
+    }
+    CacheRegistry &r = registry();
+    Lock _lock(r.mutex);
+    r.caches.erase(this);
+    r.endedAllocations += allocations;
+    r.endedReused += reused;
+  }
+
+  // move the first count blocks of the pool to the depot, or free them if
+  // the depot is full
+  void moveToDepot(int c, int count) {
+    if (count <= 0) {
+      return;
+    }
+    BlockHeader *first = lists[c];
+    BlockHeader *last = first;
+    for (int i = 1; i < count; ++i) {
+      last = last->next;
+    }
+    lists[c] = last->next;
+    counts[c] -= count;
+    uint64_t bytes = (uint64_t)count * poolSize(c);
+    addTo(cachedBytes, -bytes);
+
+    uint64_t maxFree = gMaxFreeBytes.load(std::memory_order_relaxed);
+    if (maxFree != 0 &&
+        gDepotBytes.load(std::memory_order_relaxed) + bytes > maxFree) {
+      // a burst of allocations shouldn't pin its memory for good
+      last->next = nullptr;
+      freeChain(first);
+      return;
+    }
+    gDepotBytes += bytes;
+    depotPush(c, first, last);
+  }
+
+  // fill the list of the pool from the depot, and give back what is more
+  // than half the limit of the thread
+  void refill(int c) {
+    BlockHeader *taken = depotTakeAll(c);
+    if (taken == nullptr) {
+      return;
+    }
+    int keep = (cacheLimit(c) < 2) ? 1 : cacheLimit(c) / 2;
+    BlockHeader *last = taken;
+    int n = 1;
+    while (n < keep && last->next != nullptr) {
+      last = last->next;
+      ++n;
+    }
+    BlockHeader *rest = last->next;
+    last->next = lists[c];
+    lists[c] = taken;
+    counts[c] += n;
+    uint64_t bytes = (uint64_t)n * poolSize(c);
+    addTo(cachedBytes, bytes);
+    gDepotBytes -= bytes;
+
+    if (rest != nullptr) {
+      BlockHeader *restLast = rest;
+      while (restLast->next != nullptr) {
+        restLast = restLast->next;
       }
+      depotPush(c, rest, restLast);
     }
   }
+};
+
+static thread_local ThreadCache tCache;
+
+MemBlock MemoryPool::allocate(int size, bool pageAligned) {
+  size_t wanted = (size > 0) ? (size_t)size : 0;
+  int sizeClass = sizeClassOf(wanted);
+
+  ThreadCache &cache = tCache;
+  addTo(cache.allocations, 1);
 
-  if (block == nullptr) {
-    block = allocBlock(size);
+  BlockHeader *block = nullptr;
+  if (sizeClass < 0) {
+    block = allocBlock(wanted, pageAligned, pageAligned ? -2 : -1);
+  } else {
+    int pool = pageAligned ? numClasses + sizeClass : sizeClass;
+    if (cache.lists[pool] == nullptr) {
+      cache.refill(pool);
+    }
+    block = cache.lists[pool];
+    if (block != nullptr) {
+      cache.lists[pool] = block->next;
+      --cache.counts[pool];
+      addTo(cache.reused, 1);
+      addTo(cache.cachedBytes, -(uint64_t)poolSize(pool));
+    } else {
+      block = allocBlock(classSize(sizeClass), pageAligned, pool);
+    }
   }
   block->next = nullptr;
+  block->used = (int)wanted;
 
   MemBlock result;
-  result.data = BLOCKDATA(block);
+  result.data = block->data;
   result.internalData = block;
 
-  VALGRIND_MAKE_MEM_UNDEFINED(result.data, size);
+  VALGRIND_MAKE_MEM_UNDEFINED(result.data, wanted);
 
   return result;
 }
 
 void MemoryPool::release(const MemBlock &mb) {
-  boost::lock_guard<boost::mutex> lock(gMPoolMutex);
+  auto *block = (BlockHeader *)mb.internalData;
 
-  auto *block = (BlockList *)mb.internalData;
+  // just to be sure there's nothing important left in buffers..  Only the
+  // requested part can have been used, the rest was scrubbed before.
+  VALGRIND_MAKE_MEM_UNDEFINED(block->data, block->used);
+  memset(block->data, 0, block->used);
 
-  // just to be sure there's nothing important left in buffers..
-  VALGRIND_MAKE_MEM_UNDEFINED(block->data->data, block->size);
-  memset(BLOCKDATA(block), 0, block->size);
-  VALGRIND_MAKE_MEM_NOACCESS(block->data->data, block->data->max);
+  int pool = block->pool;
+  if (pool < 0) {
+    freeBlock(block);
+    return;
+  }
+  VALGRIND_MAKE_MEM_NOACCESS(block->data, poolSize(pool));
 
-  block->next = gMemPool;
-  gMemPool = block;
+  ThreadCache &cache = tCache;
+  block->next = cache.lists[pool];
+  cache.lists[pool] = block;
+  addTo(cache.cachedBytes, poolSize(pool));
+  int limit = cacheLimit(pool);
+  if (++cache.counts[pool] > limit) {
+    cache.moveToDepot(pool, cache.counts[pool] - limit / 2);
+  }
 }
 
 void MemoryPool::destroyAll() {
-  BlockList *block = nullptr;
-  {
-    boost::lock_guard<boost::mutex> lock(gMPoolMutex);
+  uint64_t freed = 0;
+  ThreadCache &cache = tCache;
+  for (int c = 0; c < numPools; ++c) {
+    cache.moveToDepot(c, cache.counts[c]);
 
-    block = gMemPool;
-    gMemPool = nullptr;
+    BlockHeader *block = depotTakeAll(c);
+    uint64_t bytes = 0;
+    for (BlockHeader *b = block; b != nullptr; b = b->next) {
+      bytes += poolSize(c);
+    }
+    gDepotBytes -= bytes;
+    freed += bytes;
+    freeChain(block);
   }
+  gDestroyedBytes += freed;
+  VLOG(1) << "memory pool freed " << freed << " bytes";
+}
 
-  while (block != nullptr) {
-    BlockList *next = block->next;
+void MemoryPool::setMaxFreeBytes(size_t maxFreeBytes) {
+  gMaxFreeBytes = maxFreeBytes;
+}
 
-    freeBlock(block);
-    block = next;
+MemoryPoolStats MemoryPool::stats() {
+  MemoryPoolStats st;
+  st.allocations = 0;
+  st.reused = 0;
+  st.freeBytes = gDepotBytes;
+  {
+    CacheRegistry &r = registry();
+    Lock _lock(r.mutex);
+    st.allocations = r.endedAllocations;
+    st.reused = r.endedReused;
+    std::set<ThreadCache *>::const_iterator it;
+    for (it = r.caches.begin(); it != r.caches.end(); ++it) {
+      st.allocations += (*it)->allocations.load(std::memory_order_relaxed);
+      st.reused += (*it)->reused.load(std::memory_order_relaxed);
+      st.freeBytes += (*it)->cachedBytes.load(std::memory_order_relaxed);
+    }
   }
+  st.newBlocks = gNewBlocks;
+  st.residentBytes = gResidentBytes;
+  st.peakResidentBytes = gPeakResidentBytes;
+  st.destroyedBytes = gDestroyedBytes;
+  return st;
 }
 
 }  // namespace encfs
@@ -21,6 +21,9 @@
 #ifndef _MemoryPool_incl_
 #define _MemoryPool_incl_
 
+#include <cstddef>
+#include <stdint.h>
+
 namespace encfs {
 
 struct MemBlock {
@@ -33,6 +36,16 @@ struct MemBlock {
 
 inline MemBlock::MemBlock() : data(0), internalData(0) {}
 
+struct MemoryPoolStats {
+  uint64_t allocations;        // calls of allocate()
+  uint64_t reused;             // allocations served with a free block
+  uint64_t newBlocks;          // blocks allocated from the heap
+  uint64_t residentBytes;      // bytes of all blocks, in use or free
+  uint64_t peakResidentBytes;  // most residentBytes so far
+  uint64_t freeBytes;          // bytes of the free blocks kept for reuse
+  uint64_t destroyedBytes;     // bytes freed by destroyAll()
+};
+
 /*
     Memory Pool for fixed sized objects.
 
@@ -43,9 +56,20 @@ inline MemBlock::MemBlock() : data(0), internalData(0) {}
     MemoryPool::release( mb );
 */
 namespace MemoryPool {
-MemBlock allocate(int size);
+// the data of a block is aligned to cacheLineAlignment, or to pageAlignment
+// if pageAligned is set (for unbuffered I/O)
+const size_t cacheLineAlignment = 64;
+const size_t pageAlignment = 4096;
+
+MemBlock allocate(int size, bool pageAligned = false);
 void release(const MemBlock &el);
+// free the blocks which are not in use, except those cached by other threads
 void destroyAll();
+
+// limit the free bytes kept in the global depot, 0 for no limit.  Each
+// thread additionally keeps up to 256 KB per size class.
+void setMaxFreeBytes(size_t maxFreeBytes);
+MemoryPoolStats stats();
 }
 
 }  // namespace encfs
@@ -51,6 +51,10 @@ inline Lock::~Lock() {
 
 inline void Lock::leave() { _mutex = 0; }
 
+// reader/writer locks of a boost::shared_mutex
+typedef boost::shared_lock<boost::shared_mutex> SharedLock;
+typedef boost::unique_lock<boost::shared_mutex> ExclusiveLock;
+
 }  // namespace encfs
 
 #endif
@@ -0,0 +1,217 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "NameCodingCache.h"
+
+#include <cstring>
+
+#include "Mutex.h"
+
+namespace encfs {
+
+// key of the path or component name after the direction and the IV
+static const size_t keyHeaderSize = 1 + sizeof(uint64_t);
+
+static bool isInTree(const char *path, size_t length, const char *dirPath,
+                     size_t dirLength) {
+  return length >= dirLength && memcmp(path, dirPath, dirLength) == 0 &&
+         (length == dirLength || path[dirLength] == '/');
+}
+
+NameCodingCache::NameCodingCache(size_t maxEntries, size_t maxDirs)
+    : _maxEntries(maxEntries), _maxDirs(maxDirs), _hits(0), _misses(0) {}
+
+NameCodingCache::~NameCodingCache() = default;
+
+bool NameCodingCache::lookup(bool encoding, uint64_t parentIV,
+                             const char *name, int length, std::string *coded,
+                             uint64_t *childIV) {
+  // reused, so that lookups don't allocate
+  static thread_local std::string key;
+  makeKey(encoding, parentIV, name, length, key);
+
+  Lock _lock(_mutex);
+
+  auto it = _index.find(key);
+  if (it == _index.end()) {
+    ++_misses;
+    return false;
+  }
+  _entries.splice(_entries.begin(), _entries, it->second);
+  coded->append(it->second->coded);
+  *childIV = it->second->childIV;
+  ++_hits;
+  return true;
+}
+
+void NameCodingCache::insert(bool encoding, uint64_t parentIV,
+                             const char *name, int length,
+                             const std::string &coded, uint64_t childIV) {
+  std::string key = makeKey(encoding, parentIV, name, length);
+  std::string reverseKey =
+      makeKey(!encoding, parentIV, coded.data(), (int)coded.size());
+
+  Lock _lock(_mutex);
+
+  insertKey(key, coded, childIV);
+  insertKey(reverseKey, std::string(name, length), childIV);
+}
+
+size_t NameCodingCache::lookupDir(bool encoding, uint64_t startIV,
+                                  const char *path, std::string *coded,
+                                  uint64_t *childIV) {
+  size_t length = strlen(path);
+  static thread_local std::string key;
+  makeKey(encoding, startIV, path, (int)length, key);
+
+  Lock _lock(_mutex);
+
+  if (_dirs.empty()) {
+    return 0;
+  }
+  // try the directories from the deepest one up, each ends before a '/'
+  for (size_t pos = length; pos > 1; --pos) {
+    if (path[pos - 1] != '/') {
+      continue;
+    }
+    key.resize(keyHeaderSize + pos - 1);
+    auto it = _dirs.find(key);
+    if (it != _dirs.end()) {
+      *coded = it->second.coded;
+      if (childIV != nullptr) {
+        *childIV = it->second.childIV;
+      }
+      return pos - 1;
+    }
+  }
+  return 0;
+}
+
+void NameCodingCache::insertDir(bool encoding, uint64_t startIV,
+                                const char *path, size_t length,
+                                const std::string &coded, uint64_t childIV) {
+  std::string key = makeKey(encoding, startIV, path, (int)length);
+
+  Lock _lock(_mutex);
+
+  if (_dirs.size() >= _maxDirs && _dirs.count(key) == 0) {
+    if (_dirs.empty()) {
+      return;
+    }
+    // no need for anything smarter, the path is cheap to code again
+    _dirs.erase(_dirs.begin());
+  }
+
+  DirEntry &entry = _dirs[key];
+  entry.coded = coded;
+  entry.childIV = childIV;
+}
+
+void NameCodingCache::forgetTree(const char *path) {
+  size_t length = strlen(path);
+  // coded paths don't start with '/'
+  const char *codedPath = path;
+  while (*codedPath == '/') {
+    ++codedPath;
+  }
+  size_t codedLength = strlen(codedPath);
+
+  Lock _lock(_mutex);
+
+  auto it = _dirs.begin();
+  while (it != _dirs.end()) {
+    const std::string &key = it->first;
+    const std::string &coded = it->second.coded;
+    if (isInTree(key.data() + keyHeaderSize, key.size() - keyHeaderSize, path,
+                 length) ||
+        isInTree(coded.data(), coded.size(), codedPath, codedLength)) {
+      it = _dirs.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void NameCodingCache::clear() {
+  Lock _lock(_mutex);
+
+  _index.clear();
+  _entries.clear();
+}
+
+std::vector<NameCodingCache::Entry> NameCodingCache::entries() {
+  Lock _lock(_mutex);
+
+  return std::vector<Entry>(_entries.rbegin(), _entries.rend());
+}
+
+void NameCodingCache::restore(const std::vector<Entry> &entries) {
+  Lock _lock(_mutex);
+
+  for (const Entry &entry : entries) {
+    // a key without direction and IV is no key of ours
+    if (entry.key.size() > keyHeaderSize) {
+      insertKey(entry.key, entry.coded, entry.childIV);
+    }
+  }
+}
+
+void NameCodingCache::makeKey(bool encoding, uint64_t parentIV,
+                              const char *name, int length,
+                              std::string &key) {
+  key.assign(1, encoding ? 'e' : 'd');
+  key.append((const char *)&parentIV, sizeof(parentIV));
+  key.append(name, length);
+}
+
+std::string NameCodingCache::makeKey(bool encoding, uint64_t parentIV,
+                                     const char *name, int length) {
+  std::string key;
+  makeKey(encoding, parentIV, name, length, key);
+  return key;
+}
+
+void NameCodingCache::insertKey(const std::string &key,
+                                const std::string &coded, uint64_t childIV) {
+  auto it = _index.find(key);
+  if (it != _index.end()) {
+    _entries.splice(_entries.begin(), _entries, it->second);
+    it->second->coded = coded;
+    it->second->childIV = childIV;
+    return;
+  }
+
+  if (_entries.size() >= _maxEntries) {
+    if (_entries.empty()) {
+      return;
+    }
+    _index.erase(_entries.back().key);
+    _entries.pop_back();
+  }
+
+  Entry entry;
+  entry.key = key;
+  entry.coded = coded;
+  entry.childIV = childIV;
+  _entries.push_front(entry);
+  _index[key] = _entries.begin();
+}
+
+}  // namespace encfs
@@ -0,0 +1,126 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NameCodingCache_incl_
+#define _NameCodingCache_incl_
+
+#include <atomic>
+#include <list>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+namespace encfs {
+
+/*
+    Cache of encoded and decoded filename components, used by NameIO.
+
+    Every path is coded one component after the other, starting from the
+    root, and with chained name IVs each component depends on the IV of its
+    parent.  The cache maps (parent IV, component) to the coded component
+    and the IV of the child, separately for encoding and decoding.  Each
+    coded name is stored in both directions, so that a name listed in a
+    directory can be opened without encrypting it again.
+
+    The oldest entries are dropped once maxEntries is reached.
+
+    Additionally, the coding of up to maxDirs directory paths is cached
+    together with the IV at their end, so that a path below one of them
+    only needs its remaining components to be coded.
+*/
+class NameCodingCache {
+ public:
+  NameCodingCache(size_t maxEntries, size_t maxDirs);
+  ~NameCodingCache();
+
+  // returns true, appends the coded component to coded and sets childIV
+  // if the component is cached
+  bool lookup(bool encoding, uint64_t parentIV, const char *name, int length,
+              std::string *coded, uint64_t *childIV);
+  // remember that name codes to coded, and the reverse
+  void insert(bool encoding, uint64_t parentIV, const char *name, int length,
+              const std::string &coded, uint64_t childIV);
+
+  // finds the longest directory of path which is cached, for a coding
+  // which starts with startIV.  Sets coded and *childIV (unless null) and
+  // returns the length of the directory, or returns 0.
+  size_t lookupDir(bool encoding, uint64_t startIV, const char *path,
+                   std::string *coded, uint64_t *childIV);
+  void insertDir(bool encoding, uint64_t startIV, const char *path,
+                 size_t length, const std::string &coded, uint64_t childIV);
+  // forget the directories at or below path, plaintext or coded
+  void forgetTree(const char *path);
+
+  // forget the cached components, but not the directories
+  void clear();
+
+  // a cached component, in the form the cache keeps it
+  struct Entry {
+    std::string key;
+    std::string coded;
+    uint64_t childIV;
+  };
+  // the cached components, least recently used first.  The coding only
+  // depends on the volume key, so they can be kept for the next mount.
+  std::vector<Entry> entries();
+  // adds entries in their order, the last one as the most recently used
+  void restore(const std::vector<Entry> &entries);
+
+  // component lookups, see lookup()
+  uint64_t hits() const { return _hits; }
+  uint64_t misses() const { return _misses; }
+
+ private:
+  NameCodingCache(const NameCodingCache &src);             // not allowed
+  NameCodingCache &operator=(const NameCodingCache &src);  // not allowed
+
+  typedef std::list<Entry> EntryList;
+
+  struct DirEntry {
+    std::string coded;
+    uint64_t childIV;
+  };
+
+  static std::string makeKey(bool encoding, uint64_t parentIV,
+                             const char *name, int length);
+  static void makeKey(bool encoding, uint64_t parentIV, const char *name,
+                      int length, std::string &key);
+  void insertKey(const std::string &key, const std::string &coded,
+                 uint64_t childIV);
+
+  size_t _maxEntries;
+  EntryList _entries;  // most recently used first
+  std::unordered_map<std::string, EntryList::iterator> _index;
+
+  size_t _maxDirs;
+  std::unordered_map<std::string, DirEntry> _dirs;
+
+  std::atomic<uint64_t> _hits;
+  std::atomic<uint64_t> _misses;
+
+  boost::mutex _mutex;
+};
+
+}  // namespace encfs
+
+#endif
@@ -32,7 +32,9 @@
 #include "CipherKey.h"
 #include "Error.h"
 #include "Interface.h"
+#include "NameCodingCache.h"
 #include "NullNameIO.h"
+#include "PhaseTimer.h"
 #include "StreamNameIO.h"
 
 using namespace std;
@@ -135,18 +137,47 @@ void NameIO::setChainedNameIV(bool enable) { chainedNameIV = enable; }
 
 bool NameIO::getChainedNameIV() const { return chainedNameIV; }
 
+void NameIO::setNameCache(const std::shared_ptr<NameCodingCache> &cache) {
+  nameCache = cache;
+}
+
+void NameIO::clearNameCache() const {
+  if (nameCache) {
+    nameCache->clear();
+  }
+}
+
+void NameIO::forgetNameTree(const char *path) const {
+  if (nameCache) {
+    nameCache->forgetTree(path);
+  }
+}
+
 void NameIO::setReverseEncryption(bool enable) { reverseEncryption = enable; }
 
 bool NameIO::getReverseEncryption() const { return reverseEncryption; }
 
-std::string NameIO::recodePath(
-    const char *path, int (NameIO::*_length)(int) const,
+bool NameIO::recodePath(
+    const char *path, bool encoding, int (NameIO::*_length)(int) const,
     int (NameIO::*_code)(const char *, int, uint64_t *, char *, int) const,
-    uint64_t *iv) const {
-  string output;
+    uint64_t *iv, std::string &output) const {
+  const char *start = path;
+  uint64_t startIV = (iv != nullptr) ? *iv : 0;
+  output.clear();
+
+  // continue after the longest directory which was coded before
+  if (nameCache) {
+    path += nameCache->lookupDir(encoding, startIV, start, &output, iv);
+  }
+  bool newDir = false;  // a component was coded since the last directory
 
   while (*path != 0) {
     if (*path == '/') {
+      if (newDir) {
+        nameCache->insertDir(encoding, startIV, start, path - start, output,
+                             (iv != nullptr) ? *iv : 0);
+        newDir = false;
+      }
       if (!output.empty()) {  // don't start the string with '/'
         output += '/';
       }
@@ -163,29 +194,57 @@ std::string NameIO::recodePath(
         continue;
       }
 
+      uint64_t parentIV = (iv != nullptr) ? *iv : 0;
+      if (nameCache) {
+        uint64_t childIV = 0;
+        if (nameCache->lookup(encoding, parentIV, path, len, &output,
+                              &childIV)) {
+          if (iv != nullptr) {
+            *iv = childIV;
+          }
+          path += len;
+          newDir = true;
+          continue;
+        }
+      }
+
       // figure out buffer sizes
       int approxLen = (this->*_length)(len);
       if (approxLen <= 0) {
+        if (_code == &NameIO::tryDecodeName) {
+          return false;
+        }
         throw Error("Filename too small to decode");
       }
       int bufSize = 0;
 
-      BUFFER_INIT_S(codeBuf, 32, (unsigned int)approxLen + 1, bufSize)
+      BUFFER_INIT_S(codeBuf, NameBufferSize, (unsigned int)approxLen + 1,
+                    bufSize)
 
       // code the name
       int codedLen = (this->*_code)(path, len, iv, codeBuf, bufSize);
+      if (codedLen < 0) {
+        BUFFER_RESET(codeBuf)
+        return false;
+      }
       rAssert(codedLen <= approxLen);
       rAssert(codeBuf[codedLen] == '\0');
+
+      if (nameCache) {
+        nameCache->insert(encoding, parentIV, path, len,
+                          std::string(codeBuf, codedLen),
+                          (iv != nullptr) ? *iv : 0);
+        newDir = true;
+      }
       path += len;
 
       // append result to string
-      output += (char *)codeBuf;
+      output.append(codeBuf, codedLen);
 
       BUFFER_RESET(codeBuf)
     }
   }
-
-  return output;
+  return true;
 }
 
 std::string NameIO::encodePath(const char *plaintextPath) const {
@@ -198,30 +257,75 @@ std::string NameIO::decodePath(const char *cipherPath) const {
   return decodePath(cipherPath, &iv);
 }
 
-std::string NameIO::_encodePath(const char *plaintextPath, uint64_t *iv) const {
+void NameIO::_encodePath(const char *plaintextPath, uint64_t *iv,
+                         std::string &result) const {
   // if chaining is not enabled, then the iv pointer is not used..
   if (!chainedNameIV) {
     iv = nullptr;
   }
-  return recodePath(plaintextPath, &NameIO::maxEncodedNameLen,
-                    &NameIO::encodeName, iv);
+  recodePath(plaintextPath, true, &NameIO::maxEncodedNameLen,
+             &NameIO::encodeName, iv, result);
 }
 
-std::string NameIO::_decodePath(const char *cipherPath, uint64_t *iv) const {
+void NameIO::_decodePath(const char *cipherPath, uint64_t *iv,
+                         std::string &result) const {
+  TIMED_PHASE(PhaseNameDecode);
   // if chaining is not enabled, then the iv pointer is not used..
   if (!chainedNameIV) {
     iv = nullptr;
   }
-  return recodePath(cipherPath, &NameIO::maxDecodedNameLen, &NameIO::decodeName,
-                    iv);
+  recodePath(cipherPath, false, &NameIO::maxDecodedNameLen,
+             &NameIO::decodeName, iv, result);
 }
 
 std::string NameIO::encodePath(const char *path, uint64_t *iv) const {
-  return getReverseEncryption() ? _decodePath(path, iv) : _encodePath(path, iv);
+  std::string result;
+  encodePath(path, iv, result);
+  return result;
 }
 
 std::string NameIO::decodePath(const char *path, uint64_t *iv) const {
-  return getReverseEncryption() ? _encodePath(path, iv) : _decodePath(path, iv);
+  std::string result;
+  decodePath(path, iv, result);
+  return result;
+}
+
+void NameIO::encodePath(const char *path, uint64_t *iv,
+                        std::string &result) const {
+  if (getReverseEncryption()) {
+    _decodePath(path, iv, result);
+  } else {
+    _encodePath(path, iv, result);
+  }
+}
+
+void NameIO::decodePath(const char *path, uint64_t *iv,
+                        std::string &result) const {
+  if (getReverseEncryption()) {
+    _encodePath(path, iv, result);
+  } else {
+    _decodePath(path, iv, result);
+  }
+}
+
+bool NameIO::tryDecodePath(const char *path, uint64_t *iv,
+                           std::string &result) const {
+  if (getReverseEncryption()) {
+    try {
+      _encodePath(path, iv, result);
+    } catch (encfs::Error &err) {
+      return false;
+    }
+    return true;
+  }
+
+  TIMED_PHASE(PhaseNameDecode);
+  // if chaining is not enabled, then the iv pointer is not used..
+  if (!chainedNameIV) {
+    iv = nullptr;
+  }
+  return recodePath(path, false, &NameIO::maxDecodedNameLen,
+                    &NameIO::tryDecodeName, iv, result);
 }
 
 int NameIO::encodeName(const char *input, int length, char *output,
@@ -234,52 +338,77 @@ int NameIO::decodeName(const char *input, int length, char *output,
   return decodeName(input, length, (uint64_t *)nullptr, output, bufferLength);
 }
 
-std::string NameIO::_encodeName(const char *plaintextName, int length) const {
-  int approxLen = maxEncodedNameLen(length);
-  int bufSize = 0;
+bool NameIO::isValidEncodedName(const char *encodedName, int length) const {
+  (void)encodedName;
+  (void)length;
+  return true;
+}
+
+int NameIO::tryDecodeName(const char *encodedName, int length, uint64_t *iv,
+                          char *plaintextName, int bufferLength) const {
+  if (!isValidEncodedName(encodedName, length)) {
+    return -1;
+  }
+  try {
+    return decodeName(encodedName, length, iv, plaintextName, bufferLength);
+  } catch (encfs::Error &err) {
+    VLOG(1) << "error decoding filename: " << err.what();
+    return -1;
+  }
+}
 
-  BUFFER_INIT_S(codeBuf, 32, (unsigned int)approxLen + 1, bufSize)
+int NameIO::codeName(bool encoding, const char *name, int length, char *buf,
+                     int bufLength) const {
+  int approxLen =
+      encoding ? maxEncodedNameLen(length) : maxDecodedNameLen(length);
+  rAssert(approxLen < bufLength);
 
   // code the name
-  int codedLen = encodeName(plaintextName, length, nullptr, codeBuf, bufSize);
+  int codedLen = encoding ? encodeName(name, length, nullptr, buf, bufLength)
+                          : decodeName(name, length, nullptr, buf, bufLength);
   rAssert(codedLen <= approxLen);
-  rAssert(codeBuf[codedLen] == '\0');
+  // the coding functions rely on buffers which are cleared beforehand
+  buf[codedLen] = '\0';
 
-  // append result to string
-  std::string result = (char *)codeBuf;
-
-  BUFFER_RESET(codeBuf)
-
-  return result;
+  return codedLen;
 }
 
-std::string NameIO::_decodeName(const char *encodedName, int length) const {
-  int approxLen = maxDecodedNameLen(length);
+std::string NameIO::codeName(bool encoding, const char *name,
+                             int length) const {
+  int approxLen =
+      encoding ? maxEncodedNameLen(length) : maxDecodedNameLen(length);
   int bufSize = 0;
 
-  BUFFER_INIT_S(codeBuf, 32, (unsigned int)approxLen + 1, bufSize)
+  BUFFER_INIT_S(codeBuf, NameBufferSize, (unsigned int)approxLen + 1, bufSize)
 
-  // code the name
-  int codedLen = decodeName(encodedName, length, nullptr, codeBuf, bufSize);
-  rAssert(codedLen <= approxLen);
-  rAssert(codeBuf[codedLen] == '\0');
-
-  // append result to string
-  std::string result = (char *)codeBuf;
+  int codedLen = codeName(encoding, name, length, codeBuf, bufSize);
+  std::string result(codeBuf, codedLen);
 
   BUFFER_RESET(codeBuf)
 
   return result;
 }
 
+int NameIO::encodeNameInto(const char *plaintextName, int length, char *buf,
+                           int bufLength) const {
+  return codeName(!getReverseEncryption(), plaintextName, length, buf,
+                  bufLength);
+}
+
+int NameIO::decodeNameInto(const char *encodedName, int length, char *buf,
+                           int bufLength) const {
+  TIMED_PHASE(PhaseNameDecode);
+  return codeName(getReverseEncryption(), encodedName, length, buf,
+                  bufLength);
+}
+
 std::string NameIO::encodeName(const char *path, int length) const {
-  return getReverseEncryption() ? _decodeName(path, length)
-                                : _encodeName(path, length);
+  return codeName(!getReverseEncryption(), path, length);
 }
 
 std::string NameIO::decodeName(const char *path, int length) const {
-  return getReverseEncryption() ? _encodeName(path, length)
-                                : _decodeName(path, length);
+  TIMED_PHASE(PhaseNameDecode);
+  return codeName(getReverseEncryption(), path, length);
 }
 /*
 int NameIO::encodeName( const char *path, int length,
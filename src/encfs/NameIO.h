@@ -36,6 +36,7 @@
 namespace encfs {
 
 class Cipher;
+class NameCodingCache;
 
 class NameIO {
  public:
@@ -73,18 +74,46 @@ class NameIO {
   void setReverseEncryption(bool enable);
   bool getReverseEncryption() const;
 
+  // remember coded path components in cache, shared by all paths
+  void setNameCache(const std::shared_ptr<NameCodingCache> &cache);
+  void clearNameCache() const;
+  const std::shared_ptr<NameCodingCache> &getNameCache() const {
+    return nameCache;
+  }
+  // forget the cached directories at and below path, after a rename
+  void forgetNameTree(const char *path) const;
+
   std::string encodePath(const char *plaintextPath) const;
   std::string decodePath(const char *encodedPath) const;
 
   std::string encodePath(const char *plaintextPath, uint64_t *iv) const;
   std::string decodePath(const char *encodedPath, uint64_t *iv) const;
 
+  // same as above, but replace the contents of result, so that a string
+  // which is reused doesn't need to allocate again
+  void encodePath(const char *plaintextPath, uint64_t *iv,
+                  std::string &result) const;
+  void decodePath(const char *encodedPath, uint64_t *iv,
+                  std::string &result) const;
+  // same as above, but return false instead of throwing if a name can't be
+  // decoded, e.g. for files which were not created through encfs
+  bool tryDecodePath(const char *encodedPath, uint64_t *iv,
+                     std::string &result) const;
+
   virtual int maxEncodedNameLen(int plaintextNameLen) const = 0;
   virtual int maxDecodedNameLen(int encodedNameLen) const = 0;
 
   std::string encodeName(const char *plaintextName, int length) const;
   std::string decodeName(const char *encodedName, int length) const;
 
+  // same as above, but write the name with a terminating 0 into buf,
+  // which has bufLength bytes.  NameBufferSize bytes are enough for names
+  // of up to 255 bytes.  Returns the length of the name.
+  int encodeNameInto(const char *plaintextName, int length, char *buf,
+                     int bufLength) const;
+  int decodeNameInto(const char *encodedName, int length, char *buf,
+                     int bufLength) const;
+
  protected:
   virtual int encodeName(const char *plaintextName, int length,
                          char *encodedName, int bufferLength) const;
@@ -96,20 +125,33 @@ class NameIO {
   virtual int decodeName(const char *encodedName, int length, uint64_t *iv,
                          char *plaintextName, int bufferLength) const = 0;
 
- private:
-  std::string recodePath(const char *path, int (NameIO::*codingLen)(int) const,
-                         int (NameIO::*codingFunc)(const char *, int,
-                                                   uint64_t *, char *, int)
-                             const,
-                         uint64_t *iv) const;
+  // cheap check whether encodeName() could have produced this name, by its
+  // length and characters.  Names which fail it are not decoded at all.
+  virtual bool isValidEncodedName(const char *encodedName, int length) const;
+  // same as decodeName(), but returns -1 instead of throwing if the name is
+  // invalid.  The default calls decodeName() and catches the error.
+  virtual int tryDecodeName(const char *encodedName, int length, uint64_t *iv,
+                            char *plaintextName, int bufferLength) const;
 
-  std::string _encodePath(const char *plaintextPath, uint64_t *iv) const;
-  std::string _decodePath(const char *encodedPath, uint64_t *iv) const;
-  std::string _encodeName(const char *plaintextName, int length) const;
-  std::string _decodeName(const char *encodedName, int length) const;
+ private:
+  // returns false if codingFunc returns a negative length
+  bool recodePath(const char *path, bool encoding,
+                  int (NameIO::*codingLen)(int) const,
+                  int (NameIO::*codingFunc)(const char *, int, uint64_t *,
+                                            char *, int) const,
+                  uint64_t *iv, std::string &output) const;
+
+  void _encodePath(const char *plaintextPath, uint64_t *iv,
+                   std::string &result) const;
+  void _decodePath(const char *encodedPath, uint64_t *iv,
+                   std::string &result) const;
+  int codeName(bool encoding, const char *name, int length, char *buf,
+               int bufLength) const;
+  std::string codeName(bool encoding, const char *name, int length) const;
 
   bool chainedNameIV;
   bool reverseEncryption;
+  std::shared_ptr<NameCodingCache> nameCache;
 };
 
 /*
@@ -119,6 +161,11 @@ class NameIO {
 
     BUFFER_RESET should be called for the same name as BUFFER_INIT
 */
+
+// stack buffer size for the coding of a name, large enough for the coded form
+// of a name with the 255 bytes most filesystems allow
+static const int NameBufferSize = 512;
+
 #define BUFFER_INIT(Name, OptimizedSize, Size)          \
   char Name##_Raw[OptimizedSize];                       \
   char *Name = Name##_Raw;                              \
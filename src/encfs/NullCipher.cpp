@@ -152,6 +152,16 @@ bool NullCipher::blockDecode(unsigned char *, int, uint64_t,
   return true;
 }
 
+bool NullCipher::blockEncodeMany(const Block *, int, int,
+                                 const CipherKey &) const {
+  return true;
+}
+
+bool NullCipher::blockDecodeMany(const Block *, int, int,
+                                 const CipherKey &) const {
+  return true;
+}
+
 bool NullCipher::Enabled() { return true; }
 
 }  // namespace encfs
@@ -77,6 +77,10 @@ class NullCipher : public Cipher {
                            const CipherKey &key) const;
   virtual bool blockDecode(unsigned char *buf, int size, uint64_t iv64,
                            const CipherKey &key) const;
+  virtual bool blockEncodeMany(const Block *blocks, int count, int size,
+                               const CipherKey &key) const;
+  virtual bool blockDecodeMany(const Block *blocks, int count, int size,
+                               const CipherKey &key) const;
 
   // hack to help with static builds
   static bool Enabled();
@@ -0,0 +1,199 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PhaseTimer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <set>
+#include <sstream>
+
+#include "Mutex.h"
+#include "easylogging++.h"
+
+namespace encfs {
+
+// bucket i counts durations below 2^i ns, the last one all others
+static const int histogramBucketCount = 32;
+
+struct PhaseCounters {
+  std::atomic<uint64_t> calls;
+  std::atomic<uint64_t> totalNanos;
+  std::atomic<uint64_t> maxNanos;
+  std::atomic<uint64_t> histogram[histogramBucketCount];
+
+  PhaseCounters() : calls(0), totalNanos(0), maxNanos(0) {
+    for (int i = 0; i < histogramBucketCount; ++i) {
+      histogram[i] = 0;
+    }
+  }
+};
+
+// sums of the counters, for report()
+struct PhaseTotals {
+  uint64_t calls;
+  uint64_t totalNanos;
+  uint64_t maxNanos;
+  uint64_t histogram[histogramBucketCount];
+
+  PhaseTotals() : calls(0), totalNanos(0), maxNanos(0) {
+    for (int i = 0; i < histogramBucketCount; ++i) {
+      histogram[i] = 0;
+    }
+  }
+
+  void add(const PhaseCounters &c) {
+    calls += c.calls.load(std::memory_order_relaxed);
+    totalNanos += c.totalNanos.load(std::memory_order_relaxed);
+    maxNanos = std::max(maxNanos, c.maxNanos.load(std::memory_order_relaxed));
+    for (int i = 0; i < histogramBucketCount; ++i) {
+      histogram[i] += c.histogram[i].load(std::memory_order_relaxed);
+    }
+  }
+};
+
+// counters which are only changed by their own thread, and read by report()
+static void addTo(std::atomic<uint64_t> &counter, uint64_t n) {
+  counter.store(counter.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+}
+
+struct ThreadPhases;
+
+// the histograms of all threads.  Never destroyed, threads may end after the
+// static objects are gone.
+struct PhaseRegistry {
+  boost::mutex mutex;
+  std::set<ThreadPhases *> threads;
+  PhaseTotals ended[PhaseCount];  // of the threads which have ended
+};
+
+static PhaseRegistry &registry() {
+  static PhaseRegistry *r = new PhaseRegistry;
+  return *r;
+}
+
+struct ThreadPhases {
+  PhaseCounters phases[PhaseCount];
+
+  ThreadPhases() {
+    PhaseRegistry &r = registry();
+    Lock _lock(r.mutex);
+    r.threads.insert(this);
+  }
+
+  ~ThreadPhases() {
+    PhaseRegistry &r = registry();
+    Lock _lock(r.mutex);
+    r.threads.erase(this);
+    for (int p = 0; p < PhaseCount; ++p) {
+      r.ended[p].add(phases[p]);
+    }
+  }
+};
+
+static thread_local ThreadPhases tPhases;
+
+bool PhaseTimers::enabled() {
+#if defined(ENCFS_PHASE_TIMERS)
+  return true;
+#else
+  return false;
+#endif
+}
+
+void PhaseTimers::record(TimedPhase phase, uint64_t nanos) {
+  PhaseCounters &c = tPhases.phases[phase];
+  addTo(c.calls, 1);
+  addTo(c.totalNanos, nanos);
+  if (nanos > c.maxNanos.load(std::memory_order_relaxed)) {
+    c.maxNanos.store(nanos, std::memory_order_relaxed);
+  }
+
+  int bucket = 0;
+  while (bucket < histogramBucketCount - 1 && (nanos >> bucket) != 0) {
+    ++bucket;
+  }
+  addTo(c.histogram[bucket], 1);
+}
+
+std::string PhaseTimers::report() {
+  PhaseTotals totals[PhaseCount];
+  {
+    PhaseRegistry &r = registry();
+    Lock _lock(r.mutex);
+    for (int p = 0; p < PhaseCount; ++p) {
+      totals[p] = r.ended[p];
+    }
+    std::set<ThreadPhases *>::const_iterator it;
+    for (it = r.threads.begin(); it != r.threads.end(); ++it) {
+      for (int p = 0; p < PhaseCount; ++p) {
+        totals[p].add((*it)->phases[p]);
+      }
+    }
+  }
+
+  std::ostringstream ostr;
+  ostr << std::left << std::setw(12) << "Phase" << std::right
+       << std::setw(12) << "Calls" << std::setw(12) << "Avg [ns]"
+       << std::setw(14) << "Max [ns]"
+       << "  Histogram [calls below 1, 2, 4, ... ns]" << std::endl;
+  for (int p = 0; p < PhaseCount; ++p) {
+    const PhaseTotals &t = totals[p];
+    if (t.calls == 0) {
+      continue;
+    }
+    ostr << std::left << std::setw(12) << phaseName((TimedPhase)p)
+         << std::right << std::setw(12) << t.calls << std::setw(12)
+         << (t.totalNanos / t.calls) << std::setw(14) << t.maxNanos << " ";
+
+    // leave out the empty buckets at both ends
+    int first = 0, last = histogramBucketCount - 1;
+    while (first < last && t.histogram[first] == 0) {
+      ++first;
+    }
+    while (last > first && t.histogram[last] == 0) {
+      --last;
+    }
+    ostr << " [<" << ((uint64_t)1 << first) << " ns]";
+    for (int i = first; i <= last; ++i) {
+      ostr << " " << t.histogram[i];
+    }
+    ostr << std::endl;
+  }
+  return ostr.str();
+}
+
+void PhaseTimers::logReport() {
+  std::istringstream lines(report());
+  std::string line;
+  while (std::getline(lines, line)) {
+    CLOG(INFO, "performance") << line;
+  }
+}
+
+const char *PhaseTimers::phaseName(TimedPhase phase) {
+  static const char *names[PhaseCount] = {"RawRead", "Decrypt", "MACVerify",
+                                          "NameDecode", "Stat"};
+  return names[phase];
+}
+
+}  // namespace encfs
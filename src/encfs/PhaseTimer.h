@@ -0,0 +1,97 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PhaseTimer_incl_
+#define _PhaseTimer_incl_
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+
+namespace encfs {
+
+/*
+    Latency histograms of the phases of reading a file and of name coding,
+    for profiling release builds in the field.
+
+    The timers are only compiled in with ENCFS_PHASE_TIMERS defined (the
+    ENCFS_PHASE_TIMERS option of CMake), otherwise TIMED_PHASE() expands to
+    nothing.  Every thread records into histograms of its own, report()
+    adds up the histograms of all threads.
+
+    Usage:
+    {
+      TIMED_PHASE(PhaseDecrypt);
+      // the phase lasts until the end of the scope
+    }
+*/
+enum TimedPhase {
+  PhaseRawRead = 0,  // reads of the backing files
+  PhaseDecrypt,      // decoding file blocks
+  PhaseMACVerify,    // computing and checking block MACs
+  PhaseNameDecode,   // decoding file names and paths
+  PhaseStat,         // stat of the backing files
+  PhaseCount
+};
+
+namespace PhaseTimers {
+// false if the timers are not compiled in
+bool enabled();
+void record(TimedPhase phase, uint64_t nanos);
+
+// one line per phase with calls, average, maximum and histogram
+std::string report();
+// writes report() to the "performance" logger of easylogging++
+void logReport();
+
+const char *phaseName(TimedPhase phase);
+}
+
+class ScopedPhaseTimer {
+ public:
+  explicit ScopedPhaseTimer(TimedPhase phase)
+      : _phase(phase), _start(std::chrono::steady_clock::now()) {}
+  ~ScopedPhaseTimer() {
+    PhaseTimers::record(
+        _phase, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - _start)
+                    .count());
+  }
+
+ private:
+  ScopedPhaseTimer(const ScopedPhaseTimer &src);             // not allowed
+  ScopedPhaseTimer &operator=(const ScopedPhaseTimer &src);  // not allowed
+
+  TimedPhase _phase;
+  std::chrono::steady_clock::time_point _start;
+};
+
+}  // namespace encfs
+
+#if defined(ENCFS_PHASE_TIMERS)
+#define TIMED_PHASE(phase) \
+  ::encfs::ScopedPhaseTimer _phaseTimer(::encfs::phase)
+#else
+#define TIMED_PHASE(phase) \
+  do {                     \
+  } while (0)
+#endif
+
+#endif
@@ -25,6 +25,7 @@
 
 #include "fs_layer.h"
 
+#include <algorithm>  // for max, min
 #include <cerrno>
 #include <cinttypes>
 #include <cstring>
@@ -35,9 +36,14 @@
 #endif
 #include <utility>
 
+#include "DescriptorPool.h"
+#include "DirHandleCache.h"
 #include "Error.h"
 #include "FileIO.h"
+#include "MemoryPool.h"
+#include "PhaseTimer.h"
 #include "RawFileIO.h"
+#include "TraceEvents.h"
 
 using namespace std;
 
@@ -45,6 +51,14 @@ namespace encfs {
 
 static Interface RawFileIO_iface("FileIO/Raw", 1, 0, 0);
 
+// how a RawRead trace event was served, see TraceEvents.h
+enum RawReadPath {
+  rawReadDescriptor = 0,  // pread()
+  rawReadMapped,          // copied from the mapped view
+  rawReadUnbuffered,      // the descriptor without the system cache
+  rawReadVector           // preadv() of a run of requests
+};
+
 FileIO *NewRawFileIO(const Interface &iface) {
   (void)iface;
   return new RawFileIO();
@@ -57,17 +71,67 @@ inline void swap(int &x, int &y) {
 }
 
 RawFileIO::RawFileIO()
-    : knownSize(false), fileSize(0), fd(-1), oldfd(-1), canWrite(false) {}
+    : knownSize(false),
+      fileSize(0),
+      hasOpenStat(false),
+      fd(-1),
+      oldfd(-1),
+      canWrite(false),
+      isSparse(false),
+      deferredOpen(false),
+      deferredFlags(0),
+      useMap(false),
+      mapChecked(false),
+      mapData(nullptr),
+      mapOffset(0),
+      mapLength(0),
+      mapHandle(nullptr),
+      uncachedSequential(false),
+      dropFailed(false),
+      unbuffered(false),
+      unbufferedFailed(false),
+      seqStart(0),
+      seqEnd(0),
+      dropStart(0),
+      allocatedSize(0),
+      preallocFailed(false) {}
 
 RawFileIO::RawFileIO(std::string fileName)
     : name(std::move(fileName)),
       knownSize(false),
       fileSize(0),
+      hasOpenStat(false),
       fd(-1),
       oldfd(-1),
-      canWrite(false) {}
+      canWrite(false),
+      isSparse(false),
+      deferredOpen(false),
+      deferredFlags(0),
+      useMap(false),
+      mapChecked(false),
+      mapData(nullptr),
+      mapOffset(0),
+      mapLength(0),
+      mapHandle(nullptr),
+      uncachedSequential(false),
+      dropFailed(false),
+      unbuffered(false),
+      unbufferedFailed(false),
+      seqStart(0),
+      seqEnd(0),
+      dropStart(0),
+      allocatedSize(0),
+      preallocFailed(false) {}
 
 RawFileIO::~RawFileIO() {
+  unmapWindow();
+
+  // Linux keeps the space reserved beyond the end of the file until the
+  // next truncate
+  if (fd >= 0 && canWrite && knownSize && allocatedSize > fileSize) {
+    fs_layer::ftruncate(fd, fileSize);
+  }
+
   int _fd = -1;
   int _oldfd = -1;
 
@@ -79,7 +143,11 @@ RawFileIO::~RawFileIO() {
   }
 
   if (_fd != -1) {
-    fs_layer::close(_fd);
+    if (fdPool && !unbuffered) {
+      fdPool->give(name, canWrite, _fd);
+    } else {
+      fs_layer::close(_fd);
+    }
   }
 }
 
@@ -120,12 +188,19 @@ static int open_readonly_workaround(const char *path, int flags) {
     -  Basically we just need to distinguish between read and write flags
     -  Also keep the O_LARGEFILE flag, in case the underlying filesystem needs
        it..
+    -  Read-only opens only check that the file exists and return 0.  The
+       descriptor is opened by the first read, so FileNodes used only for
+       getAttr() never open the backing file.
 */
 int RawFileIO::open(int flags) {
   bool requestWrite = (((flags & O_RDWR) != 0) || ((flags & O_WRONLY) != 0));
   VLOG(1) << "open call, requestWrite = " << requestWrite;
 
   // if we have a descriptor and it is writable, or we don't need writable..
+  {
+    boost::mutex::scoped_lock lock(stateMutex);
+    hasOpenStat = false;
+  }
   if ((fd >= 0) && (canWrite || !requestWrite)) {
     VLOG(1) << "using existing file descriptor";
     return fd;  // success
@@ -143,18 +218,71 @@ int RawFileIO::open(int flags) {
 #	endif
 #endif
 
-  int eno = 0;
-  int newFd = fs_layer::open(name.c_str(), finalFlags);
-  if (newFd < 0) {
-    eno = errno;
+  if (!requestWrite && (fd < 0)) {
+    if (!deferredOpen) {
+      efs_stat stbuf;
+      memset(&stbuf, 0, sizeof(efs_stat));
+      int res = dirHandles ? dirHandles->stat(name, &stbuf)
+                           : fs_layer::lstat(name.c_str(), &stbuf);
+      if (res < 0) {
+        int eno = errno;
+        RLOG(DEBUG) << "::lstat error: " << strerror(eno);
+        return -eno;
+      }
+      VLOG(1) << "deferring open with flags " << finalFlags;
+      boost::mutex::scoped_lock lock(stateMutex);
+      fileSize = stbuf.st_size;
+      knownSize = true;
+      deferredOpen = true;
+      deferredFlags = finalFlags;
+      openStat = stbuf;
+      hasOpenStat = true;
+    }
+    return 0;
   }
 
-  VLOG(1) << "open file with flags " << finalFlags << ", result = " << newFd;
+  int res = openDescriptor(finalFlags, requestWrite);
+  // the attributes of the new descriptor, without another lookup of the path.
+  // The size is then known for the first write.
+  if (res >= 0 && fs_layer::fstat(fd, &openStat) == 0) {
+    boost::mutex::scoped_lock lock(stateMutex);
+    fileSize = openStat.st_size;
+    knownSize = true;
+    hasOpenStat = true;
+  }
+  return res;
+}
+
+/**
+ * Open the file descriptor, or a writable one in place of a read-only one.
+ * Returns the descriptor, or -errno in case of failure.
+ */
+int RawFileIO::openDescriptor(int finalFlags, bool requestWrite) {
+  // the unbuffered descriptor can't be shared with the new one on Windows
+  if (unbuffered) {
+    fs_layer::close(fd);
+    fd = -1;
+    unbuffered = false;
+  }
+
+  int eno = 0;
+  int newFd = fdPool ? fdPool->take(name, requestWrite) : -1;
+  if (newFd >= 0) {
+    VLOG(1) << "reusing pooled descriptor " << newFd;
+  } else {
+    newFd = dirHandles ? dirHandles->open(name, finalFlags)
+                       : fs_layer::open(name.c_str(), finalFlags);
+    if (newFd < 0) {
+      eno = errno;
+    }
+
+    VLOG(1) << "open file with flags " << finalFlags << ", result = " << newFd;
 
-  if ((newFd == -1) && (eno == EACCES)) {
-    VLOG(1) << "using readonly workaround for open";
-    newFd = open_readonly_workaround(name.c_str(), finalFlags);
-    eno = errno;
+    if ((newFd == -1) && (eno == EACCES)) {
+      VLOG(1) << "using readonly workaround for open";
+      newFd = open_readonly_workaround(name.c_str(), finalFlags);
+      eno = errno;
+    }
   }
 
   if (newFd < 0) {
@@ -167,16 +295,39 @@ int RawFileIO::open(int flags) {
                 << ", newfd = " << newFd;
   }
 
+  // the map is only used for read-only descriptors, and would prevent
+  // truncating the file on Windows
+  if (requestWrite) {
+    unmapWindow();
+  }
+
   // the old fd might still be in use, so just keep it around for
   // now.
   canWrite = requestWrite;
   oldfd = fd;
   fd = newFd;
+  deferredOpen = false;
 
   return fd;
 }
 
+/**
+ * Open the descriptor of a deferred read-only open, see open().
+ * Returns 0, or -errno in case of failure.
+ * Must be called with stateMutex held.
+ */
+int RawFileIO::ensureOpen() const {
+  if (fd >= 0) {
+    return 0;
+  }
+  rAssert(deferredOpen);
+
+  int res = const_cast<RawFileIO *>(this)->openDescriptor(deferredFlags, false);
+  return (res < 0) ? res : 0;
+}
+
 int RawFileIO::getAttr(efs_stat *stbuf, void *statCache) const {
+  TIMED_PHASE(PhaseStat);
   int res = fs_layer::stat_cached( name.c_str(), stbuf, statCache );
   int eno = errno;
 
@@ -191,7 +342,24 @@ void RawFileIO::setFileName(const char *fileName) { name = fileName; }
 
 const char *RawFileIO::getFileName() const { return name.c_str(); }
 
+bool RawFileIO::getOpenStat(efs_stat *stbuf) const {
+  boost::mutex::scoped_lock lock(stateMutex);
+  if (!hasOpenStat) {
+    return false;
+  }
+  *stbuf = openStat;
+  return true;
+}
+
 off_t RawFileIO::getSize() const {
+  boost::mutex::scoped_lock lock(stateMutex);
+  return statSize();
+}
+
+/**
+ * Same as getSize(), must be called with stateMutex held.
+ */
+off_t RawFileIO::statSize() const {
   if (!knownSize) {
     efs_stat stbuf;
     memset(&stbuf, 0, sizeof(efs_stat));
@@ -210,9 +378,47 @@ off_t RawFileIO::getSize() const {
 }
 
 ssize_t RawFileIO::read(const IORequest &req) const {
-  rAssert(fd >= 0);
+  TIMED_PHASE(PhaseRawRead);
+  boost::mutex::scoped_lock lock(stateMutex);
+  int res = ensureOpen();
+  if (res < 0) {
+    return res;
+  }
+
+  if (useMap && !canWrite) {
+    ssize_t mappedSize = const_cast<RawFileIO *>(this)->readMapped(req);
+    if (mappedSize >= 0) {
+      TRACE_EVENT4(RawRead, "offset", req.offset, "requested", req.dataLen,
+                   "result", mappedSize, "path", rawReadMapped);
+      return mappedSize;
+    }
+  }
+
+  // the unbuffered descriptor may be replaced by the next read, so reads
+  // following the sequential run keep the lock.  Otherwise fd doesn't change
+  // while the file is read.
+  if (!uncachedSequential) {
+    lock.unlock();
+  } else {
+    RawFileIO *self = const_cast<RawFileIO *>(this);
+    bool sequential = self->trackSequential(req.offset, req.dataLen, false);
+    if (unbuffered || (sequential && dropFailed)) {
+      ssize_t unbufferedSize = self->readUnbuffered(req);
+      if (unbufferedSize >= 0) {
+        TRACE_EVENT4(RawRead, "offset", req.offset, "requested", req.dataLen,
+                     "result", unbufferedSize, "path", rawReadUnbuffered);
+        return unbufferedSize;
+      }
+      res = ensureOpen();
+      if (res < 0) {
+        return res;
+      }
+    }
+  }
 
   ssize_t readSize = fs_layer::pread(fd, req.data, req.dataLen, req.offset);
+  TRACE_EVENT4(RawRead, "offset", req.offset, "requested", req.dataLen,
+               "result", readSize, "path", rawReadDescriptor);
 
   if (readSize < 0) {
     int eno = errno;
@@ -227,6 +433,11 @@ ssize_t RawFileIO::read(const IORequest &req) const {
 ssize_t RawFileIO::write(const IORequest &req) {
   rAssert(fd >= 0);
   rAssert(canWrite);
+  hasOpenStat = false;
+
+  if (knownSize && req.offset == fileSize) {
+    extendAllocation(req.offset + (off_t)req.dataLen);
+  }
 
   // int retrys = 10;
   void *buf = req.data;
@@ -246,6 +457,7 @@ ssize_t RawFileIO::write(const IORequest &req) {
     if (writeSize < 0) {
       int eno = errno;
       knownSize = false;
+      TRACE_EVENT3(RawWrite, "offset", offset, "bytes", bytes, "result", -eno);
       RLOG(WARNING) << "write failed at offset " << offset << " for " << bytes
                     << " bytes: " << strerror(eno);
       // pwrite is not expected to return 0, so eno should always be set, but we
@@ -274,14 +486,151 @@ ssize_t RawFileIO::write(const IORequest &req) {
       fileSize = last;
     }
   }
+  if (uncachedSequential) {
+    trackSequential(req.offset, req.dataLen, true);
+  }
+  TRACE_EVENT3(RawWrite, "offset", req.offset, "bytes", req.dataLen, "result",
+               req.dataLen);
 
   return req.dataLen;
 }
 
+// number of adjacent requests passed to one preadv() / pwritev() call,
+// well below IOV_MAX
+static const int maxRunRequests = 64;
+
+/**
+ * Collect the requests at the start of reqs which follow each other without
+ * a gap.  Returns their number.
+ */
+int RawFileIO::collectRun(const IORequest *reqs, int count,
+                          std::vector<fs_layer::fs_iovec> &iov,
+                          size_t &runLen) const {
+  iov.clear();
+  runLen = 0;
+  int n = 0;
+  while (n < count && n < maxRunRequests &&
+         reqs[n].offset == reqs[0].offset + (off_t)runLen) {
+    fs_layer::fs_iovec vec;
+    vec.iov_base = reqs[n].data;
+    vec.iov_len = reqs[n].dataLen;
+    iov.push_back(vec);
+    runLen += reqs[n].dataLen;
+    ++n;
+  }
+  return n;
+}
+
+ssize_t RawFileIO::readv(const IORequest *reqs, int count) const {
+  boost::mutex::scoped_lock lock(stateMutex);
+  int res = ensureOpen();
+  if (res < 0) {
+    return res;
+  }
+  // read() copies from the map, no system calls to save, or follows the
+  // sequential run
+  bool useRead = (useMap && !canWrite) || uncachedSequential;
+  lock.unlock();
+  if (useRead) {
+    return FileIO::readv(reqs, count);
+  }
+
+  TIMED_PHASE(PhaseRawRead);
+  std::vector<fs_layer::fs_iovec> iov;
+  ssize_t total = 0;
+  while (count > 0) {
+    size_t runLen;
+    int n = collectRun(reqs, count, iov, runLen);
+
+    ssize_t readSize =
+        fs_layer::preadv(fd, iov.data(), (int)iov.size(), reqs[0].offset);
+    TRACE_EVENT4(RawRead, "offset", reqs[0].offset, "requested", runLen,
+                 "result", readSize, "path", rawReadVector);
+    if (readSize < 0) {
+      int eno = errno;
+      RLOG(WARNING) << "read failed at offset " << reqs[0].offset << " for "
+                    << runLen << " bytes: " << strerror(eno);
+      return -eno;
+    }
+
+    total += readSize;
+    if ((size_t)readSize < runLen) {
+      break;
+    }
+    reqs += n;
+    count -= n;
+  }
+  return total;
+}
+
+ssize_t RawFileIO::writev(const IORequest *reqs, int count) {
+  rAssert(fd >= 0);
+  rAssert(canWrite);
+  hasOpenStat = false;
+
+  std::vector<fs_layer::fs_iovec> iov;
+  ssize_t total = 0;
+  while (count > 0) {
+    size_t runLen;
+    int n = collectRun(reqs, count, iov, runLen);
+    if (knownSize && reqs[0].offset == fileSize) {
+      extendAllocation(reqs[0].offset + (off_t)runLen);
+    }
+
+    ssize_t writeSize =
+        fs_layer::pwritev(fd, iov.data(), (int)iov.size(), reqs[0].offset);
+    TRACE_EVENT3(RawWrite, "offset", reqs[0].offset, "bytes", runLen, "result",
+                 writeSize);
+    if (writeSize < 0) {
+      int eno = errno;
+      knownSize = false;
+      RLOG(WARNING) << "write failed at offset " << reqs[0].offset << " for "
+                    << runLen << " bytes: " << strerror(eno);
+      return -eno;
+    }
+
+    // finish a partial write with write(), which retries until done
+    for (int i = 0; i < n; ++i) {
+      if ((size_t)writeSize >= reqs[i].dataLen) {
+        writeSize -= reqs[i].dataLen;
+        continue;
+      }
+      IORequest rest = reqs[i];
+      rest.offset += writeSize;
+      rest.data += writeSize;
+      rest.dataLen -= writeSize;
+      writeSize = 0;
+      ssize_t res = write(rest);
+      if (res < 0) {
+        return res;
+      }
+    }
+
+    if (knownSize) {
+      off_t last = reqs[0].offset + (off_t)runLen;
+      if (last > fileSize) {
+        fileSize = last;
+      }
+    }
+    if (uncachedSequential) {
+      trackSequential(reqs[0].offset, runLen, true);
+    }
+
+    total += runLen;
+    reqs += n;
+    count -= n;
+  }
+  return total;
+}
+
 #undef ftruncate
 
 int RawFileIO::truncate(off_t size) {
   int res;
+  hasOpenStat = false;
+
+  // reading the mapping beyond the new end of the file would fault
+  unmapWindow();
 
   if (fd >= 0 && canWrite) {
     res = fs_layer::ftruncate(fd, size);
@@ -299,6 +648,8 @@ int RawFileIO::truncate(off_t size) {
     res = 0;
     fileSize = size;
     knownSize = true;
+    // the space beyond the new end is released
+    allocatedSize = min(allocatedSize, size);
   }
 
   if (fd >= 0 && canWrite) {
@@ -312,6 +663,321 @@ int RawFileIO::truncate(off_t size) {
   return res;
 }
 
+int RawFileIO::setSparse() {
+  if (isSparse) {
+    return 0;
+  }
+  if (fd < 0 || !canWrite) {
+    return -EBADF;
+  }
+
+  if (fs_layer::set_sparse(fd) < 0) {
+    int eno = errno;
+    VLOG(1) << "setting sparse flag failed for " << name << ": "
+            << strerror(eno);
+    return -eno;
+  }
+  isSparse = true;
+  return 0;
+}
+
+int RawFileIO::preallocate(off_t size) {
+  if (preallocFailed || size <= allocatedSize) {
+    return 0;
+  }
+  if (fd < 0 || !canWrite) {
+    return -EBADF;
+  }
+  // Windows truncates the file to a smaller allocation
+  off_t oldSize = getSize();
+  if (oldSize < 0) {
+    return (int)oldSize;
+  }
+  if (size <= oldSize) {
+    return 0;
+  }
+
+  if (fs_layer::preallocate(fd, size) < 0) {
+    int eno = errno;
+    VLOG(1) << "preallocating " << size << " bytes for " << name
+            << " failed: " << strerror(eno);
+    // don't try again unless it was just a lack of space
+    if (eno != ENOSPC) {
+      preallocFailed = true;
+    }
+    return -eno;
+  }
+  allocatedSize = size;
+  return 0;
+}
+
+// appending writers reserve the space ahead of them in steps of 1/8 of the
+// file size, within these limits
+static const off_t preallocMinStep = (off_t)1 << 20;
+static const off_t preallocMaxStep = (off_t)64 << 20;
+
+/**
+ * Called before a write which appends to the file up to end.  Reserves the
+ * space ahead of it if the previous reservation is used up.
+ */
+void RawFileIO::extendAllocation(off_t end) {
+  if (preallocFailed || end <= allocatedSize) {
+    return;
+  }
+  off_t step = min(max(end / 8, preallocMinStep), preallocMaxStep);
+  // failing is fine, the write allocates the space itself then
+  preallocate(end + step);
+}
+
+void RawFileIO::setDescriptorPool(const std::shared_ptr<DescriptorPool> &pool) {
+  fdPool = pool;
+}
+
+void RawFileIO::setDirHandleCache(
+    const std::shared_ptr<DirHandleCache> &dirHandles) {
+  this->dirHandles = dirHandles;
+}
+
+void RawFileIO::setUseMap(bool useMap) { this->useMap = useMap; }
+
+// size of the mapped window, smaller for 32 bit address spaces
+static const size_t mapWindowSize =
+    (sizeof(void *) >= 8) ? ((size_t)256 << 20) : ((size_t)16 << 20);
+
+/**
+ * Serve a read from the mapped window of the file, after moving the window
+ * to the offset if needed.  Returns the number of bytes read, or -1 if the
+ * read has to be done with pread().
+ */
+ssize_t RawFileIO::readMapped(const IORequest &req) {
+  if (!mapChecked) {
+    mapChecked = true;
+    useMap = fs_layer::is_local_path(name.c_str());
+    VLOG(1) << "mapping " << name << (useMap ? "" : " not") << " possible";
+    if (!useMap) {
+      return -1;
+    }
+  }
+
+  off_t size = statSize();
+  if (size < 0) {
+    return -1;
+  }
+
+  size_t done = 0;
+  while (done < req.dataLen) {
+    off_t offset = req.offset + (off_t)done;
+    if (offset >= size) {
+      break;  // end of file
+    }
+    off_t mapEnd = mapOffset + (off_t)mapLength;
+    if (mapData == nullptr || offset < mapOffset || offset >= mapEnd) {
+      if (!mapWindow(offset, size)) {
+        return -1;
+      }
+      mapEnd = mapOffset + (off_t)mapLength;
+    }
+
+    size_t len = (size_t)min((off_t)(req.dataLen - done),
+                             min(mapEnd, size) - offset);
+    memcpy(req.data + done, mapData + (offset - mapOffset), len);
+    done += len;
+  }
+  return (ssize_t)done;
+}
+
+/**
+ * Map the window of the file containing offset, and at most up to size.
+ * Stops using the map if this fails.
+ */
+bool RawFileIO::mapWindow(off_t offset, off_t size) {
+  unmapWindow();
+
+  off_t start = offset - offset % fs_layer::map_alignment;
+  size_t length = (size_t)min((off_t)mapWindowSize, size - start);
+  void *handle = nullptr;
+  void *addr = fs_layer::map_view(fd, start, length, &handle);
+  if (addr == nullptr) {
+    int eno = errno;
+    VLOG(1) << "mapping " << name << " at " << start
+            << " failed: " << strerror(eno);
+    useMap = false;
+    return false;
+  }
+
+  mapData = static_cast<unsigned char *>(addr);
+  mapOffset = start;
+  mapLength = length;
+  mapHandle = handle;
+  return true;
+}
+
+void RawFileIO::unmapWindow() {
+  if (mapData != nullptr) {
+    fs_layer::unmap_view(mapData, mapLength, mapHandle);
+    mapData = nullptr;
+    mapLength = 0;
+    mapHandle = nullptr;
+  }
+}
+
+void RawFileIO::setUncachedSequential(bool uncached) {
+  // reads of the unbuffered descriptor are aligned by the sequential run,
+  // it stays in use until the file is reopened
+  uncachedSequential = uncached || unbuffered;
+}
+
+// length of a sequential run before it is kept out of the system cache, and
+// the steps in which the cached pages behind it are dropped
+static const off_t sequentialMinBytes = (off_t)8 << 20;
+static const off_t dropStepBytes = (off_t)8 << 20;
+
+/**
+ * Follow the run of transfers which continue each other.  Returns true once
+ * the run is long enough to keep it out of the system cache, and drops the
+ * cached pages of the run behind it.
+ */
+bool RawFileIO::trackSequential(off_t offset, size_t len, bool written) {
+  if (offset != seqEnd) {
+    seqStart = offset;
+    dropStart = offset;
+  }
+  seqEnd = offset + (off_t)len;
+  if (seqEnd - seqStart < sequentialMinBytes) {
+    return false;
+  }
+
+  if (!dropFailed && !unbuffered && seqEnd - dropStart >= dropStepBytes) {
+    if (fs_layer::drop_cache(fd, dropStart, seqEnd - dropStart, written) < 0) {
+      int eno = errno;
+      VLOG(1) << "dropping cached pages of " << name
+              << " failed: " << strerror(eno);
+      dropFailed = true;
+    }
+    dropStart = seqEnd;
+  }
+  return true;
+}
+
+/**
+ * Serve a read through a descriptor which bypasses the system cache, after
+ * opening it if needed.  Such reads have to be aligned, so a superset of the
+ * request is read into a page-aligned buffer.  Returns the number of bytes read,
+ * or -1 if the read has to be done with pread().
+ */
+ssize_t RawFileIO::readUnbuffered(const IORequest &req) {
+  if (canWrite || (!unbuffered && (unbufferedFailed || !reopenUnbuffered()))) {
+    return -1;
+  }
+
+  const off_t align = fs_layer::unbuffered_alignment;
+  off_t start = req.offset - req.offset % align;
+  off_t end = (req.offset + (off_t)req.dataLen + align - 1) / align * align;
+  size_t len = (size_t)(end - start);
+
+  static_assert(MemoryPool::pageAlignment % fs_layer::unbuffered_alignment == 0,
+                "page-aligned blocks must do for unbuffered reads");
+  MemBlock mb = MemoryPool::allocate((int)len, true);
+  unsigned char *buf = mb.data;
+
+  ssize_t readSize = fs_layer::pread_unbuffered(fd, buf, len, start);
+  if (readSize < 0) {
+    int eno = errno;
+    VLOG(1) << "unbuffered read of " << name << " at " << start
+            << " failed: " << strerror(eno);
+    MemoryPool::release(mb);
+    reopenBuffered();
+    return -1;
+  }
+
+  size_t skip = (size_t)(req.offset - start);
+  size_t done = 0;
+  if ((size_t)readSize > skip) {
+    done = min((size_t)readSize - skip, req.dataLen);
+    memcpy(req.data, buf + skip, done);
+  }
+  MemoryPool::release(mb);
+  return (ssize_t)done;
+}
+
+/**
+ * Replace the read-only descriptor with one which bypasses the system cache.
+ * Goes back to a buffered descriptor for good if that fails.
+ */
+bool RawFileIO::reopenUnbuffered() {
+  // Windows denies sharing, so the buffered descriptor has to go first
+  fs_layer::close(fd);
+  fd = fs_layer::open_unbuffered(name.c_str());
+  if (fd < 0) {
+    int eno = errno;
+    VLOG(1) << "unbuffered open of " << name << " failed: " << strerror(eno);
+    reopenBuffered();
+    return false;
+  }
+  VLOG(1) << "reading " << name << " without the system cache";
+  unbuffered = true;
+  return true;
+}
+
+/**
+ * Open a buffered read-only descriptor in place of the unbuffered one.  If
+ * that fails, the next read tries again, see ensureOpen().
+ */
+void RawFileIO::reopenBuffered() {
+  if (unbuffered) {
+    fs_layer::close(fd);
+    unbuffered = false;
+  }
+  fd = -1;
+  unbufferedFailed = true;
+  deferredOpen = true;
+  openDescriptor(deferredFlags, false);
+}
+
+bool RawFileIO::findData(off_t offset, off_t &begin, off_t &end) const {
+  boost::mutex::scoped_lock lock(stateMutex);
+  if (ensureOpen() < 0) {
+    return false;
+  }
+  off_t size = statSize();
+  if (size < 0) {
+    return false;
+  }
+  lock.unlock();
+
+  int64_t dataBegin, dataEnd;
+  if (fs_layer::find_data(fd, offset, size, &dataBegin, &dataEnd) < 0) {
+    return false;
+  }
+  begin = dataBegin;
+  end = dataEnd;
+  return true;
+}
+
+int RawFileIO::sync(bool datasync) {
+  if (fd < 0) {
+    // never opened for writing, see open()
+    return 0;
+  }
+
+  int res = -EIO;
+#if defined(HAVE_FDATASYNC)
+  if (datasync) {
+    res = ::fdatasync(fd);
+  } else {
+    res = ::fsync(fd);
+  }
+#else
+  (void)datasync;
+  res = fs_layer::fsync(fd);
+#endif
+
+  if (res == -1) {
+    res = -errno;
+  }
+  return res;
+}
+
 bool RawFileIO::isWritable() const { return canWrite; }
 
 }  // namespace encfs
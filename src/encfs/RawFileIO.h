@@ -21,14 +21,21 @@
 #ifndef _RawFileIO_incl_
 #define _RawFileIO_incl_
 
+#include <memory>
 #include <string>
 #include <sys/types.h>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
 
 #include "FileIO.h"
 #include "Interface.h"
 
 namespace encfs {
 
+class DescriptorPool;
+class DirHandleCache;
+
 class RawFileIO : public FileIO {
  public:
   RawFileIO();
@@ -48,19 +55,98 @@ class RawFileIO : public FileIO {
   virtual ssize_t read(const IORequest &req) const;
   virtual ssize_t write(const IORequest &req);
 
+  virtual ssize_t readv(const IORequest *reqs, int count) const;
+  virtual ssize_t writev(const IORequest *reqs, int count);
+
   virtual int truncate(off_t size);
+  virtual int setSparse();
+  virtual bool findData(off_t offset, off_t &begin, off_t &end) const;
+  virtual int preallocate(off_t size);
+  virtual int sync(bool datasync);
 
   virtual bool isWritable() const;
 
+  // serve reads from mapped views of the file while it is only open for
+  // reading.  Only used for files on local file systems.
+  void setUseMap(bool useMap);
+
+  // the attributes of the backing file as of the last open(), taken by the
+  // open itself.  Returns false if the open reused a descriptor, or once the
+  // file was written or truncated since.
+  bool getOpenStat(efs_stat *stbuf) const;
+
+  // keep large sequential transfers out of the system cache.  Where the
+  // cached pages can't be dropped, such files are read without the cache.
+  void setUncachedSequential(bool uncached);
+
+  // take the descriptor from the pool when the file is opened, and hand it
+  // back to the pool when this goes away
+  void setDescriptorPool(const std::shared_ptr<DescriptorPool> &pool);
+
+  // open and stat the backing file relative to a cached handle of its folder
+  void setDirHandleCache(const std::shared_ptr<DirHandleCache> &dirHandles);
+
  protected:
+  int collectRun(const IORequest *reqs, int count,
+                 std::vector<fs_layer::fs_iovec> &iov, size_t &runLen) const;
+  int openDescriptor(int finalFlags, bool requestWrite);
+  int ensureOpen() const;
+  off_t statSize() const;
+  ssize_t readMapped(const IORequest &req);
+  bool mapWindow(off_t offset, off_t size);
+  void unmapWindow();
+  bool trackSequential(off_t offset, size_t len, bool written);
+  ssize_t readUnbuffered(const IORequest &req);
+  bool reopenUnbuffered();
+  void reopenBuffered();
+  void extendAllocation(off_t end);
+
   std::string name;
 
   bool knownSize;
   off_t fileSize;
 
+  // see getOpenStat()
+  bool hasOpenStat;
+  efs_stat openStat;
+
   int fd;
   int oldfd;
   bool canWrite;
+  bool isSparse;
+
+  // set by a read-only open() until the descriptor is opened
+  bool deferredOpen;
+  int deferredFlags;
+
+  // mapped window of the file, see setUseMap()
+  bool useMap;
+  bool mapChecked;  // whether the file was checked to be local
+  unsigned char *mapData;
+  off_t mapOffset;
+  size_t mapLength;
+  void *mapHandle;
+
+  // sequential run of transfers, see setUncachedSequential()
+  bool uncachedSequential;
+  bool dropFailed;        // the system can't drop cached pages
+  bool unbuffered;        // fd bypasses the system cache
+  bool unbufferedFailed;  // don't try to open an unbuffered fd again
+  off_t seqStart;
+  off_t seqEnd;
+  off_t dropStart;  // start of the part of the run which is still cached
+
+  // space reserved by preallocate(), may be beyond the end of the file
+  off_t allocatedSize;
+  bool preallocFailed;
+
+  std::shared_ptr<DescriptorPool> fdPool;  // may be null
+  std::shared_ptr<DirHandleCache> dirHandles;  // may be null
+
+  // concurrent readers open the deferred descriptor, learn the size, move
+  // the mapped window and follow the sequential run under this lock.
+  // Writers don't need it, they exclude the readers (see FileNode).
+  mutable boost::mutex stateMutex;
 };
 
 }  // namespace encfs
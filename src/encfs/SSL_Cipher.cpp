@@ -19,6 +19,8 @@
  */
 
 #include "easylogging++.h"
+#include <algorithm>
+#include <cstdlib>  // for _byteswap_uint64
 #include <cstring>
 #include <openssl/crypto.h>
 #include <openssl/err.h>
@@ -28,6 +30,7 @@
 #include <openssl/rand.h>
 #include <boost/thread.hpp>
 #include <string>
+#include <vector>
 //#include <sys/mman.h>
 //#include <sys/time.h>
 
@@ -38,13 +41,15 @@
 #include "Range.h"
 #include "SSL_Cipher.h"
 #include "SSL_Compat.h"
+#include "TraceEvents.h"
 #include "intl/gettext_.h"
+#include "openssl.h"
 
 using namespace std;
 
 namespace encfs {
 
-const int MAX_KEYLENGTH = 32;  // in bytes (256 bit)
+const int MAX_KEYLENGTH = 64;  // in bytes (512 bit, AES-256 in XTS mode)
 const int MAX_IVLENGTH = 16;   // 128 bit (AES block size, Blowfish has 64)
 const int KEY_CHECKSUM_BYTES = 4;
 
@@ -163,11 +168,17 @@ int TimedPBKDF2(const char *pass, int passlen, const unsigned char *salt,
 static Interface BlowfishInterface("ssl/blowfish", 3, 0, 2);
 static Interface AESInterface("ssl/aes", 3, 0, 2);
 static Interface CAMELLIAInterface("ssl/camellia", 3, 0, 2);
+// - AES-XTS starts at 3:0, it only exists for new volumes
+static Interface AESXTSInterface("ssl/aes_xts", 3, 0, 0);
+
+// Volumes of large files may use blocks of up to 1 MB, the block size in the
+// configuration is all other EncFS versions need to read them.
+static const int maxBlockSize = 1 << 20;
 
 #ifndef OPENSSL_NO_CAMELLIA
 
 static Range CAMELLIAKeyRange(128, 256, 64);
-static Range CAMELLIABlockRange(64, 4096, 16);
+static Range CAMELLIABlockRange(64, maxBlockSize, 16);
 
 static std::shared_ptr<Cipher> NewCAMELLIACipher(const Interface &iface,
                                                  int keyLen) {
@@ -209,7 +220,7 @@ static bool CAMELLIA_Cipher_registered =
 #ifndef OPENSSL_NO_BF
 
 static Range BFKeyRange(128, 256, 32);
-static Range BFBlockRange(64, 4096, 8);
+static Range BFBlockRange(64, maxBlockSize, 8);
 
 static std::shared_ptr<Cipher> NewBFCipher(const Interface &iface, int keyLen) {
   if (keyLen <= 0) {
@@ -235,7 +246,7 @@ static bool BF_Cipher_registered =
 #ifndef OPENSSL_NO_AES
 
 static Range AESKeyRange(128, 256, 64);
-static Range AESBlockRange(64, 4096, 16);
+static Range AESBlockRange(64, maxBlockSize, 16);
 
 static std::shared_ptr<Cipher> NewAESCipher(const Interface &iface,
                                             int keyLen) {
@@ -273,11 +284,111 @@ static std::shared_ptr<Cipher> NewAESCipher(const Interface &iface,
 static bool AES_Cipher_registered =
     Cipher::Register("AES", "16 byte block cipher", AESInterface, AESKeyRange,
                      AESBlockRange, NewAESCipher);
+
+// XTS uses two AES keys, so 256 bit is AES-128 and 512 bit is AES-256
+static Range AESXTSKeyRange(256, 512, 256);
+
+/*
+    AES in XTS mode for the file blocks, with the volume block as the data
+    unit and the block IV as the tweak.  Partial blocks, names and keys use
+    CFB with the first AES key, like "AES".  Integrity is still provided by
+    the per-block MAC of MACFileIO if it is enabled.
+*/
+static std::shared_ptr<Cipher> NewAESXTSCipher(const Interface &iface,
+                                               int keyLen) {
+  if (keyLen <= 0) {
+    keyLen = 512;
+  }
+
+  keyLen = AESXTSKeyRange.closest(keyLen);
+
+  const EVP_CIPHER *blockCipher = nullptr;
+  const EVP_CIPHER *streamCipher = nullptr;
+
+  if (keyLen == 256) {
+    blockCipher = EVP_aes_128_xts();
+    streamCipher = EVP_aes_128_cfb();
+  } else {
+    blockCipher = EVP_aes_256_xts();
+    streamCipher = EVP_aes_256_cfb();
+  }
+
+  return std::shared_ptr<Cipher>(new SSL_Cipher(
+      iface, AESXTSInterface, blockCipher, streamCipher, keyLen / 8));
+}
+
+static bool AESXTS_Cipher_registered = Cipher::Register(
+    "AES-XTS", "16 byte block cipher in XTS mode, for new volumes",
+    AESXTSInterface, AESXTSKeyRange, AESBlockRange, NewAESXTSCipher);
 #endif
 
+/**
+ * One set of cipher and HMAC contexts.  A context can only be used by one
+ * thread at a time, so SSLKey hands out copies of its initialized set.
+ */
+struct SSLContexts {
+  EVP_CIPHER_CTX *block_enc;
+  EVP_CIPHER_CTX *block_dec;
+  EVP_CIPHER_CTX *stream_enc;
+  EVP_CIPHER_CTX *stream_dec;
+
+  HMAC_CTX *mac_ctx;
+
+  // IVs derived recently with these contexts, direct mapped by seed.  Stream
+  // coding derives two IVs per call, and blocks are often coded repeatedly.
+  static const int ivMemoSize = 16;
+  struct IVMemo {
+    bool valid;
+    uint64_t seed;
+    unsigned char ivec[MAX_IVLENGTH];
+  };
+  IVMemo ivMemo[ivMemoSize];
+
+  SSLContexts();
+  ~SSLContexts();
+
+  bool copyFrom(const SSLContexts &src);
+
+  SSLContexts(const SSLContexts &src) = delete;
+  SSLContexts& operator=(const SSLContexts& other) = delete;
+};
+
+SSLContexts::SSLContexts() {
+  block_enc = EVP_CIPHER_CTX_new();
+  EVP_CIPHER_CTX_init(block_enc);
+  block_dec = EVP_CIPHER_CTX_new();
+  EVP_CIPHER_CTX_init(block_dec);
+  stream_enc = EVP_CIPHER_CTX_new();
+  EVP_CIPHER_CTX_init(stream_enc);
+  stream_dec = EVP_CIPHER_CTX_new();
+  EVP_CIPHER_CTX_init(stream_dec);
+  mac_ctx = HMAC_CTX_new();
+  HMAC_CTX_reset(mac_ctx);
+
+  for (IVMemo &memo : ivMemo) {
+    memo.valid = false;
+  }
+}
+
+SSLContexts::~SSLContexts() {
+  EVP_CIPHER_CTX_free(block_enc);
+  EVP_CIPHER_CTX_free(block_dec);
+  EVP_CIPHER_CTX_free(stream_enc);
+  EVP_CIPHER_CTX_free(stream_dec);
+  HMAC_CTX_free(mac_ctx);
+}
+
+bool SSLContexts::copyFrom(const SSLContexts &src) {
+  return (EVP_CIPHER_CTX_copy(block_enc, src.block_enc) == 1) &&
+         (EVP_CIPHER_CTX_copy(block_dec, src.block_dec) == 1) &&
+         (EVP_CIPHER_CTX_copy(stream_enc, src.stream_enc) == 1) &&
+         (EVP_CIPHER_CTX_copy(stream_dec, src.stream_dec) == 1) &&
+         (HMAC_CTX_copy(mac_ctx, src.mac_ctx) == 1);
+}
+
 class SSLKey : public AbstractCipherKey {
  public:
-  boost::mutex mutex;
+  boost::mutex mutex;  // protects freeContexts
 
   unsigned int keySize;  // in bytes
   unsigned int ivLength;
@@ -286,18 +397,20 @@ class SSLKey : public AbstractCipherKey {
   // followed by iv of _ivLength bytes,
   unsigned char *buffer;
 
-  EVP_CIPHER_CTX *block_enc;
-  EVP_CIPHER_CTX *block_dec;
-  EVP_CIPHER_CTX *stream_enc;
-  EVP_CIPHER_CTX *stream_dec;
+  // initialized by initKey(), afterwards only used as the source of copies
+  SSLContexts master;
 
-  HMAC_CTX *mac_ctx;
+  // copies of master which are not in use, see SSLContextLease
+  std::vector<SSLContexts *> freeContexts;
 
   SSLKey(int keySize, int ivLength);
 
   // destructor
   ~SSLKey() override;
 
+  SSLContexts *acquireContexts();
+  void releaseContexts(SSLContexts *contexts);
+
   SSLKey(const SSLKey &src) = delete; // copy constructor
   SSLKey(SSLKey&& other) = delete; // move constructor
   SSLKey& operator=(const SSLKey& other) = delete; // copy assignment
@@ -313,17 +426,6 @@ SSLKey::SSLKey(int keySize_, int ivLength_) {
   // most likely fails unless we're running as root, or a user-page-lock
   // kernel patch is applied..
   //mlock(buffer, (size_t)keySize + (size_t)ivLength);
-
-  block_enc = EVP_CIPHER_CTX_new();
-  EVP_CIPHER_CTX_init(block_enc);
-  block_dec = EVP_CIPHER_CTX_new();
-  EVP_CIPHER_CTX_init(block_dec);
-  stream_enc = EVP_CIPHER_CTX_new();
-  EVP_CIPHER_CTX_init(stream_enc);
-  stream_dec = EVP_CIPHER_CTX_new();
-  EVP_CIPHER_CTX_init(stream_dec);
-  mac_ctx = HMAC_CTX_new();
-  HMAC_CTX_reset(mac_ctx);
 }
 
 SSLKey::~SSLKey() {
@@ -336,46 +438,112 @@ SSLKey::~SSLKey() {
   ivLength = 0;
   buffer = nullptr;
 
-  EVP_CIPHER_CTX_free(block_enc);
-  EVP_CIPHER_CTX_free(block_dec);
-  EVP_CIPHER_CTX_free(stream_enc);
-  EVP_CIPHER_CTX_free(stream_dec);
-  HMAC_CTX_free(mac_ctx);
+  for (SSLContexts *contexts : freeContexts) {
+    delete contexts;
+  }
 }
 
+/**
+ * Return a set of contexts for the exclusive use of the caller.  There are
+ * as many sets as threads have used the key at the same time.
+ */
+SSLContexts *SSLKey::acquireContexts() {
+  Lock lock(mutex);
+
+  if (!freeContexts.empty()) {
+    SSLContexts *contexts = freeContexts.back();
+    freeContexts.pop_back();
+    return contexts;
+  }
+
+  std::unique_ptr<SSLContexts> contexts(new SSLContexts());
+  if (!contexts->copyFrom(master)) {
+    RLOG(ERROR) << "unable to copy the cipher contexts";
+    throw Error("unable to copy the cipher contexts");
+  }
+  return contexts.release();
+}
+
+void SSLKey::releaseContexts(SSLContexts *contexts) {
+  Lock lock(mutex);
+  freeContexts.push_back(contexts);
+}
+
+/**
+ * Holds a set of contexts of the key for the lifetime of the object.
+ */
+class SSLContextLease {
+ public:
+  explicit SSLContextLease(SSLKey *key)
+      : _key(key), _contexts(key->acquireContexts()) {}
+  ~SSLContextLease() { _key->releaseContexts(_contexts); }
+
+  SSLContexts *get() const { return _contexts; }
+  SSLContexts *operator->() const { return _contexts; }
+
+ private:
+  SSLContextLease(const SSLContextLease &src) = delete;
+  SSLContextLease &operator=(const SSLContextLease &src) = delete;
+
+  SSLKey *_key;
+  SSLContexts *_contexts;
+};
+
+inline unsigned char *KeyData(const SSLKey *key) { return key->buffer; }
+inline unsigned char *IVData(const SSLKey *key) {
+  return key->buffer + key->keySize;
+}
 inline unsigned char *KeyData(const std::shared_ptr<SSLKey> &key) {
-  return key->buffer;
+  return KeyData(key.get());
 }
 inline unsigned char *IVData(const std::shared_ptr<SSLKey> &key) {
-  return key->buffer + key->keySize;
+  return IVData(key.get());
+}
+
+/**
+ * The key of the calls which are made for every block.  A key is only ever
+ * used with the cipher which created it, so we know its type and don't need
+ * the RTTI check and reference count updates of dynamic_pointer_cast.
+ */
+inline SSLKey *BlockKey(const CipherKey &ckey) {
+  return static_cast<SSLKey *>(ckey.get());
 }
 
 void initKey(const std::shared_ptr<SSLKey> &key, const EVP_CIPHER *_blockCipher,
              const EVP_CIPHER *_streamCipher, int _keySize) {
   Lock lock(key->mutex);
+  SSLContexts &master = key->master;
   // initialize the cipher context once so that we don't have to do it for
   // every block..
-  EVP_EncryptInit_ex(key->block_enc, _blockCipher, nullptr, nullptr, nullptr);
-  EVP_DecryptInit_ex(key->block_dec, _blockCipher, nullptr, nullptr, nullptr);
-  EVP_EncryptInit_ex(key->stream_enc, _streamCipher, nullptr, nullptr, nullptr);
-  EVP_DecryptInit_ex(key->stream_dec, _streamCipher, nullptr, nullptr, nullptr);
-
-  EVP_CIPHER_CTX_set_key_length(key->block_enc, _keySize);
-  EVP_CIPHER_CTX_set_key_length(key->block_dec, _keySize);
-  EVP_CIPHER_CTX_set_key_length(key->stream_enc, _keySize);
-  EVP_CIPHER_CTX_set_key_length(key->stream_dec, _keySize);
+  EVP_EncryptInit_ex(master.block_enc, _blockCipher, nullptr, nullptr, nullptr);
+  EVP_DecryptInit_ex(master.block_dec, _blockCipher, nullptr, nullptr, nullptr);
+  EVP_EncryptInit_ex(master.stream_enc, _streamCipher, nullptr, nullptr,
+                     nullptr);
+  EVP_DecryptInit_ex(master.stream_dec, _streamCipher, nullptr, nullptr,
+                     nullptr);
+
+  EVP_CIPHER_CTX_set_key_length(master.block_enc, _keySize);
+  EVP_CIPHER_CTX_set_key_length(master.block_dec, _keySize);
+  // the stream cipher of XTS only uses the first of the two keys
+  if ((EVP_CIPHER_flags(_streamCipher) & EVP_CIPH_VARIABLE_LENGTH) != 0) {
+    EVP_CIPHER_CTX_set_key_length(master.stream_enc, _keySize);
+    EVP_CIPHER_CTX_set_key_length(master.stream_dec, _keySize);
+  }
 
-  EVP_CIPHER_CTX_set_padding(key->block_enc, 0);
-  EVP_CIPHER_CTX_set_padding(key->block_dec, 0);
-  EVP_CIPHER_CTX_set_padding(key->stream_enc, 0);
-  EVP_CIPHER_CTX_set_padding(key->stream_dec, 0);
+  EVP_CIPHER_CTX_set_padding(master.block_enc, 0);
+  EVP_CIPHER_CTX_set_padding(master.block_dec, 0);
+  EVP_CIPHER_CTX_set_padding(master.stream_enc, 0);
+  EVP_CIPHER_CTX_set_padding(master.stream_dec, 0);
 
-  EVP_EncryptInit_ex(key->block_enc, nullptr, nullptr, KeyData(key), nullptr);
-  EVP_DecryptInit_ex(key->block_dec, nullptr, nullptr, KeyData(key), nullptr);
-  EVP_EncryptInit_ex(key->stream_enc, nullptr, nullptr, KeyData(key), nullptr);
-  EVP_DecryptInit_ex(key->stream_dec, nullptr, nullptr, KeyData(key), nullptr);
+  EVP_EncryptInit_ex(master.block_enc, nullptr, nullptr, KeyData(key), nullptr);
+  EVP_DecryptInit_ex(master.block_dec, nullptr, nullptr, KeyData(key), nullptr);
+  EVP_EncryptInit_ex(master.stream_enc, nullptr, nullptr, KeyData(key),
+                     nullptr);
+  EVP_DecryptInit_ex(master.stream_dec, nullptr, nullptr, KeyData(key),
+                     nullptr);
 
-  HMAC_Init_ex(key->mac_ctx, KeyData(key), _keySize, EVP_sha1(), nullptr);
+  HMAC_Init_ex(master.mac_ctx, KeyData(key), _keySize,
+               openssl_digest(EVP_sha1()), nullptr);
 }
 
 SSL_Cipher::SSL_Cipher(const Interface &iface_, const Interface &realIface_,
@@ -383,8 +551,9 @@ SSL_Cipher::SSL_Cipher(const Interface &iface_, const Interface &realIface_,
                        const EVP_CIPHER *streamCipher, int keySize_) {
   this->iface = iface_;
   this->realIface = realIface_;
-  this->_blockCipher = blockCipher;
-  this->_streamCipher = streamCipher;
+  // fetched once, initKey() uses them for every key
+  this->_blockCipher = openssl_cipher(blockCipher);
+  this->_streamCipher = openssl_cipher(streamCipher);
   this->_keySize = keySize_;
   this->_ivLength = EVP_CIPHER_iv_length(_blockCipher);
 
@@ -509,16 +678,15 @@ CipherKey SSL_Cipher::newRandomKey() {
 /**
     compute a 64-bit check value for the data using HMAC.
 */
-static uint64_t _checksum_64(SSLKey *key, const unsigned char *data,
+static uint64_t _checksum_64(HMAC_CTX *mac_ctx, const unsigned char *data,
                              int dataLen, const uint64_t *const chainedIV) {
   rAssert(dataLen > 0);
-  Lock lock(key->mutex);
 
   unsigned char md[EVP_MAX_MD_SIZE];
   unsigned int mdLen = EVP_MAX_MD_SIZE;
 
-  HMAC_Init_ex(key->mac_ctx, nullptr, 0, nullptr, nullptr);
-  HMAC_Update(key->mac_ctx, data, dataLen);
+  HMAC_Init_ex(mac_ctx, nullptr, 0, nullptr, nullptr);
+  HMAC_Update(mac_ctx, data, dataLen);
   if (chainedIV != nullptr) {
     // toss in the chained IV as well
     uint64_t tmp = *chainedIV;
@@ -528,10 +696,10 @@ static uint64_t _checksum_64(SSLKey *key, const unsigned char *data,
       tmp >>= 8;
     }
 
-    HMAC_Update(key->mac_ctx, h, 8);
+    HMAC_Update(mac_ctx, h, 8);
   }
 
-  HMAC_Final(key->mac_ctx, md, &mdLen);
+  HMAC_Final(mac_ctx, md, &mdLen);
 
   rAssert(mdLen >= 8);
 
@@ -549,18 +717,56 @@ static uint64_t _checksum_64(SSLKey *key, const unsigned char *data,
   return value;
 }
 
+/**
+ * Random bytes of the current thread, fetched from RAND_bytes in bulk for the
+ * small requests of the per-block headers.
+ */
+struct RandomBuffer {
+  static const int size = 4096;
+  // requests larger than this go to RAND_bytes directly
+  static const int maxRequest = 64;
+
+  unsigned char data[size];
+  int pos;
+
+  RandomBuffer() : pos(size) {}
+  ~RandomBuffer() { OPENSSL_cleanse(data, sizeof(data)); }
+
+  bool take(unsigned char *buf, int len) {
+    if (pos + len > size) {
+      if (RAND_bytes(data, size) != 1) {
+        return false;
+      }
+      pos = 0;
+    }
+    memcpy(buf, data + pos, len);
+    // the bytes are handed out only once
+    OPENSSL_cleanse(data + pos, len);
+    pos += len;
+    return true;
+  }
+};
+
+static thread_local RandomBuffer randomBuffer;
+
 /**
  * Write "len" bytes of random data into "buf"
  *
- * We ignore the @strongRandom parameter because OpenSSL
- * does not * offer a "weak" random generator
+ * OpenSSL does not offer a "weak" random generator.  Without @strongRandom,
+ * small requests are served from a per-thread buffer of RAND_bytes output,
+ * which saves the locking of RAND_bytes for every few bytes.
  */
 bool SSL_Cipher::randomize(unsigned char *buf, int len,
-                           bool /*strongRandom*/) const {
+                           bool strongRandom) const {
   // to avoid warnings of uninitialized data from valgrind
   memset(buf, 0, len);
 
-  int result = RAND_bytes(buf, len);
+  int result;
+  if (!strongRandom && len <= RandomBuffer::maxRequest) {
+    result = randomBuffer.take(buf, len) ? 1 : 0;
+  } else {
+    result = RAND_bytes(buf, len);
+  }
   if (result != 1) {
     char errStr[120];  // specs require string at least 120 bytes long..
     unsigned long errVal = 0;
@@ -575,8 +781,8 @@ bool SSL_Cipher::randomize(unsigned char *buf, int len,
 
 uint64_t SSL_Cipher::MAC_64(const unsigned char *data, int len,
                             const CipherKey &key, uint64_t *chainedIV) const {
-  std::shared_ptr<SSLKey> mk = dynamic_pointer_cast<SSLKey>(key);
-  uint64_t tmp = _checksum_64(mk.get(), data, len, chainedIV);
+  SSLContextLease ctx(BlockKey(key));
+  uint64_t tmp = _checksum_64(ctx->mac_ctx, data, len, chainedIV);
 
   if (chainedIV != nullptr) {
     *chainedIV = tmp;
@@ -585,6 +791,20 @@ uint64_t SSL_Cipher::MAC_64(const unsigned char *data, int len,
   return tmp;
 }
 
+/**
+ * MACs of several buffers with one HMAC context, which is keyed once when
+ * the contexts are created and only reset per buffer.
+ */
+void SSL_Cipher::MAC_64_many(const unsigned char *src, int len, int stride,
+                             int count, const CipherKey &key,
+                             uint64_t *macs) const {
+  SSLContextLease ctx(BlockKey(key));
+  for (int i = 0; i < count; ++i) {
+    macs[i] = _checksum_64(ctx->mac_ctx, src + (size_t)i * stride, len,
+                           nullptr);
+  }
+}
+
 CipherKey SSL_Cipher::readKey(const unsigned char *data,
                               const CipherKey &masterKey, bool checkKey) {
   std::shared_ptr<SSLKey> mk = dynamic_pointer_cast<SSLKey>(masterKey);
@@ -667,6 +887,10 @@ int SSL_Cipher::encodedKeySize() const {
 int SSL_Cipher::keySize() const { return _keySize; }
 
 int SSL_Cipher::cipherBlockSize() const {
+  // XTS reports 1, but works on 16 byte AES blocks and needs at least one
+  if (EVP_CIPHER_mode(_blockCipher) == EVP_CIPH_XTS_MODE) {
+    return 16;
+  }
   return EVP_CIPHER_block_size(_blockCipher);
 }
 
@@ -687,28 +911,57 @@ int SSL_Cipher::cipherBlockSize() const {
  * requirement for "seed" is that is must be unique.
  */
 void SSL_Cipher::setIVec(unsigned char *ivec, uint64_t seed,
-                         const std::shared_ptr<SSLKey> &key) const {
-  if (iface.current() >= 3) {
+                         SSLKey *key, SSLContexts *ctx) const {
+  setIVecs(ivec, &seed, 1, key, ctx);
+}
+
+/**
+ * Derive the IVs for count seeds, _ivLength bytes each, into ivecs.  IVs
+ * which were derived recently with ctx are taken from its memo.
+ */
+void SSL_Cipher::setIVecs(unsigned char *ivecs, const uint64_t *seeds,
+                          int count, SSLKey *key, SSLContexts *ctx) const {
+  if (iface.current() < 3) {
+    for (int i = 0; i < count; ++i) {
+      setIVec_old(ivecs + i * _ivLength, seeds[i], key);
+    }
+    return;
+  }
+
+  for (int i = 0; i < count; ++i) {
+    unsigned char *ivec = ivecs + i * _ivLength;
+    uint64_t seed = seeds[i];
+
+    SSLContexts::IVMemo &memo =
+        ctx->ivMemo[seed % SSLContexts::ivMemoSize];
+    if (memo.valid && memo.seed == seed) {
+      memcpy(ivec, memo.ivec, _ivLength);
+      continue;
+    }
+
     memcpy(ivec, IVData(key), _ivLength);
 
     unsigned char md[EVP_MAX_MD_SIZE];
     unsigned int mdLen = EVP_MAX_MD_SIZE;
 
-    for (int i = 0; i < 8; ++i) {
-      md[i] = (unsigned char)(seed & 0xff);
+    for (int j = 0; j < 8; ++j) {
+      md[j] = (unsigned char)(seed & 0xff);
       seed >>= 8;
     }
 
-    // combine ivec and seed with HMAC
-    HMAC_Init_ex(key->mac_ctx, nullptr, 0, nullptr, nullptr);
-    HMAC_Update(key->mac_ctx, ivec, _ivLength);
-    HMAC_Update(key->mac_ctx, md, 8);
-    HMAC_Final(key->mac_ctx, md, &mdLen);
+    // combine ivec and seed with HMAC.  Passing no key restarts from the
+    // keyed state, so the key schedule isn't repeated for every IV.
+    HMAC_Init_ex(ctx->mac_ctx, nullptr, 0, nullptr, nullptr);
+    HMAC_Update(ctx->mac_ctx, ivec, _ivLength);
+    HMAC_Update(ctx->mac_ctx, md, 8);
+    HMAC_Final(ctx->mac_ctx, md, &mdLen);
     rAssert(mdLen >= _ivLength);
 
     memcpy(ivec, md, _ivLength);
-  } else {
-    setIVec_old(ivec, seed, key);
+
+    memo.valid = true;
+    memo.seed = seeds[i];
+    memcpy(memo.ivec, ivec, _ivLength);
   }
 }
 
@@ -719,7 +972,7 @@ void SSL_Cipher::setIVec(unsigned char *ivec, uint64_t seed,
     decrypting the file).
   */
 void SSL_Cipher::setIVec_old(unsigned char *ivec, unsigned int seed,
-                             const std::shared_ptr<SSLKey> &key) const {
+                             SSLKey *key) const {
   /* These multiplication constants chosen as they represent (non optimal)
      Golumb rulers, the idea being to spread around the information in the
      seed.
@@ -753,65 +1006,159 @@ void SSL_Cipher::setIVec_old(unsigned char *ivec, unsigned int seed,
   }
 }
 
-static void flipBytes(unsigned char *buf, int size) {
-  unsigned char revBuf[64];
+// The byte loops below work on 64 bit words.  The running XOR of the shuffle
+// needs the bytes of a word in memory order, i.e. a little endian machine.
+#if defined(_MSC_VER) || \
+    (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define SSL_CIPHER_WORD_SHUFFLE 1
+#endif
 
-  int bytesLeft = size;
-  while (bytesLeft != 0) {
-    int toFlip = MIN(sizeof(revBuf), bytesLeft);
+// stream coding reverses the data in chunks of this size, see
+// flipAndShuffleBytes()
+static const int flipChunkSize = 64;
 
-    for (int i = 0; i < toFlip; ++i) {
-      revBuf[i] = buf[toFlip - (i + 1)];
-    }
+static inline uint64_t loadWord(const unsigned char *p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+static inline void storeWord(unsigned char *p, uint64_t w) {
+  memcpy(p, &w, sizeof(w));
+}
 
-    memcpy(buf, revBuf, toFlip);
-    bytesLeft -= toFlip;
-    buf += toFlip;
+static inline uint64_t byteSwap64(uint64_t w) {
+#if defined(_MSC_VER)
+  return _byteswap_uint64(w);
+#else
+  return __builtin_bswap64(w);
+#endif
+}
+
+static void reverseBytes(unsigned char *buf, int size) {
+  unsigned char *lo = buf;
+  unsigned char *hi = buf + size;
+  while (hi - lo >= 16) {
+    uint64_t a = loadWord(lo);
+    uint64_t b = loadWord(hi - 8);
+    storeWord(lo, byteSwap64(b));
+    storeWord(hi - 8, byteSwap64(a));
+    lo += 8;
+    hi -= 8;
+  }
+  while (hi - lo > 1) {
+    --hi;
+    unsigned char tmp = *lo;
+    *lo = *hi;
+    *hi = tmp;
+    ++lo;
+  }
+}
+
+// running XOR over the bytes, continuing from carry, the last byte of the
+// previous range.  Returns the last byte of this range.
+static unsigned char shuffleRange(unsigned char *buf, int size,
+                                  unsigned char carry) {
+  int i = 0;
+#ifdef SSL_CIPHER_WORD_SHUFFLE
+  for (; i + 8 <= size; i += 8) {
+    uint64_t w = loadWord(buf + i);
+    w ^= w << 8;
+    w ^= w << 16;
+    w ^= w << 32;
+    w ^= carry * 0x0101010101010101ULL;
+    storeWord(buf + i, w);
+    carry = (unsigned char)(w >> 56);
+  }
+#endif
+  for (; i < size; ++i) {
+    buf[i] ^= carry;
+    carry = buf[i];
+  }
+  return carry;
+}
+
+// inverse of shuffleRange(), carry is the last byte of the previous range
+// before unshuffling.  Returns the last byte of this range before
+// unshuffling.
+static unsigned char unshuffleRange(unsigned char *buf, int size,
+                                    unsigned char carry) {
+  int i = 0;
+#ifdef SSL_CIPHER_WORD_SHUFFLE
+  for (; i + 8 <= size; i += 8) {
+    uint64_t w = loadWord(buf + i);
+    storeWord(buf + i, w ^ ((w << 8) | carry));
+    carry = (unsigned char)(w >> 56);
+  }
+#endif
+  for (; i < size; ++i) {
+    unsigned char b = buf[i];
+    buf[i] ^= carry;
+    carry = b;
   }
-  memset(revBuf, 0, sizeof(revBuf));
+  return carry;
 }
 
 static void shuffleBytes(unsigned char *buf, int size) {
-  for (int i = 0; i < size - 1; ++i) {
-    buf[i + 1] ^= buf[i];
+  shuffleRange(buf, size, 0);
+}
+
+/*
+    Between its two passes, stream coding flips the data (reverses every
+    chunk of flipChunkSize bytes) and shuffles it.  Both are done in one pass
+    over the data, each chunk is shuffled right after it was flipped.
+*/
+static void flipAndShuffleBytes(unsigned char *buf, int size) {
+  unsigned char carry = 0;
+  for (int offset = 0; offset < size; offset += flipChunkSize) {
+    int toFlip = std::min(flipChunkSize, size - offset);
+    reverseBytes(buf + offset, toFlip);
+    carry = shuffleRange(buf + offset, toFlip, carry);
   }
 }
 
-static void unshuffleBytes(unsigned char *buf, int size) {
-  for (int i = size - 1; i != 0; --i) {
-    buf[i] ^= buf[i - 1];
+static void unshuffleAndFlipBytes(unsigned char *buf, int size) {
+  unsigned char carry = 0;
+  for (int offset = 0; offset < size; offset += flipChunkSize) {
+    int toFlip = std::min(flipChunkSize, size - offset);
+    carry = unshuffleRange(buf + offset, toFlip, carry);
+    reverseBytes(buf + offset, toFlip);
   }
 }
 
+static void unshuffleBytes(unsigned char *buf, int size) {
+  unshuffleRange(buf, size, 0);
+}
+
 /** Partial blocks are encoded with a stream cipher.  We make multiple passes on
  the data to ensure that the ends of the data depend on each other.
 */
 bool SSL_Cipher::streamEncode(unsigned char *buf, int size, uint64_t iv64,
                               const CipherKey &ckey) const {
   rAssert(size > 0);
-  std::shared_ptr<SSLKey> key = dynamic_pointer_cast<SSLKey>(ckey);
+  SSLKey *key = BlockKey(ckey);
   rAssert(key->keySize == _keySize);
   rAssert(key->ivLength == _ivLength);
+  TRACE_EVENT3(CipherEncode, "bytes", size, "blocks", 1, "stream", 1);
 
-  Lock lock(key->mutex);
+  SSLContextLease ctx(key);
 
   unsigned char ivec[MAX_IVLENGTH];
   int dstLen = 0, tmpLen = 0;
 
   shuffleBytes(buf, size);
 
-  setIVec(ivec, iv64, key);
-  EVP_EncryptInit_ex(key->stream_enc, nullptr, nullptr, nullptr, ivec);
-  EVP_EncryptUpdate(key->stream_enc, buf, &dstLen, buf, size);
-  EVP_EncryptFinal_ex(key->stream_enc, buf + dstLen, &tmpLen);
+  setIVec(ivec, iv64, key, ctx.get());
+  EVP_EncryptInit_ex(ctx->stream_enc, nullptr, nullptr, nullptr, ivec);
+  EVP_EncryptUpdate(ctx->stream_enc, buf, &dstLen, buf, size);
+  EVP_EncryptFinal_ex(ctx->stream_enc, buf + dstLen, &tmpLen);
 
-  flipBytes(buf, size);
-  shuffleBytes(buf, size);
+  flipAndShuffleBytes(buf, size);
 
-  setIVec(ivec, iv64 + 1, key);
-  EVP_EncryptInit_ex(key->stream_enc, nullptr, nullptr, nullptr, ivec);
-  EVP_EncryptUpdate(key->stream_enc, buf, &dstLen, buf, size);
-  EVP_EncryptFinal_ex(key->stream_enc, buf + dstLen, &tmpLen);
+  setIVec(ivec, iv64 + 1, key, ctx.get());
+  EVP_EncryptInit_ex(ctx->stream_enc, nullptr, nullptr, nullptr, ivec);
+  EVP_EncryptUpdate(ctx->stream_enc, buf, &dstLen, buf, size);
+  EVP_EncryptFinal_ex(ctx->stream_enc, buf + dstLen, &tmpLen);
 
   dstLen += tmpLen;
   if (dstLen != size) {
@@ -826,27 +1173,28 @@ bool SSL_Cipher::streamEncode(unsigned char *buf, int size, uint64_t iv64,
 bool SSL_Cipher::streamDecode(unsigned char *buf, int size, uint64_t iv64,
                               const CipherKey &ckey) const {
   rAssert(size > 0);
-  std::shared_ptr<SSLKey> key = dynamic_pointer_cast<SSLKey>(ckey);
+  SSLKey *key = BlockKey(ckey);
   rAssert(key->keySize == _keySize);
   rAssert(key->ivLength == _ivLength);
 
-  Lock lock(key->mutex);
+  TRACE_EVENT3(CipherDecode, "bytes", size, "blocks", 1, "stream", 1);
+
+  SSLContextLease ctx(key);
 
   unsigned char ivec[MAX_IVLENGTH];
   int dstLen = 0, tmpLen = 0;
 
-  setIVec(ivec, iv64 + 1, key);
-  EVP_DecryptInit_ex(key->stream_dec, nullptr, nullptr, nullptr, ivec);
-  EVP_DecryptUpdate(key->stream_dec, buf, &dstLen, buf, size);
-  EVP_DecryptFinal_ex(key->stream_dec, buf + dstLen, &tmpLen);
+  setIVec(ivec, iv64 + 1, key, ctx.get());
+  EVP_DecryptInit_ex(ctx->stream_dec, nullptr, nullptr, nullptr, ivec);
+  EVP_DecryptUpdate(ctx->stream_dec, buf, &dstLen, buf, size);
+  EVP_DecryptFinal_ex(ctx->stream_dec, buf + dstLen, &tmpLen);
 
-  unshuffleBytes(buf, size);
-  flipBytes(buf, size);
+  unshuffleAndFlipBytes(buf, size);
 
-  setIVec(ivec, iv64, key);
-  EVP_DecryptInit_ex(key->stream_dec, nullptr, nullptr, nullptr, ivec);
-  EVP_DecryptUpdate(key->stream_dec, buf, &dstLen, buf, size);
-  EVP_DecryptFinal_ex(key->stream_dec, buf + dstLen, &tmpLen);
+  setIVec(ivec, iv64, key, ctx.get());
+  EVP_DecryptInit_ex(ctx->stream_dec, nullptr, nullptr, nullptr, ivec);
+  EVP_DecryptUpdate(ctx->stream_dec, buf, &dstLen, buf, size);
+  EVP_DecryptFinal_ex(ctx->stream_dec, buf + dstLen, &tmpLen);
 
   unshuffleBytes(buf, size);
 
@@ -862,28 +1210,36 @@ bool SSL_Cipher::streamDecode(unsigned char *buf, int size, uint64_t iv64,
 
 bool SSL_Cipher::blockEncode(unsigned char *buf, int size, uint64_t iv64,
                              const CipherKey &ckey) const {
+  return blockEncodeTo(buf, buf, size, iv64, ckey);
+}
+
+bool SSL_Cipher::blockEncodeTo(const unsigned char *src, unsigned char *dst,
+                               int size, uint64_t iv64,
+                               const CipherKey &ckey) const {
   rAssert(size > 0);
-  std::shared_ptr<SSLKey> key = dynamic_pointer_cast<SSLKey>(ckey);
+  SSLKey *key = BlockKey(ckey);
   rAssert(key->keySize == _keySize);
   rAssert(key->ivLength == _ivLength);
 
   // data must be integer number of blocks
-  const int blockMod = size % EVP_CIPHER_CTX_block_size(key->block_enc);
+  const int blockMod = size % EVP_CIPHER_block_size(_blockCipher);
   if (blockMod != 0) {
     RLOG(ERROR) << "Invalid data size, not multiple of block size";
     return false;
   }
 
-  Lock lock(key->mutex);
+  TRACE_EVENT3(CipherEncode, "bytes", size, "blocks", 1, "stream", 0);
+
+  SSLContextLease ctx(key);
 
   unsigned char ivec[MAX_IVLENGTH];
 
   int dstLen = 0, tmpLen = 0;
-  setIVec(ivec, iv64, key);
+  setIVec(ivec, iv64, key, ctx.get());
 
-  EVP_EncryptInit_ex(key->block_enc, nullptr, nullptr, nullptr, ivec);
-  EVP_EncryptUpdate(key->block_enc, buf, &dstLen, buf, size);
-  EVP_EncryptFinal_ex(key->block_enc, buf + dstLen, &tmpLen);
+  EVP_EncryptInit_ex(ctx->block_enc, nullptr, nullptr, nullptr, ivec);
+  EVP_EncryptUpdate(ctx->block_enc, dst, &dstLen, src, size);
+  EVP_EncryptFinal_ex(ctx->block_enc, dst + dstLen, &tmpLen);
   dstLen += tmpLen;
 
   if (dstLen != size) {
@@ -898,27 +1254,29 @@ bool SSL_Cipher::blockEncode(unsigned char *buf, int size, uint64_t iv64,
 bool SSL_Cipher::blockDecode(unsigned char *buf, int size, uint64_t iv64,
                              const CipherKey &ckey) const {
   rAssert(size > 0);
-  std::shared_ptr<SSLKey> key = dynamic_pointer_cast<SSLKey>(ckey);
+  SSLKey *key = BlockKey(ckey);
   rAssert(key->keySize == _keySize);
   rAssert(key->ivLength == _ivLength);
 
   // data must be integer number of blocks
-  const int blockMod = size % EVP_CIPHER_CTX_block_size(key->block_dec);
+  const int blockMod = size % EVP_CIPHER_block_size(_blockCipher);
   if (blockMod != 0) {
     RLOG(ERROR) << "Invalid data size, not multiple of block size";
     return false;
   }
 
-  Lock lock(key->mutex);
+  TRACE_EVENT3(CipherDecode, "bytes", size, "blocks", 1, "stream", 0);
+
+  SSLContextLease ctx(key);
 
   unsigned char ivec[MAX_IVLENGTH];
 
   int dstLen = 0, tmpLen = 0;
-  setIVec(ivec, iv64, key);
+  setIVec(ivec, iv64, key, ctx.get());
 
-  EVP_DecryptInit_ex(key->block_dec, nullptr, nullptr, nullptr, ivec);
-  EVP_DecryptUpdate(key->block_dec, buf, &dstLen, buf, size);
-  EVP_DecryptFinal_ex(key->block_dec, buf + dstLen, &tmpLen);
+  EVP_DecryptInit_ex(ctx->block_dec, nullptr, nullptr, nullptr, ivec);
+  EVP_DecryptUpdate(ctx->block_dec, buf, &dstLen, buf, size);
+  EVP_DecryptFinal_ex(ctx->block_dec, buf + dstLen, &tmpLen);
   dstLen += tmpLen;
 
   if (dstLen != size) {
@@ -930,6 +1288,77 @@ bool SSL_Cipher::blockDecode(unsigned char *buf, int size, uint64_t iv64,
   return true;
 }
 
+bool SSL_Cipher::blockEncodeMany(const Block *blocks, int count, int size,
+                                 const CipherKey &ckey) const {
+  return blockCodeMany(blocks, count, size, ckey, true);
+}
+
+bool SSL_Cipher::blockDecodeMany(const Block *blocks, int count, int size,
+                                 const CipherKey &ckey) const {
+  return blockCodeMany(blocks, count, size, ckey, false);
+}
+
+/**
+ * Code several blocks with one set of contexts.  The IVs are derived in
+ * batches of ivBatchSize blocks.
+ */
+bool SSL_Cipher::blockCodeMany(const Block *blocks, int count, int size,
+                               const CipherKey &ckey, bool encode) const {
+  rAssert(size > 0);
+  SSLKey *key = BlockKey(ckey);
+  rAssert(key->keySize == _keySize);
+  rAssert(key->ivLength == _ivLength);
+
+  // data must be integer number of blocks
+  const int blockMod = size % EVP_CIPHER_block_size(_blockCipher);
+  if (blockMod != 0) {
+    RLOG(ERROR) << "Invalid data size, not multiple of block size";
+    return false;
+  }
+
+  if (encode) {
+    TRACE_EVENT3(CipherEncode, "bytes", size, "blocks", count, "stream", 0);
+  } else {
+    TRACE_EVENT3(CipherDecode, "bytes", size, "blocks", count, "stream", 0);
+  }
+
+  SSLContextLease ctx(key);
+  EVP_CIPHER_CTX *cipherCtx = encode ? ctx->block_enc : ctx->block_dec;
+
+  static const int ivBatchSize = 16;
+  unsigned char ivecs[ivBatchSize * MAX_IVLENGTH];
+  uint64_t seeds[ivBatchSize];
+
+  for (int first = 0; first < count; first += ivBatchSize) {
+    int batch = std::min(count - first, ivBatchSize);
+    for (int i = 0; i < batch; ++i) {
+      seeds[i] = blocks[first + i].iv64;
+    }
+    setIVecs(ivecs, seeds, batch, key, ctx.get());
+
+    for (int i = 0; i < batch; ++i) {
+      unsigned char *buf = blocks[first + i].buf;
+      int dstLen = 0, tmpLen = 0;
+
+      // -1 keeps the direction the context was initialized with
+      EVP_CipherInit_ex(cipherCtx, nullptr, nullptr, nullptr,
+                        ivecs + i * _ivLength, -1);
+      EVP_CipherUpdate(cipherCtx, buf, &dstLen, buf, size);
+      EVP_CipherFinal_ex(cipherCtx, buf + dstLen, &tmpLen);
+      dstLen += tmpLen;
+
+      if (dstLen != size) {
+        RLOG(ERROR) << (encode ? "encoding " : "decoding ") << size
+                    << " bytes, got back " << dstLen << " (" << tmpLen
+                    << " in final_ex)";
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
 bool SSL_Cipher::Enabled() { return true; }
 
 }  // namespace encfs
@@ -37,6 +37,7 @@ using EVP_CIPHER = struct evp_cipher_st;
 namespace encfs {
 
 class SSLKey;
+struct SSLContexts;
 
 /*
     Implements Cipher interface for OpenSSL's ciphers.
@@ -118,6 +119,9 @@ class SSL_Cipher : public Cipher {
 
   virtual uint64_t MAC_64(const unsigned char *src, int len,
                           const CipherKey &key, uint64_t *augment) const;
+  virtual void MAC_64_many(const unsigned char *src, int len, int stride,
+                           int count, const CipherKey &key,
+                           uint64_t *macs) const;
 
   // functional interfaces
   /*
@@ -137,17 +141,31 @@ class SSL_Cipher : public Cipher {
                            const CipherKey &key) const;
   virtual bool blockDecode(unsigned char *buf, int size, uint64_t iv64,
                            const CipherKey &key) const;
+  // EVP codes from one buffer into the other in the same pass
+  virtual bool blockEncodeTo(const unsigned char *src, unsigned char *dst,
+                             int size, uint64_t iv64,
+                             const CipherKey &key) const;
+  virtual bool blockEncodeMany(const Block *blocks, int count, int size,
+                               const CipherKey &key) const;
+  virtual bool blockDecodeMany(const Block *blocks, int count, int size,
+                               const CipherKey &key) const;
 
   // hack to help with static builds
   static bool Enabled();
 
  private:
+  // ctx is the set of contexts used by the caller, see SSLContextLease
   void setIVec(unsigned char *ivec, uint64_t seed,
-               const std::shared_ptr<SSLKey> &key) const;
+               SSLKey *key, SSLContexts *ctx) const;
+  void setIVecs(unsigned char *ivecs, const uint64_t *seeds, int count,
+                SSLKey *key, SSLContexts *ctx) const;
+
+  bool blockCodeMany(const Block *blocks, int count, int size,
+                     const CipherKey &key, bool encode) const;
 
   // deprecated - for backward compatibility
   void setIVec_old(unsigned char *ivec, unsigned int seed,
-                   const std::shared_ptr<SSLKey> &key) const;
+                   SSLKey *key) const;
 };
 
 }  // namespace encfs
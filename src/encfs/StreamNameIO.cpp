@@ -135,15 +135,35 @@ int StreamNameIO::encodeName(const char *plaintextName, int length,
 int StreamNameIO::decodeName(const char *encodedName, int length, uint64_t *iv,
                              char *plaintextName, int bufferLength) const {
   rAssert(length > 2);
+  int decodedStreamLen =
+      tryDecodeName(encodedName, length, iv, plaintextName, bufferLength);
+  if (decodedStreamLen < 0) {
+    throw Error("Invalid filename, decode failed");
+  }
+  return decodedStreamLen;
+}
+
+bool StreamNameIO::isValidEncodedName(const char *encodedName,
+                                      int length) const {
+  // at least one byte besides the 2 checksum bytes, in the shortest ASCII
+  // form which encodeName() produces
   int decLen256 = B64ToB256Bytes(length);
-  int decodedStreamLen = decLen256 - 2;
-  rAssert(decodedStreamLen <= bufferLength);
+  return decLen256 > 2 && B256ToB64Bytes(decLen256) == length &&
+         IsB64Ascii((const unsigned char *)encodedName, length);
+}
 
-  if (decodedStreamLen <= 0) {
-    throw Error("Filename too small to decode");
+int StreamNameIO::tryDecodeName(const char *encodedName, int length,
+                                uint64_t *iv, char *plaintextName,
+                                int bufferLength) const {
+  if (!isValidEncodedName(encodedName, length)) {
+    VLOG(1) << "Rejecting filename " << encodedName;
+    return -1;
   }
+  int decLen256 = B64ToB256Bytes(length);
+  int decodedStreamLen = decLen256 - 2;
+  rAssert(decodedStreamLen <= bufferLength);
 
-  BUFFER_INIT(tmpBuf, 32, (unsigned int)length);
+  BUFFER_INIT(tmpBuf, NameBufferSize, (unsigned int)length);
 
   // decode into tmpBuf, because this step produces more data then we can fit
   // into the result buffer..
@@ -184,7 +204,7 @@ int StreamNameIO::decodeName(const char *encodedName, int length, uint64_t *iv,
   if (mac2 != mac) {
     VLOG(1) << "checksum mismatch: expected " << mac << ", got " << mac2;
     VLOG(1) << "on decode of " << decodedStreamLen << " bytes";
-    throw Error("checksum mismatch in filename decode");
+    return -1;
   }
 
   return decodedStreamLen;
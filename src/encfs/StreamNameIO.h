@@ -53,6 +53,9 @@ class StreamNameIO : public NameIO {
                          char *encodedName, int bufferLength) const;
   virtual int decodeName(const char *encodedName, int length, uint64_t *iv,
                          char *plaintextName, int bufferLength) const;
+  virtual bool isValidEncodedName(const char *encodedName, int length) const;
+  virtual int tryDecodeName(const char *encodedName, int length, uint64_t *iv,
+                            char *plaintextName, int bufferLength) const;
 
  private:
   int _interface;
@@ -0,0 +1,56 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "TraceEvents.h"
+
+namespace encfs {
+
+#if defined(ENCFS_TRACE_EVENTS) && defined(_WIN32)
+
+// {f678b274-837c-4469-a6ca-a6ed8e168575}, e.g. for
+// "tracelog -start encfsmp -guid #f678b274-837c-4469-a6ca-a6ed8e168575"
+TRACELOGGING_DEFINE_PROVIDER(traceProvider, "EncFSMP",
+                             (0xf678b274, 0x837c, 0x4469, 0xa6, 0xca, 0xa6,
+                              0xed, 0x8e, 0x16, 0x85, 0x75));
+
+/*
+    Registers the provider for the lifetime of the process.  Every user of
+    the events refers to traceProvider, so this object is linked in with
+    them.
+*/
+class TraceProviderRegistration {
+ public:
+  TraceProviderRegistration() { TraceLoggingRegister(traceProvider); }
+  ~TraceProviderRegistration() { TraceLoggingUnregister(traceProvider); }
+};
+
+static TraceProviderRegistration providerRegistration;
+
+#endif
+
+bool TraceEvents::enabled() {
+#if defined(ENCFS_TRACE_EVENTS)
+  return true;
+#else
+  return false;
+#endif
+}
+
+}  // namespace encfs
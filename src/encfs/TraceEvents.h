@@ -0,0 +1,128 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TraceEvents_incl_
+#define _TraceEvents_incl_
+
+#include <stdint.h>
+
+/*
+    Events for system-wide tracers, so that a mount can be analyzed next to
+    the rest of the system, where PhaseTimer and the statistics of the
+    formatter only show totals.
+
+    On Windows the events are written with TraceLogging by the provider
+    "EncFSMP" (see traceProviderGuid in TraceEvents.cpp), to be recorded
+    with e.g. "wpr" or "tracelog" and viewed in WPA.  Elsewhere they are
+    USDT probes of the provider "encfsmp", for perf, bpftrace, SystemTap or
+    the userspace probes of LTTng, e.g. "perf probe sdt_encfsmp:RawRead".
+
+    The events are only compiled in with ENCFS_TRACE_EVENTS defined (the
+    ENCFS_TRACE_EVENTS option of CMake, if the system has the headers),
+    otherwise TRACE_EVENTn() expands to nothing.  When no session listens, a
+    TraceLogging event is one test of the provider, a USDT probe a nop; the
+    arguments are integers and pointers which are at hand anyway.
+
+    Usage:
+      TRACE_EVENT2(RawRead, "offset", req.offset, "bytes", readSize);
+
+    The event name becomes the name of the ETW event and of the USDT probe.
+    The names of the fields only show in ETW, the probes take the values in
+    the same order as arguments arg1, arg2, ...  All values are passed as
+    64 bit signed integers.
+*/
+
+#if defined(ENCFS_TRACE_EVENTS) && defined(_WIN32)
+
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+
+namespace encfs {
+TRACELOGGING_DECLARE_PROVIDER(traceProvider);
+}  // namespace encfs
+
+#define ENCFS_TRACE_FIELD(name, value) TraceLoggingInt64((int64_t)(value), name)
+
+#define TRACE_EVENT1(event, n1, v1)                       \
+  TraceLoggingWrite(::encfs::traceProvider, #event,       \
+                    ENCFS_TRACE_FIELD(n1, v1))
+#define TRACE_EVENT2(event, n1, v1, n2, v2)               \
+  TraceLoggingWrite(::encfs::traceProvider, #event,       \
+                    ENCFS_TRACE_FIELD(n1, v1),            \
+                    ENCFS_TRACE_FIELD(n2, v2))
+#define TRACE_EVENT3(event, n1, v1, n2, v2, n3, v3)       \
+  TraceLoggingWrite(::encfs::traceProvider, #event,       \
+                    ENCFS_TRACE_FIELD(n1, v1),            \
+                    ENCFS_TRACE_FIELD(n2, v2),            \
+                    ENCFS_TRACE_FIELD(n3, v3))
+#define TRACE_EVENT4(event, n1, v1, n2, v2, n3, v3, n4, v4) \
+  TraceLoggingWrite(::encfs::traceProvider, #event,         \
+                    ENCFS_TRACE_FIELD(n1, v1),              \
+                    ENCFS_TRACE_FIELD(n2, v2),              \
+                    ENCFS_TRACE_FIELD(n3, v3),              \
+                    ENCFS_TRACE_FIELD(n4, v4))
+#define TRACE_EVENT5(event, n1, v1, n2, v2, n3, v3, n4, v4, n5, v5) \
+  TraceLoggingWrite(::encfs::traceProvider, #event,                 \
+                    ENCFS_TRACE_FIELD(n1, v1),                      \
+                    ENCFS_TRACE_FIELD(n2, v2),                      \
+                    ENCFS_TRACE_FIELD(n3, v3),                      \
+                    ENCFS_TRACE_FIELD(n4, v4),                      \
+                    ENCFS_TRACE_FIELD(n5, v5))
+
+#elif defined(ENCFS_TRACE_EVENTS)
+
+#include <sys/sdt.h>
+
+#define TRACE_EVENT1(event, n1, v1) \
+  STAP_PROBE1(encfsmp, event, (int64_t)(v1))
+#define TRACE_EVENT2(event, n1, v1, n2, v2) \
+  STAP_PROBE2(encfsmp, event, (int64_t)(v1), (int64_t)(v2))
+#define TRACE_EVENT3(event, n1, v1, n2, v2, n3, v3) \
+  STAP_PROBE3(encfsmp, event, (int64_t)(v1), (int64_t)(v2), (int64_t)(v3))
+#define TRACE_EVENT4(event, n1, v1, n2, v2, n3, v3, n4, v4)              \
+  STAP_PROBE4(encfsmp, event, (int64_t)(v1), (int64_t)(v2), (int64_t)(v3), \
+              (int64_t)(v4))
+#define TRACE_EVENT5(event, n1, v1, n2, v2, n3, v3, n4, v4, n5, v5)      \
+  STAP_PROBE5(encfsmp, event, (int64_t)(v1), (int64_t)(v2), (int64_t)(v3), \
+              (int64_t)(v4), (int64_t)(v5))
+
+#else
+
+#define ENCFS_TRACE_NOTHING \
+  do {                      \
+  } while (0)
+#define TRACE_EVENT1(event, ...) ENCFS_TRACE_NOTHING
+#define TRACE_EVENT2(event, ...) ENCFS_TRACE_NOTHING
+#define TRACE_EVENT3(event, ...) ENCFS_TRACE_NOTHING
+#define TRACE_EVENT4(event, ...) ENCFS_TRACE_NOTHING
+#define TRACE_EVENT5(event, ...) ENCFS_TRACE_NOTHING
+
+#endif
+
+namespace encfs {
+
+namespace TraceEvents {
+// false if the events are not compiled in
+bool enabled();
+}
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,101 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "VolumeKeyCache.h"
+
+#include <cstring>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include "Error.h"
+#include "Mutex.h"
+
+namespace encfs {
+
+VolumeKeyCache &VolumeKeyCache::instance() {
+  static VolumeKeyCache cache;
+  return cache;
+}
+
+VolumeKeyCache::VolumeKeyCache() {
+  if (RAND_bytes(_secret, secretSize) != 1) {
+    throw Error("unable to create the secret of the volume key cache");
+  }
+}
+
+VolumeKeyCache::~VolumeKeyCache() { OPENSSL_cleanse(_secret, secretSize); }
+
+std::string VolumeKeyCache::passwordVerifier(
+    const std::string &password) const {
+  unsigned char md[EVP_MAX_MD_SIZE];
+  unsigned int mdLen = 0;
+  HMAC(EVP_sha256(), _secret, secretSize,
+       reinterpret_cast<const unsigned char *>(password.data()),
+       password.size(), md, &mdLen);
+  return std::string(reinterpret_cast<const char *>(md), mdLen);
+}
+
+CipherKey VolumeKeyCache::lookup(const std::string &volume,
+                                 const std::vector<unsigned char> &keyData,
+                                 const std::string &password) const {
+  std::string verifier = passwordVerifier(password);
+
+  Lock _lock(_mutex);
+
+  auto it = _entries.find(volume);
+  if (it == _entries.end()) {
+    return CipherKey();
+  }
+  const Entry &entry = it->second;
+  if (entry.keyData != keyData || entry.verifier.size() != verifier.size() ||
+      CRYPTO_memcmp(entry.verifier.data(), verifier.data(),
+                    verifier.size()) != 0) {
+    return CipherKey();
+  }
+  return entry.volumeKey;
+}
+
+void VolumeKeyCache::insert(const std::string &volume,
+                            const std::vector<unsigned char> &keyData,
+                            const std::string &password,
+                            const CipherKey &volumeKey) {
+  std::string verifier = passwordVerifier(password);
+
+  Lock _lock(_mutex);
+
+  Entry &entry = _entries[volume];
+  entry.keyData = keyData;
+  entry.verifier = verifier;
+  entry.volumeKey = volumeKey;
+}
+
+void VolumeKeyCache::forget(const std::string &volume) {
+  Lock _lock(_mutex);
+  _entries.erase(volume);
+}
+
+void VolumeKeyCache::clear() {
+  Lock _lock(_mutex);
+  _entries.clear();
+}
+
+}  // namespace encfs
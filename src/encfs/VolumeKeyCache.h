@@ -0,0 +1,84 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _VolumeKeyCache_incl_
+#define _VolumeKeyCache_incl_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+#include "CipherKey.h"
+
+namespace encfs {
+
+/*
+    Decoded volume keys of the volumes mounted by this process, so that a
+    volume can be mounted again without running the key derivation.
+
+    An entry is identified by the volume (root directory and configuration
+    file) and only used while the encoded key in the configuration is
+    unchanged and the password matches.  The password itself is not kept,
+    only an HMAC of it with a secret chosen when the process starts.
+    Nothing is written to disk; the keys are in memory like the key of a
+    mounted volume.
+*/
+class VolumeKeyCache {
+ public:
+  static VolumeKeyCache &instance();
+
+  // returns an empty key if the volume is not cached for this password
+  CipherKey lookup(const std::string &volume,
+                   const std::vector<unsigned char> &keyData,
+                   const std::string &password) const;
+  void insert(const std::string &volume,
+              const std::vector<unsigned char> &keyData,
+              const std::string &password, const CipherKey &volumeKey);
+
+  void forget(const std::string &volume);
+  void clear();
+
+ private:
+  VolumeKeyCache();
+  ~VolumeKeyCache();
+  VolumeKeyCache(const VolumeKeyCache &src);             // not allowed
+  VolumeKeyCache &operator=(const VolumeKeyCache &src);  // not allowed
+
+  std::string passwordVerifier(const std::string &password) const;
+
+  struct Entry {
+    std::vector<unsigned char> keyData;
+    std::string verifier;
+    CipherKey volumeKey;
+  };
+
+  static const int secretSize = 32;
+  unsigned char _secret[secretSize];
+
+  std::unordered_map<std::string, Entry> _entries;
+
+  mutable boost::mutex _mutex;
+};
+
+}  // namespace encfs
+
+#endif
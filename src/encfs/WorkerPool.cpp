@@ -0,0 +1,127 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "WorkerPool.h"
+
+#include <algorithm>  // for max
+
+#include "Mutex.h"
+
+namespace encfs {
+
+WorkerPool &WorkerPool::instance() {
+  // the calling thread is one of the workers
+  static WorkerPool pool(
+      std::max(1, static_cast<int>(boost::thread::hardware_concurrency()) - 1));
+  return pool;
+}
+
+WorkerPool::WorkerPool(int threadCount)
+    : _threadCount(threadCount), _stopping(false) {
+  for (int i = 0; i < threadCount; i++) {
+    _threads.create_thread([this]() { workerLoop(); });
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    Lock _lock(_mutex);
+    _stopping = true;
+  }
+  _cond.notify_all();
+  _threads.join_all();
+}
+
+void WorkerPool::parallelFor(size_t count,
+                             const std::function<void(size_t)> &fn) {
+  if (count == 0) {
+    return;
+  }
+  if (count == 1 || _threadCount == 0) {
+    for (size_t i = 0; i < count; i++) {
+      fn(i);
+    }
+    return;
+  }
+
+  std::shared_ptr<Job> job = std::make_shared<Job>();
+  job->fn = &fn;
+  job->count = count;
+  job->next = 0;
+  job->done = 0;
+  {
+    Lock _lock(_mutex);
+    _jobs.push_back(job);
+  }
+  _cond.notify_all();
+
+  while (runOne(*job)) {
+  }
+
+  boost::mutex::scoped_lock lock(job->mutex);
+  while (job->done < count) {
+    job->doneCond.wait(lock);
+  }
+}
+
+/**
+ * Runs the next call of job.  Returns false if all calls have been handed out.
+ */
+bool WorkerPool::runOne(Job &job) {
+  size_t index = job.next++;
+  if (index >= job.count) {
+    return false;
+  }
+
+  (*job.fn)(index);
+
+  if (++job.done == job.count) {
+    boost::mutex::scoped_lock lock(job.mutex);
+    job.doneCond.notify_all();
+  }
+  return true;
+}
+
+void WorkerPool::workerLoop() {
+  while (true) {
+    std::shared_ptr<Job> job;
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      while (_jobs.empty() && !_stopping) {
+        _cond.wait(lock);
+      }
+      if (_stopping) {
+        return;
+      }
+
+      job = _jobs.front();
+      // everything handed out, the remaining calls are already running
+      if (job->next >= job->count) {
+        _jobs.pop_front();
+        continue;
+      }
+    }
+
+    while (runOne(*job)) {
+    }
+  }
+}
+
+}  // namespace encfs
@@ -0,0 +1,80 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WorkerPool_incl_
+#define _WorkerPool_incl_
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <stddef.h>
+
+#include <boost/thread.hpp>
+
+namespace encfs {
+
+/*
+    Small pool of threads shared by all filesystems of the process, for
+    splitting CPU bound work like the coding of many blocks.
+
+    The calling thread takes part in the work, so parallelFor() also makes
+    progress when all pool threads are busy.
+*/
+class WorkerPool {
+ public:
+  static WorkerPool &instance();
+
+  WorkerPool(int threadCount);
+  ~WorkerPool();
+
+  int threadCount() const { return _threadCount; }
+
+  // calls fn(i) for every i in [0, count), and returns once all calls have
+  // completed.  fn must not throw.
+  void parallelFor(size_t count, const std::function<void(size_t)> &fn);
+
+ private:
+  WorkerPool(const WorkerPool &src);             // not allowed
+  WorkerPool &operator=(const WorkerPool &src);  // not allowed
+
+  struct Job {
+    const std::function<void(size_t)> *fn;
+    size_t count;
+    std::atomic<size_t> next;  // next index to hand out
+    std::atomic<size_t> done;  // number of completed calls
+    boost::mutex mutex;
+    boost::condition_variable doneCond;
+  };
+
+  void workerLoop();
+  static bool runOne(Job &job);
+
+  int _threadCount;
+  boost::thread_group _threads;
+  boost::mutex _mutex;
+  boost::condition_variable _cond;
+  std::deque<std::shared_ptr<Job>> _jobs;
+  bool _stopping;
+};
+
+}  // namespace encfs
+
+#endif
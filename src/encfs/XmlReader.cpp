@@ -22,10 +22,8 @@
 
 #include <algorithm>  // for remove_if
 #include <cstring>    // for NULL
-#include <fstream>    // for ifstream
 #include <limits>
 #include <memory>     // for shared_ptr
-#include <sstream>    // for ostringstream
 
 #include <tinyxml2.h>  // for XMLElement, XMLNode, XMLDocument (ptr only)
 
@@ -207,14 +205,8 @@ XmlReader::~XmlReader() = default;
 bool XmlReader::load(const char *fileName) {
   pd->doc.reset(new tinyxml2::XMLDocument());
 
-  std::ifstream in(fileName);
-  if (!in) {
-    return false;
-  }
-
-  std::ostringstream fileContent;
-  fileContent << in.rdbuf();
-  auto err = pd->doc->Parse(fileContent.str().c_str());
+  // read the file in one go, tinyxml2 parses it in place
+  auto err = pd->doc->LoadFile(fileName);
   return err == tinyxml2::XML_SUCCESS;
 }
 
@@ -0,0 +1,83 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ZeroBlock.h"
+
+#include <cstring>  // for memcpy
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ZERO_BLOCK_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define ZERO_BLOCK_NEON
+#include <arm_neon.h>
+#endif
+
+namespace encfs {
+
+// bytes tested per iteration of the vector loops
+static const size_t vectorStride = 64;
+
+bool isAllZero(const unsigned char *buf, size_t len) {
+  size_t i = 0;
+
+  // encrypted data fails on the first bytes, so test vectorStride bytes at a
+  // time and return as soon as one of them is set
+#if defined(ZERO_BLOCK_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + vectorStride <= len; i += vectorStride) {
+    const __m128i *p = reinterpret_cast<const __m128i *>(buf + i);
+    __m128i v = _mm_or_si128(
+        _mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+        _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xffff) {
+      return false;
+    }
+  }
+#elif defined(ZERO_BLOCK_NEON)
+  for (; i + vectorStride <= len; i += vectorStride) {
+    const unsigned char *p = buf + i;
+    uint8x16_t v = vorrq_u8(vorrq_u8(vld1q_u8(p), vld1q_u8(p + 16)),
+                            vorrq_u8(vld1q_u8(p + 32), vld1q_u8(p + 48)));
+    if (vmaxvq_u8(v) != 0) {
+      return false;
+    }
+  }
+#endif
+
+  // the rest a word at a time, then the remaining bytes
+  for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, buf + i, sizeof(word));
+    if (word != 0) {
+      return false;
+    }
+  }
+  for (; i < len; ++i) {
+    if (buf[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace encfs
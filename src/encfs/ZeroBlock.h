@@ -0,0 +1,34 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2004, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ZeroBlock_incl_
+#define _ZeroBlock_incl_
+
+#include <stddef.h>
+
+namespace encfs {
+
+// true if the len bytes at buf are all zero.  Decides the zero-block
+// pass-through (allowHoles), so it uses SIMD where available.
+bool isAllZero(const unsigned char *buf, size_t len);
+
+}  // namespace encfs
+
+#endif
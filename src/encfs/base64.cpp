@@ -20,7 +20,18 @@
 
 #include "base64.h"
 
-#include <cctype>  // for toupper
+#include <cctype>   // for toupper
+#include <cstring>  // for memcpy
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BASE64_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define BASE64_NEON
+#include <arm_neon.h>
+#endif
 
 #include "Error.h"
 
@@ -57,61 +68,155 @@ void changeBase2(unsigned char *src, int srcLen, int src2Pow,
   }
 }
 
+// number of bytes of a whole group of values, which starts and ends on a
+// byte boundary of both bases
+static int groupLength(int src2Pow, int dst2Pow) {
+  int bits = src2Pow * dst2Pow;
+  while ((bits % 2 == 0) && (bits / 2) % src2Pow == 0 &&
+         (bits / 2) % dst2Pow == 0) {
+    bits /= 2;
+  }
+  return bits / src2Pow;
+}
+
 /*
-    Same as changeBase2, except the output is written over the input data.  The
-    output is assumed to be large enough to accept the data.
+    Converts srcLen values of src2Pow bits to values of dst2Pow bits, and
+    returns the number of values written to out.  The last value is written
+    even if it is incomplete.  With outputPartialLastByte, the remaining
+    bits are written too.
 
-    Uses the stack to store output values.  Recurse every time a new value is
-    to be written, then write the value at the tail end of the recursion.
+    out may be the same as src if dst2Pow >= src2Pow, as no value is written
+    before the bits of its position have been read.
 */
-static void changeBase2Inline(unsigned char *src, int srcLen, int src2Pow,
-                              int dst2Pow, bool outputPartialLastByte,
-                              unsigned long work, int workBits,
-                              unsigned char *outLoc) {
-  const int mask = (1 << dst2Pow) - 1;
-  if (outLoc == nullptr) {
-    outLoc = src;
+static int changeBase2Stream(const unsigned char *src, int srcLen, int src2Pow,
+                             unsigned char *out, int dst2Pow,
+                             bool outputPartialLastByte) {
+  const uint64_t mask = (1 << dst2Pow) - 1;
+  const int srcGroup = groupLength(src2Pow, dst2Pow);
+  const int dstGroup = srcGroup * src2Pow / dst2Pow;
+  int outLen = 0;
+
+  // whole groups first, there are at most 40 bits in a group.  Keep the
+  // last group for the loop below, which handles the end of the input.
+  while (srcLen > srcGroup) {
+    uint64_t work = 0;
+    for (int i = 0; i < srcGroup; ++i) {
+      work |= (uint64_t)src[i] << (i * src2Pow);
+    }
+    src += srcGroup;
+    srcLen -= srcGroup;
+    for (int i = 0; i < dstGroup; ++i) {
+      out[outLen++] = work & mask;
+      work >>= dst2Pow;
+    }
   }
 
   // copy the new bits onto the high bits of the stream.
   // The bits that fall off the low end are the output bits.
-  while ((srcLen != 0) && workBits < dst2Pow) {
-    work |= ((unsigned long)(*src++)) << workBits;
-    workBits += src2Pow;
-    --srcLen;
-  }
+  unsigned long work = 0;
+  int workBits = 0;  // number of bits left in the work buffer
+  do {
+    while ((srcLen != 0) && workBits < dst2Pow) {
+      work |= ((unsigned long)(*src++)) << workBits;
+      workBits += src2Pow;
+      --srcLen;
+    }
 
-  // we have at least one value that can be output
-  unsigned char outVal = work & mask;
-  work >>= dst2Pow;
-  workBits -= dst2Pow;
-
-  if (srcLen != 0) {
-    // more input left, so recurse
-    changeBase2Inline(src, srcLen, src2Pow, dst2Pow, outputPartialLastByte,
-                      work, workBits, outLoc + 1);
-    *outLoc = outVal;
-  } else {
-    // no input left, we can write remaining values directly
-    *outLoc++ = outVal;
-
-    // we could have a partial value left in the work buffer..
-    if (outputPartialLastByte) {
-      while (workBits > 0) {
-        *outLoc++ = work & mask;
-        work >>= dst2Pow;
-        workBits -= dst2Pow;
-      }
+    // we have at least one value that can be output
+    out[outLen++] = work & mask;
+    work >>= dst2Pow;
+    workBits -= dst2Pow;
+  } while (srcLen != 0);
+
+  // we could have a partial value left in the work buffer..
+  if (outputPartialLastByte) {
+    while (workBits > 0) {
+      out[outLen++] = work & mask;
+      work >>= dst2Pow;
+      workBits -= dst2Pow;
     }
   }
+
+  return outLen;
 }
 
+/*
+    Same as changeBase2, except the output is written over the input data.  The
+    output is assumed to be large enough to accept the data.
+
+    When the output is longer than the input, it is built in a temporary
+    buffer first.  Names are short, so the stack buffer is almost always
+    large enough.
+*/
 void changeBase2Inline(unsigned char *src, int srcLen, int src2Pow, int dst2Pow,
                        bool outputPartialLastByte) {
-  changeBase2Inline(src, srcLen, src2Pow, dst2Pow, outputPartialLastByte, 0, 0,
-                    nullptr);
+  if (dst2Pow >= src2Pow) {
+    changeBase2Stream(src, srcLen, src2Pow, src, dst2Pow,
+                      outputPartialLastByte);
+    return;
+  }
+
+  size_t maxLen = ((size_t)srcLen * src2Pow + dst2Pow - 1) / dst2Pow + 1;
+  unsigned char stackBuf[512];
+  std::vector<unsigned char> heapBuf;
+  unsigned char *out = stackBuf;
+  if (maxLen > sizeof(stackBuf)) {
+    heapBuf.resize(maxLen);
+    out = heapBuf.data();
+  }
+
+  int outLen = changeBase2Stream(src, srcLen, src2Pow, out, dst2Pow,
+                                 outputPartialLastByte);
+  memcpy(src, out, outLen);
 }
 
+/*
+    The translations between values and ASCII below work on vectors of 16
+    bytes where available, with the same arithmetic as the scalar code.
+    The comparisons of SSE2 are signed, so chunks with a byte of 128 or
+    more (which can't occur in valid names) are left to the scalar code.
+*/
+#if defined(BASE64_SSE2)
+typedef __m128i Vec;
+static inline Vec vload(const unsigned char *p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+}
+static inline void vstore(unsigned char *p, Vec v) {
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v);
+}
+static inline Vec vsplat(int c) { return _mm_set1_epi8((char)c); }
+static inline Vec vadd(Vec a, Vec b) { return _mm_add_epi8(a, b); }
+static inline Vec vsub(Vec a, Vec b) { return _mm_sub_epi8(a, b); }
+static inline Vec vand(Vec a, Vec b) { return _mm_and_si128(a, b); }
+static inline Vec vor(Vec a, Vec b) { return _mm_or_si128(a, b); }
+// b without the bits of mask
+static inline Vec vandnot(Vec mask, Vec b) { return _mm_andnot_si128(mask, b); }
+static inline Vec vgt(Vec a, int c) { return _mm_cmpgt_epi8(a, vsplat(c)); }
+static inline Vec vlt(Vec a, int c) { return _mm_cmplt_epi8(a, vsplat(c)); }
+static inline Vec veq(Vec a, int c) { return _mm_cmpeq_epi8(a, vsplat(c)); }
+static inline bool vhasHighBit(Vec v) { return _mm_movemask_epi8(v) != 0; }
+#elif defined(BASE64_NEON)
+typedef uint8x16_t Vec;
+static inline Vec vload(const unsigned char *p) { return vld1q_u8(p); }
+static inline void vstore(unsigned char *p, Vec v) { vst1q_u8(p, v); }
+static inline Vec vsplat(int c) { return vdupq_n_u8((uint8_t)c); }
+static inline Vec vadd(Vec a, Vec b) { return vaddq_u8(a, b); }
+static inline Vec vsub(Vec a, Vec b) { return vsubq_u8(a, b); }
+static inline Vec vand(Vec a, Vec b) { return vandq_u8(a, b); }
+static inline Vec vor(Vec a, Vec b) { return vorrq_u8(a, b); }
+// b without the bits of mask
+static inline Vec vandnot(Vec mask, Vec b) { return vbicq_u8(b, mask); }
+static inline Vec vgt(Vec a, int c) { return vcgtq_u8(a, vsplat(c)); }
+static inline Vec vlt(Vec a, int c) { return vcltq_u8(a, vsplat(c)); }
+static inline Vec veq(Vec a, int c) { return vceqq_u8(a, vsplat(c)); }
+static inline bool vhasHighBit(Vec v) { return vmaxvq_u8(v) >= 0x80; }
+#endif
+
+#if defined(BASE64_SSE2) || defined(BASE64_NEON)
+#define BASE64_VECTOR
+static const int vectorLength = 16;
+#endif
+
 // character set for ascii b64:
 // ",-0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
 // a standard base64 (eg a64l doesn't use ',-' but uses './'.  We don't
@@ -120,7 +225,21 @@ void changeBase2Inline(unsigned char *src, int srcLen, int src2Pow, int dst2Pow,
 // with special meaning.
 static const char B642AsciiTable[] = ",-0123456789";
 void B64ToAscii(unsigned char *in, int length) {
-  for (int offset = 0; offset < length; ++offset) {
+  int offset = 0;
+#if defined(BASE64_VECTOR)
+  // ',' for 0, then '-', '0' for 2, 'A' for 12 and 'a' for 38
+  for (; offset + vectorLength <= length; offset += vectorLength) {
+    Vec v = vload(in + offset);
+    if (vhasHighBit(v)) {
+      break;
+    }
+    Vec add = vadd(vadd(vsplat(','), vand(vgt(v, 1), vsplat(2))),
+                   vadd(vand(vgt(v, 11), vsplat('A' - 12 - '0' + 2)),
+                        vand(vgt(v, 37), vsplat('a' - 38 - 'A' + 12))));
+    vstore(in + offset, vadd(v, add));
+  }
+#endif
+  for (; offset < length; ++offset) {
     int ch = in[offset];
     if (ch > 11) {
       if (ch > 37) {
@@ -145,6 +264,29 @@ void AsciiToB64(unsigned char *in, int length) {
 }
 
 void AsciiToB64(unsigned char *out, const unsigned char *in, int length) {
+#if defined(BASE64_VECTOR)
+  for (; length >= vectorLength; length -= vectorLength) {
+    Vec v = vload(in);
+    if (vhasHighBit(v)) {
+      break;
+    }
+    Vec lower = vgt(v, 'a' - 1);
+    Vec upper = vandnot(lower, vgt(v, 'A' - 1));
+    Vec sign = vor(veq(v, ','), veq(v, '-'));
+    Vec digit = vand(vgt(v, '0' - 1), vlt(v, '9' + 1));
+    // the other characters map to ' ' - '0' like in Ascii2B64Table
+    Vec other = vandnot(vor(vor(lower, upper), vor(sign, digit)),
+                        vsplat(' ' - '0'));
+    Vec r = vor(vor(vand(lower, vsub(v, vsplat('a' - 38))),
+                    vand(upper, vsub(v, vsplat('A' - 12)))),
+                vor(vor(vand(sign, vsub(v, vsplat(','))),
+                        vand(digit, vsub(v, vsplat('0' - 2)))),
+                    other));
+    vstore(out, r);
+    in += vectorLength;
+    out += vectorLength;
+  }
+#endif
   while ((length--) != 0) {
     unsigned char ch = *in++;
     if (ch >= 'A') {
@@ -161,7 +303,18 @@ void AsciiToB64(unsigned char *out, const unsigned char *in, int length) {
 }
 
 void B32ToAscii(unsigned char *buf, int len) {
-  for (int offset = 0; offset < len; ++offset) {
+  int offset = 0;
+#if defined(BASE64_VECTOR)
+  for (; offset + vectorLength <= len; offset += vectorLength) {
+    Vec v = vload(buf + offset);
+    if (vhasHighBit(v)) {
+      break;
+    }
+    Vec add = vsub(vsplat('A'), vand(vgt(v, 25), vsplat('A' - '2' + 26)));
+    vstore(buf + offset, vadd(v, add));
+  }
+#endif
+  for (; offset < len; ++offset) {
     int ch = buf[offset];
     if (ch >= 0 && ch < 26) {
       ch += 'A';
@@ -178,6 +331,22 @@ void AsciiToB32(unsigned char *in, int length) {
 }
 
 void AsciiToB32(unsigned char *out, const unsigned char *in, int length) {
+#if defined(BASE64_VECTOR)
+  // toupper() only changes 'a' to 'z' below 128, in all locales
+  for (; length >= vectorLength; length -= vectorLength) {
+    Vec v = vload(in);
+    if (vhasHighBit(v)) {
+      break;
+    }
+    Vec lower = vand(vgt(v, 'a' - 1), vlt(v, 'z' + 1));
+    Vec u = vsub(v, vand(lower, vsplat('a' - 'A')));
+    Vec sub = vsub(vsplat('2' - 26), vand(vgt(u, 'A' - 1),
+                                          vsplat('2' - 26 - 'A')));
+    vstore(out, vsub(u, sub));
+    in += vectorLength;
+    out += vectorLength;
+  }
+#endif
   while ((length--) != 0) {
     unsigned char ch = *in++;
     int lch = toupper(ch);
@@ -190,6 +359,126 @@ void AsciiToB32(unsigned char *out, const unsigned char *in, int length) {
   }
 }
 
+/*
+    Base32 names are converted 5 bytes (8 values) at a time, directly
+    between the bytes and the ASCII alphabet, with the same results as the
+    two steps of changeBase2Inline and B32ToAscii resp. AsciiToB32.
+*/
+static const char B32AsciiTable[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+
+// AsciiToB32 of all bytes, as toupper() behaves in the "C" locale
+static const unsigned char Ascii2B32Table[256] = {
+    232, 233, 234, 235, 236, 237, 238, 239, 240, 241, 242, 243,
+    244, 245, 246, 247, 248, 249, 250, 251, 252, 253, 254, 255,
+      0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,
+     12,  13,  14,  15,  16,  17,  18,  19,  20,  21,  22,  23,
+     24,  25,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,
+     36,  37,  38,  39,  40,   0,   1,   2,   3,   4,   5,   6,
+      7,   8,   9,  10,  11,  12,  13,  14,  15,  16,  17,  18,
+     19,  20,  21,  22,  23,  24,  25,  26,  27,  28,  29,  30,
+     31,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,
+     11,  12,  13,  14,  15,  16,  17,  18,  19,  20,  21,  22,
+     23,  24,  25,  58,  59,  60,  61,  62,  63,  64,  65,  66,
+     67,  68,  69,  70,  71,  72,  73,  74,  75,  76,  77,  78,
+     79,  80,  81,  82,  83,  84,  85,  86,  87,  88,  89,  90,
+     91,  92,  93,  94,  95,  96,  97,  98,  99, 100, 101, 102,
+    103, 104, 105, 106, 107, 108, 109, 110, 111, 112, 113, 114,
+    115, 116, 117, 118, 119, 120, 121, 122, 123, 124, 125, 126,
+    127, 128, 129, 130, 131, 132, 133, 134, 135, 136, 137, 138,
+    139, 140, 141, 142, 143, 144, 145, 146, 147, 148, 149, 150,
+    151, 152, 153, 154, 155, 156, 157, 158, 159, 160, 161, 162,
+    163, 164, 165, 166, 167, 168, 169, 170, 171, 172, 173, 174,
+    175, 176, 177, 178, 179, 180, 181, 182, 183, 184, 185, 186,
+    187, 188, 189, 190,
+};
+
+int B256ToB32Ascii(unsigned char *buf, int length) {
+  int groups = length / 5;
+  int rest = length % 5;
+  int outLen = B256ToB32Bytes(length);
+
+  // the output is longer than the input, so start at the end.  The last
+  // partial group is read completely before its output is written.
+  if (rest != 0) {
+    uint64_t work = 0;
+    for (int i = 0; i < rest; ++i) {
+      work |= (uint64_t)buf[groups * 5 + i] << (i * 8);
+    }
+    for (int i = groups * 8; i < outLen; ++i) {
+      buf[i] = B32AsciiTable[work & 31];
+      work >>= 5;
+    }
+  }
+  for (int g = groups - 1; g >= 0; --g) {
+    const unsigned char *in = buf + g * 5;
+    uint64_t work = (uint64_t)in[0] | ((uint64_t)in[1] << 8) |
+                    ((uint64_t)in[2] << 16) | ((uint64_t)in[3] << 24) |
+                    ((uint64_t)in[4] << 32);
+    unsigned char *out = buf + g * 8;
+    for (int i = 0; i < 8; ++i) {
+      out[i] = B32AsciiTable[work & 31];
+      work >>= 5;
+    }
+  }
+
+  return outLen;
+}
+
+int B32AsciiToB256(unsigned char *out, const unsigned char *in, int length) {
+  int outLen = B32ToB256Bytes(length);
+  unsigned char *start = out;
+
+  // the values of invalid characters have more than 5 bits.  As in
+  // changeBase2Inline, the excess bits are carried into the next group.
+  uint64_t carry = 0;
+  for (; length >= 8; length -= 8) {
+    uint64_t work = carry;
+    for (int i = 0; i < 8; ++i) {
+      work |= (uint64_t)Ascii2B32Table[in[i]] << (i * 5);
+    }
+    in += 8;
+    for (int i = 0; i < 5; ++i) {
+      *out++ = work & 0xff;
+      work >>= 8;
+    }
+    carry = work;
+  }
+
+  // the last partial group, bits which don't fill a byte are dropped
+  uint64_t work = carry;
+  for (int i = 0; i < length; ++i) {
+    work |= (uint64_t)Ascii2B32Table[in[i]] << (i * 5);
+  }
+  while (out - start < outLen) {
+    *out++ = work & 0xff;
+    work >>= 8;
+  }
+
+  return outLen;
+}
+
+bool IsB64Ascii(const unsigned char *in, int length) {
+  for (int i = 0; i < length; ++i) {
+    unsigned char ch = in[i];
+    if (!((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+          (ch >= '0' && ch <= '9') || ch == ',' || ch == '-')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool IsB32Ascii(const unsigned char *in, int length) {
+  for (int i = 0; i < length; ++i) {
+    unsigned char ch = in[i];
+    if (!((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+          (ch >= '2' && ch <= '7'))) {
+      return false;
+    }
+  }
+  return true;
+}
+
 #define WHITESPACE 64
 #define EQUALS 65
 #define INVALID 66
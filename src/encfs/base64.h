@@ -67,6 +67,20 @@ void AsciiToB64(unsigned char *out, const unsigned char *in, int length);
 void AsciiToB32(unsigned char *buf, int length);
 void AsciiToB32(unsigned char *out, const unsigned char *in, int length);
 
+// inplace conversion of length bytes to base32 ASCII, the same as
+// changeBase2Inline(buf, length, 8, 5, true) followed by B32ToAscii().
+// Returns the length of the output, B256ToB32Bytes(length).
+int B256ToB32Ascii(unsigned char *buf, int length);
+// conversion of base32 ASCII to B32ToB256Bytes(length) bytes, the same as
+// AsciiToB32() followed by changeBase2Inline(out, length, 5, 8, false).
+// out may be the same as in.
+int B32AsciiToB256(unsigned char *out, const unsigned char *in, int length);
+
+// true if all characters are part of the base64 / base32 ASCII alphabet
+// used for names.  The base32 alphabet is checked case-insensitively.
+bool IsB64Ascii(const unsigned char *in, int length);
+bool IsB32Ascii(const unsigned char *in, int length);
+
 // Decode standard B64 into the output array.
 // Used only to decode legacy Boost XML serialized config format.
 // The output size must be at least B64ToB256Bytes(inputLen).
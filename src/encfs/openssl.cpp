@@ -30,7 +30,22 @@
 #endif
 
 #include <cstdlib>
+#include <map>
 #include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+#include <openssl/provider.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
 
 #include <boost/thread.hpp>
 
@@ -85,6 +100,120 @@ void pthreads_locking_cleanup() {
   }
 }
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+#define HAVE_EVP_FETCH
+#endif
+
+#ifdef HAVE_EVP_FETCH
+// fetched objects by the built-in ones they stand for, nullptr if the
+// providers don't have them
+static boost::mutex fetchMutex;
+static std::map<const EVP_CIPHER *, EVP_CIPHER *> fetchedCiphers;
+static std::map<const EVP_MD *, EVP_MD *> fetchedDigests;
+#endif
+
+const EVP_CIPHER *openssl_cipher(const EVP_CIPHER *cipher) {
+#ifdef HAVE_EVP_FETCH
+  if (cipher == nullptr) {
+    return nullptr;
+  }
+  boost::mutex::scoped_lock lock(fetchMutex);
+  auto it = fetchedCiphers.find(cipher);
+  if (it == fetchedCiphers.end()) {
+    // Blowfish is only in the legacy provider, which isn't loaded
+    EVP_CIPHER *fetched =
+        EVP_CIPHER_fetch(nullptr, EVP_CIPHER_get0_name(cipher), nullptr);
+    if (fetched == nullptr) {
+      VLOG(1) << "no provider for " << EVP_CIPHER_get0_name(cipher);
+      ERR_clear_error();
+    }
+    it = fetchedCiphers.insert(std::make_pair(cipher, fetched)).first;
+  }
+  return (it->second != nullptr) ? it->second : cipher;
+#else
+  return cipher;
+#endif
+}
+
+const EVP_MD *openssl_digest(const EVP_MD *md) {
+#ifdef HAVE_EVP_FETCH
+  if (md == nullptr) {
+    return nullptr;
+  }
+  boost::mutex::scoped_lock lock(fetchMutex);
+  auto it = fetchedDigests.find(md);
+  if (it == fetchedDigests.end()) {
+    EVP_MD *fetched = EVP_MD_fetch(nullptr, EVP_MD_get0_name(md), nullptr);
+    if (fetched == nullptr) {
+      VLOG(1) << "no provider for " << EVP_MD_get0_name(md);
+      ERR_clear_error();
+    }
+    it = fetchedDigests.insert(std::make_pair(md, fetched)).first;
+  }
+  return (it->second != nullptr) ? it->second : md;
+#else
+  return md;
+#endif
+}
+
+/**
+ * OpenSSL picks its AES code by the CPU features: AES-NI, or the vector
+ * permutation code (VPAES) with SSSE3, or the generic tables.  On ARM the
+ * crypto extensions take the place of AES-NI.
+ */
+static std::string aesImplementation() {
+#if (defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))) || \
+    defined(__i386__) || defined(__x86_64__)
+  unsigned int ecx = 0;
+#if defined(_MSC_VER)
+  int regs[4];
+  __cpuid(regs, 1);
+  ecx = (unsigned int)regs[2];
+#else
+  unsigned int eax, ebx, edx;
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) {
+    ecx = 0;
+  }
+#endif
+  std::string impl;
+  if ((ecx & (1u << 25)) != 0) {
+    impl = "AES-NI";
+  } else if ((ecx & (1u << 9)) != 0) {
+    impl = "VPAES (SSSE3)";
+  } else {
+    impl = "generic";
+  }
+  if (getenv("OPENSSL_ia32cap") != nullptr) {
+    impl += ", unless masked by OPENSSL_ia32cap";
+  }
+  return impl;
+#elif defined(__aarch64__) && defined(__linux__)
+  return ((getauxval(AT_HWCAP) & HWCAP_AES) != 0) ? "ARMv8 crypto extensions"
+                                                  : "VPAES (NEON)";
+#elif defined(__aarch64__) && defined(__APPLE__)
+  return "ARMv8 crypto extensions";
+#else
+  return "unknown";
+#endif
+}
+
+std::string openssl_report() {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  std::string report = OpenSSL_version(OPENSSL_VERSION);
+#else
+  std::string report = SSLeay_version(SSLEAY_VERSION);
+#endif
+  report += ", AES: " + aesImplementation();
+#ifdef HAVE_EVP_FETCH
+  const EVP_CIPHER *aes = openssl_cipher(EVP_aes_256_cbc());
+  if (EVP_CIPHER_get0_provider(aes) != nullptr) {
+    report += ", provider: ";
+    report += OSSL_PROVIDER_get0_name(EVP_CIPHER_get0_provider(aes));
+  }
+#endif
+  return report;
+}
+
 void openssl_init(bool threaded) {
   // initialize the SSL library
   SSL_load_error_strings();
@@ -107,6 +236,17 @@ void openssl_init(bool threaded) {
     CRYPTO_set_id_callback(threads_thread_id);
     CRYPTO_set_locking_callback(threads_locking_callback);
   }
+
+  // fetch the algorithms of the volumes once, instead of on every key
+#ifndef OPENSSL_NO_AES
+  static const EVP_CIPHER *(*const ciphers[])() = {
+      EVP_aes_128_cbc, EVP_aes_192_cbc, EVP_aes_256_cbc, EVP_aes_128_cfb,
+      EVP_aes_192_cfb, EVP_aes_256_cfb, EVP_aes_128_xts, EVP_aes_256_xts};
+  for (auto cipher : ciphers) {
+    openssl_cipher(cipher());
+  }
+#endif
+  openssl_digest(EVP_sha1());
 }
 
 void openssl_shutdown(bool threaded) {
@@ -117,6 +257,18 @@ void openssl_shutdown(bool threaded) {
   if (threaded) {
     pthreads_locking_cleanup();
   }
+
+#ifdef HAVE_EVP_FETCH
+  boost::mutex::scoped_lock lock(fetchMutex);
+  for (auto &entry : fetchedCiphers) {
+    EVP_CIPHER_free(entry.second);
+  }
+  fetchedCiphers.clear();
+  for (auto &entry : fetchedDigests) {
+    EVP_MD_free(entry.second);
+  }
+  fetchedDigests.clear();
+#endif
 }
 
 }  // namespace encfs
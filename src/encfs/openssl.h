@@ -21,11 +21,26 @@
 #ifndef _openssl_incl_
 #define _openssl_incl_
 
+#include <string>
+
+#include <openssl/ossl_typ.h>
+
 namespace encfs {
 
 void openssl_init(bool isThreaded);
 void openssl_shutdown(bool isThreaded);
 
+// the cipher or digest of the same algorithm, fetched from the providers
+// once with OpenSSL 3, so that initializing a context with it doesn't look
+// up the implementation again.  Returned unchanged by older versions, or
+// if the providers don't have it.
+const EVP_CIPHER *openssl_cipher(const EVP_CIPHER *cipher);
+const EVP_MD *openssl_digest(const EVP_MD *md);
+
+// the version of OpenSSL and the implementation of AES it selects for
+// this CPU, for the log
+std::string openssl_report();
+
 }  // namespace encfs
 
 #endif
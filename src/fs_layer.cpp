@@ -25,6 +25,7 @@
 #include "fs_layer.h"
 #include "efs_config.h"
 #include "FileStatCache.h"
+#include "UTFConvert.h"
 
 #include <errno.h>
 #include <stdio.h>
@@ -42,19 +43,33 @@
 #include <utime.h>
 #endif
 
+#include <algorithm>
 #include <time.h>
 #include <stdarg.h>
 #include <cctype> 
 #include <clocale>
+#include <locale>
+
+#include <unordered_map>
 
 #include <boost/scoped_array.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
-#include <boost/locale.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/replace.hpp>
 
 #if defined(_WIN32)
 #include <share.h>
+#include <winioctl.h>
+#include <winternl.h>
+#else
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+#if defined(__linux__)
+#include <sys/vfs.h>
+#else
+#include <sys/param.h>
+#include <sys/mount.h>
+#endif
 #endif
 
 /**
@@ -62,7 +77,9 @@
  */
 static std::string wchar_to_utf8_cstr(const wchar_t *str)
 {
-	return boost::locale::conv::utf_to_utf<char>(str);
+	std::string res;
+	UTFConvert::toUTF8(str, wcslen(str), res);
+	return res;
 }
 
 /**
@@ -70,16 +87,10 @@ static std::string wchar_to_utf8_cstr(const wchar_t *str)
  */
 static void utf8_to_wchar_buf(const char *src, wchar_t *res, int maxlen)
 {
-	std::wstring conv = boost::locale::conv::utf_to_utf<wchar_t>(src);
-
-#if defined(_MSC_VER)
-	wcscpy_s(res, maxlen, conv.c_str());
-#else
-	if(conv.size() < maxlen)
-		std::wcscpy(res, conv.c_str());
-	else
+	if(maxlen <= 0)
+		return;
+	if(UTFConvert::toWide(src, strlen(src), res, maxlen - 1) < 0)
 		*res = L'\0';
-#endif
 }
 
 /**
@@ -87,7 +98,9 @@ static void utf8_to_wchar_buf(const char *src, wchar_t *res, int maxlen)
  */
 static std::wstring utf8_to_wchar(const char *src)
 {
-	return boost::locale::conv::utf_to_utf<wchar_t>(src);
+	std::wstring res;
+	UTFConvert::toWide(src, strlen(src), res);
+	return res;
 }
 
 /**
@@ -142,6 +155,80 @@ boost::filesystem::path fs_layer::stringToFSPath(const std::string &str)
 	return p;
 }
 
+#if defined(_WIN32)
+// Long enough for almost all backing paths, longer ones are converted on the heap
+static const int stackPathLength = 1024;
+
+/**
+ * UTF-16 version of a UTF-8 string, converted into a buffer on the stack.
+ *
+ * With extendedLength, the string is converted to an extended-length path,
+ * the same way as utf8_to_wfn(). Used by the functions called per file, where
+ * the heap allocations of utf8_to_wfn() and boost::filesystem::path show.
+ */
+class WideString
+{
+public:
+	WideString(const char *src, bool extendedLength);
+
+	const wchar_t *c_str() const { return heapStr_.empty() ? buf_ : heapStr_.c_str(); }
+	size_t length() const { return heapStr_.empty() ? length_ : heapStr_.length(); }
+
+private:
+	WideString(const WideString &);					// not allowed
+	WideString &operator=(const WideString &);		// not allowed
+
+	wchar_t buf_[stackPathLength];
+	size_t length_;
+	std::wstring heapStr_;
+};
+
+WideString::WideString(const char *src, bool extendedLength) :
+	length_(0)
+{
+	buf_[0] = L'\0';
+
+	// The prefixes only depend on the first (ASCII) characters, see utf8_to_wfn()
+	const wchar_t *prefix = L"";
+	const char *s = src;
+	if(extendedLength && s[0] != '\0' && s[1] != '\0' && s[2] != '\0')
+	{
+		bool isSep0 = (s[0] == '/' || s[0] == '\\');
+		bool isSep1 = (s[1] == '/' || s[1] == '\\');
+		if(((s[0] >= 'A' && s[0] <= 'Z') || (s[0] >= 'a' && s[0] <= 'z')) && s[1] == ':')
+		{
+			prefix = L"\\\\?\\";
+		}
+		else if(isSep0 && isSep1)
+		{
+			prefix = L"\\\\?\\UNC";
+			s++;
+		}
+	}
+	size_t prefixLength = wcslen(prefix);
+	wmemcpy(buf_, prefix, prefixLength);
+
+	ptrdiff_t len = UTFConvert::toWide(s, strlen(s), buf_ + prefixLength,
+		stackPathLength - prefixLength - 1);
+	if(len < 0)
+	{
+		// Too long for the buffer
+		heapStr_ = extendedLength ? utf8_to_wfn(src) : utf8_to_wchar(src);
+		return;
+	}
+
+	length_ = prefixLength + len;
+	if(extendedLength)
+	{
+		for(size_t i = prefixLength; i < length_; i++)
+		{
+			if(buf_[i] == L'/')
+				buf_[i] = L'\\';
+		}
+	}
+}
+#endif
+
 std::string fs_layer::readFileToString(const char *fn)
 {
 	efs_stat stbuf;
@@ -231,14 +318,63 @@ int fs_layer::fdatasync(int fd)
 #endif
 }
 
+#if defined(_WIN32)
+/**
+ * Reads or writes at a file position with one ReadFile / WriteFile call per
+ * GiB, the offset is passed in an OVERLAPPED. Unlike seeking and reading
+ * through the CRT, this is safe when threads share a descriptor. The file
+ * pointer moves, but only positional I/O is done on the descriptors.
+ */
+static int64_t positional_io(int fd, void *buf, int64_t count, int64_t offset, bool write)
+{
+	HANDLE h = (HANDLE)_get_osfhandle(fd);
+	if(h == INVALID_HANDLE_VALUE)
+	{
+		errno = EBADF;
+		return -1;
+	}
+
+	const int64_t maxChunk = 1 << 30;
+	unsigned char *pos = static_cast<unsigned char *>(buf);
+	int64_t total = 0;
+	while(total < count)
+	{
+		int64_t chunkOffset = offset + total;
+		OVERLAPPED ov;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = static_cast<DWORD>(chunkOffset & 0xffffffff);
+		ov.OffsetHigh = static_cast<DWORD>(chunkOffset >> 32);
+		DWORD chunk = static_cast<DWORD>((count - total < maxChunk) ? count - total : maxChunk);
+		DWORD done = 0;
+		BOOL ok = write ? WriteFile(h, pos + total, chunk, &done, &ov)
+			: ReadFile(h, pos + total, chunk, &done, &ov);
+		if(!ok)
+		{
+			DWORD err = GetLastError();
+			if(!write && err == ERROR_HANDLE_EOF)
+				break;
+			if(total > 0)
+				break;
+			if(err == ERROR_DISK_FULL || err == ERROR_HANDLE_DISK_FULL)
+				errno = ENOSPC;
+			else if(err == ERROR_ACCESS_DENIED || err == ERROR_LOCK_VIOLATION)
+				errno = EACCES;
+			else
+				errno = EIO;
+			return -1;
+		}
+		total += done;
+		if(done < chunk)
+			break;
+	}
+	return total;
+}
+#endif
+
 int64_t fs_layer::pread(int fd, void *buf, int64_t count, int64_t offset)
 {
 #if defined(_WIN32)
-	int64_t oldpos = _telli64(fd);
-	_lseeki64(fd, offset, SEEK_SET);
-	int ret = _read(fd, buf, count);
-	_lseeki64(fd, oldpos, SEEK_SET);
-	return ret;
+	return positional_io(fd, buf, count, offset, false);
 #else
 	return ::pread(fd, buf, count, offset);
 #endif
@@ -247,16 +383,52 @@ int64_t fs_layer::pread(int fd, void *buf, int64_t count, int64_t offset)
 int64_t fs_layer::pwrite(int fd, const void *buf, int64_t count, int64_t offset)
 {
 #if defined(_WIN32)
-	int64_t oldpos = _telli64(fd);
-	_lseeki64(fd, offset, SEEK_SET);
-	int ret = _write(fd, buf, count);
-	_lseeki64(fd, oldpos, SEEK_SET);
-	return ret;
+	return positional_io(fd, const_cast<void *>(buf), count, offset, true);
 #else
 	return ::pwrite(fd, buf, count, offset);
 #endif
 }
 
+int64_t fs_layer::preadv(int fd, const fs_iovec *iov, int iovcnt, int64_t offset)
+{
+#if defined(HAVE_PREADV)
+	return ::preadv(fd, iov, iovcnt, offset);
+#else
+	// Windows only has ReadFileScatter for unbuffered, overlapped handles
+	// with page sized buffers, so read the buffers one by one
+	int64_t total = 0;
+	for(int i = 0; i < iovcnt; i++)
+	{
+		int64_t ret = pread(fd, iov[i].iov_base, iov[i].iov_len, offset + total);
+		if(ret < 0)
+			return (total > 0) ? total : ret;
+		total += ret;
+		if(ret < static_cast<int64_t>(iov[i].iov_len))
+			break;
+	}
+	return total;
+#endif
+}
+
+int64_t fs_layer::pwritev(int fd, const fs_iovec *iov, int iovcnt, int64_t offset)
+{
+#if defined(HAVE_PREADV)
+	return ::pwritev(fd, iov, iovcnt, offset);
+#else
+	int64_t total = 0;
+	for(int i = 0; i < iovcnt; i++)
+	{
+		int64_t ret = pwrite(fd, iov[i].iov_base, iov[i].iov_len, offset + total);
+		if(ret < 0)
+			return (total > 0) ? total : ret;
+		total += ret;
+		if(ret < static_cast<int64_t>(iov[i].iov_len))
+			break;
+	}
+	return total;
+#endif
+}
+
 int fs_layer::read(int fd, void *buf, unsigned int count)
 {
 #if defined(_WIN32)
@@ -310,6 +482,323 @@ int fs_layer::ftruncate(int fd, int64_t length)
 #endif
 }
 
+/**
+ * Mark the file as sparse, so that ranges which are never written don't take
+ * up space and don't have to be zero-filled by the file system.
+ * POSIX file systems do this for every file.
+ */
+int fs_layer::set_sparse(int fd)
+{
+#if defined(_WIN32)
+	HANDLE h = (HANDLE)_get_osfhandle(fd);
+	if(h == INVALID_HANDLE_VALUE)
+	{
+		errno = EBADF;
+		return -1;
+	}
+	DWORD bytesReturned = 0;
+	if(!DeviceIoControl(h, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytesReturned, NULL))
+	{
+		// e.g. FAT file systems
+		errno = (GetLastError() == ERROR_INVALID_FUNCTION) ? ENOTSUP : EIO;
+		return -1;
+	}
+	return 0;
+#else
+	(void)fd;
+	return 0;
+#endif
+}
+
+#if defined(_WIN32)
+// SetFileInformationByHandle exists from Vista on, and is only declared for
+// _WIN32_WINNT >= 0x0600
+typedef BOOL (WINAPI *SetFileInformationByHandleFn)(HANDLE, int, LPVOID, DWORD);
+static const int fileAllocationInfoClass = 5;		// FileAllocationInfo
+#endif
+
+/**
+ * Reserve the space for a file of length bytes without changing its size.
+ * length must not be smaller than the size of the file, Windows would
+ * truncate it. Fails with ENOTSUP if the system can't do this.
+ */
+int fs_layer::preallocate(int fd, int64_t length)
+{
+#if defined(_WIN32)
+	static SetFileInformationByHandleFn setFileInformationByHandle =
+		(SetFileInformationByHandleFn)GetProcAddress(GetModuleHandleW(L"kernel32.dll"),
+			"SetFileInformationByHandle");
+	if(setFileInformationByHandle == NULL)
+	{
+		errno = ENOTSUP;
+		return -1;
+	}
+	HANDLE h = (HANDLE)_get_osfhandle(fd);
+	if(h == INVALID_HANDLE_VALUE)
+	{
+		errno = EBADF;
+		return -1;
+	}
+	LARGE_INTEGER allocationSize;
+	allocationSize.QuadPart = length;
+	if(!setFileInformationByHandle(h, fileAllocationInfoClass, &allocationSize, sizeof(allocationSize)))
+	{
+		errno = (GetLastError() == ERROR_DISK_FULL) ? ENOSPC : ENOTSUP;
+		return -1;
+	}
+	return 0;
+#elif defined(__linux__)
+	if(::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, length) != 0)
+	{
+		if(errno == EOPNOTSUPP)
+			errno = ENOTSUP;
+		return -1;
+	}
+	return 0;
+#else
+	(void)fd;
+	(void)length;
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+/**
+ * Find the first allocated range of the file at or after offset.
+ * [offset, *begin) is a hole, [*begin, *end) may contain data. If there is no
+ * data after offset, *begin and *end are set to fileSize.
+ * Fails with ENOTSUP if the file system doesn't report holes.
+ */
+int fs_layer::find_data(int fd, int64_t offset, int64_t fileSize, int64_t *begin, int64_t *end)
+{
+	if(offset >= fileSize)
+	{
+		*begin = *end = fileSize;
+		return 0;
+	}
+#if defined(_WIN32)
+	HANDLE h = (HANDLE)_get_osfhandle(fd);
+	if(h == INVALID_HANDLE_VALUE)
+	{
+		errno = EBADF;
+		return -1;
+	}
+	FILE_ALLOCATED_RANGE_BUFFER query, range;
+	query.FileOffset.QuadPart = offset;
+	query.Length.QuadPart = fileSize - offset;
+	DWORD bytesReturned = 0;
+	// Only the first range is needed, ERROR_MORE_DATA just says there are more
+	if(!DeviceIoControl(h, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query),
+		&range, sizeof(range), &bytesReturned, NULL) && GetLastError() != ERROR_MORE_DATA)
+	{
+		errno = (GetLastError() == ERROR_INVALID_FUNCTION) ? ENOTSUP : EIO;
+		return -1;
+	}
+	if(bytesReturned < sizeof(range))
+	{
+		*begin = *end = fileSize;
+		return 0;
+	}
+	*begin = (range.FileOffset.QuadPart > offset) ? range.FileOffset.QuadPart : offset;
+	*end = range.FileOffset.QuadPart + range.Length.QuadPart;
+	return 0;
+#elif defined(SEEK_DATA) && defined(SEEK_HOLE)
+	// Only pread / pwrite are used, so moving the file position is harmless
+	off_t dataPos = ::lseek(fd, offset, SEEK_DATA);
+	if(dataPos == -1)
+	{
+		if(errno != ENXIO)
+			return -1;
+		*begin = *end = fileSize;
+		return 0;
+	}
+	off_t holePos = ::lseek(fd, dataPos, SEEK_HOLE);
+	if(holePos == -1)
+		return -1;
+	*begin = dataPos;
+	*end = holePos;
+	return 0;
+#else
+	(void)fd;
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+/**
+ * Map length bytes of the file at offset for reading. mapHandle receives the
+ * handle which has to be passed to unmap_view().
+ * Returns NULL and sets errno in case of failure.
+ */
+void *fs_layer::map_view(int fd, int64_t offset, size_t length, void **mapHandle)
+{
+#if defined(_WIN32)
+	HANDLE h = (HANDLE)_get_osfhandle(fd);
+	if(h == INVALID_HANDLE_VALUE)
+	{
+		errno = EBADF;
+		return NULL;
+	}
+	HANDLE hMap = CreateFileMappingW(h, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(hMap == NULL)
+	{
+		errno = EIO;
+		return NULL;
+	}
+	void *addr = MapViewOfFile(hMap, FILE_MAP_READ, static_cast<DWORD>(offset >> 32),
+		static_cast<DWORD>(offset & 0xffffffff), length);
+	if(addr == NULL)
+	{
+		CloseHandle(hMap);
+		errno = ENOMEM;
+		return NULL;
+	}
+	*mapHandle = hMap;
+	return addr;
+#else
+	void *addr = ::mmap(NULL, length, PROT_READ, MAP_SHARED, fd, offset);
+	if(addr == MAP_FAILED)
+		return NULL;
+	*mapHandle = NULL;
+	return addr;
+#endif
+}
+
+void fs_layer::unmap_view(void *addr, size_t length, void *mapHandle)
+{
+#if defined(_WIN32)
+	(void)length;
+	UnmapViewOfFile(addr);
+	CloseHandle((HANDLE)mapHandle);
+#else
+	(void)mapHandle;
+	::munmap(addr, length);
+#endif
+}
+
+/**
+ * Whether path is on a local file system. Mapped views of files on network
+ * shares fail with an exception or signal when the connection breaks, so
+ * they are only used for local files.
+ */
+bool fs_layer::is_local_path(const char *path)
+{
+#if defined(_WIN32)
+	std::wstring p = stringToFSPath(path).wstring();
+	if(boost::starts_with(p, L"\\\\?\\UNC\\"))
+		return false;
+	if(boost::starts_with(p, L"\\\\?\\"))
+		p = p.substr(4);
+	if(p.size() < 2 || p[1] != L':')
+		return false;		// \\server\share or relative path
+	std::wstring root = p.substr(0, 2) + L"\\";
+	UINT driveType = GetDriveTypeW(root.c_str());
+	return (driveType != DRIVE_REMOTE && driveType != DRIVE_NO_ROOT_DIR && driveType != DRIVE_UNKNOWN);
+#elif defined(__linux__)
+	struct statfs fs;
+	if(::statfs(path, &fs) != 0)
+		return false;
+	switch(static_cast<unsigned long>(fs.f_type))
+	{
+	case 0x6969UL:			// NFS
+	case 0x517BUL:			// SMB
+	case 0xFF534D42UL:		// CIFS
+	case 0xFE534D42UL:		// SMB2
+	case 0x65735546UL:		// FUSE, e.g. sshfs
+	case 0x01021997UL:		// 9P
+	case 0x00C36400UL:		// Ceph
+	case 0x5346414FUL:		// AFS
+		return false;
+	default:
+		return true;
+	}
+#elif defined(MNT_LOCAL)
+	struct statfs fs;
+	if(::statfs(path, &fs) != 0)
+		return false;
+	return (fs.f_flags & MNT_LOCAL) != 0;
+#else
+	(void)path;
+	return false;
+#endif
+}
+
+/**
+ * Tell the system that the range [offset, offset + length) won't be accessed
+ * again soon, so that its pages don't push other data out of the cache.
+ * If written is set, the range is written back first. Windows has no such
+ * hint, see open_unbuffered() instead.
+ */
+int fs_layer::drop_cache(int fd, int64_t offset, int64_t length, bool written)
+{
+#if defined(__linux__)
+	if(written && ::sync_file_range(fd, offset, length, SYNC_FILE_RANGE_WAIT_BEFORE
+		| SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) != 0)
+		return -1;
+	int res = ::posix_fadvise(fd, offset, length, POSIX_FADV_DONTNEED);
+	if(res != 0)
+	{
+		errno = res;
+		return -1;
+	}
+	return 0;
+#elif defined(F_NOCACHE)
+	// Applies to the whole descriptor, the range is ignored
+	(void)offset;
+	(void)length;
+	(void)written;
+	return (::fcntl(fd, F_NOCACHE, 1) == -1) ? -1 : 0;
+#else
+	(void)fd;
+	(void)offset;
+	(void)length;
+	(void)written;
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+/**
+ * Open fn for reading without the system cache (FILE_FLAG_NO_BUFFERING).
+ * Only supported on Windows, fails with ENOTSUP elsewhere.
+ */
+int fs_layer::open_unbuffered(const char *fn)
+{
+#if defined(_WIN32)
+	WideString fn_path(fn, true);
+	HANDLE h = CreateFileW(fn_path.c_str(), GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(h == INVALID_HANDLE_VALUE)
+	{
+		DWORD err = GetLastError();
+		errno = (err == ERROR_FILE_NOT_FOUND || err == ERROR_PATH_NOT_FOUND) ? ENOENT : EACCES;
+		return -1;
+	}
+	int fd = _open_osfhandle(reinterpret_cast<intptr_t>(h), _O_RDONLY | _O_BINARY);
+	if(fd < 0)
+	{
+		CloseHandle(h);
+		errno = EMFILE;
+	}
+	return fd;
+#else
+	(void)fn;
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+int64_t fs_layer::pread_unbuffered(int fd, void *buf, int64_t count, int64_t offset)
+{
+#if defined(_WIN32)
+	// The chunks of positional_io() keep the alignment
+	return positional_io(fd, buf, count, offset, false);
+#else
+	return ::pread(fd, buf, count, offset);
+#endif
+}
+
 int fs_layer::truncate(const char *path, int64_t length)
 {
 	boost::filesystem::path p(stringToFSPath(path));
@@ -378,33 +867,59 @@ int fs_layer::futimes(int fd, const struct fs_layer::timeval_fs times[2])
 #endif
 }
 
-int fs_layer::statvfs(const char *path, struct statvfs *fs)
+int fs_layer::statvfs(const char *path, struct fs_layer::statvfs_fs *buf)
 {
+	memset(buf, 0, sizeof(*buf));
 #if defined(_WIN32)
-	boost::filesystem::path p(utf8_to_wfn(path));
+	WideString p(path, true);
+	ULARGE_INTEGER freeToCaller, total, totalFree;
+	if(!GetDiskFreeSpaceExW(p.c_str(), &freeToCaller, &total, &totalFree))
+	{
+		DWORD err = GetLastError();
+		errno = (err == ERROR_FILE_NOT_FOUND || err == ERROR_PATH_NOT_FOUND) ? ENOENT : EACCES;
+		return -1;
+	}
+
+	// The cluster size and the name length are properties of the volume
+	uint64_t clusterSize = 4096;
+	DWORD maxComponentLength = 255;
+	wchar_t volume[MAX_PATH + 1];
+	if(GetVolumePathNameW(p.c_str(), volume, MAX_PATH + 1))
+	{
+		DWORD sectorsPerCluster = 0, bytesPerSector = 0, freeClusters = 0, totalClusters = 0;
+		if(GetDiskFreeSpaceW(volume, &sectorsPerCluster, &bytesPerSector, &freeClusters, &totalClusters)
+			&& sectorsPerCluster * bytesPerSector > 0)
+		{
+			clusterSize = static_cast<uint64_t>(sectorsPerCluster) * bytesPerSector;
+		}
+		if(!GetVolumeInformationW(volume, NULL, 0, NULL, &maxComponentLength, NULL, NULL, 0))
+			maxComponentLength = 255;
+	}
+
+	buf->f_bsize = clusterSize;
+	buf->f_frsize = clusterSize;
+	buf->f_blocks = total.QuadPart / clusterSize;
+	buf->f_bfree = totalFree.QuadPart / clusterSize;
+	buf->f_bavail = freeToCaller.QuadPart / clusterSize;
+	buf->f_namemax = maxComponentLength;
+	return 0;
 #else
-	boost::filesystem::path p(path);
-#endif
+	struct ::statvfs st;
+	if(::statvfs(path, &st) != 0)
+		return -1;
 
-	boost::system::error_code ec;
-	boost::filesystem::space_info spaceInfo = boost::filesystem::space(p, ec);
-
-	assert(false);		// TODO: Implement
-/*
-unsigned long f_bsize    File system block size. 
-unsigned long f_frsize   Fundamental file system block size. 
-fsblkcnt_t    f_blocks   Total number of blocks on file system in units of f_frsize. 
-fsblkcnt_t    f_bfree    Total number of free blocks. 
-fsblkcnt_t    f_bavail   Number of free blocks available to 
-                         non-privileged process. 
-fsfilcnt_t    f_files    Total number of file serial numbers. 
-fsfilcnt_t    f_ffree    Total number of free file serial numbers. 
-fsfilcnt_t    f_favail   Number of file serial numbers available to 
-                         non-privileged process. 
-unsigned long f_fsid     File system ID. 
-unsigned long f_flag     Bit mask of f_flag values. 
-unsigned long f_namemax  Maximum filename length.*/
+	// Some systems leave f_frsize at 0
+	buf->f_bsize = st.f_bsize;
+	buf->f_frsize = (st.f_frsize != 0) ? st.f_frsize : st.f_bsize;
+	buf->f_blocks = st.f_blocks;
+	buf->f_bfree = st.f_bfree;
+	buf->f_bavail = st.f_bavail;
+	buf->f_files = st.f_files;
+	buf->f_ffree = st.f_ffree;
+	buf->f_favail = st.f_favail;
+	buf->f_namemax = st.f_namemax;
 	return 0;
+#endif
 }
 
 int fs_layer::creat(const char *fn, unsigned short mode)
@@ -453,13 +968,13 @@ int fs_layer::open(const char *fn, int flags, ...)
 #endif
 
 #if defined(_WIN32)
-	boost::filesystem::path fn_path(utf8_to_wfn(fn));
+	WideString fn_path(fn, true);
 	flags |= _O_BINARY;
 	int shflag = _SH_DENYRW;
 
 
 #	if defined(HAVE__WSOPEN_S)
-	errno_t err = _wsopen_s(&fd, fn_path.wstring().c_str(), flags,
+	errno_t err = _wsopen_s(&fd, fn_path.c_str(), flags,
 		shflag, mode);
 	if(err)
 	{
@@ -467,7 +982,7 @@ int fs_layer::open(const char *fn, int flags, ...)
 		return -1;
 	}
 #	else
-	fd = _wsopen(fn_path.wstring().c_str(), flags, shflag, mode);
+	fd = _wsopen(fn_path.c_str(), flags, shflag, mode);
 #	endif
 #else
 	fd = ::open(fn, flags, mode);
@@ -615,28 +1130,39 @@ int fs_layer::rmdir(const char *fn)
 	return 0;
 }
 
-int fs_layer::stat(const char *fn, efs_stat *buf)
+static void fillStat(efs_stat *buf, unsigned short mode, uintmax_t fsize,
+	uintmax_t hlc, std::time_t lwt)
 {
-	boost::filesystem::path fn_path(stringToFSPath(fn));
+	buf->st_dev = buf->st_rdev = 0;
+	buf->st_ino = 0;
+	buf->st_mode = mode;
+	buf->st_nlink = static_cast<short>(hlc);
+	buf->st_uid = 0;
+	buf->st_gid = 0;
+	buf->st_size = fsize;
+	buf->st_atime = lwt;
+	buf->st_mtime = lwt;
+	buf->st_ctime = lwt;
+}
 
-	std::time_t lwt = 0;
+#if defined(_WIN32)
+/**
+ * Fills buf from the file attributes returned by GetFileAttributesEx
+ * and FindFirstFile/FindNextFile.
+ */
+static void fileAttributesToStat(DWORD attributes, DWORD sizeHigh, DWORD sizeLow,
+	const FILETIME &lastWriteTime, efs_stat *buf)
+{
 	uintmax_t fsize = 0;
-	uintmax_t hlc = 0;
 	unsigned short mode = 0;
 
-#if defined(EFS_WIN32)
-	// On Windows, the boost variant is too slow as it queries the file twice
-	WIN32_FILE_ATTRIBUTE_DATA fad;
-	if(GetFileAttributesEx(fn_path.native().c_str(), GetFileExInfoStandard, &fad) == 0)
-		return -1;
-
-	if(fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+	if(attributes & FILE_ATTRIBUTE_DIRECTORY)
 	{
 		// Ignore the read-only flag for folders on Windows
 		// See for example http://support.microsoft.com/kb/326549
 		mode = (S_IFDIR | S_IRUSR | S_IRGRP | S_IROTH | S_IWUSR | S_IWGRP | S_IWOTH);
 	}
-	else if(fad.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+	else if(attributes & FILE_ATTRIBUTE_REPARSE_POINT)
 	{
 		// Reparse point, or link: Not supported by EncFSMP
 		mode = (S_IFLNK | S_IRUSR | S_IRGRP | S_IROTH | S_IWUSR | S_IWGRP | S_IWOTH);
@@ -645,93 +1171,82 @@ int fs_layer::stat(const char *fn, efs_stat *buf)
 	{
 		// Regular file
 		mode = (S_IFREG | S_IRUSR | S_IRGRP | S_IROTH);
-		if((fad.dwFileAttributes & FILE_ATTRIBUTE_READONLY) == 0)
+		if((attributes & FILE_ATTRIBUTE_READONLY) == 0)
 			mode |= (S_IWUSR | S_IWGRP | S_IWOTH);
-		fsize = (static_cast<uintmax_t>(fad.nFileSizeHigh) << 32) + fad.nFileSizeLow;
+		fsize = (static_cast<uintmax_t>(sizeHigh) << 32) + sizeLow;
 	}
 
-	FILETIME &ft = fad.ftLastWriteTime;
+	const FILETIME &ft = lastWriteTime;
 	__int64 t = (static_cast<__int64>(ft.dwHighDateTime)<< 32) + ft.dwLowDateTime;
 	t -= 116444736000000000LL;
 	t /= 10000000;
-	lwt = static_cast<std::time_t>(t);
+
+	fillStat(buf, mode, fsize, 0, static_cast<std::time_t>(t));
+}
 #else
-	boost::system::error_code ec;
-	boost::filesystem::file_status status = boost::filesystem::status(fn_path, ec);
-	if(ec)
-	{
-		errno = ec.value();
-		return -1;
-	}
+/**
+ * Fills buf from the result of the POSIX stat functions.
+ */
+static void posixStatToStat(const struct stat &st, efs_stat *buf)
+{
+	unsigned short mode = static_cast<unsigned short>(st.st_mode & 06777);
+	if(S_ISREG(st.st_mode))
+		mode |= S_IFREG;
+	else if(S_ISDIR(st.st_mode))
+		mode |= S_IFDIR;
+	else
+		mode |= S_IFCHR;
+	fillStat(buf, mode, S_ISREG(st.st_mode) ? st.st_size : 0, st.st_nlink, st.st_mtime);
+}
+#endif
 
-	lwt = boost::filesystem::last_write_time(fn_path, ec);
-	if(ec)
+int fs_layer::stat(const char *fn, efs_stat *buf)
+{
+#if defined(EFS_WIN32)
+	// On Windows, the boost variant is too slow as it queries the file twice
+	WideString fn_path(fn, true);
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+	if(GetFileAttributesExW(fn_path.c_str(), GetFileExInfoStandard, &fad) == 0)
 	{
-		errno = ec.value();
+		DWORD err = GetLastError();
+		errno = (err == ERROR_FILE_NOT_FOUND || err == ERROR_PATH_NOT_FOUND) ? ENOENT : EACCES;
 		return -1;
 	}
-	if(boost::filesystem::is_regular_file(status))
-		fsize = boost::filesystem::file_size(fn_path, ec);
-	if(ec)
-	{
-		errno = ec.value();
+
+	fileAttributesToStat(fad.dwFileAttributes, fad.nFileSizeHigh, fad.nFileSizeLow,
+		fad.ftLastWriteTime, buf);
+	return 0;
+#else
+	// The boost variant queries the file four times
+	struct stat st;
+	if(::stat(fn, &st) != 0)
 		return -1;
-	}
-	hlc = boost::filesystem::hard_link_count(fn_path, ec);
-	if(ec)
+	posixStatToStat(st, buf);
+	return 0;
+#endif
+}
+
+int fs_layer::fstat(int fd, efs_stat *buf)
+{
+#if defined(EFS_WIN32)
+	HANDLE h = (HANDLE)_get_osfhandle(fd);
+	BY_HANDLE_FILE_INFORMATION info;
+	if(h == INVALID_HANDLE_VALUE || GetFileInformationByHandle(h, &info) == 0)
 	{
-		errno = ec.value();
+		errno = EBADF;
 		return -1;
 	}
 
-	// File type
-	if(boost::filesystem::is_regular_file(status))
-		mode |= S_IFREG;
-	if(boost::filesystem::is_directory(status))
-		mode |= S_IFDIR;
-	if(boost::filesystem::is_symlink(status))
-		mode |= S_IFLNK;
-	if(boost::filesystem::is_other(status))
-		mode |= S_IFCHR;	// ???
-
-	// Permissions
-	if(status.permissions() & boost::filesystem::owner_read)
-		mode |= S_IRUSR;
-	if(status.permissions() & boost::filesystem::owner_write)
-		mode |= S_IWUSR;
-	if(status.permissions() & boost::filesystem::owner_exe)
-		mode |= S_IXUSR;
-	if(status.permissions() & boost::filesystem::group_read)
-		mode |= S_IRGRP;
-	if(status.permissions() & boost::filesystem::group_write)
-		mode |= S_IWGRP;
-	if(status.permissions() & boost::filesystem::group_exe)
-		mode |= S_IXGRP;
-	if(status.permissions() & boost::filesystem::others_read)
-		mode |= S_IROTH;
-	if(status.permissions() & boost::filesystem::others_write)
-		mode |= S_IWOTH;
-	if(status.permissions() & boost::filesystem::others_exe)
-		mode |= S_IXOTH;
-
-	if(status.permissions() & boost::filesystem::set_uid_on_exe)
-		mode |= S_ISUID;
-	if(status.permissions() & boost::filesystem::set_gid_on_exe)
-		mode |= S_ISGID;
-#endif
-
-	buf->st_dev = buf->st_rdev = 0;
-	buf->st_ino = 0;
-	buf->st_mode = mode;
-	buf->st_nlink = static_cast<short>(hlc);
-	buf->st_uid = 0;
-	buf->st_gid = 0;
-	buf->st_size = fsize;
-	buf->st_atime = lwt;
-	buf->st_mtime = lwt;
-	buf->st_ctime = lwt;
-
+	fileAttributesToStat(info.dwFileAttributes, info.nFileSizeHigh, info.nFileSizeLow,
+		info.ftLastWriteTime, buf);
 	return 0;
+#else
+	struct stat st;
+	if(::fstat(fd, &st) != 0)
+		return -1;
+	posixStatToStat(st, buf);
+	return 0;
+#endif
 }
 
 int fs_layer::stat_cached(const char *path, efs_stat *buffer, void *pStatCache)
@@ -749,6 +1264,317 @@ int fs_layer::stat_cached(const char *path, efs_stat *buffer, void *pStatCache)
 	return ret;
 }
 
+#if defined(_WIN32)
+// Paths of a folder which are looked up individually, instead of by querying
+// the whole folder
+static const size_t statManyMinPerFolder = 4;
+
+/**
+ * Queries the directory entries of folder dirName with GetFileInformationByHandleEx,
+ * and fills the results of the requested names. Returns false if the folder
+ * can't be queried, the names not found must be stat()'ed individually.
+ */
+static bool statFolderEntries(const std::string &dirName,
+	const std::unordered_map<std::wstring, size_t> &names,
+	std::vector<efs_stat> &buffers, std::vector<int> &retVals, std::vector<bool> &found)
+{
+	HANDLE h = CreateFileW(utf8_to_wfn(dirName).c_str(), FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if(h == INVALID_HANDLE_VALUE)
+		return false;
+
+	// LONGLONG elements, the entries must be 8 byte aligned
+	std::vector<LONGLONG> buffer(64 * 1024 / sizeof(LONGLONG));
+	size_t remaining = names.size();
+	FILE_INFO_BY_HANDLE_CLASS infoClass = FileIdBothDirectoryRestartInfo;
+	while(remaining > 0 && GetFileInformationByHandleEx(h, infoClass,
+		&buffer[0], static_cast<DWORD>(buffer.size() * sizeof(LONGLONG))))
+	{
+		infoClass = FileIdBothDirectoryInfo;
+		const unsigned char *pos = reinterpret_cast<const unsigned char *>(&buffer[0]);
+		while(true)
+		{
+			const FILE_ID_BOTH_DIR_INFO *info = reinterpret_cast<const FILE_ID_BOTH_DIR_INFO *>(pos);
+			std::wstring name(info->FileName, info->FileNameLength / sizeof(WCHAR));
+			std::unordered_map<std::wstring, size_t>::const_iterator iter = names.find(name);
+			if(iter != names.end() && !found[iter->second])
+			{
+				FILETIME lastWriteTime;
+				lastWriteTime.dwLowDateTime = info->LastWriteTime.LowPart;
+				lastWriteTime.dwHighDateTime = info->LastWriteTime.HighPart;
+				fileAttributesToStat(info->FileAttributes, info->EndOfFile.HighPart,
+					info->EndOfFile.LowPart, lastWriteTime, &buffers[iter->second]);
+				retVals[iter->second] = 0;
+				found[iter->second] = true;
+				remaining--;
+			}
+
+			if(info->NextEntryOffset == 0)
+				break;
+			pos += info->NextEntryOffset;
+		}
+	}
+
+	CloseHandle(h);
+	return true;
+}
+#endif
+
+void fs_layer::statMany(const std::vector<std::string> &paths,
+	std::vector<efs_stat> &buffers, std::vector<int> &retVals)
+{
+	buffers.resize(paths.size());
+	retVals.assign(paths.size(), -1);
+	std::vector<bool> found(paths.size(), false);
+
+	// Group the paths by folder
+	typedef std::unordered_map<std::string, std::vector<size_t> > FolderMap;
+	FolderMap folders;
+	for(size_t i = 0; i < paths.size(); i++)
+		folders[extract_path(paths[i])].push_back(i);
+
+	for(FolderMap::const_iterator iter = folders.begin(); iter != folders.end(); iter++)
+	{
+		const std::vector<size_t> &indices = iter->second;
+		if(iter->first.empty())
+			continue;
+#if defined(_WIN32)
+		if(indices.size() < statManyMinPerFolder)
+			continue;
+
+		std::unordered_map<std::wstring, size_t> names;
+		for(size_t i = 0; i < indices.size(); i++)
+			names[utf8_to_wchar(extract_filename(paths[indices[i]]).c_str())] = indices[i];
+		statFolderEntries(iter->first, names, buffers, retVals, found);
+#else
+		int dirfd = ::open(iter->first.c_str(), O_RDONLY | O_DIRECTORY);
+		if(dirfd < 0)
+			continue;
+
+		for(size_t i = 0; i < indices.size(); i++)
+		{
+			size_t index = indices[i];
+			std::string name = extract_filename(paths[index]);
+			struct stat st;
+			if(name.empty() || fstatat(dirfd, name.c_str(), &st, 0) != 0)
+				continue;
+
+			posixStatToStat(st, &buffers[index]);
+			retVals[index] = 0;
+			found[index] = true;
+		}
+		::close(dirfd);
+#endif
+	}
+
+	// Everything not found above, also to get the proper errno
+	for(size_t i = 0; i < paths.size(); i++)
+	{
+		if(!found[i])
+			retVals[i] = stat(paths[i].c_str(), &buffers[i]);
+	}
+}
+
+#if defined(_WIN32)
+// FILE_NETWORK_OPEN_INFORMATION, which winternl.h doesn't declare
+struct NetworkOpenInformation
+{
+	LARGE_INTEGER CreationTime;
+	LARGE_INTEGER LastAccessTime;
+	LARGE_INTEGER LastWriteTime;
+	LARGE_INTEGER ChangeTime;
+	LARGE_INTEGER AllocationSize;
+	LARGE_INTEGER EndOfFile;
+	ULONG FileAttributes;
+};
+
+typedef NTSTATUS (NTAPI *NtCreateFileType)(PHANDLE, ACCESS_MASK, POBJECT_ATTRIBUTES,
+	PIO_STATUS_BLOCK, PLARGE_INTEGER, ULONG, ULONG, ULONG, ULONG, PVOID, ULONG);
+typedef NTSTATUS (NTAPI *NtQueryFullAttributesFileType)(POBJECT_ATTRIBUTES, NetworkOpenInformation *);
+
+/**
+ * The native API functions opening files relative to a folder handle,
+ * they are not in the import library.
+ */
+struct NtFunctions
+{
+	NtCreateFileType createFile;
+	NtQueryFullAttributesFileType queryFullAttributesFile;
+
+	NtFunctions()
+	{
+		HMODULE ntdll = GetModuleHandleW(L"ntdll.dll");
+		createFile = reinterpret_cast<NtCreateFileType>(GetProcAddress(ntdll, "NtCreateFile"));
+		queryFullAttributesFile = reinterpret_cast<NtQueryFullAttributesFileType>(
+			GetProcAddress(ntdll, "NtQueryFullAttributesFile"));
+	}
+
+	bool isAvailable() const { return createFile != NULL && queryFullAttributesFile != NULL; }
+};
+
+static const NtFunctions &ntFunctions()
+{
+	static NtFunctions functions;
+	return functions;
+}
+
+static int ntStatusToErrno(NTSTATUS status)
+{
+	switch(static_cast<ULONG>(status))
+	{
+	case 0xC0000034:	// STATUS_OBJECT_NAME_NOT_FOUND
+	case 0xC000003A:	// STATUS_OBJECT_PATH_NOT_FOUND
+		return ENOENT;
+	case 0xC0000035:	// STATUS_OBJECT_NAME_COLLISION
+		return EEXIST;
+	case 0xC00000BA:	// STATUS_FILE_IS_A_DIRECTORY
+		return EISDIR;
+	case 0xC0000022:	// STATUS_ACCESS_DENIED
+	case 0xC0000043:	// STATUS_SHARING_VIOLATION
+		return EACCES;
+	default:
+		return EIO;
+	}
+}
+
+/**
+ * Describes name in folder dir. nameW must stay alive while oa is used.
+ */
+static void initRelativeName(HANDLE dir, const WideString &nameW,
+	UNICODE_STRING &us, OBJECT_ATTRIBUTES &oa)
+{
+	us.Buffer = const_cast<PWSTR>(nameW.c_str());
+	us.Length = static_cast<USHORT>(nameW.length() * sizeof(WCHAR));
+	us.MaximumLength = us.Length;
+	InitializeObjectAttributes(&oa, &us, OBJ_CASE_INSENSITIVE, dir, NULL);
+}
+#endif
+
+bool fs_layer::open_dir_handle(const char *path, fs_layer::dir_handle &dir)
+{
+#if defined(_WIN32)
+	if(!ntFunctions().isAvailable())
+		return false;
+
+	HANDLE h = CreateFileW(utf8_to_wfn(path).c_str(), FILE_TRAVERSE | FILE_LIST_DIRECTORY | SYNCHRONIZE,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if(h == INVALID_HANDLE_VALUE)
+		return false;
+	dir = h;
+	return true;
+#else
+	int fd = ::open(path, O_RDONLY | O_DIRECTORY);
+	if(fd < 0)
+		return false;
+	dir = fd;
+	return true;
+#endif
+}
+
+void fs_layer::close_dir_handle(fs_layer::dir_handle dir)
+{
+#if defined(_WIN32)
+	CloseHandle(dir);
+#else
+	::close(dir);
+#endif
+}
+
+int fs_layer::open_at(fs_layer::dir_handle dir, const char *name, int flags, int mode)
+{
+#if defined(_WIN32)
+	// Strip off illegal bits in mode, same as in open()
+	mode &= (_S_IREAD | _S_IWRITE);
+
+	ACCESS_MASK access = SYNCHRONIZE | FILE_READ_ATTRIBUTES;
+	int accessMode = flags & (_O_RDONLY | _O_WRONLY | _O_RDWR);
+	if(accessMode == _O_WRONLY)
+		access |= GENERIC_WRITE;
+	else if(accessMode == _O_RDWR)
+		access |= GENERIC_READ | GENERIC_WRITE;
+	else
+		access |= GENERIC_READ;
+
+	ULONG disposition = FILE_OPEN;
+	if(flags & _O_CREAT)
+	{
+		if(flags & _O_EXCL)
+			disposition = FILE_CREATE;
+		else if(flags & _O_TRUNC)
+			disposition = FILE_OVERWRITE_IF;
+		else
+			disposition = FILE_OPEN_IF;
+	}
+	else if(flags & _O_TRUNC)
+	{
+		disposition = FILE_OVERWRITE;
+	}
+
+	ULONG attributes = FILE_ATTRIBUTE_NORMAL;
+	if((flags & _O_CREAT) && (mode & _S_IWRITE) == 0)
+		attributes = FILE_ATTRIBUTE_READONLY;
+
+	WideString nameW(name, false);
+	UNICODE_STRING us;
+	OBJECT_ATTRIBUTES oa;
+	initRelativeName(dir, nameW, us, oa);
+	IO_STATUS_BLOCK iosb;
+	HANDLE h = INVALID_HANDLE_VALUE;
+	// No sharing, same as _SH_DENYRW in open()
+	NTSTATUS status = ntFunctions().createFile(&h, access, &oa, &iosb, NULL, attributes, 0,
+		disposition, FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT, NULL, 0);
+	if(status < 0)
+	{
+		errno = ntStatusToErrno(status);
+		return -1;
+	}
+
+	int fd = _open_osfhandle(reinterpret_cast<intptr_t>(h), flags & _O_APPEND);
+	if(fd < 0)
+	{
+		CloseHandle(h);
+		errno = EMFILE;
+	}
+	return fd;
+#else
+	// Strip off illegal bits in mode, same as in open()
+	mode &= (S_IREAD | S_IWRITE);
+	return ::openat(dir, name, flags, mode);
+#endif
+}
+
+int fs_layer::stat_at(fs_layer::dir_handle dir, const char *name, efs_stat *buffer)
+{
+#if defined(_WIN32)
+	WideString nameW(name, false);
+	UNICODE_STRING us;
+	OBJECT_ATTRIBUTES oa;
+	initRelativeName(dir, nameW, us, oa);
+	NetworkOpenInformation info;
+	NTSTATUS status = ntFunctions().queryFullAttributesFile(&oa, &info);
+	if(status < 0)
+	{
+		errno = ntStatusToErrno(status);
+		return -1;
+	}
+
+	FILETIME lastWriteTime;
+	lastWriteTime.dwLowDateTime = info.LastWriteTime.LowPart;
+	lastWriteTime.dwHighDateTime = info.LastWriteTime.HighPart;
+	fileAttributesToStat(info.FileAttributes, info.EndOfFile.HighPart,
+		info.EndOfFile.LowPart, lastWriteTime, buffer);
+	return 0;
+#else
+	struct stat st;
+	if(fstatat(dir, name, &st, 0) != 0)
+		return -1;
+	posixStatToStat(st, buffer);
+	return 0;
+#endif
+}
+
 int fs_layer::chmod(const char* fn, int mode)
 {
 	boost::filesystem::path fn_path(stringToFSPath(fn));
@@ -790,14 +1616,87 @@ int fs_layer::chmod(const char* fn, int mode)
 	return 0;
 }
 
+#if defined(_WIN32)
+// Buffer of a listing with GetFileInformationByHandleEx, FindNextFile fetches
+// only 64 KB at a time even with FIND_FIRST_EX_LARGE_FETCH
+static const size_t dirBufferSize = 256 * 1024;
+#endif
+
 struct fs_layer::DIR
 {
+#if defined(_WIN32)
+	// Queried with GetFileInformationByHandleEx, or with FindFirstFile if
+	// the filesystem doesn't support it (dirHandle is INVALID_HANDLE_VALUE)
+	HANDLE dirHandle;
+	std::vector<LONGLONG> buffer;	// LONGLONG elements, the entries must be 8 byte aligned
+	size_t bufferPos;		// Offset of the next entry in buffer, npos if none is left
+	HANDLE findHandle;
+	WIN32_FIND_DATAW findData;
+	bool hasFindData;		// findData holds the next entry
+#else
 	boost::filesystem::directory_iterator *iter;
+#endif
 	fs_layer::fs_dirent ent;
 };
 
 fs_layer::DIR* fs_layer::opendir(const char *name)
 {
+#if defined(_WIN32)
+	// Enumerate with FindFirstFile directly, as it also returns the attributes,
+	// size and times of the files (see readdirplus())
+	boost::filesystem::path path(stringToFSPath(name));
+
+	fs_layer::DIR *dir = new fs_layer::DIR;
+	dir->findHandle = INVALID_HANDLE_VALUE;
+	dir->hasFindData = false;
+	dir->bufferPos = std::string::npos;
+	dir->dirHandle = CreateFileW(path.native().c_str(), FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if(dir->dirHandle != INVALID_HANDLE_VALUE)
+	{
+		dir->buffer.resize(dirBufferSize / sizeof(LONGLONG));
+		if(GetFileInformationByHandleEx(dir->dirHandle, FileIdBothDirectoryRestartInfo,
+			&dir->buffer[0], static_cast<DWORD>(dir->buffer.size() * sizeof(LONGLONG))))
+		{
+			dir->bufferPos = 0;
+			return dir;
+		}
+		DWORD err = GetLastError();
+		if(err == ERROR_NO_MORE_FILES || err == ERROR_FILE_NOT_FOUND)
+			return dir;		// Empty
+
+		// Not a folder, or not supported by the filesystem, FindFirstFile
+		// tells which
+		CloseHandle(dir->dirHandle);
+		dir->dirHandle = INVALID_HANDLE_VALUE;
+		std::vector<LONGLONG>().swap(dir->buffer);
+	}
+
+	path /= L"*";
+	// Don't query the short names, and fetch the entries in larger chunks
+	dir->findHandle = FindFirstFileExW(path.native().c_str(), FindExInfoBasic, &dir->findData,
+		FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	dir->hasFindData = (dir->findHandle != INVALID_HANDLE_VALUE);
+	if(!dir->hasFindData)
+	{
+		// The root folder of a drive may be empty, all others contain at least "."
+		DWORD err = GetLastError();
+		if(err != ERROR_FILE_NOT_FOUND)
+		{
+			if(err == ERROR_PATH_NOT_FOUND)
+				errno = ENOENT;
+			else if(err == ERROR_DIRECTORY)
+				errno = ENOTDIR;
+			else
+				errno = EACCES;
+			delete dir;
+			return NULL;
+		}
+	}
+
+	return dir;
+#else
 	boost::system::error_code ec;
 
 	// Convert name to boost path
@@ -817,17 +1716,100 @@ fs_layer::DIR* fs_layer::opendir(const char *name)
 	}
 
 	return dir;
+#endif
 }
 
 int fs_layer::closedir(fs_layer::DIR* dir)
 {
+#if defined(_WIN32)
+	if(dir->dirHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(dir->dirHandle);
+	if(dir->findHandle != INVALID_HANDLE_VALUE)
+		FindClose(dir->findHandle);
+#else
 	delete dir->iter;
+#endif
 	delete dir;
 	return 0;
 }
 
 fs_layer::fs_dirent* fs_layer::readdir(fs_layer::DIR* dir)
 {
+	bool hasStat = false;
+	return readdirplus(dir, NULL, hasStat);
+}
+
+fs_layer::fs_dirent* fs_layer::readdirplus(fs_layer::DIR* dir, efs_stat *buffer, bool &hasStat)
+{
+	hasStat = false;
+#if defined(_WIN32)
+	if(dir == NULL)
+		return NULL;
+
+	while(dir->bufferPos != std::string::npos)
+	{
+		const FILE_ID_BOTH_DIR_INFO *info = reinterpret_cast<const FILE_ID_BOTH_DIR_INFO *>(
+			reinterpret_cast<const unsigned char *>(&dir->buffer[0]) + dir->bufferPos);
+		std::wstring name(info->FileName, info->FileNameLength / sizeof(WCHAR));
+		bool isDots = (name == L"." || name == L"..");
+		if(!isDots)
+		{
+			std::string path = wchar_to_utf8_cstr(name.c_str());
+			strncpy(dir->ent.d_name, path.c_str(), sizeof(dir->ent.d_name));
+			dir->ent.d_name[sizeof(dir->ent.d_name)-1] = 0;
+			dir->ent.d_namlen = static_cast<unsigned short>(strlen(dir->ent.d_name));
+			dir->ent.d_ino = 0;
+			if(buffer != NULL)
+			{
+				FILETIME lastWriteTime;
+				lastWriteTime.dwLowDateTime = info->LastWriteTime.LowPart;
+				lastWriteTime.dwHighDateTime = info->LastWriteTime.HighPart;
+				fileAttributesToStat(info->FileAttributes, info->EndOfFile.HighPart,
+					info->EndOfFile.LowPart, lastWriteTime, buffer);
+				hasStat = true;
+			}
+		}
+
+		// The buffer is overwritten by the next query, the entry was copied above
+		if(info->NextEntryOffset != 0)
+			dir->bufferPos += info->NextEntryOffset;
+		else if(GetFileInformationByHandleEx(dir->dirHandle, FileIdBothDirectoryInfo,
+			&dir->buffer[0], static_cast<DWORD>(dir->buffer.size() * sizeof(LONGLONG))))
+			dir->bufferPos = 0;
+		else
+			dir->bufferPos = std::string::npos;
+		if(!isDots)
+			return &dir->ent;
+	}
+
+	while(dir->hasFindData)
+	{
+		const WIN32_FIND_DATAW &fd = dir->findData;
+		bool isDots = (wcscmp(fd.cFileName, L".") == 0 || wcscmp(fd.cFileName, L"..") == 0);
+		if(!isDots)
+		{
+			std::string path = wchar_to_utf8_cstr(fd.cFileName);
+			strncpy(dir->ent.d_name, path.c_str(), sizeof(dir->ent.d_name));
+			dir->ent.d_name[sizeof(dir->ent.d_name)-1] = 0;
+			dir->ent.d_namlen = static_cast<unsigned short>(strlen(dir->ent.d_name));
+			dir->ent.d_ino = 0;
+			if(buffer != NULL)
+			{
+				fileAttributesToStat(fd.dwFileAttributes, fd.nFileSizeHigh, fd.nFileSizeLow,
+					fd.ftLastWriteTime, buffer);
+				hasStat = true;
+			}
+		}
+
+		// findData is overwritten, the entry was copied above
+		dir->hasFindData = (FindNextFileW(dir->findHandle, &dir->findData) != 0);
+		if(!isDots)
+			return &dir->ent;
+	}
+
+	return NULL;
+#else
+	(void)buffer;
 	if(dir == NULL
 		|| dir->iter == NULL)
 		return NULL;
@@ -837,19 +1819,13 @@ fs_layer::fs_dirent* fs_layer::readdir(fs_layer::DIR* dir)
 		return NULL;
 
 	const boost::filesystem::directory_entry &dirEntry = *(*dir->iter);
-#if defined(_WIN32)
-	std::string path = wchar_to_utf8_cstr(dirEntry.path().filename().wstring().c_str());
-#else
 	std::string path(dirEntry.path().filename().string());
-#endif
 	strncpy(dir->ent.d_name, path.c_str(), sizeof(dir->ent.d_name));
 	dir->ent.d_name[sizeof(dir->ent.d_name)-1] = 0;
-#if defined(_WIN32)
-	dir->ent.d_namlen = static_cast<unsigned short>(strlen(dir->ent.d_name));
-#endif
 	(*(dir->iter))++;
 
 	return &dir->ent;
+#endif
 }
 
 /**
@@ -861,25 +1837,50 @@ fs_layer::fs_dirent* fs_layer::readdir(fs_layer::DIR* dir)
 std::string fs_layer::concat_path(const std::string &path1,
 	const std::string &path2, bool genericPath)
 {
-	// Convert name to boost path
+	std::string result;
+	concat_path(path1, path2, result, genericPath);
+	return result;
+}
+
+static bool isSeparator(char c)
+{
 #if defined(_WIN32)
-	boost::filesystem::path ppath1(utf8_to_wchar(path1.c_str()));
-	boost::filesystem::path ppath2(utf8_to_wchar(path2.c_str()));
+	return (c == '/' || c == '\\');
 #else
-	boost::filesystem::path ppath1(path1);
-	boost::filesystem::path ppath2(path2);
+	return (c == '/');
 #endif
+}
 
-	ppath1 /= ppath2;	// Append with separator, if necessary
+/**
+ * Appends path2 to path1 with a separator, if necessary, the same way as
+ * boost::filesystem::path::operator/=(). The result reuses the memory of
+ * result, so that List doesn't allocate per entry.
+ */
+void fs_layer::concat_path(const std::string &path1,
+	const std::string &path2, std::string &result, bool genericPath)
+{
+	result.reserve(path1.size() + path2.size() + 1);
+	result.assign(path1);
 
-	std::string concat_path;
-	
-	if(genericPath)
-		concat_path = wchar_to_utf8_cstr(ppath1.generic_wstring().c_str());
-	else
-		concat_path = wchar_to_utf8_cstr(ppath1.wstring().c_str());
+	if(!path1.empty() && !path2.empty()
+		&& !isSeparator(path1[path1.size() - 1]) && !isSeparator(path2[0])
+#if defined(_WIN32)
+		&& path1[path1.size() - 1] != ':'
+#endif
+		)
+	{
+#if defined(_WIN32)
+		result += (genericPath ? '/' : '\\');
+#else
+		result += '/';
+#endif
+	}
+	result.append(path2);
 
-	return concat_path;
+#if defined(_WIN32)
+	if(genericPath)
+		std::replace(result.begin(), result.end(), '\\', '/');
+#endif
 }
 
 bool fs_layer::is_same_path(const std::string &path1,
@@ -939,15 +1940,12 @@ std::string fs_layer::canonical(const std::string &fullpath)
 bool fs_layer::capacity(const std::string &rootDir,
 	uint64_t &totalCapacity, uint64_t &availableCapacity)
 {
-	boost::filesystem::path p(stringToFSPath(rootDir));
-
-	boost::system::error_code ec;
-	boost::filesystem::space_info spaceInfo = boost::filesystem::space(p, ec);
-	if(ec)
+	struct fs_layer::statvfs_fs fs;
+	if(statvfs(rootDir.c_str(), &fs) != 0)
 		return false;
 
-	totalCapacity = spaceInfo.capacity;
-	availableCapacity = spaceInfo.available;
+	totalCapacity = fs.f_blocks * fs.f_frsize;
+	availableCapacity = fs.f_bavail * fs.f_frsize;
 
 	return true;
 }
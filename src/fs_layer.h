@@ -22,6 +22,7 @@
 
 #include "config.h"
 #include <string>
+#include <vector>
 
 #if defined(HAVE_SYS_UTIME_H)
 #include <sys/utime.h>
@@ -42,6 +43,9 @@
 #if defined(HAVE_SYS_DIR_H)
 #include <sys/dir.h>
 #endif
+#if defined(HAVE_SYS_UIO_H)
+#include <sys/uio.h>
+#endif
 
 #include <boost/filesystem.hpp>
 
@@ -90,6 +94,23 @@ public:
 
 	static int gettimeofday(struct fs_layer::timeval_fs *, void *);
 
+	/*
+	 * The fields of POSIX struct statvfs, which Windows doesn't have.
+	 * The block counts are in units of f_frsize.
+	 */
+	struct statvfs_fs
+	{
+		uint64_t f_bsize;		// file system block size
+		uint64_t f_frsize;		// fundamental file system block size
+		uint64_t f_blocks;		// total number of blocks
+		uint64_t f_bfree;		// total number of free blocks
+		uint64_t f_bavail;		// free blocks available to non-privileged processes
+		uint64_t f_files;		// total number of file serial numbers (0 if unknown)
+		uint64_t f_ffree;		// free file serial numbers
+		uint64_t f_favail;		// free file serial numbers for non-privileged processes
+		uint64_t f_namemax;		// maximum file name length
+	};
+
 
 	static boost::filesystem::path stringToFSPath(const std::string &str);
 	static std::string readFileToString(const char *fn);
@@ -101,12 +122,42 @@ public:
 	static int64_t pread(int fd, void *buf, int64_t count, int64_t offset);
 	static int64_t pwrite(int fd, const void *buf, int64_t count, int64_t offset);
 
+#if defined(HAVE_PREADV)
+	typedef struct ::iovec fs_iovec;
+#else
+	struct fs_iovec
+	{
+		void *iov_base;
+		size_t iov_len;
+	};
+#endif
+	// Scatter read / gather write at a file position
+	static int64_t preadv(int fd, const fs_iovec *iov, int iovcnt, int64_t offset);
+	static int64_t pwritev(int fd, const fs_iovec *iov, int iovcnt, int64_t offset);
+
 	static int read(int fd, void *buf, unsigned int count);
 	static int write(int fd, const void *buf, unsigned int count);
 
 	static int truncate(const char *path, int64_t length);
 	static int ftruncate(int fd, int64_t length);
-	static int statvfs(const char *path, struct statvfs *buf);
+	static int set_sparse(int fd);
+	static int preallocate(int fd, int64_t length);
+	static int find_data(int fd, int64_t offset, int64_t fileSize, int64_t *begin, int64_t *end);
+
+	// Read-only views of a file. The offset must be a multiple of map_alignment.
+	static const int64_t map_alignment = 1 << 20;
+	static void *map_view(int fd, int64_t offset, size_t length, void **mapHandle);
+	static void unmap_view(void *addr, size_t length, void *mapHandle);
+	static bool is_local_path(const char *path);
+
+	// Keep large sequential transfers out of the system cache.
+	static int drop_cache(int fd, int64_t offset, int64_t length, bool written);
+	// Read-only descriptor bypassing the system cache. Offsets, sizes and buffer
+	// addresses of pread_unbuffered() must be multiples of unbuffered_alignment.
+	static const int64_t unbuffered_alignment = 4096;
+	static int open_unbuffered(const char *fn);
+	static int64_t pread_unbuffered(int fd, void *buf, int64_t count, int64_t offset);
+	static int statvfs(const char *path, struct fs_layer::statvfs_fs *buf);
 	static int utimes(const char *filename, const struct fs_layer::timeval_fs times[2]);
 	static int futimes(int fd, const struct fs_layer::timeval_fs times[2]);
 	static int utime(const char *filename, struct utimbuf *times);
@@ -118,7 +169,26 @@ public:
 	static int unlink(const char *path);
 	static int rmdir(const char *path);
 	static int stat(const char *path, efs_stat *buffer);
+	// Same as stat(), for the file of an open descriptor
+	static int fstat(int fd, efs_stat *buffer);
 	static int stat_cached(const char *path, efs_stat *buffer, void *pStatCache);
+	// stat() of many paths, with one directory query for the paths in the same folder
+	// where possible. retVals receives the result of stat() for each path.
+	static void statMany(const std::vector<std::string> &paths,
+		std::vector<efs_stat> &buffers, std::vector<int> &retVals);
+
+	// Handle of an open folder, names can be resolved relative to it
+	// without walking the whole path again
+#if defined(_WIN32)
+	typedef void *dir_handle;		// HANDLE
+#else
+	typedef int dir_handle;
+#endif
+	static bool open_dir_handle(const char *path, dir_handle &dir);
+	static void close_dir_handle(dir_handle dir);
+	// Same as open() and stat(), for name (a single path component) in folder dir
+	static int open_at(dir_handle dir, const char *name, int flags, int mode = 0);
+	static int stat_at(dir_handle dir, const char *name, efs_stat *buffer);
 	static inline int lstat(const char *path, efs_stat *buffer) {
 		return stat(path, buffer);
 	}
@@ -139,9 +209,16 @@ typedef struct dirent
 	static DIR *opendir(const char *name);
 	static int closedir(DIR* dir);
 	static fs_dirent* readdir(DIR* dir);
+	// Same as readdir(), but also returns the stat data if the enumeration
+	// provides it (Windows), so that no stat() is required per entry.
+	// Otherwise, hasStat is set to false.
+	static fs_dirent* readdirplus(DIR* dir, efs_stat *buffer, bool &hasStat);
 
 	static std::string concat_path(const std::string &path1,
 		const std::string &path2, bool genericPath = false);
+	// Same as above, into result, which keeps its memory between calls
+	static void concat_path(const std::string &path1,
+		const std::string &path2, std::string &result, bool genericPath = false);
 	static bool is_same_path(const std::string &path1,
 		const std::string &path2);
 	static std::string extract_path(const std::string &fullpath);
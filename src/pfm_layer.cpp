@@ -24,25 +24,33 @@
 #include <memory.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include <fcntl.h>
 
 #include "efs_config.h"
 #include "pfm_layer.h"
+#include "PFMDispatchPool.h"
+#include "UTFConvert.h"
 #include "EncFSMPLogger.h"
 
 #include <boost/filesystem.hpp>
-#include <boost/locale.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/functional/hash.hpp>
 #include <boost/random/random_device.hpp>
 #include <boost/random/uniform_int_distribution.hpp>
+#include <boost/thread/thread.hpp>
 
 // libencfs
+#include "BlockCache.h"
+#include "DirHandleCache.h"
 #include "DirNode.h"
 #include "Cipher.h"
 #include "DirNode.h"
 #include "MemoryPool.h"
+#include "NameCodingCache.h"
 #include "Interface.h"
+#include "PhaseTimer.h"
 #include "FileUtils.h"
 #include "StreamNameIO.h"
 #include "BlockNameIO.h"
@@ -59,67 +67,291 @@ static PfmOpenAttribs zeroOpenAttribs = {};
 static PfmAttribs zeroAttribs = {};
 static PfmMediaInfo zeroMediaInfo = {};
 
+static uint8_t traceFileType(const PfmOpenAttribs &openAttribs)
+{
+	if(openAttribs.attribs.fileType == pfmFileTypeFile)
+		return OpTrace::fileTypeFile;
+	if(openAttribs.attribs.fileType == pfmFileTypeFolder)
+		return OpTrace::fileTypeFolder;
+	return OpTrace::fileTypeNone;
+}
+
+// Entries of fileStatCache_ for missing files, kept apart from the others
+static const int negativeStatCacheSize = 4000;
+// Directory entries decoded at a time by List
+static const size_t listBatchSize = 256;
+// Entries of all listings in dirListCache_, an entry takes about 150 bytes
+static const int dirListCacheSize = 100000;
+// Paths remembered by negativeLookupCache_
+static const int negativeLookupCacheSize = 1000;
+// File IDs kept, beyond that the least recently used ones of closed files are dropped
+static const size_t fileIdTableSize = 200000;
+// FlushFile writes out the write buffer of a file at most once within this time with FPCoalesced
+static const std::chrono::milliseconds flushCoalesceTime(500);
+// Listings collected after the Open of a folder, see prefetchListing()
+static const size_t maxPendingPrefetches = 16;
+static const size_t prefetchMaxEntries = 5000;
+// Files of a listing whose first block is decoded in advance, see prefetchFirstBlocks()
+static const size_t maxFirstBlockPrefetches = 64;
+// Unfinished listings which keep their folder handle open
+static const size_t maxOpenListings = 64;
+// How long paths which were not found are remembered by negativeLookupCache_
+static const std::chrono::milliseconds negativeLookupTimeToLive(2000);
+// Files which are never shown, the configuration file of the volume
+static const char *builtinSkippedNamePatterns = "/.encfs*";
+
 PFMLayer::PFMLayer() :
 	marshaller(NULL),
-	newFileID_(1)
+	unlockFailed_(false),
+	isUnlocked_(false),
+	newFileID_(1),
+	dispatchThreadCount_(0),
+	useWriteBuffer_(false),
+	readOnly_(false),
+	flushPolicy_(FPStrict),
+	flusherStop_(false),
+	prefetchStop_(false),
+	prefetchedListings_(0),
+	firstBlockQueue_(SharedExecutor::PriorityBackground),
+	firstBlockStop_(false),
+	prefetchedFirstBlocks_(0),
+	bulkDeletedEntries_(0),
+	useCacheSnapshot_(false),
+	restoredListings_(0),
+	refreshedOpenFiles_(0),
+	readAheadHits_(0),
+	readAheadMisses_(0),
+	autoTunings_(0),
+	finalizerStop_(false),
+	useCaching_(false),
+	readAheadBytes_(0),
+	writeBufferBytes_(0),
+	firstBlockPrefetchBytes_(0),
+	dispatchPool_(NULL),
+	watchBackingFolder_(false),
+	useNameIndex_(false),
+	nameIndexStop_(false),
+	capacityCacheTime_(2000),
+	hasCachedCapacity_(false),
+	bytesWrittenSinceCapacity_(0),
+	pausedListings_(0),
+	mountCreateMicros_(0),
+	firstListMicros_(0)
 {
+	memset(&cachedVolumeStat_, 0, sizeof(cachedVolumeStat_));
+	setNamePatterns(std::string(), std::string());
+	// Called with mutex_ held, like every use of fileIDs_
+	fileIDs_.setPinnedFunction([this](const encfs::InternedPath &path)
+		{ return openIdMap_.find(path) != openIdMap_.end(); });
+	fileIDs_.setCapacity(fileIdTableSize);
 }
 
 PFMLayer::~PFMLayer()
 {
 	// Close openFiles_
-	OpenFileMapType::iterator iter = openFiles_.begin();
-	while(iter != openFiles_.end())
+	for(int i = 0; i < openFileShardCount_; i++)
 	{
-		OpenFile &cur = iter->second;
+		OpenFileMapType &openFiles = openFileShards_[i].openFiles_;
+		OpenFileMapType::iterator iter = openFiles.begin();
+		while(iter != openFiles.end())
+		{
+			OpenFile &cur = *(iter->second);
+			flushWriteBuffer(&cur);
 
-		// Save some attributes for later.
-		// Reason: We need the file to be closed in order to delete it.
-		// To close it, we have to delete the OpenFile instance.
-		bool isDeleted = cur.isDeleted_;
-		bool isFile = cur.isFile_;
-		std::string pathName = cur.pathName_;
+			// Save some attributes for later.
+			// Reason: We need the file to be closed in order to delete it.
+			// To close it, we have to delete the OpenFile instance.
+			bool isDeleted = cur.isDeleted_ && !cur.isReplaced_;
+			bool isFile = cur.isFile_;
+			std::string pathName = cur.pathName_;
+			setOpenFileNode(&cur, std::shared_ptr<encfs::FileNode>());
 
-		// The file is closed. Remove from the list of open files
-		openFiles_.erase(iter);
-		openIdMap_.erase(pathName);
-		// Don't access cur after this point
+			// The file is closed. Remove from the list of open files
+			openFiles.erase(iter);
+			openIdMap_.erase(pathName);
+			// Don't access cur after this point
 
-		if(isDeleted)
-		{
-			try
+			if(isDeleted)
 			{
-				if(isFile)
+				try
 				{
-					rootFS_->root->unlink(pathName.c_str());
+					if(isFile)
+					{
+						rootFS_->root->unlink(pathName.c_str());
+					}
+					else
+					{
+						std::string cipherPathName = rootFS_->root->cipherPath(pathName.c_str());
+						if(rootFS_->dirHandles)
+							rootFS_->dirHandles->forgetTree(cipherPathName);
+						fs_layer::rmdir(cipherPathName.c_str());
+					}
 				}
-				else
+				catch( encfs::Error &err )
 				{
-					std::string cipherPathName = rootFS_->root->cipherPath(pathName.c_str());
-					fs_layer::rmdir(cipherPathName.c_str());
+					reportRLogErr(err);
 				}
 			}
-			catch( encfs::Error &err )
-			{
-				reportRLogErr(err);
-			}
+
+			iter = openFiles.begin();
 		}
+	}
+
+}
+
+void PFMLayer::setNamePatterns(const std::string &hiddenPatterns, const std::string &skippedPatterns)
+{
+	hiddenNames_.setPatterns(hiddenPatterns);
+	skippedNames_.setPatterns(std::string(builtinSkippedNamePatterns) + ";" + skippedPatterns);
+}
+
+void PFMLayer::setDeferredUnlock(const std::string &rootDir, const UnlockFunction &unlock)
+{
+	rootDir_ = rootDir;
+	unlock_ = unlock;
+}
+
+PFMLayer::RegistryType PFMLayer::registry_;
+boost::mutex PFMLayer::registryMutex_;
+
+bool PFMLayer::retune(const std::wstring &mountName, const CacheTuning &tuning)
+{
+	boost::mutex::scoped_lock lock(registryMutex_);
+	RegistryType::const_iterator iter = registry_.find(mountName);
+	if(iter == registry_.end())
+		return false;
+
+	return iter->second->applyTuning(tuning);
+}
+
+bool PFMLayer::searchNames(const std::wstring &mountName, const std::string &query,
+	size_t maxHits, std::vector<NameIndex::Hit> &hits, bool &isComplete)
+{
+	boost::mutex::scoped_lock lock(registryMutex_);
+	RegistryType::const_iterator iter = registry_.find(mountName);
+	if(iter == registry_.end() || !iter->second->useNameIndex_ || !iter->second->isUnlocked_)
+		return false;
+
+	NameIndex &nameIndex = iter->second->nameIndex_;
+	isComplete = !nameIndex.isRebuilding();
+	if(!nameIndex.search(query, maxHits, hits))
+		isComplete = false;
+	return true;
+}
+
+bool PFMLayer::applyTuning(const CacheTuning &tuning)
+{
+	boost::mutex::scoped_lock tuningLock(tuningMutex_);
+	// The auto-tuning starts again from the new sizes
+	baseTuning_ = tuning.withCaching(useCaching_);
+	autoTuner_.reset();
+	CacheTuning newTuning(baseTuning_);
+	if(newTuning.autoTune_)
+		CacheAutoTuner::fitBudget(baseTuning_, newTuning);
+	return setTuning(newTuning);
+}
+
+/**
+ * Puts newTuning into effect, tuningMutex_ must be held.
+ * Returns false if a part could not be changed while mounted.
+ */
+bool PFMLayer::setTuning(const CacheTuning &newTuning)
+{
+	bool isComplete = true;
+	bool useStatCache = (newTuning.statCacheSize_ > 0);
+	fileStatCache_.setCacheSize(static_cast<int>(newTuning.statCacheSize_));
+	fileStatCache_.setNegativeCacheSize(useStatCache ? negativeStatCacheSize : 0);
+	// Nothing changes a read-only volume, its entries never expire
+	fileStatCache_.setTimeToLive(std::chrono::milliseconds(readOnly_ ? 0 : newTuning.statCacheTimeToLive_));
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		dirListCache_.setCacheSize(newTuning.listingCache_ ? dirListCacheSize : 0);
+		negativeLookupCache_.setCacheSize(useStatCache ? negativeLookupCacheSize : 0);
+	}
+
+	readAheadBytes_ = static_cast<size_t>(std::max(newTuning.readAheadKB_, 0L)) * 1024;
+	writeBufferBytes_ = static_cast<size_t>(std::max(newTuning.writeBufferKB_, 0L)) * 1024;
+	firstBlockPrefetchBytes_ = static_cast<int64_t>(std::max(newTuning.firstBlockPrefetchKB_, 0L)) * 1024;
+
+	// The block cache is created with the filesystem, only its budget can change
+	if(newTuning.blockCacheMB_ != cacheTuning_.blockCacheMB_)
+	{
+		RootPtr rootFS = isUnlocked_ ? rootFS_ : RootPtr();
+		if(rootFS && rootFS->blockCache && newTuning.blockCacheMB_ > 0)
+			rootFS->blockCache->setBudget(static_cast<size_t>(newTuning.blockCacheMB_) * 1024 * 1024);
+		else
+			isComplete = false;
+	}
 
-		iter = openFiles_.begin();
+	if(newTuning.threadCount_ != cacheTuning_.threadCount_)
+	{
+		int threadCount = static_cast<int>(newTuning.threadCount_);
+		if(threadCount <= 0)
+			threadCount = static_cast<int>(boost::thread::hardware_concurrency());
+		if(dispatchPool_ && threadCount > 1)
+			dispatchPool_->setThreadCount(threadCount);
+		else
+			isComplete = false;
 	}
 
+	cacheTuning_ = newTuning;
+	return isComplete;
 }
 
 void PFMLayer::startFS(RootPtr rootFS, const wchar_t *mountDir, PfmApi *pfmApi,
 	wchar_t driveLetter, bool useCaching, bool worldWrite, bool localDrive,
 	bool startBrowser, std::ostream &ostr)
 {
-	rootFS_ = rootFS;
 	mountName_ = mountDir;
-	if(useCaching)
-		fileStatCache_.setCacheSize(1000);
+	mountStartTime_ = std::chrono::steady_clock::now();
+	mountCreateMicros_ = 0;
+	firstListMicros_ = 0;
+	stats_.reset();
+	if(rootFS)
+	{
+		useRootFS(rootFS);
+		rootDir_ = rootFS->root->rootDirectory();
+		isUnlocked_ = true;
+	}
+	stats_.addCounter("Memory pool allocations", []() { return encfs::MemoryPool::stats().allocations; });
+	stats_.addCounter("Memory pool reused", []() { return encfs::MemoryPool::stats().reused; });
+	stats_.addCounter("Memory pool new blocks", []() { return encfs::MemoryPool::stats().newBlocks; });
+	stats_.addCounter("Memory pool bytes", []() { return encfs::MemoryPool::stats().residentBytes; });
+	stats_.addCounter("Memory pool peak bytes", []() { return encfs::MemoryPool::stats().peakResidentBytes; });
+	stats_.addCounter("Memory pool free bytes", []() { return encfs::MemoryPool::stats().freeBytes; });
+	stats_.addCounter("Memory pool destroyed bytes", []() { return encfs::MemoryPool::stats().destroyedBytes; });
+	stats_.addCounter("Interned paths", []() { return static_cast<uint64_t>(encfs::InternedPath::tableSize()); });
+	useCaching_ = useCaching;
+	if(readOnly_)
+	{
+		// The volume is sealed: nothing to buffer, and what was not found stays so
+		useWriteBuffer_ = false;
+		negativeLookupCache_.setTimeToLive(std::chrono::milliseconds(0));
+		fileStatCache_.setNegativeTimeToLive(std::chrono::milliseconds(0));
+	}
 	else
-		fileStatCache_.setCacheSize(0);
+	{
+		negativeLookupCache_.setTimeToLive(negativeLookupTimeToLive);
+		fileStatCache_.setNegativeTimeToLive(negativeLookupTimeToLive);
+	}
+	// The block cache and the threads were already set up with this tuning
+	applyTuning(cacheTuning_);
+	stats_.addCounter("Negative lookup hits", [this]() { return negativeLookupCache_.getHits(); });
+	stats_.addCounter("Stat cache hits", [this]() { return fileStatCache_.getHits(); });
+	stats_.addCounter("Stat cache misses", [this]() { return fileStatCache_.getMisses(); });
+	stats_.addCounter("Folder listing hits", [this]() { return dirListCache_.getHits(); });
+	stats_.addCounter("Folder listing misses", [this]() { return dirListCache_.getMisses(); });
+	stats_.addCounter("Paused folder listings", [this]() { return pausedListings_.load(); });
+	stats_.addCounter("Prefetched folder listings", [this]() { return prefetchedListings_.load(); });
+	stats_.addCounter("Prefetched first blocks", [this]() { return prefetchedFirstBlocks_.load(); });
+	stats_.addCounter("Bulk deleted entries", [this]() { return bulkDeletedEntries_.load(); });
+	stats_.addCounter("Restored folder listings", [this]() { return restoredListings_.load(); });
+	stats_.addCounter("Refreshed open files", [this]() { return refreshedOpenFiles_.load(); });
+	stats_.addCounter("Read-ahead hits", [this]() { return readAheadHits_.load(); });
+	stats_.addCounter("Read-ahead misses", [this]() { return readAheadMisses_.load(); });
+	stats_.addCounter("Auto-tunings", [this]() { return autoTunings_.load(); });
+	stats_.addCounter("Mount create microseconds", [this]() { return mountCreateMicros_.load(); });
+	stats_.addCounter("First listing microseconds", [this]() { return firstListMicros_.load(); });
 
 	// The following code is copied mostly from the Pismo File Mount's example code tempfs.cpp
 	int error = 0;
@@ -137,6 +369,8 @@ void PFMLayer::startFS(RootPtr rootFS, const wchar_t *mountDir, PfmApi *pfmApi,
 		mcp.mountFlags |= pfmMountFlagBrowse;
 	if(worldWrite)
 		mcp.mountFlags |= (pfmMountFlagWorldRead | pfmMountFlagWorldWrite);
+	if(readOnly_)
+		mcp.mountFlags |= pfmMountFlagReadOnly;
 
 	if(driveLetter != L'-')
 	{
@@ -162,7 +396,10 @@ void PFMLayer::startFS(RootPtr rootFS, const wchar_t *mountDir, PfmApi *pfmApi,
 		return;
 	}
 
+	std::chrono::steady_clock::time_point mountCreateStartTime = std::chrono::steady_clock::now();
 	error = pfmApi->MountCreate(&mcp,&mount);
+	mountCreateMicros_ = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - mountCreateStartTime).count());
 	if(error)
 	{
 		ostr << "ERROR: " << error << " Unable to create mount" << std::endl;
@@ -191,7 +428,75 @@ void PFMLayer::startFS(RootPtr rootFS, const wchar_t *mountDir, PfmApi *pfmApi,
 	
 	msp.formatterName = EncFSMPStrings::formatterName8_.c_str();
 	msp.volumeFlags |= volumeFlags;
+	if(readOnly_)
+		msp.volumeFlags |= pfmVolumeFlagReadOnly;
+
+	// Let a pool of worker threads handle the requests, so that a slow
+	// operation on one file does not block all others
+	PFMDispatchPool dispatchPool(this);
+	if(dispatchThreadCount_ > 1)
+	{
+		dispatchPool.start(dispatchThreadCount_);
+		msp.dispatch = &dispatchPool;
+		dispatchPool_ = &dispatchPool;
+	}
+	if(!traceFile_.empty())
+	{
+		if(trace_.open(traceFile_))
+			stats_.setTrace(&trace_);
+		else
+			ostr << "WARNING: Unable to create the trace file" << std::endl;
+	}
+	if(!changeJournalFile_.empty() && !changeJournal_.open(changeJournalFile_, rootDir_))
+		ostr << "WARNING: Unable to open the change journal" << std::endl;
+	FormatterStats::registerStats(mountName_, &stats_);
+	{
+		boost::mutex::scoped_lock lock(registryMutex_);
+		registry_[mountName_] = this;
+	}
+	readAheadWorker_.start();
+	firstBlockStop_ = false;
+	// One file at a time, it must not compete with the requests
+	firstBlockQueue_.open(1);
+	startFlusher();
+	startPrefetcher();
+	startFinalizer();
+	cacheTrimmer_.start([this]() { return activityCount(); },
+		[this](bool shedAll) { trimCaches(shedAll); }, [this]() { autoTune(); });
+	if(useCaching && watchBackingFolder_ && !readOnly_)
+	{
+		if(!backingFolderWatcher_.start(rootDir_,
+			[this](const std::string &cipherPath, bool namesChanged) { backingFolderChanged(cipherPath, namesChanged); }))
+		{
+			ostr << "WARNING: Unable to watch the backing folder for changes" << std::endl;
+		}
+	}
 	marshaller->ServeDispatch(&msp);
+	{
+		boost::mutex::scoped_lock lock(registryMutex_);
+		registry_.erase(mountName_);
+	}
+	{
+		boost::mutex::scoped_lock tuningLock(tuningMutex_);
+		dispatchPool_ = NULL;
+	}
+	dispatchPool.stop();
+	cacheTrimmer_.stop();
+	stopFlusher();
+	stopPrefetcher();
+	stopFinalizer();
+	backingFolderWatcher_.stop();
+	stopNameIndex();
+	saveCacheSnapshot();
+	firstBlockStop_ = true;
+	firstBlockQueue_.close();
+	readAheadWorker_.stop();
+	FormatterStats::unregisterStats(mountName_);
+	stats_.setTrace(NULL);
+	trace_.close();
+	changeJournal_.close();
+	if(encfs::PhaseTimers::enabled())
+		encfs::PhaseTimers::logReport();
 
 	if(mount)
 		mount->Release();
@@ -206,6 +511,297 @@ void PFMLayer::startFS(RootPtr rootFS, const wchar_t *mountDir, PfmApi *pfmApi,
 	close_fd(msp.fromFormatterWrite);
 }
 
+/**
+ * Runs the deferred unlock on the first call, see setDeferredUnlock().
+ * Concurrent callers wait until it is finished.
+ * Returns false if the volume could not be unlocked.
+ */
+bool PFMLayer::unlockRootFS()
+{
+	if(isUnlocked_)
+		return true;
+
+	boost::mutex::scoped_lock unlockLock(unlockMutex_);
+	if(isUnlocked_)
+		return true;
+	if(!unlock_ || unlockFailed_)
+		return false;
+
+	RootPtr rootFS = unlock_();
+	if(!rootFS)
+	{
+		unlockFailed_ = true;
+		return false;
+	}
+
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		useRootFS(rootFS);
+	}
+	isUnlocked_ = true;
+	return true;
+}
+
+/**
+ * Sets rootFS_ and the statistics and caches which depend on it.
+ */
+void PFMLayer::useRootFS(RootPtr rootFS)
+{
+	rootFS_ = rootFS;
+	if(rootFS->blockCache)
+	{
+		std::shared_ptr<encfs::BlockCache> blockCache = rootFS->blockCache;
+		stats_.addCounter("Block cache hits", [blockCache]() { return blockCache->hits(); });
+		stats_.addCounter("Block cache misses", [blockCache]() { return blockCache->misses(); });
+		stats_.addCounter("Block cache bytes", [blockCache]() { return static_cast<uint64_t>(blockCache->bytesUsed()); });
+	}
+	if(rootFS->dirHandles)
+	{
+		std::shared_ptr<encfs::DirHandleCache> dirHandles = rootFS->dirHandles;
+		stats_.addCounter("Folder handle hits", [dirHandles]() { return dirHandles->hits(); });
+		stats_.addCounter("Folder handle misses", [dirHandles]() { return dirHandles->misses(); });
+	}
+	if(rootFS->nameCache)
+	{
+		std::shared_ptr<encfs::NameCodingCache> nameCache = rootFS->nameCache;
+		stats_.addCounter("Name cache hits", [nameCache]() { return nameCache->hits(); });
+		stats_.addCounter("Name cache misses", [nameCache]() { return nameCache->misses(); });
+	}
+	if(rootFS->codingNanos)
+	{
+		std::shared_ptr<std::atomic<uint64_t> > codingNanos = rootFS->codingNanos;
+		stats_.addCounter("Crypto microseconds", [codingNanos]() { return codingNanos->load() / 1000; });
+	}
+	std::shared_ptr<encfs::DirNode> root = rootFS->root;
+	stats_.addCounter("Folder rename entries", [root]() { return root->renameEntriesTotal(); });
+	stats_.addCounter("Folder rename entries done", [root]() { return root->renameEntriesDone(); });
+	fileStatCache_.setPlaintextSizeFunction([root](const efs_stat &buf) -> int64_t { return root->plaintextSizeFromStat(buf); });
+	startNameIndex();
+	loadCacheSnapshot();
+}
+
+/**
+ * Reads the snapshot of the last mount. The coded names go to the name cache
+ * right away, the folders are kept until they are listed, see restoreListing().
+ */
+void PFMLayer::loadCacheSnapshot()
+{
+	if(!useCacheSnapshot_)
+		return;
+
+	RootPtr rootFS = rootFS_;
+	if(!cacheSnapshot_.load(rootFS->root->cacheSnapshotPath(), rootFS->cipher, rootFS->volumeKey))
+		return;
+	if(rootFS->nameCache)
+		rootFS->nameCache->restore(cacheSnapshot_.nameCodings_);
+	cacheSnapshot_.nameCodings_.clear();
+}
+
+/**
+ * Stores the name cache and the cached listings for the next mount, together
+ * with the folders of the last snapshot which were not listed and are still
+ * unchanged. Called at unmount, when no requests are served any more.
+ * Must be called with mutex_ unlocked.
+ */
+void PFMLayer::saveCacheSnapshot()
+{
+	if(!useCacheSnapshot_ || readOnly_ || !isUnlocked_)
+		return;
+
+	boost::mutex::scoped_lock lock(mutex_);
+	if(!rootFS_)
+		return;
+	if(rootFS_->nameCache)
+		cacheSnapshot_.nameCodings_ = rootFS_->nameCache->entries();
+
+	std::vector<std::pair<std::string, DirListCache::ListingPtr> > listings;
+	dirListCache_.getListings(listings);
+	for(size_t i = 0; i < listings.size(); i++)
+	{
+		CacheSnapshot::Folder &folder = cacheSnapshot_.folders_[listings[i].first];
+		folder.names.clear();
+		const DirListCache::Listing &listing = *(listings[i].second);
+		for(size_t n = 0; n < listing.size(); n++)
+			folder.names.push_back(listing[n].name_);
+		folder.mtime = -1;
+	}
+
+	// The time of the backing folders now, the listings are up to date with them
+	CacheSnapshot::FolderMap::iterator iter = cacheSnapshot_.folders_.begin();
+	while(iter != cacheSnapshot_.folders_.end())
+	{
+		efs_stat buf;
+		bool isValid = false;
+		try
+		{
+			std::string cipherPath = rootFS_->root->cipherPath(iter->first.c_str());
+			isValid = (fs_layer::stat(cipherPath.c_str(), &buf) == 0 && S_ISDIR(buf.st_mode)
+				&& (iter->second.mtime < 0 || iter->second.mtime == static_cast<int64_t>(buf.st_mtime)));
+		}
+		catch(encfs::Error &)
+		{
+		}
+		if(isValid)
+		{
+			iter->second.mtime = static_cast<int64_t>(buf.st_mtime);
+			++iter;
+		}
+		else
+			iter = cacheSnapshot_.folders_.erase(iter);
+	}
+
+	if(!cacheSnapshot_.save(rootFS_->root->cacheSnapshotPath(), rootFS_->cipher, rootFS_->volumeKey))
+		reportEncFSMPErr(L"Unable to store the cache snapshot", rootFS_->root->cacheSnapshotPath());
+	cacheSnapshot_.clear();
+}
+
+/**
+ * The listing of dirPath from the snapshot of the last mount, if its backing
+ * folder was not modified since, added to dirListCache_. Its entries are stale:
+ * the names need no decoding, but the attributes of the files are queried
+ * again when they are listed. Must be called with mutex_ locked.
+ */
+DirListCache::ListingPtr PFMLayer::restoreListing(const std::string &dirPath)
+{
+	std::vector<std::string> names;
+	int64_t mtime = 0;
+	if(cacheSnapshot_.folders_.empty() || !cacheSnapshot_.takeFolder(dirPath, names, mtime))
+		return DirListCache::ListingPtr();
+
+	try
+	{
+		std::string cipherPath = rootFS_->root->cipherPath(dirPath.c_str());
+		efs_stat buf;
+		if(fileStatCache_.stat(cipherPath.c_str(), &buf) != 0 || static_cast<int64_t>(buf.st_mtime) != mtime)
+			return DirListCache::ListingPtr();
+	}
+	catch(encfs::Error &)
+	{
+		return DirListCache::ListingPtr();
+	}
+
+	DirListCache::ListingPtr pListing(new DirListCache::Listing(names.size()));
+	for(size_t i = 0; i < names.size(); i++)
+	{
+		(*pListing)[i].name_.swap(names[i]);
+		(*pListing)[i].isStale_ = true;
+	}
+	dirListCache_.addListing(dirPath, dirListCache_.getGeneration(), pListing);
+	restoredListings_++;
+	return pListing;
+}
+
+/**
+ * Loads the stored name index, and builds a fresh one in the background:
+ * the volume may have been changed without this mount.
+ */
+void PFMLayer::startNameIndex()
+{
+	if(!useNameIndex_ || nameIndexThread_.joinable())
+		return;
+
+	RootPtr rootFS = rootFS_;
+	nameIndex_.load(rootFS->root->nameIndexPath(), rootFS->cipher, rootFS->volumeKey);
+	nameIndex_.beginRebuild();
+	nameIndexStop_ = false;
+	nameIndexThread_ = boost::thread([this, rootFS]() { buildNameIndex(rootFS); });
+}
+
+/**
+ * Stops building the index and stores it for the next mount.
+ */
+void PFMLayer::stopNameIndex()
+{
+	if(!nameIndexThread_.joinable())
+		return;
+
+	nameIndexStop_ = true;
+	nameIndexThread_.join();
+	// A read-only volume keeps the index it had, this one is built anew next time
+	if(rootFS_ && !readOnly_)
+	{
+		if(!nameIndex_.save(rootFS_->root->nameIndexPath(), rootFS_->cipher, rootFS_->volumeKey))
+			reportEncFSMPErr(L"Unable to store the name index", rootFS_->root->nameIndexPath());
+	}
+}
+
+void PFMLayer::buildNameIndex(RootPtr rootFS)
+{
+	NameIndex::Map index;
+	bool isOK = false;
+	try
+	{
+		isOK = walkNameIndex(rootFS, "/", index);
+	}
+	catch(encfs::Error &err)
+	{
+		reportRLogErr(err);
+	}
+	if(isOK)
+		nameIndex_.endRebuild(index);
+	else
+		nameIndex_.cancelRebuild();
+}
+
+/**
+ * Adds everything below dirPath, which ends with '/', to index. Returns false
+ * if the index is stopped meanwhile.
+ */
+bool PFMLayer::walkNameIndex(RootPtr rootFS, const std::string &dirPath, NameIndex::Map &index)
+{
+	static const size_t batchSize = 256;
+
+	encfs::DirTraverse dt = rootFS->root->openDir(dirPath.c_str());
+	if(!dt.valid())
+		return true;
+
+	std::vector<encfs::DirTraverse::Entry> entries = dt.nextBatch(batchSize);
+	while(!entries.empty())
+	{
+		for(size_t i = 0; i < entries.size(); i++)
+		{
+			if(nameIndexStop_)
+				return false;
+
+			const encfs::DirTraverse::Entry &entry = entries[i];
+			if(entry.plainName == "." || entry.plainName == "..")
+				continue;
+			std::string plainPath = dirPath + entry.plainName;
+			if(skippedNames_.matches(plainPath))
+				continue;
+
+			efs_stat buf = entry.stat;
+			if(!entry.hasStat)
+			{
+				std::string cpath = rootFS->root->cipherPath(plainPath.c_str());
+				if(fs_layer::stat(cpath.c_str(), &buf) != 0)
+					continue;
+			}
+
+			NameIndex::Entry indexEntry;
+			indexEntry.isFolder = S_ISDIR(buf.st_mode);
+			indexEntry.mtime = static_cast<int64_t>(buf.st_mtime);
+			if(!indexEntry.isFolder)
+			{
+				indexEntry.size = rootFS->root->plaintextSizeFromStat(buf);
+				if(indexEntry.size == -ENOTSUP)
+				{
+					// Compressed volume: the size is in the index of the file
+					std::shared_ptr<encfs::FileNode> fileNode =
+						rootFS->root->lookupNode(plainPath.c_str(), "EncFSMP");
+					indexEntry.size = fileNode ? fileNode->getSize() : 0;
+				}
+			}
+			index[plainPath] = indexEntry;
+
+			if(indexEntry.isFolder && !walkNameIndex(rootFS, plainPath + '/', index))
+				return false;
+		}
+		entries = dt.nextBatch(batchSize);
+	}
+	return true;
+}
+
 
 int64_t UnixTimeToFileTime(time_t t)
 {
@@ -219,6 +815,10 @@ long FileTimeToUnixTime(int64_t t)
 
 void CCALL PFMLayer::Open(PfmMarshallerOpenOp* op, void* formatterUse)
 {
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opOpen);
+	// All other requests which need the volume key refer to an open file
+	unlockRootFS();
+	boost::mutex::scoped_lock lock(mutex_);
 	int perr = 0;
 
 	if(!rootFS_)
@@ -243,10 +843,12 @@ void CCALL PFMLayer::Open(PfmMarshallerOpenOp* op, void* formatterUse)
 		std::string path("/"), parentFolder;		// In UTF-8 encoding
 		for(size_t i = 0; i < namePartCount; i++)
 		{
-			parentFolder = path;
+			parentFolder.swap(path);
 
-			path = fs_layer::concat_path(path, nameParts[i].name8, true);
+			fs_layer::concat_path(parentFolder, nameParts[i].name8, path, true);
 		}
+		opTimer.setTracePath(path);
+		finalizeClosingFiles(path, false);
 
 		// Check whether parent folder exists
 
@@ -313,24 +915,25 @@ void CCALL PFMLayer::Open(PfmMarshallerOpenOp* op, void* formatterUse)
 						&& pOpenFile->isFile_)
 					{
 						// Check for access level and fail if source file is not writable
-						if(pOpenFile->isReadOnly_)
+						if(pOpenFile->isReadOnly_ || readOnly_)
 							perr = pfmErrorAccessDenied;
 						else if(pOpenFile->isOpenedReadOnly_)
 						{
-							// Try to reopen file with write access
-							pOpenFile->fileNode_.reset();
-
+							// Try to reopen file with write access. The FileNode is shared
+							// through libencfs, so this upgrades the open node
 							int res = 0;
 							int8_t accessLevel = determineAccessLevel(pOpenFile->isReadOnly_, existingAccessLevel);
-							pOpenFile->fileNode_ =
+							std::shared_ptr<encfs::FileNode> fileNode =
 								rootFS_->root->openNode(pOpenFile->pathName_.c_str(), "open", makeOpenFileFlags(static_cast<PT_INT8>(accessLevel)), &res);
-							if(!pOpenFile->fileNode_)
+							if(!fileNode)
 							{
 								// Failed, try to open again for reading
-								pOpenFile->fileNode_ =
+								fileNode =
 									rootFS_->root->openNode(pOpenFile->pathName_.c_str(), "open", makeOpenFileFlags(pfmAccessLevelReadData), &res);
 								perr = pfmErrorAccessDenied;
 							}
+							pOpenFile->fd_ = fileNode ? res : -1;
+							setOpenFileNode(pOpenFile, fileNode);
 							if(perr == 0)
 								pOpenFile->isOpenedReadOnly_ = false;
 						}
@@ -343,10 +946,20 @@ void CCALL PFMLayer::Open(PfmMarshallerOpenOp* op, void* formatterUse)
 				}
 
 				// Return here
+				opTimer.setTraceResult(perr, openAttribs.openId, traceFileType(openAttribs));
 				op->Complete(perr, existed, &openAttribs, parentFileId, endName.c_str(), 0, 0, 0, 0);
 				return;
 			}
 		}
+		// Plain lookups of paths which were not found recently, without encoding the name again
+		bool isLookup = (newCreateOpenId == 0 || createFileType == pfmFileTypeNone);
+		if(isLookup && negativeLookupCache_.isMissing(path))
+		{
+			opTimer.setTraceResult(pfmErrorNotFound);
+			op->Complete(pfmErrorNotFound, false, &openAttribs, parentFileId, endName.c_str(), 0, 0, 0, 0);
+			return;
+		}
+
 		// Check whether path is a directory or a file
 		bool isDir = false;
 		{
@@ -383,8 +996,7 @@ void CCALL PFMLayer::Open(PfmMarshallerOpenOp* op, void* formatterUse)
 					existed = false;
 
 					// From doc: If the indicated file does not exist and the newCreateOpenId parameter is zero then the formatter should return pfmErrorNotFound
-					if(newCreateOpenId == 0
-						|| createFileType == pfmFileTypeNone)
+					if(isLookup)
 					{
 						res = std::abs(res);
 						if(errno == EACCES)
@@ -392,7 +1004,10 @@ void CCALL PFMLayer::Open(PfmMarshallerOpenOp* op, void* formatterUse)
 						else if(errno == EISDIR)
 							perr = pfmErrorNotAFile;
 						else if(errno == ENOENT)
+						{
 							perr = pfmErrorNotFound;
+							negativeLookupCache_.addMissing(path);
+						}
 						else perr = pfmErrorInvalid;
 					}
 
@@ -424,12 +1039,16 @@ void CCALL PFMLayer::Open(PfmMarshallerOpenOp* op, void* formatterUse)
 		}
 	}
 
+	opTimer.setTraceResult(perr, openAttribs.openId, traceFileType(openAttribs));
 	op->Complete(perr, existed, &openAttribs, parentFileId, endName.c_str(), 0, 0, 0, 0);
 }
 
 void CCALL PFMLayer::Replace(PfmMarshallerReplaceOp* op, void* formatterUse)
 {
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opReplace);
+	boost::mutex::scoped_lock lock(mutex_);
 	int64_t targetOpenId = op->TargetOpenId();
+	opTimer.setTraceTarget(targetOpenId);
 	int64_t targetParentFileId = op->TargetParentFileId();
 	const PfmNamePart* targetEndName = op->TargetEndName();
 	uint8_t createFileFlags = op->CreateFileFlags();
@@ -472,12 +1091,16 @@ void CCALL PFMLayer::Replace(PfmMarshallerReplaceOp* op, void* formatterUse)
 		}
 	}
 
+	opTimer.setTraceResult(perr, openAttribs.openId, traceFileType(openAttribs));
 	op->Complete(perr, &openAttribs, 0);
 }
 
 void CCALL PFMLayer::Move(PfmMarshallerMoveOp* op, void* formatterUse)
 {
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opMove);
+	boost::mutex::scoped_lock lock(mutex_);
 	int64_t sourceOpenId = op->SourceOpenId();
+	opTimer.setTraceTarget(sourceOpenId);
 	int64_t sourceParentFileId = op->SourceParentFileId();
 	const PfmNamePart* sourceEndName = op->SourceEndName();
 	const PfmNamePart* targetNameParts = op->TargetNameParts();
@@ -507,10 +1130,11 @@ void CCALL PFMLayer::Move(PfmMarshallerMoveOp* op, void* formatterUse)
 		std::string path("/"), parentFolder;		// In UTF-8 encoding
 		for(size_t i = 0; i < targetNamePartCount; i++)
 		{
-			parentFolder = path;
+			parentFolder.swap(path);
 
-			path = fs_layer::concat_path(path, targetNameParts[i].name8, true);
+			fs_layer::concat_path(parentFolder, targetNameParts[i].name8, path, true);
 		}
+		opTimer.setTracePath(path);
 
 		// Check whether parent folder exists
 		// First, look in open files
@@ -584,6 +1208,7 @@ void CCALL PFMLayer::Move(PfmMarshallerMoveOp* op, void* formatterUse)
 
 					existed = true;
 
+					opTimer.setTraceResult(perr, openAttribs.openId, traceFileType(openAttribs));
 					op->Complete(perr, existed, &openAttribs, parentFileId, endName.c_str(), 0, 0, 0, 0);
 					return;
 				}
@@ -657,15 +1282,19 @@ void CCALL PFMLayer::Move(PfmMarshallerMoveOp* op, void* formatterUse)
 			}
 		}
 	}
+	opTimer.setTraceResult(perr, openAttribs.openId, traceFileType(openAttribs));
 	op->Complete(perr, existed, &openAttribs, parentFileId, endName.c_str(), 0, 0, 0, 0);
 }
 
 void CCALL PFMLayer::MoveReplace(PfmMarshallerMoveReplaceOp* op, void* formatterUse)
 {
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opMoveReplace);
+	boost::mutex::scoped_lock lock(mutex_);
 	int64_t sourceOpenId = op->SourceOpenId();
 	int64_t sourceParentFileId = op->SourceParentFileId();
 	const PfmNamePart* sourceEndName = op->SourceEndName();
 	int64_t targetOpenId = op->TargetOpenId();
+	opTimer.setTraceTarget(sourceOpenId);
 	int64_t targetParentFileId = op->TargetParentFileId();
 	const PfmNamePart* targetEndName = op->TargetEndName();
 	uint8_t/*bool*/ deleteSource = op->DeleteSource();
@@ -707,22 +1336,33 @@ void CCALL PFMLayer::MoveReplace(PfmMarshallerMoveReplaceOp* op, void* formatter
 		perr = pfmErrorInvalid;
 	}
 
-	std::string newPath = pTargetOpenFile->pathName_;
+	if(perr == 0 && pSourceOpenFile->isFile_ && pTargetOpenFile->isFile_)
+	{
+		// Save by replace of an editor, one rename of the backing files
+		perr = replaceOp(pSourceOpenFile, pTargetOpenFile);
+	}
+	else if(perr == 0)
+	{
+		std::string newPath = pTargetOpenFile->pathName_;
 
-	// Delete target
-	if(perr == 0)
+		// Delete target
 		perr = deleteOp(pTargetOpenFile);
 
-	// Rename source to target
-	if(perr == 0)
-		perr = renameOp(pSourceOpenFile, newPath);
+		// Rename source to target
+		if(perr == 0)
+			perr = renameOp(pSourceOpenFile, newPath);
+	}
 
+	opTimer.setTraceResult(perr, targetOpenId);
 	op->Complete(perr);
 }
 
 void CCALL PFMLayer::Delete(PfmMarshallerDeleteOp* op, void* formatterUse)
 {
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opDelete);
+	boost::mutex::scoped_lock lock(mutex_);
 	int64_t openId = op->OpenId();
+	opTimer.setTraceTarget(openId);
 	int64_t parentFileId = op->ParentFileId();
 	const PfmNamePart* endName = op->EndName();
 	int64_t writeTime = op->WriteTime();
@@ -743,19 +1383,25 @@ void CCALL PFMLayer::Delete(PfmMarshallerDeleteOp* op, void* formatterUse)
 	if(perr == 0)
 		perr = deleteOp(pOpenFile);
 
+	opTimer.setTraceResult(perr);
 	op->Complete(perr);
 }
 
 void CCALL PFMLayer::Close(PfmMarshallerCloseOp* op, void* formatterUse)
 {
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opClose);
+	boost::mutex::scoped_lock lock(mutex_);
 	int64_t openId = op->OpenId();
+	opTimer.setTraceTarget(openId);
 	int64_t openSequence = op->OpenSequence();
 	int perr = 0;
 
-	OpenFileMapType::iterator iter = openFiles_.find(openId);
-	if(iter != openFiles_.end())
+	OpenFileShard &shard = getOpenFileShard(openId);
+	boost::mutex::scoped_lock shardLock(shard.mutex_);
+	OpenFileMapType::iterator iter = shard.openFiles_.find(openId);
+	if(iter != shard.openFiles_.end())
 	{
-		OpenFile &cur = iter->second;
+		OpenFile &cur = *(iter->second);
 
 		if(openSequence >= cur.sequenceId_)
 		{
@@ -763,38 +1409,78 @@ void CCALL PFMLayer::Close(PfmMarshallerCloseOp* op, void* formatterUse)
 			// Reason: We need the file to be closed in order to delete it.
 			// To close it, we have to delete the OpenFile instance.
 			bool isDeleted = cur.isDeleted_;
+			bool isReplaced = cur.isReplaced_;
 			bool isFile = cur.isFile_;
 			std::string pathName = cur.pathName_;
 
+			if(isFile && !isDeleted && finalizerThread_.joinable())
+			{
+				// Complete right away, the write buffer and the FileNode are
+				// finished by finalizerLoop()
+				if(cur.readAhead_)
+					cur.readAhead_->invalidate();
+				std::unique_ptr<OpenFile> of = std::move(iter->second);
+				shard.openFiles_.erase(iter);
+				shardLock.unlock();
+				openIdMap_.erase(pathName);
+				// A file closed twice before the finalizer got to it
+				finalizeClosingFiles(pathName, false);
+				encfs::InternedPath closedPath = of->pathName_;
+				closeQueue_.push_back(closedPath);
+				closingFiles_[closedPath] = std::move(of);
+				finalizerCond_.notify_one();
+
+				opTimer.setTraceResult(0);
+				op->Complete(0);
+				return;
+			}
+
+			flushWriteBuffer(&cur);
+			if(!isDeleted)
+				writeExtendedSize(&cur);
+
+			// A running read-ahead must not keep the file open
+			if(cur.readAhead_)
+				cur.readAhead_->invalidate();
+			setOpenFileNode(&cur, std::shared_ptr<encfs::FileNode>());
+
 			// The file is closed. Remove from the list of open files
-			openFiles_.erase(iter);
+			shard.openFiles_.erase(iter);
+			shardLock.unlock();
 			openIdMap_.erase(pathName);
 			// Don't access cur after this point
 
-			if(isDeleted)
+			if(isDeleted && !isReplaced)
 			{
 				try
 				{
+					std::string cipherPathName = rootFS_->root->cipherPath(pathName.c_str());
 					if(isFile)
 					{
 						int retVal = rootFS_->root->unlink(pathName.c_str());
 						if(retVal != 0)												// See above: Is file is not closed, delete does not work
 							throw encfs::Error("PFMLayer::Close: Could not delete file");
+						changeJournal_.record(ChangeJournal::changeDeleted, cipherPathName);
 					}
 					else
 					{
-						std::string cipherPathName = rootFS_->root->cipherPath(pathName.c_str());
-						if(fs_layer::rmdir(cipherPathName.c_str()) < 0)
+						if(rootFS_->dirHandles)
+							rootFS_->dirHandles->forgetTree(cipherPathName);
+						int retVal = fs_layer::rmdir(cipherPathName.c_str());
+						if(retVal < 0)
 						{
 							fs_layer::chmod(cipherPathName.c_str(), S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IWGRP | S_IXGRP | S_IROTH | S_IWOTH | S_IXOTH);
-							fs_layer::rmdir(cipherPathName.c_str());
+							retVal = fs_layer::rmdir(cipherPathName.c_str());
 						}
+						if(retVal == 0)
+							changeJournal_.record(ChangeJournal::changeDeleted, cipherPathName);
 					}
 				}
 				catch( encfs::Error &err )
 				{
 					reportEncFSMPErr(L"File deletion failed", pathName, err);
 				}
+				dirListCache_.removeName(fs_layer::extract_path(pathName), fs_layer::extract_filename(pathName));
 			}
 
 		}
@@ -803,12 +1489,16 @@ void CCALL PFMLayer::Close(PfmMarshallerCloseOp* op, void* formatterUse)
 	else
 		perr = pfmErrorFailed;
 
+	opTimer.setTraceResult(perr);
 	op->Complete(perr);
 }
 
 void CCALL PFMLayer::FlushFile(PfmMarshallerFlushFileOp* op, void* formatterUse)
 {
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opFlushFile);
+	boost::mutex::scoped_lock lock(mutex_);
 	int64_t openId = op->OpenId();
+	opTimer.setTraceTarget(openId);
 	uint8_t flushFlags = op->FlushFlags();
 	uint8_t fileFlags = op->FileFlags();
 	uint8_t color = op->Color();
@@ -824,8 +1514,11 @@ void CCALL PFMLayer::FlushFile(PfmMarshallerFlushFileOp* op, void* formatterUse)
 		perr = pfmErrorFailed;
 	else
 	{
-		if(pOpenFile->isFile_)
+		// Nothing was written to a read-only volume, and its attributes stay as they are
+		if(pOpenFile->isFile_ && !readOnly_)
 		{
+			perr = flushFileRequested(pOpenFile);
+
 			const char *cipherName = pOpenFile->fileNode_->cipherName();
 			if(fileFlags != pfmFileFlagsInvalid)
 			{
@@ -852,7 +1545,7 @@ void CCALL PFMLayer::FlushFile(PfmMarshallerFlushFileOp* op, void* formatterUse)
 					if(fs_layer::chmod(cipherName, mode) < 0)
 						perr = pfmErrorFailed;
 					else
-						fileStatCache_.forgetCachedStat(cipherName);
+						refreshCachedEntry(pOpenFile->pathName_, cipherName);
 				}
 			}
 
@@ -864,7 +1557,8 @@ void CCALL PFMLayer::FlushFile(PfmMarshallerFlushFileOp* op, void* formatterUse)
 				tm[0].tv_usec = 0;
 				tm[1].tv_sec = FileTimeToUnixTime(writeTime);
 				tm[1].tv_usec = 0;
-				if(pOpenFile->fd_ < 0)
+				// Read-only opens have no descriptor, see RawFileIO::open
+				if(pOpenFile->fd_ <= 0 || pOpenFile->isOpenedReadOnly_)
 					fs_layer::utimes(cipherName, tm);
 				else
 					fs_layer::futimes(pOpenFile->fd_, tm);
@@ -874,7 +1568,7 @@ void CCALL PFMLayer::FlushFile(PfmMarshallerFlushFileOp* op, void* formatterUse)
 				pOpenFile->writeTime_ = writeTime;
 				pOpenFile->createTime_ = writeTime;
 
-				fileStatCache_.forgetCachedStat(cipherName);
+				refreshCachedEntry(pOpenFile->pathName_, cipherName);
 			}
 		}
 
@@ -882,12 +1576,16 @@ void CCALL PFMLayer::FlushFile(PfmMarshallerFlushFileOp* op, void* formatterUse)
 			openExisting(pOpenFile, &openAttribs, pfmAccessLevelWriteData);
 	}
 
+	opTimer.setTraceResult(perr);
 	op->Complete(perr, &openAttribs, 0);
 }
 
 void CCALL PFMLayer::List(PfmMarshallerListOp* op, void* formatterUse)
 {
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opList);
+	boost::mutex::scoped_lock lock(mutex_);
 	int64_t openId = op->OpenId();
+	opTimer.setTraceTarget(openId);
 	int64_t listId = op->ListId();
 	int perr = 0;
 	bool noMore = false;
@@ -912,42 +1610,64 @@ void CCALL PFMLayer::List(PfmMarshallerListOp* op, void* formatterUse)
 
 	// Check whether listId already exists
 	FileList *pFileList = NULL;
-	std::list<FileList>::iterator iter = pOpenFile->fileLists_.begin();
-	while(iter != pOpenFile->fileLists_.end())
+	std::unordered_map<int64_t, FileList>::iterator iter = pOpenFile->fileLists_.find(listId);
+	if(iter != pOpenFile->fileLists_.end())
+		pFileList = &(iter->second);
+
+	// Continued once more after the end until ListEnd
+	if(pFileList != NULL && pFileList->isComplete_)
 	{
-		FileList &cur = *iter;
-		if(cur.listId_ == listId)
-		{
-			pFileList = &cur;
-		}
-		iter++;
+		op->Complete(perr, true);
+		return;
 	}
 
 	FileList fl;
 	if(pFileList == NULL)
 	{
-		try
+		DirListCache::ListingPtr pListing = dirListCache_.getListing(pOpenFile->pathName_);
+		if(!pListing)
+			pListing = restoreListing(pOpenFile->pathName_);
+		if(pListing)
 		{
-			// Create new list
-			encfs::DirTraverse dirT = rootFS_->root->openDir(pOpenFile->pathName_.c_str());
-			if(!dirT.valid())
-				perr = pfmErrorFailed;
-
-			if(perr == 0)
-			{
-				fl.listId_ = listId;
-				std::shared_ptr<encfs::DirTraverse> pDirTTemp(new encfs::DirTraverse(dirT));
-				fl.pDirT_ = pDirTTemp;
-				pOpenFile->fileLists_.push_back(fl);
-				pFileList = &(pOpenFile->fileLists_.back());
-			}
+			// Serve the list from the last complete listing of this folder
+			fl.listId_ = listId;
+			fl.pListing_ = pListing;
+			pFileList = &(pOpenFile->fileLists_[listId] = fl);
 		}
-		catch( encfs::Error &err )
+		else
 		{
-			reportEncFSMPErr(L"Could not open directory", pOpenFile->pathName_, err);
-			perr = pfmErrorFailed;
-		}
-
+			try
+			{
+				// Create new list
+				encfs::DirTraverse dirT = rootFS_->root->openDir(pOpenFile->pathName_.c_str());
+				if(!dirT.valid())
+					perr = pfmErrorFailed;
+
+				if(perr == 0)
+				{
+					fl.listId_ = listId;
+					std::shared_ptr<encfs::DirTraverse> pDirTTemp(new encfs::DirTraverse(dirT));
+					fl.pDirT_ = pDirTTemp;
+					fl.cipherDirPath_ = rootFS_->root->cipherPath(pOpenFile->pathName_.c_str());
+					// cipherPath() of the root folder ends with a separator, all others don't
+					char lastChar = fl.cipherDirPath_.empty() ? 0 : fl.cipherDirPath_[fl.cipherDirPath_.length() - 1];
+					if(lastChar != '/' && lastChar != '\\')
+						fl.cipherDirPath_ += '/';
+					if(dirListCache_.getCachesize() > 0)
+					{
+						fl.pNewListing_.reset(new DirListCache::Listing());
+						fl.listingGeneration_ = dirListCache_.getGeneration();
+					}
+					pFileList = &(pOpenFile->fileLists_[listId] = fl);
+				}
+			}
+			catch( encfs::Error &err )
+			{
+				reportEncFSMPErr(L"Could not open directory", pOpenFile->pathName_, err);
+				perr = pfmErrorFailed;
+			}
+		}
+
 		if(perr != 0)
 		{
 			op->Complete(perr, noMore);
@@ -955,6 +1675,36 @@ void CCALL PFMLayer::List(PfmMarshallerListOp* op, void* formatterUse)
 		}
 	}
 
+	if(pFileList->pListing_)
+	{
+		DirListCache::Listing &listing = *(pFileList->pListing_);
+		while(pFileList->listingPos_ < listing.size())
+		{
+			DirListCache::Entry &entry = listing[pFileList->listingPos_];
+			// The file was changed after the listing was collected
+			if(entry.isStale_ && !refreshListEntry(pOpenFile->pathName_, entry))
+			{
+				pFileList->listingPos_++;
+				continue;
+			}
+			if(!op->Add8(&(entry.attribs_), entry.name_.c_str()))
+				break;
+			notePrefetchName(pFileList, entry.name_, entry.attribs_);
+			pFileList->listingPos_++;
+		}
+
+		noMore = (pFileList->listingPos_ >= listing.size());
+		if(noMore)
+		{
+			postFirstBlockPrefetch(pOpenFile->pathName_.str(), pFileList);
+			// The cache may drop the listing from now on
+			pFileList->pListing_.reset();
+			pFileList->isComplete_ = true;
+		}
+		op->Complete(perr, noMore);
+		return;
+	}
+
 	// Process result from previous call
 	if(pFileList->hasPreviousResult_)
 	{
@@ -965,113 +1715,92 @@ void CCALL PFMLayer::List(PfmMarshallerListOp* op, void* formatterUse)
 			pFileList->hasPreviousResult_ = false;
 	}
 
+	// Kept between the entries, so that its memory is reused
+	std::string plainPath;
 	bool doCont = true;
 	while(doCont)
 	{
 		int fileType = 0;
 		try
 		{
-			std::string name = pFileList->pDirT_->nextPlaintextName(&fileType);
+			// Decode the names a batch at a time, in parallel
+			if(pFileList->batchPos_ >= pFileList->batch_.size())
+			{
+				pFileList->batch_ = pFileList->pDirT_->nextBatch(listBatchSize);
+				pFileList->batchPos_ = 0;
+			}
+			std::string name, cipherName;
+			efs_stat buf;
+			bool hasStat = false;
+			if(pFileList->batchPos_ < pFileList->batch_.size())
+			{
+				encfs::DirTraverse::Entry &entry = pFileList->batch_[pFileList->batchPos_++];
+				name.swap(entry.plainName);
+				cipherName.swap(entry.cipherName);
+				fileType = entry.fileType;
+				hasStat = entry.hasStat;
+				if(hasStat)
+					buf = entry.stat;
+			}
 			if(name.empty())
 			{
 				//listResult->NoMore();
 				noMore = true;
 				doCont = false;
+
+				if(pFileList->pNewListing_)
+				{
+					dirListCache_.addListing(pOpenFile->pathName_, pFileList->listingGeneration_,
+						pFileList->pNewListing_);
+					pFileList->pNewListing_.reset();
+				}
+				postFirstBlockPrefetch(pOpenFile->pathName_.str(), pFileList);
 			}
 			else
 			{
 				if(name != "." && name != "..")
 				{
-					std::string plainPath = fs_layer::concat_path(pOpenFile->pathName_, name, true);
-					std::string cpath = rootFS_->root->cipherPath(plainPath.c_str());
+					fs_layer::concat_path(pOpenFile->pathName_, name, plainPath, true);
+					// Same as rootFS_->root->cipherPath(plainPath), without encoding the name again
+					std::string cpath = pFileList->cipherDirPath_ + cipherName;
 
 					// Check whether a file with name plainPath is opened (and deleted)
 					bool isDeleted = false;
-					OpenFile *pOpenFile = findOpenFileByName(plainPath);
-					if(pOpenFile != NULL && pOpenFile->isDeleted_)
+					OpenFile *pEntryOpenFile = findOpenFileByName(plainPath);
+					if(pEntryOpenFile != NULL && pEntryOpenFile->isDeleted_)
 						isDeleted = true;
 
 					if(!isDeleted		// Skip deleted, but not yet closed files
-						&& !isSkippedFile(plainPath))
+						&& !skippedNames_.matches(plainPath))
 					{
-						efs_stat buf;
+						// The enumeration usually returned the stat data already,
+						// keep it for the Open requests following the listing
+						int statRet = 0;
+						int64_t plainSize = -1;
+						if(hasStat)
+							fileStatCache_.addStat(cpath.c_str(), &buf, &plainSize);
+						else
+							statRet = fileStatCache_.stat(cpath.c_str(), &buf, &plainSize);
 
-						if( !fileStatCache_.stat(cpath.c_str(), &buf) )		//fs_layer::lstat( cpath.c_str(), &buf ))
+						if( !statRet )		//fs_layer::lstat( cpath.c_str(), &buf ))
 						{
 							uint8_t wasAdded = 1;
 							PfmAttribs attribs;
-							bool skipThisFile = false;
-
-							if(S_ISREG(buf.st_mode))
-								attribs.fileType = pfmFileTypeFile;
-							else if(S_ISDIR(buf.st_mode))
-								attribs.fileType = pfmFileTypeFolder;
-							else
-								attribs.fileType = pfmFileTypeNone;
-							attribs.fileFlags = 0;
-							if((buf.st_mode & S_IWUSR) == 0)
-								attribs.fileFlags |= pfmFileFlagReadOnly;
-							if(isHiddenFile(plainPath))
-								attribs.fileFlags |= pfmFileFlagHidden;
-#if defined(EFS_MACOSX)
-							attribs.fileFlags |= pfmFileFlagArchive;	// Inverted logic of archive flag on OS X
-#endif
-							attribs.fileId = createFileId(plainPath);
-							attribs.fileSize = buf.st_size;
-							attribs.resourceSize = 0;
-							attribs.color = 0;
-							attribs.extraFlags = 0;
+							bool skipThisFile = !makeListAttribs(plainPath, cpath, buf, plainSize,
+								pEntryOpenFile, attribs);
 
-							if(attribs.fileType == pfmFileTypeFile)
+							if(!skipThisFile)
 							{
-								// Determine file size for unencrypted file
-								efs_stat buf_ue;
-								memset(&buf_ue, 0, sizeof(efs_stat));
-								bool getAttrSuccess = false;
-
-								try
+								if(pFileList->pNewListing_)
 								{
-									// If file is open, use this fileNode, as physical file might be locked
-									OpenFile *pOpenFile = findOpenFileByName(plainPath);
-									if(pOpenFile != NULL)
-									{
-										int err = pOpenFile->fileNode_->getAttr(&buf_ue, &fileStatCache_);
-										if(err == 0)
-											getAttrSuccess = true;
-									}
-
-									if(!getAttrSuccess)
-									{
-										int res = 0;
-										const int flags = makeOpenFileFlags(true);
-										std::shared_ptr<encfs::FileNode> fileNode = 
-											rootFS_->root->lookupNode( plainPath.c_str(), "open" );
-										if(fileNode)
-										{
-											int err = fileNode->getAttr(&buf_ue, &fileStatCache_);
-											if(err == 0)
-												getAttrSuccess = true;
-										}
-									}
+									DirListCache::Entry entry;
+									entry.name_ = name;
+									entry.attribs_ = attribs;
+									pFileList->pNewListing_->push_back(entry);
 								}
-								catch( encfs::Error &err )
-								{
-									reportEncFSMPErr(L"Error during directory listing", cpath, err);
-									skipThisFile = true;
-								}
-
-								if(!getAttrSuccess)
-									skipThisFile = true;
-								attribs.fileSize = buf_ue.st_size;
-							}
-
-							attribs.accessTime = UnixTimeToFileTime(buf.st_atime);
-							attribs.createTime = UnixTimeToFileTime(buf.st_ctime);
-							attribs.writeTime = UnixTimeToFileTime(buf.st_mtime);
-							attribs.changeTime = UnixTimeToFileTime(buf.st_mtime);
-
-							if(!skipThisFile)
+								notePrefetchName(pFileList, name, attribs);
 								wasAdded = op->Add8(&attribs, name.c_str());
+							}
 
 							if(!wasAdded)
 							{
@@ -1097,15 +1826,267 @@ void CCALL PFMLayer::List(PfmMarshallerListOp* op, void* formatterUse)
 		{
 			reportEncFSMPErr(L"Error in directory listing", "", err);
 			perr = pfmErrorFailed;
+			pFileList->pNewListing_.reset();
 		}
 	}
 
+	touchListing(pFileList->pDirT_, !noMore && perr == 0);
+	if(noMore)
+	{
+		// Closes the folder handle now rather than at ListEnd, which may come
+		// much later, or when the folder is closed
+		pFileList->pDirT_.reset();
+		std::vector<encfs::DirTraverse::Entry>().swap(pFileList->batch_);
+		pFileList->isComplete_ = true;
+	}
+
+	// Time to the first listing after mounting, usually of the root folder
+	uint64_t noListingYet = 0;
+	if(perr == 0)
+		firstListMicros_.compare_exchange_strong(noListingYet, static_cast<uint64_t>(
+			std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mountStartTime_).count()));
 	op->Complete(perr, noMore);
 }
 
+/**
+ * Remembers a listed file for prefetchFirstBlocks(), if it is small enough.
+ */
+void PFMLayer::notePrefetchName(FileList *pFileList, const std::string &name, const PfmAttribs &attribs)
+{
+	int64_t maxSize = firstBlockPrefetchBytes_;
+	if(maxSize > 0 && attribs.fileType == pfmFileTypeFile && attribs.fileSize > 0
+		&& attribs.fileSize <= maxSize && pFileList->prefetchNames_.size() < maxFirstBlockPrefetches)
+		pFileList->prefetchNames_.push_back(name);
+}
+
+/**
+ * Posts the small files of a completed listing to firstBlockQueue_.
+ * Must be called with mutex_ locked.
+ */
+void PFMLayer::postFirstBlockPrefetch(const std::string &dirPath, FileList *pFileList)
+{
+	if(pFileList->prefetchNames_.empty())
+		return;
+
+	std::vector<std::string> names;
+	names.swap(pFileList->prefetchNames_);
+	if(!rootFS_ || !rootFS_->blockCache)
+		return;
+	RootPtr rootFS = rootFS_;
+	firstBlockQueue_.post([this, rootFS, dirPath, names]() { prefetchFirstBlocks(rootFS, dirPath, names); });
+}
+
+/**
+ * Reads the beginning of the listed files, a background job of
+ * firstBlockQueue_. BlockFileIO decodes the whole first block, and the header
+ * of the file is read with it, so the block cache and the cache of the file
+ * IVs serve the reads of the first KB following the Open of the file.
+ *
+ * The files are read through a FileNode registered with libencfs, which an
+ * Open in the meantime shares, so a write can't be overtaken by the read.
+ * Files which are open already are skipped, they are in the caches anyway.
+ */
+void PFMLayer::prefetchFirstBlocks(RootPtr rootFS, const std::string &dirPath, const std::vector<std::string> &names)
+{
+	std::string plainPath;
+	for(size_t i = 0; i < names.size() && !firstBlockStop_; i++)
+	{
+		fs_layer::concat_path(dirPath, names[i], plainPath, true);
+		std::shared_ptr<encfs::FileNode> fileNode;
+		try
+		{
+			{
+				boost::mutex::scoped_lock lock(mutex_);
+				if(rootFS_ != rootFS)
+					return;
+				if(findOpenFileByName(plainPath) != NULL)
+					continue;
+				fileNode = rootFS->root->lookupNode(plainPath.c_str(), "EncFSMP");
+				if(!fileNode)
+					continue;
+				rootFS->root->retainNode(fileNode);
+			}
+
+#if defined(_WIN32)
+			int flags = O_BINARY | O_RDONLY;
+#else
+			int flags = O_RDONLY;
+#endif
+			unsigned char buf[1024];
+			if(fileNode->open(flags) >= 0 && fileNode->read(0, buf, sizeof(buf)) > 0)
+				prefetchedFirstBlocks_++;
+		}
+		catch( encfs::Error & )
+		{
+			// Only done in advance, the Open of the file reports the error
+		}
+
+		if(fileNode)
+			rootFS->root->releaseNode(fileNode);
+	}
+}
+
+/**
+ * Marks the listing as recently used, or removes it if isOpen is false.
+ *
+ * Listings which are not continued would otherwise keep their folder handle
+ * until the folder is closed. Beyond maxOpenListings, the least recently used
+ * listing closes its handle; it is resumed from its cookie when it is continued.
+ * Must be called with mutex_ locked.
+ */
+void PFMLayer::touchListing(const std::shared_ptr<encfs::DirTraverse> &pDirT, bool isOpen)
+{
+	std::list<std::weak_ptr<encfs::DirTraverse> >::iterator iter = openListings_.begin();
+	while(iter != openListings_.end())
+	{
+		std::shared_ptr<encfs::DirTraverse> cur = iter->lock();
+		if(!cur || cur == pDirT)
+			iter = openListings_.erase(iter);
+		else
+			iter++;
+	}
+
+	if(!isOpen || !pDirT || pDirT->paused())
+		return;
+	openListings_.push_back(pDirT);
+
+	while(openListings_.size() > maxOpenListings)
+	{
+		std::shared_ptr<encfs::DirTraverse> oldest = openListings_.front().lock();
+		openListings_.pop_front();
+		if(oldest && oldest->pause())
+			pausedListings_++;
+	}
+}
+
+/**
+ * Determines the attributes of a folder entry from the stat of its cipher file.
+ * Returns false if the entry is skipped. Must be called with mutex_ locked.
+ */
+bool PFMLayer::makeListAttribs(const std::string &plainPath, const std::string &cipherPath,
+	const efs_stat &buf, int64_t plainSize, OpenFile *pEntryOpenFile, PfmAttribs &attribs)
+{
+	bool skipThisFile = false;
+
+	if(S_ISREG(buf.st_mode))
+		attribs.fileType = pfmFileTypeFile;
+	else if(S_ISDIR(buf.st_mode))
+		attribs.fileType = pfmFileTypeFolder;
+	else
+		attribs.fileType = pfmFileTypeNone;
+	attribs.fileFlags = 0;
+	if((buf.st_mode & S_IWUSR) == 0)
+		attribs.fileFlags |= pfmFileFlagReadOnly;
+	if(hiddenNames_.matches(plainPath))
+		attribs.fileFlags |= pfmFileFlagHidden;
+#if defined(EFS_MACOSX)
+	attribs.fileFlags |= pfmFileFlagArchive;	// Inverted logic of archive flag on OS X
+#endif
+	attribs.fileId = createFileId(plainPath);
+	attribs.fileSize = buf.st_size;
+	attribs.resourceSize = 0;
+	attribs.color = 0;
+	attribs.extraFlags = 0;
+
+	if(attribs.fileType == pfmFileTypeFile)
+	{
+		// Determine file size for unencrypted file
+		efs_stat buf_ue;
+		memset(&buf_ue, 0, sizeof(efs_stat));
+		bool getAttrSuccess = false;
+
+		try
+		{
+			// If file is open, use this fileNode, as physical file might be locked
+			if(pEntryOpenFile != NULL && pEntryOpenFile->fileNode_)
+			{
+				int err = pEntryOpenFile->fileNode_->getAttr(&buf_ue, &fileStatCache_);
+				if(err == 0)
+					getAttrSuccess = true;
+			}
+
+			if(!getAttrSuccess)
+			{
+				// No need to construct a FileNode, the cache computed the size from buf
+				if(plainSize >= 0)
+				{
+					buf_ue.st_size = plainSize;
+					getAttrSuccess = true;
+				}
+			}
+
+			if(!getAttrSuccess && plainSize == -ENOTSUP)
+			{
+				// Compressed volume: the size is in the index of the file
+				std::shared_ptr<encfs::FileNode> fileNode =
+					rootFS_->root->lookupNode(plainPath.c_str(), "EncFSMP");
+				if(fileNode && fileNode->getAttr(&buf_ue, &fileStatCache_) == 0)
+					getAttrSuccess = true;
+			}
+		}
+		catch( encfs::Error &err )
+		{
+			reportEncFSMPErr(L"Error during directory listing", cipherPath, err);
+			skipThisFile = true;
+		}
+
+		if(!getAttrSuccess)
+			skipThisFile = true;
+		attribs.fileSize = buf_ue.st_size;
+		// The backing file lacks the data still in the write buffer
+		if(pEntryOpenFile != NULL && pEntryOpenFile->writeBuffer_)
+			attribs.fileSize = std::max<PT_UINT64>(attribs.fileSize, pEntryOpenFile->writeBuffer_->endOffset());
+	}
+
+	attribs.accessTime = UnixTimeToFileTime(buf.st_atime);
+	attribs.createTime = UnixTimeToFileTime(buf.st_ctime);
+	attribs.writeTime = UnixTimeToFileTime(buf.st_mtime);
+	attribs.changeTime = UnixTimeToFileTime(buf.st_mtime);
+
+	return !skipThisFile;
+}
+
+/**
+ * Determines the attributes of an entry of a cached listing again, after the file
+ * was changed. Returns false if the entry is skipped. Must be called with mutex_ locked.
+ */
+bool PFMLayer::refreshListEntry(const std::string &dirPath, DirListCache::Entry &entry)
+{
+	std::string plainPath;
+	fs_layer::concat_path(dirPath, entry.name_, plainPath, true);
+
+	// Skip deleted, but not yet closed files
+	OpenFile *pEntryOpenFile = findOpenFileByName(plainPath);
+	if((pEntryOpenFile != NULL && pEntryOpenFile->isDeleted_)
+		|| skippedNames_.matches(plainPath))
+		return false;
+
+	try
+	{
+		std::string cpath = rootFS_->root->cipherPath(plainPath.c_str());
+		efs_stat buf;
+		int64_t plainSize = -1;
+		if(fileStatCache_.stat(cpath.c_str(), &buf, &plainSize) != 0)
+			return false;
+		if(!makeListAttribs(plainPath, cpath, buf, plainSize, pEntryOpenFile, entry.attribs_))
+			return false;
+	}
+	catch( encfs::Error &err )
+	{
+		reportEncFSMPErr(L"Error in directory listing", plainPath, err);
+		return false;
+	}
+
+	entry.isStale_ = false;
+	return true;
+}
+
 void CCALL PFMLayer::ListEnd(PfmMarshallerListEndOp* op, void* formatterUse)
 {
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opListEnd);
+	boost::mutex::scoped_lock lock(mutex_);
 	int64_t openId = op->OpenId();
+	opTimer.setTraceTarget(openId);
 	int64_t listId = op->ListId();
 	int perr = 0;
 
@@ -1114,95 +2095,109 @@ void CCALL PFMLayer::ListEnd(PfmMarshallerListEndOp* op, void* formatterUse)
 	OpenFile *pOpenFile = getOpenFile(openId);
 	if(perr == 0 && pOpenFile == NULL)
 		perr = pfmErrorFailed;
-	if(perr = 0 && pOpenFile->isFile_)
+	if(perr == 0 && pOpenFile->isFile_)
 		perr = pfmErrorNotAFolder;
 
 	if(perr == 0)
-	{
-		FileList *pFileList = NULL;
-		std::list<FileList>::iterator iter = pOpenFile->fileLists_.begin();
-		while(iter != pOpenFile->fileLists_.end())
-		{
-			FileList &cur = *iter;
-			if(cur.listId_ == listId)
-			{
-				pOpenFile->fileLists_.erase(iter);
-				op->Complete(perr);
-				return;
-			}
-			iter++;
-		}
-	}
+		pOpenFile->fileLists_.erase(listId);
 	op->Complete(perr);
 }
 
 void CCALL PFMLayer::Read(PfmMarshallerReadOp* op, void* formatterUse)
 {
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opRead);
 	int64_t openId = op->OpenId();
 	uint64_t fileOffset = op->FileOffset();
 	void* data = op->Data();
 	size_t requestedSize = op->RequestedSize();
+	opTimer.setTraceTarget(openId, static_cast<int64_t>(fileOffset), requestedSize);
 	int perr = 0;
 	size_t actualSize = 0;
 
-	OpenFile *pOpenFile = getOpenFile(openId);
-	if(pOpenFile == NULL)
-		perr = pfmErrorFailed;
-	if((perr == 0) && (!pOpenFile->isFile_))
-		perr = pfmErrorNotAFile;
-	if((perr == 0) && (pOpenFile->isDeleted_))
-		perr = pfmErrorDeleted;
+	// Doesn't need the global lock, the FileNode does its own locking
+	std::shared_ptr<ReadAheadBuffer> readAhead;
+	std::shared_ptr<WriteBuffer> writeBuffer;
+	std::shared_ptr<encfs::FileNode> fileNode = getOpenFileNode(openId, perr, &readAhead, &writeBuffer);
+
+	if(perr == 0 && writeBuffer && !writeBuffer->isEmpty())
+	{
+		// Written data must be readable
+		boost::mutex::scoped_lock lock(mutex_);
+		OpenFile *pOpenFile = getOpenFile(openId);
+		if(pOpenFile != NULL)
+			perr = flushWriteBuffer(pOpenFile);
+	}
 
 	if(perr == 0)
 	{
-		std::shared_ptr<encfs::FileNode> fileNode = pOpenFile->fileNode_;
 		if(!fileNode)
 			perr = pfmErrorFailed;
 		else
 		{
 			try
 			{
-				ssize_t actSize = fileNode->read(static_cast<efs_off_t>(fileOffset), reinterpret_cast<unsigned char *>(data), requestedSize);
-				actualSize = actSize;
+				bool isBuffered = (readAhead && readAhead->read(fileOffset,
+					reinterpret_cast<unsigned char *>(data), requestedSize, actualSize));
+				if(isBuffered)
+					readAheadHits_++;
+				else
+				{
+					if(readAhead)
+						readAheadMisses_++;
+					ssize_t actSize = fileNode->read(static_cast<efs_off_t>(fileOffset), reinterpret_cast<unsigned char *>(data), requestedSize);
+					if(actSize < 0)
+						perr = pfmErrorFailed;
+					else
+						actualSize = actSize;
+				}
+
+				// Read the following data in the background, if the file is read sequentially
+				if(perr == 0 && readAhead && readAhead->registerRead(fileOffset, actualSize))
+					readAheadWorker_.post(readAhead, fileNode);
 			}
 			catch(encfs::Error &err)
 			{
-				reportEncFSMPErr(L"Error during read operation", pOpenFile->pathName_, err);
+				reportEncFSMPErr(L"Error during read operation", fileNode->plaintextName(), err);
 				perr = pfmErrorFailed;
 			}
 		}
 	}
+	opTimer.setBytes(actualSize);
+	opTimer.setTraceResult(perr);
 	op->Complete(perr, actualSize);
 }
 
 void CCALL PFMLayer::Write(PfmMarshallerWriteOp* op, void* formatterUse)
 {
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opWrite);
 	int64_t openId = op->OpenId();
 	uint64_t fileOffset = op->FileOffset();
 	const void* data = op->Data();
 	size_t requestedSize = op->RequestedSize();
+	opTimer.setTraceTarget(openId, static_cast<int64_t>(fileOffset), requestedSize);
 	int perr = 0;
 	size_t actualSize = 0;
 
-	OpenFile *pOpenFile = getOpenFile(openId);
-	if(pOpenFile == NULL)
-		perr = pfmErrorFailed;
-	if((perr == 0) && (!pOpenFile->isFile_))
-		perr = pfmErrorNotAFile;
-	if((perr == 0) && (pOpenFile->isDeleted_))
-		perr = pfmErrorDeleted;
+	std::shared_ptr<ReadAheadBuffer> readAhead;
+	std::shared_ptr<WriteBuffer> writeBuffer;
+	std::shared_ptr<encfs::FileNode> fileNode = getOpenFileNode(openId, perr, &readAhead, &writeBuffer);
+	if(perr == 0 && readOnly_)
+		perr = pfmErrorAccessDenied;
 
 	if(perr == 0)
 	{
-		std::shared_ptr<encfs::FileNode> fileNode = pOpenFile->fileNode_;
 		if(!fileNode)
 			perr = pfmErrorFailed;
 		else
 		{
 			try
 			{
-				bool isOK = fileNode->write(static_cast<efs_off_t>(fileOffset), const_cast<unsigned char *>(reinterpret_cast<const unsigned char *>(data)),
-					requestedSize);
+				bool isOK = false;
+				if(writeBuffer)
+					isOK = writeBuffer->write(fileNode, fileOffset, reinterpret_cast<const unsigned char *>(data), requestedSize);
+				else	// The FileIO layers encode into buffers of their own, data is not modified
+					isOK = fileNode->write(static_cast<efs_off_t>(fileOffset), const_cast<unsigned char *>(reinterpret_cast<const unsigned char *>(data)),
+						requestedSize);
 				if(isOK)
 					actualSize = requestedSize;
 				else
@@ -1212,36 +2207,72 @@ void CCALL PFMLayer::Write(PfmMarshallerWriteOp* op, void* formatterUse)
 			}
 			catch(encfs::Error &err)
 			{
-				reportEncFSMPErr(L"Error during write operation", pOpenFile->pathName_, err);
+				reportEncFSMPErr(L"Error during write operation", fileNode->plaintextName(), err);
 				perr = pfmErrorFailed;
 			}
+			if(readAhead)
+				readAhead->invalidate();
+			{
+				boost::mutex::scoped_lock lock(mutex_);
+				OpenFile *pOpenFile = getOpenFile(openId);
+				// Size and/or last write time has changed, forget cached file stat.
+				// Also after a failure, the write buffer may have been written out
+				refreshCachedEntry(fileNode->plaintextName(), fileNode->cipherName());
+				if(perr == 0)
+				{
+					if(pOpenFile != NULL)
+					{
+						// Keeps the record answering Access up to date
+						pOpenFile->fileSize_ = std::max<PT_UINT64>(pOpenFile->fileSize_, fileOffset + actualSize);
+						pOpenFile->writeTime_ = pOpenFile->changeTime_ = UnixTimeToFileTime(time(NULL));
+					}
+				}
+				else if(pOpenFile != NULL)
+				{
+					// A part may have been written
+					pOpenFile->isStale_ = true;
+				}
+			}
 			if(perr == 0)
 			{
-				// Size and/or last write time has changed, forget cached file stat
-				fileStatCache_.forgetCachedStat(fileNode->cipherName());
+				changeJournal_.record(ChangeJournal::changeWritten, fileNode->cipherName());
+				if(useNameIndex_)
+					nameIndex_.written(fileNode->plaintextName(), static_cast<int64_t>(fileOffset + actualSize),
+						static_cast<int64_t>(time(NULL)), false);
 			}
 		}
 	}
+	bytesWrittenSinceCapacity_ += actualSize;
+	opTimer.setBytes(actualSize);
+	opTimer.setTraceResult(perr);
 	op->Complete(perr, actualSize);
 }
 
 void CCALL PFMLayer::SetSize(PfmMarshallerSetSizeOp* op, void* formatterUse)
 {
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opSetSize);
 	int64_t openId = op->OpenId();
 	uint64_t fileSize = op->FileSize();
+	opTimer.setTraceTarget(openId, static_cast<int64_t>(fileSize));
 	int perr = 0;
 
-	OpenFile *pOpenFile = getOpenFile(openId);
-	if(pOpenFile == NULL)
-		perr = pfmErrorFailed;
-	if((perr == 0) && (!pOpenFile->isFile_))
-		perr = pfmErrorNotAFile;
-	if((perr == 0) && (pOpenFile->isDeleted_))
-		perr = pfmErrorDeleted;
+	std::shared_ptr<ReadAheadBuffer> readAhead;
+	std::shared_ptr<WriteBuffer> writeBuffer;
+	std::shared_ptr<encfs::FileNode> fileNode = getOpenFileNode(openId, perr, &readAhead, &writeBuffer);
+	if(perr == 0 && readOnly_)
+		perr = pfmErrorAccessDenied;
+
+	if(perr == 0 && writeBuffer)
+	{
+		// Buffered data beyond the new size must not be written afterwards
+		boost::mutex::scoped_lock lock(mutex_);
+		OpenFile *pOpenFile = getOpenFile(openId);
+		if(pOpenFile != NULL)
+			perr = flushWriteBuffer(pOpenFile);
+	}
 
 	if(perr == 0)
 	{
-		std::shared_ptr<encfs::FileNode> fileNode = pOpenFile->fileNode_;
 		if(!fileNode)
 			perr = pfmErrorFailed;
 		else
@@ -1254,70 +2285,255 @@ void CCALL PFMLayer::SetSize(PfmMarshallerSetSizeOp* op, void* formatterUse)
 			}
 			catch( encfs::Error &err )
 			{
-				reportEncFSMPErr(L"Error during SetSize operation", pOpenFile->pathName_, err);
+				reportEncFSMPErr(L"Error during SetSize operation", fileNode->plaintextName(), err);
 				perr = pfmErrorFailed;
 			}
+			if(readAhead)
+				readAhead->invalidate();
 
 			if(perr == 0)
 			{
 				// Size has changed, forget cached file stat
-				fileStatCache_.forgetCachedStat( fileNode->cipherName() );
+				boost::mutex::scoped_lock lock(mutex_);
+				refreshCachedEntry(fileNode->plaintextName(), fileNode->cipherName());
 
-				pOpenFile->fileSize_ = fileSize;
+				OpenFile *pOpenFile = getOpenFile(openId);
+				if(pOpenFile != NULL)
+				{
+					pOpenFile->fileSize_ = fileSize;
+					pOpenFile->writeTime_ = pOpenFile->changeTime_ = UnixTimeToFileTime(time(NULL));
+				}
+			}
+			else
+			{
+				boost::mutex::scoped_lock lock(mutex_);
+				OpenFile *pOpenFile = getOpenFile(openId);
+				if(pOpenFile != NULL)
+					pOpenFile->isStale_ = true;
+			}
+			if(perr == 0)
+			{
+				changeJournal_.record(ChangeJournal::changeWritten, fileNode->cipherName());
+				if(useNameIndex_)
+					nameIndex_.written(fileNode->plaintextName(), static_cast<int64_t>(fileSize),
+						static_cast<int64_t>(time(NULL)), true);
 			}
 		}
 	}
+	opTimer.setTraceResult(perr);
 	op->Complete(perr);
 }
 
 void CCALL PFMLayer::Capacity(PfmMarshallerCapacityOp* op, void* formatterUse)
 {
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opCapacity);
 	uint64_t totalCapacity = 0;
 	uint64_t availableCapacity = 0;
 	int perr = 0;
 
-	// Retrieve absolute path of encrypted directory
-	if(!rootFS_)
+	if(rootDir_.empty())
 		perr = pfmErrorFailed;
 	else
 	{
-		std::string rootDir = rootFS_->root->rootDirectory();
-
-		uint64_t totalCapacityLocal, availableCapacityLocal;
-		if(!fs_layer::capacity(rootDir, totalCapacityLocal, availableCapacityLocal))
+		fs_layer::statvfs_fs fs;
+		if(!volumeStat(fs))
+		{
 			perr = pfmErrorInvalid;
-
-		totalCapacity = totalCapacityLocal;
-		availableCapacity = availableCapacityLocal;
+		}
+		else
+		{
+			totalCapacity = fs.f_blocks * fs.f_frsize;
+			availableCapacity = fs.f_bavail * fs.f_frsize;
+		}
 	}
 	op->Complete(perr, totalCapacity, availableCapacity);
 }
 
-void CCALL PFMLayer::FlushMedia(PfmMarshallerFlushMediaOp* op, void* formatterUse)
+/**
+ * Stat of the volume containing the encrypted directory.
+ *
+ * Explorer asks for the capacity all the time, and the underlying volume
+ * might be a network share. Reuse the last result for capacityCacheTime_,
+ * with the free blocks reduced by the amount of data written since.
+ */
+bool PFMLayer::volumeStat(fs_layer::statvfs_fs &fs)
 {
-	op->Complete(pfmErrorSuccess, -1/*msecFlushDelay*/);
+	boost::mutex::scoped_lock lock(capacityMutex_);
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if(!hasCachedCapacity_
+		|| now - capacityTime_ >= std::chrono::milliseconds(capacityCacheTime_))
+	{
+		fs_layer::statvfs_fs fsLocal;
+		if(fs_layer::statvfs(rootDir_.c_str(), &fsLocal) != 0 || fsLocal.f_frsize == 0)
+		{
+			hasCachedCapacity_ = false;
+			return false;
+		}
+		hasCachedCapacity_ = true;
+		capacityTime_ = now;
+		cachedVolumeStat_ = fsLocal;
+		bytesWrittenSinceCapacity_ = 0;
+	}
+
+	fs = cachedVolumeStat_;
+	uint64_t blocksWritten = (bytesWrittenSinceCapacity_ + fs.f_frsize - 1) / fs.f_frsize;
+	fs.f_bfree -= std::min(blocksWritten, fs.f_bfree);
+	fs.f_bavail -= std::min(blocksWritten, fs.f_bavail);
+	return true;
 }
 
-void CCALL PFMLayer::Control(PfmMarshallerControlOp* op, void* formatterUse)
+/**
+ * Number of requests served so far, without the volume queries Explorer
+ * sends all the time while a window of the drive is open.
+ */
+uint64_t PFMLayer::activityCount() const
 {
-	op->Complete(pfmErrorInvalid, 0/*outputSize*/);
+	uint64_t count = 0;
+	for(int i = 0; i < FormatterStats::opCount; i++)
+	{
+		FormatterStats::Operation op = static_cast<FormatterStats::Operation>(i);
+		if(op != FormatterStats::opCapacity && op != FormatterStats::opMediaInfo
+			&& op != FormatterStats::opControl)
+			count += stats_.callCount(op);
+	}
+	return count;
 }
 
-void CCALL PFMLayer::MediaInfo(PfmMarshallerMediaInfoOp* op, void* formatterUse)
+/**
+ * Called by the CacheTrimmer once per cycle while the drive is busy. Feeds
+ * the counters of the caches and the requests to the CacheAutoTuner and puts
+ * the tuning it arrives at into effect.
+ */
+void PFMLayer::autoTune()
 {
-	PfmMediaInfo mediaInfo = zeroMediaInfo;
-	std::wstring mediaLabel = mountName_;
+	boost::mutex::scoped_lock tuningLock(tuningMutex_);
+	if(!baseTuning_.autoTune_)
+		return;
 
-	op->Complete(pfmErrorSuccess, &mediaInfo, mediaLabel.c_str());
+	CacheAutoTuner::Sample sample;
+	sample.time_ = std::chrono::steady_clock::now();
+	RootPtr rootFS = isUnlocked_ ? rootFS_ : RootPtr();
+	if(rootFS && rootFS->blockCache)
+	{
+		sample.blockCacheHits_ = rootFS->blockCache->hits();
+		sample.blockCacheMisses_ = rootFS->blockCache->misses();
+		sample.blockCacheBytes_ = rootFS->blockCache->bytesUsed();
+	}
+	sample.statCacheHits_ = fileStatCache_.getHits();
+	sample.statCacheMisses_ = fileStatCache_.getMisses();
+	sample.readAheadHits_ = readAheadHits_.load();
+	sample.readAheadMisses_ = readAheadMisses_.load();
+	for(int i = 0; i < FormatterStats::opCount; i++)
+		sample.busyMicros_ += stats_.totalMicros(static_cast<FormatterStats::Operation>(i));
+	sample.cpuMicros_ = CacheAutoTuner::processCPUMicros();
+
+	CacheTuning tuning(cacheTuning_);
+	if(!autoTuner_.update(sample, baseTuning_, tuning))
+		return;
+	// A drive served by one thread stays so
+	if(dispatchPool_ == NULL)
+		tuning.threadCount_ = cacheTuning_.threadCount_;
+	setTuning(tuning);
+	autoTunings_++;
 }
 
-void CCALL PFMLayer::Access(PfmMarshallerAccessOp* op, void* formatterUse)
+/**
+ * Called by the CacheTrimmer while the drive is idle, and with shedAll when
+ * the system is low on memory. Idle drives keep their stat cache and half of
+ * their decoded blocks per cycle, listings are read again quickly.
+ */
+void PFMLayer::trimCaches(bool shedAll)
 {
-	int64_t openId = op->OpenId();
-	int8_t accessLevel = op->AccessLevel();
+	{
+		// The idle time would count as a cycle without requests
+		boost::mutex::scoped_lock tuningLock(tuningMutex_);
+		autoTuner_.reset();
+	}
+	boost::mutex::scoped_lock lock(mutex_);
+	if(!rootFS_)
+		return;
 
-	int perr = 0;
-	PfmOpenAttribs openAttribs = zeroOpenAttribs;
+	dirListCache_.clearCache();
+	negativeLookupCache_.clearCache();
+	if(shedAll)
+	{
+		fileStatCache_.clearCache();
+		cacheSnapshot_.clear();
+	}
+	if(rootFS_->blockCache)
+		rootFS_->blockCache->trim(shedAll ? 0 : rootFS_->blockCache->bytesUsed() / 2);
+}
+
+void CCALL PFMLayer::FlushMedia(PfmMarshallerFlushMediaOp* op, void* formatterUse)
+{
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opFlushMedia);
+	int perr = flushAllFiles();
+	opTimer.setTraceResult(perr);
+	op->Complete(perr, -1/*msecFlushDelay*/);
+}
+
+void CCALL PFMLayer::Control(PfmMarshallerControlOp* op, void* formatterUse)
+{
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opControl);
+	if(op->ControlCode() == FormatterStats::controlCodeDeleteContents)
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		int64_t openId = op->OpenId();
+		opTimer.setTraceTarget(openId);
+		uint64_t removedCount = 0;
+		int perr = 0;
+
+		OpenFile *pOpenFile = getOpenFile(openId);
+		if(pOpenFile == NULL)
+			perr = pfmErrorFailed;
+		else
+			perr = deleteContentsOp(pOpenFile, removedCount);
+		lock.unlock();
+
+		size_t outputSize = 0;
+		if(perr == 0)
+		{
+			std::stringstream ostr;
+			ostr << removedCount;
+			std::string result = ostr.str();
+			outputSize = std::min(result.length(), op->MaxOutputSize());
+			memcpy(op->Output(), result.c_str(), outputSize);
+		}
+		opTimer.setTraceResult(perr);
+		op->Complete(perr, outputSize);
+		return;
+	}
+	if(op->ControlCode() != FormatterStats::controlCodeGetStats)
+	{
+		op->Complete(pfmErrorInvalid, 0/*outputSize*/);
+		return;
+	}
+
+	std::string report = stats_.report();
+	size_t outputSize = std::min(report.length(), op->MaxOutputSize());
+	memcpy(op->Output(), report.c_str(), outputSize);
+	op->Complete(pfmErrorSuccess, outputSize);
+}
+
+void CCALL PFMLayer::MediaInfo(PfmMarshallerMediaInfoOp* op, void* formatterUse)
+{
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opMediaInfo);
+	PfmMediaInfo mediaInfo = zeroMediaInfo;
+	std::wstring mediaLabel = mountName_;
+
+	op->Complete(pfmErrorSuccess, &mediaInfo, mediaLabel.c_str());
+}
+
+void CCALL PFMLayer::Access(PfmMarshallerAccessOp* op, void* formatterUse)
+{
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opAccess);
+	boost::mutex::scoped_lock lock(mutex_);
+	int64_t openId = op->OpenId();
+	opTimer.setTraceTarget(openId);
+	int8_t accessLevel = op->AccessLevel();
+
+	int perr = 0;
+	PfmOpenAttribs openAttribs = zeroOpenAttribs;
 
 	OpenFile *pOpenFile = getOpenFile(openId);
 	if(pOpenFile == NULL)
@@ -1328,30 +2544,35 @@ void CCALL PFMLayer::Access(PfmMarshallerAccessOp* op, void* formatterUse)
 		// Check for access level and fail if source file is not writable
 		if(accessLevel >= pfmAccessLevelWriteData)
 		{
-			if(pOpenFile->isReadOnly_)
+			if(pOpenFile->isReadOnly_ || readOnly_)
 				perr = pfmErrorAccessDenied;
 
 			if((perr == 0) && (pOpenFile->isOpenedReadOnly_))
 			{
-				// Try to reopen file with write access
-				pOpenFile->fileNode_.reset();
-
+				// Try to reopen file with write access. The FileNode is shared
+				// through libencfs, so this upgrades the open node
 				int res = 0;
-				pOpenFile->fileNode_ =
+				std::shared_ptr<encfs::FileNode> fileNode =
 					rootFS_->root->openNode(pOpenFile->pathName_.c_str(), "open", makeOpenFileFlags(accessLevel), &res);
-				if(!pOpenFile->fileNode_)
+				if(!fileNode)
 				{
 					// Failed, try to open again for reading
-					pOpenFile->fileNode_ =
+					fileNode =
 						rootFS_->root->openNode(pOpenFile->pathName_.c_str(), "open", makeOpenFileFlags(pfmAccessLevelReadData), &res);
 					perr = pfmErrorAccessDenied;
 				}
+				pOpenFile->fd_ = fileNode ? res : -1;
+				setOpenFileNode(pOpenFile, fileNode);
 				if(perr == 0)
 					pOpenFile->isOpenedReadOnly_ = false;
 			}
 		}
 #endif
 
+		// Answered from the record, which Write and SetSize keep up to date
+		if(perr == 0 && pOpenFile->isStale_)
+			refreshOpenFile(pOpenFile);
+
 		if(perr == 0)
 		{
 			pOpenFile->sequenceId_++;
@@ -1379,27 +2600,25 @@ void CCALL PFMLayer::Access(PfmMarshallerAccessOp* op, void* formatterUse)
 
 void CCALL PFMLayer::ReadXattr(PfmMarshallerReadXattrOp* op, void* formatterUse)
 {
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opReadXattr);
 	op->Complete(pfmErrorNotFound, 0/*xattrSize*/, 0/*transferredSize*/);
 }
 
 void CCALL PFMLayer::WriteXattr(PfmMarshallerWriteXattrOp* op, void* formatterUse)
 {
+	FormatterStats::OpTimer opTimer(stats_, FormatterStats::opWriteXattr);
 	op->Complete(pfmErrorAccessDenied, 0/*transferredSize*/);
 }
 
-int64_t PFMLayer::getFileID(const std::string &path)
+int64_t PFMLayer::getFileID(const encfs::InternedPath &path)
 {
-	FileIDMap::const_iterator iter = fileIDs_.find(path);
-	if(iter == fileIDs_.end())
-		return -1;
-
-	return iter->second;
+	return fileIDs_.find(path);
 }
 
-int64_t PFMLayer::addFileID(const std::string &path)
+int64_t PFMLayer::addFileID(const encfs::InternedPath &path)
 {
 	int64_t newID = newFileID_++;
-	fileIDs_[path] = newID;
+	fileIDs_.add(path, newID);
 
 /*
 	std::stringstream ostr;
@@ -1412,52 +2631,67 @@ int64_t PFMLayer::addFileID(const std::string &path)
 	return newID;
 }
 
+/**
+ * The IDs below a renamed folder move along with it.
+ */
 bool PFMLayer::renameFileID(int64_t fileId, const std::string &newpath)
 {
-	FileIDMap::iterator iter = fileIDs_.begin();
-	while(iter != fileIDs_.end())
-	{
-		int64_t curFileId = iter->second;
-		if(curFileId == fileId)
-		{
-			fileIDs_.erase(iter);
-			fileIDs_[newpath] = fileId;
-			return true;
-		}
-
-		iter++;
-	}
-
-	return false;
+	return fileIDs_.rename(fileId, newpath);
 }
 
 bool PFMLayer::deleteFileID(int64_t fileId)
 {
-	FileIDMap::iterator iter = fileIDs_.begin();
-	while(iter != fileIDs_.end())
-	{
-		int64_t curFileId = iter->second;
-		if(curFileId == fileId)
-		{
-			fileIDs_.erase(iter);
-			return true;
-		}
-
-		iter++;
-	}
+	return fileIDs_.remove(fileId);
+}
 
-	return false;
+PFMLayer::OpenFileShard &PFMLayer::getOpenFileShard(int64_t openId)
+{
+	return openFileShards_[static_cast<uint64_t>(openId) % openFileShardCount_];
 }
 
 PFMLayer::OpenFile *PFMLayer::getOpenFile(int64_t openId)
 {
-	OpenFileMapType::iterator iter = openFiles_.find(openId);
-	if(iter != openFiles_.end())
-		return &(iter->second);
+	OpenFileShard &shard = getOpenFileShard(openId);
+	boost::mutex::scoped_lock shardLock(shard.mutex_);
+	OpenFileMapType::iterator iter = shard.openFiles_.find(openId);
+	if(iter != shard.openFiles_.end())
+		return iter->second.get();
 
 	return NULL;
 }
 
+/**
+ * Returns the FileNode of an open file for Read, Write and SetSize.
+ *
+ * Only the shard of openId is locked, not the global mutex_.
+ */
+std::shared_ptr<encfs::FileNode> PFMLayer::getOpenFileNode(int64_t openId, int &perr,
+	std::shared_ptr<ReadAheadBuffer> *readAhead, std::shared_ptr<WriteBuffer> *writeBuffer)
+{
+	OpenFileShard &shard = getOpenFileShard(openId);
+	boost::mutex::scoped_lock shardLock(shard.mutex_);
+	OpenFileMapType::iterator iter = shard.openFiles_.find(openId);
+	if(iter == shard.openFiles_.end())
+	{
+		perr = pfmErrorFailed;
+		return std::shared_ptr<encfs::FileNode>();
+	}
+
+	OpenFile &cur = *(iter->second);
+	if(!cur.isFile_)
+		perr = pfmErrorNotAFile;
+	else if(cur.isDeleted_)
+		perr = pfmErrorDeleted;
+	if(perr != 0)
+		return std::shared_ptr<encfs::FileNode>();
+
+	if(readAhead != NULL)
+		*readAhead = cur.readAhead_;
+	if(writeBuffer != NULL)
+		*writeBuffer = cur.writeBuffer_;
+	return std::atomic_load(&cur.fileNode_);
+}
+
 PFMLayer::OpenFile *PFMLayer::findOpenFileByName(const std::string &path)
 {
 	OpenIdMapType::iterator iter = openIdMap_.find(path);
@@ -1468,7 +2702,10 @@ PFMLayer::OpenFile *PFMLayer::findOpenFileByName(const std::string &path)
 	return NULL;
 }
 
-int64_t PFMLayer::createFileId(const std::string &fn)
+/**
+ * fn is interned once for both lookups, callers may pass a std::string.
+ */
+int64_t PFMLayer::createFileId(const encfs::InternedPath &fn)
 {
 	int64_t fileId = getFileID(fn);
 	if(fileId < 0)	// not found
@@ -1481,14 +2718,29 @@ int64_t PFMLayer::createFileId(const std::string &fn)
 
 void PFMLayer::createEndName(std::wstring &endName, const char *fullPathName)
 {
-	// Convert filename from UTF8 to UTF16
-	std::string fileName = fs_layer::extract_filename(std::string(fullPathName));
-	endName = boost::locale::conv::utf_to_utf<wchar_t>(fileName.c_str());
+	// Convert the file name from UTF8 to UTF16 in place, without copying the path
+	const char *fileName = fullPathName;
+	for(const char *p = fullPathName; *p != '\0'; p++)
+	{
+		if(*p == '/' || *p == '\\')
+			fileName = p + 1;
+	}
+	if(*fileName == '\0')
+	{
+		// A folder path with a trailing separator, or the root
+		std::string name = fs_layer::extract_filename(std::string(fullPathName));
+		UTFConvert::toWide(name.data(), name.length(), endName);
+		return;
+	}
+	UTFConvert::toWide(fileName, strlen(fileName), endName);
 }
 
 int PFMLayer::createOp(const std::string &path, int8_t createFileType, uint8_t createFileFlags,
 	int64_t writeTime, int64_t newCreateOpenId,PfmOpenAttribs* openAttribs)
 {
+	if(readOnly_)
+		return pfmErrorAccessDenied;
+
 	try
 	{
 		if(createFileType == pfmFileTypeFile)
@@ -1553,35 +2805,46 @@ int PFMLayer::createOp(const std::string &path, int8_t createFileType, uint8_t c
 
 			// Before actually creating the file, delete entry in fileStatCache with same name
 			std::string cipherPath = rootFS_->root->cipherPath(path.c_str());
-			fileStatCache_.forgetCachedStat( cipherPath.c_str() );
+			forgetCachedEntry(path, cipherPath.c_str());
 
 
 			res = fileNodeNew->mknod( mode, 0 );
 			if(res != 0)
 				return pfmErrorAccessDenied;
+			changeJournal_.record(ChangeJournal::changeCreated, cipherPath);
+			if(useNameIndex_ && !skippedNames_.matches(path))
+			{
+				NameIndex::Entry indexEntry;
+				indexEntry.mtime = static_cast<int64_t>(FileTimeToUnixTime(writeTime));
+				nameIndex_.add(path, indexEntry);
+			}
 
 			// mknod creates a file, but does not open it.
 			res = fileNodeNew->open( flags );
 			if(res < 0)
 				return pfmErrorFailed;
 
-			OpenFile of;
-			of.isFile_ = true;
-			of.fileNode_ = fileNodeNew;
-			of.openId_ = newCreateOpenId;
-			of.sequenceId_ = 1;
-			of.fd_ = res;
-			of.pathName_ = path;
-			of.isOpenedReadOnly_ = (accessLevel < pfmAccessLevelWriteData);
-			of.isReadOnly_ = false;
-			of.fileId_ = createFileId(path);
+			std::unique_ptr<OpenFile> of(new OpenFile);
+			of->isFile_ = true;
+			setOpenFileNode(of.get(), fileNodeNew);
+			of->openId_ = newCreateOpenId;
+			of->sequenceId_ = 1;
+			of->fd_ = res;
+			// PFM passes no hints of the application, a new file is written once
+			applyAccessHint(of.get(), fileNodeNew.get(), encfs::Access_WriteOnce);
+			if(useWriteBuffer_ && writeBufferBytes_ > 0)
+				of->writeBuffer_.reset(new WriteBuffer(writeBufferBytes_));
+			of->pathName_ = path;
+			of->isOpenedReadOnly_ = (accessLevel < pfmAccessLevelWriteData);
+			of->isReadOnly_ = false;
+			of->fileId_ = createFileId(path);
 
 			openAttribs->openId = newCreateOpenId;
 			openAttribs->openSequence = 1;
 			openAttribs->accessLevel = accessLevel;
 			openAttribs->attribs.fileType = pfmFileTypeFile;
 			openAttribs->attribs.fileFlags = createFileFlags;
-			openAttribs->attribs.fileId = of.fileId_;
+			openAttribs->attribs.fileId = of->fileId_;
 			openAttribs->attribs.fileSize = 0;
 
 			openAttribs->attribs.accessTime = writeTime;
@@ -1589,14 +2852,14 @@ int PFMLayer::createOp(const std::string &path, int8_t createFileType, uint8_t c
 			openAttribs->attribs.writeTime = writeTime;
 			openAttribs->attribs.changeTime = writeTime;
 
-			of.fileFlags_ = openAttribs->attribs.fileFlags;	// Store attributes in OpenFile class
-			of.fileSize_ = openAttribs->attribs.fileSize;
-			of.accessTime_ = openAttribs->attribs.accessTime;
-			of.createTime_ = openAttribs->attribs.createTime;
-			of.writeTime_ = openAttribs->attribs.writeTime;
-			of.changeTime_ = openAttribs->attribs.changeTime;
+			of->fileFlags_ = openAttribs->attribs.fileFlags;	// Store attributes in OpenFile class
+			of->fileSize_ = openAttribs->attribs.fileSize;
+			of->accessTime_ = openAttribs->attribs.accessTime;
+			of->createTime_ = openAttribs->attribs.createTime;
+			of->writeTime_ = openAttribs->attribs.writeTime;
+			of->changeTime_ = openAttribs->attribs.changeTime;
 
-			addOpenFile(of);
+			addOpenFile(std::move(of));
 
 			// Apply writeTime
 			struct fs_layer::timeval_fs tm[2];
@@ -1626,25 +2889,36 @@ int PFMLayer::createOp(const std::string &path, int8_t createFileType, uint8_t c
 
 			// Before actually creating the folder, delete entry in fileStatCache with same name
 			std::string cipherPath = rootFS_->root->cipherPath(path.c_str());
-			fileStatCache_.forgetCachedStat( cipherPath.c_str() );
+			forgetCachedEntry(path, cipherPath.c_str());
+			dirListCache_.forgetListing(path);
 
-			rootFS_->root->mkdir( path.c_str(), mode);
+			if(rootFS_->root->mkdir( path.c_str(), mode) == 0)
+			{
+				changeJournal_.record(ChangeJournal::changeCreated, cipherPath);
+				if(useNameIndex_ && !skippedNames_.matches(path))
+				{
+					NameIndex::Entry indexEntry;
+					indexEntry.mtime = static_cast<int64_t>(FileTimeToUnixTime(writeTime));
+					indexEntry.isFolder = true;
+					nameIndex_.add(path, indexEntry);
+				}
+			}
 
-			OpenFile of;
-			of.isFile_ = false;
-			of.openId_ = newCreateOpenId;
-			of.sequenceId_ = 1;
-			of.pathName_ = path;
-			of.isOpenedReadOnly_ = (accessLevel < pfmAccessLevelWriteData);
-			of.isReadOnly_ = false;
-			of.fileId_ = createFileId(path);
+			std::unique_ptr<OpenFile> of(new OpenFile);
+			of->isFile_ = false;
+			of->openId_ = newCreateOpenId;
+			of->sequenceId_ = 1;
+			of->pathName_ = path;
+			of->isOpenedReadOnly_ = (accessLevel < pfmAccessLevelWriteData);
+			of->isReadOnly_ = false;
+			of->fileId_ = createFileId(path);
 
 			openAttribs->openId = newCreateOpenId;
 			openAttribs->openSequence = 1;
 			openAttribs->accessLevel = accessLevel;
 			openAttribs->attribs.fileType = pfmFileTypeFolder;
 			openAttribs->attribs.fileFlags = createFileFlags;
-			openAttribs->attribs.fileId = of.fileId_;
+			openAttribs->attribs.fileId = of->fileId_;
 			openAttribs->attribs.fileSize = 0;
 
 			openAttribs->attribs.accessTime = writeTime;
@@ -1652,14 +2926,14 @@ int PFMLayer::createOp(const std::string &path, int8_t createFileType, uint8_t c
 			openAttribs->attribs.writeTime = writeTime;
 			openAttribs->attribs.changeTime = writeTime;
 
-			of.fileFlags_ = openAttribs->attribs.fileFlags;	// Store attributes in OpenFile class
-			of.fileSize_ = openAttribs->attribs.fileSize;
-			of.accessTime_ = openAttribs->attribs.accessTime;
-			of.createTime_ = openAttribs->attribs.createTime;
-			of.writeTime_ = openAttribs->attribs.writeTime;
-			of.changeTime_ = openAttribs->attribs.changeTime;
+			of->fileFlags_ = openAttribs->attribs.fileFlags;	// Store attributes in OpenFile class
+			of->fileSize_ = openAttribs->attribs.fileSize;
+			of->accessTime_ = openAttribs->attribs.accessTime;
+			of->createTime_ = openAttribs->attribs.createTime;
+			of->writeTime_ = openAttribs->attribs.writeTime;
+			of->changeTime_ = openAttribs->attribs.changeTime;
 
-			addOpenFile(of);
+			addOpenFile(std::move(of));
 
 			// Apply writeTime
 			struct fs_layer::timeval_fs tm[2];
@@ -1683,24 +2957,56 @@ int PFMLayer::createOp(const std::string &path, int8_t createFileType, uint8_t c
 
 int PFMLayer::renameOp(PFMLayer::OpenFile *pOpenFile, const std::string &newPath)
 {
+	if(readOnly_)
+		return pfmErrorAccessDenied;
+
 	int openFlags = makeOpenFileFlags(pOpenFile->isReadOnly_ || pOpenFile->isOpenedReadOnly_);
 
+	// Windows renames no folder with open files in it, and no file over an open one
+	finalizeClosingFiles(pOpenFile->pathName_, !pOpenFile->isFile_);
+	finalizeClosingFiles(newPath, true);
+
 	try
 	{
 		bool reopen = false;
+		if(pOpenFile->readAhead_)
+			pOpenFile->readAhead_->invalidate();
+		int perr = flushWriteBuffer(pOpenFile);
+		if(perr != 0)
+			return perr;
 		if(pOpenFile->fileNode_)	// Close file
 		{
 			reopen = true;
-			pOpenFile->fileNode_.reset();
+			setOpenFileNode(pOpenFile, std::shared_ptr<encfs::FileNode>());
 		}
 		
 		std::string oldCipherPath = rootFS_->root->cipherPath(pOpenFile->pathName_.c_str());
-		fileStatCache_.forgetCachedStat( oldCipherPath.c_str() );
 		std::string newCipherPath = rootFS_->root->cipherPath(newPath.c_str());
-		fileStatCache_.forgetCachedStat( newCipherPath.c_str() );
+		if(!pOpenFile->isFile_)
+		{
+			negativeLookupCache_.forgetTree(newPath);
+			fileStatCache_.forgetTree(oldCipherPath);
+			fileStatCache_.forgetTree(newCipherPath);
+		}
 
 		// Apply name change (works for folders and for files)
 		int res = rootFS_->root->rename( pOpenFile->pathName_.c_str(), newPath.c_str() );
+		if(res == 0)
+		{
+			moveCachedEntry(pOpenFile->pathName_, oldCipherPath.c_str(), newPath, newCipherPath.c_str(),
+				!pOpenFile->isFile_);
+			changeJournal_.record(ChangeJournal::changeMoved, oldCipherPath, newCipherPath);
+			if(useNameIndex_)
+				nameIndex_.move(pOpenFile->pathName_, newPath);
+		}
+		else
+		{
+			// Parts of a folder may have been moved
+			forgetCachedEntry(pOpenFile->pathName_, oldCipherPath.c_str());
+			forgetCachedEntry(newPath, newCipherPath.c_str());
+			if(!pOpenFile->isFile_)
+				dirListCache_.forgetTree(pOpenFile->pathName_);
+		}
 		if(res < 0)
 		{
 			if(errno == EACCES)
@@ -1723,12 +3029,16 @@ int PFMLayer::renameOp(PFMLayer::OpenFile *pOpenFile, const std::string &newPath
 				rootFS_->root->openNode( newPath.c_str(), "open", openFlags, &res );
 			if(!fileNode)
 				return pfmErrorInvalid;
-			pOpenFile->fileNode_ = fileNode;
+			pOpenFile->fd_ = res;
+			setOpenFileNode(pOpenFile, fileNode);
 		}
 	}
 	catch( encfs::Error &err )
 	{
 		reportEncFSMPErr(L"Error during rename operation", pOpenFile->pathName_, err);
+		// It is unknown what was renamed
+		fileStatCache_.clearCache();
+		dirListCache_.clearCache();
 		return pfmErrorFailed;
 	}
 
@@ -1751,6 +3061,9 @@ int PFMLayer::renameOp(PFMLayer::OpenFile *pOpenFile, const std::string &newPath
  */
 int PFMLayer::deleteOp(PFMLayer::OpenFile *pOpenFile)
 {
+	if(readOnly_)
+		return pfmErrorAccessDenied;
+
 	if(!pOpenFile->isFile_)
 	{
 		try
@@ -1794,6 +3107,8 @@ int PFMLayer::deleteOp(PFMLayer::OpenFile *pOpenFile)
 	int retVal = renameOp(pOpenFile, newname);
 	if(retVal != 0)
 		return retVal;
+	if(useNameIndex_)
+		nameIndex_.remove(newname);
 
 	// Delete it
 	pOpenFile->isDeleted_ = true;
@@ -1803,9 +3118,152 @@ int PFMLayer::deleteOp(PFMLayer::OpenFile *pOpenFile)
 	return 0;
 }
 
+/**
+ * Deletes everything in an open folder at once, for tools which would
+ * otherwise delete a large tree through Open, Delete and Close of every entry,
+ * each with its name encoded and its file looked up.
+ *
+ * The backing folders are walked by their cipher names, which are never
+ * decoded, and the files are unlinked in parallel (see
+ * DirNode::removeFolderContents). The cached entries below the folder are
+ * dropped at once afterwards. Fails without deleting anything if a file or
+ * folder below it is open.
+ * Must be called with mutex_ locked.
+ */
+int PFMLayer::deleteContentsOp(PFMLayer::OpenFile *pOpenFile, uint64_t &removedCount)
+{
+	const std::string &path = pOpenFile->pathName_.str();
+	if(pOpenFile->isFile_)
+		return pfmErrorNotAFolder;
+	if(pOpenFile->isDeleted_)
+		return pfmErrorDeleted;
+	if(pOpenFile->isReadOnly_ || readOnly_)
+		return pfmErrorAccessDenied;
+	// The root holds the configuration of the volume
+	if(path == "/")
+		return pfmErrorInvalid;
+
+	// Files completed early by Close still hold their FileNode
+	finalizeClosingFiles(path, true);
+
+	std::string prefix = path + "/";
+	for(OpenIdMapType::iterator iter = openIdMap_.begin(); iter != openIdMap_.end(); iter++)
+	{
+		if(iter->first.str().compare(0, prefix.size(), prefix) == 0)
+			return pfmErrorAccessDenied;
+	}
+
+	std::string cipherPath;
+	std::vector<std::string> removed;
+	int res = 0;
+	try
+	{
+		cipherPath = rootFS_->root->cipherPath(path.c_str());
+		res = rootFS_->root->removeFolderContents(path.c_str(), removed);
+	}
+	catch( encfs::Error &err )
+	{
+		reportEncFSMPErr(L"Error during delete operation", path, err);
+		return pfmErrorFailed;
+	}
+
+	// Also after a partial failure, some of the entries may be gone
+	if(!removed.empty())
+	{
+		fileStatCache_.forgetTree(cipherPath);
+		dirListCache_.forgetTree(path);
+		refreshCachedEntry(path, cipherPath.c_str());
+		fileIDs_.removeBelow(pOpenFile->pathName_);
+		if(useNameIndex_)
+			nameIndex_.removeContents(path);
+		for(size_t i = 0; i < removed.size(); i++)
+			changeJournal_.record(ChangeJournal::changeDeleted, removed[i]);
+		bulkDeletedEntries_ += removed.size();
+	}
+	removedCount = removed.size();
+
+	if(res == -EBUSY || res == -EACCES)
+		return pfmErrorAccessDenied;
+	else if(res != 0)
+		return pfmErrorFailed;
+	return 0;
+}
+
+/**
+ * Moves the source file over the target file with one rename of the backing
+ * file, which replaces the target in one step, so that there is no moment
+ * without a file at the target path.
+ *
+ * Other than with deleteOp(), the data of the target is gone right away,
+ * the target is closed here and only accepts its Close afterwards. Its ID is
+ * dropped by renameFileID(), as the source moves over it.
+ */
+int PFMLayer::replaceOp(OpenFile *pSourceOpenFile, OpenFile *pTargetOpenFile)
+{
+	if(readOnly_)
+		return pfmErrorAccessDenied;
+
+	std::string targetPath = pTargetOpenFile->pathName_.str();
+
+	// The backing file can't be replaced while it is open on Windows
+	if(pTargetOpenFile->readAhead_)
+		pTargetOpenFile->readAhead_->invalidate();
+	flushWriteBuffer(pTargetOpenFile);
+	setOpenFileNode(pTargetOpenFile, std::shared_ptr<encfs::FileNode>());
+
+	int perr = renameOp(pSourceOpenFile, targetPath);
+	if(perr != 0)
+	{
+		// The target is still there
+		try
+		{
+			int res = 0;
+			int openFlags = makeOpenFileFlags(pTargetOpenFile->isReadOnly_ || pTargetOpenFile->isOpenedReadOnly_);
+			std::shared_ptr<encfs::FileNode> fileNode =
+				rootFS_->root->openNode(targetPath.c_str(), "open", openFlags, &res);
+			if(fileNode)
+			{
+				pTargetOpenFile->fd_ = res;
+				setOpenFileNode(pTargetOpenFile, fileNode);
+			}
+		}
+		catch( encfs::Error &err )
+		{
+			reportEncFSMPErr(L"Error during replace operation", targetPath, err);
+		}
+		return perr;
+	}
+
+	// openIdMap_ has the source at targetPath now, the target keeps a name of
+	// its own until it is closed
+	std::stringstream ostr;
+	ostr << "/encfsmp_replaced_" << std::hex << pTargetOpenFile->openId_;
+	pTargetOpenFile->pathName_ = ostr.str();
+	openIdMap_[pTargetOpenFile->pathName_] = pTargetOpenFile->openId_;
+	pTargetOpenFile->isReplaced_ = true;
+	pTargetOpenFile->isDeleted_ = true;
+
+	return 0;
+}
+
+void PFMLayer::applyAccessHint(PFMLayer::OpenFile *pOpenFile, encfs::FileNode *fileNode,
+	encfs::AccessHint hint)
+{
+	fileNode->setAccessHint(hint);
+
+	// Files which are read at random or not read at all gain nothing from read-ahead
+	if(readAheadBytes_ > 0 && hint != encfs::Access_Random && hint != encfs::Access_WriteOnce &&
+		hint != encfs::Access_NoCache)
+	{
+		pOpenFile->readAhead_.reset(new ReadAheadBuffer(readAheadBytes_));
+	}
+}
+
 void PFMLayer::openExisting(PFMLayer::OpenFile *pOpenFile, PfmOpenAttribs *openAttribs,
 	PT_UINT8 accessLevel)
 {
+	if(pOpenFile->isStale_)
+		refreshOpenFile(pOpenFile);
 	accessLevel = determineAccessLevel(pOpenFile->isReadOnly_ || pOpenFile->isOpenedReadOnly_, accessLevel);
 
 	pOpenFile->sequenceId_++;
@@ -1829,13 +3287,35 @@ void PFMLayer::openExisting(PFMLayer::OpenFile *pOpenFile, PfmOpenAttribs *openA
 }
 
 int PFMLayer::openFileOp(std::shared_ptr<encfs::FileNode> fileNode, int fd, PfmOpenAttribs *openAttribs,
-	int64_t newExistingOpenId, PT_UINT8 accessLevel, const std::string &path)
+	int64_t newExistingOpenId, PT_UINT8 accessLevel, const std::string &path,
+	encfs::AccessHint hint)
 {
 	efs_stat buf;
 
 	try
 	{
-		int err = fileNode->getAttr(&buf, &fileStatCache_);
+		int err = 0;
+		efs_stat cipherStat;
+		off_t openSize = 0;
+		if(fileNode->getOpenAttr(&cipherStat, &openSize))
+		{
+			// Taken by the open of the backing file, which is newer than a cached
+			// entry. It replaces the entry, so that the next stat needs no query
+			fileStatCache_.addStat(fileNode->cipherName(), &cipherStat);
+			buf = cipherStat;
+			buf.st_size = openSize;
+		}
+		else
+		{
+			// The cached plaintext size saves going through the FileIO layers,
+			// unless the node is open with a lazy extension
+			int64_t plainSize = -1;
+			err = fileStatCache_.stat(fileNode->cipherName(), &buf, &plainSize);
+			if(err == 0 && plainSize >= 0 && !fileNode->hasExtendedSize())
+				buf.st_size = plainSize;
+			else
+				err = fileNode->getAttr(&buf, &fileStatCache_);
+		}
 		if(err != 0)
 			return pfmErrorFailed;
 	}
@@ -1846,32 +3326,35 @@ int PFMLayer::openFileOp(std::shared_ptr<encfs::FileNode> fileNode, int fd, PfmO
 	}
 
 	// File found
-	OpenFile of;
-	of.isFile_ = true;
-	of.fileNode_ = fileNode;
-	of.openId_ = newExistingOpenId;
-	of.sequenceId_ = 1;
-	of.fd_ = fd;
-	of.pathName_ = path;
-	of.isReadOnly_ = ((buf.st_mode & S_IWUSR) == 0);
-	of.isOpenedReadOnly_ = (accessLevel < pfmAccessLevelWriteData);
-	of.fileId_ = createFileId(path);
-
-	accessLevel = determineAccessLevel(of.isReadOnly_ || of.isOpenedReadOnly_, accessLevel);
+	std::unique_ptr<OpenFile> of(new OpenFile);
+	of->isFile_ = true;
+	setOpenFileNode(of.get(), fileNode);
+	of->openId_ = newExistingOpenId;
+	of->sequenceId_ = 1;
+	of->fd_ = fd;
+	applyAccessHint(of.get(), fileNode.get(), hint);
+	if(useWriteBuffer_ && writeBufferBytes_ > 0)
+		of->writeBuffer_.reset(new WriteBuffer(writeBufferBytes_));
+	of->pathName_ = path;
+	of->isReadOnly_ = ((buf.st_mode & S_IWUSR) == 0);
+	of->isOpenedReadOnly_ = (accessLevel < pfmAccessLevelWriteData);
+	of->fileId_ = createFileId(path);
+
+	accessLevel = determineAccessLevel(of->isReadOnly_ || of->isOpenedReadOnly_, accessLevel);
 
 	openAttribs->openId = newExistingOpenId;
 	openAttribs->openSequence = 1;
 	openAttribs->accessLevel = accessLevel;
 	openAttribs->attribs.fileType = pfmFileTypeFile;
 	openAttribs->attribs.fileFlags = 0;
-	if(of.isReadOnly_)
+	if(of->isReadOnly_)
 		openAttribs->attribs.fileFlags |= pfmFileFlagReadOnly;
-	if(isHiddenFile(path))
+	if(hiddenNames_.matches(path))
 		openAttribs->attribs.fileFlags |= pfmFileFlagHidden;
 #if defined(EFS_MACOSX)
 	openAttribs->attribs.fileFlags |= pfmFileFlagArchive;	// Inverted logic of archive flag on OS X
 #endif
-	openAttribs->attribs.fileId = of.fileId_;
+	openAttribs->attribs.fileId = of->fileId_;
 	openAttribs->attribs.fileSize = buf.st_size;
 
 	openAttribs->attribs.accessTime = UnixTimeToFileTime(buf.st_atime);
@@ -1879,14 +3362,14 @@ int PFMLayer::openFileOp(std::shared_ptr<encfs::FileNode> fileNode, int fd, PfmO
 	openAttribs->attribs.writeTime = UnixTimeToFileTime(buf.st_mtime);
 	openAttribs->attribs.changeTime = UnixTimeToFileTime(buf.st_mtime);
 
-	of.fileFlags_ = openAttribs->attribs.fileFlags;	// Store attributes in OpenFile class
-	of.fileSize_ = openAttribs->attribs.fileSize;
-	of.accessTime_ = openAttribs->attribs.accessTime;
-	of.createTime_ = openAttribs->attribs.createTime;
-	of.writeTime_ = openAttribs->attribs.writeTime;
-	of.changeTime_ = openAttribs->attribs.changeTime;
+	of->fileFlags_ = openAttribs->attribs.fileFlags;	// Store attributes in OpenFile class
+	of->fileSize_ = openAttribs->attribs.fileSize;
+	of->accessTime_ = openAttribs->attribs.accessTime;
+	of->createTime_ = openAttribs->attribs.createTime;
+	of->writeTime_ = openAttribs->attribs.writeTime;
+	of->changeTime_ = openAttribs->attribs.changeTime;
 
-	addOpenFile(of);
+	addOpenFile(std::move(of));
 
 	return 0;
 }
@@ -1909,28 +3392,28 @@ int PFMLayer::openDirOp(PfmOpenAttribs *openAttribs, int64_t newExistingOpenId,
 		return pfmErrorFailed;
 	}
 
-	OpenFile of;
-	of.isFile_ = false;
-	of.openId_ = newExistingOpenId;
-	of.sequenceId_ = 1;
-	of.pathName_ = path;
-	of.isReadOnly_ = ((buf.st_mode & S_IWUSR) == 0);
-	of.isOpenedReadOnly_ = (accessLevel < pfmAccessLevelWriteData);
-	of.fileId_ = createFileId(path);
+	std::unique_ptr<OpenFile> of(new OpenFile);
+	of->isFile_ = false;
+	of->openId_ = newExistingOpenId;
+	of->sequenceId_ = 1;
+	of->pathName_ = path;
+	of->isReadOnly_ = ((buf.st_mode & S_IWUSR) == 0);
+	of->isOpenedReadOnly_ = (accessLevel < pfmAccessLevelWriteData);
+	of->fileId_ = createFileId(path);
 
-	accessLevel = determineAccessLevel(of.isReadOnly_ || of.isOpenedReadOnly_, accessLevel);
+	accessLevel = determineAccessLevel(of->isReadOnly_ || of->isOpenedReadOnly_, accessLevel);
 
 	openAttribs->openId = newExistingOpenId;
 	openAttribs->openSequence = 1;
 	openAttribs->accessLevel = accessLevel;
 	openAttribs->attribs.fileType = pfmFileTypeFolder;
 	openAttribs->attribs.fileFlags = 0;
-	if(of.isReadOnly_)
+	if(of->isReadOnly_)
 		openAttribs->attribs.fileFlags |= pfmFileFlagReadOnly;
 #if defined(EFS_MACOSX)
 	openAttribs->attribs.fileFlags |= pfmFileFlagArchive;	// Inverted logic of archive flag on OS X
 #endif
-	openAttribs->attribs.fileId = of.fileId_;
+	openAttribs->attribs.fileId = of->fileId_;
 	openAttribs->attribs.fileSize = 0;
 
 	openAttribs->attribs.accessTime = UnixTimeToFileTime(buf.st_atime);
@@ -1938,14 +3421,22 @@ int PFMLayer::openDirOp(PfmOpenAttribs *openAttribs, int64_t newExistingOpenId,
 	openAttribs->attribs.writeTime = UnixTimeToFileTime(buf.st_mtime);
 	openAttribs->attribs.changeTime = UnixTimeToFileTime(buf.st_mtime);
 
-	of.fileFlags_ = openAttribs->attribs.fileFlags;	// Store attributes in OpenFile class
-	of.fileSize_ = openAttribs->attribs.fileSize;
-	of.accessTime_ = openAttribs->attribs.accessTime;
-	of.createTime_ = openAttribs->attribs.createTime;
-	of.writeTime_ = openAttribs->attribs.writeTime;
-	of.changeTime_ = openAttribs->attribs.changeTime;
+	of->fileFlags_ = openAttribs->attribs.fileFlags;	// Store attributes in OpenFile class
+	of->fileSize_ = openAttribs->attribs.fileSize;
+	of->accessTime_ = openAttribs->attribs.accessTime;
+	of->createTime_ = openAttribs->attribs.createTime;
+	of->writeTime_ = openAttribs->attribs.writeTime;
+	of->changeTime_ = openAttribs->attribs.changeTime;
 
-	addOpenFile(of);
+	addOpenFile(std::move(of));
+
+	// Explorer lists a folder right after opening it
+	if(prefetchThread_.joinable() && dirListCache_.getCachesize() > 0
+		&& pendingPrefetches_.size() < maxPendingPrefetches && !dirListCache_.hasListing(path))
+	{
+		pendingPrefetches_.push_back(newExistingOpenId);
+		prefetchCond_.notify_one();
+	}
 
 	return 0;
 }
@@ -1955,6 +3446,8 @@ int PFMLayer::makeOpenFileFlags(PT_INT8 accessLevel)
 #if defined(PFM_ACCESS_LEVEL_WORKAROUND)
 	accessLevel = pfmAccessLevelWriteData;
 #endif
+	if(readOnly_)
+		accessLevel = pfmAccessLevelReadData;
 
 #if defined(_WIN32)
 	int flags = O_BINARY;
@@ -1975,6 +3468,8 @@ int PFMLayer::makeOpenFileFlags(bool isReadOnly)
 #if defined(PFM_ACCESS_LEVEL_WORKAROUND)
 	isReadOnly = false;
 #endif
+	if(readOnly_)
+		isReadOnly = true;
 
 #if defined(_WIN32)
 	int flags = O_BINARY;
@@ -2016,38 +3511,11 @@ void PFMLayer::reportEncFSMPErr(const std::wstring &errStr, const std::string &f
 	EncFSMPLogger::log(errStr, fn, NULL);
 }
 
-bool PFMLayer::isHiddenFile(const std::string &fullpath)
-{
-/*	std::string fn = fs_layer::extract_filename(fullpath);
-	if(fn.length() > 1)
-	{
-		if(fn[0] == '.')
-			return true;
-	}
-	*/
-	return false;
-}
-
-bool PFMLayer::isSkippedFile(const std::string &fullpath)
-{
-	// Only skip files in the root directory
-	std::string path = fs_layer::extract_path(fullpath);
-	if(path != std::string("/")
-		|| path.empty())
-		return false;
-
-	std::string fn = fs_layer::extract_filename(fullpath);
-	if(fn.length() > 1)
-	{
-		if(fn.substr(0, 6) == ".encfs")
-			return true;
-	}
-	return false;
-}
-
 PT_INT8 PFMLayer::determineAccessLevel(bool isReadOnly, PT_INT8 requestedAccessLevel)
 {
 	PT_INT8 accessLevel = requestedAccessLevel;
+	if(readOnly_)
+		return pfmAccessLevelReadData;
 #if defined(PFM_ACCESS_LEVEL_WORKAROUND)
 	accessLevel = pfmAccessLevelWriteData;
 #else
@@ -2085,43 +3553,673 @@ void PFMLayer::printOpenFiles(const char *msg)
 	std::cout << msg << ": List of open files" << std::endl;
 #endif
 	int i = 0;
-	OpenFileMapType::iterator iter = openFiles_.begin();
-	while(iter != openFiles_.end())
+	for(int shardIdx = 0; shardIdx < openFileShardCount_; shardIdx++)
 	{
-		OpenFile &cur = iter->second;
-		
+		OpenFileMapType &openFiles = openFileShards_[shardIdx].openFiles_;
+		OpenFileMapType::iterator iter = openFiles.begin();
+		while(iter != openFiles.end())
+		{
+			OpenFile &cur = *(iter->second);
+
 #if defined(EFS_WIN32)
-		std::ostringstream ostr;
-		ostr << " " << i << ": "
-			<< cur.pathName_.c_str()
-			<< (cur.isDeleted_ ? " (del)" : " (nd)")
-			<< std::endl;
-		OutputDebugStringA(ostr.str().c_str());
+			std::ostringstream ostr;
+			ostr << " " << i << ": "
+				<< cur.pathName_.c_str()
+				<< (cur.isDeleted_ ? " (del)" : " (nd)")
+				<< std::endl;
+			OutputDebugStringA(ostr.str().c_str());
 #else
-		std::cout << " " << i << ": "
-			<< cur.pathName_.c_str()
-			<< (cur.isDeleted_ ? " (del)" : " (nd)")
-			<< std::endl;
+			std::cout << " " << i << ": "
+				<< cur.pathName_.c_str()
+				<< (cur.isDeleted_ ? " (del)" : " (nd)")
+				<< std::endl;
 #endif
-		i++;
-		iter++;
+			i++;
+			iter++;
+		}
 	}
 }
 
-void PFMLayer::addOpenFile(const OpenFile &of)
+/**
+ * Replaces the FileNode of an open file. The node is registered with libencfs
+ * while it is used, so that other opens and renames of the same file share it.
+ */
+void PFMLayer::setOpenFileNode(OpenFile *pOpenFile, const std::shared_ptr<encfs::FileNode> &fileNode)
+{
+	std::shared_ptr<encfs::FileNode> oldNode = std::atomic_load(&pOpenFile->fileNode_);
+	if(oldNode == fileNode)
+		return;
+
+	try
+	{
+		if(fileNode)
+			rootFS_->root->retainNode(fileNode);
+		std::atomic_store(&pOpenFile->fileNode_, fileNode);
+		if(oldNode)
+			rootFS_->root->releaseNode(oldNode);
+	}
+	catch( encfs::Error &err )
+	{
+		reportRLogErr(err);
+	}
+}
+
+/**
+ * Takes ownership of of. The OpenFile instance is not copied, so pointers
+ * returned by getOpenFile() stay valid until the file is closed.
+ */
+void PFMLayer::addOpenFile(std::unique_ptr<OpenFile> of)
+{
+	int64_t openId = of->openId_;
+	openIdMap_[of->pathName_] = openId;
+
+	OpenFileShard &shard = getOpenFileShard(openId);
+	boost::mutex::scoped_lock shardLock(shard.mutex_);
+	shard.openFiles_[openId] = std::move(of);
+}
+
+/**
+ * Forgets the cached stat of the file, and the cached listing and
+ * missing files of the folder containing it. Must be called with mutex_ locked.
+ */
+void PFMLayer::forgetCachedEntry(const std::string &plainPath, const char *cipherPath)
+{
+	fileStatCache_.forgetCachedStat(cipherPath);
+	std::string parentPath = fs_layer::extract_path(plainPath);
+	dirListCache_.forgetListing(parentPath);
+	negativeLookupCache_.forgetFolder(parentPath);
+}
+
+/**
+ * Forgets the cached stat of the file, its entry in the cached listing of the folder
+ * is determined again when it is listed next. For changes of the size, the times or
+ * the flags of a file. Must be called with mutex_ locked.
+ */
+void PFMLayer::refreshCachedEntry(const std::string &plainPath, const char *cipherPath)
 {
-	openFiles_[of.openId_] = of;
-	openIdMap_[of.pathName_] = of.openId_;
+	fileStatCache_.forgetCachedStat(cipherPath);
+	dirListCache_.markStale(fs_layer::extract_path(plainPath), fs_layer::extract_filename(plainPath));
 }
 
+/**
+ * Moves the entry of a renamed file or folder between the cached listings.
+ * The listings of a renamed folder and its subfolders are forgotten, as their
+ * paths changed. Must be called with mutex_ locked.
+ */
+void PFMLayer::moveCachedEntry(const std::string &oldPath, const char *oldCipherPath,
+	const std::string &newPath, const char *newCipherPath, bool isFolder)
+{
+	fileStatCache_.forgetCachedStat(oldCipherPath);
+	fileStatCache_.forgetCachedStat(newCipherPath);
+
+	std::string oldParentPath = fs_layer::extract_path(oldPath);
+	std::string newParentPath = fs_layer::extract_path(newPath);
+	dirListCache_.removeName(oldParentPath, fs_layer::extract_filename(oldPath));
+	dirListCache_.addName(newParentPath, fs_layer::extract_filename(newPath));
+	negativeLookupCache_.forgetFolder(oldParentPath);
+	negativeLookupCache_.forgetFolder(newParentPath);
+
+	if(isFolder)
+	{
+		dirListCache_.forgetTree(oldPath);
+		dirListCache_.forgetTree(newPath);
+		cacheSnapshot_.forgetTree(oldPath);
+		cacheSnapshot_.forgetTree(newPath);
+	}
+}
+
+/**
+ * Called by the backing folder watcher when a file was changed by someone else.
+ * The listings are keyed by plaintext path, they are all dropped as any of them
+ * might contain the file. Our own changes are reported too, so listing a folder
+ * while files are written in it is slower while the watcher is running.
+ */
+void PFMLayer::backingFolderChanged(const std::string &cipherPath, bool namesChanged)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+
+	// Nothing is cached before the volume is unlocked
+	if(!rootFS_)
+		return;
+
+	if(cipherPath.empty())
+	{
+		// Changes were lost
+		if(rootFS_->dirHandles)
+			rootFS_->dirHandles->forgetTree(rootFS_->root->rootDirectory());
+		fileStatCache_.clearCache();
+		dirListCache_.clearCache();
+		negativeLookupCache_.clearCache();
+		cacheSnapshot_.clear();
+		markOpenFilesStale(std::string());
+		return;
+	}
+
+	fileStatCache_.forgetCachedStat(cipherPath.c_str());
+	markOpenFilesStale(cipherPath);
+	dirListCache_.clearCache();
+	if(namesChanged)
+	{
+		// The modification time of the folder changed
+		fileStatCache_.forgetCachedStat(fs_layer::extract_path(cipherPath).c_str());
+		// A cached handle would follow a folder which was renamed
+		if(rootFS_->dirHandles)
+			rootFS_->dirHandles->forgetTree(cipherPath);
+		negativeLookupCache_.clearCache();
+		// The plaintext name of a renamed folder is not known
+		cacheSnapshot_.clear();
+	}
+}
+
+/**
+ * Takes the attributes of an open file from the backing file again, see
+ * OpenFile::isStale_. If this fails, the record is left as it is and is tried
+ * again the next time.
+ * Must be called with mutex_ locked.
+ */
+void PFMLayer::refreshOpenFile(OpenFile *pOpenFile)
+{
+	std::shared_ptr<encfs::FileNode> fileNode = std::atomic_load(&pOpenFile->fileNode_);
+	if(!pOpenFile->isFile_ || !fileNode)
+		return;
+	// Data in the write buffer is newer than the backing file
+	if(pOpenFile->writeBuffer_ && !pOpenFile->writeBuffer_->isEmpty())
+		return;
+
+	efs_stat buf;
+	try
+	{
+		// The stat of the backing file lacks a lazy extension, see SetSize
+		int64_t plainSize = -1;
+		int err = fileStatCache_.stat(fileNode->cipherName(), &buf, &plainSize);
+		if(err == 0 && plainSize >= 0 && !fileNode->hasExtendedSize())
+			buf.st_size = plainSize;
+		else
+			err = fileNode->getAttr(&buf, &fileStatCache_);
+		if(err != 0)
+			return;
+	}
+	catch( encfs::Error &err )
+	{
+		reportEncFSMPErr(L"Error during access check", pOpenFile->pathName_, err);
+		return;
+	}
+
+	pOpenFile->isReadOnly_ = ((buf.st_mode & S_IWUSR) == 0);
+	if(pOpenFile->isReadOnly_)
+		pOpenFile->fileFlags_ |= pfmFileFlagReadOnly;
+	else
+		pOpenFile->fileFlags_ &= ~pfmFileFlagReadOnly;
+	pOpenFile->fileSize_ = buf.st_size;
+	pOpenFile->accessTime_ = UnixTimeToFileTime(buf.st_atime);
+	pOpenFile->createTime_ = UnixTimeToFileTime(buf.st_ctime);
+	pOpenFile->writeTime_ = UnixTimeToFileTime(buf.st_mtime);
+	pOpenFile->changeTime_ = UnixTimeToFileTime(buf.st_mtime);
+	pOpenFile->isStale_ = false;
+	refreshedOpenFiles_++;
+}
+
+/**
+ * Marks the open files of the backing file cipherPath stale, or all of them
+ * if cipherPath is empty. Must be called with mutex_ locked.
+ */
+void PFMLayer::markOpenFilesStale(const std::string &cipherPath)
+{
+	for(int i = 0; i < openFileShardCount_; i++)
+	{
+		boost::mutex::scoped_lock shardLock(openFileShards_[i].mutex_);
+		OpenFileMapType &openFiles = openFileShards_[i].openFiles_;
+		for(OpenFileMapType::iterator iter = openFiles.begin(); iter != openFiles.end(); iter++)
+		{
+			OpenFile &cur = *(iter->second);
+			if(!cur.isFile_)
+				continue;
+			std::shared_ptr<encfs::FileNode> fileNode = std::atomic_load(&cur.fileNode_);
+			if(cipherPath.empty() || (fileNode && cipherPath == fileNode->cipherName()))
+				cur.isStale_ = true;
+		}
+	}
+}
+
+/**
+ * Writes the data collected in the write buffer of the file.
+ * Must be called with mutex_ locked.
+ */
+int PFMLayer::flushWriteBuffer(OpenFile *pOpenFile)
+{
+	std::shared_ptr<encfs::FileNode> fileNode = std::atomic_load(&pOpenFile->fileNode_);
+	if(!pOpenFile->writeBuffer_ || !fileNode || pOpenFile->writeBuffer_->isEmpty())
+		return 0;
+
+	int perr = 0;
+	try
+	{
+		if(!pOpenFile->writeBuffer_->flush(fileNode))
+			perr = pfmErrorFailed;
+	}
+	catch(encfs::Error &err)
+	{
+		reportEncFSMPErr(L"Error during write operation", pOpenFile->pathName_, err);
+		perr = pfmErrorFailed;
+	}
+
+	// Size and/or last write time has changed
+	refreshCachedEntry(pOpenFile->pathName_, fileNode->cipherName());
+	return perr;
+}
+
+/**
+ * Writes out the size of a file which was extended lazily, when it is closed
+ * (see encfs::FileNode::truncate()). Must be called with mutex_ locked.
+ */
+void PFMLayer::writeExtendedSize(OpenFile *pOpenFile)
+{
+	std::shared_ptr<encfs::FileNode> fileNode = std::atomic_load(&pOpenFile->fileNode_);
+	if(!fileNode)
+		return;
+
+	try
+	{
+		int res = fileNode->applyExtendedSize();
+		if(res < 0)
+			reportEncFSMPErr(L"Unable to extend the file", pOpenFile->pathName_);
+		else if(res > 0)
+			refreshCachedEntry(pOpenFile->pathName_, fileNode->cipherName());
+	}
+	catch(encfs::Error &err)
+	{
+		reportEncFSMPErr(L"Unable to extend the file", pOpenFile->pathName_, err);
+	}
+}
+
+/**
+ * Writes out the write buffer for a FlushFile request, as far as flushPolicy_
+ * asks for it. Must be called with mutex_ locked.
+ */
+int PFMLayer::flushFileRequested(OpenFile *pOpenFile)
+{
+	if(flushPolicy_ == FPStrict || !pOpenFile->writeBuffer_)
+		return flushWriteBuffer(pOpenFile);
+	if(flushPolicy_ == FPOnClose)
+		return 0;
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if(now - pOpenFile->lastFlush_ >= flushCoalesceTime)
+	{
+		pOpenFile->lastFlush_ = now;
+		return flushWriteBuffer(pOpenFile);
+	}
+	if(!pOpenFile->isFlushPending_ && !pOpenFile->writeBuffer_->isEmpty())
+	{
+		pOpenFile->isFlushPending_ = true;
+		pendingFlushes_.insert(pOpenFile->openId_);
+		flusherCond_.notify_one();
+	}
+	return 0;
+}
+
+/**
+ * Writes out the write buffers of all open files, and syncs the files which
+ * are open for writing.
+ */
+int PFMLayer::flushAllFiles()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	finalizeClosingFiles("/", true);
+	int perr = 0;
+	for(int i = 0; i < openFileShardCount_; i++)
+	{
+		boost::mutex::scoped_lock shardLock(openFileShards_[i].mutex_);
+		OpenFileMapType &openFiles = openFileShards_[i].openFiles_;
+		for(OpenFileMapType::iterator iter = openFiles.begin(); iter != openFiles.end(); iter++)
+		{
+			OpenFile &cur = *(iter->second);
+			if(!cur.isFile_ || cur.isOpenedReadOnly_)
+				continue;
+
+			int filePerr = flushWriteBuffer(&cur);
+			std::shared_ptr<encfs::FileNode> fileNode = std::atomic_load(&cur.fileNode_);
+			if(fileNode && fileNode->sync(true) < 0)
+				filePerr = pfmErrorFailed;
+			if(filePerr != 0)
+				perr = filePerr;
+		}
+	}
+	return perr;
+}
+
+/**
+ * Starts the thread which writes out the buffers of deferred flushes, with FPCoalesced.
+ */
+void PFMLayer::startFlusher()
+{
+	if(flushPolicy_ != FPCoalesced || !useWriteBuffer_ || flusherThread_.joinable())
+		return;
+
+	flusherStop_ = false;
+	flusherThread_ = boost::thread([this]() { flusherLoop(); });
+}
+
+void PFMLayer::stopFlusher()
+{
+	if(!flusherThread_.joinable())
+		return;
+
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		flusherStop_ = true;
+		flusherCond_.notify_one();
+	}
+	flusherThread_.join();
+}
+
+/**
+ * Writes out the buffers of the files in pendingFlushes_ once flushCoalesceTime
+ * has passed since their last flush. Files closed in the meantime were
+ * written out by Close.
+ */
+void PFMLayer::flusherLoop()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	while(!flusherStop_)
+	{
+		if(pendingFlushes_.empty())
+			flusherCond_.wait(lock);
+		else
+			flusherCond_.wait_for(lock, boost::chrono::milliseconds(flushCoalesceTime.count()));
+		if(flusherStop_)
+			break;
+
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		std::set<int64_t>::iterator iter = pendingFlushes_.begin();
+		while(iter != pendingFlushes_.end())
+		{
+			OpenFile *pOpenFile = getOpenFile(*iter);
+			if(pOpenFile != NULL && now - pOpenFile->lastFlush_ < flushCoalesceTime)
+			{
+				iter++;
+				continue;
+			}
+			if(pOpenFile != NULL)
+			{
+				pOpenFile->lastFlush_ = now;
+				pOpenFile->isFlushPending_ = false;
+				flushWriteBuffer(pOpenFile);
+			}
+			iter = pendingFlushes_.erase(iter);
+		}
+	}
+}
+
+/**
+ * Starts the thread which collects the listings of opened folders.
+ */
+void PFMLayer::startPrefetcher()
+{
+	if(prefetchThread_.joinable())
+		return;
+
+	prefetchStop_ = false;
+	prefetchThread_ = boost::thread([this]() { prefetcherLoop(); });
+}
+
+void PFMLayer::stopPrefetcher()
+{
+	if(!prefetchThread_.joinable())
+		return;
+
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		prefetchStop_ = true;
+		pendingPrefetches_.clear();
+		prefetchCond_.notify_one();
+	}
+	prefetchThread_.join();
+}
+
+void PFMLayer::prefetcherLoop()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	while(!prefetchStop_)
+	{
+		if(pendingPrefetches_.empty())
+		{
+			prefetchCond_.wait(lock);
+			continue;
+		}
+
+		int64_t openId = pendingPrefetches_.front();
+		pendingPrefetches_.pop_front();
+		prefetchListing(openId, lock);
+	}
+}
+
+/**
+ * Collects the listing of the folder opened as openId into dirListCache_, the
+ * same way List does, so that the List following the Open is served from it.
+ * Given up if the folder has more than prefetchMaxEntries entries, or if it is
+ * closed or the mount stops in the meantime. Must be called with lock (of
+ * mutex_) held, it is released while the names are decoded and the files stat'ed.
+ */
+void PFMLayer::prefetchListing(int64_t openId, boost::mutex::scoped_lock &lock)
+{
+	OpenFile *pOpenFile = getOpenFile(openId);
+	if(pOpenFile == NULL || pOpenFile->isFile_ || pOpenFile->isDeleted_ || !rootFS_
+		|| !pOpenFile->fileLists_.empty() || dirListCache_.hasListing(pOpenFile->pathName_.str()))
+		return;
+
+	RootPtr rootFS = rootFS_;
+	std::string dirPath = pOpenFile->pathName_.str();
+	if(restoreListing(dirPath))
+		return;
+	int64_t generation = dirListCache_.getGeneration();
+
+	std::string cipherDirPath;
+	std::vector<encfs::DirTraverse::Entry> entries;
+	std::vector<int64_t> plainSizes;
+	bool isComplete = false;
+	lock.unlock();
+	try
+	{
+		encfs::DirTraverse dirT = rootFS->root->openDir(dirPath.c_str());
+		cipherDirPath = rootFS->root->cipherPath(dirPath.c_str());
+		char lastChar = cipherDirPath.empty() ? 0 : cipherDirPath[cipherDirPath.length() - 1];
+		if(lastChar != '/' && lastChar != '\\')
+			cipherDirPath += '/';
+
+		while(dirT.valid())
+		{
+			std::vector<encfs::DirTraverse::Entry> batch = dirT.nextBatch(listBatchSize);
+			if(batch.empty())
+			{
+				isComplete = true;
+				break;
+			}
+			if(entries.size() + batch.size() > prefetchMaxEntries)
+				break;
+
+			for(size_t i = 0; i < batch.size(); i++)
+			{
+				encfs::DirTraverse::Entry &entry = batch[i];
+				if(entry.plainName == "." || entry.plainName == "..")
+					continue;
+				// Warms fileStatCache_ for the Open requests following the listing as well
+				std::string cpath = cipherDirPath + entry.cipherName;
+				int64_t plainSize = -1;
+				if(entry.hasStat)
+					fileStatCache_.addStat(cpath.c_str(), &entry.stat, &plainSize);
+				else
+					entry.hasStat = (fileStatCache_.stat(cpath.c_str(), &entry.stat, &plainSize) == 0);
+				if(!entry.hasStat)
+					continue;
+				entries.push_back(std::move(entry));
+				plainSizes.push_back(plainSize);
+			}
+
+			boost::mutex::scoped_lock checkLock(mutex_);
+			if(prefetchStop_ || getOpenFile(openId) == NULL)
+				break;
+		}
+	}
+	catch( encfs::Error &err )
+	{
+		reportEncFSMPErr(L"Error while prefetching directory listing", dirPath, err);
+		isComplete = false;
+	}
+	lock.lock();
+
+	if(!isComplete || prefetchStop_ || getOpenFile(openId) == NULL || dirListCache_.hasListing(dirPath))
+		return;
+
+	DirListCache::ListingPtr listing(new DirListCache::Listing());
+	std::string plainPath;
+	for(size_t i = 0; i < entries.size(); i++)
+	{
+		encfs::DirTraverse::Entry &entry = entries[i];
+		fs_layer::concat_path(dirPath, entry.plainName, plainPath, true);
+		// Skip deleted, but not yet closed files
+		OpenFile *pEntryOpenFile = findOpenFileByName(plainPath);
+		if((pEntryOpenFile != NULL && pEntryOpenFile->isDeleted_) || skippedNames_.matches(plainPath))
+			continue;
+
+		DirListCache::Entry listEntry;
+		if(!makeListAttribs(plainPath, cipherDirPath + entry.cipherName, entry.stat, plainSizes[i],
+			pEntryOpenFile, listEntry.attribs_))
+			continue;
+		listEntry.name_ = entry.plainName;
+		listing->push_back(listEntry);
+	}
+	dirListCache_.addListing(dirPath, generation, listing);
+	prefetchedListings_++;
+}
+
+/**
+ * Writes out the write buffer of a closed file and releases its FileNode.
+ * Must be called with mutex_ locked.
+ */
+void PFMLayer::finalizeClosedFile(std::unique_ptr<OpenFile> of)
+{
+	flushWriteBuffer(of.get());
+	writeExtendedSize(of.get());
+	setOpenFileNode(of.get(), std::shared_ptr<encfs::FileNode>());
+}
+
+/**
+ * Finalizes the closed files at path, and with withSubtree also those below
+ * it, before the path is used again. Must be called with mutex_ locked.
+ */
+void PFMLayer::finalizeClosingFiles(const std::string &path, bool withSubtree)
+{
+	ClosingFileMapType::iterator iter = closingFiles_.begin();
+	while(iter != closingFiles_.end())
+	{
+		const std::string &closingPath = iter->first.str();
+		bool matches = (closingPath == path);
+		if(!matches && withSubtree)
+		{
+			matches = (path == "/")
+				|| (closingPath.size() > path.size() && closingPath[path.size()] == '/'
+					&& closingPath.compare(0, path.size(), path) == 0);
+		}
+		if(!matches)
+		{
+			iter++;
+			continue;
+		}
+
+		std::unique_ptr<OpenFile> of = std::move(iter->second);
+		iter = closingFiles_.erase(iter);
+		finalizeClosedFile(std::move(of));
+	}
+}
+
+/**
+ * Starts the thread which finishes the files completed early by Close.
+ */
+void PFMLayer::startFinalizer()
+{
+	if(finalizerThread_.joinable())
+		return;
+
+	finalizerStop_ = false;
+	finalizerThread_ = boost::thread([this]() { finalizerLoop(); });
+}
+
+/**
+ * Finalizes the files still waiting, and stops the thread.
+ */
+void PFMLayer::stopFinalizer()
+{
+	if(!finalizerThread_.joinable())
+		return;
+
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		finalizerStop_ = true;
+		finalizerCond_.notify_one();
+	}
+	finalizerThread_.join();
+}
+
+void PFMLayer::finalizerLoop()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	while(true)
+	{
+		while(closeQueue_.empty() && !finalizerStop_)
+			finalizerCond_.wait(lock);
+		if(closeQueue_.empty())
+			break;
+
+		encfs::InternedPath path = closeQueue_.front();
+		closeQueue_.pop_front();
+		// Gone if it was finalized by a later use of the path
+		ClosingFileMapType::iterator iter = closingFiles_.find(path);
+		if(iter == closingFiles_.end())
+			continue;
+
+		std::unique_ptr<OpenFile> of = std::move(iter->second);
+		closingFiles_.erase(iter);
+		finalizeClosedFile(std::move(of));
+	}
+}
+
+/**
+ * Moves an open file or folder to newPath, and the files and folders open below
+ * a folder along with it. Windows renames no folders with open files in them,
+ * other systems do. openIdMap_ only holds the open files, so looking at all of
+ * them is cheap, the file IDs of all entries below the folder follow in
+ * fileIDs_ without being visited.
+ */
 bool PFMLayer::renameOpenFile(OpenFile *pOpenFile, const std::string &newPath)
 {
 	OpenIdMapType::iterator iter = openIdMap_.find(pOpenFile->pathName_);
 	if(iter == openIdMap_.end())
 		return false;
 	openIdMap_.erase(iter);	// Erase old pathname from openIdMap_
+	std::string oldPath = pOpenFile->pathName_.str();
 	pOpenFile->pathName_ = newPath;
-	openIdMap_[newPath] = pOpenFile->openId_;
+	openIdMap_[pOpenFile->pathName_] = pOpenFile->openId_;
+
+	if(pOpenFile->isFile_ || oldPath == "/")
+		return true;
+
+	std::string prefix = oldPath + "/";
+	std::vector<int64_t> openIds;
+	for(iter = openIdMap_.begin(); iter != openIdMap_.end(); iter++)
+	{
+		if(iter->first.str().compare(0, prefix.size(), prefix) == 0)
+			openIds.push_back(iter->second);
+	}
+	for(size_t i = 0; i < openIds.size(); i++)
+	{
+		OpenFile *pEntryOpenFile = getOpenFile(openIds[i]);
+		if(pEntryOpenFile == NULL)
+			continue;
+		openIdMap_.erase(pEntryOpenFile->pathName_);
+		pEntryOpenFile->pathName_ = newPath + pEntryOpenFile->pathName_.str().substr(oldPath.size());
+		openIdMap_[pEntryOpenFile->pathName_] = pEntryOpenFile->openId_;
+	}
 
 	return true;
 }
@@ -24,14 +24,42 @@ namespace encfs
 {
 class DirTraverse;
 }
+class PFMDispatchPool;
 
 #include "config.h"
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <list>
 #include <map>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
 #include <stdint.h>
 
+#include <boost/filesystem/path.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "BackingFolderWatcher.h"
+#include "CacheAutoTuner.h"
+#include "CacheTrimmer.h"
+#include "CacheSnapshot.h"
+#include "CacheTuning.h"
+#include "ChangeJournal.h"
+#include "DirListCache.h"
+#include "NameIndex.h"
 #include "FileStatCache.h"
+#include "FormatterStats.h"
+#include "NameMatcher.h"
+#include "NegativeLookupCache.h"
+#include "FileIDIndex.h"
+#include "ReadAheadBuffer.h"
+#include "WriteBuffer.h"
 
 #if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
@@ -46,7 +74,9 @@ class DirTraverse;
 #include "pfmapi.h"
 
 // libencfs
+#include "DirNode.h"
 #include "FileUtils.h"
+#include "InternedPath.h"
 #include "FileNode.h"
 #include "Error.h"
 
@@ -71,6 +101,119 @@ public:
 		wchar_t driveLetter, bool useCaching, bool worldWrite, bool localDrive, 
 		bool startBrowser, std::ostream &ostr);
 
+	/**
+	 * Mount the drive before the volume is unlocked: startFS() is called
+	 * with an empty rootFS, and unlock is run on the first Open to read the
+	 * configuration and derive the volume key. Until then, the capacity of
+	 * the drive is taken from rootDir, the encrypted directory.
+	 * If unlock returns an empty RootPtr, all Open requests fail.
+	 */
+	typedef std::function<RootPtr ()> UnlockFunction;
+	void setDeferredUnlock(const std::string &rootDir, const UnlockFunction &unlock);
+
+	/**
+	 * Number of PFM requests served at the same time by the threads shared by
+	 * all mounts (see SharedExecutor).
+	 * With 0 or 1, all requests are handled by the marshaller thread.
+	 */
+	void setDispatchThreadCount(int threadCount) { dispatchThreadCount_ = threadCount; }
+
+	/**
+	 * Collect small writes in a write-back buffer per file.
+	 */
+	void setUseWriteBuffer(bool useWriteBuffer) { useWriteBuffer_ = useWriteBuffer; }
+
+	/**
+	 * When FlushFile writes out the write buffer of a file.
+	 * FPStrict: on every FlushFile.
+	 * FPCoalesced: at most once per file within flushCoalesceTime, a background
+	 * flusher writes out the buffers of the skipped ones.
+	 * FPOnClose: only when the file is closed or read, or its buffer is full.
+	 * FlushMedia writes out all buffers and syncs the files with every policy.
+	 */
+	enum FlushPolicy
+	{
+		FPStrict = 0, FPCoalesced, FPOnClose
+	};
+	void setFlushPolicy(FlushPolicy flushPolicy) { flushPolicy_ = flushPolicy; }
+
+	/**
+	 * File names which are listed with the hidden flag, and file names which
+	 * are not shown at all, see NameMatcher for the format. The configuration
+	 * file of the volume is always skipped.
+	 */
+	void setNamePatterns(const std::string &hiddenPatterns, const std::string &skippedPatterns);
+
+	/**
+	 * Time in milliseconds the result of a capacity query is reused.
+	 * With 0, every Capacity request queries the underlying volume.
+	 */
+	void setCapacityCacheTime(int milliseconds) { capacityCacheTime_ = milliseconds; }
+
+	/**
+	 * Sizes of the caches and buffers used while mounted, see CacheTuning.
+	 * The block cache budget and the thread count are set by the caller
+	 * before the volume is mounted.
+	 */
+	void setCacheTuning(const CacheTuning &tuning) { cacheTuning_ = tuning; }
+
+	/**
+	 * Applies tuning to the mounted volume mountName.
+	 * Files which are already open keep their buffers.
+	 * Returns false if the volume is not mounted, or if some of the settings
+	 * only take effect when it is mounted again.
+	 */
+	static bool retune(const std::wstring &mountName, const CacheTuning &tuning);
+
+	/**
+	 * Watch the backing folder for changes made by others and drop the
+	 * affected cache entries (Windows only).
+	 */
+	void setWatchBackingFolder(bool watch) { watchBackingFolder_ = watch; }
+
+	/**
+	 * Keep an index of the names for searchNames(), stored encrypted in the
+	 * encrypted directory, see NameIndex.
+	 */
+	void setUseNameIndex(bool useNameIndex) { useNameIndex_ = useNameIndex; }
+
+	/**
+	 * Mount the volume read-only, the encrypted directory is not changed
+	 * while it is mounted by anyone (set EncFS_Opts::readOnly as well).
+	 * The stat, listing and negative lookup caches keep their entries until
+	 * they are full, the backing folder is not watched, and nothing is
+	 * written: no write buffers, no flushes and no stored name index.
+	 */
+	void setReadOnly(bool readOnly) { readOnly_ = readOnly; }
+
+	/**
+	 * Store the coded names and the folder listings at unmount, encrypted in
+	 * the encrypted directory, and use them after the next mount as long as
+	 * the folders are unchanged, see CacheSnapshot.
+	 */
+	void setUseCacheSnapshot(bool useCacheSnapshot) { useCacheSnapshot_ = useCacheSnapshot; }
+
+	/**
+	 * Searches the name index of the mounted volume mountName, see
+	 * NameIndex::search(). Returns false if it is not mounted or keeps no
+	 * index. isComplete is false while the index is being built after the
+	 * mount, or if more than maxHits names matched.
+	 */
+	static bool searchNames(const std::wstring &mountName, const std::string &query,
+		size_t maxHits, std::vector<NameIndex::Hit> &hits, bool &isComplete);
+
+	/**
+	 * Record every operation to this file while mounted, see OpTrace.
+	 * Empty (the default) for no trace.
+	 */
+	void setTraceFile(const boost::filesystem::path &traceFile) { traceFile_ = traceFile; }
+
+	/**
+	 * Append the changes of the encrypted directory to this file while
+	 * mounted, see ChangeJournal. Empty (the default) for no journal.
+	 */
+	void setChangeJournalFile(const boost::filesystem::path &journalFile) { changeJournalFile_ = journalFile; }
+
 	// PfmFormatterDispatch
 	void CCALL Open(PfmMarshallerOpenOp* op, void* formatterUse);
 	void CCALL Replace(PfmMarshallerReplaceOp* op, void* formatterUse);
@@ -98,16 +241,25 @@ public:
 	class FileList
 	{
 	public:
-		FileList(): listId_(0), hasPreviousResult_(false) { }
+		FileList(): listId_(0), isComplete_(false), hasPreviousResult_(false), listingPos_(0), listingGeneration_(0), batchPos_(0) { }
 		FileList(const FileList &o) { copy(o); }
 		virtual ~FileList() { }
 		FileList &copy(const FileList &o)
 		{
 			listId_ = o.listId_;
+			isComplete_ = o.isComplete_;
 			pDirT_ = o.pDirT_;
+			cipherDirPath_ = o.cipherDirPath_;
 			hasPreviousResult_ = o.hasPreviousResult_;
 			prevAttribs_ = o.prevAttribs_;
 			prevName_ = o.prevName_;
+			pListing_ = o.pListing_;
+			listingPos_ = o.listingPos_;
+			pNewListing_ = o.pNewListing_;
+			listingGeneration_ = o.listingGeneration_;
+			batch_ = o.batch_;
+			batchPos_ = o.batchPos_;
+			prefetchNames_ = o.prefetchNames_;
 
 			return *this;
 		}
@@ -117,56 +269,50 @@ public:
 		}
 
 		int64_t listId_;
+		bool isComplete_;		// All entries were listed, pDirT_ and pListing_ are released
 		std::shared_ptr<encfs::DirTraverse> pDirT_;
+		std::string cipherDirPath_;
 
 		bool hasPreviousResult_;
 		PfmAttribs prevAttribs_;
 		std::string prevName_;
+
+		DirListCache::ListingPtr pListing_;		// Set if the list is served from dirListCache_
+		size_t listingPos_;
+		std::shared_ptr<DirListCache::Listing> pNewListing_;	// Listing collected for dirListCache_
+		int64_t listingGeneration_;
+
+		std::vector<encfs::DirTraverse::Entry> batch_;	// Decoded entries not yet added to the list
+		size_t batchPos_;
+		std::vector<std::string> prefetchNames_;	// Small files listed, see prefetchFirstBlocks()
 	};
 
 	/**
 	 * Class to hold information about open files and directories.
+	 *
+	 * Instances are owned by the open file table and never copied.
 	 */
 	class OpenFile
 	{
 	public:
 		OpenFile() : openId_(0), sequenceId_(0), fd_(-1), isFile_(true), fileId_(0),
-			isDeleted_(false), isReadOnly_(false), isOpenedReadOnly_(false), fileFlags_(0),
-			fileSize_(0), createTime_(0), accessTime_(0), writeTime_(0), changeTime_(0)
+			isDeleted_(false), isReplaced_(false), isReadOnly_(false), isOpenedReadOnly_(false), fileFlags_(0),
+			fileSize_(0), createTime_(0), accessTime_(0), writeTime_(0), changeTime_(0),
+			isStale_(false), isFlushPending_(false)
 		{ }
-		OpenFile(const OpenFile &o) { copy(o); }
+		OpenFile(const OpenFile &o) = delete;
+		OpenFile & operator=(const OpenFile & o) = delete;
 		virtual ~OpenFile() { }
-		OpenFile &copy(const OpenFile &o)
-		{
-			openId_ = o.openId_;
-			sequenceId_ = o.sequenceId_;
-			fd_ = o.fd_;
-			fileNode_ = o.fileNode_;
-			isFile_ = o.isFile_;
-			isDeleted_ = o.isDeleted_;
-			fileId_ = o.fileId_;
-			pathName_ = o.pathName_;
-			isReadOnly_ = o.isReadOnly_;
-			isOpenedReadOnly_ = o.isOpenedReadOnly_;
-			fileFlags_ = o.fileFlags_;
-			fileSize_ = o.fileSize_;
-			createTime_ = o.createTime_;
-			accessTime_ = o.accessTime_;
-			writeTime_ = o.writeTime_;
-			changeTime_ = o.changeTime_;
 
-			return *this;
-		}
-		OpenFile & operator=(const OpenFile & o)
-		{
-			return copy(o);
-		}
 		int64_t openId_, sequenceId_;
 		int fd_;
 		bool isFile_;	// File: true, Directory: false
-		bool isDeleted_;
+		std::atomic<bool> isDeleted_;			// Read without the global lock by Read/Write
+		bool isReplaced_;						// Deleted by MoveReplace, the backing file is gone already
 		int64_t fileId_;
-		std::shared_ptr<encfs::FileNode> fileNode_;	// For files
+		std::shared_ptr<encfs::FileNode> fileNode_;	// For files. Modify only with std::atomic_store
+		std::shared_ptr<ReadAheadBuffer> readAhead_;	// For files, not changed after creation
+		std::shared_ptr<WriteBuffer> writeBuffer_;		// For files if useWriteBuffer_, not changed after creation
 		bool isReadOnly_;						// File has Read-only bit set
 		bool isOpenedReadOnly_;					// File was opened read-only
 		PT_UINT8 fileFlags_;
@@ -175,28 +321,42 @@ public:
 		PT_INT64 accessTime_;
 		PT_INT64 writeTime_;
 		PT_INT64 changeTime_;
-		std::string pathName_;
-		std::list<FileList> fileLists_;			// For directories
+		// The backing file changed in a way the attributes above don't follow,
+		// they are queried again by refreshOpenFile(). Protected by mutex_
+		bool isStale_;
+		encfs::InternedPath pathName_;			// Shares the string with the maps below and libencfs
+		std::unordered_map<int64_t, FileList> fileLists_;	// For directories, by listId_
+		std::chrono::steady_clock::time_point lastFlush_;	// Of the write buffer by FlushFile, see FPCoalesced
+		bool isFlushPending_;					// In pendingFlushes_
 	};
 
-	int64_t getFileID(const std::string &path);
-	int64_t addFileID(const std::string &path);
+	int64_t getFileID(const encfs::InternedPath &path);
+	int64_t addFileID(const encfs::InternedPath &path);
 	bool renameFileID(int64_t fileId, const std::string &newpath);
 	bool deleteFileID(int64_t fileId);
 
 	OpenFile *getOpenFile(int64_t openId);
+	std::shared_ptr<encfs::FileNode> getOpenFileNode(int64_t openId, int &perr,
+		std::shared_ptr<ReadAheadBuffer> *readAhead = NULL,
+		std::shared_ptr<WriteBuffer> *writeBuffer = NULL);
 	OpenFile *findOpenFileByName(const std::string &path);
-	int64_t createFileId(const std::string &fn);
+	int64_t createFileId(const encfs::InternedPath &fn);
+	void touchListing(const std::shared_ptr<encfs::DirTraverse> &pDirT, bool isOpen);
 	static void createEndName(std::wstring &endName, const char *fullPathName);
 
 	int createOp(const std::string &path, int8_t createFileType, uint8_t createFileFlags,
 		int64_t writeTime, int64_t newCreateOpenId,PfmOpenAttribs* openAttribs);
 	int renameOp(OpenFile *pOpenFile, const std::string &newPath);
 	int deleteOp(OpenFile *pOpenFile);
+	int replaceOp(OpenFile *pSourceOpenFile, OpenFile *pTargetOpenFile);
+	int deleteContentsOp(OpenFile *pOpenFile, uint64_t &removedCount);
 	void openExisting(OpenFile *pOpenFile, PfmOpenAttribs *openAttribs,
 		PT_UINT8 accessLevel);
 	int openFileOp(std::shared_ptr<encfs::FileNode> fileNode, int fd, PfmOpenAttribs *openAttribs,
-		int64_t newExistingOpenId, PT_UINT8 accessLevel, const std::string &path);
+		int64_t newExistingOpenId, PT_UINT8 accessLevel, const std::string &path,
+		encfs::AccessHint hint = encfs::Access_Normal);
+	// Passes the hint to the FileIO layers of a file being opened, and sets up its read-ahead
+	void applyAccessHint(OpenFile *pOpenFile, encfs::FileNode *fileNode, encfs::AccessHint hint);
 	int openDirOp(PfmOpenAttribs *openAttribs, int64_t newExistingOpenId,
 		PT_UINT8 accessLevel, const std::string &path);
 	int makeOpenFileFlags(PT_INT8 accessLevel);
@@ -206,11 +366,52 @@ public:
 	void reportEncFSMPErr(const std::wstring &errStr, const std::string &fn, encfs::Error &err);
 	void reportEncFSMPErr(const std::wstring &errStr, const std::string &fn);
 
-	bool isHiddenFile(const std::string &fileName);
-	bool isSkippedFile(const std::string &fileName);
 	PT_INT8 determineAccessLevel(bool isReadOnly, PT_INT8 requestedAccessLevel);
 	void printOpenFiles(const char *msg);
-	void addOpenFile(const OpenFile &of);
+	void addOpenFile(std::unique_ptr<OpenFile> of);
+	void setOpenFileNode(OpenFile *pOpenFile, const std::shared_ptr<encfs::FileNode> &fileNode);
+	void forgetCachedEntry(const std::string &plainPath, const char *cipherPath);
+	void refreshCachedEntry(const std::string &plainPath, const char *cipherPath);
+	void moveCachedEntry(const std::string &oldPath, const char *oldCipherPath,
+		const std::string &newPath, const char *newCipherPath, bool isFolder);
+	bool makeListAttribs(const std::string &plainPath, const std::string &cipherPath,
+		const efs_stat &buf, int64_t plainSize, OpenFile *pEntryOpenFile, PfmAttribs &attribs);
+	bool refreshListEntry(const std::string &dirPath, DirListCache::Entry &entry);
+	void backingFolderChanged(const std::string &cipherPath, bool namesChanged);
+	bool volumeStat(fs_layer::statvfs_fs &fs);
+	bool unlockRootFS();
+	void useRootFS(RootPtr rootFS);
+	uint64_t activityCount() const;
+	void trimCaches(bool shedAll);
+	void autoTune();
+	void startNameIndex();
+	void stopNameIndex();
+	void loadCacheSnapshot();
+	void saveCacheSnapshot();
+	DirListCache::ListingPtr restoreListing(const std::string &dirPath);
+	void buildNameIndex(RootPtr rootFS);
+	bool walkNameIndex(RootPtr rootFS, const std::string &dirPath, NameIndex::Map &index);
+	int flushWriteBuffer(OpenFile *pOpenFile);
+	void refreshOpenFile(OpenFile *pOpenFile);
+	void markOpenFilesStale(const std::string &cipherPath);
+	void writeExtendedSize(OpenFile *pOpenFile);
+	int flushFileRequested(OpenFile *pOpenFile);
+	int flushAllFiles();
+	void startFlusher();
+	void stopFlusher();
+	void flusherLoop();
+	void startPrefetcher();
+	void stopPrefetcher();
+	void prefetcherLoop();
+	void prefetchListing(int64_t openId, boost::mutex::scoped_lock &lock);
+	void notePrefetchName(FileList *pFileList, const std::string &name, const PfmAttribs &attribs);
+	void postFirstBlockPrefetch(const std::string &dirPath, FileList *pFileList);
+	void prefetchFirstBlocks(RootPtr rootFS, const std::string &dirPath, const std::vector<std::string> &names);
+	void finalizeClosedFile(std::unique_ptr<OpenFile> of);
+	void finalizeClosingFiles(const std::string &path, bool withSubtree);
+	void startFinalizer();
+	void stopFinalizer();
+	void finalizerLoop();
 	bool renameOpenFile(OpenFile *pOpenFile, const std::string &newPath);
 
 private:
@@ -219,18 +420,155 @@ private:
 
 	RootPtr rootFS_;
 
-	typedef std::map< int64_t, OpenFile > OpenFileMapType;
-	OpenFileMapType openFiles_;
-	typedef std::map< std::string, int64_t > OpenIdMapType;
+	// Encrypted directory, also known before a deferred unlock
+	std::string rootDir_;
+
+	// See setDeferredUnlock(), unlockMutex_ is held while unlock_ runs
+	UnlockFunction unlock_;
+	boost::mutex unlockMutex_;
+	bool unlockFailed_;
+	std::atomic<bool> isUnlocked_;
+
+	typedef std::unordered_map< int64_t, std::unique_ptr<OpenFile> > OpenFileMapType;
+
+	/**
+	 * The open files are distributed over several shards, each with its own lock.
+	 * This way, Read and Write don't have to take the global lock.
+	 */
+	struct OpenFileShard
+	{
+		boost::mutex mutex_;
+		OpenFileMapType openFiles_;
+	};
+	static const int openFileShardCount_ = 16;
+	OpenFileShard openFileShards_[openFileShardCount_];
+	OpenFileShard &getOpenFileShard(int64_t openId);
+
+	typedef std::unordered_map< encfs::InternedPath, int64_t, encfs::InternedPathHash > OpenIdMapType;
 	OpenIdMapType openIdMap_;
 	int64_t newFileID_;
 
-	typedef std::map< std::string, int64_t > FileIDMap;
-	FileIDMap fileIDs_;
+	FileIDIndex fileIDs_;
 
 	FileStatCache fileStatCache_;
+	DirListCache dirListCache_;
+	NegativeLookupCache negativeLookupCache_;
+
+	// Listings which hold an open folder handle, least recently used first.
+	// The oldest ones are paused beyond maxOpenListings, see touchListing()
+	std::list<std::weak_ptr<encfs::DirTraverse> > openListings_;
+	std::atomic<uint64_t> pausedListings_;
+
+	// See retune(), tuningMutex_ is held while the tuning is applied
+	bool applyTuning(const CacheTuning &tuning);
+	bool setTuning(const CacheTuning &newTuning);
+	boost::mutex tuningMutex_;
+	CacheTuning baseTuning_;	// As configured, cacheTuning_ is the one in effect
+	CacheTuning cacheTuning_;
+	CacheAutoTuner autoTuner_;	// Used with CacheTuning::autoTune_, see autoTune()
+	bool useCaching_;
+	std::atomic<size_t> readAheadBytes_, writeBufferBytes_;
+	std::atomic<int64_t> firstBlockPrefetchBytes_;
+	PFMDispatchPool *dispatchPool_;	// While served by several threads
+
+	// Mounted volumes by mount name, for retune()
+	typedef std::map<std::wstring, PFMLayer *> RegistryType;
+	static RegistryType registry_;
+	static boost::mutex registryMutex_;
+
+	bool watchBackingFolder_;
+	BackingFolderWatcher backingFolderWatcher_;
+
+	// Set before the volume is mounted, read-only afterwards
+	NameMatcher hiddenNames_, skippedNames_;
+
+	ReadAheadWorker readAheadWorker_;
+	CacheTrimmer::Client cacheTrimmer_;
+
+	FormatterStats stats_;
+	OpTrace trace_;
+	boost::filesystem::path traceFile_;
+	ChangeJournal changeJournal_;
+	boost::filesystem::path changeJournalFile_;
+
+	// Set before the volume is mounted, see setUseNameIndex()
+	bool useNameIndex_;
+	NameIndex nameIndex_;
+	boost::thread nameIndexThread_;		// Builds the fresh index after the mount
+	std::atomic<bool> nameIndexStop_;
+
+	// Mount latency for the statistics, in microseconds since the start of startFS()
+	std::chrono::steady_clock::time_point mountStartTime_;
+	std::atomic<uint64_t> mountCreateMicros_;	// Duration of PfmApi::MountCreate
+	std::atomic<uint64_t> firstListMicros_;		// End of the first successful listing
+
+	// Result of the last volume query, see volumeStat()
+	boost::mutex capacityMutex_;
+	int capacityCacheTime_;
+	bool hasCachedCapacity_;
+	std::chrono::steady_clock::time_point capacityTime_;
+	fs_layer::statvfs_fs cachedVolumeStat_;
+	std::atomic<uint64_t> bytesWrittenSinceCapacity_;
 
 	std::wstring mountName_;
+
+	int dispatchThreadCount_;
+	bool useWriteBuffer_;
+	bool readOnly_;		// Set before the volume is mounted, see setReadOnly()
+
+	// Open IDs of the files whose FlushFile was deferred by FPCoalesced, written
+	// out by flusherThread_. Protected by mutex_
+	FlushPolicy flushPolicy_;
+	std::set<int64_t> pendingFlushes_;
+	boost::thread flusherThread_;
+	boost::condition_variable flusherCond_;
+	bool flusherStop_;
+
+	// Open IDs of the folders whose listing is collected into dirListCache_ by
+	// prefetchThread_ after their Open, for the List usually following it.
+	// Protected by mutex_
+	std::deque<int64_t> pendingPrefetches_;
+	boost::thread prefetchThread_;
+	boost::condition_variable prefetchCond_;
+	bool prefetchStop_;
+	std::atomic<uint64_t> prefetchedListings_;
+
+	// Decodes the first block of small files after they were listed, into the
+	// block cache, for the icons and previews Explorer reads next
+	SharedExecutor::Queue firstBlockQueue_;
+	std::atomic<bool> firstBlockStop_;
+	std::atomic<uint64_t> prefetchedFirstBlocks_;
+
+	// Entries deleted by deleteContentsOp()
+	std::atomic<uint64_t> bulkDeletedEntries_;
+
+	// Folders of the last mount not listed yet, see setUseCacheSnapshot().
+	// Protected by mutex_
+	bool useCacheSnapshot_;
+	CacheSnapshot cacheSnapshot_;
+	std::atomic<uint64_t> restoredListings_;
+
+	// Access and reopens answered from the backing file, see refreshOpenFile()
+	std::atomic<uint64_t> refreshedOpenFiles_;
+
+	// Reads of files with a ReadAheadBuffer, and changes of the auto-tuning
+	std::atomic<uint64_t> readAheadHits_, readAheadMisses_;
+	std::atomic<uint64_t> autoTunings_;
+
+	// Files whose Close was completed before their write buffer was written out
+	// and their FileNode released, by finalizerThread_ in the order of closeQueue_.
+	// Anything else using the path finalizes them first. Protected by mutex_
+	typedef std::unordered_map< encfs::InternedPath, std::unique_ptr<OpenFile>, encfs::InternedPathHash > ClosingFileMapType;
+	ClosingFileMapType closingFiles_;
+	std::deque<encfs::InternedPath> closeQueue_;
+	boost::thread finalizerThread_;
+	boost::condition_variable finalizerCond_;
+	bool finalizerStop_;
+
+	// Protects openIdMap_, fileIDs_, dirListCache_, negativeLookupCache_, openListings_ and the contents of the OpenFile
+	// entries when the requests are served by several threads. Inserting into and
+	// erasing from openFileShards_ additionally requires the lock of the shard.
+	boost::mutex mutex_;
 };
 
 #endif